@@ -0,0 +1,466 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff (and other contributing authors)
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file bundle_packer.c
+ * @brief tool to pack a directory tree into a static asset bundle
+ *        for #MHD_bundle_open(), and to serve such a bundle
+ * @author Christian Grothoff
+ *
+ * Usage:
+ *   bundle_packer pack BUNDLE DIRECTORY
+ *   bundle_packer serve BUNDLE PORT
+ *
+ * When packing, a file "NAME.gz" next to a file "NAME" is stored as
+ * the gzip-compressed variant of "NAME" (use "gzip -k -9" to create
+ * them).  See the top of src/microhttpd/bundle.c for the format.
+ */
+
+#include "platform.h"
+#include <dirent.h>
+#include <microhttpd.h>
+#include <unistd.h>
+
+#define PAGE "<html><head><title>File not found</title></head><body>File not found</body></html>"
+
+/**
+ * Size of the bundle header.
+ */
+#define HEADER_SIZE 16
+
+/**
+ * Size of an index entry.
+ */
+#define ENTRY_SIZE 48
+
+
+/**
+ * File to be packed.
+ */
+struct Asset
+{
+  /**
+   * Path in the bundle (URL).
+   */
+  char *path;
+
+  /**
+   * Name of the file on disk.
+   */
+  char *filename;
+
+  /**
+   * Headers for the asset.
+   */
+  char headers[256];
+
+  /**
+   * Size of the file.
+   */
+  uint64_t size;
+
+  /**
+   * Compressed variant, NULL for none.
+   */
+  struct Asset *gzip;
+
+  /**
+   * Non-zero if this is the compressed variant of another asset.
+   */
+  int is_variant;
+};
+
+
+static struct Asset *assets;
+
+static unsigned int num_assets;
+
+static unsigned int max_assets;
+
+
+static const char *
+get_mime_type (const char *path)
+{
+  static const char *const types[] = {
+    ".html", "text/html; charset=utf-8",
+    ".htm", "text/html; charset=utf-8",
+    ".css", "text/css",
+    ".js", "application/javascript",
+    ".json", "application/json",
+    ".xml", "application/xml",
+    ".txt", "text/plain; charset=utf-8",
+    ".svg", "image/svg+xml",
+    ".png", "image/png",
+    ".jpg", "image/jpeg",
+    ".jpeg", "image/jpeg",
+    ".gif", "image/gif",
+    ".ico", "image/x-icon",
+    ".woff", "font/woff",
+    ".woff2", "font/woff2",
+    ".wasm", "application/wasm",
+    NULL, NULL
+  };
+  const char *ext;
+  unsigned int i;
+
+  ext = strrchr (path, '.');
+  if ( (NULL != ext) &&
+       (NULL == strchr (ext, '/')) )
+    for (i = 0; NULL != types[i]; i += 2)
+      if (0 == strcmp (ext, types[i]))
+        return types[i + 1];
+  return "application/octet-stream";
+}
+
+
+static int
+add_asset (const char *path, const char *filename, uint64_t size)
+{
+  struct Asset *a;
+
+  if (num_assets == max_assets)
+    {
+      max_assets = (0 == max_assets) ? 64 : max_assets * 2;
+      assets = realloc (assets, max_assets * sizeof (struct Asset));
+      if (NULL == assets)
+        return 1;
+    }
+  a = &assets[num_assets++];
+  memset (a, 0, sizeof (struct Asset));
+  a->path = strdup (path);
+  a->filename = strdup (filename);
+  a->size = size;
+  if ( (NULL == a->path) || (NULL == a->filename) )
+    return 1;
+  return 0;
+}
+
+
+static int
+scan_directory (const char *dirname, const char *prefix)
+{
+  DIR *dir;
+  struct dirent *de;
+  struct stat buf;
+  char filename[1024];
+  char path[1024];
+  int ret = 0;
+
+  dir = opendir (dirname);
+  if (NULL == dir)
+    {
+      fprintf (stderr, "Failed to open directory `%s'\n", dirname);
+      return 1;
+    }
+  while ( (0 == ret) && (NULL != (de = readdir (dir))) )
+    {
+      if ('.' == de->d_name[0])
+        continue;               /* skip ".", ".." and hidden files */
+      if ( (sizeof (filename) <= (size_t) snprintf (filename, sizeof (filename),
+                                                    "%s/%s", dirname, de->d_name)) ||
+           (sizeof (path) <= (size_t) snprintf (path, sizeof (path),
+                                                "%s/%s", prefix, de->d_name)) ||
+           (0 != stat (filename, &buf)) )
+        {
+          ret = 1;
+          break;
+        }
+      if (S_ISDIR (buf.st_mode))
+        ret = scan_directory (filename, path);
+      else if (S_ISREG (buf.st_mode))
+        ret = add_asset (path, filename, (uint64_t) buf.st_size);
+    }
+  closedir (dir);
+  return ret;
+}
+
+
+static int
+compare_assets (const void *a, const void *b)
+{
+  return strcmp (((const struct Asset *) a)->path,
+                 ((const struct Asset *) b)->path);
+}
+
+
+static struct Asset *
+find_asset (const char *path)
+{
+  struct Asset key;
+
+  key.path = (char *) path;
+  return bsearch (&key, assets, num_assets, sizeof (struct Asset), &compare_assets);
+}
+
+
+static void
+put_u32 (unsigned char *p, uint32_t v)
+{
+  p[0] = (unsigned char) v;
+  p[1] = (unsigned char) (v >> 8);
+  p[2] = (unsigned char) (v >> 16);
+  p[3] = (unsigned char) (v >> 24);
+}
+
+
+static void
+put_u64 (unsigned char *p, uint64_t v)
+{
+  put_u32 (p, (uint32_t) v);
+  put_u32 (&p[4], (uint32_t) (v >> 32));
+}
+
+
+/**
+ * Hash the contents of a file (FNV-1a), for use in the ETag.
+ */
+static int
+hash_file (const char *filename, uint64_t *hash)
+{
+  unsigned char buf[4096];
+  FILE *f;
+  size_t n;
+  size_t i;
+  uint64_t h = 14695981039346656037ULL;
+
+  f = fopen (filename, "rb");
+  if (NULL == f)
+    return 1;
+  while (0 < (n = fread (buf, 1, sizeof (buf), f)))
+    for (i = 0; i < n; i++)
+      {
+        h ^= buf[i];
+        h *= 1099511628211ULL;
+      }
+  fclose (f);
+  *hash = h;
+  return 0;
+}
+
+
+static int
+copy_file (FILE *out, const char *filename, uint64_t size)
+{
+  char buf[4096];
+  FILE *f;
+  size_t n;
+  uint64_t total = 0;
+
+  f = fopen (filename, "rb");
+  if (NULL == f)
+    return 1;
+  while (0 < (n = fread (buf, 1, sizeof (buf), f)))
+    {
+      if (n != fwrite (buf, 1, n, out))
+        break;
+      total += n;
+    }
+  fclose (f);
+  return (total == size) ? 0 : 1;
+}
+
+
+static int
+pack (const char *bundle, const char *dirname)
+{
+  unsigned char entry[ENTRY_SIZE];
+  unsigned char header[HEADER_SIZE];
+  struct Asset *a;
+  struct Asset *plain;
+  FILE *out;
+  uint64_t hash;
+  uint64_t off;
+  uint64_t str_off;
+  unsigned int count;
+  unsigned int i;
+  char *base;
+
+  if (0 != scan_directory (dirname, ""))
+    return 1;
+  qsort (assets, num_assets, sizeof (struct Asset), &compare_assets);
+  /* attach "NAME.gz" as the compressed variant of "NAME" */
+  for (i = 0; i < num_assets; i++)
+    {
+      a = &assets[i];
+      if ( (strlen (a->path) <= 3) ||
+           (0 != strcmp (&a->path[strlen (a->path) - 3], ".gz")) )
+        continue;
+      base = strdup (a->path);
+      if (NULL == base)
+        return 1;
+      base[strlen (base) - 3] = '\0';
+      plain = find_asset (base);
+      free (base);
+      if (NULL == plain)
+        continue;
+      plain->gzip = a;
+      a->is_variant = 1;
+    }
+  count = 0;
+  for (i = 0; i < num_assets; i++)
+    {
+      a = &assets[i];
+      if (a->is_variant)
+        continue;
+      count++;
+      if (0 != hash_file (a->filename, &hash))
+        return 1;
+      snprintf (a->headers, sizeof (a->headers),
+                "%s: %s\r\n%s: \"%016llx\"\r\n",
+                MHD_HTTP_HEADER_CONTENT_TYPE, get_mime_type (a->path),
+                MHD_HTTP_HEADER_ETAG, (unsigned long long) hash);
+    }
+
+  out = fopen (bundle, "wb");
+  if (NULL == out)
+    return 1;
+  memcpy (header, "MHDBNDL", 8);
+  put_u32 (&header[8], 1);
+  put_u32 (&header[12], count);
+  fwrite (header, 1, sizeof (header), out);
+  /* strings go after the index, data after the strings */
+  str_off = HEADER_SIZE + (uint64_t) count * ENTRY_SIZE;
+  off = str_off;
+  for (i = 0; i < num_assets; i++)
+    if (! assets[i].is_variant)
+      off += strlen (assets[i].path) + strlen (assets[i].headers);
+  for (i = 0; i < num_assets; i++)
+    {
+      a = &assets[i];
+      if (a->is_variant)
+        continue;
+      memset (entry, 0, sizeof (entry));
+      put_u32 (&entry[0], (uint32_t) str_off);
+      put_u32 (&entry[4], (uint32_t) strlen (a->path));
+      str_off += strlen (a->path);
+      put_u32 (&entry[8], (uint32_t) str_off);
+      put_u32 (&entry[12], (uint32_t) strlen (a->headers));
+      str_off += strlen (a->headers);
+      put_u64 (&entry[16], off);
+      put_u64 (&entry[24], a->size);
+      off += a->size;
+      if (NULL != a->gzip)
+        {
+          put_u64 (&entry[32], off);
+          put_u64 (&entry[40], a->gzip->size);
+          off += a->gzip->size;
+        }
+      fwrite (entry, 1, sizeof (entry), out);
+    }
+  for (i = 0; i < num_assets; i++)
+    if (! assets[i].is_variant)
+      {
+        fputs (assets[i].path, out);
+        fputs (assets[i].headers, out);
+      }
+  for (i = 0; i < num_assets; i++)
+    {
+      a = &assets[i];
+      if (a->is_variant)
+        continue;
+      if ( (0 != copy_file (out, a->filename, a->size)) ||
+           ( (NULL != a->gzip) &&
+             (0 != copy_file (out, a->gzip->filename, a->gzip->size)) ) )
+        {
+          fprintf (stderr, "Failed to copy `%s'\n", a->filename);
+          fclose (out);
+          return 1;
+        }
+    }
+  if (0 != fclose (out))
+    return 1;
+  printf ("Packed %u assets into `%s'\n", count, bundle);
+  return 0;
+}
+
+
+static int
+ahc_bundle (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size, void **ptr)
+{
+  struct MHD_Bundle *bundle = cls;
+  struct MHD_Response *response;
+  int ret;
+
+  if ( (0 != strcmp (method, MHD_HTTP_METHOD_GET)) &&
+       (0 != strcmp (method, MHD_HTTP_METHOD_HEAD)) )
+    return MHD_NO;              /* unexpected method */
+  response = MHD_bundle_lookup (bundle,
+                                url,
+                                MHD_lookup_connection_value (connection,
+                                                             MHD_HEADER_KIND,
+                                                             MHD_HTTP_HEADER_ACCEPT_ENCODING));
+  if (NULL == response)
+    {
+      response = MHD_create_response_from_buffer (strlen (PAGE),
+                                                  (void *) PAGE,
+                                                  MHD_RESPMEM_PERSISTENT);
+      ret = MHD_queue_response (connection, MHD_HTTP_NOT_FOUND, response);
+    }
+  else
+    ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static int
+serve (const char *filename, const char *port)
+{
+  struct MHD_Bundle *bundle;
+  struct MHD_Daemon *d;
+
+  bundle = MHD_bundle_open (filename);
+  if (NULL == bundle)
+    {
+      fprintf (stderr, "Failed to open bundle `%s'\n", filename);
+      return 1;
+    }
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        atoi (port),
+                        NULL, NULL, &ahc_bundle, bundle, MHD_OPTION_END);
+  if (NULL == d)
+    {
+      MHD_bundle_close (bundle);
+      return 1;
+    }
+  (void) getc (stdin);
+  MHD_stop_daemon (d);
+  MHD_bundle_close (bundle);
+  return 0;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  if ( (4 == argc) && (0 == strcmp (argv[1], "pack")) )
+    return pack (argv[2], argv[3]);
+  if ( (4 == argc) && (0 == strcmp (argv[1], "serve")) )
+    return serve (argv[2], argv[3]);
+  printf ("%s pack BUNDLE DIRECTORY\n"
+          "%s serve BUNDLE PORT\n",
+          argv[0], argv[0]);
+  return 1;
+}
@@ -456,6 +456,7 @@ MHD_get_reason_phrase_for (unsigned int code);
  */
 #define MHD_HTTP_VERSION_1_0 "HTTP/1.0"
 #define MHD_HTTP_VERSION_1_1 "HTTP/1.1"
+#define MHD_HTTP_VERSION_2_0 "HTTP/2.0"
 
 /** @} */ /* end of group versions */
 
@@ -483,6 +484,7 @@ MHD_get_reason_phrase_for (unsigned int code);
  */
 #define MHD_HTTP_POST_ENCODING_FORM_URLENCODED "application/x-www-form-urlencoded"
 #define MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA "multipart/form-data"
+#define MHD_HTTP_POST_ENCODING_JSON "application/json"
 
 /** @} */ /* end of group postenc */
 
@@ -664,7 +666,26 @@ enum MHD_FLAG
    * kernel >= 3.6.  On other systems, using this option cases #MHD_start_daemon
    * to fail.
    */
-  MHD_USE_TCP_FASTOPEN = 16384
+  MHD_USE_TCP_FASTOPEN = 16384,
+
+  /**
+   * Allow connections to be taken over by other protocols with
+   * responses created by #MHD_create_response_for_upgrade().  Implies
+   * #MHD_USE_SUSPEND_RESUME and thus cannot be combined with
+   * #MHD_USE_THREAD_PER_CONNECTION.
+   */
+  MHD_ALLOW_UPGRADE = 32768 | MHD_USE_SUSPEND_RESUME,
+
+  /**
+   * Speak HTTP/2 with clients that support it: negotiated via ALPN
+   * with #MHD_USE_SSL, and via "prior knowledge" or an "h2c"
+   * upgrade (of requests without body) otherwise.  Each stream is
+   * passed to the #MHD_AccessHandlerCallback as a connection of its
+   * own with version #MHD_HTTP_VERSION_2_0.  Implies
+   * #MHD_USE_SUSPEND_RESUME, as streams may be suspended (but not
+   * the connection carrying them).
+   */
+  MHD_USE_HTTP2 = 65536 | MHD_USE_SUSPEND_RESUME
 
 };
 
@@ -797,13 +818,16 @@ enum MHD_OPTION
   /**
    * Daemon credentials type.
    * Followed by an argument of type
-   * `gnutls_credentials_type_t`.
+   * `gnutls_credentials_type_t`.  Only `GNUTLS_CRD_CERTIFICATE`
+   * (the default) is supported.
    */
   MHD_OPTION_HTTPS_CRED_TYPE = 10,
 
   /**
    * Memory pointer to a `const char *` specifying the
-   * cipher algorithm (default: "NORMAL").
+   * cipher algorithm (default: "NORMAL").  If MHD was built
+   * with OpenSSL (see `--with-tls` of configure), this is an
+   * OpenSSL cipher list instead (default: the one of OpenSSL).
    */
   MHD_OPTION_HTTPS_PRIORITIES = 11,
 
@@ -928,7 +952,8 @@ enum MHD_OPTION
    * the callback is expected to select the correct certificate
    * based on the SNI information provided.  The callback is expected
    * to access the SNI data using `gnutls_server_name_get()`.
-   * Using this option requires GnuTLS 3.0 or higher.
+   * Using this option requires GnuTLS 3.0 or higher (it is not
+   * available if MHD was built with OpenSSL).
    */
   MHD_OPTION_HTTPS_CERT_CALLBACK = 22,
 
@@ -983,7 +1008,157 @@ enum MHD_OPTION
    * value is used. This option should be followed by an `unsigned int`
    * argument.
    */
-  MHD_OPTION_LISTEN_BACKLOG_SIZE = 28
+  MHD_OPTION_LISTEN_BACKLOG_SIZE = 28,
+
+  /**
+   * Enable a cache of the responses produced by the access handler
+   * for "GET" and "HEAD" requests.  Responses are cached by method,
+   * "Host" header, URL, GET arguments and the headers given with
+   * #MHD_OPTION_RESPONSE_CACHE_VARY, and requests with the same key
+   * are answered from the cache (without calling the access handler)
+   * for the given number of seconds.  Only responses created from a
+   * buffer or a file descriptor with a cacheable status code (200,
+   * 203, 204, 300, 301, 404, 405, 410, 414 and 501) are cached;
+   * responses with a "Set-Cookie" header, a "Cache-Control" header
+   * with "no-store", "no-cache" or "private", or a "Vary" header that
+   * is "*" or names a header that is not part of the key are not.
+   * Requests with an "Authorization" header are never answered from
+   * the cache, and neither are requests with a "Cookie" header unless
+   * "Cookie" is given with #MHD_OPTION_RESPONSE_CACHE_VARY.
+   *
+   * If #MHD_USE_SUSPEND_RESUME is set, concurrent requests with a key
+   * that is not yet cached are coalesced: only one of them is passed
+   * to the access handler, while the others are suspended until its
+   * response is available.  Applications must thus not rely on the
+   * access handler being called for every request.
+   *
+   * This option should be followed by an `unsigned int` argument
+   * (number of seconds, 0 disables the cache, which is the default).
+   */
+  MHD_OPTION_RESPONSE_CACHE_TTL = 29,
+
+  /**
+   * Maximum number of entries in the cache enabled with
+   * #MHD_OPTION_RESPONSE_CACHE_TTL.  The least recently used entry is
+   * evicted when the cache is full.  This option should be followed
+   * by an `unsigned int` argument (default: 128).
+   */
+  MHD_OPTION_RESPONSE_CACHE_SIZE = 30,
+
+  /**
+   * Comma-separated list of request headers whose values are part of
+   * the key of the cache enabled with #MHD_OPTION_RESPONSE_CACHE_TTL
+   * (for example, "Accept-Encoding, Accept-Language").  The string
+   * must remain valid until #MHD_start_daemon() returns.  This option
+   * should be followed by a `const char *` argument.
+   */
+  MHD_OPTION_RESPONSE_CACHE_VARY = 31,
+
+  /**
+   * Dispatch requests to the handlers registered with a router
+   * (see #MHD_router_create).  Requests for which no route matches
+   * are passed to the default handler given to #MHD_start_daemon.
+   * The router must not be destroyed before the daemon is stopped.
+   * This option should be followed by a `struct MHD_Router *`
+   * argument.
+   */
+  MHD_OPTION_ROUTER = 32,
+
+  /**
+   * Interval at which MHD sends pings on idle WebSockets (see
+   * #MHD_create_response_for_websocket).  WebSockets that do not
+   * answer within another interval are closed.  This option should
+   * be followed by an `unsigned int` argument (number of seconds,
+   * 0 disables keepalives; default: 30).
+   */
+  MHD_OPTION_WEBSOCKET_PING_INTERVAL = 33,
+
+  /**
+   * Maximum number of bytes of frames that may be queued on a
+   * WebSocket and not yet passed to the OS; #MHD_websocket_send()
+   * fails for WebSockets that fall further behind.  This option
+   * should be followed by a `size_t` argument (0 for no limit,
+   * which is the default).
+   */
+  MHD_OPTION_WEBSOCKET_MAX_PENDING = 34,
+
+  /**
+   * Maximum number of concurrent streams a client may open on an
+   * HTTP/2 connection (see #MHD_USE_HTTP2).  This option should be
+   * followed by an `unsigned int` argument (default: 100).
+   */
+  MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS = 35,
+
+  /**
+   * Maximum number of idle keep-alive connections to upstream
+   * servers that a daemon (each thread of a thread pool) keeps for
+   * reuse by later proxied requests (see
+   * #MHD_create_response_for_proxy).  This option should be followed
+   * by an `unsigned int` argument (0 disables reuse; default: 16).
+   */
+  MHD_OPTION_PROXY_POOL_SIZE = 36,
+
+  /**
+   * Enable a cache of basic authentication credentials that the
+   * application verified (see #MHD_basic_auth_cache_verified and
+   * #MHD_basic_auth_check_cached), so that slow password checks are
+   * not repeated for every request of a client.  Only keyed hashes
+   * of the "Authorization" header are kept.  Credentials are
+   * remembered for the given time even if the password is changed in
+   * the meantime.  This option should be followed by an `unsigned
+   * int` argument (number of seconds, 0 disables the cache, which is
+   * the default).
+   */
+  MHD_OPTION_BASIC_AUTH_CACHE_TTL = 37,
+
+  /**
+   * Maximum number of credentials in the cache enabled with
+   * #MHD_OPTION_BASIC_AUTH_CACHE_TTL.  The least recently used ones
+   * are evicted when the cache is full.  This option should be
+   * followed by an `unsigned int` argument (default: 1024).
+   */
+  MHD_OPTION_BASIC_AUTH_CACHE_SIZE = 38,
+
+  /**
+   * Keep the parameters of up to the given number of TLS sessions so
+   * that clients can resume them (by session ID) with an abbreviated
+   * handshake.  The cache is shared by all threads of a thread pool.
+   * This option should be followed by an `unsigned int` argument
+   * (0 disables the cache, which is the default).
+   */
+  MHD_OPTION_HTTPS_SESSION_CACHE_SIZE = 39,
+
+  /**
+   * Allow clients to resume TLS sessions with session tickets (RFC
+   * 5077 and the tickets of TLS 1.3).  The key protecting the tickets
+   * is generated when the daemon starts, is shared by all threads of
+   * a thread pool and is rotated every
+   * #MHD_OPTION_HTTPS_SESSION_TIMEOUT.  This option should be followed
+   * by an `unsigned int` argument (#MHD_YES to enable tickets; the
+   * default is #MHD_NO).
+   */
+  MHD_OPTION_HTTPS_SESSION_TICKETS = 40,
+
+  /**
+   * Number of seconds TLS sessions can be resumed, both from the
+   * cache (#MHD_OPTION_HTTPS_SESSION_CACHE_SIZE) and with tickets
+   * (#MHD_OPTION_HTTPS_SESSION_TICKETS).  This option should be
+   * followed by an `unsigned int` argument (default: 3600).
+   */
+  MHD_OPTION_HTTPS_SESSION_TIMEOUT = 41,
+
+  /**
+   * Run the TLS handshakes of new connections on this many separate
+   * threads instead of on the thread that accepted the connection,
+   * so that a burst of new clients does not delay the requests of
+   * established connections.  Once its handshake is done, a
+   * connection is handed back to the thread that accepted it.
+   * Requires #MHD_USE_SSL and #MHD_USE_SUSPEND_RESUME (new
+   * connections are suspended during the handshake).  This option
+   * should be followed by an `unsigned int` argument (0 runs the
+   * handshakes on the threads of the daemon, which is the default).
+   */
+  MHD_OPTION_HTTPS_HANDSHAKE_THREADS = 42
 };
 
 
@@ -1055,7 +1230,13 @@ enum MHD_ValueKind
   /**
    * HTTP footer (only for HTTP 1.1 chunked encodings).
    */
-  MHD_FOOTER_KIND = 16
+  MHD_FOOTER_KIND = 16,
+
+  /**
+   * Values of the parameters in the path pattern of the route
+   * matching the request (see #MHD_router_add).
+   */
+  MHD_ROUTE_ARGUMENT_KIND = 32
 };
 
 
@@ -1199,14 +1380,16 @@ enum MHD_ConnectionInfoType
 {
   /**
    * What cipher algorithm is being used.
-   * Takes no extra arguments.
+   * Takes no extra arguments.  Not available if MHD was built
+   * with OpenSSL.
    * @ingroup request
    */
   MHD_CONNECTION_INFO_CIPHER_ALGO,
 
   /**
-   *
-   * Takes no extra arguments.
+   * What version of TLS is being used.
+   * Takes no extra arguments.  Not available if MHD was built
+   * with OpenSSL.
    * @ingroup request
    */
   MHD_CONNECTION_INFO_PROTOCOL,
@@ -1221,7 +1404,8 @@ enum MHD_ConnectionInfoType
   MHD_CONNECTION_INFO_CLIENT_ADDRESS,
 
   /**
-   * Get the gnuTLS session handle.
+   * Get the gnuTLS session handle.  NULL if MHD was built with
+   * OpenSSL instead of GnuTLS.
    * @ingroup request
    */
   MHD_CONNECTION_INFO_GNUTLS_SESSION,
@@ -1656,6 +1840,189 @@ MHD_add_connection (struct MHD_Daemon *daemon,
 		    socklen_t addrlen);
 
 
+/**
+ * How a transport should shut down its connection.
+ * @ingroup specialized
+ */
+enum MHD_TransportShutdown
+{
+
+  /**
+   * No more data will be sent (like `SHUT_WR`).
+   */
+  MHD_TRANSPORT_SHUTDOWN_WRITE = 1,
+
+  /**
+   * No more data will be sent or received (like `SHUT_RDWR`).  Used
+   * when the daemon stops; the readiness descriptor of the connection
+   * must become readable afterwards.
+   */
+  MHD_TRANSPORT_SHUTDOWN_BOTH = 2
+
+};
+
+
+/**
+ * Receive data for a connection from a custom transport.
+ *
+ * @param cls closure given to #MHD_add_connection_with_transport()
+ * @param buf where to store the data
+ * @param size number of bytes available in @a buf
+ * @return number of bytes received, 0 if the client
+ *         closed the connection, -1 on error with `errno`
+ *         set (`EAGAIN` if no data is available right now)
+ * @ingroup specialized
+ */
+typedef ssize_t
+(*MHD_TransportRecvCallback) (void *cls,
+                              void *buf,
+                              size_t size);
+
+
+/**
+ * Send data of a connection over a custom transport.
+ *
+ * @param cls closure given to #MHD_add_connection_with_transport()
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, -1 on error with `errno`
+ *         set (`EAGAIN` if no data can be sent right now)
+ * @ingroup specialized
+ */
+typedef ssize_t
+(*MHD_TransportSendCallback) (void *cls,
+                              const void *buf,
+                              size_t size);
+
+
+/**
+ * Send data from a file of a connection over a custom transport
+ * (like `sendfile()`).  Used for responses created with
+ * #MHD_create_response_from_fd() and friends.
+ *
+ * @param cls closure given to #MHD_add_connection_with_transport()
+ * @param fd file to send data from
+ * @param offset offset in @a fd of the data to send
+ * @param size number of bytes to send
+ * @return number of bytes sent, -1 on error with `errno`
+ *         set (`EAGAIN` if no data can be sent right now)
+ * @ingroup specialized
+ */
+typedef ssize_t
+(*MHD_TransportSendfileCallback) (void *cls,
+                                  int fd,
+                                  uint64_t offset,
+                                  size_t size);
+
+
+/**
+ * Shut down a connection of a custom transport.
+ *
+ * @param cls closure given to #MHD_add_connection_with_transport()
+ * @param how what to shut down
+ * @ingroup specialized
+ */
+typedef void
+(*MHD_TransportShutdownCallback) (void *cls,
+                                  enum MHD_TransportShutdown how);
+
+
+/**
+ * Close a connection of a custom transport.  Called exactly once,
+ * after which MHD no longer uses the connection or its readiness
+ * descriptor.
+ *
+ * @param cls closure given to #MHD_add_connection_with_transport()
+ * @ingroup specialized
+ */
+typedef void
+(*MHD_TransportCloseCallback) (void *cls);
+
+
+/**
+ * Functions MHD uses instead of the socket API for a connection
+ * added with #MHD_add_connection_with_transport().
+ * @ingroup specialized
+ */
+struct MHD_Transport
+{
+
+  /**
+   * Receive data, must not be NULL.
+   */
+  MHD_TransportRecvCallback recv;
+
+  /**
+   * Send data, must not be NULL.
+   */
+  MHD_TransportSendCallback send;
+
+  /**
+   * Send data from a file, NULL to have MHD read the file and
+   * use @e send.
+   */
+  MHD_TransportSendfileCallback sendfile;
+
+  /**
+   * Shut down the connection, may be NULL.
+   */
+  MHD_TransportShutdownCallback shutdown;
+
+  /**
+   * Close the connection, must not be NULL.
+   */
+  MHD_TransportCloseCallback close;
+
+};
+
+
+/**
+ * Add a client connection that uses a custom transport instead of
+ * a socket to the set of connections managed by MHD, for example
+ * in-process memory rings or a user-space TCP stack.  HTTP (and,
+ * with #MHD_USE_SSL, TLS) are run over the functions of @a transport
+ * just like they are run over a socket otherwise.
+ *
+ * The event loop of the daemon learns about the readiness of the
+ * transport from @a ready_fd, which is used in place of the socket
+ * of the connection for `select()`, `poll()` and `epoll`: the
+ * transport must keep it readable while data can be received (or
+ * the connection was shut down), and writable while data can be
+ * sent.  MHD never reads from, writes to or closes @a ready_fd;
+ * for example, a transport can use one end of a socket pair that
+ * is written to whenever data arrives, and drain it in its receive
+ * function.  With #MHD_USE_EPOLL_LINUX_ONLY, the readiness
+ * descriptor is used edge-triggered.
+ *
+ * Upgrading connections of a custom transport to other protocols
+ * with #MHD_create_response_for_upgrade() is only supported with
+ * #MHD_USE_SSL, as MHD cannot hand a socket to the application
+ * otherwise.  The same remarks as for #MHD_add_connection() apply.
+ *
+ * @param daemon daemon that manages the connection
+ * @param ready_fd descriptor signalling the readiness of the transport
+ * @param addr address of the client (used for logging and
+ *        the access policy)
+ * @param addrlen number of bytes in @a addr
+ * @param transport functions to use for the connection, copied
+ * @param transport_cls closure for the functions of @a transport
+ * @return #MHD_YES on success, #MHD_NO if this daemon could
+ *        not handle the connection (i.e. `malloc()` failed, etc).
+ *        The connection will be closed with the close function of
+ *        @a transport in any case, unless @a transport lacks one
+ *        of its mandatory functions; `errno` is set to indicate
+ *        further details about the error.
+ * @ingroup specialized
+ */
+_MHD_EXTERN int
+MHD_add_connection_with_transport (struct MHD_Daemon *daemon,
+                                   MHD_socket ready_fd,
+                                   const struct sockaddr *addr,
+                                   socklen_t addrlen,
+                                   const struct MHD_Transport *transport,
+                                   void *transport_cls);
+
+
 /**
  * Obtain the `select()` sets for this daemon.
  * Daemon's FDs will be added to fd_sets. To get only
@@ -1996,7 +2363,20 @@ enum MHD_ResponseFlags
    * do not (automatically) sent "Connection" headers and always
    * close the connection after generating the response.
    */
-  MHD_RF_HTTP_VERSION_1_0_ONLY = 1
+  MHD_RF_HTTP_VERSION_1_0_ONLY = 1,
+
+  /**
+   * Compress the response body using the "gzip" or "deflate"
+   * content coding if the client allows it (see "Accept-Encoding").
+   * Buffer responses are compressed only once, the compressed data
+   * is kept with the response; the output of callback responses is
+   * compressed on the fly and transmitted with chunked encoding.
+   * Responses that already have a "Content-Encoding" header and
+   * tiny responses are not compressed.  A "Vary: Accept-Encoding"
+   * header is added to the response.  Ignored if MHD was built
+   * without zlib; see ::MHD_FEATURE_COMPRESSION.
+   */
+  MHD_RF_COMPRESS = 2
 
 };
 
@@ -2211,12 +2591,9 @@ MHD_create_response_from_fd_at_offset64 (uint64_t size,
                                          uint64_t offset);
 
 
-#if 0
 /**
  * Enumeration for actions MHD should perform on the underlying socket
- * of the upgrade.  This API is not finalized, and in particular
- * the final set of actions is yet to be decided. This is just an
- * idea for what we might want.
+ * of the upgrade.
  */
 enum MHD_UpgradeAction
 {
@@ -2225,22 +2602,24 @@ enum MHD_UpgradeAction
    * Close the socket, the application is done with it.
    *
    * Takes no extra arguments.
-   *
-   * NOTE: it is unclear if we want to have this in the
-   * "final" API, this is all just ideas.
    */
   MHD_UPGRADE_ACTION_CLOSE = 0,
 
+  /**
+   * Enable CORKing on the underlying TCP socket (that is, tell the OS
+   * to only transmit full packets until the socket is uncorked).
+   *
+   * Takes no extra arguments.
+   */
+  MHD_UPGRADE_ACTION_CORK = 1,
+
   /**
    * Uncork the TCP write buffer (that is, tell the OS to transmit all
    * bytes in the buffer now, and to not use TCP-CORKing).
    *
    * Takes no extra arguments.
-   *
-   * NOTE: it is unclear if we want to have this in the
-   * "final" API, this is all just ideas.
    */
-  MHD_UPGRADE_ACTION_CORK
+  MHD_UPGRADE_ACTION_UNCORK = 2
 
 };
 
@@ -2266,25 +2645,18 @@ typedef int
  * successfully and the socket should now be controlled by some
  * protocol other than HTTP.
  *
- * Any data received on the socket will be made available in
- * 'data_in'.  The function should update 'data_in_size' to
- * reflect the number of bytes consumed from 'data_in' (the remaining
- * bytes will be made available in the next call to the handler).
- *
- * Any data that should be transmitted on the socket should be
- * stored in 'data_out'.  '*data_out_size' is initially set to
- * the available buffer space in 'data_out'.  It should be set to
- * the number of bytes stored in 'data_out' (which can be zero).
- *
- * The return value is a BITMASK that indicates how the function
- * intends to interact with the event loop.  It can request to be
- * notified for reading, writing, request to UNCORK the send buffer
- * (which MHD is allowed to ignore, if it is not possible to uncork on
- * the local platform), to wait for the 'external' select loop to
- * trigger another round.  It is also possible to specify "no events"
- * to terminate the connection; in this case, the
- * #MHD_RequestCompletedCallback will be called and all resources of
- * the connection will be released.
+ * Any data the client sent after the request and that MHD already
+ * received is passed in @a extra_in; the application must process
+ * these bytes as if they had been read from @a sock, before any
+ * data that is read from @a sock.
+ *
+ * The application may use @a sock from any thread, and it remains
+ * valid until the application performs the #MHD_UPGRADE_ACTION_CLOSE
+ * action; the application must not call `close()` on @a sock itself.
+ * The #MHD_RequestCompletedCallback is only called after the
+ * #MHD_UPGRADE_ACTION_CLOSE action was performed.  Like suspended
+ * connections, all upgraded connections must be closed before
+ * #MHD_stop_daemon() is called.
  *
  * Except when in 'thread-per-connection' mode, implementations
  * of this function should never block (as it will still be called
@@ -2293,7 +2665,13 @@ typedef int
  * @param cls closure
  * @param connection original HTTP connection handle,
  *                   giving the function a last chance
- *                   to inspect the original HTTP request
+ *                   to inspect the original HTTP request;
+ *                   the request data must not be used after
+ *                   this function returns
+ * @param con_cls value as set by the last call to the
+ *                #MHD_AccessHandlerCallback for the request
+ * @param extra_in data the client already sent after the request
+ * @param extra_in_size number of bytes in @a extra_in
  * @param sock socket to use for bi-directional communication
  *        with the client.  For HTTPS, this may not be a socket
  *        that is directly connected to the client and thus certain
@@ -2309,7 +2687,10 @@ typedef int
 typedef void
 (*MHD_UpgradeHandler)(void *cls,
                       struct MHD_Connection *connection,
-                      MHD_SOCKET sock,
+                      void *con_cls,
+                      const char *extra_in,
+                      size_t extra_in_size,
+                      MHD_socket sock,
                       MHD_UpgradeActionCallback upgrade_action,
                       void *upgrade_action_cls);
 
@@ -2339,14 +2720,19 @@ typedef void
  * information and then be used any number of times (as long as the
  * header information is not connection-specific).
  *
+ * The daemon must have been started with #MHD_ALLOW_UPGRADE, and
+ * the response can only be queued with status code
+ * #MHD_HTTP_SWITCHING_PROTOCOLS for HTTP/1.1 requests.  Upgrading
+ * HTTPS connections is not supported with #MHD_USE_EPOLL_LINUX_ONLY.
+ *
  * @param upgrade_handler function to call with the 'upgraded' socket
  * @param upgrade_handler_cls closure for @a upgrade_handler
  * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
  */
-struct MHD_Response *
+_MHD_EXTERN struct MHD_Response *
 MHD_create_response_for_upgrade (MHD_UpgradeHandler upgrade_handler,
 				 void *upgrade_handler_cls);
-#endif
 
 /**
  * Destroy a response object and associated resources.  Note that
@@ -2435,126 +2821,978 @@ MHD_get_response_header (struct MHD_Response *response,
 			 const char *key);
 
 
-/* ********************** PostProcessor functions ********************** */
+/* ********************** URL router functions ********************** */
 
 /**
- * Create a `struct MHD_PostProcessor`.
- *
- * A `struct MHD_PostProcessor` can be used to (incrementally) parse
- * the data portion of a POST request.  Note that some buggy browsers
- * fail to set the encoding type.  If you want to support those, you
- * may have to call #MHD_set_connection_value with the proper encoding
- * type before creating a post processor (if no supported encoding
- * type is set, this function will fail).
- *
- * @param connection the connection on which the POST is
- *        happening (used to determine the POST format)
- * @param buffer_size maximum number of bytes to use for
- *        internal buffering (used only for the parsing,
- *        specifically the parsing of the keys).  A
- *        tiny value (256-1024) should be sufficient.
- *        Do NOT use a value smaller than 256.  For good
- *        performance, use 32 or 64k (i.e. 65536).
- * @param iter iterator to be called with the parsed data,
- *        Must NOT be NULL.
- * @param iter_cls first argument to @a iter
- * @return NULL on error (out of memory, unsupported encoding),
- *         otherwise a PP handle
- * @ingroup request
+ * Handle for a router that dispatches requests to handlers by method
+ * and URL.
  */
-_MHD_EXTERN struct MHD_PostProcessor *
-MHD_create_post_processor (struct MHD_Connection *connection,
-			   size_t buffer_size,
-			   MHD_PostDataIterator iter, void *iter_cls);
+struct MHD_Router;
 
 
 /**
- * Parse and process POST data.  Call this function when POST data is
- * available (usually during an #MHD_AccessHandlerCallback) with the
- * "upload_data" and "upload_data_size".  Whenever possible, this will
- * then cause calls to the #MHD_PostDataIterator.
+ * Create a router.  Routes are added with #MHD_router_add and the
+ * router is given to #MHD_start_daemon with #MHD_OPTION_ROUTER.
  *
- * @param pp the post processor
- * @param post_data @a post_data_len bytes of POST data
- * @param post_data_len length of @a post_data
- * @return #MHD_YES on success, #MHD_NO on error
- *         (out-of-memory, iterator aborted, parse error)
- * @ingroup request
+ * @return NULL on error (out of memory)
+ * @ingroup specialized
  */
-_MHD_EXTERN int
-MHD_post_process (struct MHD_PostProcessor *pp,
-                  const char *post_data, size_t post_data_len);
+_MHD_EXTERN struct MHD_Router *
+MHD_router_create (void);
 
 
 /**
- * Release PostProcessor resources.
+ * Register a handler for requests with the given method and a URL
+ * matching the given pattern.  Patterns are URL paths in which a
+ * segment of the form ":name" matches any non-empty path segment,
+ * and a final segment of the form "*name" matches the remainder of
+ * the path (which may be empty).  For example, "/users/:id" matches
+ * "/users/42" with "id" set to "42", and "/files/" followed by
+ * "*path" matches "/files/a/b" with "path" set to "a/b".  The
+ * matched values are available to the handler as
+ * #MHD_ROUTE_ARGUMENT_KIND values.  Static segments take
+ * precedence over parameters, and parameters over wildcards.
+ * "HEAD" requests use the route for "GET" unless a route for
+ * "HEAD" exists.
  *
- * @param pp the PostProcessor to destroy
- * @return #MHD_YES if processing completed nicely,
- *         #MHD_NO if there were spurious characters / formatting
- *                problems; it is common to ignore the return
- *                value of this function
- * @ingroup request
+ * The routes are compiled into a radix trie when the first daemon
+ * using the router is started; no routes can be added afterwards.
+ * Matching is done once per request, against the (unescaped) URL
+ * without the query string.
+ *
+ * @param router router to add the route to
+ * @param method method of the requests (i.e. #MHD_HTTP_METHOD_GET),
+ *        NULL for requests with any method
+ * @param pattern pattern for the URL, must start with '/'
+ * @param handler handler to call for matching requests
+ * @param handler_cls closure for @a handler
+ * @return #MHD_YES on success, #MHD_NO if the pattern is invalid,
+ *         conflicts with a pattern added before (same method and
+ *         pattern, or a parameter with a different name at the same
+ *         position), the router is in use by a daemon already or
+ *         we are out of memory
+ * @ingroup specialized
  */
 _MHD_EXTERN int
-MHD_destroy_post_processor (struct MHD_PostProcessor *pp);
+MHD_router_add (struct MHD_Router *router,
+                const char *method,
+                const char *pattern,
+                MHD_AccessHandlerCallback handler,
+                void *handler_cls);
 
 
-/* ********************* Digest Authentication functions *************** */
+/**
+ * Destroy a router.  Must only be called after all daemons using
+ * the router have been stopped.
+ *
+ * @param router router to destroy
+ * @ingroup specialized
+ */
+_MHD_EXTERN void
+MHD_router_destroy (struct MHD_Router *router);
 
 
+/* ********************** static file cache functions ********************** */
+
 /**
- * Constant to indicate that the nonce of the provided
- * authentication code was wrong.
- * @ingroup authentication
+ * Handle for a cache of open files and the (shareable) responses
+ * built from them.
  */
-#define MHD_INVALID_NONCE -1
+struct MHD_FileCache;
 
 
 /**
- * Get the username from the authorization header sent by the client
+ * Create a cache for serving static files below @a root.  The cache
+ * keeps the files open and holds a fully prepared `struct
+ * MHD_Response` (including "ETag" and "Last-Modified" headers) for
+ * each of them, so that lookups of hot files do not need any system
+ * calls until MHD sends the data with `sendfile()`.
  *
- * @param connection The MHD connection structure
- * @return NULL if no username could be found, a pointer
- * 			to the username if found
- * @ingroup authentication
+ * The cache is safe to use from multiple threads.
+ *
+ * @param root directory to serve files from (without trailing '/')
+ * @param max_entries maximum number of files to keep open; the least
+ *        recently used file is evicted once this limit is reached
+ * @param stat_ttl number of seconds during which a cached entry is
+ *        considered fresh without calling `stat()` on the file; use 0
+ *        to check the file for changes on every lookup
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
  */
-_MHD_EXTERN char *
-MHD_digest_auth_get_username (struct MHD_Connection *connection);
+_MHD_EXTERN struct MHD_FileCache *
+MHD_file_cache_create (const char *root,
+                       unsigned int max_entries,
+                       unsigned int stat_ttl);
 
 
 /**
- * Authenticates the authorization header sent by the client
+ * Obtain the response for a file from the cache, opening the file
+ * and creating the response if necessary.  The caller owns a
+ * reference to the returned response and must call
+ * #MHD_destroy_response after queueing it, just as with responses
+ * created by any other means.
  *
- * @param connection The MHD connection structure
- * @param realm The realm presented to the client
- * @param username The username needs to be authenticated
- * @param password The password used in the authentication
- * @param nonce_timeout The amount of time for a nonce to be
- * 			invalid in seconds
- * @return #MHD_YES if authenticated, #MHD_NO if not,
- * 			#MHD_INVALID_NONCE if nonce is invalid
- * @ingroup authentication
+ * @param cache cache to query
+ * @param url URL of the file (relative to the cache's root,
+ *        must start with '/'; ".." path segments are refused)
+ * @return NULL if the file does not exist, is not a regular file or
+ *         could not be opened
+ * @ingroup response
  */
-_MHD_EXTERN int
-MHD_digest_auth_check (struct MHD_Connection *connection,
-		       const char *realm,
-		       const char *username,
-		       const char *password,
-		       unsigned int nonce_timeout);
+_MHD_EXTERN struct MHD_Response *
+MHD_file_cache_lookup (struct MHD_FileCache *cache,
+                       const char *url);
 
 
 /**
- * Queues a response to request authentication from the client
+ * Destroy a file cache.  Responses obtained from the cache stay
+ * valid until the application and MHD are done with them.
  *
- * @param connection The MHD connection structure
- * @param realm The realm presented to the client
- * @param opaque string to user for opaque value
- * @param response reply to send; should contain the "access denied"
- *        body; note that this function will set the "WWW Authenticate"
- *        header and that the caller should not do this
- * @param signal_stale #MHD_YES if the nonce is invalid to add
- * 			'stale=true' to the authentication header
+ * @param cache cache to destroy
+ * @ingroup response
+ */
+_MHD_EXTERN void
+MHD_file_cache_destroy (struct MHD_FileCache *cache);
+
+
+/**
+ * Handle for a static asset bundle.  A bundle is a single file
+ * (created by the `bundle_packer` tool from the examples) that holds
+ * many assets together with a sorted path index, precomputed headers
+ * and optional gzip-compressed variants of the assets.
+ */
+struct MHD_Bundle;
+
+
+/**
+ * Open (and map into memory) a static asset bundle.  The bundle is
+ * read-only and safe to use from multiple threads.
+ *
+ * @param filename name of the bundle file
+ * @return NULL on error (i.e. file not found, invalid format,
+ *         out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Bundle *
+MHD_bundle_open (const char *filename);
+
+
+/**
+ * Obtain the response for an asset in the bundle.  The response
+ * uses the bundle's file descriptor at the offset of the asset, so
+ * the data is transmitted with `sendfile()` where possible.  If the
+ * asset has a gzip-compressed variant and @a accept_encoding allows
+ * gzip, the response for the compressed variant (with a
+ * "Content-Encoding: gzip" header) is returned.  The caller owns a
+ * reference to the returned response and must call
+ * #MHD_destroy_response after queueing it.
+ *
+ * @param bundle bundle to search
+ * @param url URL of the asset (must start with '/')
+ * @param accept_encoding value of the "Accept-Encoding" header
+ *        of the request, or NULL
+ * @return NULL if the asset is not in the bundle (or out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_bundle_lookup (struct MHD_Bundle *bundle,
+                   const char *url,
+                   const char *accept_encoding);
+
+
+/**
+ * Close a static asset bundle.  Must only be called once MHD is
+ * done with all responses obtained from the bundle (i.e. after
+ * the daemons using them have been stopped).
+ *
+ * @param bundle bundle to close
+ * @ingroup response
+ */
+_MHD_EXTERN void
+MHD_bundle_close (struct MHD_Bundle *bundle);
+
+
+/* ********************** server-sent events functions ********************** */
+
+/**
+ * Handle for a channel on which server-sent events
+ * ("text/event-stream") are broadcast to many connections.
+ */
+struct MHD_EventChannel;
+
+
+/**
+ * Create a channel for broadcasting server-sent events.
+ *
+ * @param max_pending maximum number of bytes of events that may be
+ *        queued for a subscriber (beyond the event it is sending);
+ *        subscribers that fall further behind are dropped from the
+ *        channel and their connections are closed (the streams of
+ *        HTTP/2 requests and, with #MHD_USE_THREAD_PER_CONNECTION,
+ *        the responses end with an error the next time their
+ *        connections ask for data); 0 for no limit
+ * @return NULL on error (out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_EventChannel *
+MHD_event_channel_create (size_t max_pending);
+
+
+/**
+ * Publish an event to all subscribers of a channel.  The event is
+ * formatted once and shared by all subscribers.  Subscribers whose
+ * connections are suspended waiting for events are resumed;
+ * subscribers that have more than the channel's limit of data queued
+ * are disconnected.  Safe to call from any thread.
+ *
+ * @param channel channel to publish on
+ * @param event type of the event ("event" field), NULL for none;
+ *        must not contain CR or LF
+ * @param id id of the event ("id" field), NULL for none;
+ *        must not contain CR or LF
+ * @param data data of the event, may contain multiple lines
+ *        (ending with CRLF, CR or LF), each is sent as a "data"
+ *        field
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory,
+ *         CR or LF in @a event or @a id)
+ * @ingroup response
+ */
+_MHD_EXTERN int
+MHD_event_channel_publish (struct MHD_EventChannel *channel,
+                           const char *event,
+                           const char *id,
+                           const char *data);
+
+
+/**
+ * Create a response that streams the events published on a channel
+ * (starting with the next event) to a connection.  If the daemon
+ * was started with #MHD_USE_SUSPEND_RESUME, the connection is
+ * suspended while there are no events to send and resumed when an
+ * event is published; otherwise, MHD polls the channel.  The
+ * response must only be queued for @a connection.
+ *
+ * @param channel channel to subscribe to
+ * @param connection connection the response will be queued for
+ * @return NULL on error (out of memory, channel destroyed)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_event_channel_subscribe (struct MHD_EventChannel *channel,
+                             struct MHD_Connection *connection);
+
+
+/**
+ * Destroy a channel.  The streams of all subscribers end after the
+ * events published so far have been sent; the channel's memory is
+ * released once the last subscriber is gone.  Must be called before
+ * stopping daemons with connections subscribed to the channel.
+ *
+ * @param channel channel to destroy
+ * @ingroup response
+ */
+_MHD_EXTERN void
+MHD_event_channel_destroy (struct MHD_EventChannel *channel);
+
+
+/* ********************** WebSocket functions ********************** */
+
+/**
+ * Handle for a connection that was upgraded to the WebSocket
+ * protocol (RFC 6455) with #MHD_create_response_for_websocket().
+ */
+struct MHD_WebSocket;
+
+
+/**
+ * Frame (or message) types of the WebSocket protocol.
+ */
+enum MHD_WebSocketOpcode
+{
+
+  /**
+   * Continuation of a fragmented message (only seen on the wire).
+   */
+  MHD_WEBSOCKET_OPCODE_CONTINUATION = 0,
+
+  /**
+   * Message with UTF-8 text.
+   */
+  MHD_WEBSOCKET_OPCODE_TEXT = 1,
+
+  /**
+   * Message with binary data.
+   */
+  MHD_WEBSOCKET_OPCODE_BINARY = 2,
+
+  /**
+   * Closing handshake.
+   */
+  MHD_WEBSOCKET_OPCODE_CLOSE = 8,
+
+  /**
+   * Keepalive request.
+   */
+  MHD_WEBSOCKET_OPCODE_PING = 9,
+
+  /**
+   * Keepalive answer.
+   */
+  MHD_WEBSOCKET_OPCODE_PONG = 10
+
+};
+
+
+/**
+ * @defgroup websocketclose WebSocket close status codes
+ * Status codes for closing WebSockets (RFC 6455, section 7.4.1).
+ * @{
+ */
+#define MHD_WEBSOCKET_CLOSE_NORMAL 1000
+#define MHD_WEBSOCKET_CLOSE_GOING_AWAY 1001
+#define MHD_WEBSOCKET_CLOSE_PROTOCOL_ERROR 1002
+#define MHD_WEBSOCKET_CLOSE_UNSUPPORTED_DATA 1003
+#define MHD_WEBSOCKET_CLOSE_NO_STATUS 1005
+#define MHD_WEBSOCKET_CLOSE_ABNORMAL 1006
+#define MHD_WEBSOCKET_CLOSE_INVALID_DATA 1007
+#define MHD_WEBSOCKET_CLOSE_POLICY_VIOLATION 1008
+#define MHD_WEBSOCKET_CLOSE_MESSAGE_TOO_BIG 1009
+/** @} */ /* end of group websocketclose */
+
+
+/**
+ * Function called once a connection was upgraded to a WebSocket,
+ * before any message is delivered.
+ *
+ * @param cls closure given to #MHD_create_response_for_websocket()
+ * @param ws handle for the WebSocket, valid until the
+ *        #MHD_WebSocketCloseCallback returns
+ * @param con_cls last value of the `con_cls` of the access handler
+ *        for the request that was upgraded
+ */
+typedef void
+(*MHD_WebSocketOpenCallback)(void *cls,
+                             struct MHD_WebSocket *ws,
+                             void *con_cls);
+
+
+/**
+ * Function called for each complete message received on a
+ * WebSocket.  Fragmented messages are reassembled first.  The
+ * payload is delivered (already unmasked) straight out of the read
+ * buffer of the connection, and is thus only valid until the
+ * function returns.  Text messages are not validated as UTF-8.
+ *
+ * @param cls closure given to #MHD_create_response_for_websocket()
+ * @param ws the WebSocket the message was received on
+ * @param opcode #MHD_WEBSOCKET_OPCODE_TEXT or #MHD_WEBSOCKET_OPCODE_BINARY
+ * @param data payload of the message
+ * @param size number of bytes in @a data
+ */
+typedef void
+(*MHD_WebSocketMessageCallback)(void *cls,
+                                struct MHD_WebSocket *ws,
+                                enum MHD_WebSocketOpcode opcode,
+                                const char *data,
+                                size_t size);
+
+
+/**
+ * Function called once a WebSocket is closed, for whatever reason
+ * (closing handshake, protocol error, timeout, network error or the
+ * daemon being stopped).  The handle must not be used anymore once
+ * the function returned; applications sending from other threads
+ * must synchronize with this function.
+ *
+ * @param cls closure given to #MHD_create_response_for_websocket()
+ * @param ws the WebSocket that was closed
+ * @param status close status received from the client (or sent
+ *        by MHD), #MHD_WEBSOCKET_CLOSE_ABNORMAL if the connection
+ *        was closed without a closing handshake
+ */
+typedef void
+(*MHD_WebSocketCloseCallback)(void *cls,
+                              struct MHD_WebSocket *ws,
+                              unsigned short status);
+
+
+/**
+ * Create a response that accepts the WebSocket handshake of a
+ * request.  The response must be queued with status code
+ * #MHD_HTTP_SWITCHING_PROTOCOLS for @a connection only.  Once the
+ * response was sent, MHD handles the WebSocket in its event loop:
+ * it reassembles and unmasks the messages of the client, answers
+ * pings, sends keepalive pings (see
+ * #MHD_OPTION_WEBSOCKET_PING_INTERVAL) and performs the closing
+ * handshake.  The daemon must have been started with
+ * #MHD_ALLOW_UPGRADE.
+ *
+ * Messages may be as large as the read buffer of the connection
+ * (see #MHD_OPTION_CONNECTION_MEMORY_LIMIT); larger messages are
+ * rejected with #MHD_WEBSOCKET_CLOSE_MESSAGE_TOO_BIG.
+ *
+ * @param connection connection with the handshake request
+ * @param protocol subprotocol to confirm in the
+ *        "Sec-WebSocket-Protocol" header, NULL for none
+ * @param open_cb function to call when the WebSocket is open, can be NULL
+ * @param message_cb function to call for each message received
+ * @param close_cb function to call when the WebSocket is closed, can be NULL
+ * @param cls closure for the callbacks
+ * @return NULL if the request is not a valid WebSocket handshake
+ *         (version 13) or on error (out of memory); the application
+ *         should then answer with #MHD_HTTP_BAD_REQUEST
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_for_websocket (struct MHD_Connection *connection,
+                                   const char *protocol,
+                                   MHD_WebSocketOpenCallback open_cb,
+                                   MHD_WebSocketMessageCallback message_cb,
+                                   MHD_WebSocketCloseCallback close_cb,
+                                   void *cls);
+
+
+/**
+ * Send a message on a WebSocket.  The frame is built and queued,
+ * and is sent by the event loop of the daemon.  Safe to call from
+ * any thread (as long as the WebSocket is not closed concurrently,
+ * see #MHD_WebSocketCloseCallback).
+ *
+ * @param ws WebSocket to send on
+ * @param opcode type of the message (text, binary, ping or pong)
+ * @param data payload of the message
+ * @param size number of bytes in @a data
+ * @return #MHD_YES on success, #MHD_NO on error (closing, out of
+ *         memory, or too much data queued, see
+ *         #MHD_OPTION_WEBSOCKET_MAX_PENDING)
+ * @ingroup response
+ */
+_MHD_EXTERN int
+MHD_websocket_send (struct MHD_WebSocket *ws,
+                    enum MHD_WebSocketOpcode opcode,
+                    const char *data,
+                    size_t size);
+
+
+/**
+ * Start the closing handshake of a WebSocket.  The connection is
+ * closed once the client answered (or after the ping interval).
+ * Safe to call from any thread.
+ *
+ * @param ws WebSocket to close
+ * @param status close status to send to the client
+ * @return #MHD_YES on success, #MHD_NO if the WebSocket was
+ *         already closing
+ * @ingroup response
+ */
+_MHD_EXTERN int
+MHD_websocket_close (struct MHD_WebSocket *ws,
+                     unsigned short status);
+
+
+/**
+ * Frame that is built once and can be sent on many WebSockets
+ * (see #MHD_websocket_frame_create).
+ */
+struct MHD_WebSocketFrame;
+
+
+/**
+ * Build a server frame that can be sent on any number of
+ * WebSockets without copying or encoding it again.
+ *
+ * @param opcode type of the message (text, binary, ping or pong)
+ * @param data payload of the message
+ * @param size number of bytes in @a data
+ * @return NULL on error (invalid opcode, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_WebSocketFrame *
+MHD_websocket_frame_create (enum MHD_WebSocketOpcode opcode,
+                            const char *data,
+                            size_t size);
+
+
+/**
+ * Queue a frame built with #MHD_websocket_frame_create() on a
+ * WebSocket.  The frame is shared, not copied.  Safe to call from
+ * any thread.
+ *
+ * @param ws WebSocket to send on
+ * @param frame frame to send
+ * @return #MHD_YES on success, #MHD_NO on error (see #MHD_websocket_send)
+ * @ingroup response
+ */
+_MHD_EXTERN int
+MHD_websocket_send_frame (struct MHD_WebSocket *ws,
+                          struct MHD_WebSocketFrame *frame);
+
+
+/**
+ * Release the application's reference to a frame.  The frame is
+ * freed once it was sent on all WebSockets it was queued for.
+ *
+ * @param frame frame to release
+ * @ingroup response
+ */
+_MHD_EXTERN void
+MHD_websocket_frame_destroy (struct MHD_WebSocketFrame *frame);
+
+
+/**
+ * Send the same message on many WebSockets.  The frame is built
+ * only once and shared by all of them.
+ *
+ * @param ws array of WebSockets to send on
+ * @param num_ws number of entries in @a ws
+ * @param opcode type of the message (text, binary, ping or pong)
+ * @param data payload of the message
+ * @param size number of bytes in @a data
+ * @return number of WebSockets the message was queued for
+ * @ingroup response
+ */
+_MHD_EXTERN unsigned int
+MHD_websocket_broadcast (struct MHD_WebSocket *const *ws,
+                         unsigned int num_ws,
+                         enum MHD_WebSocketOpcode opcode,
+                         const char *data,
+                         size_t size);
+
+
+/**
+ * Create a response that forwards the request to an upstream HTTP
+ * server and relays the answer of the server to the client.  MHD
+ * rewrites the hop-by-hop headers, adds "X-Forwarded-For" and
+ * streams the request and response bodies in its event loop;
+ * on Linux, bodies of known length are moved between plain sockets
+ * with splice() and never copied to user space.  Connections to
+ * the upstream server are kept open and reused for later requests
+ * (see #MHD_OPTION_PROXY_POOL_SIZE).
+ *
+ * The response must be queued during the first call to the access
+ * handler for a request (before its body, if any, was processed);
+ * the status code given to #MHD_queue_response() is sent if the
+ * upstream server cannot be reached or fails before answering
+ * (e.g. #MHD_HTTP_BAD_GATEWAY).  Requests with a transfer coding
+ * other than "chunked" are answered with #MHD_HTTP_NOT_IMPLEMENTED.
+ * The same response can be queued for any number of requests.
+ * Proxy responses are not supported with
+ * #MHD_USE_THREAD_PER_CONNECTION and for HTTP/2 requests.
+ *
+ * @param addr address of the upstream server (plain HTTP)
+ * @param addrlen number of bytes in @a addr
+ * @param url request target to send to the upstream server
+ *        (must be properly escaped), NULL to forward the URL and
+ *        the arguments of each request
+ * @return NULL on error (unsupported address family, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_for_proxy (const struct sockaddr *addr,
+                               socklen_t addrlen,
+                               const char *url);
+
+
+/* ********************** PostProcessor functions ********************** */
+
+/**
+ * Create a `struct MHD_PostProcessor`.
+ *
+ * A `struct MHD_PostProcessor` can be used to (incrementally) parse
+ * the data portion of a POST request.  Note that some buggy browsers
+ * fail to set the encoding type.  If you want to support those, you
+ * may have to call #MHD_set_connection_value with the proper encoding
+ * type before creating a post processor (if no supported encoding
+ * type is set, this function will fail).  Bodies of type
+ * #MHD_HTTP_POST_ENCODING_JSON are only accepted by
+ * #MHD_create_post_processor_json().
+ *
+ * @param connection the connection on which the POST is
+ *        happening (used to determine the POST format)
+ * @param buffer_size maximum number of bytes to use for
+ *        internal buffering (used only for the parsing,
+ *        specifically the parsing of the keys).  A
+ *        tiny value (256-1024) should be sufficient.
+ *        Do NOT use a value smaller than 256.  For good
+ *        performance, use 32 or 64k (i.e. 65536).
+ * @param iter iterator to be called with the parsed data,
+ *        Must NOT be NULL.
+ * @param iter_cls first argument to @a iter
+ * @return NULL on error (out of memory, unsupported encoding),
+ *         otherwise a PP handle
+ * @ingroup request
+ */
+_MHD_EXTERN struct MHD_PostProcessor *
+MHD_create_post_processor (struct MHD_Connection *connection,
+			   size_t buffer_size,
+			   MHD_PostDataIterator iter, void *iter_cls);
+
+
+/**
+ * Create a `struct MHD_PostProcessor` like
+ * #MHD_create_post_processor() that also accepts
+ * #MHD_HTTP_POST_ENCODING_JSON bodies.
+ *
+ * For JSON bodies, the iterator is called for each string, number,
+ * boolean and null in the body as it arrives, with the JSON Pointer
+ * (RFC 6901) of the value as the key ("/items/0/name"; "" for a
+ * body that is a single value) and the type of the value ("string",
+ * "number", "boolean" or "null") as the content type.  Strings are
+ * passed decoded (as UTF-8), other values as they appear in the
+ * body.  Objects and arrays are not passed on by themselves; they
+ * may be nested at most 64 levels deep and the paths of their
+ * values must fit into @a buffer_size.
+ *
+ * @param connection the connection on which the POST is
+ *        happening (used to determine the POST format)
+ * @param buffer_size maximum number of bytes to use for
+ *        internal buffering, see #MHD_create_post_processor()
+ * @param iter iterator to be called with the parsed data,
+ *        Must NOT be NULL.
+ * @param iter_cls first argument to @a iter
+ * @return NULL on error (out of memory, unsupported encoding),
+ *         otherwise a PP handle
+ * @ingroup request
+ */
+_MHD_EXTERN struct MHD_PostProcessor *
+MHD_create_post_processor_json (struct MHD_Connection *connection,
+                                size_t buffer_size,
+                                MHD_PostDataIterator iter, void *iter_cls);
+
+
+/**
+ * Parse and process POST data.  Call this function when POST data is
+ * available (usually during an #MHD_AccessHandlerCallback) with the
+ * "upload_data" and "upload_data_size".  Whenever possible, this will
+ * then cause calls to the #MHD_PostDataIterator.
+ *
+ * If the post processor writes file uploads with
+ * #MHD_POST_SPOOL_THREAD, this function blocks while the writer
+ * thread has not yet written the previous chunk of the file (and
+ * before passing a complete file on); use
+ * #MHD_post_process_partial() to avoid that.
+ *
+ * @param pp the post processor
+ * @param post_data @a post_data_len bytes of POST data
+ * @param post_data_len length of @a post_data
+ * @return #MHD_YES on success, #MHD_NO on error
+ *         (out-of-memory, iterator aborted, parse error)
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_post_process (struct MHD_PostProcessor *pp,
+                  const char *post_data, size_t post_data_len);
+
+
+/**
+ * Parse and process POST data like #MHD_post_process(), but never
+ * wait for the background thread of a post processor that writes
+ * file uploads with #MHD_POST_SPOOL_THREAD.  If the thread has not
+ * yet written the previous chunk of the upload when the next one is
+ * full (or a file is complete), processing stops and the rest of the data is
+ * left to the application, which should pass it again later (as
+ * the beginning of the data of the next call).  In an
+ * #MHD_AccessHandlerCallback, simply pass "upload_data_size".
+ *
+ * @param pp the post processor
+ * @param post_data POST data
+ * @param[in,out] post_data_len number of bytes at @a post_data,
+ *        set to the number of bytes at its end that were not
+ *        processed (0 unless the thread was busy)
+ * @return #MHD_YES on success, #MHD_NO on error
+ *         (out-of-memory, iterator aborted, parse error)
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_post_process_partial (struct MHD_PostProcessor *pp,
+                          const char *post_data,
+                          size_t *post_data_len);
+
+
+/**
+ * Release PostProcessor resources.
+ *
+ * @param pp the PostProcessor to destroy
+ * @return #MHD_YES if processing completed nicely,
+ *         #MHD_NO if there were spurious characters / formatting
+ *                problems; it is common to ignore the return
+ *                value of this function
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_destroy_post_processor (struct MHD_PostProcessor *pp);
+
+
+/**
+ * Function called by the post processor when it finished writing a
+ * file upload to a temporary file (see
+ * #MHD_post_processor_spool_files()).  The file belongs to the
+ * application from now on; it should rename (or remove) it.
+ *
+ * @param cls user-specified closure
+ * @param key 0-terminated name of the form field
+ * @param filename name of the uploaded file
+ * @param content_type mime-type of the data, NULL if not known
+ * @param transfer_encoding encoding of the data, NULL if not known
+ * @param path name of the temporary file with the data
+ * @param size number of bytes in the file
+ * @return #MHD_YES to continue processing,
+ *         #MHD_NO to abort
+ */
+typedef int
+(*MHD_PostFileCallback) (void *cls,
+                         const char *key,
+                         const char *filename,
+                         const char *content_type,
+                         const char *transfer_encoding,
+                         const char *path,
+                         uint64_t size);
+
+
+/**
+ * Flags for #MHD_post_processor_spool_files().
+ */
+enum MHD_PostSpoolFlags
+{
+  /**
+   * Write the files from the thread that calls #MHD_post_process().
+   */
+  MHD_POST_SPOOL_NONE = 0,
+
+  /**
+   * Write the files from a background thread, so that reading the
+   * upload and writing it to disk overlap.  A daemon has a single
+   * such thread, which writes the chunks of all uploads in the order
+   * they are complete.  #MHD_post_process() blocks if the thread has
+   * not yet written the previous chunk of the upload, use
+   * #MHD_post_process_partial() to avoid that.  Ignored if the
+   * platform does not support it.
+   */
+  MHD_POST_SPOOL_THREAD = 1
+};
+
+
+/**
+ * Have a (multipart) post processor write the data of file uploads
+ * (parts with a filename) to temporary files instead of passing it
+ * to the #MHD_PostDataIterator.  The data is collected in chunks of
+ * @a chunk_size bytes, so that the file is written with few large
+ * writes at aligned offsets; @a cb is called with the name of the
+ * file once it is complete.  Other form fields are still passed to
+ * the iterator.  Files that are not complete when the post
+ * processor is destroyed are removed.
+ *
+ * Must be called before the first call to #MHD_post_process().
+ *
+ * @param pp the post processor
+ * @param dir directory for the temporary files, NULL for the
+ *        one given by the TMPDIR environment variable or "/tmp"
+ * @param chunk_size number of bytes to write at once (rounded
+ *        up to a multiple of 4 KiB), 0 for the default (1 MiB)
+ * @param flags how to write the files
+ * @param cb function to call for each complete file
+ * @param cb_cls first argument to @a cb
+ * @return #MHD_YES on success,
+ *         #MHD_NO on error (out of memory, not supported by the
+ *         platform, post processor already in use)
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_post_processor_spool_files (struct MHD_PostProcessor *pp,
+                                const char *dir,
+                                size_t chunk_size,
+                                enum MHD_PostSpoolFlags flags,
+                                MHD_PostFileCallback cb,
+                                void *cb_cls);
+
+
+/* ********************* Digest Authentication functions *************** */
+
+
+/**
+ * Constant to indicate that the nonce of the provided
+ * authentication code was wrong.
+ * @ingroup authentication
+ */
+#define MHD_INVALID_NONCE -1
+
+
+/**
+ * Hash algorithms for digest authentication (RFC 7616).
+ * @ingroup authentication
+ */
+enum MHD_DigestAuthAlgorithm
+{
+
+  /**
+   * When checking credentials, accept any supported algorithm
+   * (the one chosen by the client); when asking for credentials,
+   * offer SHA-256 and MD5.
+   */
+  MHD_DIGEST_ALG_AUTO = 0,
+
+  /**
+   * MD5 (RFC 2617), the only algorithm many old clients know.
+   */
+  MHD_DIGEST_ALG_MD5,
+
+  /**
+   * SHA-256.
+   */
+  MHD_DIGEST_ALG_SHA256,
+
+  /**
+   * SHA-512/256 (called "SHA-512-256" in the protocol).
+   */
+  MHD_DIGEST_ALG_SHA512_256
+};
+
+
+/**
+ * Size of an MD5 digest (for #MHD_digest_auth_check_digest2()).
+ * @ingroup authentication
+ */
+#define MHD_MD5_DIGEST_SIZE 16
+
+/**
+ * Size of a SHA-256 digest (for #MHD_digest_auth_check_digest2()).
+ * @ingroup authentication
+ */
+#define MHD_SHA256_DIGEST_SIZE 32
+
+/**
+ * Size of a SHA-512/256 digest (for #MHD_digest_auth_check_digest2()).
+ * @ingroup authentication
+ */
+#define MHD_SHA512_256_DIGEST_SIZE 32
+
+
+/**
+ * Get the username from the authorization header sent by the client
+ *
+ * @param connection The MHD connection structure
+ * @return NULL if no username could be found, a pointer
+ * 			to the username if found
+ * @ingroup authentication
+ */
+_MHD_EXTERN char *
+MHD_digest_auth_get_username (struct MHD_Connection *connection);
+
+
+/**
+ * Authenticates the authorization header sent by the client
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param password The password used in the authentication
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_digest_auth_check (struct MHD_Connection *connection,
+		       const char *realm,
+		       const char *username,
+		       const char *password,
+		       unsigned int nonce_timeout);
+
+
+/**
+ * Authenticates the authorization header sent by the client,
+ * supporting the hash algorithms of RFC 7616.
+ * #MHD_digest_auth_check() is the same as this function with
+ * #MHD_DIGEST_ALG_MD5.
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param password The password used in the authentication
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @param algo the algorithm the client must have used, or
+ *        #MHD_DIGEST_ALG_AUTO for any supported one
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_digest_auth_check2 (struct MHD_Connection *connection,
+			const char *realm,
+			const char *username,
+			const char *password,
+			unsigned int nonce_timeout,
+			enum MHD_DigestAuthAlgorithm algo);
+
+
+/**
+ * Authenticates the authorization header sent by the client,
+ * given the digest of "username:realm:password" (H(A1) in RFC 7616)
+ * instead of the password, so that the application does not need
+ * to keep passwords.  The digest can be computed with
+ * #MHD_digest_auth_calc_userdigest().
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param digest the binary digest for @a username, @a realm and the
+ *        password, computed with the algorithm the client uses
+ * @param digest_size number of bytes in @a digest
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @param algo the algorithm @a digest was computed with, or
+ *        #MHD_DIGEST_ALG_AUTO for any supported one with
+ *        digests of @a digest_size bytes
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_digest_auth_check_digest2 (struct MHD_Connection *connection,
+			       const char *realm,
+			       const char *username,
+			       const uint8_t *digest,
+			       size_t digest_size,
+			       unsigned int nonce_timeout,
+			       enum MHD_DigestAuthAlgorithm algo);
+
+
+/**
+ * Compute the digest of "username:realm:password" to store for
+ * use with #MHD_digest_auth_check_digest2().
+ *
+ * @param algo the algorithm to use, not #MHD_DIGEST_ALG_AUTO
+ * @param username the username
+ * @param realm the realm
+ * @param password the password
+ * @param[out] digest where to write the binary digest
+ * @param digest_size number of bytes available at @a digest
+ * @return #MHD_YES on success, #MHD_NO if @a algo is not
+ *         supported or @a digest_size is too small
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_digest_auth_calc_userdigest (enum MHD_DigestAuthAlgorithm algo,
+				 const char *username,
+				 const char *realm,
+				 const char *password,
+				 uint8_t *digest,
+				 size_t digest_size);
+
+
+/**
+ * Queues a response to request authentication from the client
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param opaque string to user for opaque value
+ * @param response reply to send; should contain the "access denied"
+ *        body; note that this function will set the "WWW Authenticate"
+ *        header and that the caller should not do this
+ * @param signal_stale #MHD_YES if the nonce is invalid to add
+ * 			'stale=true' to the authentication header
  * @return #MHD_YES on success, #MHD_NO otherwise
  * @ingroup authentication
  */
@@ -2566,6 +3804,34 @@ MHD_queue_auth_fail_response (struct MHD_Connection *connection,
 			      int signal_stale);
 
 
+/**
+ * Queues a response to request authentication from the client,
+ * asking for the given hash algorithm.
+ * #MHD_queue_auth_fail_response() is the same as this function
+ * with #MHD_DIGEST_ALG_MD5.
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param opaque string to user for opaque value
+ * @param response reply to send; should contain the "access denied"
+ *        body; note that this function will set the "WWW Authenticate"
+ *        header and that the caller should not do this
+ * @param signal_stale #MHD_YES if the nonce is invalid to add
+ * 			'stale=true' to the authentication header
+ * @param algo the algorithm to ask for; #MHD_DIGEST_ALG_AUTO
+ *        offers SHA-256 (preferred) and MD5
+ * @return #MHD_YES on success, #MHD_NO otherwise
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_queue_auth_fail_response2 (struct MHD_Connection *connection,
+			       const char *realm,
+			       const char *opaque,
+			       struct MHD_Response *response,
+			       int signal_stale,
+			       enum MHD_DigestAuthAlgorithm algo);
+
+
 /**
  * Get the username and password from the basic authorization header sent by the client
  *
@@ -2597,6 +3863,40 @@ MHD_queue_basic_auth_fail_response (struct MHD_Connection *connection,
 				    const char *realm,
 				    struct MHD_Response *response);
 
+
+/**
+ * Check if the credentials in the basic authorization header of a
+ * request were verified recently, that is, if
+ * #MHD_basic_auth_cache_verified() was called for the same header
+ * and realm within the time given with
+ * #MHD_OPTION_BASIC_AUTH_CACHE_TTL.  The header is not decoded.
+ *
+ * @param connection The MHD connection structure
+ * @param realm the realm the credentials are checked for
+ * @return #MHD_YES if the credentials were verified recently,
+ *         #MHD_NO if they need to be verified (or the cache is disabled)
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_basic_auth_check_cached (struct MHD_Connection *connection,
+                             const char *realm);
+
+
+/**
+ * Remember that the application verified the credentials in the
+ * basic authorization header of a request, so that
+ * #MHD_basic_auth_check_cached() accepts them for later requests.
+ *
+ * @param connection The MHD connection structure
+ * @param realm the realm the credentials were verified for
+ * @return #MHD_YES on success, #MHD_NO if the request has no basic
+ *         authorization header or the cache is disabled
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_basic_auth_cache_verified (struct MHD_Connection *connection,
+                               const char *realm);
+
 /* ********************** generic query functions ********************** */
 
 
@@ -2817,7 +4117,39 @@ enum MHD_FEATURE
    * offsets larger than 2 GiB. If not supported value of size+offset is
    * limited to 2 GiB.
    */
-  MHD_FEATURE_LARGE_FILE = 15
+  MHD_FEATURE_LARGE_FILE = 15,
+
+  /**
+   * Get whether MHD was built with zlib and can thus compress
+   * responses marked with #MHD_RF_COMPRESS.
+   */
+  MHD_FEATURE_COMPRESSION = 16,
+
+  /**
+   * Get whether connections can be upgraded to other protocols.
+   * If supported then flag #MHD_ALLOW_UPGRADE and function
+   * #MHD_create_response_for_upgrade() can be used.
+   */
+  MHD_FEATURE_UPGRADE = 17,
+
+  /**
+   * Get whether MHD can handle WebSockets in its event loop.
+   * If supported then #MHD_create_response_for_websocket() can
+   * be used.
+   */
+  MHD_FEATURE_WEBSOCKET = 18,
+
+  /**
+   * Get whether HTTP/2 is supported.  If supported then flag
+   * #MHD_USE_HTTP2 can be used.
+   */
+  MHD_FEATURE_HTTP2 = 19,
+
+  /**
+   * Get whether requests can be forwarded to upstream servers.  If
+   * supported then #MHD_create_response_for_proxy() can be used.
+   */
+  MHD_FEATURE_PROXY = 20
 };
 
 
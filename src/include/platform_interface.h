@@ -137,6 +137,13 @@ typedef int _MHD_socket_funcs_size;
 #endif /* !defined(_WIN32) || defined(__CYGWIN__) */
 #endif /* MHD_DONT_USE_PIPES */
 
+/* MHD_socket_pair_ create two connected sockets */
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#define MHD_socket_pair_(fdarr) socketpair(AF_LOCAL, SOCK_STREAM, 0, (fdarr))
+#else /* !defined(_WIN32) || defined(__CYGWIN__) */
+#define MHD_socket_pair_(fdarr) MHD_W32_pair_of_sockets_((fdarr))
+#endif /* !defined(_WIN32) || defined(__CYGWIN__) */
+
 /* MHD_pipe_errno_ is errno of last function (!MHD_DONT_USE_PIPES) /
  *                    errno of last emulated pipe function (MHD_DONT_USE_PIPES) */
 #ifndef MHD_DONT_USE_PIPES
@@ -333,4 +340,95 @@ typedef pthread_mutex_t MHD_mutex_;
   ((NULL != (mutex)) ? (LeaveCriticalSection((mutex)), MHD_YES) : MHD_NO)
 #endif
 
+#if defined(MHD_PTHREAD_MUTEX_)
+#define MHD_PTHREAD_COND_ 1
+typedef pthread_cond_t MHD_cond_;
+#elif defined(MHD_W32_MUTEX_) && _WIN32_WINNT >= 0x0600
+#define MHD_W32_COND_ 1
+typedef CONDITION_VARIABLE MHD_cond_;
+#endif
+
+#if defined(MHD_PTHREAD_COND_) || defined(MHD_W32_COND_)
+/**
+ * Condition variables (#MHD_cond_) are available.
+ */
+#define MHD_HAVE_COND_ 1
+#endif
+
+#if defined(MHD_PTHREAD_COND_)
+/**
+ * Create new condition variable.
+ * @param cond pointer to the condition variable
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+#define MHD_cond_create_(cond) \
+  ((0 == pthread_cond_init ((cond), NULL)) ? MHD_YES : MHD_NO)
+#elif defined(MHD_W32_COND_)
+/**
+ * Create new condition variable.
+ * @param cond pointer to the condition variable
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+#define MHD_cond_create_(cond) \
+  ((NULL != (cond)) ? (InitializeConditionVariable((cond)), MHD_YES) : MHD_NO)
+#endif
+
+#if defined(MHD_PTHREAD_COND_)
+/**
+ * Destroy previously created condition variable.
+ * @param cond pointer to the condition variable
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+#define MHD_cond_destroy_(cond) \
+  ((0 == pthread_cond_destroy ((cond))) ? MHD_YES : MHD_NO)
+#elif defined(MHD_W32_COND_)
+/**
+ * Destroy previously created condition variable.
+ * @param cond pointer to the condition variable
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+#define MHD_cond_destroy_(cond) \
+  ((NULL != (cond)) ? MHD_YES : MHD_NO)
+#endif
+
+#if defined(MHD_PTHREAD_COND_)
+/**
+ * Wait until the condition variable is signalled.  The mutex
+ * is released while waiting and locked again before returning.
+ * @param cond pointer to the condition variable
+ * @param mutex pointer to the locked mutex
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+#define MHD_cond_wait_(cond,mutex) \
+  ((0 == pthread_cond_wait ((cond), (mutex))) ? MHD_YES : MHD_NO)
+#elif defined(MHD_W32_COND_)
+/**
+ * Wait until the condition variable is signalled.  The mutex
+ * is released while waiting and locked again before returning.
+ * @param cond pointer to the condition variable
+ * @param mutex pointer to the locked mutex
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+#define MHD_cond_wait_(cond,mutex) \
+  ((0 != SleepConditionVariableCS ((cond), (mutex), INFINITE)) ? MHD_YES : MHD_NO)
+#endif
+
+#if defined(MHD_PTHREAD_COND_)
+/**
+ * Wake up all threads waiting for the condition variable.
+ * @param cond pointer to the condition variable
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+#define MHD_cond_broadcast_(cond) \
+  ((0 == pthread_cond_broadcast ((cond))) ? MHD_YES : MHD_NO)
+#elif defined(MHD_W32_COND_)
+/**
+ * Wake up all threads waiting for the condition variable.
+ * @param cond pointer to the condition variable
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+#define MHD_cond_broadcast_(cond) \
+  ((NULL != (cond)) ? (WakeAllConditionVariable((cond)), MHD_YES) : MHD_NO)
+#endif
+
 #endif /* MHD_PLATFORM_INTERFACE_H */
@@ -26,12 +26,254 @@
 #include <limits.h>
 #include "internal.h"
 #include "base64.h"
+#include "basicauth.h"
+#include "mhd_shardtable.h"
+#include "sha256.h"
+#include "mhd_mono_clock.h"
 
 /**
  * Beginning string for any valid Basic authentication header.
  */
 #define _BASIC_BASE		"Basic "
 
+/**
+ * Maximum number of slots of the cache looked at for credentials;
+ * new credentials replace the least recently used one of these slots.
+ */
+#define CACHE_PROBE_LIMIT 8
+
+
+/**
+ * Credentials that were verified by the application.  Only hashes
+ * of the "Authorization" header are kept, never the credentials
+ * themselves.
+ */
+struct BasicAuthEntry
+{
+
+  /**
+   * Hash of the realm and the header, selects the slot.
+   */
+  uint64_t hash;
+
+  /**
+   * Monotonic time (in seconds) when the entry expires, 0 for
+   * unused entries.
+   */
+  uint64_t expires;
+
+  /**
+   * SHA-256 of the realm and the header; only a match of this grants
+   * access, so that access does not depend on the secrecy of the
+   * key of @e hash.
+   */
+  uint8_t check[SHA256_DIGEST_SIZE];
+
+  /**
+   * Value of the clock of the shard when the entry was last used.
+   */
+  uint32_t last_used;
+
+};
+
+
+/**
+ * Cache of basic authentication credentials verified by the
+ * application, shared by all worker threads.
+ */
+struct MHD_BasicAuthCache
+{
+
+  /**
+   * Entries of type `struct BasicAuthEntry`, hashed by realm and
+   * header.
+   */
+  struct MHD_ShardTable table;
+
+  /**
+   * Number of seconds entries are valid.
+   */
+  unsigned int ttl;
+
+};
+
+
+/**
+ * Create the cache of verified credentials of a daemon.
+ *
+ * @param size number of credentials to remember
+ * @param ttl number of seconds credentials are remembered
+ * @param seed secret data to derive the hash key from if the TLS
+ *        library cannot provide one, may be NULL
+ * @param seed_size number of bytes in @a seed
+ * @return NULL on error
+ */
+struct MHD_BasicAuthCache *
+MHD_basic_auth_cache_create_ (unsigned int size,
+                              unsigned int ttl,
+                              const void *seed,
+                              size_t seed_size)
+{
+  struct MHD_BasicAuthCache *cache;
+
+  if (0 == ttl)
+    return NULL;
+  if (NULL == (cache = malloc (sizeof (struct MHD_BasicAuthCache))))
+    return NULL;
+  /* without a secure generator, guessing the hash key only allows
+     clients to make entries share slots, matches are checked with
+     @e check */
+  if (MHD_YES != MHD_shard_table_init_ (&cache->table,
+                                        size,
+                                        sizeof (struct BasicAuthEntry),
+                                        CACHE_PROBE_LIMIT,
+                                        seed,
+                                        seed_size))
+    {
+      free (cache);
+      return NULL;
+    }
+  cache->ttl = ttl;
+  return cache;
+}
+
+
+/**
+ * Destroy the cache of verified credentials of a daemon.
+ *
+ * @param cache cache to destroy, may be NULL
+ */
+void
+MHD_basic_auth_cache_destroy_ (struct MHD_BasicAuthCache *cache)
+{
+  if (NULL == cache)
+    return;
+  MHD_shard_table_deinit_ (&cache->table,
+                           NULL);
+  free (cache);
+}
+
+
+/**
+ * Hash the "Authorization" header of a request for a realm.
+ *
+ * @param key the key for hashing
+ * @param realm the realm
+ * @param header value of the "Authorization" header
+ * @return keyed hash of @a realm and @a header
+ */
+static uint64_t
+hash_credentials (const uint8_t key[SIPHASH_KEY_SIZE],
+                  const char *realm,
+                  const char *header)
+{
+  uint8_t hkey[SIPHASH_KEY_SIZE];
+  uint64_t r;
+  unsigned int i;
+
+  /* the realm is folded into the key for hashing the header */
+  r = MHD_siphash_ (key, realm, strlen (realm));
+  for (i = 0; i < SIPHASH_KEY_SIZE; i++)
+    hkey[i] = key[i] ^ (uint8_t) (r >> (8 * (i % 8)));
+  return MHD_siphash_ (hkey, header, strlen (header));
+}
+
+
+/**
+ * Compute the SHA-256 of the "Authorization" header of a request
+ * for a realm.
+ *
+ * @param realm the realm
+ * @param header value of the "Authorization" header
+ * @param[out] digest set to the SHA-256 of @a realm and @a header
+ */
+static void
+check_credentials (const char *realm,
+                   const char *header,
+                   uint8_t digest[SHA256_DIGEST_SIZE])
+{
+  struct SHA256Context ctx;
+
+  SHA256Init (&ctx);
+  /* with the 0-terminator, so that the split is unambiguous */
+  SHA256Update (&ctx,
+                (const unsigned char *) realm,
+                strlen (realm) + 1);
+  SHA256Update (&ctx,
+                (const unsigned char *) header,
+                strlen (header));
+  SHA256Final (digest, &ctx);
+}
+
+
+/**
+ * Find the entry for the credentials of a request in the cache.
+ *
+ * @param connection the connection with the request
+ * @param realm the realm
+ * @param add #MHD_YES to add the credentials if they are not
+ *        in the cache
+ * @return #MHD_YES if the credentials were (or are now) cached,
+ *         #MHD_NO if not or if the cache is disabled
+ */
+static int
+lookup_credentials (struct MHD_Connection *connection,
+                    const char *realm,
+                    int add)
+{
+  struct MHD_BasicAuthCache *cache = connection->daemon->basic_auth_cache;
+  struct MHD_ShardProbe probe;
+  struct BasicAuthEntry *slot;
+  struct BasicAuthEntry *victim;
+  const char *header;
+  uint64_t hash;
+  uint8_t check[SHA256_DIGEST_SIZE];
+  uint64_t now;
+  unsigned int i;
+
+  if ( (NULL == cache) ||
+       (NULL == realm) ||
+       (NULL == (header = MHD_lookup_connection_value (connection,
+                                                       MHD_HEADER_KIND,
+                                                       MHD_HTTP_HEADER_AUTHORIZATION))) ||
+       (0 != strncmp (header, _BASIC_BASE, strlen (_BASIC_BASE))) )
+    return MHD_NO;
+  hash = hash_credentials (cache->table.key, realm, header);
+  check_credentials (realm, header, check);
+  now = (uint64_t) MHD_monotonic_sec_counter ();
+  MHD_shard_table_lock_ (&cache->table, hash, &probe);
+  victim = MHD_shard_probe_slot_ (&probe, 0);
+  for (i = 0; i < probe.limit; i++)
+    {
+      slot = MHD_shard_probe_slot_ (&probe, i);
+      if ( (hash == slot->hash) &&
+           (0 == memcmp (check, slot->check, sizeof (check))) &&
+           (now < slot->expires) )
+        {
+          /* the TTL counts from the verification, not the last use */
+          slot->last_used = probe.shard->clock;
+          MHD_shard_probe_unlock_ (&probe);
+          return MHD_YES;
+        }
+      /* prefer expired entries, then the least recently used one */
+      if ( (now < victim->expires) &&
+           ( (now >= slot->expires) ||
+             ((int32_t) (slot->last_used - victim->last_used) < 0) ) )
+        victim = slot;
+    }
+  if (MHD_YES != add)
+    {
+      MHD_shard_probe_unlock_ (&probe);
+      return MHD_NO;
+    }
+  victim->hash = hash;
+  memcpy (victim->check, check, sizeof (check));
+  victim->expires = now + cache->ttl;
+  victim->last_used = probe.shard->clock;
+  MHD_shard_probe_unlock_ (&probe);
+  return MHD_YES;
+}
+
 
 /**
  * Get the username and password from the basic authorization header sent by the client
@@ -157,4 +399,47 @@ MHD_queue_basic_auth_fail_response (struct MHD_Connection *connection,
   return ret;
 }
 
+
+/**
+ * Check if the credentials in the basic authorization header of a
+ * request were verified recently, that is, if
+ * #MHD_basic_auth_cache_verified() was called for the same header
+ * and realm within the time given with
+ * #MHD_OPTION_BASIC_AUTH_CACHE_TTL.
+ *
+ * @param connection The MHD connection structure
+ * @param realm the realm the credentials are checked for
+ * @return #MHD_YES if the credentials were verified recently,
+ *         #MHD_NO if they need to be verified (or the cache is disabled)
+ * @ingroup authentication
+ */
+int
+MHD_basic_auth_check_cached (struct MHD_Connection *connection,
+                             const char *realm)
+{
+  return lookup_credentials (connection,
+                             realm,
+                             MHD_NO);
+}
+
+
+/**
+ * Remember that the application verified the credentials in the
+ * basic authorization header of a request.
+ *
+ * @param connection The MHD connection structure
+ * @param realm the realm the credentials were verified for
+ * @return #MHD_YES on success, #MHD_NO if the request has no basic
+ *         authorization header or the cache is disabled
+ * @ingroup authentication
+ */
+int
+MHD_basic_auth_cache_verified (struct MHD_Connection *connection,
+                               const char *realm)
+{
+  return lookup_credentials (connection,
+                             realm,
+                             MHD_YES);
+}
+
 /* end of basicauth.c */
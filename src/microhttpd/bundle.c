@@ -0,0 +1,682 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file bundle.c
+ * @brief serving static assets from a single (memory-mapped) bundle file
+ * @author Christian Grothoff
+ *
+ * A bundle file has the following layout, all integers are stored in
+ * little endian byte order:
+ *
+ * - header (16 bytes): the magic "MHDBNDL" (including the terminating
+ *   0-byte), the format version (uint32, currently 1) and the number
+ *   of assets (uint32);
+ * - one index entry (48 bytes) per asset, sorted by path (byte-wise,
+ *   as with strcmp()): offset and length of the path (uint32 each),
+ *   offset and length of the headers (uint32 each), offset and size
+ *   of the data (uint64 each), offset and size of the gzip-compressed
+ *   data (uint64 each, size 0 if there is no compressed variant);
+ * - paths, headers and data at arbitrary offsets.  Headers are
+ *   stored as "Name: value\r\n" lines.
+ */
+
+#include "internal.h"
+#include "response.h"
+#include "mhd_str.h"
+#include "mhd_limits.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif /* HAVE_SYS_MMAN_H */
+#if defined(_WIN32)
+#include <io.h> /* for open(), read(), close() */
+#endif /* _WIN32 */
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif /* !O_BINARY */
+
+/**
+ * Magic at the beginning of each bundle file.
+ */
+#define BUNDLE_MAGIC "MHDBNDL"
+
+/**
+ * Version of the bundle format we understand.
+ */
+#define BUNDLE_VERSION 1
+
+/**
+ * Size of the bundle header.
+ */
+#define BUNDLE_HEADER_SIZE 16
+
+/**
+ * Size of an index entry.
+ */
+#define BUNDLE_ENTRY_SIZE 48
+
+/**
+ * Largest buffer we use for transmitting assets without `sendfile()`.
+ */
+#define BUNDLE_BLOCK_SIZE (32 * 1024)
+
+
+/**
+ * Data of an asset (either the original or the compressed variant).
+ */
+struct BundleVariant
+{
+
+  /**
+   * Response for the variant, NULL if not yet created.  The bundle
+   * holds one reference.
+   */
+  struct MHD_Response *response;
+
+  /**
+   * Pointer to the data in the mapped bundle.
+   */
+  const char *data;
+
+  /**
+   * Offset of the data in the bundle file.
+   */
+  uint64_t offset;
+
+  /**
+   * Number of bytes in @e data.
+   */
+  uint64_t size;
+
+};
+
+
+/**
+ * Asset in a bundle.
+ */
+struct BundleEntry
+{
+
+  /**
+   * Path of the asset (not 0-terminated).
+   */
+  const char *path;
+
+  /**
+   * Headers for the asset ("Name: value\r\n" lines).
+   */
+  const char *headers;
+
+  /**
+   * Length of @e path.
+   */
+  size_t path_len;
+
+  /**
+   * Length of @e headers.
+   */
+  size_t headers_len;
+
+  /**
+   * The asset itself.
+   */
+  struct BundleVariant plain;
+
+  /**
+   * Gzip-compressed variant of the asset, size 0 if none.
+   */
+  struct BundleVariant gzip;
+
+};
+
+
+/**
+ * Handle for a static asset bundle.
+ */
+struct MHD_Bundle
+{
+
+  /**
+   * Contents of the bundle file.
+   */
+  char *map;
+
+  /**
+   * Array of @e num_entries assets, sorted by path.
+   */
+  struct BundleEntry *entries;
+
+  /**
+   * Size of @e map.
+   */
+  size_t map_size;
+
+  /**
+   * Number of assets in the bundle.
+   */
+  unsigned int num_entries;
+
+  /**
+   * Open file descriptor for the bundle file.
+   */
+  int fd;
+
+  /**
+   * #MHD_YES if @e map was obtained using `mmap()`,
+   * #MHD_NO if it was allocated with `malloc()`.
+   */
+  int mapped;
+
+  /**
+   * Mutex protecting creation of the responses.
+   */
+  MHD_mutex_ lock;
+
+};
+
+
+/**
+ * Read a little endian uint32 from the bundle.
+ *
+ * @param p where to read from
+ * @return the value
+ */
+static uint32_t
+get_u32 (const char *p)
+{
+  const unsigned char *u = (const unsigned char *) p;
+
+  return ((uint32_t) u[0]) |
+    (((uint32_t) u[1]) << 8) |
+    (((uint32_t) u[2]) << 16) |
+    (((uint32_t) u[3]) << 24);
+}
+
+
+/**
+ * Read a little endian uint64 from the bundle.
+ *
+ * @param p where to read from
+ * @return the value
+ */
+static uint64_t
+get_u64 (const char *p)
+{
+  return ((uint64_t) get_u32 (p)) |
+    (((uint64_t) get_u32 (&p[4])) << 32);
+}
+
+
+/**
+ * Check that a range is within the bundle.
+ *
+ * @param bundle the bundle
+ * @param off offset of the range
+ * @param len length of the range
+ * @return #MHD_YES if the range is valid
+ */
+static int
+check_range (const struct MHD_Bundle *bundle,
+             uint64_t off,
+             uint64_t len)
+{
+  if ( (off > bundle->map_size) ||
+       (len > bundle->map_size - off) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Compare a 0-terminated URL with the path of an asset.
+ *
+ * @param url the URL
+ * @param entry the asset
+ * @return 0 if equal, <0 if @a url sorts before the path,
+ *         >0 if it sorts after the path
+ */
+static int
+compare_path (const char *url,
+              const struct BundleEntry *entry)
+{
+  size_t i;
+
+  for (i = 0; i < entry->path_len; i++)
+    {
+      if ('\0' == url[i])
+        return -1;
+      if (url[i] != entry->path[i])
+        return ((unsigned char) url[i]) - ((unsigned char) entry->path[i]);
+    }
+  return ('\0' == url[i]) ? 0 : 1;
+}
+
+
+/**
+ * Parse and validate the index of the bundle.
+ *
+ * @param bundle bundle with the file contents in @e map
+ * @return #MHD_YES on success
+ */
+static int
+parse_index (struct MHD_Bundle *bundle)
+{
+  struct BundleEntry *entry;
+  const char *p;
+  uint32_t count;
+  unsigned int i;
+  size_t cmp_len;
+
+  if ( (bundle->map_size < BUNDLE_HEADER_SIZE) ||
+       (0 != memcmp (bundle->map,
+                     BUNDLE_MAGIC,
+                     sizeof (BUNDLE_MAGIC))) ||
+       (BUNDLE_VERSION != get_u32 (&bundle->map[8])) )
+    return MHD_NO;
+  count = get_u32 (&bundle->map[12]);
+  if (count > (bundle->map_size - BUNDLE_HEADER_SIZE) / BUNDLE_ENTRY_SIZE)
+    return MHD_NO;
+  bundle->num_entries = count;
+  if (0 == count)
+    return MHD_YES;
+  bundle->entries = calloc (count,
+                            sizeof (struct BundleEntry));
+  if (NULL == bundle->entries)
+    return MHD_NO;
+  for (i = 0; i < count; i++)
+    {
+      entry = &bundle->entries[i];
+      p = &bundle->map[BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE];
+      if ( (MHD_YES != check_range (bundle, get_u32 (&p[0]), get_u32 (&p[4]))) ||
+           (MHD_YES != check_range (bundle, get_u32 (&p[8]), get_u32 (&p[12]))) ||
+           (MHD_YES != check_range (bundle, get_u64 (&p[16]), get_u64 (&p[24]))) ||
+           (MHD_YES != check_range (bundle, get_u64 (&p[32]), get_u64 (&p[40]))) )
+        return MHD_NO;
+      entry->path = &bundle->map[get_u32 (&p[0])];
+      entry->path_len = get_u32 (&p[4]);
+      entry->headers = &bundle->map[get_u32 (&p[8])];
+      entry->headers_len = get_u32 (&p[12]);
+      entry->plain.offset = get_u64 (&p[16]);
+      entry->plain.size = get_u64 (&p[24]);
+      entry->plain.data = &bundle->map[entry->plain.offset];
+      entry->gzip.offset = get_u64 (&p[32]);
+      entry->gzip.size = get_u64 (&p[40]);
+      entry->gzip.data = &bundle->map[entry->gzip.offset];
+      if ( (0 == entry->path_len) ||
+           ('/' != entry->path[0]) ||
+           (NULL != memchr (entry->path, '\0', entry->path_len)) )
+        return MHD_NO;
+      if (0 == i)
+        continue;
+      /* index must be strictly sorted for the binary search */
+      cmp_len = MHD_MIN (entry->path_len, entry[-1].path_len);
+      if ( (memcmp (entry[-1].path, entry->path, cmp_len) > 0) ||
+           ( (0 == memcmp (entry[-1].path, entry->path, cmp_len)) &&
+             (entry[-1].path_len >= entry->path_len) ) )
+        return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Callback for obtaining the data of an asset if `sendfile()`
+ * cannot be used.  Copies from the mapped bundle, which (unlike
+ * `lseek()` and `read()`) is safe even though many responses share
+ * the same file descriptor.
+ *
+ * @param cls the `struct BundleVariant`
+ * @param pos position in the asset
+ * @param buf where to copy the data
+ * @param max maximum number of bytes to copy
+ * @return number of bytes copied
+ */
+static ssize_t
+bundle_reader (void *cls,
+               uint64_t pos,
+               char *buf,
+               size_t max)
+{
+  const struct BundleVariant *variant = cls;
+
+  if (pos >= variant->size)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > variant->size - pos)
+    max = (size_t) (variant->size - pos);
+  if (max > SSIZE_MAX)
+    max = SSIZE_MAX;
+  memcpy (buf,
+          &variant->data[pos],
+          max);
+  return (ssize_t) max;
+}
+
+
+/**
+ * Add the precomputed headers of an asset to a response.  For the
+ * compressed variant, a strong "ETag" is made distinct from the
+ * one of the uncompressed asset by adding a "-gzip" suffix.
+ *
+ * @param response response to add the headers to
+ * @param entry asset with the headers
+ * @param is_gzip #MHD_YES if @a response is for the compressed variant
+ * @return #MHD_YES on success
+ */
+static int
+add_headers (struct MHD_Response *response,
+             const struct BundleEntry *entry,
+             int is_gzip)
+{
+  const char *pos;
+  const char *end;
+  const char *eol;
+  const char *colon;
+  char *line;
+  size_t len;
+  int ret;
+
+  pos = entry->headers;
+  end = &entry->headers[entry->headers_len];
+  while (pos < end)
+    {
+      eol = memchr (pos, '\n', end - pos);
+      if (NULL == eol)
+        eol = end;
+      len = eol - pos;
+      if ( (len > 0) && ('\r' == pos[len - 1]) )
+        len--;
+      if (0 != len)
+        {
+          line = malloc (len + sizeof ("-gzip\""));
+          if (NULL == line)
+            return MHD_NO;
+          memcpy (line, pos, len);
+          line[len] = '\0';
+          if ( (MHD_YES == is_gzip) &&
+               (len > strlen (MHD_HTTP_HEADER_ETAG ": \"")) &&
+               (MHD_str_equal_caseless_n_ (line,
+                                           MHD_HTTP_HEADER_ETAG ":",
+                                           strlen (MHD_HTTP_HEADER_ETAG ":"))) &&
+               ('"' == line[len - 1]) )
+            memcpy (&line[len - 1], "-gzip\"", sizeof ("-gzip\""));
+          colon = strchr (line, ':');
+          if (NULL == colon)
+            {
+              free (line);
+              return MHD_NO;
+            }
+          line[colon - line] = '\0';
+          colon++;
+          while ( (' ' == *colon) || ('\t' == *colon) )
+            colon++;
+          ret = MHD_add_response_header (response,
+                                         line,
+                                         colon);
+          free (line);
+          if (MHD_YES != ret)
+            return MHD_NO;
+        }
+      pos = eol + 1;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Create the response for a variant of an asset.
+ *
+ * @param bundle the bundle
+ * @param entry the asset
+ * @param variant the variant of @a entry
+ * @return NULL on error
+ */
+static struct MHD_Response *
+create_response (struct MHD_Bundle *bundle,
+                 const struct BundleEntry *entry,
+                 struct BundleVariant *variant)
+{
+  struct MHD_Response *response;
+  size_t block_size;
+
+  block_size = (size_t) MHD_MIN (variant->size,
+                                 BUNDLE_BLOCK_SIZE);
+  if (0 == block_size)
+    block_size = 1;
+  response = MHD_create_response_from_callback (variant->size,
+                                                block_size,
+                                                &bundle_reader,
+                                                variant,
+                                                NULL);
+  if (NULL == response)
+    return NULL;
+  /* allow sendfile() from the bundle; the file descriptor is
+     not closed with the response as there is no 'crfc' */
+  response->fd = bundle->fd;
+  response->fd_off = variant->offset;
+  if ( (MHD_YES != add_headers (response,
+                                entry,
+                                (variant == &entry->gzip) ? MHD_YES : MHD_NO)) ||
+       ( (0 != entry->gzip.size) &&
+         (MHD_YES != MHD_add_response_header (response,
+                                              MHD_HTTP_HEADER_VARY,
+                                              MHD_HTTP_HEADER_ACCEPT_ENCODING)) ) ||
+       ( (variant == &entry->gzip) &&
+         (MHD_YES != MHD_add_response_header (response,
+                                              MHD_HTTP_HEADER_CONTENT_ENCODING,
+                                              "gzip")) ) )
+    {
+      MHD_destroy_response (response);
+      return NULL;
+    }
+  return response;
+}
+
+
+/**
+ * Open (and map into memory) a static asset bundle.  The bundle is
+ * read-only and safe to use from multiple threads.
+ *
+ * @param filename name of the bundle file
+ * @return NULL on error (i.e. file not found, invalid format,
+ *         out of memory)
+ * @ingroup response
+ */
+struct MHD_Bundle *
+MHD_bundle_open (const char *filename)
+{
+  struct MHD_Bundle *bundle;
+  struct stat buf;
+  size_t off;
+  ssize_t ret;
+
+  bundle = malloc (sizeof (struct MHD_Bundle));
+  if (NULL == bundle)
+    return NULL;
+  memset (bundle, 0, sizeof (struct MHD_Bundle));
+  bundle->fd = open (filename, O_RDONLY | O_BINARY);
+  if (-1 == bundle->fd)
+    {
+      free (bundle);
+      return NULL;
+    }
+  if ( (0 != fstat (bundle->fd, &buf)) ||
+       (! S_ISREG (buf.st_mode)) ||
+       ((uint64_t) buf.st_size > SIZE_MAX) ||
+       (buf.st_size < BUNDLE_HEADER_SIZE) )
+    goto fail;
+  bundle->map_size = (size_t) buf.st_size;
+#ifdef HAVE_SYS_MMAN_H
+  bundle->map = mmap (NULL,
+                      bundle->map_size,
+                      PROT_READ,
+                      MAP_SHARED,
+                      bundle->fd,
+                      0);
+  if (MAP_FAILED == bundle->map)
+    bundle->map = NULL;
+  else
+    bundle->mapped = MHD_YES;
+#endif /* HAVE_SYS_MMAN_H */
+  if (NULL == bundle->map)
+    {
+      bundle->map = malloc (bundle->map_size);
+      if (NULL == bundle->map)
+        goto fail;
+      for (off = 0; off < bundle->map_size; off += ret)
+        {
+          ret = read (bundle->fd,
+                      &bundle->map[off],
+                      MHD_MIN (bundle->map_size - off, INT32_MAX));
+          if (ret <= 0)
+            goto fail;
+        }
+    }
+  if ( (MHD_YES != parse_index (bundle)) ||
+       (MHD_YES != MHD_mutex_create_ (&bundle->lock)) )
+    goto fail;
+  return bundle;
+
+ fail:
+  if (NULL != bundle->map)
+    {
+#ifdef HAVE_SYS_MMAN_H
+      if (MHD_YES == bundle->mapped)
+        (void) munmap (bundle->map, bundle->map_size);
+      else
+#endif /* HAVE_SYS_MMAN_H */
+        free (bundle->map);
+    }
+  free (bundle->entries);
+  (void) close (bundle->fd);
+  free (bundle);
+  return NULL;
+}
+
+
+/**
+ * Obtain the response for an asset in the bundle.  The response
+ * uses the bundle's file descriptor at the offset of the asset, so
+ * the data is transmitted with `sendfile()` where possible.  If the
+ * asset has a gzip-compressed variant and @a accept_encoding allows
+ * gzip, the response for the compressed variant (with a
+ * "Content-Encoding: gzip" header) is returned.  The caller owns a
+ * reference to the returned response and must call
+ * #MHD_destroy_response after queueing it.
+ *
+ * @param bundle bundle to search
+ * @param url URL of the asset (must start with '/')
+ * @param accept_encoding value of the "Accept-Encoding" header
+ *        of the request, or NULL
+ * @return NULL if the asset is not in the bundle (or out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_bundle_lookup (struct MHD_Bundle *bundle,
+                   const char *url,
+                   const char *accept_encoding)
+{
+  struct BundleEntry *entry;
+  struct BundleVariant *variant;
+  struct MHD_Response *response;
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int mid;
+  int cmp;
+
+  if ( (NULL == bundle) ||
+       (NULL == url) )
+    return NULL;
+  entry = NULL;
+  lo = 0;
+  hi = bundle->num_entries;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      cmp = compare_path (url,
+                          &bundle->entries[mid]);
+      if (0 == cmp)
+        {
+          entry = &bundle->entries[mid];
+          break;
+        }
+      if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  if (NULL == entry)
+    return NULL;
+  if ( (0 != entry->gzip.size) &&
+       (MHD_str_accepts_coding_ (accept_encoding,
+                                 "gzip")) )
+    variant = &entry->gzip;
+  else
+    variant = &entry->plain;
+  if (MHD_YES != MHD_mutex_lock_ (&bundle->lock))
+    MHD_PANIC ("Failed to acquire bundle mutex\n");
+  if (NULL == variant->response)
+    variant->response = create_response (bundle,
+                                         entry,
+                                         variant);
+  response = variant->response;
+  if (NULL != response)
+    MHD_increment_response_rc (response);
+  if (MHD_YES != MHD_mutex_unlock_ (&bundle->lock))
+    MHD_PANIC ("Failed to release bundle mutex\n");
+  return response;
+}
+
+
+/**
+ * Close a static asset bundle.  Must only be called once MHD is
+ * done with all responses obtained from the bundle (i.e. after
+ * the daemons using them have been stopped).
+ *
+ * @param bundle bundle to close
+ * @ingroup response
+ */
+void
+MHD_bundle_close (struct MHD_Bundle *bundle)
+{
+  unsigned int i;
+
+  if (NULL == bundle)
+    return;
+  for (i = 0; i < bundle->num_entries; i++)
+    {
+      if (NULL != bundle->entries[i].plain.response)
+        MHD_destroy_response (bundle->entries[i].plain.response);
+      if (NULL != bundle->entries[i].gzip.response)
+        MHD_destroy_response (bundle->entries[i].gzip.response);
+    }
+#ifdef HAVE_SYS_MMAN_H
+  if (MHD_YES == bundle->mapped)
+    (void) munmap (bundle->map, bundle->map_size);
+  else
+#endif /* HAVE_SYS_MMAN_H */
+    free (bundle->map);
+  free (bundle->entries);
+  (void) MHD_mutex_destroy_ (&bundle->lock);
+  (void) close (bundle->fd);
+  free (bundle);
+}
+
+/* end of bundle.c */
@@ -0,0 +1,501 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file compression.c
+ * @brief  gzip/deflate Content-Encoding of responses
+ * @author Christian Grothoff
+ */
+
+#include "compression.h"
+#include "response.h"
+#include "mhd_str.h"
+#include "mhd_limits.h"
+#include <zlib.h>
+
+/**
+ * Responses with fewer bytes than this are never compressed,
+ * the savings would not be worth the effort.
+ */
+#define MHD_COMPRESS_MIN_SIZE 256
+
+/**
+ * Size of the buffer used to obtain data from the application's
+ * callback when compressing on the fly.
+ */
+#define MHD_COMPRESS_BUFFER_SIZE (16 * 1024)
+
+
+/**
+ * Names of the codings, indexed by `enum MHD_CompressionCoding`.
+ */
+static const char *const coding_names[] = { "gzip", "deflate" };
+
+/**
+ * zlib 'windowBits' for the codings, indexed by
+ * `enum MHD_CompressionCoding` (+16 selects the gzip wrapper).
+ */
+static const int coding_window_bits[] = { 15 + 16, 15 };
+
+
+/**
+ * State for compressing the output of a callback response
+ * on the fly.
+ */
+struct CompressStream
+{
+
+  /**
+   * zlib state.
+   */
+  z_stream z;
+
+  /**
+   * Response we are compressing; we hold a reference.
+   */
+  struct MHD_Response *source;
+
+  /**
+   * Buffer for data obtained from @e source.
+   */
+  char *in_buf;
+
+  /**
+   * Position in @e source up to which we have obtained data.
+   */
+  uint64_t in_pos;
+
+  /**
+   * #MHD_YES once all data from @e source was obtained.
+   */
+  int in_done;
+
+  /**
+   * #MHD_YES once zlib produced all of its output.
+   */
+  int out_done;
+
+};
+
+
+/**
+ * Copy the headers and footers of a response to its compressed
+ * variant.  "Content-Length" is dropped and strong entity tags are
+ * made distinct by appending the name of the coding.
+ *
+ * @param src the response given by the application
+ * @param dst the compressed variant
+ * @param coding coding used for @a dst
+ * @return #MHD_YES on success
+ */
+static int
+copy_headers (struct MHD_Response *src,
+              struct MHD_Response *dst,
+              enum MHD_CompressionCoding coding)
+{
+  struct MHD_HTTP_Header *pos;
+  size_t len;
+  char *etag;
+  int ret;
+
+  for (pos = src->first_header; NULL != pos; pos = pos->next)
+    {
+      if (MHD_FOOTER_KIND == pos->kind)
+        {
+          if (MHD_YES != MHD_add_response_footer (dst,
+                                                  pos->header,
+                                                  pos->value))
+            return MHD_NO;
+          continue;
+        }
+      if (MHD_str_equal_caseless_ (pos->header,
+                                   MHD_HTTP_HEADER_CONTENT_LENGTH))
+        continue;
+      len = strlen (pos->value);
+      if ( (MHD_str_equal_caseless_ (pos->header,
+                                     MHD_HTTP_HEADER_ETAG)) &&
+           (len >= 2) &&
+           ('"' == pos->value[0]) &&
+           ('"' == pos->value[len - 1]) )
+        {
+          etag = malloc (len + strlen (coding_names[coding]) + 2);
+          if (NULL == etag)
+            return MHD_NO;
+          memcpy (etag, pos->value, len - 1);
+          sprintf (&etag[len - 1],
+                   "-%s\"",
+                   coding_names[coding]);
+          ret = MHD_add_response_header (dst,
+                                         pos->header,
+                                         etag);
+          free (etag);
+        }
+      else
+        ret = MHD_add_response_header (dst,
+                                       pos->header,
+                                       pos->value);
+      if (MHD_YES != ret)
+        return MHD_NO;
+    }
+  dst->flags = src->flags & ~MHD_RF_COMPRESS;
+  return MHD_add_response_header (dst,
+                                  MHD_HTTP_HEADER_CONTENT_ENCODING,
+                                  coding_names[coding]);
+}
+
+
+/**
+ * Compress the data of a buffer response in one go.
+ *
+ * @param response the buffer response
+ * @param coding coding to use
+ * @return NULL on error or if compression does not reduce the size
+ */
+static struct MHD_Response *
+compress_buffer (struct MHD_Response *response,
+                 enum MHD_CompressionCoding coding)
+{
+  struct MHD_Response *compressed;
+  z_stream z;
+  uLong bound;
+  char *out;
+
+  if (response->data_size > UINT_MAX)
+    return NULL;
+  memset (&z, 0, sizeof (z));
+  if (Z_OK != deflateInit2 (&z,
+                            Z_DEFAULT_COMPRESSION,
+                            Z_DEFLATED,
+                            coding_window_bits[coding],
+                            8,
+                            Z_DEFAULT_STRATEGY))
+    return NULL;
+  bound = deflateBound (&z,
+                        (uLong) response->data_size);
+  out = malloc (bound);
+  if (NULL == out)
+    {
+      (void) deflateEnd (&z);
+      return NULL;
+    }
+  z.next_in = (Bytef *) response->data;
+  z.avail_in = (uInt) response->data_size;
+  z.next_out = (Bytef *) out;
+  z.avail_out = (uInt) bound;
+  if ( (Z_STREAM_END != deflate (&z, Z_FINISH)) ||
+       (z.total_out >= response->data_size) )
+    {
+      (void) deflateEnd (&z);
+      free (out);
+      return NULL;
+    }
+  (void) deflateEnd (&z);
+  compressed = MHD_create_response_from_buffer (z.total_out,
+                                                out,
+                                                MHD_RESPMEM_MUST_FREE);
+  if (NULL == compressed)
+    {
+      free (out);
+      return NULL;
+    }
+  if (MHD_YES != copy_headers (response,
+                               compressed,
+                               coding))
+    {
+      MHD_destroy_response (compressed);
+      return NULL;
+    }
+  return compressed;
+}
+
+
+/**
+ * Callback producing the compressed data of a callback response.
+ * Obtains data from the application's callback and runs it through
+ * zlib.  If the application has no data available right now, the
+ * output produced so far is flushed to the client.
+ *
+ * @param cls our `struct CompressStream`
+ * @param pos position in the compressed data (ignored, as MHD asks
+ *        for the data sequentially)
+ * @param buf where to write the compressed data
+ * @param max maximum number of bytes to write to @a buf
+ * @return number of bytes written to @a buf
+ */
+static ssize_t
+compress_reader (void *cls,
+                 uint64_t pos,
+                 char *buf,
+                 size_t max)
+{
+  struct CompressStream *cs = cls;
+  struct MHD_Response *source = cs->source;
+  ssize_t ret;
+  int flush;
+  int zret;
+
+  if (MHD_YES == cs->out_done)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > UINT_MAX)
+    max = UINT_MAX;
+  if (max > SSIZE_MAX)
+    max = SSIZE_MAX;
+  cs->z.next_out = (Bytef *) buf;
+  cs->z.avail_out = (uInt) max;
+  while (cs->z.avail_out == max)
+    {
+      flush = Z_NO_FLUSH;
+      if ( (0 == cs->z.avail_in) &&
+           (MHD_NO == cs->in_done) )
+        {
+          if ( (MHD_SIZE_UNKNOWN != source->total_size) &&
+               (cs->in_pos >= source->total_size) )
+            {
+              cs->in_done = MHD_YES;
+            }
+          else
+            {
+              if (MHD_YES != MHD_mutex_lock_ (&source->mutex))
+                MHD_PANIC ("Failed to acquire response mutex\n");
+              ret = source->crc (source->crc_cls,
+                                 cs->in_pos,
+                                 cs->in_buf,
+                                 (size_t) MHD_MIN ((uint64_t) MHD_COMPRESS_BUFFER_SIZE,
+                                                   source->total_size - cs->in_pos));
+              if (MHD_YES != MHD_mutex_unlock_ (&source->mutex))
+                MHD_PANIC ("Failed to release response mutex\n");
+              if (((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret)
+                return MHD_CONTENT_READER_END_WITH_ERROR;
+              if (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret)
+                {
+                  cs->in_done = MHD_YES;
+                }
+              else if (0 == ret)
+                {
+                  /* no data right now, push out what we have */
+                  flush = Z_SYNC_FLUSH;
+                }
+              else
+                {
+                  cs->in_pos += ret;
+                  cs->z.next_in = (Bytef *) cs->in_buf;
+                  cs->z.avail_in = (uInt) ret;
+                }
+            }
+        }
+      if ( (MHD_YES == cs->in_done) &&
+           (0 == cs->z.avail_in) )
+        flush = Z_FINISH;
+      zret = deflate (&cs->z,
+                      flush);
+      if (Z_STREAM_END == zret)
+        {
+          cs->out_done = MHD_YES;
+          break;
+        }
+      if ( (Z_OK != zret) &&
+           (Z_BUF_ERROR != zret) )
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+      if (Z_SYNC_FLUSH == flush)
+        break;
+    }
+  if ( (cs->z.avail_out == max) &&
+       (MHD_YES == cs->out_done) )
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  return (ssize_t) (max - cs->z.avail_out);
+}
+
+
+/**
+ * Release the state for compressing a callback response.
+ *
+ * @param cls our `struct CompressStream`
+ */
+static void
+compress_free (void *cls)
+{
+  struct CompressStream *cs = cls;
+
+  (void) deflateEnd (&cs->z);
+  MHD_destroy_response (cs->source);
+  free (cs->in_buf);
+  free (cs);
+}
+
+
+/**
+ * Create a response compressing the output of a callback
+ * response on the fly.
+ *
+ * @param response the callback response
+ * @param coding coding to use
+ * @return NULL on error
+ */
+static struct MHD_Response *
+compress_stream (struct MHD_Response *response,
+                 enum MHD_CompressionCoding coding)
+{
+  struct MHD_Response *compressed;
+  struct CompressStream *cs;
+
+  cs = malloc (sizeof (struct CompressStream));
+  if (NULL == cs)
+    return NULL;
+  memset (cs, 0, sizeof (struct CompressStream));
+  cs->in_buf = malloc (MHD_COMPRESS_BUFFER_SIZE);
+  if (NULL == cs->in_buf)
+    {
+      free (cs);
+      return NULL;
+    }
+  if (Z_OK != deflateInit2 (&cs->z,
+                            Z_DEFAULT_COMPRESSION,
+                            Z_DEFLATED,
+                            coding_window_bits[coding],
+                            8,
+                            Z_DEFAULT_STRATEGY))
+    {
+      free (cs->in_buf);
+      free (cs);
+      return NULL;
+    }
+  cs->source = response;
+  MHD_increment_response_rc (response);
+  compressed = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                  MHD_COMPRESS_BUFFER_SIZE,
+                                                  &compress_reader,
+                                                  cs,
+                                                  &compress_free);
+  if (NULL == compressed)
+    {
+      compress_free (cs);
+      return NULL;
+    }
+  if (MHD_YES != copy_headers (response,
+                               compressed,
+                               coding))
+    {
+      MHD_destroy_response (compressed);
+      return NULL;
+    }
+  return compressed;
+}
+
+
+/**
+ * Select the response to actually queue for a response that has
+ * #MHD_RF_COMPRESS set.  If the client accepts a supported coding
+ * and compression is applicable, this is a compressed variant of
+ * @a response: for buffer responses, the compressed variant is
+ * created once and cached on @a response; for callback responses,
+ * a new response of unknown size is created which compresses the
+ * output of the callback on the fly (and is thus transmitted using
+ * chunked encoding).  Otherwise, it is @a response itself.
+ *
+ * @param connection connection the response is queued for
+ * @param response response given by the application
+ * @param status_code HTTP status code of the response
+ * @return response to use, with the reference counter incremented
+ *         (never NULL)
+ */
+struct MHD_Response *
+MHD_compress_response_ (struct MHD_Connection *connection,
+                        struct MHD_Response *response,
+                        unsigned int status_code)
+{
+  struct MHD_Response *compressed;
+  const char *accept;
+  enum MHD_CompressionCoding coding;
+
+  status_code &= ~MHD_ICY_FLAG;
+  accept = MHD_lookup_connection_value (connection,
+                                        MHD_HEADER_KIND,
+                                        MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  if (MHD_str_accepts_coding_ (accept,
+                               coding_names[MHD_COMPRESSION_GZIP]))
+    coding = MHD_COMPRESSION_GZIP;
+  else if (MHD_str_accepts_coding_ (accept,
+                                    coding_names[MHD_COMPRESSION_DEFLATE]))
+    coding = MHD_COMPRESSION_DEFLATE;
+  else
+    accept = NULL;
+  if ( (NULL == accept) ||
+       (NULL == connection->version) ||
+       ('\0' == connection->version[0]) ||
+       (status_code < MHD_HTTP_OK) ||
+       (MHD_HTTP_NO_CONTENT == status_code) ||
+       (MHD_HTTP_PARTIAL_CONTENT == status_code) ||
+       (MHD_HTTP_NOT_MODIFIED == status_code) ||
+       (response->total_size < MHD_COMPRESS_MIN_SIZE) ||
+       (NULL != MHD_get_response_header (response,
+                                         MHD_HTTP_HEADER_CONTENT_ENCODING)) )
+    {
+      MHD_increment_response_rc (response);
+      return response;
+    }
+  if (NULL != response->crc)
+    {
+      compressed = compress_stream (response,
+                                    coding);
+      if (NULL != compressed)
+        return compressed;
+      MHD_increment_response_rc (response);
+      return response;
+    }
+  if (MHD_YES != MHD_mutex_lock_ (&response->mutex))
+    MHD_PANIC ("Failed to acquire response mutex\n");
+  if ( (NULL == response->compressed[coding]) &&
+       (0 == (response->compress_useless & (1U << coding))) )
+    {
+      response->compressed[coding] = compress_buffer (response,
+                                                      coding);
+      if (NULL == response->compressed[coding])
+        response->compress_useless |= (1U << coding);
+    }
+  compressed = response->compressed[coding];
+  if (NULL == compressed)
+    {
+      response->reference_count++;
+      compressed = response;
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&response->mutex))
+    MHD_PANIC ("Failed to release response mutex\n");
+  if (compressed != response)
+    MHD_increment_response_rc (compressed);
+  return compressed;
+}
+
+
+/**
+ * Release the compressed variants cached on a response that
+ * is being destroyed.
+ *
+ * @param response response being destroyed
+ */
+void
+MHD_compress_response_cleanup_ (struct MHD_Response *response)
+{
+  unsigned int i;
+
+  for (i = 0; i < sizeof (response->compressed) / sizeof (response->compressed[0]); i++)
+    if (NULL != response->compressed[i])
+      MHD_destroy_response (response->compressed[i]);
+}
+
+/* end of compression.c */
@@ -0,0 +1,83 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file compression.h
+ * @brief  gzip/deflate Content-Encoding of responses
+ * @author Christian Grothoff
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "internal.h"
+
+#ifdef HAVE_ZLIB
+
+/**
+ * Content codings supported for compressing responses.
+ */
+enum MHD_CompressionCoding
+{
+  /**
+   * "gzip" (RFC 1952 format).
+   */
+  MHD_COMPRESSION_GZIP = 0,
+
+  /**
+   * "deflate" (RFC 1950 zlib format).
+   */
+  MHD_COMPRESSION_DEFLATE = 1
+};
+
+
+/**
+ * Select the response to actually queue for a response that has
+ * #MHD_RF_COMPRESS set.  If the client accepts a supported coding
+ * and compression is applicable, this is a compressed variant of
+ * @a response: for buffer responses, the compressed variant is
+ * created once and cached on @a response; for callback responses,
+ * a new response of unknown size is created which compresses the
+ * output of the callback on the fly (and is thus transmitted using
+ * chunked encoding).  Otherwise, it is @a response itself.
+ *
+ * @param connection connection the response is queued for
+ * @param response response given by the application
+ * @param status_code HTTP status code of the response
+ * @return response to use, with the reference counter incremented
+ *         (never NULL)
+ */
+struct MHD_Response *
+MHD_compress_response_ (struct MHD_Connection *connection,
+                        struct MHD_Response *response,
+                        unsigned int status_code);
+
+
+/**
+ * Release the compressed variants cached on a response that
+ * is being destroyed.
+ *
+ * @param response response being destroyed
+ */
+void
+MHD_compress_response_cleanup_ (struct MHD_Response *response);
+
+#endif
+
+#endif
@@ -31,6 +31,15 @@
 #include "response.h"
 #include "mhd_mono_clock.h"
 #include "mhd_str.h"
+#include "compression.h"
+#include "responsecache.h"
+#include "router.h"
+#include "upgrade.h"
+#include "http2.h"
+#include "proxy.h"
+#if HTTPS_SUPPORT
+#include "tls.h"
+#endif
 
 #if HAVE_NETINET_TCP_H
 /* for TCP_CORK */
@@ -161,6 +170,8 @@ socket_start_extra_buffering (struct MHD_Connection *connection)
 #endif /* TCP_NODELAY */
   if (!connection)
     return MHD_NO;
+  if (NULL != connection->transport.recv)
+    return MHD_NO; /* the descriptor is not ours to configure */
 #if defined(TCP_NOPUSH) && !defined(TCP_CORK)
   /* Buffer data before sending */
   res = (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NOPUSH, (const void*)&on_val,
@@ -209,6 +220,8 @@ socket_start_no_buffering_flush (struct MHD_Connection *connection)
 #endif /* !TCP_CORK */
   if (!connection)
     return MHD_NO;
+  if (NULL != connection->transport.recv)
+    return MHD_NO; /* the descriptor is not ours to configure */
 #if defined(TCP_CORK)
   /* Flush buffered data, allow partial packets */
   res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, (const void*)&off_val,
@@ -252,6 +265,8 @@ socket_start_no_buffering (struct MHD_Connection *connection)
 #endif /* TCP_CORK || TCP_NOPUSH */
   if (!connection)
     return MHD_NO;
+  if (NULL != connection->transport.recv)
+    return MHD_NO; /* the descriptor is not ours to configure */
 #if defined(TCP_CORK)
   /* Allow partial packets */
   res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, (const void*)&off_val,
@@ -292,6 +307,8 @@ socket_start_normal_buffering (struct MHD_Connection *connection)
 #endif /* TCP_CORK */
   if (!connection)
     return MHD_NO;
+  if (NULL != connection->transport.recv)
+    return MHD_NO; /* the descriptor is not ours to configure */
 #if defined(TCP_CORK)
   /* Allow partial packets */
   /* Disabling TCP_CORK will flush partial packet even if TCP_CORK wasn't enabled before
@@ -464,6 +481,28 @@ need_100_continue (struct MHD_Connection *connection)
 }
 
 
+/**
+ * Shut down the socket (or the custom transport) of a connection.
+ *
+ * @param connection connection to shut down
+ * @param how what to shut down
+ */
+void
+MHD_connection_shutdown_ (struct MHD_Connection *connection,
+                          enum MHD_TransportShutdown how)
+{
+  if (NULL != connection->transport.recv)
+    {
+      if (NULL != connection->transport.shutdown)
+        connection->transport.shutdown (connection->transport_cls,
+                                        how);
+      return;
+    }
+  shutdown (connection->socket_fd,
+            (MHD_TRANSPORT_SHUTDOWN_WRITE == how) ? SHUT_WR : SHUT_RDWR);
+}
+
+
 /**
  * Close the given connection and give the
  * specified termination code to the user.
@@ -479,9 +518,13 @@ MHD_connection_close_ (struct MHD_Connection *connection,
 
   daemon = connection->daemon;
   if (0 == (connection->daemon->options & MHD_USE_EPOLL_TURBO))
-    shutdown (connection->socket_fd, SHUT_WR);
+    MHD_connection_shutdown_ (connection,
+                              MHD_TRANSPORT_SHUTDOWN_WRITE);
   connection->state = MHD_CONNECTION_CLOSED;
   connection->event_loop_info = MHD_EVENT_LOOP_INFO_CLEANUP;
+  if ( (NULL != connection->cache_entry) ||
+       (NULL != connection->cache_wait) )
+    MHD_response_cache_abandon_ (connection);
   if ( (NULL != daemon->notify_completed) &&
        (MHD_YES == connection->client_aware) )
     daemon->notify_completed (daemon->notify_completed_cls,
@@ -552,9 +595,14 @@ try_ready_normal_body (struct MHD_Connection *connection)
        (response->data_size + response->data_start >
 	connection->response_write_position) )
     return MHD_YES; /* response already ready */
+  if ( (MHD_INVALID_SOCKET != response->fd) &&
+       (0 == (connection->daemon->options & MHD_USE_SSL)) &&
+       (NULL != connection->transport.sendfile) )
+    return MHD_YES; /* the transport sends from the file */
 #if LINUX
   if ( (MHD_INVALID_SOCKET != response->fd) &&
-       (0 == (connection->daemon->options & MHD_USE_SSL)) )
+       (0 == (connection->daemon->options & MHD_USE_SSL)) &&
+       (NULL == connection->transport.recv) )
     {
       /* will use sendfile, no need to bother response crc */
       return MHD_YES;
@@ -707,7 +755,9 @@ try_ready_chunked_body (struct MHD_Connection *connection)
  * connection.  If the "Connection" header is not exactly "close" or
  * "keep-alive", we proceed to use the default for the respective HTTP
  * version (which is conservative for HTTP 1.0, but might be a bit
- * optimistic for HTTP 1.1).
+ * optimistic for HTTP 1.1).  A request for a protocol "upgrade"
+ * ("Connection: upgrade") that the application did not accept with
+ * an upgrade response is answered and the connection is closed.
  *
  * @param connection the connection to check for keepalive
  * @return #MHD_YES if (based on the request), a keepalive is
@@ -755,8 +805,8 @@ keepalive_possible (struct MHD_Connection *connection)
  * @param date where to write the header, with
  *        at least 128 bytes available space.
  */
-static void
-get_date_string (char *date)
+void
+MHD_get_date_string_ (char *date)
 {
   static const char *const days[] =
     { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
@@ -897,7 +947,7 @@ build_header_response (struct MHD_Connection *connection)
       if ( (0 == (connection->daemon->options & MHD_SUPPRESS_DATE_NO_CLOCK)) &&
 	   (NULL == MHD_get_response_header (connection->response,
 					     MHD_HTTP_HEADER_DATE)) )
-        get_date_string (date);
+        MHD_get_date_string_ (date);
       else
         date[0] = '\0';
       size += strlen (date);
@@ -919,6 +969,15 @@ build_header_response (struct MHD_Connection *connection)
   switch (connection->state)
     {
     case MHD_CONNECTION_FOOTERS_RECEIVED:
+      if ( (NULL != connection->response->upgrade_handler) ||
+           (NULL != connection->response->ws_message_cb) )
+        {
+          /* the application sets the headers for the upgrade, there
+             is no body and the connection is not reused for HTTP */
+          response_has_keepalive = NULL;
+          connection->have_chunked_upload = MHD_NO;
+          break;
+        }
       response_has_close = MHD_get_response_header (connection->response,
                                                     MHD_HTTP_HEADER_CONNECTION);
       response_has_keepalive = response_has_close;
@@ -1195,7 +1254,7 @@ MHD_connection_update_event_loop_info (struct MHD_Connection *connection)
         {
 #if HTTPS_SUPPORT
 	case MHD_TLS_CONNECTION_INIT:
-	  if (0 == gnutls_record_get_direction (connection->tls_session))
+	  if (MHD_NO == MHD_tls_wants_write_ (connection))
             connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
 	  else
             connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
@@ -1306,6 +1365,11 @@ MHD_connection_update_event_loop_info (struct MHD_Connection *connection)
         case MHD_CONNECTION_FOOTERS_SENT:
           EXTRA_CHECK (0);
           break;
+        case MHD_CONNECTION_UPGRADE:
+          /* HTTP connections are suspended after the upgrade; HTTPS
+             connections use the handlers from upgrade.c from now on */
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+          break;
         case MHD_CONNECTION_CLOSED:
 	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_CLEANUP;
           return;       /* do nothing, not even reading */
@@ -1416,10 +1480,13 @@ connection_add_header (struct MHD_Connection *connection,
  * Parse the cookie header (see RFC 2109).
  *
  * @param connection connection to parse header of
- * @return #MHD_YES for success, #MHD_NO for failure (malformed, out of memory)
+ * @param cb function to call on each cookie found
+ * @return #MHD_YES for success, #MHD_NO for failure (malformed, out
+ *         of memory, or @a cb returned #MHD_NO)
  */
-static int
-parse_cookie_header (struct MHD_Connection *connection)
+int
+MHD_parse_cookie_header_ (struct MHD_Connection *connection,
+                          MHD_ArgumentIterator_ cb)
 {
   const char *hdr;
   char *cpy;
@@ -1443,8 +1510,6 @@ parse_cookie_header (struct MHD_Connection *connection)
       MHD_DLOG (connection->daemon,
                 "Not enough memory to parse cookies!\n");
 #endif
-      transmit_error_response (connection, MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
-                               REQUEST_TOO_BIG);
       return MHD_NO;
     }
   memcpy (cpy, hdr, strlen (hdr) + 1);
@@ -1468,7 +1533,7 @@ parse_cookie_header (struct MHD_Connection *connection)
         {
           /* value part omitted, use empty string... */
           if (MHD_NO ==
-              connection_add_header (connection, pos, "", MHD_COOKIE_KIND))
+              cb (connection, pos, "", MHD_COOKIE_KIND))
             return MHD_NO;
           if (old == '\0')
             break;
@@ -1502,10 +1567,10 @@ parse_cookie_header (struct MHD_Connection *connection)
           equals++;
         }
       if (MHD_NO ==
-	  connection_add_header (connection,
-				 pos,
-				 equals,
-				 MHD_COOKIE_KIND))
+	  cb (connection,
+              pos,
+              equals,
+              MHD_COOKIE_KIND))
         return MHD_NO;
       pos = semicolon;
     }
@@ -1513,6 +1578,28 @@ parse_cookie_header (struct MHD_Connection *connection)
 }
 
 
+/**
+ * Parse the cookie header of a request into the cookies of the
+ * connection.  If this fails, transmit an error response (request
+ * too big).
+ *
+ * @param connection connection to parse header of
+ * @return #MHD_YES for success, #MHD_NO for failure (malformed, out of memory)
+ */
+static int
+parse_cookie_header (struct MHD_Connection *connection)
+{
+  if (MHD_YES == MHD_parse_cookie_header_ (connection,
+                                           &connection_add_header))
+    return MHD_YES;
+  if (NULL == connection->response)
+    transmit_error_response (connection,
+                             MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                             REQUEST_TOO_BIG);
+  return MHD_NO;
+}
+
+
 /**
  * Parse the first line of the HTTP HEADER.
  *
@@ -1607,16 +1694,37 @@ call_connection_handler (struct MHD_Connection *connection)
 
   if (NULL != connection->response)
     return;                     /* already queued a response */
+  if ( (NULL != connection->daemon->response_cache) &&
+       (MHD_YES == MHD_response_cache_lookup_ (connection)) )
+    return;                     /* served from cache, or waiting for it */
+  if (MHD_NO == connection->client_aware)
+    {
+      /* first call for this request, select the handler */
+      connection->handler = connection->daemon->default_handler;
+      connection->handler_cls = connection->daemon->default_handler_cls;
+      if ( (NULL != connection->daemon->router) &&
+           (-1 == MHD_router_dispatch_ (connection)) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Not enough memory in pool to store route arguments\n");
+#endif
+          /* do not let the default handler serve the matched request */
+          MHD_connection_close_ (connection,
+                                 MHD_REQUEST_TERMINATED_WITH_ERROR);
+          return;
+        }
+    }
   processed = 0;
   connection->client_aware = MHD_YES;
   if (MHD_NO ==
-      connection->daemon->default_handler (connection->daemon-> default_handler_cls,
-					   connection,
-                                           connection->url,
-					   connection->method,
-					   connection->version,
-					   NULL, &processed,
-					   &connection->client_context))
+      connection->handler (connection->handler_cls,
+                           connection,
+                           connection->url,
+                           connection->method,
+                           connection->version,
+                           NULL, &processed,
+                           &connection->client_context))
     {
       /* serious internal error, close connection */
       CONNECTION_CLOSE_ERROR (connection,
@@ -1765,14 +1873,14 @@ process_request_body (struct MHD_Connection *connection)
       used = processed;
       connection->client_aware = MHD_YES;
       if (MHD_NO ==
-          connection->daemon->default_handler (connection->daemon->default_handler_cls,
-                                               connection,
-                                               connection->url,
-                                               connection->method,
-                                               connection->version,
-                                               buffer_head,
-                                               &processed,
-                                               &connection->client_context))
+          connection->handler (connection->handler_cls,
+                               connection,
+                               connection->url,
+                               connection->method,
+                               connection->version,
+                               buffer_head,
+                               &processed,
+                               &connection->client_context))
         {
           /* serious internal error, close connection */
 	  CONNECTION_CLOSE_ERROR (connection,
@@ -2124,8 +2232,8 @@ parse_connection_headers (struct MHD_Connection *connection)
  *
  * @param connection the connection that saw some activity
  */
-static void
-update_last_activity (struct MHD_Connection *connection)
+void
+MHD_update_last_activity_ (struct MHD_Connection *connection)
 {
   struct MHD_Daemon *daemon = connection->daemon;
 
@@ -2157,8 +2265,9 @@ update_last_activity (struct MHD_Connection *connection)
 int
 MHD_connection_handle_read (struct MHD_Connection *connection)
 {
-  update_last_activity (connection);
-  if (MHD_CONNECTION_CLOSED == connection->state)
+  MHD_update_last_activity_ (connection);
+  if ( (MHD_CONNECTION_CLOSED == connection->state) ||
+       (MHD_CONNECTION_UPGRADE == connection->state) )
     return MHD_YES;
   /* make sure "read" has a reasonable number of bytes
      in buffer to use per system call (if possible) */
@@ -2223,7 +2332,7 @@ MHD_connection_handle_write (struct MHD_Connection *connection)
   struct MHD_Response *response;
   ssize_t ret;
 
-  update_last_activity (connection);
+  MHD_update_last_activity_ (connection);
   while (1)
     {
 #if DEBUG_STATES
@@ -2359,6 +2468,7 @@ MHD_connection_handle_write (struct MHD_Connection *connection)
         case MHD_CONNECTION_FOOTERS_SENT:
           EXTRA_CHECK (0);
           break;
+        case MHD_CONNECTION_UPGRADE:
         case MHD_CONNECTION_CLOSED:
           return MHD_YES;
         case MHD_TLS_CONNECTION_INIT:
@@ -2407,6 +2517,15 @@ cleanup_connection (struct MHD_Connection *connection)
         XDLL_remove (daemon->manual_timeout_head,
                      daemon->manual_timeout_tail,
                      connection);
+#if HTTPS_SUPPORT
+      if (MHD_YES == connection->tls_read_ready)
+        {
+          TDLL_remove (daemon->tls_ready_head,
+                       daemon->tls_ready_tail,
+                       connection);
+          connection->tls_read_ready = MHD_NO;
+        }
+#endif
     }
   if (MHD_YES == connection->suspended)
     DLL_remove (daemon->suspended_connections_head,
@@ -2458,6 +2577,13 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
       switch (connection->state)
         {
         case MHD_CONNECTION_INIT:
+          if ( (MHD_USE_HTTP2 == (daemon->options & MHD_USE_HTTP2)) &&
+               (MHD_YES == MHD_http2_detect_ (connection)) )
+            {
+              if (MHD_CONNECTION_UPGRADE == connection->state)
+                return connection->idle_handler (connection);
+              continue;
+            }
           line = get_next_header_line (connection, &line_len);
           /* Check for empty string, as we might want
              to tolerate 'spurious' empty lines; also
@@ -2538,9 +2664,27 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
           connection->state = MHD_CONNECTION_HEADERS_PROCESSED;
           continue;
         case MHD_CONNECTION_HEADERS_PROCESSED:
+          if ( (MHD_USE_HTTP2 == (daemon->options & MHD_USE_HTTP2)) &&
+               (MHD_YES == MHD_http2_upgrade_ (connection)) )
+            {
+              if (MHD_CONNECTION_UPGRADE == connection->state)
+                return connection->idle_handler (connection);
+              continue;
+            }
           call_connection_handler (connection); /* first call */
           if (MHD_CONNECTION_CLOSED == connection->state)
             continue;
+          if ( (NULL != connection->response) &&
+               (NULL != connection->response->proxy_addr) )
+            {
+              if (MHD_YES != MHD_proxy_start_ (connection))
+                {
+                  CONNECTION_CLOSE_ERROR (connection,
+                                          "Closing connection (failed to forward request)\n");
+                  continue;
+                }
+              return connection->idle_handler (connection);
+            }
           if (need_100_continue (connection))
             {
               connection->state = MHD_CONNECTION_CONTINUE_SENDING;
@@ -2655,6 +2799,16 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
             continue;
           if (NULL == connection->response)
             break;              /* try again next time */
+          if (NULL != connection->response->proxy_addr)
+            {
+              if (MHD_YES != MHD_proxy_start_ (connection))
+                {
+                  CONNECTION_CLOSE_ERROR (connection,
+                                          "Closing connection (failed to forward request)\n");
+                  continue;
+                }
+              return connection->idle_handler (connection);
+            }
           if (MHD_NO == build_header_response (connection))
             {
               /* oops - close! */
@@ -2673,6 +2827,23 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
           /* no default action */
           break;
         case MHD_CONNECTION_HEADERS_SENT:
+          if ( (NULL != connection->response->upgrade_handler) ||
+               (NULL != connection->response->ws_message_cb) )
+            {
+              /* push the header out, the other protocol decides
+                 about buffering from now on */
+              if (MHD_NO != socket_flush_possible (connection))
+                socket_start_no_buffering_flush (connection);
+              socket_start_normal_buffering (connection);
+              connection->state = MHD_CONNECTION_UPGRADE;
+              if (MHD_NO == MHD_upgrade_connection_ (connection))
+                {
+                  CONNECTION_CLOSE_ERROR (connection,
+                                          "Closing connection (failed to upgrade)\n");
+                  continue;
+                }
+              break;
+            }
           /* Some clients may take some actions right after header receive */
           if (MHD_NO != socket_flush_possible (connection))
             {
@@ -2838,6 +3009,15 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
           connection->write_buffer_send_offset = 0;
           connection->write_buffer_append_offset = 0;
           continue;
+        case MHD_CONNECTION_UPGRADE:
+          /* only resumed once the application closed the socket */
+          if (MHD_YES == connection->urh->was_closed)
+            {
+              MHD_connection_close_ (connection,
+                                     MHD_REQUEST_TERMINATED_COMPLETED_OK);
+              continue;
+            }
+          break;
         case MHD_CONNECTION_CLOSED:
 	  cleanup_connection (connection);
 	  return MHD_NO;
@@ -2858,6 +3038,27 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
     }
   MHD_connection_update_event_loop_info (connection);
 #if EPOLL_SUPPORT
+  MHD_connection_epoll_ready_ (connection);
+  return MHD_connection_epoll_update_ (connection);
+#else
+  return MHD_YES;
+#endif
+}
+
+
+#if EPOLL_SUPPORT
+/**
+ * Put the connection into the list of connections that are ready
+ * for processing if it can make progress with the events it waits
+ * for (or if it waits on the application).
+ *
+ * @param connection connection to process
+ */
+void
+MHD_connection_epoll_ready_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
   if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
     {
       switch (connection->event_loop_info)
@@ -2901,14 +3102,9 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
           break;
         }
     }
-  return MHD_connection_epoll_update_ (connection);
-#else
-  return MHD_YES;
-#endif
 }
 
 
-#if EPOLL_SUPPORT
 /**
  * Perform epoll() processing, possibly moving the connection back into
  * the epoll() set if needed.
@@ -2991,19 +3187,10 @@ MHD_get_connection_info (struct MHD_Connection *connection,
     {
 #if HTTPS_SUPPORT
     case MHD_CONNECTION_INFO_CIPHER_ALGO:
-      if (connection->tls_session == NULL)
-	return NULL;
-      connection->cipher = gnutls_cipher_get (connection->tls_session);
-      return (const union MHD_ConnectionInfo *) &connection->cipher;
     case MHD_CONNECTION_INFO_PROTOCOL:
-      if (connection->tls_session == NULL)
-	return NULL;
-      connection->protocol = gnutls_protocol_get_version (connection->tls_session);
-      return (const union MHD_ConnectionInfo *) &connection->protocol;
     case MHD_CONNECTION_INFO_GNUTLS_SESSION:
-      if (connection->tls_session == NULL)
-	return NULL;
-      return (const union MHD_ConnectionInfo *) &connection->tls_session;
+      return MHD_tls_get_info_ (connection,
+                                info_type);
 #endif
     case MHD_CONNECTION_INFO_CLIENT_ADDRESS:
       return (const union MHD_ConnectionInfo *) &connection->addr;
@@ -3041,7 +3228,8 @@ MHD_set_connection_option (struct MHD_Connection *connection,
     {
     case MHD_CONNECTION_OPTION_TIMEOUT:
       if ( (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-          (MHD_YES != connection->suspended) )
+          (MHD_YES != connection->suspended) &&
+          (NULL == connection->h2_stream) )
         {
           if (connection->connection_timeout == daemon->connection_timeout)
             XDLL_remove (daemon->normal_timeout_head,
@@ -3056,7 +3244,8 @@ MHD_set_connection_option (struct MHD_Connection *connection,
       connection->connection_timeout = va_arg (ap, unsigned int);
       va_end (ap);
       if ( (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-          (MHD_YES != connection->suspended) )
+          (MHD_YES != connection->suspended) &&
+          (NULL == connection->h2_stream) )
         {
           if (connection->connection_timeout == daemon->connection_timeout)
             XDLL_insert (daemon->normal_timeout_head,
@@ -3090,16 +3279,98 @@ MHD_queue_response (struct MHD_Connection *connection,
                     unsigned int status_code,
                     struct MHD_Response *response)
 {
+  struct MHD_Daemon *daemon;
+  const char *clen;
+
   if ( (NULL == connection) ||
        (NULL == response) ||
        (NULL != connection->response) ||
        ( (MHD_CONNECTION_HEADERS_PROCESSED != connection->state) &&
 	 (MHD_CONNECTION_FOOTERS_RECEIVED != connection->state) ) )
     return MHD_NO;
-  MHD_increment_response_rc (response);
+  if ( (NULL != response->upgrade_handler) ||
+       (NULL != response->ws_message_cb) )
+    {
+      daemon = connection->daemon;
+      if (MHD_ALLOW_UPGRADE != (daemon->options & MHD_ALLOW_UPGRADE))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Attempted 'upgrade' connection on daemon without MHD_ALLOW_UPGRADE option!\n");
+#endif
+          return MHD_NO;
+        }
+      if ( (MHD_HTTP_SWITCHING_PROTOCOLS != status_code) ||
+           (NULL == connection->version) ||
+           (! MHD_str_equal_caseless_ (connection->version,
+                                       MHD_HTTP_VERSION_1_1)) ||
+           ( (MHD_CONNECTION_HEADERS_PROCESSED == connection->state) &&
+             (0 != connection->remaining_upload_size) ) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Upgrade response must use status 101 for an HTTP/1.1 request without body!\n");
+#endif
+          return MHD_NO;
+        }
+#if EPOLL_SUPPORT
+      /* WebSockets stay in the event loop and work with epoll */
+      if ( (NULL != response->upgrade_handler) &&
+           (0 != (daemon->options & MHD_USE_SSL)) &&
+           (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Upgrading HTTPS connections is not supported with epoll!\n");
+#endif
+          return MHD_NO;
+        }
+#endif
+    }
+  if (NULL != response->proxy_addr)
+    {
+      daemon = connection->daemon;
+      if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
+           (NULL != connection->h2_stream) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Proxy responses are not supported with a thread per connection or HTTP/2!\n");
+#endif
+          return MHD_NO;
+        }
+      clen = MHD_lookup_connection_value (connection,
+                                          MHD_HEADER_KIND,
+                                          MHD_HTTP_HEADER_CONTENT_LENGTH);
+      if ( (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state) &&
+           ( (MHD_YES == connection->have_chunked_upload) ||
+             ( (NULL != clen) &&
+               (0 != strcmp (clen, "0")) ) ) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Proxy response must be queued before the request body is processed!\n");
+#endif
+          return MHD_NO;
+        }
+    }
+  if (NULL != connection->cache_entry)
+    MHD_response_cache_store_ (connection,
+                               status_code,
+                               response);
+#ifdef HAVE_ZLIB
+  if ( (0 != (response->flags & MHD_RF_COMPRESS)) &&
+       (NULL == response->proxy_addr) )
+    response = MHD_compress_response_ (connection,
+                                       response,
+                                       status_code);
+  else
+#endif
+    MHD_increment_response_rc (response);
   connection->response = response;
   connection->responseCode = status_code;
-  if ( (NULL != connection->method) &&
+  if ( (NULL == response->proxy_addr) &&
+       (NULL != connection->method) &&
        (MHD_str_equal_caseless_ (connection->method, MHD_HTTP_METHOD_HEAD)) )
     {
       /* if this is a "HEAD" request, pretend that we
@@ -3107,6 +3378,7 @@ MHD_queue_response (struct MHD_Connection *connection,
       connection->response_write_position = response->total_size;
     }
   if ( (MHD_CONNECTION_HEADERS_PROCESSED == connection->state) &&
+       (NULL == response->proxy_addr) &&
        (NULL != connection->method) &&
        ( (MHD_str_equal_caseless_ (connection->method,
                                    MHD_HTTP_METHOD_POST)) ||
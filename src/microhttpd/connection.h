@@ -93,7 +93,63 @@ MHD_connection_close_ (struct MHD_Connection *connection,
                        enum MHD_RequestTerminationCode termination_code);
 
 
+/**
+ * Shut down the socket (or the custom transport) of a connection.
+ *
+ * @param connection connection to shut down
+ * @param how what to shut down
+ */
+void
+MHD_connection_shutdown_ (struct MHD_Connection *connection,
+                          enum MHD_TransportShutdown how);
+
+
+/**
+ * Update the 'last_activity' field of the connection to the current time
+ * and move the connection to the head of the 'normal_timeout' list if
+ * the timeout for the connection uses the default value.
+ *
+ * @param connection the connection that saw some activity
+ */
+void
+MHD_update_last_activity_ (struct MHD_Connection *connection);
+
+
+/**
+ * Produce HTTP "Date:" header.
+ *
+ * @param date where to write the header, with
+ *        at least 128 bytes available space.
+ */
+void
+MHD_get_date_string_ (char *date);
+
+
+/**
+ * Parse the cookie header (see RFC 2109).
+ *
+ * @param connection connection to parse header of
+ * @param cb function to call on each cookie found
+ * @return #MHD_YES for success, #MHD_NO for failure (malformed, out
+ *         of memory, or @a cb returned #MHD_NO)
+ */
+int
+MHD_parse_cookie_header_ (struct MHD_Connection *connection,
+                          MHD_ArgumentIterator_ cb);
+
+
 #if EPOLL_SUPPORT
+/**
+ * Put the connection into the list of connections that are ready
+ * for processing if it can make progress with the events it waits
+ * for (or if it waits on the application).
+ *
+ * @param connection connection to process
+ */
+void
+MHD_connection_epoll_ready_ (struct MHD_Connection *connection);
+
+
 /**
  * Perform epoll processing, possibly moving the connection back into
  * the epoll set if needed.
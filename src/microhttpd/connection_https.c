@@ -32,11 +32,28 @@
 #include "memorypool.h"
 #include "response.h"
 #include "mhd_mono_clock.h"
-#include <gnutls/gnutls.h>
+#include "http2.h"
+#include "tls.h"
 
 
 /**
- * Give gnuTLS chance to work on the TLS handshake.
+ * The TLS handshake of @a connection has completed, prepare the
+ * connection for HTTP processing.
+ *
+ * @param connection connection that finished its handshake
+ */
+void
+MHD_tls_handshake_completed_ (struct MHD_Connection *connection)
+{
+  /* set connection state to enable HTTP processing */
+  connection->state = MHD_CONNECTION_INIT;
+  if (MHD_USE_HTTP2 == (connection->daemon->options & MHD_USE_HTTP2))
+    (void) MHD_http2_alpn_negotiated_ (connection);
+}
+
+
+/**
+ * Give the TLS library a chance to work on the TLS handshake.
  *
  * @param connection connection to handshake on
  * @return #MHD_YES on error or if the handshake is progressing
@@ -46,20 +63,18 @@
 static int
 run_tls_handshake (struct MHD_Connection *connection)
 {
-  int ret;
+  enum MHD_TlsResult ret;
 
   connection->last_activity = MHD_monotonic_sec_counter();
   if (connection->state == MHD_TLS_CONNECTION_INIT)
     {
-      ret = gnutls_handshake (connection->tls_session);
-      if (ret == GNUTLS_E_SUCCESS)
+      ret = MHD_tls_handshake_ (connection);
+      if (MHD_TLS_DONE == ret)
 	{
-	  /* set connection state to enable HTTP processing */
-	  connection->state = MHD_CONNECTION_INIT;
+	  MHD_tls_handshake_completed_ (connection);
 	  return MHD_YES;
 	}
-      if ( (ret == GNUTLS_E_AGAIN) ||
-	   (ret == GNUTLS_E_INTERRUPTED) )
+      if (MHD_TLS_AGAIN == ret)
 	{
 	  /* handshake not done */
 	  return MHD_YES;
@@ -77,6 +92,52 @@ run_tls_handshake (struct MHD_Connection *connection)
 }
 
 
+/**
+ * Should the session stay corked after the response header was
+ * queued?  This is the case if the body is already in memory, as
+ * then the idle handler readies it at once and the next write adds
+ * (the beginning of) it to the same record.
+ *
+ * @param connection connection with a corked session
+ * @return #MHD_YES to keep collecting data, #MHD_NO to send it
+ */
+static int
+keep_corked (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+
+  return ( (MHD_CONNECTION_HEADERS_SENT == connection->state) &&
+           (NULL != response) &&
+           (NULL == response->crc) &&
+           (0 != response->total_size) &&
+           (NULL == response->upgrade_handler) &&
+           (NULL == response->ws_message_cb) ) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Send the records queued while the session was corked.
+ *
+ * @param connection connection with a corked session
+ * @return #MHD_YES if everything was sent (or the connection was
+ *         closed), #MHD_NO if the socket is not ready for all of it
+ */
+static int
+tls_uncork (struct MHD_Connection *connection)
+{
+  enum MHD_TlsResult ret;
+
+  ret = MHD_tls_uncork_ (connection);
+  if (MHD_TLS_AGAIN == ret)
+    return MHD_NO; /* still corked, try again once we can write */
+  connection->tls_corked = MHD_NO;
+  if (MHD_TLS_FAILED == ret)
+    MHD_connection_close_ (connection,
+                           MHD_REQUEST_TERMINATED_WITH_ERROR);
+  return MHD_YES;
+}
+
+
 /**
  * This function handles a particular SSL/TLS connection when
  * it has been determined that there is data to be read off a
@@ -108,6 +169,10 @@ MHD_tls_connection_handle_read (struct MHD_Connection *connection)
  * will forward all write requests to the underlying daemon unless
  * the connection has been marked for closing.
  *
+ * The session is corked while a response header is written, and (if
+ * the body is in memory) until the body was written as well, so that
+ * small responses go out as a single record with a single `send()`.
+ *
  * @return always #MHD_YES (we should continue to process the connection)
  */
 static int
@@ -115,7 +180,18 @@ MHD_tls_connection_handle_write (struct MHD_Connection *connection)
 {
   if (MHD_YES == run_tls_handshake (connection))
     return MHD_YES;
-  return MHD_connection_handle_write (connection);
+  if ( (MHD_NO == connection->tls_corked) &&
+       (MHD_CONNECTION_HEADERS_SENDING == connection->state) )
+    {
+      MHD_tls_cork_ (connection);
+      connection->tls_corked = MHD_YES;
+    }
+  MHD_connection_handle_write (connection);
+  if ( (MHD_YES == connection->tls_corked) &&
+       (MHD_CONNECTION_CLOSED != connection->state) &&
+       (MHD_NO == keep_corked (connection)) )
+    (void) tls_uncork (connection);
+  return MHD_YES;
 }
 
 
@@ -144,6 +220,21 @@ MHD_tls_connection_handle_idle (struct MHD_Connection *connection)
   if ( (timeout != 0) && (timeout <= (MHD_monotonic_sec_counter() - connection->last_activity)))
     MHD_connection_close_ (connection,
                            MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+  if ( (MHD_YES == connection->tls_corked) &&
+       (MHD_CONNECTION_CLOSED != connection->state) &&
+       (MHD_NO == keep_corked (connection)) &&
+       (MHD_NO == tls_uncork (connection)) )
+    {
+      /* the response must not go on (or the connection be closed)
+         before the queued records are out */
+      connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+#if EPOLL_SUPPORT
+      MHD_connection_epoll_ready_ (connection);
+      return MHD_connection_epoll_update_ (connection);
+#else
+      return MHD_YES;
+#endif
+    }
   switch (connection->state)
     {
       /* on newly created connections we might reach here before any reply has been received */
@@ -151,10 +242,11 @@ MHD_tls_connection_handle_idle (struct MHD_Connection *connection)
       break;
       /* close connection if necessary */
     case MHD_CONNECTION_CLOSED:
-      gnutls_bye (connection->tls_session, GNUTLS_SHUT_RDWR);
+      MHD_tls_bye_ (connection,
+                    MHD_TRANSPORT_SHUTDOWN_BOTH);
       return MHD_connection_handle_idle (connection);
     default:
-      if ( (0 != gnutls_record_check_pending (connection->tls_session)) &&
+      if ( (0 != MHD_tls_pending_ (connection)) &&
 	   (MHD_YES != MHD_tls_connection_handle_read (connection)) )
 	return MHD_YES;
       return MHD_connection_handle_idle (connection);
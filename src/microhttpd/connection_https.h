@@ -37,6 +37,16 @@
  */
 void 
 MHD_set_https_callbacks (struct MHD_Connection *connection);
+
+
+/**
+ * The TLS handshake of @a connection has completed, prepare the
+ * connection for HTTP processing.
+ *
+ * @param connection connection that finished its handshake
+ */
+void
+MHD_tls_handshake_completed_ (struct MHD_Connection *connection);
 #endif
 
 #endif
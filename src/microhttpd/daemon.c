@@ -32,6 +32,22 @@
 #include "mhd_limits.h"
 #include "autoinit_funcs.h"
 #include "mhd_mono_clock.h"
+#include "responsecache.h"
+#include "router.h"
+#include "upgrade.h"
+#include "websocket.h"
+#include "eventchannel.h"
+#include "http2.h"
+#include "proxy.h"
+#ifdef HAVE_POSTPROCESSOR
+#include "postprocessor.h"
+#endif
+#ifdef DAUTH_SUPPORT
+#include "digestauth.h"
+#endif
+#ifdef BAUTH_SUPPORT
+#include "basicauth.h"
+#endif
 
 #if HAVE_SEARCH_H
 #include <search.h>
@@ -41,7 +57,8 @@
 
 #if HTTPS_SUPPORT
 #include "connection_https.h"
-#include <gcrypt.h>
+#include "tls.h"
+#include "tlshandshake.h"
 #endif
 
 #if defined(HAVE_POLL_H) && defined(HAVE_POLL)
@@ -173,9 +190,9 @@ static int mhd_winsock_inited_ = 0;
  * @param sock socket to manipulate
  * @return #MHD_YES if succeeded, #MHD_NO otherwise
  */
-static int
-make_nonblocking (struct MHD_Daemon *daemon,
-                  MHD_socket sock)
+int
+MHD_socket_nonblocking_ (struct MHD_Daemon *daemon,
+                         MHD_socket sock)
 {
 #ifdef MHD_WINSOCK_SOCKETS
   unsigned long flags = 1;
@@ -466,6 +483,37 @@ MHD_ip_limit_del (struct MHD_Daemon *daemon,
 
 
 #if HTTPS_SUPPORT
+/**
+ * Update whether decrypted data is waiting inside of TLS for
+ * @a connection, and with it the membership of the connection
+ * in the TDLL of its daemon.
+ *
+ * @param connection connection to update
+ */
+static void
+update_tls_read_ready (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  int ready;
+
+  ready = (0 != MHD_tls_pending_ (connection))
+    ? MHD_YES : MHD_NO;
+  if (ready == connection->tls_read_ready)
+    return;
+  connection->tls_read_ready = ready;
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return; /* only used by the thread of the connection */
+  if (MHD_YES == ready)
+    TDLL_insert (daemon->tls_ready_head,
+                 daemon->tls_ready_tail,
+                 connection);
+  else
+    TDLL_remove (daemon->tls_ready_head,
+                 daemon->tls_ready_tail,
+                 connection);
+}
+
+
 /**
  * Callback for receiving data from the socket.
  *
@@ -479,14 +527,9 @@ recv_tls_adapter (struct MHD_Connection *connection, void *other, size_t i)
 {
   ssize_t res;
 
-  if (MHD_YES == connection->tls_read_ready)
-    {
-      connection->daemon->num_tls_read_ready--;
-      connection->tls_read_ready = MHD_NO;
-    }
-  res = gnutls_record_recv (connection->tls_session, other, i);
-  if ( (GNUTLS_E_AGAIN == res) ||
-       (GNUTLS_E_INTERRUPTED == res) )
+  res = MHD_tls_recv_ (connection, other, i);
+  update_tls_read_ready (connection);
+  if (MHD_TLS_AGAIN == res)
     {
       MHD_set_socket_errno_ (EINTR);
 #if EPOLL_SUPPORT
@@ -496,24 +539,48 @@ recv_tls_adapter (struct MHD_Connection *connection, void *other, size_t i)
     }
   if (res < 0)
     {
-      /* Likely 'GNUTLS_E_INVALID_SESSION' (client communication
-	 disrupted); set errno to something caller will interpret
-	 correctly as a hard error */
+      /* Likely client communication disrupted; set errno to
+	 something caller will interpret correctly as a hard error */
       MHD_set_socket_errno_ (ECONNRESET);
-      return res;
-    }
-  if ((size_t)res == i)
-    {
-      connection->tls_read_ready = MHD_YES;
-      connection->daemon->num_tls_read_ready++;
+      return -1;
     }
   return res;
 }
 
 
+/**
+ * Size of the plaintext of the records sent by a connection that
+ * just started to send (or did not send for a while).  With the
+ * TLS overhead, such a record fits into a single TCP segment, so
+ * that the client can decrypt the first bytes as soon as the first
+ * packet arrived instead of waiting for a full 16 KiB record.
+ */
+#define MHD_TLS_SMALL_RECORD_SIZE 1369
+
+/**
+ * Number of bytes sent in small records before switching to records
+ * of the maximum size (by then, TCP should have opened the
+ * congestion window enough for bulk transfers).
+ */
+#define MHD_TLS_SMALL_RECORD_LIMIT (64 * 1024)
+
+/**
+ * Number of seconds a connection must not have sent anything to
+ * start over with small records (TCP restarts slow start as well).
+ * The clock only has a resolution of one second, so the idle time
+ * must exceed this value (then at least two full seconds passed).
+ */
+#define MHD_TLS_SMALL_RECORD_IDLE 2
+
+
 /**
  * Callback for writing data to the socket.
  *
+ * The first #MHD_TLS_SMALL_RECORD_LIMIT bytes after the connection
+ * was established or idle are sent in records of at most
+ * #MHD_TLS_SMALL_RECORD_SIZE bytes, later data in records of the
+ * maximum size.
+ *
  * @param connection the MHD connection structure
  * @param other data to write
  * @param i number of bytes to write
@@ -523,11 +590,62 @@ static ssize_t
 send_tls_adapter (struct MHD_Connection *connection,
                   const void *other, size_t i)
 {
-  int res;
+  const char *data = other;
+  time_t now;
+  size_t record;
+  size_t corked;
+  size_t sent;
+  size_t size;
+  ssize_t res;
 
-  res = gnutls_record_send (connection->tls_session, other, i);
-  if ( (GNUTLS_E_AGAIN == res) ||
-       (GNUTLS_E_INTERRUPTED == res) )
+  now = MHD_monotonic_sec_counter ();
+  if (now - connection->tls_last_send > MHD_TLS_SMALL_RECORD_IDLE)
+    connection->tls_bytes_sent = 0;
+  record = MHD_tls_max_record_size_ (connection);
+  if ( (connection->tls_bytes_sent < MHD_TLS_SMALL_RECORD_LIMIT) &&
+       (record > MHD_TLS_SMALL_RECORD_SIZE) )
+    record = MHD_TLS_SMALL_RECORD_SIZE;
+  if (MHD_YES == connection->tls_corked)
+    {
+      /* collect at most one record; it is sent (by the write
+         handler) before anything else is queued */
+      corked = MHD_tls_corked_ (connection);
+      if (corked >= record)
+        {
+          MHD_set_socket_errno_ (EINTR);
+          return -1;
+        }
+      if (i > record - corked)
+        i = record - corked;
+    }
+  sent = 0;
+  do
+    {
+      size = i - sent;
+      if ( (record < size) &&
+           (MHD_NO == connection->tls_corked) &&
+           (connection->tls_bytes_sent < MHD_TLS_SMALL_RECORD_LIMIT) )
+        size = record;
+      res = MHD_tls_send_ (connection,
+                           &data[sent],
+                           size);
+      if (res <= 0)
+        break;
+      sent += res;
+      connection->tls_bytes_sent += res;
+    }
+  while ( (sent < i) &&
+          (connection->tls_bytes_sent < MHD_TLS_SMALL_RECORD_LIMIT) );
+  if (0 != sent)
+    {
+      connection->tls_last_send = now;
+#if EPOLL_SUPPORT
+      if (MHD_TLS_AGAIN == res)
+        connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+#endif
+      return sent;
+    }
+  if (MHD_TLS_AGAIN == res)
     {
       MHD_set_socket_errno_ (EINTR);
 #if EPOLL_SUPPORT
@@ -537,131 +655,13 @@ send_tls_adapter (struct MHD_Connection *connection,
     }
   if (res < 0)
     {
-      /* some other GNUTLS error, should set 'errno'; as we do not
-         really understand the error (not listed in GnuTLS
-         documentation explicitly), we set 'errno' to something that
+      /* some other TLS error; we set 'errno' to something that
          will cause the connection to fail. */
       MHD_set_socket_errno_ (ECONNRESET);
       return -1;
     }
   return res;
 }
-
-
-/**
- * Read and setup our certificate and key.
- *
- * @param daemon handle to daemon to initialize
- * @return 0 on success
- */
-static int
-MHD_init_daemon_certificate (struct MHD_Daemon *daemon)
-{
-  gnutls_datum_t key;
-  gnutls_datum_t cert;
-  int ret;
-
-#if GNUTLS_VERSION_MAJOR >= 3
-  if (NULL != daemon->cert_callback)
-    {
-      gnutls_certificate_set_retrieve_function2 (daemon->x509_cred,
-                                                 daemon->cert_callback);
-    }
-#endif
-  if (NULL != daemon->https_mem_trust)
-    {
-      cert.data = (unsigned char *) daemon->https_mem_trust;
-      cert.size = strlen (daemon->https_mem_trust);
-      if (gnutls_certificate_set_x509_trust_mem (daemon->x509_cred, &cert,
-						 GNUTLS_X509_FMT_PEM) < 0)
-	{
-#ifdef HAVE_MESSAGES
-	  MHD_DLOG(daemon,
-		   "Bad trust certificate format\n");
-#endif
-	  return -1;
-	}
-    }
-
-  if (MHD_YES == daemon->have_dhparams)
-    {
-      gnutls_certificate_set_dh_params (daemon->x509_cred,
-                                        daemon->https_mem_dhparams);
-    }
-  /* certificate & key loaded from memory */
-  if ( (NULL != daemon->https_mem_cert) &&
-       (NULL != daemon->https_mem_key) )
-    {
-      key.data = (unsigned char *) daemon->https_mem_key;
-      key.size = strlen (daemon->https_mem_key);
-      cert.data = (unsigned char *) daemon->https_mem_cert;
-      cert.size = strlen (daemon->https_mem_cert);
-
-      if (NULL != daemon->https_key_password) {
-#if GNUTLS_VERSION_NUMBER >= 0x030111
-        ret = gnutls_certificate_set_x509_key_mem2 (daemon->x509_cred,
-                                                    &cert, &key,
-                                                    GNUTLS_X509_FMT_PEM,
-                                                    daemon->https_key_password,
-                                                    0);
-#else
-#ifdef HAVE_MESSAGES
-	MHD_DLOG (daemon,
-                  "Failed to setup x509 certificate/key: pre 3.X.X version " \
-		  "of GnuTLS does not support setting key password");
-#endif
-	return -1;
-#endif
-      }
-      else
-        ret = gnutls_certificate_set_x509_key_mem (daemon->x509_cred,
-                                                   &cert, &key,
-                                                   GNUTLS_X509_FMT_PEM);
-#ifdef HAVE_MESSAGES
-      if (0 != ret)
-        MHD_DLOG (daemon,
-                  "GnuTLS failed to setup x509 certificate/key: %s\n",
-                  gnutls_strerror (ret));
-#endif
-      return ret;
-    }
-#if GNUTLS_VERSION_MAJOR >= 3
-  if (NULL != daemon->cert_callback)
-    return 0;
-#endif
-#ifdef HAVE_MESSAGES
-  MHD_DLOG (daemon,
-            "You need to specify a certificate and key location\n");
-#endif
-  return -1;
-}
-
-
-/**
- * Initialize security aspects of the HTTPS daemon
- *
- * @param daemon handle to daemon to initialize
- * @return 0 on success
- */
-static int
-MHD_TLS_init (struct MHD_Daemon *daemon)
-{
-  switch (daemon->cred_type)
-    {
-    case GNUTLS_CRD_CERTIFICATE:
-      if (0 !=
-          gnutls_certificate_allocate_credentials (&daemon->x509_cred))
-        return GNUTLS_E_MEMORY_ERROR;
-      return MHD_init_daemon_certificate (daemon);
-    default:
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "Error: invalid credentials type %d specified.\n",
-                daemon->cred_type);
-#endif
-      return -1;
-    }
-}
 #endif
 
 
@@ -812,6 +812,28 @@ MHD_get_fdset2 (struct MHD_Daemon *daemon,
 	  /* this should never happen */
 	  break;
 	}
+      if ( (NULL != pos->urh) &&
+           (MHD_INVALID_SOCKET != pos->urh->mhd_sock) )
+        {
+          /* upgraded HTTPS connection, also watch the application's data */
+          if ( (MHD_YES == pos->urh->app_read_wanted) &&
+               (MHD_YES != add_to_fd_set (pos->urh->mhd_sock, read_fd_set, max_fd, fd_setsize)) )
+            result = MHD_NO;
+          if ( (MHD_YES == pos->urh->app_write_wanted) &&
+               (MHD_YES != add_to_fd_set (pos->urh->mhd_sock, write_fd_set, max_fd, fd_setsize)) )
+            result = MHD_NO;
+        }
+      if ( (NULL != pos->proxy) &&
+           (MHD_INVALID_SOCKET != pos->proxy_sock) )
+        {
+          /* proxied request, also watch the upstream server */
+          if ( (MHD_YES == pos->proxy_read_wanted) &&
+               (MHD_YES != add_to_fd_set (pos->proxy_sock, read_fd_set, max_fd, fd_setsize)) )
+            result = MHD_NO;
+          if ( (MHD_YES == pos->proxy_write_wanted) &&
+               (MHD_YES != add_to_fd_set (pos->proxy_sock, write_fd_set, max_fd, fd_setsize)) )
+            result = MHD_NO;
+        }
     }
 #if DEBUG_CONNECT
 #ifdef HAVE_MESSAGES
@@ -1121,8 +1143,11 @@ exit:
                                     MHD_CONNECTION_NOTIFY_CLOSED);
   if (MHD_INVALID_SOCKET != con->socket_fd)
     {
-      shutdown (con->socket_fd, SHUT_WR);
-      if (0 != MHD_socket_close_ (con->socket_fd))
+      MHD_connection_shutdown_ (con,
+                                MHD_TRANSPORT_SHUTDOWN_WRITE);
+      if (NULL != con->transport.recv)
+        con->transport.close (con->transport_cls);
+      else if (0 != MHD_socket_close_ (con->socket_fd))
         MHD_PANIC ("close failed\n");
       con->socket_fd = MHD_INVALID_SOCKET;
     }
@@ -1277,39 +1302,151 @@ send_param_adapter (struct MHD_Connection *connection,
 
 
 /**
- * Signature of main function for a thread.
+ * Callback for receiving data from the custom transport
+ * of a connection.
  *
- * @param cls closure argument for the function
- * @return termination code from the thread
+ * @param connection the MHD connection structure
+ * @param other where to write received data to
+ * @param i maximum size of other (in bytes)
+ * @return number of bytes actually received
+ */
+static ssize_t
+recv_transport_adapter (struct MHD_Connection *connection,
+                        void *other,
+                        size_t i)
+{
+  ssize_t ret;
+
+  if (MHD_CONNECTION_CLOSED == connection->state)
+    {
+      MHD_set_socket_errno_ (ENOTCONN);
+      return -1;
+    }
+  if (i > SSIZE_MAX)
+    i = SSIZE_MAX; /* return value limit */
+  ret = connection->transport.recv (connection->transport_cls,
+                                    other,
+                                    i);
+#if EPOLL_SUPPORT
+  if ( (0 > ret) || (i > (size_t) ret) )
+    {
+      /* partial read --- no longer read-ready */
+      connection->epoll_state &= ~MHD_EPOLL_STATE_READ_READY;
+    }
+#endif
+  return ret;
+}
+
+
+/**
+ * Callback for writing data to the custom transport
+ * of a connection.
+ *
+ * @param connection the MHD connection structure
+ * @param other data to write
+ * @param i number of bytes to write
+ * @return actual number of bytes written
  */
-typedef MHD_THRD_RTRN_TYPE_ (MHD_THRD_CALL_SPEC_ *ThreadStartRoutine)(void *cls);
+static ssize_t
+send_transport_adapter (struct MHD_Connection *connection,
+                        const void *other,
+                        size_t i)
+{
+  ssize_t ret;
+  int fd;
+
+  if (MHD_CONNECTION_CLOSED == connection->state)
+    {
+      MHD_set_socket_errno_ (ENOTCONN);
+      return -1;
+    }
+  if (i > SSIZE_MAX)
+    i = SSIZE_MAX; /* return value limit */
+  if ( (NULL != connection->transport.sendfile) &&
+       (0 == (connection->daemon->options & MHD_USE_SSL)) &&
+       (connection->write_buffer_append_offset ==
+	connection->write_buffer_send_offset) &&
+       (NULL != connection->response) &&
+       (-1 != (fd = connection->response->fd)) )
+    {
+      uint64_t left;
+
+      left = connection->response->total_size
+        - connection->response_write_position;
+      if (left > SSIZE_MAX)
+        left = SSIZE_MAX;
+      i = (size_t) left;
+      ret = connection->transport.sendfile (connection->transport_cls,
+                                            fd,
+                                            connection->response_write_position
+                                            + connection->response->fd_off,
+                                            i);
+    }
+  else
+    ret = connection->transport.send (connection->transport_cls,
+                                      other,
+                                      i);
+#if EPOLL_SUPPORT
+  if ( (0 > ret) || (i > (size_t) ret) )
+    {
+      /* partial write --- no longer write-ready */
+      connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+    }
+#endif
+  return ret;
+}
+
+
+/**
+ * Close the socket (or the custom transport) of a new connection
+ * that is refused.
+ *
+ * @param client_socket socket of the connection
+ * @param transport custom transport of the connection, NULL for none
+ * @param transport_cls closure for @a transport
+ */
+static void
+close_client_socket (MHD_socket client_socket,
+                     const struct MHD_Transport *transport,
+                     void *transport_cls)
+{
+  if (NULL != transport)
+    {
+      transport->close (transport_cls);
+      return;
+    }
+  if (0 != MHD_socket_close_ (client_socket))
+    MHD_PANIC ("close failed\n");
+}
 
 
 /**
  * Create a thread and set the attributes according to our options.
  *
  * @param thread handle to initialize
- * @param daemon daemon with options
+ * @param daemon daemon with options, NULL for the default attributes
  * @param start_routine main function of thread
  * @param arg argument for start_routine
  * @return 0 on success
  */
-static int
-create_thread (MHD_thread_handle_ *thread,
-	       const struct MHD_Daemon *daemon,
-	       ThreadStartRoutine start_routine,
-	       void *arg)
+int
+MHD_create_thread_ (MHD_thread_handle_ *thread,
+                    const struct MHD_Daemon *daemon,
+                    MHD_ThreadStartRoutine_ start_routine,
+                    void *arg)
 {
 #if defined(MHD_USE_POSIX_THREADS)
   pthread_attr_t attr;
   pthread_attr_t *pattr;
+  size_t stack_size;
   int ret;
 
-  if (0 != daemon->thread_stack_size)
+  stack_size = (NULL != daemon) ? daemon->thread_stack_size : 0;
+  if (0 != stack_size)
     {
       if (0 != (ret = pthread_attr_init (&attr)))
 	goto ERR;
-      if (0 != (ret = pthread_attr_setstacksize (&attr, daemon->thread_stack_size)))
+      if (0 != (ret = pthread_attr_setstacksize (&attr, stack_size)))
 	{
 	  pthread_attr_destroy (&attr);
 	  goto ERR;
@@ -1326,7 +1463,7 @@ create_thread (MHD_thread_handle_ *thread,
   if (0 == ret)
     (void) pthread_setname_np (*thread, "libmicrohttpd");
 #endif /* HAVE_PTHREAD_SETNAME_NP */
-  if (0 != daemon->thread_stack_size)
+  if (0 != stack_size)
     pthread_attr_destroy (&attr);
   return ret;
  ERR:
@@ -1338,7 +1475,10 @@ create_thread (MHD_thread_handle_ *thread,
   return ret;
 #elif defined(MHD_USE_W32_THREADS)
   unsigned threadID;
-  *thread = (HANDLE)_beginthreadex(NULL, (unsigned)daemon->thread_stack_size, start_routine,
+  unsigned stack_size;
+
+  stack_size = (NULL != daemon) ? (unsigned) daemon->thread_stack_size : 0;
+  *thread = (HANDLE)_beginthreadex(NULL, stack_size, start_routine,
                           arg, 0, &threadID);
   if (NULL == (*thread))
     return errno;
@@ -1371,6 +1511,9 @@ create_thread (MHD_thread_handle_ *thread,
  * @param addrlen number of bytes in @a addr
  * @param external_add perform additional operations needed due
  *        to the application calling us directly
+ * @param transport custom transport to use instead of the socket
+ *        (which then only signals readiness), NULL for none
+ * @param transport_cls closure for @a transport
  * @return #MHD_YES on success, #MHD_NO if this daemon could
  *        not handle the connection (i.e. malloc failed, etc).
  *        The socket will be closed in any case; 'errno' is
@@ -1381,13 +1524,16 @@ internal_add_connection (struct MHD_Daemon *daemon,
 			 MHD_socket client_socket,
 			 const struct sockaddr *addr,
 			 socklen_t addrlen,
-			 int external_add)
+			 int external_add,
+			 const struct MHD_Transport *transport,
+			 void *transport_cls)
 {
   struct MHD_Connection *connection;
   int res_thread_create;
   unsigned int i;
   int eno;
   struct MHD_Daemon *worker;
+  int offload_handshake;
 #if OSX
   static int on = 1;
 #endif
@@ -1404,11 +1550,13 @@ internal_add_connection (struct MHD_Daemon *daemon,
             return internal_add_connection (worker,
                                             client_socket,
                                             addr, addrlen,
-                                            external_add);
+                                            external_add,
+                                            transport,
+                                            transport_cls);
         }
       /* all pools are at their connection limit, must refuse */
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
+      close_client_socket (client_socket,
+                           transport, transport_cls);
 #if ENFILE
       errno = ENFILE;
 #endif
@@ -1425,8 +1573,8 @@ internal_add_connection (struct MHD_Daemon *daemon,
 		client_socket,
 		FD_SETSIZE);
 #endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
+      close_client_socket (client_socket,
+                           transport, transport_cls);
 #if EINVAL
       errno = EINVAL;
 #endif
@@ -1450,8 +1598,8 @@ internal_add_connection (struct MHD_Daemon *daemon,
       MHD_DLOG (daemon,
                 "Server reached connection limit (closing inbound connection)\n");
 #endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
+      close_client_socket (client_socket,
+                           transport, transport_cls);
 #if ENFILE
       errno = ENFILE;
 #endif
@@ -1469,8 +1617,8 @@ internal_add_connection (struct MHD_Daemon *daemon,
                 "Connection rejected, closing connection\n");
 #endif
 #endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
+      close_client_socket (client_socket,
+                           transport, transport_cls);
       MHD_ip_limit_del (daemon, addr, addrlen);
 #if EACCESS
       errno = EACCESS;
@@ -1496,8 +1644,8 @@ internal_add_connection (struct MHD_Daemon *daemon,
 		"Error allocating memory: %s\n",
 		MHD_strerror_ (errno));
 #endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
+      close_client_socket (client_socket,
+                           transport, transport_cls);
       MHD_ip_limit_del (daemon, addr, addrlen);
       errno = eno;
       return MHD_NO;
@@ -1513,8 +1661,8 @@ internal_add_connection (struct MHD_Daemon *daemon,
 		"Error allocating memory: %s\n",
 		MHD_strerror_ (errno));
 #endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
+      close_client_socket (client_socket,
+                           transport, transport_cls);
       MHD_ip_limit_del (daemon, addr, addrlen);
       free (connection);
 #if ENOMEM
@@ -1532,8 +1680,8 @@ internal_add_connection (struct MHD_Daemon *daemon,
 		"Error allocating memory: %s\n",
 		MHD_strerror_ (errno));
 #endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
+      close_client_socket (client_socket,
+                           transport, transport_cls);
       MHD_ip_limit_del (daemon, addr, addrlen);
       MHD_pool_destroy (connection->pool);
       free (connection);
@@ -1550,12 +1698,20 @@ internal_add_connection (struct MHD_Daemon *daemon,
   MHD_set_http_callbacks_ (connection);
   connection->recv_cls = &recv_param_adapter;
   connection->send_cls = &send_param_adapter;
+  if (NULL != transport)
+    {
+      connection->transport = *transport;
+      connection->transport_cls = transport_cls;
+      connection->recv_cls = &recv_transport_adapter;
+      connection->send_cls = &send_transport_adapter;
+    }
 
-  if (0 == (connection->daemon->options & MHD_USE_EPOLL_TURBO))
+  if ( (NULL == transport) &&
+       (0 == (connection->daemon->options & MHD_USE_EPOLL_TURBO)) )
     {
       /* in turbo mode, we assume that non-blocking was already set
 	 by 'accept4' or whoever calls 'MHD_add_connection' */
-      make_nonblocking (daemon, connection->socket_fd);
+      MHD_socket_nonblocking_ (daemon, connection->socket_fd);
     }
 
 #if HTTPS_SUPPORT
@@ -1565,59 +1721,62 @@ internal_add_connection (struct MHD_Daemon *daemon,
       connection->send_cls = &send_tls_adapter;
       connection->state = MHD_TLS_CONNECTION_INIT;
       MHD_set_https_callbacks (connection);
-      gnutls_init (&connection->tls_session, GNUTLS_SERVER);
-      gnutls_priority_set (connection->tls_session,
-			   daemon->priority_cache);
-      switch (daemon->cred_type)
+      if (MHD_YES != MHD_tls_connection_init_ (connection,
+                                               (NULL != transport)
+                                               ? &recv_transport_adapter
+                                               : &recv_param_adapter,
+                                               (NULL != transport)
+                                               ? &send_transport_adapter
+                                               : &send_param_adapter))
         {
-          /* set needed credentials for certificate authentication. */
-        case GNUTLS_CRD_CERTIFICATE:
-          gnutls_credentials_set (connection->tls_session,
-				  GNUTLS_CRD_CERTIFICATE,
-				  daemon->x509_cred);
-          break;
-        default:
 #ifdef HAVE_MESSAGES
-          MHD_DLOG (connection->daemon,
-                    "Failed to setup TLS credentials: unknown credential type %d\n",
-                    daemon->cred_type);
+          MHD_DLOG (daemon,
+                    "Failed to create TLS session\n");
 #endif
-          if (0 != MHD_socket_close_ (client_socket))
-	    MHD_PANIC ("close failed\n");
+          close_client_socket (client_socket,
+                               transport, transport_cls);
           MHD_ip_limit_del (daemon, addr, addrlen);
+          MHD_pool_destroy (connection->pool);
           free (connection->addr);
           free (connection);
-          MHD_PANIC ("Unknown credential type");
-#if EINVAL
-	  errno = EINVAL;
+#if ENOMEM
+          errno = ENOMEM;
 #endif
- 	  return MHD_NO;
+          return MHD_NO;
         }
-      gnutls_transport_set_ptr (connection->tls_session,
-				(gnutls_transport_ptr_t) connection);
-      gnutls_transport_set_pull_function (connection->tls_session,
-					  (gnutls_pull_func) &recv_param_adapter);
-      gnutls_transport_set_push_function (connection->tls_session,
-					  (gnutls_push_func) &send_param_adapter);
-
-      if (daemon->https_mem_trust)
-	  gnutls_certificate_server_set_request (connection->tls_session,
-						 GNUTLS_CERT_REQUEST);
+      if (MHD_USE_HTTP2 == (daemon->options & MHD_USE_HTTP2))
+        MHD_http2_tls_init_ (connection);
     }
 #endif
 
+  /* with handshake threads, new TLS connections start out suspended
+     and are resumed once their handshake is done */
+  offload_handshake = MHD_NO;
+#if HTTPS_SUPPORT
+  if ( (NULL != daemon->tls_handshake_pool) &&
+       (MHD_TLS_CONNECTION_INIT == connection->state) )
+    offload_handshake = MHD_YES;
+#endif
   if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
   {
     if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
       MHD_PANIC ("Failed to acquire cleanup mutex\n");
   }
-  else
+  else if (MHD_YES != offload_handshake)
    XDLL_insert (daemon->normal_timeout_head,
                 daemon->normal_timeout_tail,
                 connection);
-  DLL_insert (daemon->connections_head,
-	      daemon->connections_tail,
-	      connection);
+  if (MHD_YES == offload_handshake)
+    {
+      DLL_insert (daemon->suspended_connections_head,
+                  daemon->suspended_connections_tail,
+                  connection);
+      connection->suspended = MHD_YES;
+    }
+  else
+    DLL_insert (daemon->connections_head,
+                daemon->connections_tail,
+                connection);
   if  ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
 	(MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
     MHD_PANIC ("Failed to release cleanup mutex\n");
@@ -1631,7 +1790,7 @@ internal_add_connection (struct MHD_Daemon *daemon,
   /* attempt to create handler thread */
   if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
     {
-      res_thread_create = create_thread (&connection->pid,
+      res_thread_create = MHD_create_thread_ (&connection->pid,
                                          daemon,
 					 &MHD_handle_connection,
                                          connection);
@@ -1657,7 +1816,13 @@ internal_add_connection (struct MHD_Daemon *daemon,
 #endif
       }
 #if EPOLL_SUPPORT
-  if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
+  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+       (MHD_YES == offload_handshake) )
+    {
+      /* added to the epoll set when it is resumed */
+      connection->epoll_state |= MHD_EPOLL_STATE_SUSPENDED;
+    }
+  else if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
     {
       if (0 == (daemon->options & MHD_USE_EPOLL_TURBO))
 	{
@@ -1691,6 +1856,11 @@ internal_add_connection (struct MHD_Daemon *daemon,
     }
 #endif
   daemon->connections++;
+#if HTTPS_SUPPORT
+  if (MHD_YES == offload_handshake)
+    MHD_tls_handshake_submit_ (daemon->tls_handshake_pool,
+                               connection);
+#endif
   return MHD_YES;
  cleanup:
   if (NULL != daemon->notify_connection)
@@ -1698,8 +1868,8 @@ internal_add_connection (struct MHD_Daemon *daemon,
                                connection,
                                &connection->socket_context,
                                MHD_CONNECTION_NOTIFY_CLOSED);
-  if (0 != MHD_socket_close_ (client_socket))
-    MHD_PANIC ("close failed\n");
+  close_client_socket (client_socket,
+                       transport, transport_cls);
   MHD_ip_limit_del (daemon, addr, addrlen);
   if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
   {
@@ -1761,6 +1931,12 @@ MHD_suspend_connection (struct MHD_Connection *connection)
   daemon = connection->daemon;
   if (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME))
     MHD_PANIC ("Cannot suspend connections without enabling MHD_USE_SUSPEND_RESUME!\n");
+  if (NULL != connection->h2_stream)
+    {
+      /* only the stream is suspended, not the connection carrying it */
+      MHD_http2_suspend_stream_ (connection);
+      return;
+    }
   if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
     {
       if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
@@ -1828,6 +2004,11 @@ MHD_resume_connection (struct MHD_Connection *connection)
   daemon = connection->daemon;
   if (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME))
     MHD_PANIC ("Cannot resume connections without enabling MHD_USE_SUSPEND_RESUME!\n");
+  if (NULL != connection->h2_stream)
+    {
+      MHD_http2_resume_stream_ (connection);
+      return;
+    }
   if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
        (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
     MHD_PANIC ("Failed to acquire cleanup mutex\n");
@@ -1932,9 +2113,9 @@ resume_suspended_connections (struct MHD_Daemon *daemon)
  * @param sock socket to manipulate
  * @return #MHD_YES if succeeded, #MHD_NO otherwise
  */
-static int
-make_noninheritable (struct MHD_Daemon *daemon,
-                     MHD_socket sock)
+int
+MHD_socket_noninheritable_ (struct MHD_Daemon *daemon,
+                            MHD_socket sock)
 {
 #ifdef MHD_WINSOCK_SOCKETS
   if (!SetHandleInformation ((HANDLE)sock, HANDLE_FLAG_INHERIT, 0))
@@ -1976,8 +2157,8 @@ static void
 make_nonblocking_noninheritable (struct MHD_Daemon *daemon,
 				 MHD_socket sock)
 {
-  (void)make_nonblocking (daemon, sock);
-  (void)make_noninheritable (daemon, sock);
+  (void)MHD_socket_nonblocking_ (daemon, sock);
+  (void)MHD_socket_noninheritable_ (daemon, sock);
 }
 
 
@@ -2024,7 +2205,65 @@ MHD_add_connection (struct MHD_Daemon *daemon,
   return internal_add_connection (daemon,
 				  client_socket,
 				  addr, addrlen,
-				  MHD_YES);
+				  MHD_YES,
+				  NULL, NULL);
+}
+
+
+/**
+ * Add a client connection that uses a custom transport instead of
+ * a socket to the set of connections managed by MHD, for example
+ * in-process memory rings or a user-space TCP stack.  HTTP (and,
+ * with #MHD_USE_SSL, TLS) are run over the functions of @a transport
+ * just like they are run over a socket otherwise.
+ *
+ * The event loop of the daemon learns about the readiness of the
+ * transport from @a ready_fd, which is used in place of the socket
+ * of the connection for `select()`, `poll()` and `epoll`.  MHD
+ * never reads from, writes to or closes @a ready_fd.
+ *
+ * @param daemon daemon that manages the connection
+ * @param ready_fd descriptor signalling the readiness of the transport
+ * @param addr address of the client (used for logging and
+ *        the access policy)
+ * @param addrlen number of bytes in @a addr
+ * @param transport functions to use for the connection, copied
+ * @param transport_cls closure for the functions of @a transport
+ * @return #MHD_YES on success, #MHD_NO if this daemon could
+ *        not handle the connection (i.e. `malloc()` failed, etc).
+ *        The connection will be closed with the close function of
+ *        @a transport in any case, unless @a transport lacks one
+ *        of its mandatory functions; `errno` is set to indicate
+ *        further details about the error.
+ * @ingroup specialized
+ */
+int
+MHD_add_connection_with_transport (struct MHD_Daemon *daemon,
+                                   MHD_socket ready_fd,
+                                   const struct sockaddr *addr,
+                                   socklen_t addrlen,
+                                   const struct MHD_Transport *transport,
+                                   void *transport_cls)
+{
+  if ( (NULL == transport) ||
+       (NULL == transport->recv) ||
+       (NULL == transport->send) ||
+       (NULL == transport->close) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Transport lacks a mandatory function\n");
+#endif
+#if EINVAL
+      errno = EINVAL;
+#endif
+      return MHD_NO;
+    }
+  return internal_add_connection (daemon,
+				  ready_fd,
+				  addr, addrlen,
+				  MHD_YES,
+				  transport, transport_cls);
 }
 
 
@@ -2086,9 +2325,9 @@ MHD_accept_connection (struct MHD_Daemon *daemon)
 #if !defined(USE_ACCEPT4)
   make_nonblocking_noninheritable (daemon, s);
 #elif !defined(HAVE_SOCK_NONBLOCK)
-  make_nonblocking (daemon, s);
+  MHD_socket_nonblocking_ (daemon, s);
 #elif !defined(SOCK_CLOEXEC)
-  make_noninheritable (daemon, s);
+  MHD_socket_noninheritable_ (daemon, s);
 #endif
 #ifdef HAVE_MESSAGES
 #if DEBUG_CONNECT
@@ -2099,7 +2338,8 @@ MHD_accept_connection (struct MHD_Daemon *daemon)
 #endif
   (void) internal_add_connection (daemon, s,
 				  addr, addrlen,
-				  MHD_NO);
+				  MHD_NO,
+				  NULL, NULL);
   return MHD_YES;
 }
 
@@ -2134,8 +2374,7 @@ MHD_cleanup_connections (struct MHD_Daemon *daemon)
 	}
       MHD_pool_destroy (pos->pool);
 #if HTTPS_SUPPORT
-      if (NULL != pos->tls_session)
-	gnutls_deinit (pos->tls_session);
+      MHD_tls_connection_deinit_ (pos);
 #endif
       daemon->connections--;
       if (NULL != daemon->notify_connection)
@@ -2177,9 +2416,15 @@ MHD_cleanup_connections (struct MHD_Daemon *daemon)
 	  MHD_destroy_response (pos->response);
 	  pos->response = NULL;
 	}
+      MHD_upgrade_cleanup_ (pos);
+      MHD_websocket_cleanup_ (pos);
+      MHD_http2_cleanup_ (pos);
+      MHD_proxy_cleanup_ (pos);
       if (MHD_INVALID_SOCKET != pos->socket_fd)
 	{
-	  if (0 != MHD_socket_close_ (pos->socket_fd))
+	  if (NULL != pos->transport.recv)
+	    pos->transport.close (pos->transport_cls);
+	  else if (0 != MHD_socket_close_ (pos->socket_fd))
 	    MHD_PANIC ("close failed\n");
 	}
       if (NULL != pos->addr)
@@ -2225,10 +2470,14 @@ MHD_get_timeout (struct MHD_Daemon *daemon,
     }
 
 #if HTTPS_SUPPORT
-  if (0 != daemon->num_tls_read_ready)
+  for (pos = daemon->tls_ready_head; NULL != pos; pos = pos->nextT)
     {
-      /* if there is any TLS connection with data ready for
-	 reading, we must not block in the event loop */
+      if ( (MHD_EVENT_LOOP_INFO_READ != pos->event_loop_info) ||
+           (MHD_YES == pos->suspended) )
+        continue;
+      /* if there is any TLS connection that wants to read data
+         that is already waiting within TLS, we must not block in
+         the event loop */
       *timeout = 0;
       return MHD_YES;
     }
@@ -2243,11 +2492,6 @@ MHD_get_timeout (struct MHD_Daemon *daemon,
 	  if ( (! have_timeout) ||
 	       (earliest_deadline > pos->last_activity + pos->connection_timeout) )
 	    earliest_deadline = pos->last_activity + pos->connection_timeout;
-#if HTTPS_SUPPORT
-	  if (  (0 != (daemon->options & MHD_USE_SSL)) &&
-		(0 != gnutls_record_check_pending (pos->tls_session)) )
-	    earliest_deadline = 0;
-#endif
 	  have_timeout = MHD_YES;
 	}
     }
@@ -2259,11 +2503,6 @@ MHD_get_timeout (struct MHD_Daemon *daemon,
       if ( (! have_timeout) ||
 	   (earliest_deadline > pos->last_activity + pos->connection_timeout) )
 	earliest_deadline = pos->last_activity + pos->connection_timeout;
-#if HTTPS_SUPPORT
-      if (  (0 != (daemon->options & MHD_USE_SSL)) &&
-	    (0 != gnutls_record_check_pending (pos->tls_session)) )
-	earliest_deadline = 0;
-#endif
       have_timeout = MHD_YES;
     }
 
@@ -2324,7 +2563,11 @@ MHD_run_from_select (struct MHD_Daemon *daemon,
 
   /* Resuming external connections when using an extern mainloop  */
   if (MHD_USE_SUSPEND_RESUME == (daemon->options & mask))
-    resume_suspended_connections (daemon);
+    {
+      resume_suspended_connections (daemon);
+      MHD_websocket_wakeup_ (daemon);
+      MHD_http2_wakeup_ (daemon);
+    }
 
 #if EPOLL_SUPPORT
   if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
@@ -2338,6 +2581,7 @@ MHD_run_from_select (struct MHD_Daemon *daemon,
       return MHD_YES;
     }
 #endif
+  MHD_event_channel_wakeup_ (daemon);
 
   /* select connection thread handling type */
   if ( (MHD_INVALID_SOCKET != (ds = daemon->socket_fd)) &&
@@ -2520,17 +2764,30 @@ MHD_poll_all (struct MHD_Daemon *daemon,
 	      int may_block)
 {
   unsigned int num_connections;
+  unsigned int num_upgraded;
   struct MHD_Connection *pos;
   struct MHD_Connection *next;
 
   if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) &&
        (MHD_YES == resume_suspended_connections (daemon)) )
     may_block = MHD_NO;
+  MHD_websocket_wakeup_ (daemon);
+  MHD_http2_wakeup_ (daemon);
+  MHD_event_channel_wakeup_ (daemon);
 
   /* count number of connections and thus determine poll set size */
   num_connections = 0;
+  num_upgraded = 0;
   for (pos = daemon->connections_head; NULL != pos; pos = pos->next)
-    num_connections++;
+    {
+      num_connections++;
+      if ( (NULL != pos->urh) &&
+           (MHD_INVALID_SOCKET != pos->urh->mhd_sock) )
+        num_upgraded++;
+      if ( (NULL != pos->proxy) &&
+           (MHD_INVALID_SOCKET != pos->proxy_sock) )
+        num_upgraded++;
+    }
   {
     MHD_UNSIGNED_LONG_LONG ltimeout;
     unsigned int i;
@@ -2540,7 +2797,7 @@ MHD_poll_all (struct MHD_Daemon *daemon,
     int poll_pipe;
     struct pollfd *p;
 
-    p = malloc(sizeof (struct pollfd) * (2 + num_connections));
+    p = malloc(sizeof (struct pollfd) * (2 + num_connections + num_upgraded));
     if (NULL == p)
       {
 #ifdef HAVE_MESSAGES
@@ -2550,7 +2807,7 @@ MHD_poll_all (struct MHD_Daemon *daemon,
 #endif
         return MHD_NO;
       }
-    memset (p, 0, sizeof (struct pollfd) * (2 + num_connections));
+    memset (p, 0, sizeof (struct pollfd) * (2 + num_connections + num_upgraded));
     poll_server = 0;
     poll_listen = -1;
     if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
@@ -2604,12 +2861,39 @@ MHD_poll_all (struct MHD_Daemon *daemon,
 	  }
 	i++;
       }
+    /* upgraded HTTPS connections also watch the application's data,
+       the idle handler of the connection processes it */
+    for (pos = daemon->connections_head; NULL != pos; pos = pos->next)
+      {
+        if ( (NULL == pos->urh) ||
+             (MHD_INVALID_SOCKET == pos->urh->mhd_sock) )
+          continue;
+        p[poll_server+i].fd = pos->urh->mhd_sock;
+        if (MHD_YES == pos->urh->app_read_wanted)
+          p[poll_server+i].events |= POLLIN;
+        if (MHD_YES == pos->urh->app_write_wanted)
+          p[poll_server+i].events |= POLLOUT;
+        i++;
+      }
+    /* so do proxied requests for the upstream server */
+    for (pos = daemon->connections_head; NULL != pos; pos = pos->next)
+      {
+        if ( (NULL == pos->proxy) ||
+             (MHD_INVALID_SOCKET == pos->proxy_sock) )
+          continue;
+        p[poll_server+i].fd = pos->proxy_sock;
+        if (MHD_YES == pos->proxy_read_wanted)
+          p[poll_server+i].events |= POLLIN;
+        if (MHD_YES == pos->proxy_write_wanted)
+          p[poll_server+i].events |= POLLOUT;
+        i++;
+      }
     if (0 == poll_server + num_connections)
       {
         free(p);
         return MHD_YES;
       }
-    if (MHD_sys_poll_(p, poll_server + num_connections, timeout) < 0)
+    if (MHD_sys_poll_(p, poll_server + num_connections + num_upgraded, timeout) < 0)
       {
 	if (EINTR == MHD_socket_errno_)
       {
@@ -2651,6 +2935,7 @@ MHD_poll_all (struct MHD_Daemon *daemon,
                        0 != (p[poll_server+i].revents & POLLIN),
                        0 != (p[poll_server+i].revents & POLLOUT),
                        MHD_NO);
+        i++;
       }
     /* handle 'listen' FD */
     if ( (-1 != poll_listen) &&
@@ -2869,6 +3154,13 @@ MHD_epoll (struct MHD_Daemon *daemon,
               MHD_pipe_drain_ (daemon->wpipe[0]);
               continue;
             }
+          if (0 != ((uintptr_t) events[i].data.ptr & MHD_PROXY_EPOLL_TAG))
+            {
+              /* upstream socket of a proxied request */
+              MHD_proxy_epoll_event_ (events[i].data.ptr,
+                                      events[i].events);
+              continue;
+            }
 	  if (daemon != events[i].data.ptr)
 	    {
 	      /* this is an event relating to a 'normal' connection,
@@ -2919,6 +3211,25 @@ MHD_epoll (struct MHD_Daemon *daemon,
   if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) &&
        (MHD_YES == resume_suspended_connections (daemon)) )
     may_block = MHD_NO;
+  MHD_websocket_wakeup_ (daemon);
+  MHD_http2_wakeup_ (daemon);
+  MHD_event_channel_wakeup_ (daemon);
+
+#if HTTPS_SUPPORT
+  /* data waiting within TLS does not trigger an event on the socket,
+     so process the connections that want to read it explicitly */
+  for (pos = daemon->tls_ready_head; NULL != pos; pos = pos->nextT)
+    {
+      if ( (MHD_EVENT_LOOP_INFO_READ != pos->event_loop_info) ||
+           (MHD_YES == pos->suspended) ||
+           (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+        continue;
+      EDLL_insert (daemon->eready_head,
+                   daemon->eready_tail,
+                   pos);
+      pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+    }
+#endif
 
   /* process events for connections */
   while (NULL != (pos = daemon->eready_tail))
@@ -3244,10 +3555,6 @@ parse_options_va (struct MHD_Daemon *daemon,
   enum MHD_OPTION opt;
   struct MHD_OptionItem *oa;
   unsigned int i;
-#if HTTPS_SUPPORT
-  int ret;
-  const char *pstr;
-#endif
 
   while (MHD_OPTION_END != (opt = (enum MHD_OPTION) va_arg (ap, int)))
     {
@@ -3340,36 +3647,20 @@ parse_options_va (struct MHD_Daemon *daemon,
 #endif
           break;
 	case MHD_OPTION_HTTPS_CRED_TYPE:
-	  daemon->cred_type = (gnutls_credentials_type_t) va_arg (ap, int);
+	  i = (unsigned int) va_arg (ap, int);
+	  if (MHD_TLS_CRD_CERTIFICATE != i)
+	    {
+#ifdef HAVE_MESSAGES
+	      MHD_DLOG (daemon,
+			"Error: invalid credentials type %u specified.\n",
+			i);
+#endif
+	      return MHD_NO;
+	    }
 	  break;
         case MHD_OPTION_HTTPS_MEM_DHPARAMS:
           if (0 != (daemon->options & MHD_USE_SSL))
-            {
-              const char *arg = va_arg (ap, const char *);
-              gnutls_datum_t dhpar;
-
-              if (gnutls_dh_params_init (&daemon->https_mem_dhparams) < 0)
-                {
-#ifdef HAVE_MESSAGES
-                  MHD_DLOG(daemon,
-                           "Error initializing DH parameters\n");
-#endif
-                  return MHD_NO;
-                }
-              dhpar.data = (unsigned char *) arg;
-              dhpar.size = strlen (arg);
-              if (gnutls_dh_params_import_pkcs3 (daemon->https_mem_dhparams, &dhpar,
-                                                 GNUTLS_X509_FMT_PEM) < 0)
-                {
-#ifdef HAVE_MESSAGES
-                  MHD_DLOG(daemon,
-                           "Bad Diffie-Hellman parameters format\n");
-#endif
-                  gnutls_dh_params_deinit (daemon->https_mem_dhparams);
-                  return MHD_NO;
-                }
-              daemon->have_dhparams = MHD_YES;
-            }
+            daemon->https_mem_dhparams = va_arg (ap, const char *);
           else
             {
 #ifdef HAVE_MESSAGES
@@ -3382,26 +3673,16 @@ parse_options_va (struct MHD_Daemon *daemon,
           break;
         case MHD_OPTION_HTTPS_PRIORITIES:
 	  if (0 != (daemon->options & MHD_USE_SSL))
-	    {
-	      gnutls_priority_deinit (daemon->priority_cache);
-	      ret = gnutls_priority_init (&daemon->priority_cache,
-					  pstr = va_arg (ap, const char*),
-					  NULL);
-	      if (GNUTLS_E_SUCCESS != ret)
-	      {
-#ifdef HAVE_MESSAGES
-		MHD_DLOG (daemon,
-			  "Setting priorities to `%s' failed: %s\n",
-			  pstr,
-			  gnutls_strerror (ret));
-#endif
-		daemon->priority_cache = NULL;
-		return MHD_NO;
-	      }
-	    }
+	    daemon->https_priorities = va_arg (ap, const char *);
           break;
         case MHD_OPTION_HTTPS_CERT_CALLBACK:
-#if GNUTLS_VERSION_MAJOR < 3
+#if MHD_TLS_OPENSSL
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "MHD_OPTION_HTTPS_CERT_CALLBACK requires building MHD with GnuTLS\n");
+#endif
+          return MHD_NO;
+#elif GNUTLS_VERSION_MAJOR < 3
 #ifdef HAVE_MESSAGES
           MHD_DLOG (daemon,
                     "MHD_OPTION_HTTPS_CERT_CALLBACK requires building MHD with GnuTLS >= 3.0\n");
@@ -3421,6 +3702,14 @@ parse_options_va (struct MHD_Daemon *daemon,
 	case MHD_OPTION_NONCE_NC_SIZE:
 	  daemon->nonce_nc_size = va_arg (ap, unsigned int);
 	  break;
+#endif
+#ifdef BAUTH_SUPPORT
+	case MHD_OPTION_BASIC_AUTH_CACHE_TTL:
+	  daemon->basic_auth_cache_ttl = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_BASIC_AUTH_CACHE_SIZE:
+	  daemon->basic_auth_cache_size = va_arg (ap, unsigned int);
+	  break;
 #endif
 	case MHD_OPTION_LISTEN_SOCKET:
 	  daemon->socket_fd = va_arg (ap, MHD_socket);
@@ -3449,6 +3738,44 @@ parse_options_va (struct MHD_Daemon *daemon,
 	case MHD_OPTION_LISTEN_BACKLOG_SIZE:
 	  daemon->listen_backlog_size = va_arg (ap, unsigned int);
 	  break;
+	case MHD_OPTION_RESPONSE_CACHE_TTL:
+	  daemon->response_cache_ttl = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_RESPONSE_CACHE_SIZE:
+	  daemon->response_cache_size = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_RESPONSE_CACHE_VARY:
+	  daemon->response_cache_vary = va_arg (ap, const char *);
+	  break;
+	case MHD_OPTION_ROUTER:
+	  daemon->router = va_arg (ap, struct MHD_Router *);
+	  break;
+	case MHD_OPTION_WEBSOCKET_PING_INTERVAL:
+	  daemon->websocket_ping_interval = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_WEBSOCKET_MAX_PENDING:
+	  daemon->websocket_max_pending = va_arg (ap, size_t);
+	  break;
+	case MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS:
+	  daemon->http2_max_streams = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_PROXY_POOL_SIZE:
+	  daemon->proxy_pool_size = va_arg (ap, unsigned int);
+	  break;
+#if HTTPS_SUPPORT
+	case MHD_OPTION_HTTPS_SESSION_CACHE_SIZE:
+	  daemon->tls_session_cache_size = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_HTTPS_SESSION_TICKETS:
+	  daemon->tls_tickets = (0 != va_arg (ap, unsigned int)) ? MHD_YES : MHD_NO;
+	  break;
+	case MHD_OPTION_HTTPS_SESSION_TIMEOUT:
+	  daemon->tls_session_timeout = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_HTTPS_HANDSHAKE_THREADS:
+	  daemon->tls_handshake_threads = va_arg (ap, unsigned int);
+	  break;
+#endif
 	case MHD_OPTION_ARRAY:
 	  oa = va_arg (ap, struct MHD_OptionItem*);
 	  i = 0;
@@ -3460,6 +3787,7 @@ parse_options_va (struct MHD_Daemon *daemon,
 		case MHD_OPTION_CONNECTION_MEMORY_LIMIT:
 		case MHD_OPTION_CONNECTION_MEMORY_INCREMENT:
 		case MHD_OPTION_THREAD_STACK_SIZE:
+		case MHD_OPTION_WEBSOCKET_MAX_PENDING:
 		  if (MHD_YES != parse_options (daemon,
 						servaddr,
 						opt,
@@ -3476,6 +3804,17 @@ parse_options_va (struct MHD_Daemon *daemon,
                 case MHD_OPTION_TCP_FASTOPEN_QUEUE_SIZE:
 		case MHD_OPTION_LISTENING_ADDRESS_REUSE:
 		case MHD_OPTION_LISTEN_BACKLOG_SIZE:
+		case MHD_OPTION_RESPONSE_CACHE_TTL:
+		case MHD_OPTION_RESPONSE_CACHE_SIZE:
+		case MHD_OPTION_WEBSOCKET_PING_INTERVAL:
+		case MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS:
+		case MHD_OPTION_PROXY_POOL_SIZE:
+		case MHD_OPTION_BASIC_AUTH_CACHE_TTL:
+		case MHD_OPTION_BASIC_AUTH_CACHE_SIZE:
+		case MHD_OPTION_HTTPS_SESSION_CACHE_SIZE:
+		case MHD_OPTION_HTTPS_SESSION_TICKETS:
+		case MHD_OPTION_HTTPS_SESSION_TIMEOUT:
+		case MHD_OPTION_HTTPS_HANDSHAKE_THREADS:
 		  if (MHD_YES != parse_options (daemon,
 						servaddr,
 						opt,
@@ -3511,6 +3850,8 @@ parse_options_va (struct MHD_Daemon *daemon,
 		case MHD_OPTION_HTTPS_PRIORITIES:
 		case MHD_OPTION_ARRAY:
                 case MHD_OPTION_HTTPS_CERT_CALLBACK:
+		case MHD_OPTION_RESPONSE_CACHE_VARY:
+		case MHD_OPTION_ROUTER:
 		  if (MHD_YES != parse_options (daemon,
 						servaddr,
 						opt,
@@ -3617,7 +3958,7 @@ create_listen_socket (struct MHD_Daemon *daemon,
   setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on_val, sizeof(on_val));
 #endif
   if (MHD_NO == cloexec_set)
-    make_noninheritable (daemon, fd);
+    MHD_socket_noninheritable_ (daemon, fd);
   return fd;
 }
 
@@ -3650,8 +3991,8 @@ setup_epoll_to_listen (struct MHD_Daemon *daemon)
       return MHD_NO;
     }
 #if !defined(USE_EPOLL_CREATE1)
-  make_noninheritable (daemon,
-                       daemon->epoll_fd);
+  MHD_socket_noninheritable_ (daemon,
+                              daemon->epoll_fd);
 #endif /* ! USE_EPOLL_CREATE1 */
   if (MHD_INVALID_SOCKET == daemon->socket_fd)
     return MHD_YES; /* non-listening daemon */
@@ -3757,14 +4098,6 @@ MHD_start_daemon_va (unsigned int flags,
   daemon->epoll_fd = -1;
 #endif
   /* try to open listen socket */
-#if HTTPS_SUPPORT
-  if (0 != (flags & MHD_USE_SSL))
-    {
-      gnutls_priority_init (&daemon->priority_cache,
-			    "NORMAL",
-			    NULL);
-    }
-#endif
   daemon->socket_fd = MHD_INVALID_SOCKET;
   daemon->listening_address_reuse = 0;
   daemon->options = flags;
@@ -3787,6 +4120,16 @@ MHD_start_daemon_va (unsigned int flags,
 #else  /* !SOMAXCONN */
   daemon->listen_backlog_size = 511; /* should be safe value */
 #endif /* !SOMAXCONN */
+  daemon->response_cache_size = 128;
+  daemon->websocket_ping_interval = 30;
+  daemon->http2_max_streams = 100;
+  daemon->proxy_pool_size = 16;
+#ifdef BAUTH_SUPPORT
+  daemon->basic_auth_cache_size = 1024;
+#endif
+#if HTTPS_SUPPORT
+  daemon->tls_session_timeout = 3600;
+#endif
 #ifdef HAVE_MESSAGES
   daemon->custom_error_log = (MHD_LogCallback) &vfprintf;
   daemon->custom_error_log_cls = stderr;
@@ -3810,7 +4153,7 @@ MHD_start_daemon_va (unsigned int flags,
       free (daemon);
       return NULL;
     }
-    if (MHD_NO == make_nonblocking (daemon, daemon->wpipe[0]))
+    if (MHD_NO == MHD_socket_nonblocking_ (daemon, daemon->wpipe[0]))
       {
 #ifdef HAVE_MESSAGES
         MHD_DLOG (daemon,
@@ -3822,7 +4165,7 @@ MHD_start_daemon_va (unsigned int flags,
         free (daemon);
         return NULL;
       }
-    make_nonblocking (daemon, daemon->wpipe[1]);
+    MHD_socket_nonblocking_ (daemon, daemon->wpipe[1]);
   }
 #ifndef MHD_WINSOCK_SOCKETS
   if ( (0 == (flags & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY))) &&
@@ -3846,74 +4189,87 @@ MHD_start_daemon_va (unsigned int flags,
   daemon->digest_auth_random = NULL;
   daemon->nonce_nc_size = 4; /* tiny */
 #endif
-#if HTTPS_SUPPORT
-  if (0 != (flags & MHD_USE_SSL))
-    {
-      daemon->cred_type = GNUTLS_CRD_CERTIFICATE;
-    }
-#endif
 
 
   if (MHD_YES != parse_options_va (daemon, &servaddr, ap))
     {
-#if HTTPS_SUPPORT
-      if ( (0 != (flags & MHD_USE_SSL)) &&
-	   (NULL != daemon->priority_cache) )
-	gnutls_priority_deinit (daemon->priority_cache);
-#endif
       free (daemon);
       return NULL;
     }
 #ifdef DAUTH_SUPPORT
-  if (daemon->nonce_nc_size > 0)
+  if ( (daemon->nonce_nc_size > 0) &&
+       (NULL == (daemon->nonce_table
+                 = MHD_nonce_table_create_ (daemon->nonce_nc_size,
+                                            daemon->digest_auth_random,
+                                            daemon->digest_auth_rand_size))) )
     {
-      if ( ( (size_t) (daemon->nonce_nc_size * sizeof (struct MHD_NonceNc))) /
-	   sizeof(struct MHD_NonceNc) != daemon->nonce_nc_size)
-	{
 #ifdef HAVE_MESSAGES
-	  MHD_DLOG (daemon,
-		    "Specified value for NC_SIZE too large\n");
+      MHD_DLOG (daemon,
+                "Failed to allocate memory for nonce-nc map: %s\n",
+                MHD_strerror_ (errno));
 #endif
-#if HTTPS_SUPPORT
-	  if (0 != (flags & MHD_USE_SSL))
-	    gnutls_priority_deinit (daemon->priority_cache);
+      free (daemon);
+      return NULL;
+    }
 #endif
-	  free (daemon);
-	  return NULL;
-	}
-      daemon->nnc = malloc (daemon->nonce_nc_size * sizeof (struct MHD_NonceNc));
-      if (NULL == daemon->nnc)
-	{
+
+  if (0 != daemon->response_cache_ttl)
+    {
+      daemon->response_cache
+        = MHD_response_cache_create_ (daemon->response_cache_size,
+                                      daemon->response_cache_ttl,
+                                      daemon->response_cache_vary);
+      daemon->response_cache_vary = NULL;
+      if (NULL == daemon->response_cache)
+        {
 #ifdef HAVE_MESSAGES
-	  MHD_DLOG (daemon,
-		    "Failed to allocate memory for nonce-nc map: %s\n",
-		    MHD_strerror_ (errno));
-#endif
-#if HTTPS_SUPPORT
-	  if (0 != (flags & MHD_USE_SSL))
-	    gnutls_priority_deinit (daemon->priority_cache);
+          MHD_DLOG (daemon,
+                    "Failed to create response cache\n");
 #endif
-	  free (daemon);
-	  return NULL;
-	}
+          goto free_and_fail;
+        }
     }
 
-  if (MHD_YES != MHD_mutex_create_ (&daemon->nnc_lock))
+#if defined(HAVE_POSTPROCESSOR) && defined(MHD_HAVE_COND_)
+  daemon->post_writer = MHD_post_writer_create_ ();
+  if (NULL == daemon->post_writer)
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
-		"MHD failed to initialize nonce-nc mutex\n");
+                "Failed to create post processor writer\n");
 #endif
-#if HTTPS_SUPPORT
-      if (0 != (flags & MHD_USE_SSL))
-	gnutls_priority_deinit (daemon->priority_cache);
+      goto free_and_fail;
+    }
 #endif
-      free (daemon->nnc);
-      free (daemon);
-      return NULL;
+
+#ifdef BAUTH_SUPPORT
+  if (0 != daemon->basic_auth_cache_ttl)
+    {
+      daemon->basic_auth_cache
+        = MHD_basic_auth_cache_create_ (daemon->basic_auth_cache_size,
+                                        daemon->basic_auth_cache_ttl,
+#ifdef DAUTH_SUPPORT
+                                        daemon->digest_auth_random,
+                                        daemon->digest_auth_rand_size
+#else
+                                        NULL,
+                                        0
+#endif
+                                        );
+      if (NULL == daemon->basic_auth_cache)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to create basic authentication cache\n");
+#endif
+          goto free_and_fail;
+        }
     }
 #endif
 
+  if (NULL != daemon->router)
+    MHD_router_compile_ (daemon->router);
+
   /* Thread pooling currently works only with internal select thread model */
   if ( (0 == (flags & MHD_USE_SELECT_INTERNALLY)) &&
        (daemon->worker_pool_size > 0) )
@@ -3935,6 +4291,20 @@ MHD_start_daemon_va (unsigned int flags,
       goto free_and_fail;
     }
 
+#if HTTPS_SUPPORT
+  /* connections are suspended while their handshake runs */
+  if ( (0 != daemon->tls_handshake_threads) &&
+       ( (0 == (flags & MHD_USE_SSL)) ||
+         (MHD_USE_SUSPEND_RESUME != (flags & MHD_USE_SUSPEND_RESUME)) ) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD_OPTION_HTTPS_HANDSHAKE_THREADS requires MHD_USE_SSL and MHD_USE_SUSPEND_RESUME.\n");
+#endif
+      goto free_and_fail;
+    }
+#endif
+
 #ifdef __SYMBIAN32__
   if (0 != (flags & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION)))
     {
@@ -4170,7 +4540,7 @@ MHD_start_daemon_va (unsigned int flags,
       socket_fd = daemon->socket_fd;
     }
 
-  if (MHD_NO == make_nonblocking (daemon, socket_fd))
+  if (MHD_NO == MHD_socket_nonblocking_ (daemon, socket_fd))
     {
       if (0 != (flags & MHD_USE_EPOLL_LINUX_ONLY) ||
           daemon->worker_pool_size > 0)
@@ -4252,11 +4622,28 @@ MHD_start_daemon_va (unsigned int flags,
 
 #if HTTPS_SUPPORT
   /* initialize HTTPS daemon certificate aspects & send / recv functions */
-  if ((0 != (flags & MHD_USE_SSL)) && (0 != MHD_TLS_init (daemon)))
+  if ( (0 != (flags & MHD_USE_SSL)) &&
+       (MHD_YES != MHD_tls_daemon_init_ (daemon)) )
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
 		"Failed to initialize TLS support\n");
+#endif
+      if ( (MHD_INVALID_SOCKET != socket_fd) &&
+	   (0 != MHD_socket_close_ (socket_fd)) )
+	MHD_PANIC ("close failed\n");
+      (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
+      (void) MHD_mutex_destroy_ (&daemon->per_ip_connection_mutex);
+      goto free_and_fail;
+    }
+  if ( (0 != daemon->tls_handshake_threads) &&
+       (NULL == (daemon->tls_handshake_pool
+                 = MHD_tls_handshake_pool_create_ (daemon,
+                                                   daemon->tls_handshake_threads))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Failed to start TLS handshake threads\n");
 #endif
       if ( (MHD_INVALID_SOCKET != socket_fd) &&
 	   (0 != MHD_socket_close_ (socket_fd)) )
@@ -4271,7 +4658,7 @@ MHD_start_daemon_va (unsigned int flags,
 	   (0 == daemon->worker_pool_size)) ) &&
        (0 == (daemon->options & MHD_USE_NO_LISTEN_SOCKET)) &&
        (0 != (res_thread_create =
-	      create_thread (&daemon->pid, daemon, &MHD_select_thread, daemon))))
+	      MHD_create_thread_ (&daemon->pid, daemon, &MHD_select_thread, daemon))))
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
@@ -4331,7 +4718,7 @@ MHD_start_daemon_va (unsigned int flags,
 #endif
                   goto thread_failed;
                 }
-              if (MHD_NO == make_nonblocking (d, d->wpipe[0]))
+              if (MHD_NO == MHD_socket_nonblocking_ (d, d->wpipe[0]))
                 {
 #ifdef HAVE_MESSAGES
                   MHD_DLOG (daemon,
@@ -4340,7 +4727,7 @@ MHD_start_daemon_va (unsigned int flags,
 #endif
                   goto thread_failed;
                 }
-              make_nonblocking (d, d->wpipe[1]);
+              MHD_socket_nonblocking_ (d, d->wpipe[1]);
             }
 #ifndef MHD_WINSOCK_SOCKETS
           if ( (0 == (flags & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY))) &&
@@ -4381,7 +4768,7 @@ MHD_start_daemon_va (unsigned int flags,
 
           /* Spawn the worker thread */
           if (0 != (res_thread_create =
-		    create_thread (&d->pid, daemon, &MHD_select_thread, d)))
+		    MHD_create_thread_ (&d->pid, daemon, &MHD_select_thread, d)))
             {
 #ifdef HAVE_MESSAGES
               MHD_DLOG (daemon,
@@ -4436,12 +4823,20 @@ thread_failed:
     close (daemon->epoll_fd);
 #endif
 #ifdef DAUTH_SUPPORT
-  free (daemon->nnc);
-  (void) MHD_mutex_destroy_ (&daemon->nnc_lock);
+  MHD_nonce_table_destroy_ (daemon->nonce_table);
+#endif
+#ifdef BAUTH_SUPPORT
+  MHD_basic_auth_cache_destroy_ (daemon->basic_auth_cache);
+#endif
+  if (NULL != daemon->response_cache)
+    MHD_response_cache_destroy_ (daemon->response_cache);
+#if defined(HAVE_POSTPROCESSOR) && defined(MHD_HAVE_COND_)
+  MHD_post_writer_destroy_ (daemon->post_writer);
 #endif
 #if HTTPS_SUPPORT
   if (0 != (flags & MHD_USE_SSL))
-    gnutls_priority_deinit (daemon->priority_cache);
+    MHD_tls_daemon_deinit_ (daemon);
+  MHD_tls_handshake_pool_destroy_ (daemon->tls_handshake_pool);
 #endif
   if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
        (0 != MHD_pipe_close_ (daemon->wpipe[0])) )
@@ -4477,6 +4872,15 @@ close_connection (struct MHD_Connection *pos)
     XDLL_remove (daemon->manual_timeout_head,
 		 daemon->manual_timeout_tail,
 		 pos);
+#if HTTPS_SUPPORT
+  if (MHD_YES == pos->tls_read_ready)
+    {
+      TDLL_remove (daemon->tls_ready_head,
+                   daemon->tls_ready_tail,
+                   pos);
+      pos->tls_read_ready = MHD_NO;
+    }
+#endif
   DLL_remove (daemon->connections_head,
 	      daemon->connections_tail,
 	      pos);
@@ -4499,6 +4903,18 @@ close_all_connections (struct MHD_Daemon *daemon)
 {
   struct MHD_Connection *pos;
 
+  /* connections waiting on the response cache were suspended by us,
+     not by the application; wake them up so that they can be closed */
+  if (NULL != daemon->response_cache)
+    {
+      MHD_response_cache_resume_all_ (daemon->response_cache);
+      resume_suspended_connections (daemon);
+    }
+#if HTTPS_SUPPORT
+  /* same for connections given back by the (stopped) handshake threads */
+  if (NULL != daemon->tls_handshake_pool)
+    resume_suspended_connections (daemon);
+#endif
   /* first, make sure all threads are aware of shutdown; need to
      traverse DLLs in peace... */
   if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
@@ -4508,7 +4924,11 @@ close_all_connections (struct MHD_Daemon *daemon)
     MHD_PANIC ("MHD_stop_daemon() called while we have suspended connections.\n");
   for (pos = daemon->connections_head; NULL != pos; pos = pos->next)
     {
-      shutdown (pos->socket_fd, SHUT_RDWR);
+      if ( (NULL != pos->urh) &&
+           (MHD_YES != pos->urh->was_closed) )
+        MHD_PANIC ("MHD_stop_daemon() called while we have upgraded connections.\n");
+      MHD_connection_shutdown_ (pos,
+                                MHD_TRANSPORT_SHUTDOWN_BOTH);
 #if MHD_WINSOCK_SOCKETS
       if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
            (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
@@ -4548,6 +4968,7 @@ close_all_connections (struct MHD_Daemon *daemon)
     close_connection (pos);
   }
   MHD_cleanup_connections (daemon);
+  MHD_proxy_pool_cleanup_ (daemon);
 }
 
 
@@ -4593,6 +5014,11 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
   if (NULL == daemon)
     return;
 
+#if HTTPS_SUPPORT
+  /* have the handshake threads give back (closed) the connections
+     they are working on */
+  MHD_tls_handshake_pool_stop_ (daemon->tls_handshake_pool);
+#endif
   if (0 != (MHD_USE_SUSPEND_RESUME & daemon->options))
     resume_suspended_connections (daemon);
   daemon->shutdown = MHD_YES;
@@ -4697,17 +5123,9 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
 
   /* TLS clean up */
 #if HTTPS_SUPPORT
-  if (MHD_YES == daemon->have_dhparams)
-    {
-      gnutls_dh_params_deinit (daemon->https_mem_dhparams);
-      daemon->have_dhparams = MHD_NO;
-    }
   if (0 != (daemon->options & MHD_USE_SSL))
-    {
-      gnutls_priority_deinit (daemon->priority_cache);
-      if (daemon->x509_cred)
-        gnutls_certificate_free_credentials (daemon->x509_cred);
-    }
+    MHD_tls_daemon_deinit_ (daemon);
+  MHD_tls_handshake_pool_destroy_ (daemon->tls_handshake_pool);
 #endif
 #if EPOLL_SUPPORT
   if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
@@ -4717,8 +5135,15 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
 #endif
 
 #ifdef DAUTH_SUPPORT
-  free (daemon->nnc);
-  (void) MHD_mutex_destroy_ (&daemon->nnc_lock);
+  MHD_nonce_table_destroy_ (daemon->nonce_table);
+#endif
+#ifdef BAUTH_SUPPORT
+  MHD_basic_auth_cache_destroy_ (daemon->basic_auth_cache);
+#endif
+  if (NULL != daemon->response_cache)
+    MHD_response_cache_destroy_ (daemon->response_cache);
+#if defined(HAVE_POSTPROCESSOR) && defined(MHD_HAVE_COND_)
+  MHD_post_writer_destroy_ (daemon->post_writer);
 #endif
   (void) MHD_mutex_destroy_ (&daemon->per_ip_connection_mutex);
   (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
@@ -4864,7 +5289,7 @@ MHD_is_feature_supported(enum MHD_FEATURE feature)
       return MHD_NO;
 #endif
     case MHD_FEATURE_HTTPS_CERT_CALLBACK:
-#if HTTPS_SUPPORT && GNUTLS_VERSION_MAJOR >= 3
+#if HTTPS_SUPPORT && ! MHD_TLS_OPENSSL && GNUTLS_VERSION_MAJOR >= 3
       return MHD_YES;
 #else
       return MHD_NO;
@@ -4930,7 +5355,7 @@ MHD_is_feature_supported(enum MHD_FEATURE feature)
       return MHD_NO;
 #endif
     case MHD_FEATURE_HTTPS_KEY_PASSWORD:
-#if HTTPS_SUPPORT && GNUTLS_VERSION_NUMBER >= 0x030111
+#if HTTPS_SUPPORT && (MHD_TLS_OPENSSL || GNUTLS_VERSION_NUMBER >= 0x030111)
       return MHD_YES;
 #else
       return MHD_NO;
@@ -4941,67 +5366,25 @@ MHD_is_feature_supported(enum MHD_FEATURE feature)
 #else
       return (sizeof(uint64_t) > sizeof(off_t)) ? MHD_NO : MHD_YES;
 #endif
+    case MHD_FEATURE_COMPRESSION:
+#ifdef HAVE_ZLIB
+      return MHD_YES;
+#else
+      return MHD_NO;
+#endif
+    case MHD_FEATURE_UPGRADE:
+      return MHD_YES;
+    case MHD_FEATURE_WEBSOCKET:
+      return MHD_YES;
+    case MHD_FEATURE_HTTP2:
+      return MHD_YES;
+    case MHD_FEATURE_PROXY:
+      return MHD_YES;
     }
   return MHD_NO;
 }
 
 
-#if HTTPS_SUPPORT && GCRYPT_VERSION_NUMBER < 0x010600
-#if defined(MHD_USE_POSIX_THREADS)
-GCRY_THREAD_OPTION_PTHREAD_IMPL;
-#elif defined(MHD_W32_MUTEX_)
-
-static int
-gcry_w32_mutex_init (void **ppmtx)
-{
-  *ppmtx = malloc (sizeof (MHD_mutex_));
-
-  if (NULL == *ppmtx)
-    return ENOMEM;
-  if (MHD_YES != MHD_mutex_create_ ((MHD_mutex_*)*ppmtx))
-    {
-      free (*ppmtx);
-      *ppmtx = NULL;
-      return EPERM;
-    }
-
-  return 0;
-}
-
-
-static int
-gcry_w32_mutex_destroy (void **ppmtx)
-{
-  int res = (MHD_YES == MHD_mutex_destroy_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
-  free (*ppmtx);
-  return res;
-}
-
-
-static int
-gcry_w32_mutex_lock (void **ppmtx)
-{
-  return (MHD_YES == MHD_mutex_lock_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
-}
-
-
-static int
-gcry_w32_mutex_unlock (void **ppmtx)
-{
-  return (MHD_YES == MHD_mutex_unlock_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
-}
-
-
-static struct gcry_thread_cbs gcry_threads_w32 = {
-  (GCRY_THREAD_OPTION_USER | (GCRY_THREAD_OPTION_VERSION << 8)),
-  NULL, gcry_w32_mutex_init, gcry_w32_mutex_destroy,
-  gcry_w32_mutex_lock, gcry_w32_mutex_unlock,
-  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
-
-#endif /* defined(MHD_W32_MUTEX_) */
-#endif /* HTTPS_SUPPORT && GCRYPT_VERSION_NUMBER < 0x010600 */
-
-
 /**
  * Initialize do setup work.
  */
@@ -5022,20 +5405,7 @@ MHD_init(void)
     MHD_PANIC ("Winsock version 2.2 is not available\n");
 #endif
 #if HTTPS_SUPPORT
-#if GCRYPT_VERSION_NUMBER < 0x010600
-#if defined(MHD_USE_POSIX_THREADS)
-  if (0 != gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread))
-    MHD_PANIC ("Failed to initialise multithreading in libgcrypt\n");
-#elif defined(MHD_W32_MUTEX_)
-  if (0 != gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_w32))
-    MHD_PANIC ("Failed to initialise multithreading in libgcrypt\n");
-#endif /* defined(MHD_W32_MUTEX_) */
-  gcry_check_version (NULL);
-#else
-  if (NULL == gcry_check_version ("1.6.0"))
-    MHD_PANIC ("libgcrypt is too old. MHD was compiled for libgcrypt 1.6.0 or newer\n");
-#endif
-  gnutls_global_init ();
+  MHD_tls_global_init_ ();
 #endif
   MHD_monotonic_sec_counter_init();
 }
@@ -5045,7 +5415,7 @@ void
 MHD_fini(void)
 {
 #if HTTPS_SUPPORT
-  gnutls_global_deinit ();
+  MHD_tls_global_deinit_ ();
 #endif
 #ifdef _WIN32
   if (mhd_winsock_inited_)
@@ -25,7 +25,10 @@
 #include "platform.h"
 #include <limits.h>
 #include "internal.h"
+#include "digestauth.h"
 #include "md5.h"
+#include "sha256.h"
+#include "mhd_shardtable.h"
 #include "mhd_mono_clock.h"
 #include "mhd_str.h"
 
@@ -36,13 +39,22 @@
 #include <windows.h>
 #endif /* _WIN32 && MHD_W32_MUTEX_ */
 
-#define HASH_MD5_HEX_LEN (2 * MD5_DIGEST_SIZE)
 /* 32 bit value is 4 bytes */
 #define TIMESTAMP_BIN_SIZE 4
 #define TIMESTAMP_HEX_LEN (2 * TIMESTAMP_BIN_SIZE)
 
-/* Standard server nonce length, not including terminating null */
-#define NONCE_STD_LEN (HASH_MD5_HEX_LEN + TIMESTAMP_HEX_LEN)
+/**
+ * Size of the largest digest of the supported algorithms.
+ */
+#define MAX_DIGEST_SIZE SHA256_DIGEST_SIZE
+
+/**
+ * Length of the largest digest of the supported algorithms in hex.
+ */
+#define MAX_DIGEST_HEX_LEN (2 * MAX_DIGEST_SIZE)
+
+/* Maximum length of a server nonce, not including terminating null */
+#define NONCE_STD_LEN (MAX_DIGEST_HEX_LEN + TIMESTAMP_HEX_LEN)
 
 /**
  * Beginning string for any valid Digest authentication header.
@@ -65,6 +77,152 @@
 #define MAX_AUTH_RESPONSE_LENGTH 128
 
 
+/**
+ * State for computing a digest with one of the supported
+ * algorithms.
+ */
+struct DigestAlgorithm
+{
+
+  /**
+   * Name of the algorithm in the headers.
+   */
+  const char *name;
+
+  /**
+   * Number of bytes of the digest.
+   */
+  size_t digest_size;
+
+  /**
+   * Which algorithm it is.
+   */
+  enum MHD_DigestAuthAlgorithm algo;
+
+  /**
+   * State of the hash function.
+   */
+  union
+  {
+    struct MD5Context md5;
+    struct SHA256Context sha256;
+    struct SHA512_256Context sha512_256;
+  } ctx;
+
+};
+
+
+/**
+ * Select an algorithm and start computing a digest.
+ *
+ * @param da state to initialize
+ * @param algo the algorithm, not #MHD_DIGEST_ALG_AUTO
+ */
+static void
+da_init (struct DigestAlgorithm *da,
+	 enum MHD_DigestAuthAlgorithm algo)
+{
+  da->algo = algo;
+  switch (algo)
+    {
+    case MHD_DIGEST_ALG_SHA256:
+      da->name = "SHA-256";
+      da->digest_size = SHA256_DIGEST_SIZE;
+      SHA256Init (&da->ctx.sha256);
+      break;
+    case MHD_DIGEST_ALG_SHA512_256:
+      da->name = "SHA-512-256";
+      da->digest_size = SHA512_256_DIGEST_SIZE;
+      SHA512_256Init (&da->ctx.sha512_256);
+      break;
+    default:
+      da->algo = MHD_DIGEST_ALG_MD5;
+      da->name = "MD5";
+      da->digest_size = MD5_DIGEST_SIZE;
+      MD5Init (&da->ctx.md5);
+      break;
+    }
+}
+
+
+/**
+ * Start computing another digest with the same algorithm.
+ *
+ * @param da state of a previous computation
+ */
+static void
+da_restart (struct DigestAlgorithm *da)
+{
+  da_init (da, da->algo);
+}
+
+
+/**
+ * Add data to the digest.
+ *
+ * @param da state of the computation
+ * @param data data to add
+ * @param len number of bytes in @a data
+ */
+static void
+da_update (struct DigestAlgorithm *da,
+	   const void *data,
+	   size_t len)
+{
+  switch (da->algo)
+    {
+    case MHD_DIGEST_ALG_SHA256:
+      SHA256Update (&da->ctx.sha256, data, len);
+      break;
+    case MHD_DIGEST_ALG_SHA512_256:
+      SHA512_256Update (&da->ctx.sha512_256, data, len);
+      break;
+    default:
+      MD5Update (&da->ctx.md5, data, len);
+      break;
+    }
+}
+
+
+/**
+ * Add a string to the digest.
+ *
+ * @param da state of the computation
+ * @param str 0-terminated string to add
+ */
+static void
+da_update_str (struct DigestAlgorithm *da,
+	       const char *str)
+{
+  da_update (da, str, strlen (str));
+}
+
+
+/**
+ * Finish the digest.
+ *
+ * @param da state of the computation
+ * @param digest where to store the @e digest_size bytes of the digest
+ */
+static void
+da_final (struct DigestAlgorithm *da,
+	  unsigned char *digest)
+{
+  switch (da->algo)
+    {
+    case MHD_DIGEST_ALG_SHA256:
+      SHA256Final (digest, &da->ctx.sha256);
+      break;
+    case MHD_DIGEST_ALG_SHA512_256:
+      SHA512_256Final (digest, &da->ctx.sha512_256);
+      break;
+    default:
+      MD5Final (digest, &da->ctx.md5);
+      break;
+    }
+}
+
+
 /**
  * convert bin to hex
  *
@@ -92,207 +250,300 @@ cvthex (const unsigned char *bin,
 
 
 /**
- * calculate H(A1) as per RFC2617 spec and store the
- * result in 'sessionkey'.
+ * Finish the digest and convert it to hex.
  *
- * @param alg The hash algorithm used, can be "md5" or "md5-sess"
- * @param username A `char *' pointer to the username value
- * @param realm A `char *' pointer to the realm value
- * @param password A `char *' pointer to the password value
- * @param nonce A `char *' pointer to the nonce value
- * @param cnonce A `char *' pointer to the cnonce value
- * @param sessionkey pointer to buffer of HASH_MD5_HEX_LEN+1 bytes
+ * @param da state of the computation
+ * @param hex where to store the 2 * @e digest_size + 1 characters
  */
 static void
-digest_calc_ha1 (const char *alg,
-		 const char *username,
-		 const char *realm,
-		 const char *password,
-		 const char *nonce,
-		 const char *cnonce,
-		 char sessionkey[HASH_MD5_HEX_LEN + 1])
+da_final_hex (struct DigestAlgorithm *da,
+	      char *hex)
 {
-  struct MD5Context md5;
-  unsigned char ha1[MD5_DIGEST_SIZE];
-
-  MD5Init (&md5);
-  MD5Update (&md5, (const unsigned char*)username, strlen (username));
-  MD5Update (&md5, (const unsigned char*)":", 1);
-  MD5Update (&md5, (const unsigned char*)realm, strlen (realm));
-  MD5Update (&md5, (const unsigned char*)":", 1);
-  MD5Update (&md5, (const unsigned char*)password, strlen (password));
-  MD5Final (ha1, &md5);
-  if (MHD_str_equal_caseless_(alg, "md5-sess"))
-    {
-      MD5Init (&md5);
-      MD5Update (&md5, (const unsigned char*)ha1, sizeof (ha1));
-      MD5Update (&md5, (const unsigned char*)":", 1);
-      MD5Update (&md5, (const unsigned char*)nonce, strlen (nonce));
-      MD5Update (&md5, (const unsigned char*)":", 1);
-      MD5Update (&md5, (const unsigned char*)cnonce, strlen (cnonce));
-      MD5Final (ha1, &md5);
-    }
-  cvthex (ha1, sizeof (ha1), sessionkey);
+  unsigned char digest[MAX_DIGEST_SIZE];
+
+  da_final (da, digest);
+  cvthex (digest, da->digest_size, hex);
 }
 
 
 /**
- * Calculate request-digest/response-digest as per RFC2617 spec
- *
- * @param ha1 H(A1)
- * @param nonce nonce from server
- * @param noncecount 8 hex digits
- * @param cnonce client nonce
- * @param qop qop-value: "", "auth" or "auth-int"
- * @param method method from request
- * @param uri requested URL
- * @param hentity H(entity body) if qop="auth-int"
- * @param response request-digest or response-digest
+ * A parameter of the "Authorization" header.  The value is not
+ * copied and thus not 0-terminated.
  */
-static void
-digest_calc_response (const char ha1[HASH_MD5_HEX_LEN + 1],
-		      const char *nonce,
-		      const char *noncecount,
-		      const char *cnonce,
-		      const char *qop,
-		      const char *method,
-		      const char *uri,
-		      const char *hentity,
-		      char response[HASH_MD5_HEX_LEN + 1])
+struct DigestParam
 {
-  struct MD5Context md5;
-  unsigned char ha2[MD5_DIGEST_SIZE];
-  unsigned char resphash[MD5_DIGEST_SIZE];
-  char ha2hex[HASH_MD5_HEX_LEN + 1];
-
-  MD5Init (&md5);
-  MD5Update (&md5, (const unsigned char*)method, strlen(method));
-  MD5Update (&md5, (const unsigned char*)":", 1);
-  MD5Update (&md5, (const unsigned char*)uri, strlen(uri));
-#if 0
-  if (0 == strcasecmp(qop, "auth-int"))
-    {
-      /* This is dead code since the rest of this module does
-	 not support auth-int. */
-      MD5Update (&md5, ":", 1);
-      if (NULL != hentity)
-	MD5Update (&md5, hentity, strlen(hentity));
-    }
-#endif
-  MD5Final (ha2, &md5);
-  cvthex (ha2, MD5_DIGEST_SIZE, ha2hex);
-  MD5Init (&md5);
-  /* calculate response */
-  MD5Update (&md5, (const unsigned char*)ha1, HASH_MD5_HEX_LEN);
-  MD5Update (&md5, (const unsigned char*)":", 1);
-  MD5Update (&md5, (const unsigned char*)nonce, strlen(nonce));
-  MD5Update (&md5, (const unsigned char*)":", 1);
-  if ('\0' != *qop)
-    {
-      MD5Update (&md5, (const unsigned char*)noncecount, strlen(noncecount));
-      MD5Update (&md5, (const unsigned char*)":", 1);
-      MD5Update (&md5, (const unsigned char*)cnonce, strlen(cnonce));
-      MD5Update (&md5, (const unsigned char*)":", 1);
-      MD5Update (&md5, (const unsigned char*)qop, strlen(qop));
-      MD5Update (&md5, (const unsigned char*)":", 1);
-    }
-  MD5Update (&md5, (const unsigned char*)ha2hex, HASH_MD5_HEX_LEN);
-  MD5Final (resphash, &md5);
-  cvthex (resphash, sizeof(resphash), response);
-}
+
+  /**
+   * Value of the parameter (without quotes), NULL if the
+   * parameter was not given.
+   */
+  const char *value;
+
+  /**
+   * Number of characters of @e value.
+   */
+  size_t len;
+
+};
 
 
 /**
- * Lookup subvalue off of the HTTP Authorization header.
+ * The parameters of a digest "Authorization" header we use.
+ */
+struct DigestAuthParams
+{
+  struct DigestParam username;
+  struct DigestParam realm;
+  struct DigestParam nonce;
+  struct DigestParam uri;
+  struct DigestParam response;
+  struct DigestParam algorithm;
+  struct DigestParam cnonce;
+  struct DigestParam qop;
+  struct DigestParam nc;
+};
+
+
+/**
+ * Parse the "Authorization" header of a connection in one pass.
  *
- * A description of the input format for 'data' is at
+ * A description of the input format is at
  * http://en.wikipedia.org/wiki/Digest_access_authentication
  *
- *
- * @param dest where to store the result (possibly truncated if
- *             the buffer is not big enough).
- * @param size size of dest
- * @param data pointer to the Authorization header
- * @param key key to look up in data
- * @return size of the located value, 0 if otherwise
- */
-static size_t
-lookup_sub_value (char *dest,
-		  size_t size,
-		  const char *data,
-		  const char *key)
+ * @param connection the connection
+ * @param[out] params where to store the parameters
+ * @return #MHD_YES on success, #MHD_NO if there is no digest
+ *         authorization header or it is malformed
+ */
+static int
+parse_auth_header (struct MHD_Connection *connection,
+		   struct DigestAuthParams *params)
 {
-  size_t keylen;
-  size_t len;
+  static const struct
+  {
+    const char *name;
+    size_t offset;
+  } names[] = {
+    { "username", offsetof (struct DigestAuthParams, username) },
+    { "realm", offsetof (struct DigestAuthParams, realm) },
+    { "nonce", offsetof (struct DigestAuthParams, nonce) },
+    { "uri", offsetof (struct DigestAuthParams, uri) },
+    { "response", offsetof (struct DigestAuthParams, response) },
+    { "algorithm", offsetof (struct DigestAuthParams, algorithm) },
+    { "cnonce", offsetof (struct DigestAuthParams, cnonce) },
+    { "qop", offsetof (struct DigestAuthParams, qop) },
+    { "nc", offsetof (struct DigestAuthParams, nc) }
+  };
   const char *ptr;
+  const char *name;
   const char *eq;
   const char *q1;
   const char *q2;
-  const char *qn;
+  size_t name_len;
+  unsigned int i;
+  struct DigestParam *param;
 
-  if (0 == size)
-    return 0;
-  keylen = strlen (key);
-  ptr = data;
-  while ('\0' != *ptr)
+  memset (params, 0, sizeof (struct DigestAuthParams));
+  ptr = MHD_lookup_connection_value (connection,
+				     MHD_HEADER_KIND,
+				     MHD_HTTP_HEADER_AUTHORIZATION);
+  if ( (NULL == ptr) ||
+       (0 != strncmp (ptr, _BASE, strlen (_BASE))) )
+    return MHD_NO;
+  ptr += strlen (_BASE);
+  while (1)
     {
-      if (NULL == (eq = strchr (ptr, '=')))
-	return 0;
+      while ( (' ' == *ptr) || ('\t' == *ptr) || (',' == *ptr) )
+	ptr++;
+      if ('\0' == *ptr)
+	break;
+      name = ptr;
+      if (NULL == (eq = strchr (name, '=')))
+	return MHD_NO;
+      name_len = eq - name;
+      while ( (name_len > 0) &&
+	      (' ' == name[name_len - 1]) )
+	name_len--;
       q1 = eq + 1;
       while (' ' == *q1)
 	q1++;
-      if ('\"' != *q1)
+      if ('\"' == *q1)
 	{
-	  q2 = strchr (q1, ',');
-	  qn = q2;
+	  q1++;
+	  if (NULL == (q2 = strchr (q1, '\"')))
+	    return MHD_NO; /* end quote not found */
+	  ptr = q2 + 1;
 	}
       else
 	{
-	  q1++;
-	  q2 = strchr (q1, '\"');
-	  if (NULL == q2)
-	    return 0; /* end quote not found */
-	  qn = q2 + 1;
+	  q2 = q1 + strcspn (q1, ",");
+	  ptr = q2;
+	  while ( (q2 > q1) &&
+		  (' ' == q2[-1]) )
+	    q2--;
 	}
-      if ((MHD_str_equal_caseless_n_(ptr,
-			      key,
-			      keylen)) &&
-	   (eq == &ptr[keylen]) )
+      for (i = 0; i < sizeof (names) / sizeof (names[0]); i++)
 	{
-	  if (NULL == q2)
-	    {
-	      len = strlen (q1) + 1;
-	      if (size > len)
-		size = len;
-	      size--;
-	      strncpy (dest,
-		       q1,
-		       size);
-	      dest[size] = '\0';
-	      return size;
-	    }
-	  else
-	    {
-	      if (size > (size_t) ((q2 - q1) + 1))
-		size = (q2 - q1) + 1;
-	      size--;
-	      memcpy (dest,
-		      q1,
-		      size);
-	      dest[size] = '\0';
-	      return size;
-	    }
+	  if ( (strlen (names[i].name) != name_len) ||
+	       (! MHD_str_equal_caseless_n_ (name,
+					     names[i].name,
+					     name_len)) )
+	    continue;
+	  param = (struct DigestParam *) (((char *) params) + names[i].offset);
+	  param->value = q1;
+	  param->len = q2 - q1;
+	  break;
 	}
-      if (NULL == qn)
-	return 0;
-      ptr = strchr (qn, ',');
-      if (NULL == ptr)
-	return 0;
-      ptr++;
-      while (' ' == *ptr)
+      /* skip anything up to the next parameter */
+      while ( ('\0' != *ptr) &&
+	      (',' != *ptr) )
 	ptr++;
     }
-  return 0;
+  return MHD_YES;
+}
+
+
+/**
+ * Check if a parameter of the "Authorization" header has the
+ * given value.
+ *
+ * @param param the parameter
+ * @param str 0-terminated value to compare with
+ * @return #MHD_YES if the parameter was given and is @a str
+ */
+static int
+param_equal (const struct DigestParam *param,
+	     const char *str)
+{
+  if ( (NULL == param->value) ||
+       (strlen (str) != param->len) ||
+       (0 != memcmp (param->value, str, param->len)) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Determine the algorithm the client used.
+ *
+ * @param param the "algorithm" parameter of the "Authorization" header
+ * @return the algorithm, #MHD_DIGEST_ALG_AUTO if it is not supported
+ */
+static enum MHD_DigestAuthAlgorithm
+get_algorithm (const struct DigestParam *param)
+{
+  if (NULL == param->value)
+    return MHD_DIGEST_ALG_MD5; /* RFC 2617 default */
+  if ( (3 == param->len) &&
+       (MHD_str_equal_caseless_n_ (param->value, "MD5", 3)) )
+    return MHD_DIGEST_ALG_MD5;
+  if ( (7 == param->len) &&
+       (MHD_str_equal_caseless_n_ (param->value, "SHA-256", 7)) )
+    return MHD_DIGEST_ALG_SHA256;
+  if ( (11 == param->len) &&
+       (MHD_str_equal_caseless_n_ (param->value, "SHA-512-256", 11)) )
+    return MHD_DIGEST_ALG_SHA512_256;
+  return MHD_DIGEST_ALG_AUTO; /* includes the "-sess" variants */
+}
+
+
+/**
+ * Maximum number of slots of the nonce table looked at for a nonce;
+ * a new nonce replaces the least recently used one of these slots.
+ */
+#define NONCE_PROBE_LIMIT 16
+
+
+/**
+ * An entry of the nonce-nc map.
+ */
+struct MHD_NonceNc
+{
+
+  /**
+   * Nonce counter, a value that increases for each subsequent
+   * request for the same nonce.
+   */
+  uint64_t nc;
+
+  /**
+   * Hash of @e nonce.
+   */
+  uint64_t hash;
+
+  /**
+   * Value of the clock of the shard when the entry was last used.
+   */
+  uint32_t last_used;
+
+  /**
+   * Nonce value, empty for unused entries.
+   */
+  char nonce[MAX_NONCE_LENGTH];
+
+};
+
+
+/**
+ * Table remembering the nonce counters of the nonces handed out
+ * for digest authentication.
+ */
+struct MHD_NonceTable
+{
+
+  /**
+   * Entries of type `struct MHD_NonceNc`, hashed by nonce.
+   */
+  struct MHD_ShardTable table;
+
+};
+
+
+/**
+ * Create the table for the nonce counters of a daemon.
+ *
+ * @param size number of nonces to remember
+ * @param seed secret data to derive the hash key from if the TLS
+ *        library cannot provide one, may be NULL
+ * @param seed_size number of bytes in @a seed
+ * @return NULL on error
+ */
+struct MHD_NonceTable *
+MHD_nonce_table_create_ (unsigned int size,
+                         const void *seed,
+                         size_t seed_size)
+{
+  struct MHD_NonceTable *nt;
+
+  if (NULL == (nt = malloc (sizeof (struct MHD_NonceTable))))
+    return NULL;
+  if (MHD_YES != MHD_shard_table_init_ (&nt->table,
+                                        size,
+                                        sizeof (struct MHD_NonceNc),
+                                        NONCE_PROBE_LIMIT,
+                                        seed,
+                                        seed_size))
+    {
+      free (nt);
+      return NULL;
+    }
+  return nt;
+}
+
+
+/**
+ * Destroy the table for the nonce counters of a daemon.
+ *
+ * @param nt table to destroy
+ */
+void
+MHD_nonce_table_destroy_ (struct MHD_NonceTable *nt)
+{
+  if (NULL == nt)
+    return;
+  MHD_shard_table_deinit_ (&nt->table,
+                           NULL);
+  free (nt);
 }
 
 
@@ -310,54 +561,74 @@ check_nonce_nc (struct MHD_Connection *connection,
 		const char *nonce,
 		uint64_t nc)
 {
-  uint32_t off;
-  uint32_t mod;
-  const char *np;
+  struct MHD_NonceTable *nt = connection->daemon->nonce_table;
+  struct MHD_ShardProbe probe;
+  struct MHD_NonceNc *slot;
+  struct MHD_NonceNc *found;
+  struct MHD_NonceNc *victim;
+  size_t len;
+  uint64_t hash;
+  unsigned int i;
 
-  if (MAX_NONCE_LENGTH <= strlen (nonce))
+  len = strlen (nonce);
+  if (MAX_NONCE_LENGTH <= len)
     return MHD_NO; /* This should be impossible, but static analysis
                       tools have a hard time with it *and* this also
                       protects against unsafe modifications that may
                       happen in the future... */
-  mod = connection->daemon->nonce_nc_size;
-  if (0 == mod)
+  if (NULL == nt)
     return MHD_NO; /* no array! */
-  /* super-fast xor-based "hash" function for HT lookup in nonce array */
-  off = 0;
-  np = nonce;
-  while ('\0' != *np)
-    {
-      off = (off << 8) | (*np ^ (off >> 24));
-      np++;
-    }
-  off = off % mod;
+  hash = MHD_shard_table_hash_ (&nt->table, nonce, len);
   /*
    * Look for the nonce, if it does exist and its corresponding
    * nonce counter is less than the current nonce counter by 1,
    * then only increase the nonce counter by one.
    */
-
-  (void) MHD_mutex_lock_ (&connection->daemon->nnc_lock);
+  MHD_shard_table_lock_ (&nt->table, hash, &probe);
+  found = NULL;
+  victim = MHD_shard_probe_slot_ (&probe, 0);
+  for (i = 0; i < probe.limit; i++)
+    {
+      slot = MHD_shard_probe_slot_ (&probe, i);
+      if ( (hash == slot->hash) &&
+           (0 == strcmp (slot->nonce, nonce)) )
+        {
+          found = slot;
+          break;
+        }
+      /* prefer unused entries, then the least recently used one */
+      if ( ('\0' != victim->nonce[0]) &&
+           ( ('\0' == slot->nonce[0]) ||
+             ((int32_t) (slot->last_used - victim->last_used) < 0) ) )
+        victim = slot;
+    }
   if (0 == nc)
     {
-      strcpy (connection->daemon->nnc[off].nonce,
-              nonce);
-      connection->daemon->nnc[off].nc = 0;
-      (void) MHD_mutex_unlock_ (&connection->daemon->nnc_lock);
+      /* a nonce handed out again keeps its counter */
+      if (NULL == found)
+        {
+          found = victim;
+          memcpy (found->nonce, nonce, len + 1);
+          found->hash = hash;
+          found->nc = 0;
+        }
+      found->last_used = probe.shard->clock;
+      MHD_shard_probe_unlock_ (&probe);
       return MHD_YES;
     }
-  if ( (nc <= connection->daemon->nnc[off].nc) ||
-       (0 != strcmp(connection->daemon->nnc[off].nonce, nonce)) )
+  if ( (NULL == found) ||
+       (nc <= found->nc) )
     {
-      (void) MHD_mutex_unlock_ (&connection->daemon->nnc_lock);
+      MHD_shard_probe_unlock_ (&probe);
 #ifdef HAVE_MESSAGES
       MHD_DLOG (connection->daemon,
 		"Stale nonce received.  If this happens a lot, you should probably increase the size of the nonce array.\n");
 #endif
       return MHD_NO;
     }
-  connection->daemon->nnc[off].nc = nc;
-  (void) MHD_mutex_unlock_ (&connection->daemon->nnc_lock);
+  found->nc = nc;
+  found->last_used = probe.shard->clock;
+  MHD_shard_probe_unlock_ (&probe);
   return MHD_YES;
 }
 
@@ -373,23 +644,22 @@ check_nonce_nc (struct MHD_Connection *connection,
 char *
 MHD_digest_auth_get_username(struct MHD_Connection *connection)
 {
-  size_t len;
-  char user[MAX_USERNAME_LENGTH];
-  const char *header;
+  struct DigestAuthParams params;
+  char *user;
 
-  if (NULL == (header = MHD_lookup_connection_value (connection,
-						     MHD_HEADER_KIND,
-						     MHD_HTTP_HEADER_AUTHORIZATION)))
-    return NULL;
-  if (0 != strncmp (header, _BASE, strlen (_BASE)))
+  if ( (MHD_YES != parse_auth_header (connection,
+				      &params)) ||
+       (NULL == params.username.value) ||
+       (0 == params.username.len) ||
+       (MAX_USERNAME_LENGTH <= params.username.len) )
     return NULL;
-  header += strlen (_BASE);
-  if (0 == (len = lookup_sub_value (user,
-				    sizeof (user),
-				    header,
-				    "username")))
+  if (NULL == (user = malloc (params.username.len + 1)))
     return NULL;
-  return strdup (user);
+  memcpy (user,
+	  params.username.value,
+	  params.username.len);
+  user[params.username.len] = '\0';
+  return user;
 }
 
 
@@ -398,6 +668,7 @@ MHD_digest_auth_get_username(struct MHD_Connection *connection)
  * The current format of the nonce is ...
  * H(timestamp ":" method ":" random ":" uri ":" realm) + Hex(timestamp)
  *
+ * @param da the algorithm to use for H
  * @param nonce_time The amount of time in seconds for a nonce to be invalid
  * @param method HTTP method
  * @param rnd A pointer to a character array for the random seed
@@ -407,7 +678,8 @@ MHD_digest_auth_get_username(struct MHD_Connection *connection)
  * @param nonce A pointer to a character array for the nonce to put in
  */
 static void
-calculate_nonce (uint32_t nonce_time,
+calculate_nonce (struct DigestAlgorithm *da,
+		 uint32_t nonce_time,
 		 const char *method,
 		 const char *rnd,
 		 size_t rnd_size,
@@ -415,30 +687,27 @@ calculate_nonce (uint32_t nonce_time,
 		 const char *realm,
 		 char nonce[NONCE_STD_LEN + 1])
 {
-  struct MD5Context md5;
   unsigned char timestamp[TIMESTAMP_BIN_SIZE];
-  unsigned char tmpnonce[MD5_DIGEST_SIZE];
-  char timestamphex[TIMESTAMP_HEX_LEN + 1];
 
-  MD5Init (&md5);
+  da_restart (da);
   timestamp[0] = (unsigned char)((nonce_time & 0xff000000) >> 0x18);
   timestamp[1] = (unsigned char)((nonce_time & 0x00ff0000) >> 0x10);
   timestamp[2] = (unsigned char)((nonce_time & 0x0000ff00) >> 0x08);
   timestamp[3] = (unsigned char)((nonce_time & 0x000000ff));
-  MD5Update (&md5, timestamp, sizeof(timestamp));
-  MD5Update (&md5, (const unsigned char*)":", 1);
-  MD5Update (&md5, (const unsigned char*)method, strlen (method));
-  MD5Update (&md5, (const unsigned char*)":", 1);
+  da_update (da, timestamp, sizeof(timestamp));
+  da_update (da, ":", 1);
+  da_update_str (da, method);
+  da_update (da, ":", 1);
   if (rnd_size > 0)
-    MD5Update (&md5, (const unsigned char*)rnd, rnd_size);
-  MD5Update (&md5, (const unsigned char*)":", 1);
-  MD5Update (&md5, (const unsigned char*)uri, strlen (uri));
-  MD5Update (&md5, (const unsigned char*)":", 1);
-  MD5Update (&md5, (const unsigned char*)realm, strlen (realm));
-  MD5Final (tmpnonce, &md5);
-  cvthex (tmpnonce, sizeof (tmpnonce), nonce);
-  cvthex (timestamp, sizeof(timestamp), timestamphex);
-  strncat (nonce, timestamphex, 8);
+    da_update (da, rnd, rnd_size);
+  da_update (da, ":", 1);
+  da_update_str (da, uri);
+  da_update (da, ":", 1);
+  da_update_str (da, realm);
+  da_final_hex (da, nonce);
+  cvthex (timestamp,
+	  sizeof (timestamp),
+	  &nonce[2 * da->digest_size]);
 }
 
 
@@ -533,93 +802,79 @@ check_argument_match (struct MHD_Connection *connection,
 
 
 /**
- * Authenticates the authorization header sent by the client
+ * Authenticates the authorization header sent by the client, given
+ * either the password or the digest of "username:realm:password".
  *
  * @param connection The MHD connection structure
  * @param realm The realm presented to the client
  * @param username The username needs to be authenticated
- * @param password The password used in the authentication
+ * @param password The password used in the authentication,
+ *        NULL to use @a userdigest
+ * @param userdigest binary H(A1), used if @a password is NULL
+ * @param userdigest_size number of bytes in @a userdigest
  * @param nonce_timeout The amount of time for a nonce to be
  * 			invalid in seconds
+ * @param algo algorithm the client must have used,
+ *        #MHD_DIGEST_ALG_AUTO for any
  * @return #MHD_YES if authenticated, #MHD_NO if not,
  * 			#MHD_INVALID_NONCE if nonce is invalid
- * @ingroup authentication
  */
-int
-MHD_digest_auth_check (struct MHD_Connection *connection,
+static int
+digest_auth_check_all (struct MHD_Connection *connection,
 		       const char *realm,
 		       const char *username,
 		       const char *password,
-		       unsigned int nonce_timeout)
+		       const uint8_t *userdigest,
+		       size_t userdigest_size,
+		       unsigned int nonce_timeout,
+		       enum MHD_DigestAuthAlgorithm algo)
 {
-  size_t len;
-  const char *header;
-  char nonce[MAX_NONCE_LENGTH];
-  char cnonce[MAX_NONCE_LENGTH];
-  char qop[15]; /* auth,auth-int */
-  char nc[20];
-  char response[MAX_AUTH_RESPONSE_LENGTH];
-  const char *hentity = NULL; /* "auth-int" is not supported */
-  char ha1[HASH_MD5_HEX_LEN + 1];
-  char respexp[HASH_MD5_HEX_LEN + 1];
+  struct DigestAuthParams params;
+  struct DigestAlgorithm da;
+  enum MHD_DigestAuthAlgorithm client_algo;
+  char nonce[NONCE_STD_LEN + 1];
+  char ha1[MAX_DIGEST_HEX_LEN + 1];
+  char ha2[MAX_DIGEST_HEX_LEN + 1];
+  char respexp[MAX_DIGEST_HEX_LEN + 1];
   char noncehashexp[NONCE_STD_LEN + 1];
   uint32_t nonce_time;
   uint32_t t;
-  size_t left; /* number of characters left in 'header' for 'uri' */
   uint64_t nci;
+  char *uri;
 
-  header = MHD_lookup_connection_value (connection,
-					MHD_HEADER_KIND,
-					MHD_HTTP_HEADER_AUTHORIZATION);
-  if (NULL == header)
+  if (MHD_YES != parse_auth_header (connection,
+				    &params))
     return MHD_NO;
-  if (0 != strncmp(header, _BASE, strlen(_BASE)))
-    return MHD_NO;
-  header += strlen (_BASE);
-  left = strlen (header);
-
-  {
-    char un[MAX_USERNAME_LENGTH];
-
-    len = lookup_sub_value (un,
-			    sizeof (un),
-			    header, "username");
-    if ( (0 == len) ||
-	 (0 != strcmp(username, un)) )
-      return MHD_NO;
-    left -= strlen ("username") + len;
-  }
-
-  {
-    char r[MAX_REALM_LENGTH];
-
-    len = lookup_sub_value (r,
-                            sizeof (r),
-                            header, "realm");
-    if ( (0 == len) ||
-	 (0 != strcmp(realm, r)) )
+  client_algo = get_algorithm (&params.algorithm);
+  if (MHD_DIGEST_ALG_AUTO == client_algo)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+		"Authentication failed, unsupported algorithm.\n");
+#endif
       return MHD_NO;
-    left -= strlen ("realm") + len;
-  }
-
-  if (0 == (len = lookup_sub_value (nonce,
-				    sizeof (nonce),
-				    header, "nonce")))
+    }
+  if ( (MHD_DIGEST_ALG_AUTO != algo) &&
+       (algo != client_algo) )
     return MHD_NO;
-  left -= strlen ("nonce") + len;
-  if (left > 32 * 1024)
-  {
-    /* we do not permit URIs longer than 32k, as we want to
-       make sure to not blow our stack (or per-connection
-       heap memory limit).  Besides, 32k is already insanely
-       large, but of course in theory the
-       #MHD_OPTION_CONNECTION_MEMORY_LIMIT might be very large
-       and would thus permit sending a >32k authorization
-       header value. */
+  da_init (&da, client_algo);
+  if ( (NULL == password) &&
+       (userdigest_size != da.digest_size) )
     return MHD_NO;
-  }
-  if (TIMESTAMP_HEX_LEN != MHD_strx_to_uint32_n_ (nonce + len - TIMESTAMP_HEX_LEN,
-                                                  TIMESTAMP_HEX_LEN, &nonce_time))
+  if ( (MHD_YES != param_equal (&params.username, username)) ||
+       (MHD_YES != param_equal (&params.realm, realm)) )
+    return MHD_NO;
+
+  if ( (NULL == params.nonce.value) ||
+       (2 * da.digest_size + TIMESTAMP_HEX_LEN != params.nonce.len) )
+    return MHD_NO;
+  memcpy (nonce,
+	  params.nonce.value,
+	  params.nonce.len);
+  nonce[params.nonce.len] = '\0';
+  if (TIMESTAMP_HEX_LEN !=
+      MHD_strx_to_uint32_n_ (nonce + params.nonce.len - TIMESTAMP_HEX_LEN,
+			     TIMESTAMP_HEX_LEN, &nonce_time))
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (connection->daemon,
@@ -640,7 +895,8 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
       return MHD_INVALID_NONCE;
     }
 
-  calculate_nonce (nonce_time,
+  calculate_nonce (&da,
+		   nonce_time,
                    connection->method,
                    connection->daemon->digest_auth_random,
                    connection->daemon->digest_auth_rand_size,
@@ -661,14 +917,18 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
     {
       return MHD_INVALID_NONCE;
     }
-  if ( (0 == lookup_sub_value (cnonce,
-                               sizeof (cnonce),
-                               header, "cnonce")) ||
-       (0 == lookup_sub_value (qop, sizeof (qop), header, "qop")) ||
-       ( (0 != strcmp (qop, "auth")) &&
-         (0 != strcmp (qop, "")) ) ||
-       (0 == (len = lookup_sub_value (nc, sizeof (nc), header, "nc")) )  ||
-       (0 == lookup_sub_value (response, sizeof (response), header, "response")) )
+  if ( (NULL == params.cnonce.value) ||
+       (0 == params.cnonce.len) ||
+       (MAX_NONCE_LENGTH <= params.cnonce.len) ||
+       (NULL == params.qop.value) ||
+       ( (MHD_YES != param_equal (&params.qop, "auth")) &&
+         (0 != params.qop.len) ) ||
+       (NULL == params.nc.value) ||
+       (0 == params.nc.len) ||
+       (NULL == params.response.value) ||
+       (0 == params.response.len) ||
+       (MAX_AUTH_RESPONSE_LENGTH <= params.response.len) ||
+       (NULL == params.uri.value) )
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (connection->daemon,
@@ -676,7 +936,9 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
 #endif
       return MHD_NO;
     }
-  if (len != MHD_strx_to_uint64_n_ (nc, len, &nci))
+  if (params.nc.len != MHD_strx_to_uint64_n_ (params.nc.value,
+					      params.nc.len,
+					      &nci))
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (connection->daemon,
@@ -684,6 +946,17 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
 #endif
       return MHD_NO; /* invalid nonce format */
     }
+  if (params.uri.len > 32 * 1024)
+  {
+    /* we do not permit URIs longer than 32k, as we want to
+       make sure to not blow our stack (or per-connection
+       heap memory limit).  Besides, 32k is already insanely
+       large, but of course in theory the
+       #MHD_OPTION_CONNECTION_MEMORY_LIMIT might be very large
+       and would thus permit sending a >32k authorization
+       header value. */
+    return MHD_NO;
+  }
   /*
    * Checking if that combination of nonce and nc is sound
    * and not a replay attack attempt. Also adds the nonce
@@ -695,11 +968,47 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
       return MHD_NO;
     }
 
-  {
-    char *uri;
+  /* H(A1), "auth-int" and the "-sess" variants are not supported */
+  if (NULL != password)
+    {
+      da_restart (&da);
+      da_update_str (&da, username);
+      da_update (&da, ":", 1);
+      da_update_str (&da, realm);
+      da_update (&da, ":", 1);
+      da_update_str (&da, password);
+      da_final_hex (&da, ha1);
+    }
+  else
+    {
+      cvthex (userdigest, userdigest_size, ha1);
+    }
+  /* H(A2) */
+  da_restart (&da);
+  da_update_str (&da, connection->method);
+  da_update (&da, ":", 1);
+  da_update (&da, params.uri.value, params.uri.len);
+  da_final_hex (&da, ha2);
+  /* calculate response */
+  da_restart (&da);
+  da_update (&da, ha1, 2 * da.digest_size);
+  da_update (&da, ":", 1);
+  da_update (&da, nonce, params.nonce.len);
+  da_update (&da, ":", 1);
+  if (0 != params.qop.len)
+    {
+      da_update (&da, params.nc.value, params.nc.len);
+      da_update (&da, ":", 1);
+      da_update (&da, params.cnonce.value, params.cnonce.len);
+      da_update (&da, ":", 1);
+      da_update (&da, params.qop.value, params.qop.len);
+      da_update (&da, ":", 1);
+    }
+  da_update (&da, ha2, 2 * da.digest_size);
+  da_final_hex (&da, respexp);
 
-    uri = malloc (left + 1);
-    if (NULL == uri)
+  uri = malloc (params.uri.len + 1);
+  if (NULL == uri)
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG(connection->daemon,
@@ -707,38 +1016,17 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
 #endif /* HAVE_MESSAGES */
       return MHD_NO;
     }
-    if (0 == lookup_sub_value (uri,
-                               left + 1,
-                               header, "uri"))
-    {
-      free (uri);
-      return MHD_NO;
-    }
-
-    digest_calc_ha1("md5",
-		    username,
-		    realm,
-		    password,
-		    nonce,
-		    cnonce,
-		    ha1);
-    digest_calc_response (ha1,
-			  nonce,
-			  nc,
-			  cnonce,
-			  qop,
-			  connection->method,
-			  uri,
-			  hentity,
-			  respexp);
-
-    /* Need to unescape URI before comparing with connection->url */
-    connection->daemon->unescape_callback (connection->daemon->unescape_callback_cls,
-                                           connection,
-                                           uri);
-    if (0 != strncmp (uri,
-		      connection->url,
-		      strlen (connection->url)))
+  memcpy (uri,
+	  params.uri.value,
+	  params.uri.len);
+  uri[params.uri.len] = '\0';
+  /* Need to unescape URI before comparing with connection->url */
+  connection->daemon->unescape_callback (connection->daemon->unescape_callback_cls,
+					 connection,
+					 uri);
+  if (0 != strncmp (uri,
+		    connection->url,
+		    strlen (connection->url)))
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (connection->daemon,
@@ -748,60 +1036,210 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
       return MHD_NO;
     }
 
-    {
-      const char *args = strchr (uri, '?');
+  {
+    const char *args = strchr (uri, '?');
 
-      if (NULL == args)
-	args = "";
-      else
-	args++;
-      if (MHD_YES !=
-	  check_argument_match (connection,
-				args) )
+    if (NULL == args)
+      args = "";
+    else
+      args++;
+    if (MHD_YES !=
+	check_argument_match (connection,
+			      args) )
       {
 #ifdef HAVE_MESSAGES
 	MHD_DLOG (connection->daemon,
 		  "Authentication failed, arguments do not match.\n");
 #endif
-       free (uri);
-       return MHD_NO;
+	free (uri);
+	return MHD_NO;
       }
-    }
-    free (uri);
-    return (0 == strcmp(response, respexp))
-      ? MHD_YES
-      : MHD_NO;
   }
+  free (uri);
+  return (MHD_YES == param_equal (&params.response, respexp))
+    ? MHD_YES
+    : MHD_NO;
 }
 
 
 /**
- * Queues a response to request authentication from the client
+ * Authenticates the authorization header sent by the client
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param password The password used in the authentication
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+int
+MHD_digest_auth_check (struct MHD_Connection *connection,
+		       const char *realm,
+		       const char *username,
+		       const char *password,
+		       unsigned int nonce_timeout)
+{
+  return MHD_digest_auth_check2 (connection,
+				 realm,
+				 username,
+				 password,
+				 nonce_timeout,
+				 MHD_DIGEST_ALG_MD5);
+}
+
+
+/**
+ * Authenticates the authorization header sent by the client,
+ * supporting the hash algorithms of RFC 7616.
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param password The password used in the authentication
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @param algo the algorithm the client must have used, or
+ *        #MHD_DIGEST_ALG_AUTO for any supported one
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+int
+MHD_digest_auth_check2 (struct MHD_Connection *connection,
+			const char *realm,
+			const char *username,
+			const char *password,
+			unsigned int nonce_timeout,
+			enum MHD_DigestAuthAlgorithm algo)
+{
+  if (NULL == password)
+    return MHD_NO;
+  return digest_auth_check_all (connection,
+				realm,
+				username,
+				password,
+				NULL,
+				0,
+				nonce_timeout,
+				algo);
+}
+
+
+/**
+ * Authenticates the authorization header sent by the client,
+ * given the digest of "username:realm:password".
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param digest the binary digest for @a username, @a realm and the
+ *        password, computed with the algorithm the client uses
+ * @param digest_size number of bytes in @a digest
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @param algo the algorithm @a digest was computed with, or
+ *        #MHD_DIGEST_ALG_AUTO for any supported one with
+ *        digests of @a digest_size bytes
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+int
+MHD_digest_auth_check_digest2 (struct MHD_Connection *connection,
+			       const char *realm,
+			       const char *username,
+			       const uint8_t *digest,
+			       size_t digest_size,
+			       unsigned int nonce_timeout,
+			       enum MHD_DigestAuthAlgorithm algo)
+{
+  if (NULL == digest)
+    return MHD_NO;
+  return digest_auth_check_all (connection,
+				realm,
+				username,
+				NULL,
+				digest,
+				digest_size,
+				nonce_timeout,
+				algo);
+}
+
+
+/**
+ * Compute the digest of "username:realm:password" to store for
+ * use with #MHD_digest_auth_check_digest2().
+ *
+ * @param algo the algorithm to use, not #MHD_DIGEST_ALG_AUTO
+ * @param username the username
+ * @param realm the realm
+ * @param password the password
+ * @param[out] digest where to write the binary digest
+ * @param digest_size number of bytes available at @a digest
+ * @return #MHD_YES on success, #MHD_NO if @a algo is not
+ *         supported or @a digest_size is too small
+ * @ingroup authentication
+ */
+int
+MHD_digest_auth_calc_userdigest (enum MHD_DigestAuthAlgorithm algo,
+				 const char *username,
+				 const char *realm,
+				 const char *password,
+				 uint8_t *digest,
+				 size_t digest_size)
+{
+  struct DigestAlgorithm da;
+
+  if ( (MHD_DIGEST_ALG_MD5 != algo) &&
+       (MHD_DIGEST_ALG_SHA256 != algo) &&
+       (MHD_DIGEST_ALG_SHA512_256 != algo) )
+    return MHD_NO;
+  da_init (&da, algo);
+  if (digest_size < da.digest_size)
+    return MHD_NO;
+  da_update_str (&da, username);
+  da_update (&da, ":", 1);
+  da_update_str (&da, realm);
+  da_update (&da, ":", 1);
+  da_update_str (&da, password);
+  da_final (&da, digest);
+  return MHD_YES;
+}
+
+
+/**
+ * Add a "WWW-Authenticate" header asking for credentials computed
+ * with the given algorithm to a response.
  *
  * @param connection The MHD connection structure
  * @param realm the realm presented to the client
  * @param opaque string to user for opaque value
- * @param response reply to send; should contain the "access denied"
- *        body; note that this function will set the "WWW Authenticate"
- *        header and that the caller should not do this
- * @param signal_stale #MHD_YES if the nonce is invalid to add
- * 			'stale=true' to the authentication header
+ * @param response response to add the header to
+ * @param signal_stale #MHD_YES to add 'stale=true'
+ * @param algo the algorithm, not #MHD_DIGEST_ALG_AUTO
  * @return #MHD_YES on success, #MHD_NO otherwise
- * @ingroup authentication
  */
-int
-MHD_queue_auth_fail_response (struct MHD_Connection *connection,
-			      const char *realm,
-			      const char *opaque,
-			      struct MHD_Response *response,
-			      int signal_stale)
+static int
+add_auth_header (struct MHD_Connection *connection,
+		 const char *realm,
+		 const char *opaque,
+		 struct MHD_Response *response,
+		 int signal_stale,
+		 enum MHD_DigestAuthAlgorithm algo)
 {
+  struct DigestAlgorithm da;
   int ret;
   size_t hlen;
   char nonce[NONCE_STD_LEN + 1];
+  char alg[32];
 
   /* Generating the server nonce */
-  calculate_nonce ((uint32_t) MHD_monotonic_sec_counter(),
+  da_init (&da, algo);
+  calculate_nonce (&da,
+		   (uint32_t) MHD_monotonic_sec_counter(),
 		   connection->method,
 		   connection->daemon->digest_auth_random,
 		   connection->daemon->digest_auth_rand_size,
@@ -816,13 +1254,22 @@ MHD_queue_auth_fail_response (struct MHD_Connection *connection,
 #endif
       return MHD_NO;
     }
+  /* RFC 2617 clients do not know the parameter, so omit it for MD5 */
+  if (MHD_DIGEST_ALG_MD5 == da.algo)
+    alg[0] = '\0';
+  else
+    MHD_snprintf_ (alg,
+		   sizeof (alg),
+		   ",algorithm=%s",
+		   da.name);
   /* Building the authentication header */
   hlen = MHD_snprintf_(NULL,
 		   0,
-		   "Digest realm=\"%s\",qop=\"auth\",nonce=\"%s\",opaque=\"%s\"%s",
+		   "Digest realm=\"%s\",qop=\"auth\",nonce=\"%s\",opaque=\"%s\"%s%s",
 		   realm,
 		   nonce,
 		   opaque,
+		   alg,
 		   signal_stale
 		   ? ",stale=\"true\""
 		   : "");
@@ -842,10 +1289,11 @@ MHD_queue_auth_fail_response (struct MHD_Connection *connection,
 
     if (MHD_snprintf_(header,
 	      hlen + 1,
-	      "Digest realm=\"%s\",qop=\"auth\",nonce=\"%s\",opaque=\"%s\"%s",
+	      "Digest realm=\"%s\",qop=\"auth\",nonce=\"%s\",opaque=\"%s\"%s%s",
 	      realm,
 	      nonce,
 	      opaque,
+	      alg,
 	      signal_stale
 	      ? ",stale=\"true\""
 	      : "") == hlen)
@@ -858,7 +1306,92 @@ MHD_queue_auth_fail_response (struct MHD_Connection *connection,
   }
   else
     ret = MHD_NO;
+  return ret;
+}
+
+
+/**
+ * Queues a response to request authentication from the client
+ *
+ * @param connection The MHD connection structure
+ * @param realm the realm presented to the client
+ * @param opaque string to user for opaque value
+ * @param response reply to send; should contain the "access denied"
+ *        body; note that this function will set the "WWW Authenticate"
+ *        header and that the caller should not do this
+ * @param signal_stale #MHD_YES if the nonce is invalid to add
+ * 			'stale=true' to the authentication header
+ * @return #MHD_YES on success, #MHD_NO otherwise
+ * @ingroup authentication
+ */
+int
+MHD_queue_auth_fail_response (struct MHD_Connection *connection,
+			      const char *realm,
+			      const char *opaque,
+			      struct MHD_Response *response,
+			      int signal_stale)
+{
+  return MHD_queue_auth_fail_response2 (connection,
+					realm,
+					opaque,
+					response,
+					signal_stale,
+					MHD_DIGEST_ALG_MD5);
+}
+
 
+/**
+ * Queues a response to request authentication from the client,
+ * asking for the given hash algorithm.
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param opaque string to user for opaque value
+ * @param response reply to send; should contain the "access denied"
+ *        body; note that this function will set the "WWW Authenticate"
+ *        header and that the caller should not do this
+ * @param signal_stale #MHD_YES if the nonce is invalid to add
+ * 			'stale=true' to the authentication header
+ * @param algo the algorithm to ask for; #MHD_DIGEST_ALG_AUTO
+ *        offers SHA-256 (preferred) and MD5
+ * @return #MHD_YES on success, #MHD_NO otherwise
+ * @ingroup authentication
+ */
+int
+MHD_queue_auth_fail_response2 (struct MHD_Connection *connection,
+			       const char *realm,
+			       const char *opaque,
+			       struct MHD_Response *response,
+			       int signal_stale,
+			       enum MHD_DigestAuthAlgorithm algo)
+{
+  int ret;
+
+  if (MHD_DIGEST_ALG_AUTO == algo)
+    {
+      /* clients pick the first challenge they support; headers
+	 added later are sent first, so add SHA-256 last */
+      ret = add_auth_header (connection,
+			     realm,
+			     opaque,
+			     response,
+			     signal_stale,
+			     MHD_DIGEST_ALG_MD5);
+      if (MHD_YES == ret)
+	ret = add_auth_header (connection,
+			       realm,
+			       opaque,
+			       response,
+			       signal_stale,
+			       MHD_DIGEST_ALG_SHA256);
+    }
+  else
+    ret = add_auth_header (connection,
+			   realm,
+			   opaque,
+			   response,
+			   signal_stale,
+			   algo);
   if (MHD_YES == ret)
     ret = MHD_queue_response(connection,
 			     MHD_HTTP_UNAUTHORIZED,
@@ -0,0 +1,55 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file digestauth.h
+ * @brief  state of the daemon for digest authentication
+ * @author Christian Grothoff
+ */
+
+#ifndef DIGESTAUTH_H
+#define DIGESTAUTH_H
+
+#include "internal.h"
+
+
+/**
+ * Create the table for the nonce counters of a daemon.
+ *
+ * @param size number of nonces to remember
+ * @param seed secret data to derive the hash key from if the TLS
+ *        library cannot provide one, may be NULL
+ * @param seed_size number of bytes in @a seed
+ * @return NULL on error
+ */
+struct MHD_NonceTable *
+MHD_nonce_table_create_ (unsigned int size,
+                         const void *seed,
+                         size_t seed_size);
+
+
+/**
+ * Destroy the table for the nonce counters of a daemon.
+ *
+ * @param table table to destroy
+ */
+void
+MHD_nonce_table_destroy_ (struct MHD_NonceTable *table);
+
+#endif
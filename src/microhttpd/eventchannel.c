@@ -0,0 +1,809 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file eventchannel.c
+ * @brief broadcast of server-sent events to many connections
+ * @author Christian Grothoff
+ *
+ * Each published event is formatted once into a reference counted
+ * buffer which is appended to the channel's list of events.  The
+ * subscribers do not have queues of their own: each subscriber only
+ * holds a reference to the event it is currently sending (and the
+ * offset within that event), and every event holds a reference to
+ * the next one.  Thus, publishing is O(1) plus the work to resume
+ * the subscribers that are suspended because they sent everything,
+ * and events are freed as soon as the slowest subscriber is done
+ * with them.
+ *
+ * Subscribers that fall too far behind are evicted by the thread
+ * that publishes an event, but their connections are closed by the
+ * event loop of their daemon, which is woken up for that.
+ */
+
+#include "internal.h"
+#include "response.h"
+#include "connection.h"
+#include "eventchannel.h"
+
+
+/**
+ * Block size to use for the responses of the subscribers.
+ */
+#define EVENT_BLOCK_SIZE 4096
+
+
+/**
+ * Formatted event.
+ */
+struct Event
+{
+
+  /**
+   * Next event published on the channel, NULL for the latest one.
+   * The event holds a reference to it.
+   */
+  struct Event *next;
+
+  /**
+   * Formatted event, allocated at the end of this struct.
+   */
+  char *data;
+
+  /**
+   * Position of the first byte of the event in the stream of
+   * all events published on the channel.
+   */
+  uint64_t start;
+
+  /**
+   * Number of bytes in @e data.
+   */
+  size_t size;
+
+  /**
+   * Reference counter (held by the previous event, subscribers that
+   * are sending this event, and the channel for the latest event).
+   */
+  unsigned int rc;
+
+};
+
+
+/**
+ * Subscriber of a channel.
+ */
+struct EventSubscriber
+{
+
+  /**
+   * Subscribers are kept in a DLL (of the channel, or of the daemon
+   * once evicted).
+   */
+  struct EventSubscriber *next;
+
+  /**
+   * Subscribers are kept in a DLL (of the channel, or of the daemon
+   * once evicted).
+   */
+  struct EventSubscriber *prev;
+
+  /**
+   * Channel the subscriber is subscribed to.
+   */
+  struct MHD_EventChannel *channel;
+
+  /**
+   * Connection receiving the events.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * Event being sent (or the last event sent), NULL if evicted.
+   */
+  struct Event *cursor;
+
+  /**
+   * Number of bytes of @e cursor that have been sent.
+   */
+  size_t offset;
+
+  /**
+   * #MHD_YES if the connection is suspended waiting for events
+   * (and the subscriber is in the channel's idle list).
+   */
+  int idle;
+
+  /**
+   * #MHD_YES if the subscriber was evicted and is in the daemon's
+   * list of connections to close.
+   */
+  int in_evicted;
+
+};
+
+
+/**
+ * Channel for broadcasting server-sent events.
+ */
+struct MHD_EventChannel
+{
+
+  /**
+   * Subscribers that are suspended, waiting for events.
+   */
+  struct EventSubscriber *idle_head;
+
+  /**
+   * Subscribers that are suspended, waiting for events.
+   */
+  struct EventSubscriber *idle_tail;
+
+  /**
+   * Subscribers that are sending events.
+   */
+  struct EventSubscriber *busy_head;
+
+  /**
+   * Subscribers that are sending events.
+   */
+  struct EventSubscriber *busy_tail;
+
+  /**
+   * Latest event published (initially an empty event).
+   */
+  struct Event *tail;
+
+  /**
+   * Mutex protecting the channel, its subscribers and the events.
+   */
+  MHD_mutex_ lock;
+
+  /**
+   * Total number of bytes of all events published.
+   */
+  uint64_t end;
+
+  /**
+   * Maximum number of bytes queued for a subscriber
+   * before it is evicted, 0 for no limit.
+   */
+  size_t max_pending;
+
+  /**
+   * Reference counter (held by the application until the channel
+   * is destroyed and by each subscriber).
+   */
+  unsigned int rc;
+
+  /**
+   * #MHD_YES once the application destroyed the channel.
+   */
+  int closed;
+
+};
+
+
+/**
+ * Create an event with room for @a size bytes of data.
+ *
+ * @param size number of bytes in the formatted event
+ * @return NULL on error
+ */
+static struct Event *
+create_event (size_t size)
+{
+  struct Event *event;
+
+  event = malloc (sizeof (struct Event) + size);
+  if (NULL == event)
+    return NULL;
+  event->next = NULL;
+  event->data = (char *) &event[1];
+  event->start = 0;
+  event->size = size;
+  event->rc = 1;
+  return event;
+}
+
+
+/**
+ * Release a reference to an event, freeing it (and the events
+ * only it references) if it was the last reference.  Must be
+ * called with the channel's lock held.
+ *
+ * @param event event to release
+ */
+static void
+release_event (struct Event *event)
+{
+  struct Event *next;
+
+  while ( (NULL != event) &&
+          (0 == --event->rc) )
+    {
+      next = event->next;
+      free (event);
+      event = next;
+    }
+}
+
+
+/**
+ * Free a channel once its reference counter dropped to zero.
+ *
+ * @param channel channel to free
+ */
+static void
+free_channel (struct MHD_EventChannel *channel)
+{
+  release_event (channel->tail);
+  (void) MHD_mutex_destroy_ (&channel->lock);
+  free (channel);
+}
+
+
+/**
+ * Resume all subscribers waiting for events.  Must be called
+ * with the channel's lock held.
+ *
+ * @param channel the channel
+ */
+static void
+wake_subscribers (struct MHD_EventChannel *channel)
+{
+  struct EventSubscriber *sub;
+
+  while (NULL != (sub = channel->idle_head))
+    {
+      DLL_remove (channel->idle_head,
+                  channel->idle_tail,
+                  sub);
+      DLL_insert (channel->busy_head,
+                  channel->busy_tail,
+                  sub);
+      sub->idle = MHD_NO;
+      MHD_resume_connection (sub->connection);
+    }
+}
+
+
+/**
+ * Evict a subscriber that fell too far behind: release the events
+ * it holds, mark it as evicted and have the event loop of its daemon
+ * close the connection.  The stream of an HTTP/2 request is ended
+ * by its content reader instead (the connection carries other
+ * streams), as is the response of a connection with a thread of its
+ * own.  Must be called with the channel's lock held.
+ *
+ * @param channel the channel
+ * @param sub subscriber to evict (in the busy list)
+ */
+static void
+evict_subscriber (struct MHD_EventChannel *channel,
+                  struct EventSubscriber *sub)
+{
+  struct MHD_Connection *connection = sub->connection;
+  struct MHD_Daemon *daemon = connection->daemon;
+  int signal;
+
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Closing event stream of slow subscriber\n");
+#endif
+  DLL_remove (channel->busy_head,
+              channel->busy_tail,
+              sub);
+  release_event (sub->cursor);
+  sub->cursor = NULL;
+  if ( (NULL != connection->h2_stream) ||
+       (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) )
+    return;
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  /* signal only once per round of the event loop */
+  signal = (NULL == daemon->evicted_head);
+  DLL_insert (daemon->evicted_head,
+              daemon->evicted_tail,
+              sub);
+  sub->in_evicted = MHD_YES;
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  if ( (signal) &&
+       (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
+       (1 != MHD_pipe_write_ (daemon->wpipe[1], "e", 1)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "failed to signal eviction via pipe");
+#endif
+    }
+}
+
+
+/**
+ * Content reader for the response of a subscriber.
+ *
+ * @param cls the `struct EventSubscriber`
+ * @param pos position in the stream (unused)
+ * @param buf where to copy the data
+ * @param max maximum number of bytes to copy
+ * @return number of bytes copied
+ */
+static ssize_t
+event_reader (void *cls,
+              uint64_t pos,
+              char *buf,
+              size_t max)
+{
+  struct EventSubscriber *sub = cls;
+  struct MHD_EventChannel *channel = sub->channel;
+  struct Event *event;
+  size_t copied;
+  size_t n;
+
+  if (MHD_YES != MHD_mutex_lock_ (&channel->lock))
+    MHD_PANIC ("Failed to acquire event channel mutex\n");
+  if (NULL == sub->cursor)
+    {
+      /* evicted */
+      if (MHD_YES != MHD_mutex_unlock_ (&channel->lock))
+        MHD_PANIC ("Failed to release event channel mutex\n");
+      return MHD_CONTENT_READER_END_WITH_ERROR;
+    }
+  copied = 0;
+  while (copied < max)
+    {
+      event = sub->cursor;
+      if (sub->offset == event->size)
+        {
+          if (NULL == event->next)
+            break;
+          event->next->rc++;
+          sub->cursor = event->next;
+          sub->offset = 0;
+          release_event (event);
+          continue;
+        }
+      n = event->size - sub->offset;
+      if (n > max - copied)
+        n = max - copied;
+      memcpy (&buf[copied],
+              &event->data[sub->offset],
+              n);
+      sub->offset += n;
+      copied += n;
+    }
+  if (0 == copied)
+    {
+      if (MHD_YES == channel->closed)
+        {
+          if (MHD_YES != MHD_mutex_unlock_ (&channel->lock))
+            MHD_PANIC ("Failed to release event channel mutex\n");
+          return MHD_CONTENT_READER_END_OF_STREAM;
+        }
+      if (0 != (sub->connection->daemon->options & MHD_USE_SUSPEND_RESUME))
+        {
+          /* nothing to send, wait for the next event */
+          DLL_remove (channel->busy_head,
+                      channel->busy_tail,
+                      sub);
+          DLL_insert (channel->idle_head,
+                      channel->idle_tail,
+                      sub);
+          sub->idle = MHD_YES;
+          MHD_suspend_connection (sub->connection);
+        }
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&channel->lock))
+    MHD_PANIC ("Failed to release event channel mutex\n");
+  return copied;
+}
+
+
+/**
+ * Free a subscriber once its response is destroyed.
+ *
+ * @param cls the `struct EventSubscriber`
+ */
+static void
+event_subscriber_free (void *cls)
+{
+  struct EventSubscriber *sub = cls;
+  struct MHD_EventChannel *channel = sub->channel;
+  struct MHD_Daemon *daemon;
+  int done;
+
+  if (MHD_YES != MHD_mutex_lock_ (&channel->lock))
+    MHD_PANIC ("Failed to acquire event channel mutex\n");
+  if (MHD_YES == sub->in_evicted)
+    {
+      /* closed before the event loop got to it */
+      daemon = sub->connection->daemon;
+      if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to acquire cleanup mutex\n");
+      DLL_remove (daemon->evicted_head,
+                  daemon->evicted_tail,
+                  sub);
+      if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to release cleanup mutex\n");
+    }
+  if (NULL != sub->cursor)
+    {
+      if (MHD_YES == sub->idle)
+        DLL_remove (channel->idle_head,
+                    channel->idle_tail,
+                    sub);
+      else
+        DLL_remove (channel->busy_head,
+                    channel->busy_tail,
+                    sub);
+      release_event (sub->cursor);
+    }
+  done = (0 == --channel->rc);
+  if (MHD_YES != MHD_mutex_unlock_ (&channel->lock))
+    MHD_PANIC ("Failed to release event channel mutex\n");
+  if (done)
+    free_channel (channel);
+  free (sub);
+}
+
+
+/**
+ * Create a channel for broadcasting server-sent events.
+ *
+ * @param max_pending maximum number of bytes of events that may be
+ *        queued for a subscriber (beyond the event it is sending);
+ *        subscribers that fall further behind are disconnected;
+ *        0 for no limit
+ * @return NULL on error (out of memory)
+ * @ingroup response
+ */
+struct MHD_EventChannel *
+MHD_event_channel_create (size_t max_pending)
+{
+  struct MHD_EventChannel *channel;
+
+  channel = malloc (sizeof (struct MHD_EventChannel));
+  if (NULL == channel)
+    return NULL;
+  memset (channel,
+          0,
+          sizeof (struct MHD_EventChannel));
+  channel->tail = create_event (0);
+  if (NULL == channel->tail)
+    {
+      free (channel);
+      return NULL;
+    }
+  if (MHD_YES != MHD_mutex_create_ (&channel->lock))
+    {
+      free (channel->tail);
+      free (channel);
+      return NULL;
+    }
+  channel->max_pending = max_pending;
+  channel->rc = 1;
+  return channel;
+}
+
+
+/**
+ * Append a field ("name: value\n") to a formatted event.  If @a buf
+ * is NULL, only the length is computed.
+ *
+ * @param buf buffer for the event, or NULL
+ * @param off offset at which to append
+ * @param name name of the field
+ * @param value value of the field
+ * @param value_len number of bytes in @a value
+ * @return new offset
+ */
+static size_t
+append_field (char *buf,
+              size_t off,
+              const char *name,
+              const char *value,
+              size_t value_len)
+{
+  size_t name_len = strlen (name);
+
+  if (NULL != buf)
+    {
+      memcpy (&buf[off], name, name_len);
+      buf[off + name_len] = ':';
+      buf[off + name_len + 1] = ' ';
+      memcpy (&buf[off + name_len + 2], value, value_len);
+      buf[off + name_len + 2 + value_len] = '\n';
+    }
+  return off + name_len + 2 + value_len + 1;
+}
+
+
+/**
+ * Format an event in the "text/event-stream" format.  If @a buf is
+ * NULL, only the length is computed.
+ *
+ * @param buf buffer for the event, or NULL
+ * @param event type of the event, or NULL
+ * @param id id of the event, or NULL
+ * @param data data of the event
+ * @return length of the formatted event
+ */
+static size_t
+format_event (char *buf,
+              const char *event,
+              const char *id,
+              const char *data)
+{
+  size_t len;
+  size_t off;
+
+  off = 0;
+  if (NULL != event)
+    off = append_field (buf, off, "event", event, strlen (event));
+  if (NULL != id)
+    off = append_field (buf, off, "id", id, strlen (id));
+  /* each line of the data is sent as a separate field; clients end
+     lines at "\r\n", "\r" and "\n" */
+  while (1)
+    {
+      len = strcspn (data, "\r\n");
+      off = append_field (buf, off, "data", data, len);
+      data += len;
+      if ('\0' == *data)
+        break;
+      if ( ('\r' == data[0]) &&
+           ('\n' == data[1]) )
+        data++;
+      data++;
+    }
+  if (NULL != buf)
+    buf[off] = '\n';
+  return off + 1;
+}
+
+
+/**
+ * Publish an event to all subscribers of a channel.  The event is
+ * formatted once and shared by all subscribers.  Subscribers whose
+ * connections are suspended waiting for events are resumed;
+ * subscribers that have more than the channel's limit of data queued
+ * are disconnected.  Safe to call from any thread.
+ *
+ * @param channel channel to publish on
+ * @param event type of the event ("event" field), NULL for none;
+ *        must not contain CR or LF
+ * @param id id of the event ("id" field), NULL for none;
+ *        must not contain CR or LF
+ * @param data data of the event, may contain multiple lines
+ *        (ending with CRLF, CR or LF), each is sent as a "data"
+ *        field
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory,
+ *         CR or LF in @a event or @a id)
+ * @ingroup response
+ */
+int
+MHD_event_channel_publish (struct MHD_EventChannel *channel,
+                           const char *event,
+                           const char *id,
+                           const char *data)
+{
+  struct EventSubscriber *sub;
+  struct EventSubscriber *next;
+  struct Event *ev;
+  uint64_t pending;
+
+  /* a line end would start a new field */
+  if ( ( (NULL != event) &&
+         ('\0' != event[strcspn (event, "\r\n")]) ) ||
+       ( (NULL != id) &&
+         ('\0' != id[strcspn (id, "\r\n")]) ) )
+    return MHD_NO;
+  if (NULL == data)
+    data = "";
+  ev = create_event (format_event (NULL, event, id, data));
+  if (NULL == ev)
+    return MHD_NO;
+  (void) format_event (ev->data, event, id, data);
+
+  if (MHD_YES != MHD_mutex_lock_ (&channel->lock))
+    MHD_PANIC ("Failed to acquire event channel mutex\n");
+  ev->start = channel->end;
+  channel->end += ev->size;
+  /* the previous event now references 'ev' and passes on
+     the channel's reference */
+  ev->rc++;
+  channel->tail->next = ev;
+  release_event (channel->tail);
+  channel->tail = ev;
+  if (0 != channel->max_pending)
+    {
+      for (sub = channel->busy_head; NULL != sub; sub = next)
+        {
+          next = sub->next;
+          pending = channel->end - (sub->cursor->start + sub->offset);
+          if (pending - (sub->cursor->size - sub->offset) > channel->max_pending)
+            evict_subscriber (channel, sub);
+        }
+    }
+  wake_subscribers (channel);
+  if (MHD_YES != MHD_mutex_unlock_ (&channel->lock))
+    MHD_PANIC ("Failed to release event channel mutex\n");
+  return MHD_YES;
+}
+
+
+/**
+ * Create a response that streams the events published on a channel
+ * (starting with the next event) to a connection.  If the daemon
+ * was started with #MHD_USE_SUSPEND_RESUME, the connection is
+ * suspended while there are no events to send and resumed when an
+ * event is published; otherwise, MHD polls the channel.  The
+ * response must only be queued for @a connection.
+ *
+ * @param channel channel to subscribe to
+ * @param connection connection the response will be queued for
+ * @return NULL on error (out of memory, channel destroyed)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_event_channel_subscribe (struct MHD_EventChannel *channel,
+                             struct MHD_Connection *connection)
+{
+  struct EventSubscriber *sub;
+  struct MHD_Response *response;
+
+  sub = malloc (sizeof (struct EventSubscriber));
+  if (NULL == sub)
+    return NULL;
+  memset (sub,
+          0,
+          sizeof (struct EventSubscriber));
+  sub->channel = channel;
+  sub->connection = connection;
+  if (MHD_YES != MHD_mutex_lock_ (&channel->lock))
+    MHD_PANIC ("Failed to acquire event channel mutex\n");
+  if (MHD_YES == channel->closed)
+    {
+      if (MHD_YES != MHD_mutex_unlock_ (&channel->lock))
+        MHD_PANIC ("Failed to release event channel mutex\n");
+      free (sub);
+      return NULL;
+    }
+  sub->cursor = channel->tail;
+  sub->offset = channel->tail->size;
+  channel->tail->rc++;
+  channel->rc++;
+  DLL_insert (channel->busy_head,
+              channel->busy_tail,
+              sub);
+  if (MHD_YES != MHD_mutex_unlock_ (&channel->lock))
+    MHD_PANIC ("Failed to release event channel mutex\n");
+  response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                EVENT_BLOCK_SIZE,
+                                                &event_reader,
+                                                sub,
+                                                &event_subscriber_free);
+  if (NULL == response)
+    {
+      event_subscriber_free (sub);
+      return NULL;
+    }
+  if ( (MHD_NO == MHD_add_response_header (response,
+                                           MHD_HTTP_HEADER_CONTENT_TYPE,
+                                           "text/event-stream")) ||
+       (MHD_NO == MHD_add_response_header (response,
+                                           MHD_HTTP_HEADER_CACHE_CONTROL,
+                                           "no-cache")) )
+    {
+      MHD_destroy_response (response);
+      return NULL;
+    }
+  return response;
+}
+
+
+/**
+ * Destroy a channel.  The streams of all subscribers end after the
+ * events published so far have been sent; the channel's memory is
+ * released once the last subscriber is gone.  Must be called before
+ * stopping daemons with connections subscribed to the channel.
+ *
+ * @param channel channel to destroy
+ * @ingroup response
+ */
+void
+MHD_event_channel_destroy (struct MHD_EventChannel *channel)
+{
+  int done;
+
+  if (MHD_YES != MHD_mutex_lock_ (&channel->lock))
+    MHD_PANIC ("Failed to acquire event channel mutex\n");
+  channel->closed = MHD_YES;
+  wake_subscribers (channel);
+  done = (0 == --channel->rc);
+  if (MHD_YES != MHD_mutex_unlock_ (&channel->lock))
+    MHD_PANIC ("Failed to release event channel mutex\n");
+  if (done)
+    free_channel (channel);
+}
+
+
+/**
+ * Close the connections of the subscribers of @a daemon that were
+ * evicted from their channels by other threads.  Must be called
+ * from the event loop of @a daemon, before it processes the
+ * connections.
+ *
+ * @param daemon daemon to process
+ */
+void
+MHD_event_channel_wakeup_ (struct MHD_Daemon *daemon)
+{
+  struct EventSubscriber *sub;
+  struct EventSubscriber *next;
+  struct MHD_Connection *connection;
+
+  if (NULL == daemon->evicted_head)
+    return; /* racy, but we will be signalled again */
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  next = daemon->evicted_head;
+  while (NULL != (sub = next))
+    {
+      if (MHD_YES == sub->connection->suspended)
+        {
+          /* evicted right after it was resumed, close it once the
+             resume is processed (which signals the event loop) */
+          next = sub->next;
+          continue;
+        }
+      DLL_remove (daemon->evicted_head,
+                  daemon->evicted_tail,
+                  sub);
+      sub->in_evicted = MHD_NO;
+      /* only this thread frees the subscriber: the idle handler
+         cleans up the connection in this round of the event loop */
+      connection = sub->connection;
+      if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to release cleanup mutex\n");
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_WITH_ERROR);
+      if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to acquire cleanup mutex\n");
+      /* the list may have changed while the mutex was released */
+      next = daemon->evicted_head;
+#if EPOLL_SUPPORT
+      /* the other event loops look at all connections anyway */
+      if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+           (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+        {
+          EDLL_insert (daemon->eready_head,
+                       daemon->eready_tail,
+                       connection);
+          connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+        }
+#endif
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+/* end of eventchannel.c */
@@ -0,0 +1,43 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file eventchannel.h
+ * @brief  broadcast of server-sent events to many connections
+ * @author Christian Grothoff
+ */
+
+#ifndef EVENTCHANNEL_H
+#define EVENTCHANNEL_H
+
+#include "internal.h"
+
+
+/**
+ * Close the connections of the subscribers of @a daemon that were
+ * evicted from their channels by other threads.  Must be called
+ * from the event loop of @a daemon, before it processes the
+ * connections.
+ *
+ * @param daemon daemon to process
+ */
+void
+MHD_event_channel_wakeup_ (struct MHD_Daemon *daemon);
+
+#endif
@@ -0,0 +1,573 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file filecache.c
+ * @brief cache of open files and prepared responses for static content
+ * @author Christian Grothoff
+ */
+
+#include "internal.h"
+#include "response.h"
+#include "mhd_mono_clock.h"
+#include "mhd_limits.h"
+
+#if defined(_WIN32)
+#include <io.h> /* for open(), close() */
+#endif /* _WIN32 */
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif /* !O_BINARY */
+
+
+/**
+ * Entry in the file cache.  Each entry is both in a hash chain
+ * (for lookups by URL) and in the LRU list (for eviction).
+ */
+struct FileCacheEntry
+{
+
+  /**
+   * Next entry in the same hash bucket.
+   */
+  struct FileCacheEntry *next_hash;
+
+  /**
+   * Next entry in the LRU list (towards less recently used).
+   */
+  struct FileCacheEntry *next;
+
+  /**
+   * Previous entry in the LRU list (towards more recently used).
+   */
+  struct FileCacheEntry *prev;
+
+  /**
+   * URL of the file (relative to the root of the cache), 0-terminated.
+   * Allocated together with the entry.
+   */
+  char *url;
+
+  /**
+   * Response for the file; the cache holds one reference.
+   */
+  struct MHD_Response *response;
+
+  /**
+   * Size of the file when it was opened.
+   */
+  uint64_t size;
+
+  /**
+   * Modification time of the file when it was opened.
+   */
+  time_t mtime;
+
+  /**
+   * Inode of the file when it was opened.
+   */
+  ino_t ino;
+
+  /**
+   * Device of the file when it was opened.
+   */
+  dev_t dev;
+
+  /**
+   * Monotonic time (in seconds) of the last check of the file's
+   * status against the file system.
+   */
+  time_t last_check;
+
+  /**
+   * Hash of @e url.
+   */
+  unsigned int hash;
+
+};
+
+
+/**
+ * Cache of open files and the responses built from them.
+ */
+struct MHD_FileCache
+{
+
+  /**
+   * Hash table of entries, with @e num_buckets chains.
+   */
+  struct FileCacheEntry **buckets;
+
+  /**
+   * Most recently used entry.
+   */
+  struct FileCacheEntry *lru_head;
+
+  /**
+   * Least recently used entry.
+   */
+  struct FileCacheEntry *lru_tail;
+
+  /**
+   * Directory from which files are served, 0-terminated.
+   */
+  char *root;
+
+  /**
+   * Mutex protecting all of the above and @e num_entries.
+   */
+  MHD_mutex_ lock;
+
+  /**
+   * Length of @e root.
+   */
+  size_t root_len;
+
+  /**
+   * Number of chains in @e buckets.
+   */
+  unsigned int num_buckets;
+
+  /**
+   * Number of entries currently in the cache.
+   */
+  unsigned int num_entries;
+
+  /**
+   * Maximum number of entries in the cache.
+   */
+  unsigned int max_entries;
+
+  /**
+   * Number of seconds an entry is used without checking the file.
+   */
+  unsigned int stat_ttl;
+
+};
+
+
+/**
+ * Compute the hash of a URL (FNV-1a).
+ *
+ * @param url 0-terminated URL
+ * @return hash value
+ */
+static unsigned int
+hash_url (const char *url)
+{
+  uint32_t h = 2166136261U;
+
+  while ('\0' != *url)
+    {
+      h ^= (unsigned char) *url++;
+      h *= 16777619U;
+    }
+  return (unsigned int) h;
+}
+
+
+/**
+ * Check that the URL can be safely mapped to a file below
+ * the root of the cache.
+ *
+ * @param url URL to check
+ * @return #MHD_YES if the URL is acceptable
+ */
+static int
+check_url (const char *url)
+{
+  const char *pos;
+
+  if ('/' != url[0])
+    return MHD_NO;
+  for (pos = url; NULL != pos; pos = strchr (pos + 1, '/'))
+    {
+      if ( ('.' == pos[1]) &&
+           ('.' == pos[2]) &&
+           ( ('/' == pos[3]) ||
+             ('\0' == pos[3]) ) )
+        return MHD_NO;
+    }
+#ifdef _WIN32
+  if (NULL != strchr (url, '\\'))
+    return MHD_NO;
+#endif /* _WIN32 */
+  return MHD_YES;
+}
+
+
+/**
+ * Produce the value of a "Last-Modified" header for the given time.
+ *
+ * @param t time to format
+ * @param date where to write the value, must be at least 30 bytes
+ * @return #MHD_YES on success
+ */
+static int
+format_http_date (time_t t,
+                  char *date)
+{
+  static const char *const days[] =
+    { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+  static const char *const mons[] =
+    { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct",
+    "Nov", "Dec"
+  };
+  struct tm tm;
+#if !defined(HAVE_C11_GMTIME_S) && !defined(HAVE_W32_GMTIME_S) && !defined(HAVE_GMTIME_R)
+  struct tm *ptm;
+#endif
+
+#if defined(HAVE_C11_GMTIME_S)
+  if (NULL == gmtime_s (&t, &tm))
+    return MHD_NO;
+#elif defined(HAVE_W32_GMTIME_S)
+  if (0 != gmtime_s (&tm, &t))
+    return MHD_NO;
+#elif defined(HAVE_GMTIME_R)
+  if (NULL == gmtime_r (&t, &tm))
+    return MHD_NO;
+#else
+  ptm = gmtime (&t);
+  if (NULL == ptm)
+    return MHD_NO;
+  tm = *ptm;
+#endif
+  sprintf (date,
+           "%3s, %02u %3s %04u %02u:%02u:%02u GMT",
+           days[tm.tm_wday % 7],
+           (unsigned int) tm.tm_mday,
+           mons[tm.tm_mon % 12],
+           (unsigned int) (1900 + tm.tm_year),
+           (unsigned int) tm.tm_hour,
+           (unsigned int) tm.tm_min,
+           (unsigned int) tm.tm_sec);
+  return MHD_YES;
+}
+
+
+/**
+ * Remove an entry from the cache and release the cache's
+ * reference to its response.  Must be called with the
+ * cache's lock held.
+ *
+ * @param cache cache to remove @a entry from
+ * @param entry entry to remove
+ */
+static void
+remove_entry (struct MHD_FileCache *cache,
+              struct FileCacheEntry *entry)
+{
+  struct FileCacheEntry **pos;
+
+  pos = &cache->buckets[entry->hash % cache->num_buckets];
+  while (*pos != entry)
+    pos = &(*pos)->next_hash;
+  *pos = entry->next_hash;
+  DLL_remove (cache->lru_head,
+              cache->lru_tail,
+              entry);
+  cache->num_entries--;
+  MHD_destroy_response (entry->response);
+  free (entry);
+}
+
+
+/**
+ * Open the file for @a url and create a new cache entry for it.
+ *
+ * @param cache the cache
+ * @param url URL of the file
+ * @param hash hash of @a url
+ * @return NULL on error
+ */
+static struct FileCacheEntry *
+create_entry (struct MHD_FileCache *cache,
+              const char *url,
+              unsigned int hash)
+{
+  struct FileCacheEntry *entry;
+  struct MHD_Response *response;
+  struct stat buf;
+  size_t url_len;
+  char *path;
+  char etag[64];
+  char date[32];
+  int fd;
+
+  url_len = strlen (url);
+  path = malloc (cache->root_len + url_len + 1);
+  if (NULL == path)
+    return NULL;
+  memcpy (path, cache->root, cache->root_len);
+  memcpy (&path[cache->root_len], url, url_len + 1);
+  fd = open (path, O_RDONLY | O_BINARY);
+  free (path);
+  if (-1 == fd)
+    return NULL;
+  if ( (0 != fstat (fd, &buf)) ||
+       (! S_ISREG (buf.st_mode)) )
+    {
+      (void) close (fd);
+      return NULL;
+    }
+  response = MHD_create_response_from_fd64 ((uint64_t) buf.st_size,
+                                            fd);
+  if (NULL == response)
+    {
+      (void) close (fd);
+      return NULL;
+    }
+  snprintf (etag,
+            sizeof (etag),
+            "\"%llx-%llx-%llx\"",
+            (unsigned long long) buf.st_ino,
+            (unsigned long long) buf.st_size,
+            (unsigned long long) buf.st_mtime);
+  if ( (MHD_YES != MHD_add_response_header (response,
+                                            MHD_HTTP_HEADER_ETAG,
+                                            etag)) ||
+       ( (MHD_YES == format_http_date (buf.st_mtime,
+                                       date)) &&
+         (MHD_YES != MHD_add_response_header (response,
+                                              MHD_HTTP_HEADER_LAST_MODIFIED,
+                                              date)) ) ||
+       (NULL == (entry = malloc (sizeof (struct FileCacheEntry) + url_len + 1))) )
+    {
+      MHD_destroy_response (response);
+      return NULL;
+    }
+  memset (entry, 0, sizeof (struct FileCacheEntry));
+  entry->url = (char *) &entry[1];
+  memcpy (entry->url, url, url_len + 1);
+  entry->response = response;
+  entry->size = (uint64_t) buf.st_size;
+  entry->mtime = buf.st_mtime;
+  entry->ino = buf.st_ino;
+  entry->dev = buf.st_dev;
+  entry->last_check = MHD_monotonic_sec_counter ();
+  entry->hash = hash;
+  return entry;
+}
+
+
+/**
+ * Check whether the file of a cached entry is still the same
+ * as when it was opened.
+ *
+ * @param cache the cache
+ * @param entry entry to check
+ * @return #MHD_YES if the entry is still valid
+ */
+static int
+revalidate_entry (struct MHD_FileCache *cache,
+                  struct FileCacheEntry *entry)
+{
+  struct stat buf;
+  size_t url_len;
+  char *path;
+  int ret;
+
+  url_len = strlen (entry->url);
+  path = malloc (cache->root_len + url_len + 1);
+  if (NULL == path)
+    return MHD_NO;
+  memcpy (path, cache->root, cache->root_len);
+  memcpy (&path[cache->root_len], entry->url, url_len + 1);
+  ret = stat (path, &buf);
+  free (path);
+  if ( (0 != ret) ||
+       (buf.st_ino != entry->ino) ||
+       (buf.st_dev != entry->dev) ||
+       (buf.st_mtime != entry->mtime) ||
+       ((uint64_t) buf.st_size != entry->size) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Create a cache for serving static files below @a root.  The cache
+ * keeps the files open and holds a fully prepared `struct
+ * MHD_Response` (including "ETag" and "Last-Modified" headers) for
+ * each of them, so that lookups of hot files do not need any system
+ * calls until MHD sends the data with `sendfile()`.
+ *
+ * The cache is safe to use from multiple threads.
+ *
+ * @param root directory to serve files from (without trailing '/')
+ * @param max_entries maximum number of files to keep open; the least
+ *        recently used file is evicted once this limit is reached
+ * @param stat_ttl number of seconds during which a cached entry is
+ *        considered fresh without calling `stat()` on the file; use 0
+ *        to check the file for changes on every lookup
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_FileCache *
+MHD_file_cache_create (const char *root,
+                       unsigned int max_entries,
+                       unsigned int stat_ttl)
+{
+  struct MHD_FileCache *cache;
+
+  if ( (NULL == root) ||
+       (0 == max_entries) ||
+       (max_entries > UINT_MAX / 2) )
+    return NULL;
+  cache = malloc (sizeof (struct MHD_FileCache));
+  if (NULL == cache)
+    return NULL;
+  memset (cache, 0, sizeof (struct MHD_FileCache));
+  cache->root_len = strlen (root);
+  cache->root = strdup (root);
+  cache->max_entries = max_entries;
+  cache->stat_ttl = stat_ttl;
+  cache->num_buckets = max_entries * 2;
+  cache->buckets = calloc (cache->num_buckets,
+                           sizeof (struct FileCacheEntry *));
+  if ( (NULL == cache->root) ||
+       (NULL == cache->buckets) ||
+       (MHD_YES != MHD_mutex_create_ (&cache->lock)) )
+    {
+      free (cache->buckets);
+      free (cache->root);
+      free (cache);
+      return NULL;
+    }
+  return cache;
+}
+
+
+/**
+ * Obtain the response for a file from the cache, opening the file
+ * and creating the response if necessary.  The caller owns a
+ * reference to the returned response and must call
+ * #MHD_destroy_response after queueing it, just as with responses
+ * created by any other means.
+ *
+ * @param cache cache to query
+ * @param url URL of the file (relative to the cache's root,
+ *        must start with '/'; ".." path segments are refused)
+ * @return NULL if the file does not exist, is not a regular file or
+ *         could not be opened
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_file_cache_lookup (struct MHD_FileCache *cache,
+                       const char *url)
+{
+  struct FileCacheEntry *entry;
+  struct MHD_Response *response;
+  unsigned int hash;
+  time_t now;
+
+  if ( (NULL == cache) ||
+       (NULL == url) ||
+       (MHD_YES != check_url (url)) )
+    return NULL;
+  hash = hash_url (url);
+  if (MHD_YES != MHD_mutex_lock_ (&cache->lock))
+    MHD_PANIC ("Failed to acquire file cache mutex\n");
+  for (entry = cache->buckets[hash % cache->num_buckets];
+       NULL != entry;
+       entry = entry->next_hash)
+    if ( (entry->hash == hash) &&
+         (0 == strcmp (entry->url, url)) )
+      break;
+  if (NULL != entry)
+    {
+      now = MHD_monotonic_sec_counter ();
+      if ( (0 == cache->stat_ttl) ||
+           (now - entry->last_check >= (time_t) cache->stat_ttl) )
+        {
+          if (MHD_YES == revalidate_entry (cache,
+                                           entry))
+            {
+              entry->last_check = now;
+            }
+          else
+            {
+              remove_entry (cache,
+                            entry);
+              entry = NULL;
+            }
+        }
+    }
+  if (NULL == entry)
+    {
+      entry = create_entry (cache,
+                            url,
+                            hash);
+      if (NULL == entry)
+        {
+          if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+            MHD_PANIC ("Failed to release file cache mutex\n");
+          return NULL;
+        }
+      entry->next_hash = cache->buckets[hash % cache->num_buckets];
+      cache->buckets[hash % cache->num_buckets] = entry;
+      DLL_insert (cache->lru_head,
+                  cache->lru_tail,
+                  entry);
+      cache->num_entries++;
+      if (cache->num_entries > cache->max_entries)
+        remove_entry (cache,
+                      cache->lru_tail);
+    }
+  else if (entry != cache->lru_head)
+    {
+      DLL_remove (cache->lru_head,
+                  cache->lru_tail,
+                  entry);
+      DLL_insert (cache->lru_head,
+                  cache->lru_tail,
+                  entry);
+    }
+  response = entry->response;
+  MHD_increment_response_rc (response);
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+    MHD_PANIC ("Failed to release file cache mutex\n");
+  return response;
+}
+
+
+/**
+ * Destroy a file cache.  Responses obtained from the cache stay
+ * valid until the application and MHD are done with them.
+ *
+ * @param cache cache to destroy
+ * @ingroup response
+ */
+void
+MHD_file_cache_destroy (struct MHD_FileCache *cache)
+{
+  if (NULL == cache)
+    return;
+  while (NULL != cache->lru_head)
+    remove_entry (cache,
+                  cache->lru_head);
+  (void) MHD_mutex_destroy_ (&cache->lock);
+  free (cache->buckets);
+  free (cache->root);
+  free (cache);
+}
+
+/* end of filecache.c */
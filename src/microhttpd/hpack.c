@@ -0,0 +1,932 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file hpack.c
+ * @brief HPACK header compression for HTTP/2 (RFC 7541)
+ * @author Christian Grothoff
+ *
+ * The decoder supports everything a client may send.  Huffman coded
+ * strings are decoded with the canonical form of the code, which
+ * only needs the number of codes of each length and the symbols
+ * ordered by code.
+ *
+ * The encoder never uses Huffman coding; it compresses by indexing
+ * the header fields of responses in its dynamic table, so that
+ * fields repeated over the responses of a connection (such as the
+ * content type or the server) are sent as a single byte.
+ */
+
+#include "internal.h"
+#include "hpack.h"
+#include "mhd_str.h"
+
+
+/**
+ * Number of slots in the ring buffer of a dynamic table.
+ */
+#define TABLE_SLOTS (MHD_HPACK_TABLE_SIZE / 32)
+
+/**
+ * Size of an entry in addition to its name and value
+ * (RFC 7541, section 4.1).
+ */
+#define ENTRY_OVERHEAD 32
+
+/**
+ * Number of entries in the static table.
+ */
+#define STATIC_ENTRIES 61
+
+
+/**
+ * Entry in a dynamic table.
+ */
+struct MHD_HpackEntry
+{
+
+  /**
+   * Name of the field, 0-terminated, allocated at the end of this
+   * struct.
+   */
+  char *name;
+
+  /**
+   * Value of the field, 0-terminated, allocated after @e name.
+   */
+  char *value;
+
+  /**
+   * Number of bytes in @e name.
+   */
+  size_t name_len;
+
+  /**
+   * Number of bytes in @e value.
+   */
+  size_t value_len;
+
+};
+
+
+/**
+ * Entry in the static table.
+ */
+struct StaticEntry
+{
+
+  /**
+   * Name of the field.
+   */
+  const char *name;
+
+  /**
+   * Number of bytes in @e name.
+   */
+  size_t name_len;
+
+  /**
+   * Value of the field.
+   */
+  const char *value;
+
+  /**
+   * Number of bytes in @e value.
+   */
+  size_t value_len;
+
+};
+
+
+#define S(n,v) { n, sizeof (n) - 1, v, sizeof (v) - 1 }
+
+/**
+ * The static table (RFC 7541, appendix A), index 1 is at offset 0.
+ */
+static const struct StaticEntry static_table[STATIC_ENTRIES] = {
+  S (":authority", ""),
+  S (":method", "GET"),
+  S (":method", "POST"),
+  S (":path", "/"),
+  S (":path", "/index.html"),
+  S (":scheme", "http"),
+  S (":scheme", "https"),
+  S (":status", "200"),
+  S (":status", "204"),
+  S (":status", "206"),
+  S (":status", "304"),
+  S (":status", "400"),
+  S (":status", "404"),
+  S (":status", "500"),
+  S ("accept-charset", ""),
+  S ("accept-encoding", "gzip, deflate"),
+  S ("accept-language", ""),
+  S ("accept-ranges", ""),
+  S ("accept", ""),
+  S ("access-control-allow-origin", ""),
+  S ("age", ""),
+  S ("allow", ""),
+  S ("authorization", ""),
+  S ("cache-control", ""),
+  S ("content-disposition", ""),
+  S ("content-encoding", ""),
+  S ("content-language", ""),
+  S ("content-length", ""),
+  S ("content-location", ""),
+  S ("content-range", ""),
+  S ("content-type", ""),
+  S ("cookie", ""),
+  S ("date", ""),
+  S ("etag", ""),
+  S ("expect", ""),
+  S ("expires", ""),
+  S ("from", ""),
+  S ("host", ""),
+  S ("if-match", ""),
+  S ("if-modified-since", ""),
+  S ("if-none-match", ""),
+  S ("if-range", ""),
+  S ("if-unmodified-since", ""),
+  S ("last-modified", ""),
+  S ("link", ""),
+  S ("location", ""),
+  S ("max-forwards", ""),
+  S ("proxy-authenticate", ""),
+  S ("proxy-authorization", ""),
+  S ("range", ""),
+  S ("referer", ""),
+  S ("refresh", ""),
+  S ("retry-after", ""),
+  S ("server", ""),
+  S ("set-cookie", ""),
+  S ("strict-transport-security", ""),
+  S ("transfer-encoding", ""),
+  S ("user-agent", ""),
+  S ("vary", ""),
+  S ("via", ""),
+  S ("www-authenticate", "")
+};
+
+#undef S
+
+
+/**
+ * Number of Huffman codes of each length in bits (RFC 7541,
+ * appendix B).
+ */
+static const uint8_t huffman_count[31] = {
+  0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+  0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+/**
+ * Symbols of the Huffman code ordered by their code, 256 is the
+ * end of string symbol.
+ */
+static const uint16_t huffman_symbol[257] = {
+   48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,
+   45,  46,  47,  51,  52,  53,  54,  55,  56,  57,  61,  65,
+   95,  98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+   58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+   77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,
+  106, 107, 113, 118, 119, 120, 121, 122,  38,  42,  44,  59,
+   88,  90,  33,  34,  40,  41,  63,  39,  43, 124,  35,  62,
+    0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+  195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+  167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+  132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+  173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+  233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+  151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+  183, 188, 191, 197, 231, 239,   9, 142, 144, 145, 148, 159,
+  171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+  200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+  255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+  246, 247, 248, 250, 251, 252, 253, 254,   2,   3,   4,   5,
+    6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+   21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220,
+  249,  10,  13,  22, 256
+};
+
+
+/**
+ * Create an entry for a dynamic table.
+ *
+ * @param name name of the field
+ * @param name_len number of bytes in @a name
+ * @param value value of the field
+ * @param value_len number of bytes in @a value
+ * @return NULL on error (out of memory)
+ */
+static struct MHD_HpackEntry *
+entry_create (const char *name,
+              size_t name_len,
+              const char *value,
+              size_t value_len)
+{
+  struct MHD_HpackEntry *e;
+
+  e = malloc (sizeof (struct MHD_HpackEntry) + name_len + value_len + 2);
+  if (NULL == e)
+    return NULL;
+  e->name = (char *) &e[1];
+  e->value = &e->name[name_len + 1];
+  e->name_len = name_len;
+  e->value_len = value_len;
+  memcpy (e->name, name, name_len);
+  e->name[name_len] = '\0';
+  memcpy (e->value, value, value_len);
+  e->value[value_len] = '\0';
+  return e;
+}
+
+
+/**
+ * Evict the oldest entries of a table until its size is at most
+ * @a max_size.
+ *
+ * @param table table to shrink
+ * @param max_size size to shrink the table to
+ */
+static void
+table_evict (struct MHD_HpackTable *table,
+             size_t max_size)
+{
+  struct MHD_HpackEntry *e;
+  unsigned int oldest;
+
+  while ( (table->size > max_size) &&
+          (0 != table->num) )
+    {
+      oldest = (table->head + TABLE_SLOTS - (table->num - 1)) % TABLE_SLOTS;
+      e = table->entries[oldest];
+      table->entries[oldest] = NULL;
+      table->size -= e->name_len + e->value_len + ENTRY_OVERHEAD;
+      table->num--;
+      free (e);
+    }
+}
+
+
+/**
+ * Add an entry to a table, evicting old entries to make room.  An
+ * entry larger than the table empties it and is not added.
+ *
+ * @param table table to add to
+ * @param e entry to add, ownership is transferred
+ */
+static void
+table_insert (struct MHD_HpackTable *table,
+              struct MHD_HpackEntry *e)
+{
+  size_t esize = e->name_len + e->value_len + ENTRY_OVERHEAD;
+
+  if (esize > table->max_size)
+    {
+      table_evict (table, 0);
+      free (e);
+      return;
+    }
+  table_evict (table, table->max_size - esize);
+  table->head = (table->head + 1) % TABLE_SLOTS;
+  table->entries[table->head] = e;
+  table->num++;
+  table->size += esize;
+}
+
+
+/**
+ * Get an entry of the dynamic table.
+ *
+ * @param table the table
+ * @param i position of the entry, 0 for the newest one
+ * @return the entry
+ */
+static struct MHD_HpackEntry *
+table_get (const struct MHD_HpackTable *table,
+           unsigned int i)
+{
+  return table->entries[(table->head + TABLE_SLOTS - i) % TABLE_SLOTS];
+}
+
+
+/**
+ * Lookup a field by its index in the address space of both tables.
+ *
+ * @param table dynamic table
+ * @param index index of the field
+ * @param[out] name set to the name of the field
+ * @param[out] name_len set to the number of bytes in @a name
+ * @param[out] value set to the value of the field
+ * @param[out] value_len set to the number of bytes in @a value
+ * @return #MHD_YES on success, #MHD_NO if @a index is invalid
+ */
+static int
+table_lookup (const struct MHD_HpackTable *table,
+              size_t index,
+              const char **name,
+              size_t *name_len,
+              const char **value,
+              size_t *value_len)
+{
+  const struct MHD_HpackEntry *e;
+
+  if (0 == index)
+    return MHD_NO;
+  if (index <= STATIC_ENTRIES)
+    {
+      *name = static_table[index - 1].name;
+      *name_len = static_table[index - 1].name_len;
+      *value = static_table[index - 1].value;
+      *value_len = static_table[index - 1].value_len;
+      return MHD_YES;
+    }
+  index -= STATIC_ENTRIES + 1;
+  if (index >= table->num)
+    return MHD_NO;
+  e = table_get (table, (unsigned int) index);
+  *name = e->name;
+  *name_len = e->name_len;
+  *value = e->value;
+  *value_len = e->value_len;
+  return MHD_YES;
+}
+
+
+/**
+ * Decode an integer with an N-bit prefix (RFC 7541, section 5.1).
+ *
+ * @param[in,out] pos current position in the header block, advanced
+ * @param end end of the header block
+ * @param prefix number of bits of the prefix
+ * @param[out] value set to the integer
+ * @return #MHD_YES on success, #MHD_NO if the integer is truncated
+ *         or too large
+ */
+static int
+decode_int (const uint8_t **pos,
+            const uint8_t *end,
+            unsigned int prefix,
+            size_t *value)
+{
+  size_t max = (1 << prefix) - 1;
+  size_t v;
+  unsigned int shift;
+  uint8_t b;
+
+  if (*pos >= end)
+    return MHD_NO;
+  v = **pos & max;
+  (*pos)++;
+  if (v < max)
+    {
+      *value = v;
+      return MHD_YES;
+    }
+  shift = 0;
+  do
+    {
+      /* nothing we accept needs more than 28 bits */
+      if ( (*pos >= end) ||
+           (shift > 21) )
+        return MHD_NO;
+      b = **pos;
+      (*pos)++;
+      v += (size_t) (b & 0x7F) << shift;
+      shift += 7;
+    }
+  while (0 != (b & 0x80));
+  *value = v;
+  return MHD_YES;
+}
+
+
+/**
+ * Decode a Huffman coded string.
+ *
+ * @param in the coded string
+ * @param size number of bytes in @a in
+ * @param out where to write the string, must have room for
+ *        @a size * 8 / 5 bytes
+ * @param[out] out_len set to the number of bytes written to @a out
+ * @return #MHD_YES on success, #MHD_NO if the string is malformed
+ */
+static int
+huffman_decode (const uint8_t *in,
+                size_t size,
+                char *out,
+                size_t *out_len)
+{
+  int code;
+  int first;
+  int index;
+  int count;
+  unsigned int len;
+  unsigned int ones;
+  unsigned int bit;
+  size_t n;
+  size_t i;
+  int b;
+
+  code = first = index = 0;
+  len = 0;
+  ones = 1;
+  n = 0;
+  for (i = 0; i < size; i++)
+    for (b = 7; b >= 0; b--)
+      {
+        bit = (in[i] >> b) & 1;
+        code |= bit;
+        ones &= bit;
+        len++;
+        count = huffman_count[len];
+        if (code - count < first)
+          {
+            if (256 == huffman_symbol[index + (code - first)])
+              return MHD_NO; /* EOS must not be encoded */
+            out[n++] = (char) huffman_symbol[index + (code - first)];
+            code = first = index = 0;
+            len = 0;
+            ones = 1;
+            continue;
+          }
+        if (len >= 30)
+          return MHD_NO;
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+      }
+  /* padding must be a prefix of EOS, i.e. less than 8 one bits */
+  if ( (len > 7) ||
+       (! ones) )
+    return MHD_NO;
+  *out_len = n;
+  return MHD_YES;
+}
+
+
+/**
+ * Decode a string literal (RFC 7541, section 5.2).
+ *
+ * @param dec decoder of the connection
+ * @param[in,out] pos current position in the header block, advanced
+ * @param end end of the header block
+ * @param[in,out] buf_off offset of the free space in the buffer of
+ *        @a dec, advanced if the string was Huffman coded
+ * @param[out] str set to the string, which points into the block or
+ *        into the buffer of @a dec
+ * @param[out] str_len set to the number of bytes in @a str
+ * @return #MHD_YES on success, #MHD_NO if the string is malformed
+ */
+static int
+decode_string (struct MHD_HpackDecoder *dec,
+               const uint8_t **pos,
+               const uint8_t *end,
+               size_t *buf_off,
+               const char **str,
+               size_t *str_len)
+{
+  int huffman;
+  size_t len;
+
+  if (*pos >= end)
+    return MHD_NO;
+  huffman = (0 != (**pos & 0x80));
+  if ( (MHD_YES != decode_int (pos, end, 7, &len)) ||
+       (len > (size_t) (end - *pos)) )
+    return MHD_NO;
+  if (! huffman)
+    {
+      *str = (const char *) *pos;
+      *str_len = len;
+      *pos += len;
+      return MHD_YES;
+    }
+  if (MHD_YES != huffman_decode (*pos,
+                                 len,
+                                 &dec->buf[*buf_off],
+                                 str_len))
+    return MHD_NO;
+  *str = &dec->buf[*buf_off];
+  *buf_off += *str_len;
+  *pos += len;
+  return MHD_YES;
+}
+
+
+/**
+ * Initialize a decoder.
+ *
+ * @param dec decoder to initialize
+ */
+void
+MHD_hpack_decoder_init_ (struct MHD_HpackDecoder *dec)
+{
+  memset (dec, 0, sizeof (struct MHD_HpackDecoder));
+  dec->table.max_size = MHD_HPACK_TABLE_SIZE;
+}
+
+
+/**
+ * Release the resources of a decoder.
+ *
+ * @param dec decoder to clean up
+ */
+void
+MHD_hpack_decoder_destroy_ (struct MHD_HpackDecoder *dec)
+{
+  table_evict (&dec->table, 0);
+  free (dec->buf);
+  dec->buf = NULL;
+  dec->buf_size = 0;
+}
+
+
+/**
+ * Decode a complete header block.  The whole block is always
+ * decoded to keep the dynamic table in sync with the peer.
+ *
+ * @param dec decoder of the connection
+ * @param block the header block
+ * @param size number of bytes in @a block
+ * @param cb function to call for each header field, NULL to only
+ *        update the dynamic table
+ * @param cb_cls closure for @a cb
+ * @return #MHD_YES on success, #MHD_NO if the block is malformed or
+ *         on error (out of memory); the connection must be closed
+ *         with a COMPRESSION_ERROR
+ */
+int
+MHD_hpack_decode_ (struct MHD_HpackDecoder *dec,
+                   const uint8_t *block,
+                   size_t size,
+                   MHD_HpackHeaderCallback cb,
+                   void *cb_cls)
+{
+  const uint8_t *pos = block;
+  const uint8_t *end = block + size;
+  struct MHD_HpackEntry *e;
+  const char *name;
+  const char *value;
+  size_t name_len;
+  size_t value_len;
+  size_t index;
+  size_t buf_off;
+  size_t need;
+  char *buf;
+  int fields;
+  int indexing;
+
+  /* all Huffman coded strings of the block together decode to at
+     most 8/5 of the size of the block, as codes have 5 bits or more */
+  need = size / 5 * 8 + 8;
+  if (dec->buf_size < need)
+    {
+      buf = realloc (dec->buf, need);
+      if (NULL == buf)
+        return MHD_NO;
+      dec->buf = buf;
+      dec->buf_size = need;
+    }
+  buf_off = 0;
+  fields = MHD_NO;
+  while (pos < end)
+    {
+      if (0 != (*pos & 0x80))
+        {
+          /* indexed header field */
+          if ( (MHD_YES != decode_int (&pos, end, 7, &index)) ||
+               (MHD_YES != table_lookup (&dec->table,
+                                         index,
+                                         &name, &name_len,
+                                         &value, &value_len)) )
+            return MHD_NO;
+          if (NULL != cb)
+            cb (cb_cls, name, name_len, value, value_len);
+          fields = MHD_YES;
+          continue;
+        }
+      if (0x20 == (*pos & 0xE0))
+        {
+          /* dynamic table size update, only allowed at the start */
+          if ( (MHD_YES == fields) ||
+               (MHD_YES != decode_int (&pos, end, 5, &index)) ||
+               (index > MHD_HPACK_TABLE_SIZE) )
+            return MHD_NO;
+          dec->table.max_size = index;
+          table_evict (&dec->table, index);
+          continue;
+        }
+      /* literal header field, with incremental indexing (01),
+         without indexing (0000) or never indexed (0001) */
+      indexing = (0x40 == (*pos & 0xC0));
+      if (MHD_YES != decode_int (&pos, end, indexing ? 6 : 4, &index))
+        return MHD_NO;
+      if (0 == index)
+        {
+          if (MHD_YES != decode_string (dec, &pos, end, &buf_off,
+                                        &name, &name_len))
+            return MHD_NO;
+        }
+      else if (MHD_YES != table_lookup (&dec->table,
+                                        index,
+                                        &name, &name_len,
+                                        &value, &value_len))
+        return MHD_NO;
+      if (MHD_YES != decode_string (dec, &pos, end, &buf_off,
+                                    &value, &value_len))
+        return MHD_NO;
+      if (NULL != cb)
+        cb (cb_cls, name, name_len, value, value_len);
+      fields = MHD_YES;
+      if (! indexing)
+        continue;
+      /* copy before inserting, @a name may be evicted */
+      e = entry_create (name, name_len, value, value_len);
+      if (NULL == e)
+        return MHD_NO;
+      table_insert (&dec->table, e);
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Encode an integer with an N-bit prefix (RFC 7541, section 5.1).
+ *
+ * @param out where to write the integer
+ * @param flags bits of the first byte above the prefix
+ * @param prefix number of bits of the prefix
+ * @param value integer to encode
+ * @return number of bytes written to @a out
+ */
+static size_t
+encode_int (uint8_t *out,
+            uint8_t flags,
+            unsigned int prefix,
+            size_t value)
+{
+  size_t max = (1 << prefix) - 1;
+  size_t n;
+
+  if (value < max)
+    {
+      out[0] = flags | (uint8_t) value;
+      return 1;
+    }
+  out[0] = flags | (uint8_t) max;
+  value -= max;
+  n = 1;
+  while (value >= 0x80)
+    {
+      out[n++] = (uint8_t) (0x80 | (value & 0x7F));
+      value >>= 7;
+    }
+  out[n++] = (uint8_t) value;
+  return n;
+}
+
+
+/**
+ * Encode a string literal without Huffman coding, optionally
+ * converting it to lower case.
+ *
+ * @param out where to write the string
+ * @param str string to encode
+ * @param len number of bytes in @a str
+ * @param lower #MHD_YES to convert @a str to lower case
+ * @return number of bytes written to @a out
+ */
+static size_t
+encode_string (uint8_t *out,
+               const char *str,
+               size_t len,
+               int lower)
+{
+  size_t n;
+  size_t i;
+
+  n = encode_int (out, 0x00, 7, len);
+  if (! lower)
+    {
+      memcpy (&out[n], str, len);
+      return n + len;
+    }
+  for (i = 0; i < len; i++)
+    out[n + i] = (uint8_t) ( ( (str[i] >= 'A') && (str[i] <= 'Z') )
+                             ? str[i] - 'A' + 'a' : str[i]);
+  return n + len;
+}
+
+
+/**
+ * Initialize an encoder.
+ *
+ * @param enc encoder to initialize
+ */
+void
+MHD_hpack_encoder_init_ (struct MHD_HpackEncoder *enc)
+{
+  memset (enc, 0, sizeof (struct MHD_HpackEncoder));
+  enc->table.max_size = MHD_HPACK_TABLE_SIZE;
+}
+
+
+/**
+ * Release the resources of an encoder.
+ *
+ * @param enc encoder to clean up
+ */
+void
+MHD_hpack_encoder_destroy_ (struct MHD_HpackEncoder *enc)
+{
+  table_evict (&enc->table, 0);
+}
+
+
+/**
+ * Change the size of the dynamic table of an encoder after the peer
+ * changed the setting for it.
+ *
+ * @param enc encoder to update
+ * @param max_size size allowed by the peer
+ */
+void
+MHD_hpack_encoder_set_max_size_ (struct MHD_HpackEncoder *enc,
+                                 size_t max_size)
+{
+  if (max_size > MHD_HPACK_TABLE_SIZE)
+    max_size = MHD_HPACK_TABLE_SIZE;
+  if (max_size == enc->table.max_size)
+    return;
+  if ( (MHD_NO == enc->size_update) ||
+       (max_size < enc->min_size) )
+    enc->min_size = MHD_MIN (max_size, enc->table.max_size);
+  enc->size_update = MHD_YES;
+  enc->table.max_size = max_size;
+  table_evict (&enc->table, max_size);
+}
+
+
+/**
+ * Start a header block, encoding the ":status" pseudo header (and
+ * an update of the size of the dynamic table, if pending).
+ *
+ * @param enc encoder of the connection
+ * @param status status code of the response, 0 to not encode a
+ *        status (for a block of trailers)
+ * @param out where to write the encoded field, must have room
+ *        for #MHD_HPACK_MAX_ENCODED(7,3) bytes
+ * @return number of bytes written to @a out
+ */
+size_t
+MHD_hpack_encode_status_ (struct MHD_HpackEncoder *enc,
+                          unsigned int status,
+                          uint8_t *out)
+{
+  size_t n;
+  unsigned int i;
+  char digits[3];
+
+  n = 0;
+  if (MHD_YES == enc->size_update)
+    {
+      if (enc->min_size < enc->table.max_size)
+        n += encode_int (&out[n], 0x20, 5, enc->min_size);
+      n += encode_int (&out[n], 0x20, 5, enc->table.max_size);
+      enc->size_update = MHD_NO;
+    }
+  if (0 == status)
+    return n;
+  digits[0] = (char) ('0' + (status / 100) % 10);
+  digits[1] = (char) ('0' + (status / 10) % 10);
+  digits[2] = (char) ('0' + status % 10);
+  /* the static table has the most common codes at 8 to 14 */
+  for (i = 8; i <= 14; i++)
+    if (0 == memcmp (static_table[i - 1].value, digits, 3))
+      {
+        out[n++] = (uint8_t) (0x80 | i);
+        return n;
+      }
+  n += encode_int (&out[n], 0x00, 4, 8);
+  n += encode_string (&out[n], digits, 3, MHD_NO);
+  return n;
+}
+
+
+/**
+ * Should a field with this name be added to the dynamic table?  We
+ * do not index fields that change with every response, and never
+ * index cookies (RFC 7541, section 7.1.3).
+ *
+ * @param name name of the field
+ * @return 0x40 to index the field, 0x00 to not index it, 0x10 to
+ *         tell intermediaries to never index it
+ */
+static uint8_t
+indexing_for (const char *name)
+{
+  if (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_SET_COOKIE))
+    return 0x10;
+  if ( (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_CONTENT_LENGTH)) ||
+       (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_DATE)) ||
+       (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_ETAG)) ||
+       (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_LAST_MODIFIED)) ||
+       (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_LOCATION)) )
+    return 0x00;
+  return 0x40;
+}
+
+
+/**
+ * Encode a header field.  The name is converted to lower case.
+ *
+ * @param enc encoder of the connection
+ * @param name name of the field
+ * @param value value of the field
+ * @param out where to write the encoded field, must have room
+ *        for #MHD_HPACK_MAX_ENCODED() bytes
+ * @return number of bytes written to @a out
+ */
+size_t
+MHD_hpack_encode_header_ (struct MHD_HpackEncoder *enc,
+                          const char *name,
+                          const char *value,
+                          uint8_t *out)
+{
+  struct MHD_HpackTable *table = &enc->table;
+  struct MHD_HpackEntry *e;
+  size_t name_len = strlen (name);
+  size_t value_len = strlen (value);
+  size_t name_index;
+  size_t n;
+  unsigned int i;
+  uint8_t flags;
+
+  /* the whole field may be in the dynamic table */
+  name_index = 0;
+  for (i = 0; i < table->num; i++)
+    {
+      e = table_get (table, i);
+      if ( (e->name_len != name_len) ||
+           (! MHD_str_equal_caseless_n_ (e->name, name, name_len)) )
+        continue;
+      if ( (e->value_len == value_len) &&
+           (0 == memcmp (e->value, value, value_len)) )
+        return encode_int (out, 0x80, 7, STATIC_ENTRIES + 1 + i);
+      if (0 == name_index)
+        name_index = STATIC_ENTRIES + 1 + i;
+    }
+  /* prefer the name from the static table, it is never evicted */
+  for (i = 0; i < STATIC_ENTRIES; i++)
+    if ( (static_table[i].name_len == name_len) &&
+         (MHD_str_equal_caseless_n_ (static_table[i].name, name, name_len)) )
+      {
+        name_index = i + 1;
+        break;
+      }
+  flags = indexing_for (name);
+  e = NULL;
+  if (0x40 == flags)
+    {
+      if (name_len + value_len + ENTRY_OVERHEAD <= table->max_size / 2)
+        e = entry_create (name, name_len, value, value_len);
+      /* without the entry, the peer must not index it either */
+      if (NULL == e)
+        flags = 0x00;
+    }
+  if (0x40 == flags)
+    n = encode_int (out, flags, 6, name_index);
+  else
+    n = encode_int (out, flags, 4, name_index);
+  if (0 == name_index)
+    n += encode_string (&out[n], name, name_len, MHD_YES);
+  n += encode_string (&out[n], value, value_len, MHD_NO);
+  if (NULL != e)
+    {
+      for (i = 0; i < name_len; i++)
+        if ( (e->name[i] >= 'A') && (e->name[i] <= 'Z') )
+          e->name[i] = e->name[i] - 'A' + 'a';
+      table_insert (table, e);
+    }
+  return n;
+}
+
+/* end of hpack.c */
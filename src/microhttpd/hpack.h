@@ -0,0 +1,257 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file hpack.h
+ * @brief  HPACK header compression for HTTP/2 (RFC 7541)
+ * @author Christian Grothoff
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include "platform.h"
+
+
+/**
+ * Size of the dynamic table (RFC 7541, section 4.2) that we use for
+ * decoding and at most use for encoding.  This is the default of
+ * HTTP/2, so it never needs to be negotiated.
+ */
+#define MHD_HPACK_TABLE_SIZE 4096
+
+/**
+ * Upper bound on the number of bytes #MHD_hpack_encode_header_()
+ * writes for a header with a name of @a n and a value of @a v bytes.
+ */
+#define MHD_HPACK_MAX_ENCODED(n,v) ((n) + (v) + 16)
+
+
+/**
+ * Entry in a dynamic table.
+ */
+struct MHD_HpackEntry;
+
+
+/**
+ * Dynamic table of a decoder or an encoder.
+ */
+struct MHD_HpackTable
+{
+
+  /**
+   * Ring buffer of the entries, each entry takes at least 32 bytes
+   * of the table size.
+   */
+  struct MHD_HpackEntry *entries[MHD_HPACK_TABLE_SIZE / 32];
+
+  /**
+   * Position of the newest entry in @e entries.
+   */
+  unsigned int head;
+
+  /**
+   * Number of entries in the table.
+   */
+  unsigned int num;
+
+  /**
+   * Size of the table as defined by RFC 7541, section 4.1.
+   */
+  size_t size;
+
+  /**
+   * Maximum size of the table.
+   */
+  size_t max_size;
+
+};
+
+
+/**
+ * State for decoding the header blocks of a connection.
+ */
+struct MHD_HpackDecoder
+{
+
+  /**
+   * Dynamic table.
+   */
+  struct MHD_HpackTable table;
+
+  /**
+   * Buffer for Huffman decoded strings.
+   */
+  char *buf;
+
+  /**
+   * Number of bytes allocated for @e buf.
+   */
+  size_t buf_size;
+
+};
+
+
+/**
+ * State for encoding the header blocks of a connection.
+ */
+struct MHD_HpackEncoder
+{
+
+  /**
+   * Dynamic table.
+   */
+  struct MHD_HpackTable table;
+
+  /**
+   * Smallest size the dynamic table had since the last header
+   * block, to be signalled before the current size.
+   */
+  size_t min_size;
+
+  /**
+   * #MHD_YES if the next header block must start with an update of
+   * the size of the dynamic table.
+   */
+  int size_update;
+
+};
+
+
+/**
+ * Function called for each header field of a header block.
+ *
+ * @param cls closure
+ * @param name name of the field, not 0-terminated
+ * @param name_len number of bytes in @a name
+ * @param value value of the field, not 0-terminated
+ * @param value_len number of bytes in @a value
+ */
+typedef void
+(*MHD_HpackHeaderCallback)(void *cls,
+                           const char *name,
+                           size_t name_len,
+                           const char *value,
+                           size_t value_len);
+
+
+/**
+ * Initialize a decoder.
+ *
+ * @param dec decoder to initialize
+ */
+void
+MHD_hpack_decoder_init_ (struct MHD_HpackDecoder *dec);
+
+
+/**
+ * Release the resources of a decoder.
+ *
+ * @param dec decoder to clean up
+ */
+void
+MHD_hpack_decoder_destroy_ (struct MHD_HpackDecoder *dec);
+
+
+/**
+ * Decode a complete header block.  The whole block is always
+ * decoded to keep the dynamic table in sync with the peer.
+ *
+ * @param dec decoder of the connection
+ * @param block the header block
+ * @param size number of bytes in @a block
+ * @param cb function to call for each header field, NULL to only
+ *        update the dynamic table
+ * @param cb_cls closure for @a cb
+ * @return #MHD_YES on success, #MHD_NO if the block is malformed or
+ *         on error (out of memory); the connection must be closed
+ *         with a COMPRESSION_ERROR
+ */
+int
+MHD_hpack_decode_ (struct MHD_HpackDecoder *dec,
+                   const uint8_t *block,
+                   size_t size,
+                   MHD_HpackHeaderCallback cb,
+                   void *cb_cls);
+
+
+/**
+ * Initialize an encoder.
+ *
+ * @param enc encoder to initialize
+ */
+void
+MHD_hpack_encoder_init_ (struct MHD_HpackEncoder *enc);
+
+
+/**
+ * Release the resources of an encoder.
+ *
+ * @param enc encoder to clean up
+ */
+void
+MHD_hpack_encoder_destroy_ (struct MHD_HpackEncoder *enc);
+
+
+/**
+ * Change the size of the dynamic table of an encoder after the peer
+ * changed the setting for it.
+ *
+ * @param enc encoder to update
+ * @param max_size size allowed by the peer
+ */
+void
+MHD_hpack_encoder_set_max_size_ (struct MHD_HpackEncoder *enc,
+                                 size_t max_size);
+
+
+/**
+ * Start a header block, encoding the ":status" pseudo header (and
+ * an update of the size of the dynamic table, if pending).
+ *
+ * @param enc encoder of the connection
+ * @param status status code of the response, 0 to not encode a
+ *        status (for a block of trailers)
+ * @param out where to write the encoded field, must have room
+ *        for #MHD_HPACK_MAX_ENCODED(7,3) bytes
+ * @return number of bytes written to @a out
+ */
+size_t
+MHD_hpack_encode_status_ (struct MHD_HpackEncoder *enc,
+                          unsigned int status,
+                          uint8_t *out);
+
+
+/**
+ * Encode a header field.  The name is converted to lower case.
+ *
+ * @param enc encoder of the connection
+ * @param name name of the field
+ * @param value value of the field
+ * @param out where to write the encoded field, must have room
+ *        for #MHD_HPACK_MAX_ENCODED() bytes
+ * @return number of bytes written to @a out
+ */
+size_t
+MHD_hpack_encode_header_ (struct MHD_HpackEncoder *enc,
+                          const char *name,
+                          const char *value,
+                          uint8_t *out);
+
+#endif
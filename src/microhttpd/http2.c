@@ -0,0 +1,3182 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file http2.c
+ * @brief HTTP/2 (RFC 7540) handled in the event loop of the daemon
+ * @author Christian Grothoff
+ *
+ * Once a connection speaks HTTP/2, its memory pool is released and
+ * it gets a read and a write buffer that each hold a few frames of
+ * the maximum size; the handlers of the connection are replaced by
+ * the ones in this file.
+ *
+ * Every stream gets a connection of its own that is passed to the
+ * application: it shares the socket (and TLS session) of the real
+ * connection, but has its own memory pool for the headers and
+ * arguments of the request and goes through the same states as an
+ * HTTP/1.x connection, so that the application (and post
+ * processors, authentication, ...) cannot tell the difference.
+ *
+ * Request bodies are passed to the application straight out of the
+ * read buffer, only what the application does not consume is copied
+ * aside; flow control makes sure that this is bounded.  Responses
+ * are written round-robin, one frame per stream at a time, directly
+ * into the write buffer: content readers produce the payload of a
+ * DATA frame in place, so that the data of all streams goes to the
+ * OS with a single system call.
+ *
+ * Server push and priorities are not supported.
+ */
+
+#include "internal.h"
+#include "connection.h"
+#include "hpack.h"
+#include "http2.h"
+#include "memorypool.h"
+#include "mhd_mono_clock.h"
+#include "mhd_str.h"
+#include "router.h"
+#if HTTPS_SUPPORT
+#include "tls.h"
+#endif
+
+#if HAVE_NETINET_TCP_H
+/* for TCP_NODELAY */
+#include <netinet/tcp.h>
+#endif
+
+
+/**
+ * Size of the header of a frame.
+ */
+#define FRAME_HEADER_SIZE 9
+
+/**
+ * Maximum size of the payload of a frame we accept and send (the
+ * default of HTTP/2, which therefore never needs to be negotiated).
+ */
+#define MAX_FRAME_SIZE 16384
+
+/**
+ * Size of the read and of the write buffer of a connection.
+ */
+#define BUFFER_SIZE (2 * (FRAME_HEADER_SIZE + MAX_FRAME_SIZE))
+
+/**
+ * Space we keep free in the write buffer while parsing frames, for
+ * the control frames sent in reply to a single frame.
+ */
+#define CONTROL_RESERVE 64
+
+/**
+ * Initial size of the flow control windows (RFC 7540, section 6.9.2).
+ */
+#define DEFAULT_WINDOW 65535
+
+/**
+ * Size of the window for receiving data on the whole connection;
+ * the windows of the streams limit the buffering anyway.
+ */
+#define CONNECTION_WINDOW (1024 * 1024)
+
+/**
+ * Largest valid size of a flow control window.
+ */
+#define MAX_WINDOW 0x7FFFFFFF
+
+/**
+ * Client connection preface (RFC 7540, section 3.5).
+ */
+#define CLIENT_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+/**
+ * Length of #CLIENT_PREFACE.
+ */
+#define CLIENT_PREFACE_SIZE 24
+
+/**
+ * Response to a request to upgrade to HTTP/2 via "h2c".
+ */
+#define SWITCHING_PROTOCOLS "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n"
+
+
+/**
+ * Frame types (RFC 7540, section 6).
+ */
+enum FrameType
+{
+  FRAME_DATA = 0,
+  FRAME_HEADERS = 1,
+  FRAME_PRIORITY = 2,
+  FRAME_RST_STREAM = 3,
+  FRAME_SETTINGS = 4,
+  FRAME_PUSH_PROMISE = 5,
+  FRAME_PING = 6,
+  FRAME_GOAWAY = 7,
+  FRAME_WINDOW_UPDATE = 8,
+  FRAME_CONTINUATION = 9
+};
+
+
+/**
+ * Frame flags.
+ */
+#define FLAG_END_STREAM 0x01
+#define FLAG_ACK 0x01
+#define FLAG_END_HEADERS 0x04
+#define FLAG_PADDED 0x08
+#define FLAG_PRIORITY 0x20
+
+
+/**
+ * Settings (RFC 7540, section 6.5.2).
+ */
+#define SETTINGS_HEADER_TABLE_SIZE 1
+#define SETTINGS_ENABLE_PUSH 2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 3
+#define SETTINGS_INITIAL_WINDOW_SIZE 4
+#define SETTINGS_MAX_FRAME_SIZE 5
+#define SETTINGS_MAX_HEADER_LIST_SIZE 6
+
+
+/**
+ * Error codes (RFC 7540, section 7).
+ */
+enum ErrorCode
+{
+  ERROR_NO_ERROR = 0,
+  ERROR_PROTOCOL = 1,
+  ERROR_INTERNAL = 2,
+  ERROR_FLOW_CONTROL = 3,
+  ERROR_STREAM_CLOSED = 5,
+  ERROR_FRAME_SIZE = 6,
+  ERROR_REFUSED_STREAM = 7,
+  ERROR_CANCEL = 8,
+  ERROR_COMPRESSION = 9,
+  ERROR_ENHANCE_YOUR_CALM = 11
+};
+
+
+/**
+ * A stream (request) of an HTTP/2 connection.
+ */
+struct MHD_Http2Stream
+{
+
+  /**
+   * Streams of a session are kept in a DLL, which is also the order
+   * in which they get to send.
+   */
+  struct MHD_Http2Stream *next;
+
+  /**
+   * Streams of a session are kept in a DLL.
+   */
+  struct MHD_Http2Stream *prev;
+
+  /**
+   * Session the stream belongs to.
+   */
+  struct MHD_Http2Session *session;
+
+  /**
+   * Connection representing the request to the application.
+   */
+  struct MHD_Connection request;
+
+  /**
+   * Data of the request body that the application did not consume
+   * yet.
+   */
+  char *body;
+
+  /**
+   * Number of bytes in @e body.
+   */
+  size_t body_size;
+
+  /**
+   * Number of bytes allocated for @e body.
+   */
+  size_t body_alloc;
+
+  /**
+   * Value of the "content-length" header of the request,
+   * #MHD_SIZE_UNKNOWN if it has none.
+   */
+  uint64_t content_length;
+
+  /**
+   * Number of bytes of the request body received so far.
+   */
+  uint64_t received;
+
+  /**
+   * Number of bytes we may send on the stream.
+   */
+  int64_t send_window;
+
+  /**
+   * Number of bytes the client may send on the stream.
+   */
+  int64_t recv_window;
+
+  /**
+   * Number of bytes consumed since we last extended @e recv_window.
+   */
+  uint32_t recv_consumed;
+
+  /**
+   * Identifier of the stream.
+   */
+  uint32_t id;
+
+  /**
+   * Reason to give to the application once the stream is done.
+   */
+  enum MHD_RequestTerminationCode toe;
+
+  /**
+   * #MHD_YES if the client finished sending the request.
+   */
+  int remote_closed;
+
+  /**
+   * #MHD_YES if the stream is done (response sent or stream reset)
+   * and is to be destroyed.
+   */
+  int done;
+
+  /**
+   * #MHD_YES if a RST_STREAM was sent or received for the stream.
+   */
+  int reset;
+
+  /**
+   * #MHD_YES if the content reader of the response had no data the
+   * last time we asked.
+   */
+  int waiting;
+
+};
+
+
+/**
+ * State of an HTTP/2 connection.
+ */
+struct MHD_Http2Session
+{
+
+  /**
+   * Sessions with streams resumed from outside of the event loop
+   * are kept in a DLL of the daemon.
+   */
+  struct MHD_Http2Session *next;
+
+  /**
+   * Sessions with resumed streams are kept in a DLL of the daemon.
+   */
+  struct MHD_Http2Session *prev;
+
+  /**
+   * Connection of the session.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * Head of DLL of the open streams.
+   */
+  struct MHD_Http2Stream *streams_head;
+
+  /**
+   * Tail of DLL of the open streams.
+   */
+  struct MHD_Http2Stream *streams_tail;
+
+  /**
+   * Decoder for the header blocks of the client.
+   */
+  struct MHD_HpackDecoder decoder;
+
+  /**
+   * Encoder for the header blocks of our responses.
+   */
+  struct MHD_HpackEncoder encoder;
+
+  /**
+   * Header block received in a HEADERS frame followed by
+   * CONTINUATION frames, collected until it is complete.
+   */
+  uint8_t *in_block;
+
+  /**
+   * Number of bytes in @e in_block.
+   */
+  size_t in_block_size;
+
+  /**
+   * Number of bytes allocated for @e in_block.
+   */
+  size_t in_block_alloc;
+
+  /**
+   * Stream of the header block being received, 0 if none.
+   */
+  uint32_t in_stream;
+
+  /**
+   * Flags of the HEADERS frame that started @e in_block.
+   */
+  uint8_t in_flags;
+
+  /**
+   * Header block being sent; its frames may not be interleaved with
+   * any other frames.
+   */
+  uint8_t *out_block;
+
+  /**
+   * Number of bytes in @e out_block.
+   */
+  size_t out_block_size;
+
+  /**
+   * Number of bytes of @e out_block already put into frames.
+   */
+  size_t out_block_offset;
+
+  /**
+   * Stream of @e out_block.
+   */
+  uint32_t out_stream;
+
+  /**
+   * #FLAG_END_STREAM if the HEADERS frame of @e out_block ends the
+   * stream, 0 otherwise.
+   */
+  uint8_t out_flags;
+
+  /**
+   * Number of bytes we may send on the connection.
+   */
+  int64_t send_window;
+
+  /**
+   * Number of bytes the client may send on the connection.
+   */
+  int64_t recv_window;
+
+  /**
+   * Number of bytes received since we last extended @e recv_window.
+   */
+  uint32_t recv_consumed;
+
+  /**
+   * Initial size of the windows of the streams for sending, as set
+   * by the client.
+   */
+  uint32_t peer_initial_window;
+
+  /**
+   * Largest payload of a frame we send.
+   */
+  uint32_t peer_max_frame;
+
+  /**
+   * Highest identifier of a stream opened by the client.
+   */
+  uint32_t last_stream_id;
+
+  /**
+   * Number of streams in the DLL.
+   */
+  unsigned int num_streams;
+
+  /**
+   * Maximum size of the header list of a request.
+   */
+  size_t max_header_list;
+
+  /**
+   * #MHD_YES once the client connection preface was received.
+   */
+  int preface_received;
+
+  /**
+   * #MHD_YES once the SETTINGS frame of the client preface was
+   * received.
+   */
+  int settings_received;
+
+  /**
+   * #MHD_YES once we sent a GOAWAY frame.
+   */
+  int goaway_sent;
+
+  /**
+   * #MHD_YES once the client sent a GOAWAY frame.
+   */
+  int goaway_received;
+
+  /**
+   * #MHD_YES if the connection failed and is to be closed once the
+   * GOAWAY frame was sent.
+   */
+  int failed;
+
+  /**
+   * #MHD_YES if one of the streams was resumed (protected by the
+   * daemon's `cleanup_connection_mutex`).
+   */
+  int resumed;
+
+  /**
+   * #MHD_YES if the session is in the wakeup DLL of the daemon
+   * (protected by the daemon's `cleanup_connection_mutex`).
+   */
+  int in_wakeup;
+
+  /**
+   * #MHD_YES if we suspended the connection to wait for suspended
+   * streams before closing it (protected by the daemon's
+   * `cleanup_connection_mutex`).
+   */
+  int suspended;
+
+};
+
+
+/**
+ * State for collecting the header fields of a header block.
+ */
+struct HeaderContext
+{
+
+  /**
+   * Stream the header block is for.
+   */
+  struct MHD_Http2Stream *stream;
+
+  /**
+   * Value of the ":method" pseudo header.
+   */
+  char *method;
+
+  /**
+   * Value of the ":path" pseudo header.
+   */
+  char *path;
+
+  /**
+   * Value of the ":scheme" pseudo header.
+   */
+  char *scheme;
+
+  /**
+   * Value of the ":authority" pseudo header.
+   */
+  char *authority;
+
+  /**
+   * Cookie header fields, joined (RFC 7540, section 8.1.2.5).
+   */
+  char *cookie;
+
+  /**
+   * Size of the header list (RFC 7540, section 6.5.2).
+   */
+  size_t list_size;
+
+  /**
+   * #MHD_YES if the block has trailers rather than the headers of
+   * the request.
+   */
+  int trailers;
+
+  /**
+   * #MHD_YES once a regular header field was seen.
+   */
+  int regular;
+
+  /**
+   * #MHD_YES if the block is malformed.
+   */
+  int malformed;
+
+  /**
+   * #MHD_YES if the header list did not fit the limits.
+   */
+  int too_large;
+
+};
+
+
+/**
+ * Read a 32-bit number in network byte order.
+ *
+ * @param p where to read
+ * @return the number
+ */
+static uint32_t
+get32 (const uint8_t *p)
+{
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+    ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+
+/**
+ * Write a 32-bit number in network byte order.
+ *
+ * @param p where to write
+ * @param v the number
+ */
+static void
+put32 (uint8_t *p,
+       uint32_t v)
+{
+  p[0] = (uint8_t) (v >> 24);
+  p[1] = (uint8_t) (v >> 16);
+  p[2] = (uint8_t) (v >> 8);
+  p[3] = (uint8_t) v;
+}
+
+
+/**
+ * Get the space at the end of the write buffer, moving the data not
+ * yet sent to the start of the buffer if less than a full frame
+ * fits.
+ *
+ * @param connection connection of the session
+ * @return number of bytes that can be appended
+ */
+static size_t
+write_space (struct MHD_Connection *connection)
+{
+  size_t pending;
+
+  if (connection->write_buffer_send_offset ==
+      connection->write_buffer_append_offset)
+    {
+      connection->write_buffer_send_offset = 0;
+      connection->write_buffer_append_offset = 0;
+    }
+  else if ( (0 != connection->write_buffer_send_offset) &&
+            (connection->write_buffer_size -
+             connection->write_buffer_append_offset <
+             FRAME_HEADER_SIZE + MAX_FRAME_SIZE) )
+    {
+      pending = connection->write_buffer_append_offset -
+        connection->write_buffer_send_offset;
+      memmove (connection->write_buffer,
+               &connection->write_buffer[connection->write_buffer_send_offset],
+               pending);
+      connection->write_buffer_send_offset = 0;
+      connection->write_buffer_append_offset = pending;
+    }
+  return connection->write_buffer_size -
+    connection->write_buffer_append_offset;
+}
+
+
+/**
+ * Append a frame to the write buffer.  The caller must have made
+ * sure that it fits.
+ *
+ * @param session session to send the frame on
+ * @param size size of the payload
+ * @param type type of the frame
+ * @param flags flags of the frame
+ * @param id stream of the frame, 0 for the connection
+ * @return where to put the payload
+ */
+static uint8_t *
+frame_append (struct MHD_Http2Session *session,
+              size_t size,
+              enum FrameType type,
+              uint8_t flags,
+              uint32_t id)
+{
+  struct MHD_Connection *connection = session->connection;
+  uint8_t *hdr;
+
+  hdr = (uint8_t *) &connection->write_buffer
+    [connection->write_buffer_append_offset];
+  hdr[0] = (uint8_t) (size >> 16);
+  hdr[1] = (uint8_t) (size >> 8);
+  hdr[2] = (uint8_t) size;
+  hdr[3] = (uint8_t) type;
+  hdr[4] = flags;
+  put32 (&hdr[5], id);
+  connection->write_buffer_append_offset += FRAME_HEADER_SIZE + size;
+  return &hdr[FRAME_HEADER_SIZE];
+}
+
+
+/**
+ * Send a control frame.
+ *
+ * @param session session to send the frame on
+ * @param type type of the frame
+ * @param flags flags of the frame
+ * @param id stream of the frame, 0 for the connection
+ * @param payload payload of the frame
+ * @param size number of bytes in @a payload
+ */
+static void
+send_control (struct MHD_Http2Session *session,
+              enum FrameType type,
+              uint8_t flags,
+              uint32_t id,
+              const uint8_t *payload,
+              size_t size)
+{
+  if (write_space (session->connection) < FRAME_HEADER_SIZE + size)
+    {
+      /* cannot happen with the space we reserve, but be safe */
+      session->failed = MHD_YES;
+      return;
+    }
+  if (0 != size)
+    memcpy (frame_append (session, size, type, flags, id),
+            payload,
+            size);
+  else
+    (void) frame_append (session, 0, type, flags, id);
+}
+
+
+/**
+ * Send a frame with a 32-bit number as payload.
+ *
+ * @param session session to send the frame on
+ * @param type #FRAME_RST_STREAM or #FRAME_WINDOW_UPDATE
+ * @param id stream of the frame, 0 for the connection
+ * @param value the number
+ */
+static void
+send_u32 (struct MHD_Http2Session *session,
+          enum FrameType type,
+          uint32_t id,
+          uint32_t value)
+{
+  uint8_t payload[4];
+
+  put32 (payload, value);
+  send_control (session, type, 0, id, payload, sizeof (payload));
+}
+
+
+/**
+ * Fail the connection: tell the client why and close it once that
+ * was sent.
+ *
+ * @param session session that failed
+ * @param error error code for the client
+ */
+static void
+session_fail (struct MHD_Http2Session *session,
+              enum ErrorCode error)
+{
+  uint8_t payload[8];
+
+  if (MHD_YES == session->goaway_sent)
+    {
+      session->failed = MHD_YES;
+      return;
+    }
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (session->connection->daemon,
+            "HTTP/2 connection error %u, closing connection\n",
+            (unsigned int) error);
+#endif
+  put32 (payload, session->last_stream_id);
+  put32 (&payload[4], error);
+  send_control (session, FRAME_GOAWAY, 0, 0, payload, sizeof (payload));
+  session->goaway_sent = MHD_YES;
+  session->failed = MHD_YES;
+}
+
+
+/**
+ * Reset a stream.
+ *
+ * @param stream stream to reset
+ * @param error error code for the client
+ */
+static void
+stream_reset (struct MHD_Http2Stream *stream,
+              enum ErrorCode error)
+{
+  if (MHD_YES == stream->reset)
+    return;
+  send_u32 (stream->session, FRAME_RST_STREAM, stream->id, error);
+  stream->reset = MHD_YES;
+  stream->remote_closed = MHD_YES;
+  if (MHD_NO == stream->done)
+    {
+      stream->done = MHD_YES;
+      stream->toe = MHD_REQUEST_TERMINATED_WITH_ERROR;
+    }
+}
+
+
+/**
+ * Give the client credit for data of a stream that was consumed.
+ *
+ * @param stream stream the data was received on
+ * @param size number of bytes consumed
+ */
+static void
+stream_consumed (struct MHD_Http2Stream *stream,
+                 size_t size)
+{
+  stream->recv_consumed += size;
+  if ( (MHD_YES == stream->remote_closed) ||
+       (stream->recv_consumed < DEFAULT_WINDOW / 2) )
+    return;
+  send_u32 (stream->session,
+            FRAME_WINDOW_UPDATE,
+            stream->id,
+            stream->recv_consumed);
+  stream->recv_window += stream->recv_consumed;
+  stream->recv_consumed = 0;
+}
+
+
+/**
+ * Find an open stream.
+ *
+ * @param session session to search
+ * @param id identifier of the stream
+ * @return NULL if the stream is not open
+ */
+static struct MHD_Http2Stream *
+stream_find (struct MHD_Http2Session *session,
+             uint32_t id)
+{
+  struct MHD_Http2Stream *stream;
+
+  for (stream = session->streams_head; NULL != stream; stream = stream->next)
+    if (id == stream->id)
+      return (MHD_YES == stream->done) ? NULL : stream;
+  return NULL;
+}
+
+
+/**
+ * Create a stream and the connection representing its request.
+ *
+ * @param session session of the stream
+ * @param id identifier of the stream
+ * @return NULL on error (out of memory)
+ */
+static struct MHD_Http2Stream *
+stream_create (struct MHD_Http2Session *session,
+               uint32_t id)
+{
+  struct MHD_Connection *connection = session->connection;
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_Http2Stream *stream;
+  struct MHD_Connection *sc;
+
+  stream = malloc (sizeof (struct MHD_Http2Stream));
+  if (NULL == stream)
+    return NULL;
+  memset (stream, 0, sizeof (struct MHD_Http2Stream));
+  sc = &stream->request;
+  sc->pool = MHD_pool_create (daemon->pool_size / 2);
+  if (NULL == sc->pool)
+    {
+      free (stream);
+      return NULL;
+    }
+  sc->daemon = daemon;
+  sc->addr = connection->addr;
+  sc->addr_len = connection->addr_len;
+  sc->socket_fd = connection->socket_fd;
+  sc->socket_context = connection->socket_context;
+#if HTTPS_SUPPORT
+  sc->tls_session = connection->tls_session;
+#endif
+  sc->version = MHD_HTTP_VERSION_2_0;
+  sc->state = MHD_CONNECTION_INIT;
+  sc->last_activity = connection->last_activity;
+  /* the stream is only processed by the code in this file */
+  sc->in_idle = MHD_YES;
+  sc->h2_stream = stream;
+  stream->session = session;
+  stream->id = id;
+  stream->content_length = MHD_SIZE_UNKNOWN;
+  stream->send_window = session->peer_initial_window;
+  stream->recv_window = DEFAULT_WINDOW;
+  DLL_insert (session->streams_head,
+              session->streams_tail,
+              stream);
+  session->num_streams++;
+  return stream;
+}
+
+
+/**
+ * Destroy a stream, notifying the application that the request is
+ * done.
+ *
+ * @param stream stream to destroy
+ * @param toe reason to give to the application
+ */
+static void
+stream_destroy (struct MHD_Http2Stream *stream,
+                enum MHD_RequestTerminationCode toe)
+{
+  struct MHD_Http2Session *session = stream->session;
+  struct MHD_Connection *sc = &stream->request;
+  struct MHD_Daemon *daemon = sc->daemon;
+
+  if ( (NULL != daemon->notify_completed) &&
+       (MHD_YES == sc->client_aware) )
+    daemon->notify_completed (daemon->notify_completed_cls,
+                              sc,
+                              &sc->client_context,
+                              toe);
+  if (NULL != sc->response)
+    MHD_destroy_response (sc->response);
+  DLL_remove (session->streams_head,
+              session->streams_tail,
+              stream);
+  session->num_streams--;
+  MHD_pool_destroy (sc->pool);
+  free (stream->body);
+  free (stream);
+}
+
+
+/**
+ * Call the handler of the application for the request of a stream.
+ *
+ * @param stream stream to process
+ * @param upload_data request body data, NULL if none
+ * @param[in,out] upload_data_size number of bytes in @a upload_data,
+ *        set to the number of bytes the handler did not consume
+ * @return #MHD_YES on success, #MHD_NO if the stream was reset
+ */
+static int
+call_handler (struct MHD_Http2Stream *stream,
+              const char *upload_data,
+              size_t *upload_data_size)
+{
+  struct MHD_Connection *sc = &stream->request;
+  struct MHD_Daemon *daemon = sc->daemon;
+
+  /* streams are not served from the response cache, which would
+     have to suspend them while waiting for other requests */
+  if (MHD_NO == sc->client_aware)
+    {
+      sc->handler = daemon->default_handler;
+      sc->handler_cls = daemon->default_handler_cls;
+      if ( (NULL != daemon->router) &&
+           (-1 == MHD_router_dispatch_ (sc)) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Not enough memory in pool to store route arguments, resetting stream.\n");
+#endif
+          stream_reset (stream, ERROR_INTERNAL);
+          return MHD_NO;
+        }
+    }
+  sc->client_aware = MHD_YES;
+  if (MHD_NO ==
+      sc->handler (sc->handler_cls,
+                   sc,
+                   sc->url,
+                   sc->method,
+                   sc->version,
+                   upload_data,
+                   upload_data_size,
+                   &sc->client_context))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Internal application error, resetting stream.\n");
+#endif
+      stream_reset (stream, ERROR_INTERNAL);
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Advance the request of a stream as far as possible, calling the
+ * handler of the application with the request body received and
+ * until it queued a response.
+ *
+ * @param stream stream to process
+ */
+static void
+stream_process (struct MHD_Http2Stream *stream)
+{
+  struct MHD_Connection *sc = &stream->request;
+  size_t processed;
+  size_t used;
+
+  while ( (MHD_NO == stream->done) &&
+          (MHD_NO == sc->suspended) )
+    {
+      switch (sc->state)
+        {
+        case MHD_CONNECTION_HEADERS_PROCESSED:
+          processed = 0;
+          if (MHD_NO == call_handler (stream, NULL, &processed))
+            return;
+          if (NULL != sc->response)
+            {
+              /* response queued early, the body is discarded */
+              sc->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+              continue;
+            }
+          sc->state = ( (MHD_YES == stream->remote_closed) &&
+                        (0 == stream->body_size) )
+            ? MHD_CONNECTION_FOOTERS_RECEIVED
+            : MHD_CONNECTION_CONTINUE_SENT;
+          continue;
+        case MHD_CONNECTION_CONTINUE_SENT:
+          if (0 != stream->body_size)
+            {
+              processed = stream->body_size;
+              if (MHD_NO == call_handler (stream,
+                                          stream->body,
+                                          &processed))
+                return;
+              used = stream->body_size - processed;
+              if (0 == used)
+                return; /* no progress, try again later */
+              memmove (stream->body,
+                       &stream->body[used],
+                       processed);
+              stream->body_size = processed;
+              stream_consumed (stream, used);
+              continue;
+            }
+          if (MHD_NO == stream->remote_closed)
+            return;
+          sc->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+          continue;
+        case MHD_CONNECTION_FOOTERS_RECEIVED:
+          if (NULL == sc->response)
+            {
+              processed = 0;
+              if (MHD_NO == call_handler (stream, NULL, &processed))
+                return;
+              if (NULL == sc->response)
+                return;
+            }
+          sc->state = MHD_CONNECTION_HEADERS_SENDING;
+          return;
+        default:
+          return;
+        }
+    }
+}
+
+
+/**
+ * Receive request body data for a stream.  The data is passed to the
+ * application right away if it is ready for it; what it does not
+ * consume is kept until later.
+ *
+ * @param stream stream the data is for
+ * @param data the data
+ * @param size number of bytes in @a data
+ */
+static void
+stream_receive (struct MHD_Http2Stream *stream,
+                const char *data,
+                size_t size)
+{
+  struct MHD_Connection *sc = &stream->request;
+  size_t processed;
+  size_t used;
+  char *body;
+
+  stream->received += size;
+  if ( (MHD_SIZE_UNKNOWN != stream->content_length) &&
+       (stream->received > stream->content_length) )
+    {
+      stream_reset (stream, ERROR_PROTOCOL);
+      return;
+    }
+  if ( (MHD_CONNECTION_HEADERS_PROCESSED != sc->state) &&
+       (MHD_CONNECTION_CONTINUE_SENT != sc->state) )
+    {
+      /* a response was queued, nobody is interested in the body */
+      stream_consumed (stream, size);
+      return;
+    }
+  if ( (0 == stream->body_size) &&
+       (0 != size) &&
+       (MHD_CONNECTION_CONTINUE_SENT == sc->state) &&
+       (MHD_NO == sc->suspended) )
+    {
+      /* common case: pass the data straight out of the read buffer */
+      processed = size;
+      if (MHD_NO == call_handler (stream, data, &processed))
+        return;
+      used = size - processed;
+      stream_consumed (stream, used);
+      data += used;
+      size = processed;
+    }
+  if (0 == size)
+    return;
+  if (stream->body_size + size > stream->body_alloc)
+    {
+      /* bounded by the receive window of the stream */
+      body = realloc (stream->body, stream->body_size + size);
+      if (NULL == body)
+        {
+          stream_reset (stream, ERROR_INTERNAL);
+          return;
+        }
+      stream->body = body;
+      stream->body_alloc = stream->body_size + size;
+    }
+  memcpy (&stream->body[stream->body_size],
+          data,
+          size);
+  stream->body_size += size;
+}
+
+
+/**
+ * Copy a string into the pool of a connection.
+ *
+ * @param connection connection with the pool
+ * @param str string to copy, not 0-terminated
+ * @param len number of bytes in @a str
+ * @return NULL if the pool is exhausted
+ */
+static char *
+pool_strndup (struct MHD_Connection *connection,
+              const char *str,
+              size_t len)
+{
+  char *cpy;
+
+  cpy = MHD_pool_allocate (connection->pool, len + 1, MHD_YES);
+  if (NULL == cpy)
+    return NULL;
+  memcpy (cpy, str, len);
+  cpy[len] = '\0';
+  return cpy;
+}
+
+
+/**
+ * Add a value to the request of a stream; arguments and cookies are
+ * parsed in place, so the strings are already in the pool.
+ *
+ * @param connection the connection of the stream
+ * @param key key of the value
+ * @param value the value
+ * @param kind kind of the value
+ * @return #MHD_NO on failure (out of memory), #MHD_YES for success
+ */
+static int
+add_value (struct MHD_Connection *connection,
+           const char *key,
+           const char *value,
+           enum MHD_ValueKind kind)
+{
+  return MHD_set_connection_value (connection, kind, key, value);
+}
+
+
+/**
+ * Check if a header field name is a connection-specific field that
+ * must not be used with HTTP/2 (RFC 7540, section 8.1.2.2).
+ *
+ * @param name name of the field
+ * @param len number of bytes in @a name
+ * @return non-zero if the field is connection-specific
+ */
+static int
+is_connection_header (const char *name,
+                      size_t len)
+{
+  static const char *const names[] =
+    { "connection", "keep-alive", "proxy-connection",
+      "transfer-encoding", "upgrade", NULL };
+  unsigned int i;
+
+  for (i = 0; NULL != names[i]; i++)
+    if ( (strlen (names[i]) == len) &&
+         (0 == memcmp (names[i], name, len)) )
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Collect a header field of a request.
+ *
+ * @param cls the `struct HeaderContext`
+ * @param name name of the field, not 0-terminated
+ * @param name_len number of bytes in @a name
+ * @param value value of the field, not 0-terminated
+ * @param value_len number of bytes in @a value
+ */
+static void
+header_cb (void *cls,
+           const char *name,
+           size_t name_len,
+           const char *value,
+           size_t value_len)
+{
+  struct HeaderContext *hc = cls;
+  struct MHD_Connection *sc = &hc->stream->request;
+  char **pseudo;
+  char *key;
+  char *val;
+  char *cookie;
+  size_t old;
+  size_t i;
+  uint64_t clen;
+
+  if ( (MHD_YES == hc->malformed) ||
+       (MHD_YES == hc->too_large) )
+    return;
+  hc->list_size += name_len + value_len + 32;
+  if (hc->list_size > hc->stream->session->max_header_list)
+    {
+      hc->too_large = MHD_YES;
+      return;
+    }
+  for (i = 0; i < name_len; i++)
+    if ( (name[i] >= 'A') &&
+         (name[i] <= 'Z') )
+      {
+        hc->malformed = MHD_YES;
+        return;
+      }
+  if ( (0 != name_len) &&
+       (':' == name[0]) )
+    {
+      pseudo = NULL;
+      if ( (7 == name_len) && (0 == memcmp (name, ":method", 7)) )
+        pseudo = &hc->method;
+      else if ( (5 == name_len) && (0 == memcmp (name, ":path", 5)) )
+        pseudo = &hc->path;
+      else if ( (7 == name_len) && (0 == memcmp (name, ":scheme", 7)) )
+        pseudo = &hc->scheme;
+      else if ( (10 == name_len) && (0 == memcmp (name, ":authority", 10)) )
+        pseudo = &hc->authority;
+      if ( (NULL == pseudo) ||
+           (NULL != *pseudo) ||
+           (MHD_YES == hc->regular) ||
+           (MHD_YES == hc->trailers) )
+        {
+          hc->malformed = MHD_YES;
+          return;
+        }
+      *pseudo = pool_strndup (sc, value, value_len);
+      if (NULL == *pseudo)
+        hc->too_large = MHD_YES;
+      return;
+    }
+  hc->regular = MHD_YES;
+  if ( (is_connection_header (name, name_len)) ||
+       ( (2 == name_len) &&
+         (0 == memcmp (name, "te", 2)) &&
+         ( (8 != value_len) ||
+           (0 != memcmp (value, "trailers", 8)) ) ) )
+    {
+      hc->malformed = MHD_YES;
+      return;
+    }
+  if ( (6 == name_len) &&
+       (0 == memcmp (name, "cookie", 6)) &&
+       (MHD_NO == hc->trailers) )
+    {
+      /* join the cookie crumbs for the cookie parser */
+      old = (NULL == hc->cookie) ? 0 : strlen (hc->cookie);
+      cookie = MHD_pool_allocate (sc->pool, old + value_len + 3, MHD_YES);
+      if (NULL == cookie)
+        {
+          hc->too_large = MHD_YES;
+          return;
+        }
+      if (0 != old)
+        {
+          memcpy (cookie, hc->cookie, old);
+          memcpy (&cookie[old], "; ", 2);
+          old += 2;
+        }
+      memcpy (&cookie[old], value, value_len);
+      cookie[old + value_len] = '\0';
+      hc->cookie = cookie;
+      return;
+    }
+  key = pool_strndup (sc, name, name_len);
+  val = pool_strndup (sc, value, value_len);
+  if ( (NULL == key) ||
+       (NULL == val) )
+    {
+      hc->too_large = MHD_YES;
+      return;
+    }
+  if ( (14 == name_len) &&
+       (0 == memcmp (name, "content-length", 14)) &&
+       (MHD_NO == hc->trailers) )
+    {
+      if ( (0 == value_len) ||
+           (value_len != MHD_str_to_uint64_ (val, &clen)) ||
+           ( (MHD_SIZE_UNKNOWN != hc->stream->content_length) &&
+             (clen != hc->stream->content_length) ) )
+        {
+          hc->malformed = MHD_YES;
+          return;
+        }
+      hc->stream->content_length = clen;
+    }
+  if (MHD_NO ==
+      MHD_set_connection_value (sc,
+                                hc->trailers
+                                ? MHD_FOOTER_KIND
+                                : MHD_HEADER_KIND,
+                                key,
+                                val))
+    hc->too_large = MHD_YES;
+}
+
+
+/**
+ * Queue a response with an empty body for a request we refuse to
+ * pass to the application.
+ *
+ * @param stream stream of the request
+ * @param status_code status of the response
+ */
+static void
+stream_refuse (struct MHD_Http2Stream *stream,
+               unsigned int status_code)
+{
+  struct MHD_Connection *sc = &stream->request;
+  struct MHD_Response *response;
+
+  response = MHD_create_response_from_buffer (0,
+                                              NULL,
+                                              MHD_RESPMEM_PERSISTENT);
+  if (NULL == response)
+    {
+      stream_reset (stream, ERROR_INTERNAL);
+      return;
+    }
+  sc->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+  (void) MHD_queue_response (sc, status_code, response);
+  MHD_destroy_response (response);
+  sc->state = MHD_CONNECTION_HEADERS_SENDING;
+}
+
+
+/**
+ * Set up the request of a stream from the header fields received and
+ * start processing it.
+ *
+ * @param stream stream with the new request
+ * @param hc header fields of the request
+ */
+static void
+stream_start_request (struct MHD_Http2Stream *stream,
+                      struct HeaderContext *hc)
+{
+  struct MHD_Connection *sc = &stream->request;
+  struct MHD_Daemon *daemon = sc->daemon;
+  unsigned int unused_num_headers;
+  char *uri;
+  char *args;
+
+  if ( (MHD_YES == hc->malformed) ||
+       ( (MHD_NO == hc->too_large) &&
+         ( (NULL == hc->method) ||
+           (NULL == hc->scheme) ||
+           (NULL == hc->path) ||
+           ('\0' == hc->path[0]) ) ) )
+    {
+      stream_reset (stream, ERROR_PROTOCOL);
+      return;
+    }
+  if (MHD_YES == hc->too_large)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Not enough memory for the headers of a request!\n");
+#endif
+      stream_refuse (stream, MHD_HTTP_REQUEST_ENTITY_TOO_LARGE);
+      return;
+    }
+  if ( ( (NULL != hc->authority) &&
+         (NULL == MHD_lookup_connection_value (sc,
+                                               MHD_HEADER_KIND,
+                                               MHD_HTTP_HEADER_HOST)) &&
+         (MHD_NO == MHD_set_connection_value (sc,
+                                              MHD_HEADER_KIND,
+                                              MHD_HTTP_HEADER_HOST,
+                                              hc->authority)) ) ||
+       ( (NULL != hc->cookie) &&
+         ( (MHD_NO == MHD_set_connection_value (sc,
+                                                MHD_HEADER_KIND,
+                                                MHD_HTTP_HEADER_COOKIE,
+                                                hc->cookie)) ||
+           (MHD_NO == MHD_parse_cookie_header_ (sc,
+                                                &add_value)) ) ) )
+    {
+      stream_refuse (stream, MHD_HTTP_REQUEST_ENTITY_TOO_LARGE);
+      return;
+    }
+  sc->method = hc->method;
+  uri = hc->path;
+  if (NULL != daemon->uri_log_callback)
+    sc->client_context
+      = daemon->uri_log_callback (daemon->uri_log_callback_cls,
+                                  uri,
+                                  sc);
+  args = strchr (uri, '?');
+  if (NULL != args)
+    {
+      args[0] = '\0';
+      args++;
+      /* note that this call clobbers 'args' */
+      MHD_parse_arguments_ (sc,
+                            MHD_GET_ARGUMENT_KIND,
+                            args,
+                            &add_value,
+                            &unused_num_headers);
+    }
+  daemon->unescape_callback (daemon->unescape_callback_cls,
+                             sc,
+                             uri);
+  sc->url = uri;
+  sc->remaining_upload_size = (MHD_YES == stream->remote_closed)
+    ? 0
+    : stream->content_length;
+  sc->state = MHD_CONNECTION_HEADERS_PROCESSED;
+  stream_process (stream);
+}
+
+
+/**
+ * Process a complete header block received from the client.
+ *
+ * @param session session the block was received on
+ * @param id stream of the block
+ * @param flags flags of the HEADERS frame
+ * @param block the header block
+ * @param size number of bytes in @a block
+ */
+static void
+handle_header_block (struct MHD_Http2Session *session,
+                     uint32_t id,
+                     uint8_t flags,
+                     const uint8_t *block,
+                     size_t size)
+{
+  struct MHD_Http2Stream *stream;
+  struct HeaderContext hc;
+
+  stream = stream_find (session, id);
+  if (NULL == stream)
+    {
+      /* refused stream, still keep the dynamic table in sync */
+      if (MHD_NO == MHD_hpack_decode_ (&session->decoder,
+                                       block,
+                                       size,
+                                       NULL,
+                                       NULL))
+        session_fail (session, ERROR_COMPRESSION);
+      return;
+    }
+  memset (&hc, 0, sizeof (struct HeaderContext));
+  hc.stream = stream;
+  hc.trailers = (MHD_CONNECTION_INIT != stream->request.state);
+  if (MHD_NO == MHD_hpack_decode_ (&session->decoder,
+                                   block,
+                                   size,
+                                   &header_cb,
+                                   &hc))
+    {
+      session_fail (session, ERROR_COMPRESSION);
+      return;
+    }
+  if (0 != (flags & FLAG_END_STREAM))
+    stream->remote_closed = MHD_YES;
+  if (MHD_NO == hc.trailers)
+    {
+      if ( (MHD_YES == stream->remote_closed) &&
+           (MHD_SIZE_UNKNOWN != stream->content_length) &&
+           (0 != stream->content_length) )
+        {
+          stream_reset (stream, ERROR_PROTOCOL);
+          return;
+        }
+      stream_start_request (stream, &hc);
+      return;
+    }
+  if ( (MHD_NO == stream->remote_closed) ||
+       (MHD_YES == hc.malformed) ||
+       ( (MHD_SIZE_UNKNOWN != stream->content_length) &&
+         (stream->received != stream->content_length) ) )
+    {
+      stream_reset (stream, ERROR_PROTOCOL);
+      return;
+    }
+  stream_process (stream);
+}
+
+
+/**
+ * Apply settings received from the client.
+ *
+ * @param session session to update
+ * @param payload the settings
+ * @param size number of bytes in @a payload
+ * @return #MHD_YES on success, #MHD_NO if the connection failed
+ */
+static int
+apply_settings (struct MHD_Http2Session *session,
+                const uint8_t *payload,
+                size_t size)
+{
+  struct MHD_Http2Stream *stream;
+  uint32_t value;
+  int64_t delta;
+  size_t off;
+
+  for (off = 0; off + 6 <= size; off += 6)
+    {
+      value = get32 (&payload[off + 2]);
+      switch ((payload[off] << 8) | payload[off + 1])
+        {
+        case SETTINGS_HEADER_TABLE_SIZE:
+          MHD_hpack_encoder_set_max_size_ (&session->encoder, value);
+          break;
+        case SETTINGS_ENABLE_PUSH:
+          if (value > 1)
+            {
+              session_fail (session, ERROR_PROTOCOL);
+              return MHD_NO;
+            }
+          break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+          if (value > MAX_WINDOW)
+            {
+              session_fail (session, ERROR_FLOW_CONTROL);
+              return MHD_NO;
+            }
+          delta = (int64_t) value - session->peer_initial_window;
+          session->peer_initial_window = value;
+          for (stream = session->streams_head; NULL != stream; stream = stream->next)
+            {
+              stream->send_window += delta;
+              if (stream->send_window > MAX_WINDOW)
+                {
+                  session_fail (session, ERROR_FLOW_CONTROL);
+                  return MHD_NO;
+                }
+            }
+          break;
+        case SETTINGS_MAX_FRAME_SIZE:
+          if ( (value < MAX_FRAME_SIZE) ||
+               (value > 0xFFFFFF) )
+            {
+              session_fail (session, ERROR_PROTOCOL);
+              return MHD_NO;
+            }
+          /* our buffers are made for frames of the default size */
+          session->peer_max_frame = MAX_FRAME_SIZE;
+          break;
+        default:
+          /* MAX_CONCURRENT_STREAMS only limits server push, which we
+             do not use; MAX_HEADER_LIST_SIZE is advisory */
+          break;
+        }
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Process a DATA frame.
+ *
+ * @param session session the frame was received on
+ * @param id stream of the frame
+ * @param flags flags of the frame
+ * @param payload payload of the frame
+ * @param size number of bytes in @a payload
+ */
+static void
+handle_data (struct MHD_Http2Session *session,
+             uint32_t id,
+             uint8_t flags,
+             const uint8_t *payload,
+             size_t size)
+{
+  struct MHD_Http2Stream *stream;
+  size_t pad;
+
+  if (0 == id)
+    {
+      session_fail (session, ERROR_PROTOCOL);
+      return;
+    }
+  if ((int64_t) size > session->recv_window)
+    {
+      session_fail (session, ERROR_FLOW_CONTROL);
+      return;
+    }
+  /* the connection window only bounds what the streams buffer */
+  session->recv_window -= size;
+  session->recv_consumed += size;
+  if (session->recv_consumed >= CONNECTION_WINDOW / 2)
+    {
+      send_u32 (session, FRAME_WINDOW_UPDATE, 0, session->recv_consumed);
+      session->recv_window += session->recv_consumed;
+      session->recv_consumed = 0;
+    }
+  pad = 0;
+  if (0 != (flags & FLAG_PADDED))
+    {
+      if ( (0 == size) ||
+           (payload[0] >= size) )
+        {
+          session_fail (session, ERROR_PROTOCOL);
+          return;
+        }
+      pad = payload[0] + 1;
+    }
+  stream = stream_find (session, id);
+  if (NULL == stream)
+    {
+      if (id > session->last_stream_id)
+        session_fail (session, ERROR_PROTOCOL);
+      else
+        send_u32 (session, FRAME_RST_STREAM, id, ERROR_STREAM_CLOSED);
+      return;
+    }
+  if (MHD_YES == stream->remote_closed)
+    {
+      stream_reset (stream, ERROR_STREAM_CLOSED);
+      return;
+    }
+  if ((int64_t) size > stream->recv_window)
+    {
+      stream_reset (stream, ERROR_FLOW_CONTROL);
+      return;
+    }
+  stream->recv_window -= size;
+  stream_consumed (stream, pad);
+  if (0 != (flags & FLAG_END_STREAM))
+    stream->remote_closed = MHD_YES;
+  stream_receive (stream,
+                  (const char *) &payload[0 == pad ? 0 : 1],
+                  size - pad);
+  if ( (MHD_YES == stream->remote_closed) &&
+       (MHD_NO == stream->done) )
+    {
+      if ( (MHD_SIZE_UNKNOWN != stream->content_length) &&
+           (stream->received != stream->content_length) )
+        {
+          stream_reset (stream, ERROR_PROTOCOL);
+          return;
+        }
+      stream_process (stream);
+    }
+}
+
+
+/**
+ * Process a HEADERS frame.
+ *
+ * @param session session the frame was received on
+ * @param id stream of the frame
+ * @param flags flags of the frame
+ * @param payload payload of the frame
+ * @param size number of bytes in @a payload
+ */
+static void
+handle_headers (struct MHD_Http2Session *session,
+                uint32_t id,
+                uint8_t flags,
+                const uint8_t *payload,
+                size_t size)
+{
+  struct MHD_Http2Stream *stream;
+  size_t off;
+  size_t pad;
+
+  if ( (0 == id) ||
+       (0 == (id & 1)) )
+    {
+      session_fail (session, ERROR_PROTOCOL);
+      return;
+    }
+  off = 0;
+  pad = 0;
+  if (0 != (flags & FLAG_PADDED))
+    {
+      if (0 == size)
+        {
+          session_fail (session, ERROR_PROTOCOL);
+          return;
+        }
+      pad = payload[0];
+      off = 1;
+    }
+  if (0 != (flags & FLAG_PRIORITY))
+    off += 5; /* priorities are ignored */
+  if (off + pad > size)
+    {
+      session_fail (session, ERROR_PROTOCOL);
+      return;
+    }
+  stream = stream_find (session, id);
+  if (NULL != stream)
+    {
+      /* trailers */
+      if (MHD_YES == stream->remote_closed)
+        stream_reset (stream, ERROR_STREAM_CLOSED);
+      else if (0 == (flags & FLAG_END_STREAM))
+        stream_reset (stream, ERROR_PROTOCOL);
+    }
+  else if (id <= session->last_stream_id)
+    {
+      /* closed stream, still decode the block below */
+      send_u32 (session, FRAME_RST_STREAM, id, ERROR_STREAM_CLOSED);
+    }
+  else
+    {
+      session->last_stream_id = id;
+      if ( (MHD_YES == session->goaway_sent) ||
+           (MHD_YES == session->goaway_received) )
+        stream = NULL; /* ignore new streams while going away */
+      else if ( (session->num_streams >=
+                 session->connection->daemon->http2_max_streams) ||
+                (NULL == (stream = stream_create (session, id))) )
+        send_u32 (session, FRAME_RST_STREAM, id, ERROR_REFUSED_STREAM);
+    }
+  if (0 != (flags & FLAG_END_HEADERS))
+    {
+      handle_header_block (session,
+                           id,
+                           flags,
+                           &payload[off],
+                           size - off - pad);
+      return;
+    }
+  session->in_stream = id;
+  session->in_flags = flags;
+  session->in_block_size = 0;
+  if (size - off - pad > session->in_block_alloc)
+    {
+      free (session->in_block);
+      session->in_block_alloc = 0;
+      session->in_block = malloc (size - off - pad);
+      if (NULL == session->in_block)
+        {
+          session_fail (session, ERROR_INTERNAL);
+          return;
+        }
+      session->in_block_alloc = size - off - pad;
+    }
+  memcpy (session->in_block, &payload[off], size - off - pad);
+  session->in_block_size = size - off - pad;
+}
+
+
+/**
+ * Process a CONTINUATION frame.
+ *
+ * @param session session the frame was received on
+ * @param flags flags of the frame
+ * @param payload payload of the frame
+ * @param size number of bytes in @a payload
+ */
+static void
+handle_continuation (struct MHD_Http2Session *session,
+                     uint8_t flags,
+                     const uint8_t *payload,
+                     size_t size)
+{
+  uint8_t *block;
+  size_t total;
+  uint32_t id;
+
+  total = session->in_block_size + size;
+  if (total > session->connection->daemon->pool_size)
+    {
+      /* way beyond what we allow for the header list */
+      session_fail (session, ERROR_ENHANCE_YOUR_CALM);
+      return;
+    }
+  if (total > session->in_block_alloc)
+    {
+      block = realloc (session->in_block, total);
+      if (NULL == block)
+        {
+          session_fail (session, ERROR_INTERNAL);
+          return;
+        }
+      session->in_block = block;
+      session->in_block_alloc = total;
+    }
+  memcpy (&session->in_block[session->in_block_size], payload, size);
+  session->in_block_size = total;
+  if (0 == (flags & FLAG_END_HEADERS))
+    return;
+  id = session->in_stream;
+  session->in_stream = 0;
+  handle_header_block (session,
+                       id,
+                       session->in_flags,
+                       session->in_block,
+                       session->in_block_size);
+}
+
+
+/**
+ * Process a frame received from the client.
+ *
+ * @param session session the frame was received on
+ * @param type type of the frame
+ * @param flags flags of the frame
+ * @param id stream of the frame
+ * @param payload payload of the frame
+ * @param size number of bytes in @a payload
+ */
+static void
+handle_frame (struct MHD_Http2Session *session,
+              uint8_t type,
+              uint8_t flags,
+              uint32_t id,
+              const uint8_t *payload,
+              size_t size)
+{
+  struct MHD_Http2Stream *stream;
+  uint32_t increment;
+
+  if ( (0 != session->in_stream) &&
+       ( (FRAME_CONTINUATION != type) ||
+         (id != session->in_stream) ) )
+    {
+      /* header blocks must not be interleaved with other frames */
+      session_fail (session, ERROR_PROTOCOL);
+      return;
+    }
+  switch (type)
+    {
+    case FRAME_DATA:
+      handle_data (session, id, flags, payload, size);
+      break;
+    case FRAME_HEADERS:
+      handle_headers (session, id, flags, payload, size);
+      break;
+    case FRAME_PRIORITY:
+      if (0 == id)
+        session_fail (session, ERROR_PROTOCOL);
+      else if (5 != size)
+        send_u32 (session, FRAME_RST_STREAM, id, ERROR_FRAME_SIZE);
+      break;
+    case FRAME_RST_STREAM:
+      if ( (0 == id) ||
+           (id > session->last_stream_id) )
+        {
+          session_fail (session, ERROR_PROTOCOL);
+          break;
+        }
+      if (4 != size)
+        {
+          session_fail (session, ERROR_FRAME_SIZE);
+          break;
+        }
+      stream = stream_find (session, id);
+      if (NULL == stream)
+        break;
+      stream->reset = MHD_YES;
+      stream->remote_closed = MHD_YES;
+      stream->done = MHD_YES;
+      stream->toe = MHD_REQUEST_TERMINATED_CLIENT_ABORT;
+      break;
+    case FRAME_SETTINGS:
+      if (0 != id)
+        {
+          session_fail (session, ERROR_PROTOCOL);
+          break;
+        }
+      if (0 != (flags & FLAG_ACK))
+        {
+          if (0 != size)
+            session_fail (session, ERROR_FRAME_SIZE);
+          break;
+        }
+      if (0 != size % 6)
+        {
+          session_fail (session, ERROR_FRAME_SIZE);
+          break;
+        }
+      if (MHD_YES != apply_settings (session, payload, size))
+        break;
+      session->settings_received = MHD_YES;
+      send_control (session, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+      break;
+    case FRAME_PUSH_PROMISE:
+      /* clients must not push */
+      session_fail (session, ERROR_PROTOCOL);
+      break;
+    case FRAME_PING:
+      if (0 != id)
+        session_fail (session, ERROR_PROTOCOL);
+      else if (8 != size)
+        session_fail (session, ERROR_FRAME_SIZE);
+      else if (0 == (flags & FLAG_ACK))
+        send_control (session, FRAME_PING, FLAG_ACK, 0, payload, 8);
+      break;
+    case FRAME_GOAWAY:
+      if (0 != id)
+        session_fail (session, ERROR_PROTOCOL);
+      else if (size < 8)
+        session_fail (session, ERROR_FRAME_SIZE);
+      else
+        session->goaway_received = MHD_YES;
+      break;
+    case FRAME_WINDOW_UPDATE:
+      if (4 != size)
+        {
+          session_fail (session, ERROR_FRAME_SIZE);
+          break;
+        }
+      increment = get32 (payload) & 0x7FFFFFFF;
+      if (0 == id)
+        {
+          session->send_window += increment;
+          if ( (0 == increment) ||
+               (session->send_window > MAX_WINDOW) )
+            session_fail (session, (0 == increment)
+                          ? ERROR_PROTOCOL
+                          : ERROR_FLOW_CONTROL);
+          break;
+        }
+      if (id > session->last_stream_id)
+        {
+          session_fail (session, ERROR_PROTOCOL);
+          break;
+        }
+      stream = stream_find (session, id);
+      if (NULL == stream)
+        break;
+      stream->send_window += increment;
+      if (0 == increment)
+        stream_reset (stream, ERROR_PROTOCOL);
+      else if (stream->send_window > MAX_WINDOW)
+        stream_reset (stream, ERROR_FLOW_CONTROL);
+      break;
+    case FRAME_CONTINUATION:
+      if (0 == session->in_stream)
+        session_fail (session, ERROR_PROTOCOL);
+      else
+        handle_continuation (session, flags, payload, size);
+      break;
+    default:
+      /* unknown frame types must be ignored */
+      break;
+    }
+}
+
+
+/**
+ * Process the frames in the read buffer.  Stops while a header
+ * block is being sent or the write buffer has no room for the
+ * control frames we may have to send in reply.
+ *
+ * @param session session to process
+ */
+static void
+parse_frames (struct MHD_Http2Session *session)
+{
+  struct MHD_Connection *connection = session->connection;
+  const uint8_t *buf = (const uint8_t *) connection->read_buffer;
+  size_t avail = connection->read_buffer_offset;
+  size_t pos;
+  size_t size;
+
+  pos = 0;
+  if (MHD_NO == session->preface_received)
+    {
+      if (avail < CLIENT_PREFACE_SIZE)
+        {
+          if (0 != memcmp (buf, CLIENT_PREFACE, avail))
+            session_fail (session, ERROR_PROTOCOL);
+          return;
+        }
+      if (0 != memcmp (buf, CLIENT_PREFACE, CLIENT_PREFACE_SIZE))
+        {
+          session_fail (session, ERROR_PROTOCOL);
+          return;
+        }
+      session->preface_received = MHD_YES;
+      pos = CLIENT_PREFACE_SIZE;
+    }
+  while ( (MHD_NO == session->failed) &&
+          (avail - pos >= FRAME_HEADER_SIZE) &&
+          (NULL == session->out_block) &&
+          (write_space (connection) >= CONTROL_RESERVE) )
+    {
+      size = ((size_t) buf[pos] << 16) | ((size_t) buf[pos + 1] << 8) | buf[pos + 2];
+      if (size > MAX_FRAME_SIZE)
+        {
+          session_fail (session, ERROR_FRAME_SIZE);
+          break;
+        }
+      if (avail - pos < FRAME_HEADER_SIZE + size)
+        break;
+      if ( (MHD_NO == session->settings_received) &&
+           ( (FRAME_SETTINGS != buf[pos + 3]) ||
+             (0 != (buf[pos + 4] & FLAG_ACK)) ) )
+        {
+          /* the preface must end with the settings of the client */
+          session_fail (session, ERROR_PROTOCOL);
+          break;
+        }
+      handle_frame (session,
+                    buf[pos + 3],
+                    buf[pos + 4],
+                    get32 (&buf[pos + 5]) & 0x7FFFFFFF,
+                    &buf[pos + FRAME_HEADER_SIZE],
+                    size);
+      pos += FRAME_HEADER_SIZE + size;
+    }
+  if (0 != pos)
+    {
+      memmove (connection->read_buffer,
+               &connection->read_buffer[pos],
+               avail - pos);
+      connection->read_buffer_offset = avail - pos;
+    }
+}
+
+
+/**
+ * Check if the response of a stream has footers, to be sent as
+ * trailers.
+ *
+ * @param response the response
+ * @return #MHD_YES if it has footers
+ */
+static int
+have_footers (struct MHD_Response *response)
+{
+  struct MHD_HTTP_Header *pos;
+
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    if (MHD_FOOTER_KIND == pos->kind)
+      return MHD_YES;
+  return MHD_NO;
+}
+
+
+/**
+ * Check if the response of a stream has a body.
+ *
+ * @param sc connection of the stream
+ * @return #MHD_YES if it has a body
+ */
+static int
+have_body (struct MHD_Connection *sc)
+{
+  unsigned int rc = sc->responseCode & (~MHD_ICY_FLAG);
+
+  return ( (rc >= MHD_HTTP_OK) &&
+           (MHD_HTTP_NO_CONTENT != rc) &&
+           (MHD_HTTP_NOT_MODIFIED != rc) &&
+           (! MHD_str_equal_caseless_ (sc->method,
+                                       MHD_HTTP_METHOD_HEAD)) );
+}
+
+
+/**
+ * Encode the headers (or trailers) of the response of a stream into
+ * the header block to send next.
+ *
+ * @param stream stream with the response
+ * @param trailers #MHD_YES to encode the footers of the response
+ * @param end_stream #MHD_YES if the block ends the stream
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+static int
+encode_header_block (struct MHD_Http2Stream *stream,
+                     int trailers,
+                     int end_stream)
+{
+  struct MHD_Http2Session *session = stream->session;
+  struct MHD_Connection *sc = &stream->request;
+  struct MHD_Response *response = sc->response;
+  struct MHD_HTTP_Header *pos;
+  enum MHD_ValueKind kind;
+  char date[128];
+  char clen[32];
+  uint8_t *block;
+  size_t size;
+  size_t off;
+
+  size = MHD_HPACK_MAX_ENCODED (7, 3) +
+    MHD_HPACK_MAX_ENCODED (4, sizeof (date)) +
+    MHD_HPACK_MAX_ENCODED (14, sizeof (clen));
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    size += MHD_HPACK_MAX_ENCODED (strlen (pos->header),
+                                   strlen (pos->value));
+  block = malloc (size);
+  if (NULL == block)
+    return MHD_NO;
+  off = MHD_hpack_encode_status_ (&session->encoder,
+                                  (MHD_YES == trailers)
+                                  ? 0
+                                  : sc->responseCode & (~MHD_ICY_FLAG),
+                                  block);
+  kind = (MHD_YES == trailers) ? MHD_FOOTER_KIND : MHD_HEADER_KIND;
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    {
+      if ( (kind != pos->kind) ||
+           (is_connection_header (pos->header, strlen (pos->header))) ||
+           (MHD_str_equal_caseless_ (pos->header,
+                                     MHD_HTTP_HEADER_CONNECTION)) ||
+           (MHD_str_equal_caseless_ (pos->header,
+                                     MHD_HTTP_HEADER_TRANSFER_ENCODING)) ||
+           (MHD_str_equal_caseless_ (pos->header,
+                                     MHD_HTTP_HEADER_UPGRADE)) ||
+           (MHD_str_equal_caseless_ (pos->header,
+                                     "Keep-Alive")) ||
+           ( (MHD_NO == trailers) &&
+             (MHD_str_equal_caseless_ (pos->header,
+                                       MHD_HTTP_HEADER_CONTENT_LENGTH)) ) )
+        continue;
+      off += MHD_hpack_encode_header_ (&session->encoder,
+                                       pos->header,
+                                       pos->value,
+                                       &block[off]);
+    }
+  if (MHD_NO == trailers)
+    {
+      if ( (0 == (sc->daemon->options & MHD_SUPPRESS_DATE_NO_CLOCK)) &&
+           (NULL == MHD_get_response_header (response,
+                                             MHD_HTTP_HEADER_DATE)) )
+        {
+          MHD_get_date_string_ (date);
+          if ('\0' != date[0])
+            {
+              /* strip "Date: " and the CRLF */
+              date[strlen (date) - 2] = '\0';
+              off += MHD_hpack_encode_header_ (&session->encoder,
+                                               MHD_HTTP_HEADER_DATE,
+                                               &date[strlen ("Date: ")],
+                                               &block[off]);
+            }
+        }
+      if ( (MHD_SIZE_UNKNOWN != response->total_size) &&
+           (MHD_HTTP_NO_CONTENT != (sc->responseCode & (~MHD_ICY_FLAG))) &&
+           (MHD_HTTP_NOT_MODIFIED != (sc->responseCode & (~MHD_ICY_FLAG))) )
+        {
+          MHD_snprintf_ (clen,
+                         sizeof (clen),
+                         MHD_UNSIGNED_LONG_LONG_PRINTF,
+                         (MHD_UNSIGNED_LONG_LONG) response->total_size);
+          off += MHD_hpack_encode_header_ (&session->encoder,
+                                           MHD_HTTP_HEADER_CONTENT_LENGTH,
+                                           clen,
+                                           &block[off]);
+        }
+    }
+  session->out_block = block;
+  session->out_block_size = off;
+  session->out_block_offset = 0;
+  session->out_stream = stream->id;
+  session->out_flags = (MHD_YES == end_stream) ? FLAG_END_STREAM : 0;
+  return MHD_YES;
+}
+
+
+/**
+ * Put as much of the header block being sent into frames as fits
+ * into the write buffer.
+ *
+ * @param session session to process
+ * @return #MHD_YES if the header block was sent completely
+ */
+static int
+flush_header_block (struct MHD_Http2Session *session)
+{
+  size_t space;
+  size_t n;
+  uint8_t flags;
+
+  while (session->out_block_offset < session->out_block_size)
+    {
+      space = write_space (session->connection);
+      if (space <= FRAME_HEADER_SIZE)
+        return MHD_NO;
+      n = session->out_block_size - session->out_block_offset;
+      if (n > space - FRAME_HEADER_SIZE)
+        n = space - FRAME_HEADER_SIZE;
+      if (n > session->peer_max_frame)
+        n = session->peer_max_frame;
+      flags = (session->out_block_offset + n == session->out_block_size)
+        ? FLAG_END_HEADERS
+        : 0;
+      if (0 == session->out_block_offset)
+        flags |= session->out_flags;
+      memcpy (frame_append (session,
+                            n,
+                            (0 == session->out_block_offset)
+                            ? FRAME_HEADERS
+                            : FRAME_CONTINUATION,
+                            flags,
+                            session->out_stream),
+              &session->out_block[session->out_block_offset],
+              n);
+      session->out_block_offset += n;
+    }
+  free (session->out_block);
+  session->out_block = NULL;
+  return MHD_YES;
+}
+
+
+/**
+ * Mark the response of a stream as sent.
+ *
+ * @param stream stream that is done
+ */
+static void
+stream_complete (struct MHD_Http2Stream *stream)
+{
+  stream->request.state = MHD_CONNECTION_FOOTERS_SENT;
+  stream->done = MHD_YES;
+  stream->toe = MHD_REQUEST_TERMINATED_COMPLETED_OK;
+}
+
+
+/**
+ * Put the next DATA frame of the response of a stream into the write
+ * buffer, as far as flow control and the content reader permit.
+ *
+ * @param stream stream to send data on
+ * @return #MHD_YES if progress was made
+ */
+static int
+send_data (struct MHD_Http2Stream *stream)
+{
+  struct MHD_Http2Session *session = stream->session;
+  struct MHD_Connection *connection = session->connection;
+  struct MHD_Connection *sc = &stream->request;
+  struct MHD_Response *response = sc->response;
+  uint64_t pos = sc->response_write_position;
+  char *dst;
+  size_t space;
+  size_t max;
+  size_t n;
+  ssize_t ret;
+  int end;
+  uint8_t flags;
+
+  space = write_space (connection);
+  if (space < FRAME_HEADER_SIZE)
+    return MHD_NO;
+  max = space - FRAME_HEADER_SIZE;
+  if (max > session->peer_max_frame)
+    max = session->peer_max_frame;
+  if ((int64_t) max > stream->send_window)
+    max = (stream->send_window > 0) ? (size_t) stream->send_window : 0;
+  if ((int64_t) max > session->send_window)
+    max = (session->send_window > 0) ? (size_t) session->send_window : 0;
+  if ( (MHD_SIZE_UNKNOWN != response->total_size) &&
+       (response->total_size - pos < max) )
+    max = (size_t) (response->total_size - pos);
+  dst = &connection->write_buffer[connection->write_buffer_append_offset +
+                                  FRAME_HEADER_SIZE];
+  end = MHD_NO;
+  n = 0;
+  if ( (MHD_SIZE_UNKNOWN != response->total_size) &&
+       (pos == response->total_size) )
+    {
+      end = MHD_YES;
+    }
+  else if (0 == max)
+    {
+      return MHD_NO; /* flow control */
+    }
+  else if (NULL == response->crc)
+    {
+      memcpy (dst,
+              &response->data[pos - response->data_start],
+              max);
+      n = max;
+    }
+  else
+    {
+      (void) MHD_mutex_lock_ (&response->mutex);
+      /* the reader writes straight into the frame */
+      ret = response->crc (response->crc_cls,
+                           pos,
+                           dst,
+                           max);
+      (void) MHD_mutex_unlock_ (&response->mutex);
+      if ( (((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret) ||
+           ( (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret) &&
+             (MHD_SIZE_UNKNOWN != response->total_size) ) )
+        {
+          stream_reset (stream, ERROR_INTERNAL);
+          return MHD_YES;
+        }
+      if (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret)
+        {
+          end = MHD_YES;
+        }
+      else if (0 == ret)
+        {
+          stream->waiting = MHD_YES;
+          return MHD_NO;
+        }
+      else
+        {
+          n = (size_t) ret;
+        }
+    }
+  stream->waiting = MHD_NO;
+  if ( (MHD_SIZE_UNKNOWN != response->total_size) &&
+       (pos + n == response->total_size) )
+    end = MHD_YES;
+  flags = 0;
+  if (MHD_YES == end)
+    {
+      if (MHD_YES == have_footers (response))
+        sc->state = MHD_CONNECTION_FOOTERS_SENDING;
+      else
+        flags = FLAG_END_STREAM;
+      if (0 == n && 0 == flags)
+        return MHD_YES;
+    }
+  (void) frame_append (session, n, FRAME_DATA, flags, stream->id);
+  sc->response_write_position += n;
+  stream->send_window -= n;
+  session->send_window -= n;
+  if (0 != flags)
+    stream_complete (stream);
+  return MHD_YES;
+}
+
+
+/**
+ * Produce the next frame (or header block) of the response of a
+ * stream.
+ *
+ * @param stream stream to process
+ * @return #MHD_YES if progress was made
+ */
+static int
+stream_output (struct MHD_Http2Stream *stream)
+{
+  struct MHD_Connection *sc = &stream->request;
+  int body;
+  int footers;
+
+  if ( (MHD_YES == stream->done) ||
+       (MHD_YES == sc->suspended) )
+    return MHD_NO;
+  switch (sc->state)
+    {
+    case MHD_CONNECTION_HEADERS_SENDING:
+      body = have_body (sc);
+      footers = have_footers (sc->response);
+      if (MHD_NO == encode_header_block (stream,
+                                         MHD_NO,
+                                         (MHD_NO == body) &&
+                                         (MHD_NO == footers)))
+        {
+          stream_reset (stream, ERROR_INTERNAL);
+          return MHD_YES;
+        }
+      if (MHD_YES == body)
+        sc->state = MHD_CONNECTION_NORMAL_BODY_READY;
+      else if (MHD_YES == footers)
+        sc->state = MHD_CONNECTION_FOOTERS_SENDING;
+      else
+        stream_complete (stream);
+      return MHD_YES;
+    case MHD_CONNECTION_NORMAL_BODY_READY:
+      return send_data (stream);
+    case MHD_CONNECTION_FOOTERS_SENDING:
+      if (MHD_NO == encode_header_block (stream,
+                                         MHD_YES,
+                                         MHD_YES))
+        {
+          stream_reset (stream, ERROR_INTERNAL);
+          return MHD_YES;
+        }
+      stream_complete (stream);
+      return MHD_YES;
+    default:
+      return MHD_NO;
+    }
+}
+
+
+/**
+ * Fill the write buffer with the frames of the responses.  Each
+ * stream gets to send one frame in turn; streams that sent go to
+ * the head of the DLL, which is served from the tail, so that the
+ * bandwidth is shared fairly.
+ *
+ * @param session session to process
+ */
+static void
+fill_write_buffer (struct MHD_Http2Session *session)
+{
+  struct MHD_Http2Stream *stream;
+  struct MHD_Http2Stream *prev;
+  struct MHD_Http2Stream *first;
+  int progress;
+
+  if ( (NULL != session->out_block) &&
+       (MHD_NO == flush_header_block (session)) )
+    return;
+  do
+    {
+      progress = MHD_NO;
+      first = NULL;
+      for (stream = session->streams_tail;
+           (NULL != stream) && (stream != first);
+           stream = prev)
+        {
+          prev = stream->prev;
+          if (MHD_NO == stream_output (stream))
+            continue;
+          progress = MHD_YES;
+          DLL_remove (session->streams_head,
+                      session->streams_tail,
+                      stream);
+          DLL_insert (session->streams_head,
+                      session->streams_tail,
+                      stream);
+          if (NULL == first)
+            first = stream;
+          if ( (NULL != session->out_block) &&
+               (MHD_NO == flush_header_block (session)) )
+            return;
+        }
+    }
+  while ( (MHD_YES == progress) &&
+          (write_space (session->connection) > FRAME_HEADER_SIZE) );
+}
+
+
+/**
+ * Destroy the streams that are done.
+ *
+ * @param session session to process
+ */
+static void
+reap_streams (struct MHD_Http2Session *session)
+{
+  struct MHD_Http2Stream *stream;
+  struct MHD_Http2Stream *next;
+
+  next = session->streams_head;
+  while (NULL != (stream = next))
+    {
+      next = stream->next;
+      if ( (MHD_NO == stream->done) ||
+           (MHD_YES == stream->request.suspended) ||
+           ( (NULL != session->out_block) &&
+             (stream->id == session->out_stream) ) )
+        continue;
+      if ( (MHD_NO == stream->reset) &&
+           (MHD_NO == stream->remote_closed) )
+        {
+          /* responded before the request was complete, tell the
+             client to stop sending (RFC 7540, section 8.1) */
+          if (write_space (session->connection) < FRAME_HEADER_SIZE + 4)
+            continue;
+          send_u32 (session, FRAME_RST_STREAM, stream->id, ERROR_NO_ERROR);
+        }
+      stream_destroy (stream, stream->toe);
+    }
+}
+
+
+/**
+ * Resume the streams that were resumed from outside of the event
+ * loop.
+ *
+ * @param session session to process
+ */
+static void
+resume_streams (struct MHD_Http2Session *session)
+{
+  struct MHD_Daemon *daemon = session->connection->daemon;
+  struct MHD_Http2Stream *stream;
+
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  session->resumed = MHD_NO;
+  for (stream = session->streams_head; NULL != stream; stream = stream->next)
+    {
+      if (MHD_NO == stream->request.resuming)
+        continue;
+      stream->request.resuming = MHD_NO;
+      stream->request.suspended = MHD_NO;
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Read frames from the client into the read buffer.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES
+ */
+static int
+http2_handle_read (struct MHD_Connection *connection)
+{
+  ssize_t ret;
+  int err;
+
+  if ( (MHD_CONNECTION_UPGRADE != connection->state) ||
+       (MHD_YES == connection->read_closed) ||
+       (connection->read_buffer_offset == connection->read_buffer_size) )
+    return MHD_YES;
+  ret = connection->recv_cls (connection,
+                              &connection->read_buffer
+                              [connection->read_buffer_offset],
+                              connection->read_buffer_size -
+                              connection->read_buffer_offset);
+  if (0 < ret)
+    {
+      connection->read_buffer_offset += ret;
+      MHD_update_last_activity_ (connection);
+      return MHD_YES;
+    }
+  err = MHD_socket_errno_;
+  if ( (0 > ret) &&
+       ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) ) )
+    return MHD_YES;
+  connection->read_closed = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Send the write buffer to the client.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES
+ */
+static int
+http2_handle_write (struct MHD_Connection *connection)
+{
+  ssize_t ret;
+  int err;
+
+  if ( (MHD_CONNECTION_UPGRADE != connection->state) ||
+       (connection->write_buffer_send_offset ==
+        connection->write_buffer_append_offset) )
+    return MHD_YES;
+  ret = connection->send_cls (connection,
+                              &connection->write_buffer
+                              [connection->write_buffer_send_offset],
+                              connection->write_buffer_append_offset -
+                              connection->write_buffer_send_offset);
+  if (0 < ret)
+    {
+      connection->write_buffer_send_offset += ret;
+      return MHD_YES;
+    }
+  err = MHD_socket_errno_;
+  if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+    return MHD_YES;
+  /* client is gone, nothing more can be delivered */
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = 0;
+  connection->read_closed = MHD_YES;
+  connection->h2->failed = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Process the frames received, run the requests of the streams and
+ * send their responses, and close the connection once it is done.
+ *
+ * @param connection connection to handle
+ * @return #MHD_YES if we should continue to process the
+ *         connection (not dead yet), #MHD_NO if it died
+ */
+static int
+http2_handle_idle (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_Http2Stream *stream;
+  unsigned int timeout;
+  int waiting;
+  int suspended;
+  uint8_t payload[8];
+
+  if (MHD_CONNECTION_UPGRADE != connection->state)
+    return MHD_connection_handle_idle (connection); /* closed by the daemon */
+  connection->in_idle = MHD_YES;
+#if HTTPS_SUPPORT
+  if ( (MHD_YES == connection->tls_read_ready) ||
+       ( (NULL != connection->tls_session) &&
+         (0 != MHD_tls_pending_ (connection)) ) )
+    http2_handle_read (connection);
+#endif
+  if (MHD_YES == session->resumed)
+    resume_streams (session);
+  parse_frames (session);
+  for (stream = session->streams_head; NULL != stream; stream = stream->next)
+    stream_process (stream);
+
+  /* send what we can right away instead of waiting for the next round */
+  fill_write_buffer (session);
+  http2_handle_write (connection);
+  if (connection->write_buffer_send_offset ==
+      connection->write_buffer_append_offset)
+    fill_write_buffer (session);
+  reap_streams (session);
+
+  timeout = connection->connection_timeout;
+  if (NULL != session->streams_head)
+    {
+      /* the timeout only applies to idle connections */
+      MHD_update_last_activity_ (connection);
+    }
+  else if ( (MHD_NO == session->goaway_sent) &&
+            ( (MHD_YES == session->goaway_received) ||
+              ( (0 != timeout) &&
+                (timeout <= MHD_monotonic_sec_counter () -
+                 connection->last_activity) ) ) &&
+            (write_space (connection) >= FRAME_HEADER_SIZE + 8) )
+    {
+      put32 (payload, session->last_stream_id);
+      put32 (&payload[4], ERROR_NO_ERROR);
+      send_control (session, FRAME_GOAWAY, 0, 0, payload, sizeof (payload));
+      session->goaway_sent = MHD_YES;
+      http2_handle_write (connection);
+    }
+  if ( (MHD_YES == connection->read_closed) ||
+       (MHD_YES == session->failed) ||
+       ( (MHD_YES == session->goaway_sent) &&
+         (NULL == session->streams_head) ) )
+    {
+      if ( (MHD_NO == connection->read_closed) &&
+           (connection->write_buffer_send_offset !=
+            connection->write_buffer_append_offset) )
+        {
+          /* flush the GOAWAY frame first */
+          connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+          goto done;
+        }
+      suspended = MHD_NO;
+      for (stream = session->streams_head; NULL != stream; stream = stream->next)
+        {
+          if (MHD_NO == stream->done)
+            {
+              stream->done = MHD_YES;
+              stream->toe = (MHD_YES == connection->read_closed)
+                ? MHD_REQUEST_TERMINATED_READ_ERROR
+                : MHD_REQUEST_TERMINATED_WITH_ERROR;
+            }
+          if (MHD_YES == stream->request.suspended)
+            suspended = MHD_YES;
+        }
+      if (MHD_YES == suspended)
+        {
+          /* like with HTTP/1.x, suspended requests keep the
+             connection until the application resumes them */
+          if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+            MHD_PANIC ("Failed to acquire cleanup mutex\n");
+          session->suspended = MHD_YES;
+          if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+            MHD_PANIC ("Failed to release cleanup mutex\n");
+          connection->in_idle = MHD_NO;
+          MHD_suspend_connection (connection);
+          return MHD_YES;
+        }
+#if HTTPS_SUPPORT
+      if ( (NULL != connection->tls_session) &&
+           (MHD_NO == connection->read_closed) )
+        MHD_tls_bye_ (connection, MHD_TRANSPORT_SHUTDOWN_WRITE);
+#endif
+      MHD_connection_close_ (connection,
+                             (MHD_YES == session->failed)
+                             ? MHD_REQUEST_TERMINATED_WITH_ERROR
+                             : MHD_REQUEST_TERMINATED_COMPLETED_OK);
+      return MHD_connection_handle_idle (connection);
+    }
+
+  waiting = MHD_NO;
+  for (stream = session->streams_head; NULL != stream; stream = stream->next)
+    if ( (MHD_NO == stream->request.suspended) &&
+         (MHD_NO == stream->done) &&
+         ( (MHD_YES == stream->waiting) ||
+           ( (NULL == stream->request.response) &&
+             (MHD_CONNECTION_FOOTERS_RECEIVED == stream->request.state) ) ) )
+      waiting = MHD_YES;
+  if (connection->write_buffer_send_offset !=
+      connection->write_buffer_append_offset)
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+  else if (MHD_YES == waiting)
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+  else
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+ done:
+#if EPOLL_SUPPORT
+  MHD_connection_epoll_ready_ (connection);
+  return MHD_connection_epoll_update_ (connection);
+#else
+  connection->in_idle = MHD_NO;
+  return MHD_YES;
+#endif
+}
+
+
+/**
+ * Create the HTTP/2 session for a connection, taking over the data
+ * received after the HTTP/1.x request (if any).
+ *
+ * @param connection connection to switch to HTTP/2
+ * @return NULL on error (out of memory, too much data)
+ */
+static struct MHD_Http2Session *
+session_create (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session;
+
+  if (connection->read_buffer_offset > BUFFER_SIZE)
+    return NULL;
+  session = malloc (sizeof (struct MHD_Http2Session) + 2 * BUFFER_SIZE);
+  if (NULL == session)
+    return NULL;
+  memset (session, 0, sizeof (struct MHD_Http2Session));
+  session->connection = connection;
+  MHD_hpack_decoder_init_ (&session->decoder);
+  MHD_hpack_encoder_init_ (&session->encoder);
+  session->send_window = DEFAULT_WINDOW;
+  session->recv_window = CONNECTION_WINDOW;
+  session->peer_initial_window = DEFAULT_WINDOW;
+  session->peer_max_frame = MAX_FRAME_SIZE;
+  session->max_header_list = connection->daemon->pool_size / 4;
+  if (0 != connection->read_buffer_offset)
+    memcpy (&session[1],
+            connection->read_buffer,
+            connection->read_buffer_offset);
+  connection->h2 = session;
+  return session;
+}
+
+
+/**
+ * Release a session that was not started.
+ *
+ * @param connection connection of the session
+ */
+static void
+session_abort (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+
+  while (NULL != session->streams_head)
+    stream_destroy (session->streams_head,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+  MHD_hpack_decoder_destroy_ (&session->decoder);
+  MHD_hpack_encoder_destroy_ (&session->encoder);
+  free (session);
+  connection->h2 = NULL;
+}
+
+
+/**
+ * Switch a connection to HTTP/2: release its pool, set up its
+ * buffers and handlers and send our settings.
+ *
+ * @param connection connection with the session created
+ */
+static void
+session_start (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+  struct MHD_Daemon *daemon = connection->daemon;
+  uint8_t settings[18];
+#if defined(TCP_NODELAY)
+  const _MHD_SOCKOPT_BOOL_TYPE on_val = 1;
+#endif
+
+  MHD_pool_destroy (connection->pool);
+  connection->pool = NULL;
+  connection->headers_received = NULL;
+  connection->headers_received_tail = NULL;
+  connection->method = NULL;
+  connection->url = NULL;
+  connection->version = MHD_HTTP_VERSION_2_0;
+  connection->read_buffer = (char *) &session[1];
+  connection->read_buffer_size = BUFFER_SIZE;
+  connection->write_buffer = &connection->read_buffer[BUFFER_SIZE];
+  connection->write_buffer_size = BUFFER_SIZE;
+  connection->write_buffer_send_offset = 0;
+  connection->state = MHD_CONNECTION_UPGRADE;
+  connection->read_handler = &http2_handle_read;
+  connection->write_handler = &http2_handle_write;
+  connection->idle_handler = &http2_handle_idle;
+  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+#if defined(TCP_NODELAY)
+  /* we always write as much as we have, the small frames of
+     flow control and of short responses must not be delayed */
+  (void) setsockopt (connection->socket_fd,
+                     IPPROTO_TCP,
+                     TCP_NODELAY,
+                     (const void *) &on_val,
+                     sizeof (on_val));
+#endif
+  settings[0] = 0;
+  settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+  put32 (&settings[2], daemon->http2_max_streams);
+  settings[6] = 0;
+  settings[7] = SETTINGS_MAX_HEADER_LIST_SIZE;
+  put32 (&settings[8], (uint32_t) session->max_header_list);
+  settings[12] = 0;
+  settings[13] = SETTINGS_ENABLE_PUSH;
+  put32 (&settings[14], 0);
+  send_control (session, FRAME_SETTINGS, 0, 0, settings, sizeof (settings));
+  send_u32 (session,
+            FRAME_WINDOW_UPDATE,
+            0,
+            CONNECTION_WINDOW - DEFAULT_WINDOW);
+  MHD_update_last_activity_ (connection);
+}
+
+
+/**
+ * Check if the data received on a new connection starts with the
+ * HTTP/2 connection preface (prior knowledge, RFC 7540, section
+ * 3.4), and if so switch the connection to HTTP/2.
+ *
+ * @param connection connection in state #MHD_CONNECTION_INIT
+ * @return #MHD_YES if the connection now speaks HTTP/2 (or was
+ *         closed trying to), #MHD_NO to continue with HTTP/1.x
+ */
+int
+MHD_http2_detect_ (struct MHD_Connection *connection)
+{
+#if HTTPS_SUPPORT
+  if (NULL != connection->tls_session)
+    return MHD_NO; /* only via ALPN */
+#endif
+  if ( (connection->read_buffer_offset < 4) ||
+       (0 != memcmp (connection->read_buffer, CLIENT_PREFACE, 4)) )
+    return MHD_NO;
+  if (NULL == session_create (connection))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Failed to set up HTTP/2 connection\n");
+#endif
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_WITH_ERROR);
+      return MHD_YES;
+    }
+  connection->write_buffer_append_offset = 0;
+  session_start (connection);
+  return MHD_YES;
+}
+
+
+/**
+ * Decode base64url without padding, as used for "HTTP2-Settings".
+ *
+ * @param src string to decode
+ * @param[out] dst where to write the result, must have room for
+ *        3/4 of the length of @a src
+ * @return number of bytes written to @a dst, -1 if @a src is malformed
+ */
+static ssize_t
+base64url_decode (const char *src,
+                  uint8_t *dst)
+{
+  uint32_t acc;
+  unsigned int bits;
+  ssize_t n;
+  char c;
+  unsigned int v;
+
+  acc = 0;
+  bits = 0;
+  n = 0;
+  while ('\0' != (c = *src++))
+    {
+      if ( (c >= 'A') && (c <= 'Z') )
+        v = c - 'A';
+      else if ( (c >= 'a') && (c <= 'z') )
+        v = c - 'a' + 26;
+      else if ( (c >= '0') && (c <= '9') )
+        v = c - '0' + 52;
+      else if ('-' == c)
+        v = 62;
+      else if ('_' == c)
+        v = 63;
+      else if ('=' == c)
+        break;
+      else
+        return -1;
+      acc = (acc << 6) | v;
+      bits += 6;
+      if (bits >= 8)
+        {
+          bits -= 8;
+          dst[n++] = (uint8_t) (acc >> bits);
+        }
+    }
+  return n;
+}
+
+
+/**
+ * Copy the headers, arguments and cookies of a request into the
+ * connection of a stream.
+ *
+ * @param connection connection with the request
+ * @param sc connection of the stream
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+static int
+copy_request (struct MHD_Connection *connection,
+              struct MHD_Connection *sc)
+{
+  struct MHD_HTTP_Header *pos;
+  char *key;
+  char *value;
+
+  for (pos = connection->headers_received; NULL != pos; pos = pos->next)
+    {
+      if ( (MHD_HEADER_KIND == pos->kind) &&
+           ( (MHD_str_equal_caseless_ (pos->header,
+                                       MHD_HTTP_HEADER_CONNECTION)) ||
+             (MHD_str_equal_caseless_ (pos->header,
+                                       MHD_HTTP_HEADER_UPGRADE)) ||
+             (MHD_str_equal_caseless_ (pos->header,
+                                       "HTTP2-Settings")) ) )
+        continue;
+      key = pool_strndup (sc, pos->header, strlen (pos->header));
+      value = pool_strndup (sc, pos->value, strlen (pos->value));
+      if ( (NULL == key) ||
+           (NULL == value) ||
+           (MHD_NO == MHD_set_connection_value (sc, pos->kind, key, value)) )
+        return MHD_NO;
+    }
+  sc->method = pool_strndup (sc, connection->method, strlen (connection->method));
+  sc->url = pool_strndup (sc, connection->url, strlen (connection->url));
+  if ( (NULL == sc->method) ||
+       (NULL == sc->url) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Upgrade an HTTP/1.1 request with "Upgrade: h2c" to HTTP/2 (RFC
+ * 7540, section 3.2), turning the request into stream 1.
+ *
+ * @param connection connection in state #MHD_CONNECTION_HEADERS_PROCESSED
+ * @return #MHD_YES if the connection now speaks HTTP/2 (or was
+ *         closed trying to), #MHD_NO to process the request as usual
+ */
+int
+MHD_http2_upgrade_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session;
+  struct MHD_Http2Stream *stream;
+  const char *settings;
+  uint8_t buf[128];
+  ssize_t size;
+
+#if HTTPS_SUPPORT
+  if (NULL != connection->tls_session)
+    return MHD_NO; /* only via ALPN */
+#endif
+  settings = MHD_lookup_connection_value (connection,
+                                          MHD_HEADER_KIND,
+                                          "HTTP2-Settings");
+  if ( (NULL == settings) ||
+       (0 != connection->remaining_upload_size) ||
+       (! MHD_str_equal_caseless_ (connection->version,
+                                   MHD_HTTP_VERSION_1_1)) ||
+       (! MHD_str_has_token_caseless_ (MHD_lookup_connection_value (connection,
+                                                                    MHD_HEADER_KIND,
+                                                                    MHD_HTTP_HEADER_UPGRADE),
+                                       "h2c")) ||
+       (! MHD_str_has_token_caseless_ (MHD_lookup_connection_value (connection,
+                                                                    MHD_HEADER_KIND,
+                                                                    MHD_HTTP_HEADER_CONNECTION),
+                                       "HTTP2-Settings")) ||
+       (strlen (settings) > sizeof (buf) * 4 / 3) ||
+       (0 > (size = base64url_decode (settings, buf))) ||
+       (0 != size % 6) )
+    return MHD_NO;
+  session = session_create (connection);
+  if (NULL == session)
+    return MHD_NO;
+  stream = stream_create (session, 1);
+  if ( (NULL == stream) ||
+       (MHD_NO == copy_request (connection, &stream->request)) ||
+       (MHD_NO == apply_settings (session, buf, size)) )
+    {
+      session_abort (connection);
+      return MHD_NO;
+    }
+  /* the request is now the one of stream 1 */
+  stream->request.client_context = connection->client_context;
+  connection->client_context = NULL;
+  stream->request.state = MHD_CONNECTION_HEADERS_PROCESSED;
+  stream->remote_closed = MHD_YES;
+  session->last_stream_id = 1;
+  session->settings_received = MHD_YES;
+  connection->write_buffer_append_offset = strlen (SWITCHING_PROTOCOLS);
+  session_start (connection);
+  memcpy (connection->write_buffer,
+          SWITCHING_PROTOCOLS,
+          strlen (SWITCHING_PROTOCOLS));
+  return MHD_YES;
+}
+
+
+#if HTTPS_SUPPORT
+/**
+ * Offer HTTP/2 via ALPN on a new TLS session.
+ *
+ * @param connection connection with the TLS session to set up
+ */
+void
+MHD_http2_tls_init_ (struct MHD_Connection *connection)
+{
+  static const char protocols[] = "\x02h2\x08http/1.1";
+
+  MHD_tls_set_alpn_ (connection,
+                     protocols,
+                     sizeof (protocols) - 1);
+}
+
+
+/**
+ * Switch a connection to HTTP/2 if the client selected it via ALPN
+ * during the TLS handshake that just completed.
+ *
+ * @param connection connection that completed the handshake
+ * @return #MHD_YES if the connection now speaks HTTP/2 (or was
+ *         closed trying to), #MHD_NO to continue with HTTP/1.x
+ */
+int
+MHD_http2_alpn_negotiated_ (struct MHD_Connection *connection)
+{
+  const char *protocol;
+  size_t size;
+
+  if ( (MHD_YES != MHD_tls_get_alpn_ (connection,
+                                      &protocol,
+                                      &size)) ||
+       (2 != size) ||
+       (0 != memcmp (protocol, "h2", 2)) )
+    return MHD_NO;
+  if (NULL == session_create (connection))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Failed to set up HTTP/2 connection\n");
+#endif
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_WITH_ERROR);
+      return MHD_YES;
+    }
+  connection->write_buffer_append_offset = 0;
+  session_start (connection);
+  return MHD_YES;
+}
+#endif
+
+
+/**
+ * Suspend the stream of an HTTP/2 request.  Called by
+ * #MHD_suspend_connection() for the connection of a stream.
+ *
+ * @param connection the connection of the stream
+ */
+void
+MHD_http2_suspend_stream_ (struct MHD_Connection *connection)
+{
+  connection->suspended = MHD_YES;
+}
+
+
+/**
+ * Resume the stream of an HTTP/2 request.  Called by
+ * #MHD_resume_connection() for the connection of a stream; may be
+ * called from any thread.
+ *
+ * @param connection the connection of the stream
+ */
+void
+MHD_http2_resume_stream_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2_stream->session;
+  struct MHD_Daemon *daemon = connection->daemon;
+  int signal;
+  int resume;
+
+  signal = MHD_NO;
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  connection->resuming = MHD_YES;
+  session->resumed = MHD_YES;
+  resume = session->suspended;
+  session->suspended = MHD_NO;
+  if ( (MHD_NO == resume) &&
+       (MHD_NO == session->in_wakeup) )
+    {
+      /* signal only once per round of the event loop */
+      signal = (NULL == daemon->h2_wakeup_head);
+      DLL_insert (daemon->h2_wakeup_head,
+                  daemon->h2_wakeup_tail,
+                  session);
+      session->in_wakeup = MHD_YES;
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  if (MHD_YES == resume)
+    {
+      /* the connection waited for its suspended streams to close */
+      MHD_resume_connection (session->connection);
+      return;
+    }
+  if ( (signal) &&
+       (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
+       (1 != MHD_pipe_write_ (daemon->wpipe[1], "w", 1)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "failed to signal resume via pipe");
+#endif
+    }
+}
+
+
+/**
+ * Process the HTTP/2 connections of @a daemon that had streams
+ * resumed from outside of the event loop, making sure that the
+ * event loop looks at them.
+ *
+ * @param daemon daemon to process
+ */
+void
+MHD_http2_wakeup_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Http2Session *session;
+
+  if (NULL == daemon->h2_wakeup_head)
+    return; /* racy, but we will be signalled again */
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  while (NULL != (session = daemon->h2_wakeup_head))
+    {
+      DLL_remove (daemon->h2_wakeup_head,
+                  daemon->h2_wakeup_tail,
+                  session);
+      session->in_wakeup = MHD_NO;
+#if EPOLL_SUPPORT
+      /* the other event loops look at all connections anyway */
+      if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+           (0 == (session->connection->epoll_state &
+                  (MHD_EPOLL_STATE_IN_EREADY_EDLL | MHD_EPOLL_STATE_SUSPENDED))) )
+        {
+          EDLL_insert (daemon->eready_head,
+                       daemon->eready_tail,
+                       session->connection);
+          session->connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+        }
+#endif
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Release the HTTP/2 session of a connection that is being
+ * destroyed, notifying the application about the requests that
+ * were still in progress.
+ *
+ * @param connection the connection to clean up
+ */
+void
+MHD_http2_cleanup_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_Http2Stream *stream;
+
+  if (NULL == session)
+    return;
+  while (NULL != (stream = session->streams_head))
+    stream_destroy (stream,
+                    (MHD_YES == stream->done)
+                    ? stream->toe
+                    : ( (MHD_YES == daemon->shutdown)
+                        ? MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN
+                        : MHD_REQUEST_TERMINATED_WITH_ERROR ));
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_YES == session->in_wakeup)
+    DLL_remove (daemon->h2_wakeup_head,
+                daemon->h2_wakeup_tail,
+                session);
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  MHD_hpack_decoder_destroy_ (&session->decoder);
+  MHD_hpack_encoder_destroy_ (&session->encoder);
+  free (session->in_block);
+  free (session->out_block);
+  connection->read_buffer = NULL;
+  connection->read_buffer_size = 0;
+  connection->read_buffer_offset = 0;
+  connection->write_buffer = NULL;
+  connection->write_buffer_size = 0;
+  free (session);
+  connection->h2 = NULL;
+}
+
+/* end of http2.c */
@@ -0,0 +1,122 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file http2.h
+ * @brief  HTTP/2 (RFC 7540) handled in the event loop of the daemon
+ * @author Christian Grothoff
+ */
+
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include "internal.h"
+
+
+/**
+ * Check if the data received on a new connection starts with the
+ * HTTP/2 connection preface (prior knowledge, RFC 7540, section
+ * 3.4), and if so switch the connection to HTTP/2.
+ *
+ * @param connection connection in state #MHD_CONNECTION_INIT
+ * @return #MHD_YES if the connection now speaks HTTP/2 (or was
+ *         closed trying to), #MHD_NO to continue with HTTP/1.x
+ */
+int
+MHD_http2_detect_ (struct MHD_Connection *connection);
+
+
+/**
+ * Upgrade an HTTP/1.1 request with "Upgrade: h2c" to HTTP/2 (RFC
+ * 7540, section 3.2), turning the request into stream 1.
+ *
+ * @param connection connection in state #MHD_CONNECTION_HEADERS_PROCESSED
+ * @return #MHD_YES if the connection now speaks HTTP/2 (or was
+ *         closed trying to), #MHD_NO to process the request as usual
+ */
+int
+MHD_http2_upgrade_ (struct MHD_Connection *connection);
+
+
+#if HTTPS_SUPPORT
+/**
+ * Offer HTTP/2 via ALPN on a new TLS session.
+ *
+ * @param connection connection with the TLS session to set up
+ */
+void
+MHD_http2_tls_init_ (struct MHD_Connection *connection);
+
+
+/**
+ * Switch a connection to HTTP/2 if the client selected it via ALPN
+ * during the TLS handshake that just completed.
+ *
+ * @param connection connection that completed the handshake
+ * @return #MHD_YES if the connection now speaks HTTP/2 (or was
+ *         closed trying to), #MHD_NO to continue with HTTP/1.x
+ */
+int
+MHD_http2_alpn_negotiated_ (struct MHD_Connection *connection);
+#endif
+
+
+/**
+ * Suspend the stream of an HTTP/2 request.  Called by
+ * #MHD_suspend_connection() for the connection of a stream.
+ *
+ * @param connection the connection of the stream
+ */
+void
+MHD_http2_suspend_stream_ (struct MHD_Connection *connection);
+
+
+/**
+ * Resume the stream of an HTTP/2 request.  Called by
+ * #MHD_resume_connection() for the connection of a stream; may be
+ * called from any thread.
+ *
+ * @param connection the connection of the stream
+ */
+void
+MHD_http2_resume_stream_ (struct MHD_Connection *connection);
+
+
+/**
+ * Process the HTTP/2 connections of @a daemon that had streams
+ * resumed from outside of the event loop, making sure that the
+ * event loop looks at them.
+ *
+ * @param daemon daemon to process
+ */
+void
+MHD_http2_wakeup_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Release the HTTP/2 session of a connection that is being
+ * destroyed, notifying the application about the requests that
+ * were still in progress.
+ *
+ * @param connection the connection to clean up
+ */
+void
+MHD_http2_cleanup_ (struct MHD_Connection *connection);
+
+#endif
@@ -74,6 +74,8 @@ MHD_state_to_string (enum MHD_CONNECTION_STATE state)
       return "footers sending";
     case MHD_CONNECTION_FOOTERS_SENT:
       return "footers sent";
+    case MHD_CONNECTION_UPGRADE:
+      return "upgrade";
     case MHD_CONNECTION_CLOSED:
       return "closed";
     case MHD_TLS_CONNECTION_INIT:
@@ -31,11 +31,15 @@
 #include "microhttpd.h"
 #include "platform_interface.h"
 #if HTTPS_SUPPORT
+#if MHD_TLS_OPENSSL
+#include <openssl/ssl.h>
+#else
 #include <gnutls/gnutls.h>
 #if GNUTLS_VERSION_MAJOR >= 3
 #include <gnutls/abstract.h>
 #endif
 #endif
+#endif
 #if EPOLL_SUPPORT
 #include <sys/epoll.h>
 #endif
@@ -180,24 +184,26 @@ enum MHD_ConnectionEventLoopInfo
 
 
 /**
- * A structure representing the internal holder of the
- * nonce-nc map.
+ * Table remembering the nonce counters of the nonces handed out
+ * for digest authentication (see digestauth.c).
  */
-struct MHD_NonceNc
-{
+struct MHD_NonceTable;
 
-  /**
-   * Nonce counter, a value that increases for each subsequent
-   * request for the same nonce.
-   */
-  uint64_t nc;
+/**
+ * Cache of the basic authentication credentials verified by the
+ * application (see basicauth.c).
+ */
+struct MHD_BasicAuthCache;
 
-  /**
-   * Nonce value:
-   */
-  char nonce[MAX_NONCE_LENGTH];
+/**
+ * Cache of TLS sessions for resumption (see tlscache.c).
+ */
+struct MHD_TlsSessionCache;
 
-};
+/**
+ * Threads running TLS handshakes (see tlshandshake.c).
+ */
+struct MHD_TlsHandshakePool;
 
 #ifdef HAVE_MESSAGES
 /**
@@ -326,6 +332,140 @@ struct MHD_Response
    */
   enum MHD_ResponseFlags flags;
 
+#ifdef HAVE_ZLIB
+  /**
+   * Compressed variants of this (buffer) response, created on
+   * demand and indexed by `enum MHD_CompressionCoding`.
+   */
+  struct MHD_Response *compressed[2];
+
+  /**
+   * Bitmask of codings (1 << `enum MHD_CompressionCoding`) for which
+   * compression was found to be useless (no size reduction).
+   */
+  unsigned int compress_useless;
+#endif
+
+  /**
+   * Function to call to hand over the connection to another
+   * protocol after the response header was sent, NULL if this
+   * is not an upgrade response.
+   */
+  MHD_UpgradeHandler upgrade_handler;
+
+  /**
+   * Closure for @e upgrade_handler.
+   */
+  void *upgrade_handler_cls;
+
+  /**
+   * Function to call when the WebSocket is open, for responses
+   * created by #MHD_create_response_for_websocket().
+   */
+  MHD_WebSocketOpenCallback ws_open_cb;
+
+  /**
+   * Function to call for each message received on the WebSocket,
+   * NULL if this is not a WebSocket response.
+   */
+  MHD_WebSocketMessageCallback ws_message_cb;
+
+  /**
+   * Function to call when the WebSocket is closed.
+   */
+  MHD_WebSocketCloseCallback ws_close_cb;
+
+  /**
+   * Closure for the WebSocket callbacks.
+   */
+  void *ws_cls;
+
+  /**
+   * Address of the upstream server the request is forwarded to,
+   * NULL if this is not a proxy response.
+   */
+  struct sockaddr *proxy_addr;
+
+  /**
+   * Number of bytes in @e proxy_addr.
+   */
+  socklen_t proxy_addr_len;
+
+  /**
+   * Request target to send to the upstream server, NULL to forward
+   * the URL of the request.
+   */
+  char *proxy_url;
+
+};
+
+
+/**
+ * State of a connection that was taken over by another protocol
+ * after an upgrade response was sent.
+ */
+struct MHD_UpgradeResponseHandle
+{
+
+  /**
+   * The connection that was upgraded.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * For HTTPS, our end of the socket pair used to exchange the
+   * plaintext with the application; #MHD_INVALID_SOCKET otherwise.
+   */
+  MHD_socket mhd_sock;
+
+  /**
+   * For HTTPS, the end of the socket pair given to the application;
+   * #MHD_INVALID_SOCKET otherwise.
+   */
+  MHD_socket app_sock;
+
+  /**
+   * Set to #MHD_YES once the application performed
+   * #MHD_UPGRADE_ACTION_CLOSE (possibly from another thread).
+   */
+  volatile int was_closed;
+
+  /**
+   * For HTTPS, set to #MHD_YES once the application stopped sending
+   * (we read EOF from @e mhd_sock).
+   */
+  int app_eof;
+
+  /**
+   * For HTTPS, set to #MHD_YES once the client stopped sending
+   * (or the TLS session failed).
+   */
+  int client_eof;
+
+  /**
+   * For HTTPS, set to #MHD_YES once we signalled EOF to the
+   * application by shutting down @e mhd_sock for writing.
+   */
+  int app_shut;
+
+  /**
+   * For HTTPS, set to #MHD_YES if sending to the client failed;
+   * data from the application is then discarded.
+   */
+  int tls_failed;
+
+  /**
+   * For HTTPS, #MHD_YES if the event loop should watch @e mhd_sock
+   * for reading (we have room for data from the application).
+   */
+  int app_read_wanted;
+
+  /**
+   * For HTTPS, #MHD_YES if the event loop should watch @e mhd_sock
+   * for writing (we have data from the client for the application).
+   */
+  int app_write_wanted;
+
 };
 
 
@@ -447,12 +587,18 @@ enum MHD_CONNECTION_STATE
   MHD_CONNECTION_FOOTERS_SENT = MHD_CONNECTION_FOOTERS_SENDING + 1,
 
   /**
-   * 19: This connection is to be closed.
+   * 19: We have sent an upgrade response header, the socket
+   * is now used by another protocol.
+   */
+  MHD_CONNECTION_UPGRADE = MHD_CONNECTION_FOOTERS_SENT + 1,
+
+  /**
+   * 20: This connection is to be closed.
    */
-  MHD_CONNECTION_CLOSED = MHD_CONNECTION_FOOTERS_SENT + 1,
+  MHD_CONNECTION_CLOSED = MHD_CONNECTION_UPGRADE + 1,
 
   /**
-   * 20: This connection is finished (only to be freed)
+   * 21: This connection is finished (only to be freed)
    */
   MHD_CONNECTION_IN_CLEANUP = MHD_CONNECTION_CLOSED + 1,
 
@@ -528,6 +674,20 @@ struct MHD_Connection
   struct MHD_Connection *prevE;
 #endif
 
+#if HTTPS_SUPPORT
+  /**
+   * Next pointer for the TDLL listing connections with data
+   * waiting inside of TLS.
+   */
+  struct MHD_Connection *nextT;
+
+  /**
+   * Previous pointer for the TDLL listing connections with data
+   * waiting inside of TLS.
+   */
+  struct MHD_Connection *prevT;
+#endif
+
   /**
    * Next pointer for the DLL describing our IO state.
    */
@@ -841,11 +1001,65 @@ struct MHD_Connection
    */
   TransmitCallback send_cls;
 
+  /**
+   * Custom transport used instead of @e socket_fd for I/O (which
+   * then only signals readiness); @e transport.recv is NULL if the
+   * connection uses its socket.
+   */
+  struct MHD_Transport transport;
+
+  /**
+   * Closure for the functions of @e transport.
+   */
+  void *transport_cls;
+
 #if HTTPS_SUPPORT
   /**
    * State required for HTTPS/SSL/TLS support.
    */
+#if MHD_TLS_OPENSSL
+  SSL *tls_session;
+
+  /**
+   * Function receiving the encrypted data of @e tls_session.
+   */
+  ReceiveCallback tls_pull;
+
+  /**
+   * Function sending the encrypted data of @e tls_session.
+   */
+  TransmitCallback tls_push;
+
+  /**
+   * Plaintext collected while the session is corked (one record),
+   * NULL if the session was never corked.
+   */
+  char *tls_cork_buffer;
+
+  /**
+   * Number of bytes in @e tls_cork_buffer.
+   */
+  size_t tls_cork_size;
+
+  /**
+   * Number of bytes given to the write of @e tls_session that has to
+   * be repeated as the socket was not ready, 0 if none.
+   */
+  size_t tls_write_pending;
+
+  /**
+   * Application protocols offered via ALPN (in wire format),
+   * NULL for none.
+   */
+  const char *tls_alpn;
+
+  /**
+   * Number of bytes in @e tls_alpn.
+   */
+  size_t tls_alpn_size;
+#else
   gnutls_session_t tls_session;
+#endif
 
   /**
    * Memory location to return for protocol session info.
@@ -858,10 +1072,29 @@ struct MHD_Connection
   int cipher;
 
   /**
-   * Could it be that we are ready to read due to TLS buffers
-   * even though the socket is not?
+   * Is decrypted data waiting inside of TLS (so that we are ready to
+   * read even though the socket is not)?  If so, the connection is
+   * in the TDLL of its daemon (unless we use a thread per connection).
    */
   int tls_read_ready;
+
+  /**
+   * #MHD_YES while the TLS session is corked, that is while the
+   * beginning of a response is collected so that it can be sent
+   * in a single record.
+   */
+  int tls_corked;
+
+  /**
+   * Number of bytes sent since the connection was established or
+   * was last idle (determines the size of the TLS records).
+   */
+  uint64_t tls_bytes_sent;
+
+  /**
+   * Last time (monotonic seconds) data was sent on the connection.
+   */
+  time_t tls_last_send;
 #endif
 
   /**
@@ -873,6 +1106,80 @@ struct MHD_Connection
    * Is the connection wanting to resume?
    */
   int resuming;
+
+  /**
+   * Entry of the response cache for which this connection runs the
+   * access handler (the response it queues will be cached), or NULL.
+   */
+  struct MHD_ResponseCacheEntry *cache_entry;
+
+  /**
+   * Entry of the response cache this connection is suspended on,
+   * waiting for another connection to produce the response, or NULL.
+   */
+  struct MHD_ResponseCacheEntry *cache_wait;
+
+  /**
+   * Next connection waiting on @e cache_wait.
+   */
+  struct MHD_Connection *cache_waiter_next;
+
+  /**
+   * State of the upgrade if the connection was taken over by
+   * another protocol, NULL otherwise.
+   */
+  struct MHD_UpgradeResponseHandle *urh;
+
+  /**
+   * WebSocket handled in the event loop if the connection was
+   * upgraded with a WebSocket response, NULL otherwise.
+   */
+  struct MHD_WebSocket *ws;
+
+  /**
+   * HTTP/2 session if the connection speaks HTTP/2, NULL otherwise.
+   */
+  struct MHD_Http2Session *h2;
+
+  /**
+   * If this connection is an HTTP/2 stream as seen by the
+   * application, the stream; NULL for connections with a socket.
+   */
+  struct MHD_Http2Stream *h2_stream;
+
+  /**
+   * State of the forwarding if the request is proxied to an upstream
+   * server, NULL otherwise.
+   */
+  struct MHD_Proxy *proxy;
+
+  /**
+   * For proxied requests, the socket of the upstream connection
+   * that the event loop should watch, #MHD_INVALID_SOCKET if none.
+   */
+  MHD_socket proxy_sock;
+
+  /**
+   * #MHD_YES if the event loop should watch @e proxy_sock for reading.
+   */
+  int proxy_read_wanted;
+
+  /**
+   * #MHD_YES if the event loop should watch @e proxy_sock for writing.
+   */
+  int proxy_write_wanted;
+
+  /**
+   * Handler for the current request: the handler of the matching
+   * route if the daemon has a router, otherwise the daemon's default
+   * handler.  Set before the first call to the handler.
+   */
+  MHD_AccessHandlerCallback handler;
+
+  /**
+   * Closure for @e handler.
+   */
+  void *handler_cls;
 };
 
 /**
@@ -1169,6 +1476,60 @@ struct MHD_Daemon
    */
   int resuming;
 
+  /**
+   * Head of DLL of WebSockets that had frames queued from outside
+   * of the event loop (protected by @e cleanup_connection_mutex).
+   */
+  struct MHD_WebSocket *ws_wakeup_head;
+
+  /**
+   * Tail of DLL of WebSockets that had frames queued from outside
+   * of the event loop (protected by @e cleanup_connection_mutex).
+   */
+  struct MHD_WebSocket *ws_wakeup_tail;
+
+  /**
+   * Head of DLL of HTTP/2 sessions with streams resumed from outside
+   * of the event loop (protected by @e cleanup_connection_mutex).
+   */
+  struct MHD_Http2Session *h2_wakeup_head;
+
+  /**
+   * Tail of DLL of HTTP/2 sessions with streams resumed from outside
+   * of the event loop (protected by @e cleanup_connection_mutex).
+   */
+  struct MHD_Http2Session *h2_wakeup_tail;
+
+  /**
+   * Head of DLL of subscribers of event channels that were evicted
+   * from outside of the event loop and whose connections must be
+   * closed (protected by @e cleanup_connection_mutex).
+   */
+  struct EventSubscriber *evicted_head;
+
+  /**
+   * Tail of DLL of subscribers of event channels that were evicted
+   * from outside of the event loop and whose connections must be
+   * closed (protected by @e cleanup_connection_mutex).
+   */
+  struct EventSubscriber *evicted_tail;
+
+  /**
+   * Head of DLL of idle connections to upstream servers kept for
+   * proxied requests, most recently used first.
+   */
+  struct MHD_ProxyUpstream *proxy_pool_head;
+
+  /**
+   * Tail of DLL of idle connections to upstream servers.
+   */
+  struct MHD_ProxyUpstream *proxy_pool_tail;
+
+  /**
+   * Number of connections in the DLL at @e proxy_pool_head.
+   */
+  unsigned int proxy_pool_count;
+
   /**
    * Number of active parallel connections.
    */
@@ -1202,35 +1563,60 @@ struct MHD_Daemon
   uint16_t port;
 
 #if HTTPS_SUPPORT
+#if MHD_TLS_OPENSSL
+  /**
+   * Credentials and settings for new TLS sessions, including the
+   * session cache.  Shared by all worker threads.
+   */
+  SSL_CTX *tls_context;
+#else
   /**
    * Desired cipher algorithms.
    */
   gnutls_priority_t priority_cache;
 
   /**
-   * What kind of credentials are we offering
-   * for SSL/TLS?
+   * Server x509 credentials
    */
-  gnutls_credentials_type_t cred_type;
+  gnutls_certificate_credentials_t x509_cred;
 
+#if GNUTLS_VERSION_MAJOR >= 3
   /**
-   * Server x509 credentials
+   * Function that can be used to obtain the certificate.  Needed
+   * for SNI support.  See #MHD_OPTION_HTTPS_CERT_CALLBACK.
    */
-  gnutls_certificate_credentials_t x509_cred;
+  gnutls_certificate_retrieve_function2 *cert_callback;
+#endif
 
   /**
-   * Diffie-Hellman parameters
+   * Our Diffie-Hellman parameters.
    */
   gnutls_dh_params_t dh_params;
 
-#if GNUTLS_VERSION_MAJOR >= 3
   /**
-   * Function that can be used to obtain the certificate.  Needed
-   * for SNI support.  See #MHD_OPTION_HTTPS_CERT_CALLBACK.
+   * #MHD_YES if we have initialized @e dh_params.
    */
-  gnutls_certificate_retrieve_function2 *cert_callback;
+  int have_dhparams;
+
+  /**
+   * Cache of TLS sessions for resumption, NULL if disabled.
+   * Shared by all worker threads.
+   */
+  struct MHD_TlsSessionCache *tls_session_cache;
+
+  /**
+   * Master key for session tickets (data is NULL if tickets are
+   * disabled).  Shared by all worker threads.
+   */
+  gnutls_datum_t tls_ticket_key;
 #endif
 
+  /**
+   * Desired cipher algorithms (in the syntax of the TLS library),
+   * NULL for the default.
+   */
+  const char *https_priorities;
+
   /**
    * Pointer to our SSL/TLS key (in ASCII) in memory.
    */
@@ -1252,22 +1638,55 @@ struct MHD_Daemon
   const char *https_mem_trust;
 
   /**
-   * Our Diffie-Hellman parameters in memory.
+   * Our Diffie-Hellman parameters (in ASCII) in memory.
    */
-  gnutls_dh_params_t https_mem_dhparams;
+  const char *https_mem_dhparams;
 
   /**
-   * #MHD_YES if we have initialized @e https_mem_dhparams.
+   * Maximum number of sessions in the cache of TLS sessions,
+   * 0 to disable the cache.
    */
-  int have_dhparams;
+  unsigned int tls_session_cache_size;
 
   /**
-   * For how many connections do we have 'tls_read_ready' set to MHD_YES?
-   * Used to avoid O(n) traversal over all connections when determining
-   * event-loop timeout (as it needs to be zero if there is any connection
-   * which might have ready data within TLS).
+   * Number of seconds TLS sessions can be resumed.
    */
-  unsigned int num_tls_read_ready;
+  unsigned int tls_session_timeout;
+
+  /**
+   * #MHD_YES if clients may resume sessions with session tickets.
+   */
+  int tls_tickets;
+
+  /**
+   * Threads running the handshakes of new connections, NULL if
+   * handshakes run on the threads of the daemon.  Shared by all
+   * worker threads.
+   */
+  struct MHD_TlsHandshakePool *tls_handshake_pool;
+
+  /**
+   * Number of threads in @e tls_handshake_pool, 0 to disable it.
+   */
+  unsigned int tls_handshake_threads;
+
+  /**
+   * Head of TDLL of connections that have 'tls_read_ready' set to
+   * MHD_YES.  Used to avoid O(n) traversal over all connections when
+   * determining the event-loop timeout (as it needs to be zero if
+   * a connection can read data waiting within TLS), and to process
+   * exactly these connections in epoll mode, where they do not get
+   * an event for that data.  The select() and poll() loops only use
+   * it for the timeout: they visit every connection after each
+   * round anyway, and #call_handlers() treats 'tls_read_ready' as
+   * readable.
+   */
+  struct MHD_Connection *tls_ready_head;
+
+  /**
+   * Tail of TDLL of connections that have 'tls_read_ready' set.
+   */
+  struct MHD_Connection *tls_ready_tail;
 
 #endif
 
@@ -1279,14 +1698,9 @@ struct MHD_Daemon
   const char *digest_auth_random;
 
   /**
-   * An array that contains the map nonce-nc.
-   */
-  struct MHD_NonceNc *nnc;
-
-  /**
-   * A rw-lock for synchronizing access to `nnc'.
+   * The map nonce-nc, shared by all worker threads.
    */
-  MHD_mutex_ nnc_lock;
+  struct MHD_NonceTable *nonce_table;
 
   /**
    * Size of `digest_auth_random.
@@ -1294,12 +1708,33 @@ struct MHD_Daemon
   size_t digest_auth_rand_size;
 
   /**
-   * Size of the nonce-nc array.
+   * Number of entries of the nonce-nc map.
    */
   unsigned int nonce_nc_size;
 
 #endif
 
+#ifdef BAUTH_SUPPORT
+
+  /**
+   * Cache of verified basic authentication credentials, NULL if
+   * disabled.  Shared by all worker threads.
+   */
+  struct MHD_BasicAuthCache *basic_auth_cache;
+
+  /**
+   * Number of seconds verified credentials are cached, 0 to
+   * disable the cache.
+   */
+  unsigned int basic_auth_cache_ttl;
+
+  /**
+   * Maximum number of entries in @e basic_auth_cache.
+   */
+  unsigned int basic_auth_cache_size;
+
+#endif
+
 #ifdef TCP_FASTOPEN
   /**
    * The queue size for incoming SYN + DATA packets.
@@ -1312,6 +1747,64 @@ struct MHD_Daemon
    */
   unsigned int listen_backlog_size;
 
+  /**
+   * Cache of responses produced by the access handler, NULL if
+   * disabled.  Shared by the master daemon and its workers.
+   */
+  struct MHD_ResponseCache *response_cache;
+
+  /**
+   * Number of seconds responses are cached, 0 to disable the cache.
+   */
+  unsigned int response_cache_ttl;
+
+  /**
+   * Maximum number of entries in @e response_cache.
+   */
+  unsigned int response_cache_size;
+
+  /**
+   * Request headers that are part of the key of @e response_cache.
+   */
+  const char *response_cache_vary;
+
+#if defined(HAVE_POSTPROCESSOR) && defined(MHD_HAVE_COND_)
+  /**
+   * Thread writing the files of post processors with
+   * #MHD_POST_SPOOL_THREAD.  Shared by the master daemon and its
+   * workers.
+   */
+  struct MHD_PostWriter *post_writer;
+#endif
+
+  /**
+   * Router dispatching requests to handlers, NULL to always
+   * use @e default_handler.
+   */
+  struct MHD_Router *router;
+
+  /**
+   * Interval (in seconds) for keepalive pings on WebSockets,
+   * 0 to not send any.
+   */
+  unsigned int websocket_ping_interval;
+
+  /**
+   * Maximum number of bytes queued on a WebSocket, 0 for no limit.
+   */
+  size_t websocket_max_pending;
+
+  /**
+   * Maximum number of concurrent streams on an HTTP/2 connection.
+   */
+  unsigned int http2_max_streams;
+
+  /**
+   * Maximum number of idle upstream connections kept for proxied
+   * requests, 0 to not reuse them.
+   */
+  unsigned int proxy_pool_size;
+
   /**
    *  Number of thread from threadpool
    */
@@ -1455,6 +1948,46 @@ struct MHD_Daemon
   (element)->prevE = NULL; } while (0)
 
 
+/**
+ * Insert an element at the head of a TDLL. Assumes that head, tail and
+ * element are structs with prevT and nextT fields.
+ *
+ * @param head pointer to the head of the TDLL
+ * @param tail pointer to the tail of the TDLL
+ * @param element element to insert
+ */
+#define TDLL_insert(head,tail,element) do { \
+  (element)->nextT = (head); \
+  (element)->prevT = NULL; \
+  if ((tail) == NULL) \
+    (tail) = element; \
+  else \
+    (head)->prevT = element; \
+  (head) = (element); } while (0)
+
+
+/**
+ * Remove an element from a TDLL. Assumes
+ * that head, tail and element are structs
+ * with prevT and nextT fields.
+ *
+ * @param head pointer to the head of the TDLL
+ * @param tail pointer to the tail of the TDLL
+ * @param element element to remove
+ */
+#define TDLL_remove(head,tail,element) do { \
+  if ((element)->prevT == NULL) \
+    (head) = (element)->nextT;  \
+  else \
+    (element)->prevT->nextT = (element)->nextT; \
+  if ((element)->nextT == NULL) \
+    (tail) = (element)->prevT;  \
+  else \
+    (element)->nextT->prevT = (element)->prevT; \
+  (element)->nextT = NULL; \
+  (element)->prevT = NULL; } while (0)
+
+
 /**
  * Convert all occurrences of '+' to ' '.
  *
@@ -1504,4 +2037,54 @@ MHD_parse_arguments_ (struct MHD_Connection *connection,
 		      unsigned int *num_headers);
 
 
+/**
+ * Signature of main function for a thread.
+ *
+ * @param cls closure argument for the function
+ * @return termination code from the thread
+ */
+typedef MHD_THRD_RTRN_TYPE_
+(MHD_THRD_CALL_SPEC_ *MHD_ThreadStartRoutine_)(void *cls);
+
+
+/**
+ * Change socket options to be non-blocking.
+ *
+ * @param daemon daemon context (for logging)
+ * @param sock socket to manipulate
+ * @return #MHD_YES if succeeded, #MHD_NO otherwise
+ */
+int
+MHD_socket_nonblocking_ (struct MHD_Daemon *daemon,
+                         MHD_socket sock);
+
+
+/**
+ * Change socket options to be non-inheritable.
+ *
+ * @param daemon daemon context (for logging)
+ * @param sock socket to manipulate
+ * @return #MHD_YES if succeeded, #MHD_NO otherwise
+ */
+int
+MHD_socket_noninheritable_ (struct MHD_Daemon *daemon,
+                            MHD_socket sock);
+
+
+/**
+ * Create a thread and set the attributes according to our options.
+ *
+ * @param thread handle to initialize
+ * @param daemon daemon with options, NULL for the default attributes
+ * @param start_routine main function of thread
+ * @param arg argument for start_routine
+ * @return 0 on success
+ */
+int
+MHD_create_thread_ (MHD_thread_handle_ *thread,
+                    const struct MHD_Daemon *daemon,
+                    MHD_ThreadStartRoutine_ start_routine,
+                    void *arg);
+
+
 #endif
@@ -0,0 +1,231 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file mhd_shardtable.c
+ * @brief  hash tables of fixed size, split into separately locked shards
+ * @author Christian Grothoff
+ */
+
+#include "mhd_shardtable.h"
+#include "mhd_mono_clock.h"
+#if HTTPS_SUPPORT
+#include "tls.h"
+#endif
+
+
+/**
+ * Set the hash key of a table.
+ *
+ * @param table the table
+ * @param seed secret data to derive the key from if the TLS
+ *        library cannot provide one, may be NULL
+ * @param seed_size number of bytes in @a seed
+ */
+static void
+init_key (struct MHD_ShardTable *table,
+          const void *seed,
+          size_t seed_size)
+{
+  struct
+  {
+    const void *table;
+    time_t now;
+    time_t mono;
+    uint64_t seed;
+  } entropy;
+  uint64_t k;
+  unsigned int i;
+
+#if HTTPS_SUPPORT
+  if (MHD_YES == MHD_tls_random_ (table->key,
+                                  sizeof (table->key)))
+    return;
+#endif
+  /* without a secure generator, the key is derived from what we
+     have; the address and the time can be guessed, so the key is
+     only unpredictable with a secret @a seed */
+  memset (table->key, 0, sizeof (table->key));
+  memset (&entropy, 0, sizeof (entropy));
+  entropy.table = table;
+  entropy.now = time (NULL);
+  entropy.mono = MHD_monotonic_sec_counter ();
+  if (NULL != seed)
+    entropy.seed = MHD_siphash_ (table->key, seed, seed_size);
+  for (i = 0; i < SIPHASH_KEY_SIZE; i += sizeof (k))
+    {
+      k = MHD_siphash_ (table->key, &entropy, sizeof (entropy));
+      memcpy (&table->key[i], &k, sizeof (k));
+      entropy.seed ^= k;
+    }
+}
+
+
+/**
+ * Initialize a table with zeroed entries.  The hash key is taken from
+ * the generator of the TLS library if there is one, and otherwise
+ * derived from @a seed.
+ *
+ * @param[out] table table to initialize
+ * @param size total number of entries
+ * @param entry_size number of bytes of each entry
+ * @param probe_limit maximum number of slots looked at for an entry;
+ *        the table is only split where shards keep at least this
+ *        many slots
+ * @param seed secret data to derive the hash key from if the TLS
+ *        library cannot provide one, may be NULL
+ * @param seed_size number of bytes in @a seed
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_shard_table_init_ (struct MHD_ShardTable *table,
+                       unsigned int size,
+                       size_t entry_size,
+                       unsigned int probe_limit,
+                       const void *seed,
+                       size_t seed_size)
+{
+  unsigned int i;
+
+  memset (table, 0, sizeof (struct MHD_ShardTable));
+  if (0 == size)
+    return MHD_NO;
+  table->entry_size = entry_size;
+  table->probe_limit = probe_limit;
+  table->num_shards = 1;
+  while ( (table->num_shards < MHD_SHARD_TABLE_MAX_SHARDS) &&
+          (size / (table->num_shards * 2) >= probe_limit) )
+    table->num_shards *= 2;
+  for (i = 0; i < table->num_shards; i++)
+    {
+      struct MHD_Shard *shard = &table->shards[i];
+
+      shard->size = size / table->num_shards
+        + ((i < size % table->num_shards) ? 1 : 0);
+      if ( (NULL == (shard->slots = calloc (shard->size,
+                                            entry_size))) ||
+           (MHD_YES != MHD_mutex_create_ (&shard->lock)) )
+        {
+          free (shard->slots);
+          table->num_shards = i;
+          MHD_shard_table_deinit_ (table, NULL);
+          return MHD_NO;
+        }
+    }
+  init_key (table, seed, seed_size);
+  return MHD_YES;
+}
+
+
+/**
+ * Release the resources of a table.
+ *
+ * @param table table initialized with #MHD_shard_table_init_()
+ * @param release function to call for each entry, may be NULL
+ */
+void
+MHD_shard_table_deinit_ (struct MHD_ShardTable *table,
+                         MHD_ShardEntryCallback_ release)
+{
+  struct MHD_Shard *shard;
+  unsigned int i;
+  unsigned int j;
+
+  for (i = 0; i < table->num_shards; i++)
+    {
+      shard = &table->shards[i];
+      if (NULL != release)
+        for (j = 0; j < shard->size; j++)
+          release (&shard->slots[j * table->entry_size]);
+      free (shard->slots);
+      (void) MHD_mutex_destroy_ (&shard->lock);
+    }
+  table->num_shards = 0;
+}
+
+
+/**
+ * Compute the hash of data with the key of a table.
+ *
+ * @param table the table
+ * @param data data to hash
+ * @param size number of bytes in @a data
+ * @return keyed hash of @a data
+ */
+uint64_t
+MHD_shard_table_hash_ (const struct MHD_ShardTable *table,
+                       const void *data,
+                       size_t size)
+{
+  return MHD_siphash_ (table->key, data, size);
+}
+
+
+/**
+ * Lock the shard for a hash and advance its clock.
+ *
+ * @param table the table
+ * @param hash hash of the entry (from #MHD_shard_table_hash_())
+ * @param[out] probe set to the slots to look at for @a hash
+ */
+void
+MHD_shard_table_lock_ (struct MHD_ShardTable *table,
+                       uint64_t hash,
+                       struct MHD_ShardProbe *probe)
+{
+  struct MHD_Shard *shard;
+
+  /* high bits select the shard, low bits the slot */
+  shard = &table->shards[(hash >> 32) & (table->num_shards - 1)];
+  probe->shard = shard;
+  probe->entry_size = table->entry_size;
+  probe->off = (uint32_t) hash % shard->size;
+  probe->limit = (shard->size < table->probe_limit)
+    ? shard->size : table->probe_limit;
+  (void) MHD_mutex_lock_ (&shard->lock);
+  shard->clock++;
+}
+
+
+/**
+ * Get one of the slots to look at for a hash.
+ *
+ * @param probe slots from #MHD_shard_table_lock_()
+ * @param i index of the slot, less than the @e limit of @a probe
+ * @return the entry in the slot
+ */
+void *
+MHD_shard_probe_slot_ (const struct MHD_ShardProbe *probe,
+                       unsigned int i)
+{
+  return &probe->shard->slots[((probe->off + i) % probe->shard->size)
+                              * probe->entry_size];
+}
+
+
+/**
+ * Unlock the shard locked with #MHD_shard_table_lock_().
+ *
+ * @param probe slots from #MHD_shard_table_lock_()
+ */
+void
+MHD_shard_probe_unlock_ (struct MHD_ShardProbe *probe)
+{
+  (void) MHD_mutex_unlock_ (&probe->shard->lock);
+}
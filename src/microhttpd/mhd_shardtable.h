@@ -0,0 +1,231 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file mhd_shardtable.h
+ * @brief  hash tables of fixed size, split into separately locked shards
+ * @author Christian Grothoff
+ *
+ * Entries are placed by a keyed hash (SipHash), so that clients
+ * cannot make them collide, into one of several shards that are
+ * locked separately, so that threads rarely contend.  Within a shard
+ * an entry is looked for in a few slots after the one selected by
+ * the hash (open addressing); what an entry is and which entry is
+ * replaced when all of these slots are taken is up to the user of
+ * the table.
+ */
+
+#ifndef MHD_SHARDTABLE_H
+#define MHD_SHARDTABLE_H
+
+#include "internal.h"
+#include "siphash.h"
+
+/**
+ * Maximum number of shards of a table.  Must be a power of two.
+ */
+#define MHD_SHARD_TABLE_MAX_SHARDS 16
+
+
+/**
+ * Independently locked part of a table.
+ */
+struct MHD_Shard
+{
+
+  /**
+   * Protects the entries of the shard and @e clock.
+   */
+  MHD_mutex_ lock;
+
+  /**
+   * Entries of the shard.
+   */
+  char *slots;
+
+  /**
+   * Number of entries at @e slots.
+   */
+  unsigned int size;
+
+  /**
+   * Counter incremented for each lookup in the shard, to tell which
+   * entries were used least recently.
+   */
+  uint32_t clock;
+
+};
+
+
+/**
+ * Hash table split into shards.
+ */
+struct MHD_ShardTable
+{
+
+  /**
+   * Key for hashing entries.
+   */
+  uint8_t key[SIPHASH_KEY_SIZE];
+
+  /**
+   * Number of bytes of each entry.
+   */
+  size_t entry_size;
+
+  /**
+   * Maximum number of slots looked at for an entry.
+   */
+  unsigned int probe_limit;
+
+  /**
+   * Number of shards used, a power of two.
+   */
+  unsigned int num_shards;
+
+  /**
+   * The shards.
+   */
+  struct MHD_Shard shards[MHD_SHARD_TABLE_MAX_SHARDS];
+
+};
+
+
+/**
+ * Slots of a table to look at for a hash, in a locked shard.
+ */
+struct MHD_ShardProbe
+{
+
+  /**
+   * The shard, locked.
+   */
+  struct MHD_Shard *shard;
+
+  /**
+   * Number of bytes of each entry.
+   */
+  size_t entry_size;
+
+  /**
+   * Index of the first slot in the shard.
+   */
+  unsigned int off;
+
+  /**
+   * Number of slots to look at.
+   */
+  unsigned int limit;
+
+};
+
+
+/**
+ * Function called for each entry of a table that is destroyed.
+ *
+ * @param entry the entry
+ */
+typedef void
+(*MHD_ShardEntryCallback_) (void *entry);
+
+
+/**
+ * Initialize a table with zeroed entries.  The hash key is taken from
+ * the generator of the TLS library if there is one, and otherwise
+ * derived from @a seed.
+ *
+ * @param[out] table table to initialize
+ * @param size total number of entries
+ * @param entry_size number of bytes of each entry
+ * @param probe_limit maximum number of slots looked at for an entry;
+ *        the table is only split where shards keep at least this
+ *        many slots
+ * @param seed secret data to derive the hash key from if the TLS
+ *        library cannot provide one, may be NULL
+ * @param seed_size number of bytes in @a seed
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_shard_table_init_ (struct MHD_ShardTable *table,
+                       unsigned int size,
+                       size_t entry_size,
+                       unsigned int probe_limit,
+                       const void *seed,
+                       size_t seed_size);
+
+
+/**
+ * Release the resources of a table.
+ *
+ * @param table table initialized with #MHD_shard_table_init_()
+ * @param release function to call for each entry, may be NULL
+ */
+void
+MHD_shard_table_deinit_ (struct MHD_ShardTable *table,
+                         MHD_ShardEntryCallback_ release);
+
+
+/**
+ * Compute the hash of data with the key of a table.
+ *
+ * @param table the table
+ * @param data data to hash
+ * @param size number of bytes in @a data
+ * @return keyed hash of @a data
+ */
+uint64_t
+MHD_shard_table_hash_ (const struct MHD_ShardTable *table,
+                       const void *data,
+                       size_t size);
+
+
+/**
+ * Lock the shard for a hash and advance its clock.
+ *
+ * @param table the table
+ * @param hash hash of the entry (from #MHD_shard_table_hash_())
+ * @param[out] probe set to the slots to look at for @a hash
+ */
+void
+MHD_shard_table_lock_ (struct MHD_ShardTable *table,
+                       uint64_t hash,
+                       struct MHD_ShardProbe *probe);
+
+
+/**
+ * Get one of the slots to look at for a hash.
+ *
+ * @param probe slots from #MHD_shard_table_lock_()
+ * @param i index of the slot, less than the @e limit of @a probe
+ * @return the entry in the slot
+ */
+void *
+MHD_shard_probe_slot_ (const struct MHD_ShardProbe *probe,
+                       unsigned int i);
+
+
+/**
+ * Unlock the shard locked with #MHD_shard_table_lock_().
+ *
+ * @param probe slots from #MHD_shard_table_lock_()
+ */
+void
+MHD_shard_probe_unlock_ (struct MHD_ShardProbe *probe);
+
+#endif /* !MHD_SHARDTABLE_H */
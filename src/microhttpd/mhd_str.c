@@ -32,6 +32,7 @@
 #endif
 
 #include "mhd_limits.h"
+#include <string.h>
 
 /*
  * Block of functions/macros that use US-ASCII charset as required by HTTP
@@ -595,3 +596,97 @@ MHD_strx_to_uint64_n_ (const char * str, size_t maxlen, uint64_t * out_val)
     *out_val = res;
   return i;
 }
+
+
+/**
+ * Check whether a list of content codings, as found in the value of
+ * an "Accept-Encoding" header, allows the use of @a coding.
+ * Codings listed with a quality value of zero ("q=0") are not
+ * acceptable; the wildcard "*" matches any coding that is not
+ * listed explicitly (RFC 7231, section 5.3.4).
+ * @param accept value of the "Accept-Encoding" header, may be NULL
+ * @param coding name of the coding to check, like "gzip"
+ * @return non-zero if @a coding is acceptable, zero otherwise
+ */
+int
+MHD_str_accepts_coding_ (const char * accept, const char * coding)
+{
+  const size_t coding_len = strlen (coding);
+  const char *token;
+  size_t token_len;
+  int zero_q;
+  int wildcard;
+
+  if (!accept)
+    return 0;
+  wildcard = 0;
+  while (1)
+    {
+      while (' ' == *accept || '\t' == *accept || ',' == *accept)
+        accept++;
+      if (0 == *accept)
+        return wildcard;
+      token = accept;
+      while (0 != *accept && ',' != *accept && ';' != *accept &&
+             ' ' != *accept && '\t' != *accept)
+        accept++;
+      token_len = accept - token;
+      zero_q = 0;
+      while (0 != *accept && ',' != *accept)
+        {
+          if ('q' == toasciilower (*accept) && '=' == accept[1] &&
+              '0' == accept[2])
+            {
+              accept += 3;
+              if ('.' == *accept)
+                accept++;
+              while ('0' == *accept)
+                accept++;
+              zero_q = (0 == *accept || ',' == *accept ||
+                        ';' == *accept || ' ' == *accept || '\t' == *accept);
+              continue;
+            }
+          accept++;
+        }
+      if (token_len == coding_len &&
+          MHD_str_equal_caseless_n_ (token, coding, coding_len))
+        return !zero_q;
+      if (1 == token_len && '*' == token[0])
+        wildcard = !zero_q;
+    }
+}
+
+
+/**
+ * Check whether a comma-separated list of tokens, as found in the
+ * value of headers like "Connection" or "Upgrade", contains @a token.
+ * Tokens are compared caseless, parameters of tokens are ignored.
+ * @param list value of the header, may be NULL
+ * @param token token to look for, like "upgrade"
+ * @return non-zero if @a token is in @a list, zero otherwise
+ */
+int
+MHD_str_has_token_caseless_ (const char * list, const char * token)
+{
+  const size_t token_len = strlen (token);
+  const char *start;
+
+  if (!list)
+    return 0;
+  while (1)
+    {
+      while (' ' == *list || '\t' == *list || ',' == *list)
+        list++;
+      if (0 == *list)
+        return 0;
+      start = list;
+      while (0 != *list && ',' != *list && ';' != *list &&
+             ' ' != *list && '\t' != *list)
+        list++;
+      if ( (token_len == (size_t)(list - start)) &&
+           MHD_str_equal_caseless_n_ (start, token, token_len) )
+        return !0;
+      while (0 != *list && ',' != *list)
+        list++;
+    }
+}
@@ -186,4 +186,31 @@ MHD_strx_to_uint64_n_ (const char * str,
                        size_t maxlen,
                        uint64_t * out_val);
 
+
+/**
+ * Check whether a list of content codings, as found in the value of
+ * an "Accept-Encoding" header, allows the use of @a coding.
+ * Codings listed with a quality value of zero ("q=0") are not
+ * acceptable; the wildcard "*" matches any coding.
+ * @param accept value of the "Accept-Encoding" header, may be NULL
+ * @param coding name of the coding to check, like "gzip"
+ * @return non-zero if @a coding is acceptable, zero otherwise
+ */
+int
+MHD_str_accepts_coding_ (const char * accept,
+                         const char * coding);
+
+
+/**
+ * Check whether a comma-separated list of tokens, as found in the
+ * value of headers like "Connection" or "Upgrade", contains @a token.
+ * Tokens are compared caseless, parameters of tokens are ignored.
+ * @param list value of the header, may be NULL
+ * @param token token to look for, like "upgrade"
+ * @return non-zero if @a token is in @a list, zero otherwise
+ */
+int
+MHD_str_has_token_caseless_ (const char * list,
+                             const char * token);
+
 #endif /* MHD_STR_H */
@@ -24,6 +24,7 @@
  */
 
 #include "internal.h"
+#include "postprocessor.h"
 #include "mhd_str.h"
 
 /**
@@ -96,6 +97,64 @@ enum RN_State
 };
 
 
+/**
+ * States of the JSON tokenizer (while the PP is in #PP_Init).
+ */
+enum JSON_State
+{
+  /**
+   * Expecting a value.
+   */
+  JSON_Value = 0,
+
+  /**
+   * After '{', expecting a key or '}'.
+   */
+  JSON_ObjectStart,
+
+  /**
+   * After '[', expecting a value or ']'.
+   */
+  JSON_ArrayStart,
+
+  /**
+   * After ',' in an object, expecting a key.
+   */
+  JSON_Key,
+
+  /**
+   * In the string of a key.
+   */
+  JSON_KeyString,
+
+  /**
+   * After a key, expecting ':'.
+   */
+  JSON_Colon,
+
+  /**
+   * In a string value.
+   */
+  JSON_String,
+
+  /**
+   * In a number.
+   */
+  JSON_Number,
+
+  /**
+   * In "true", "false" or "null".
+   */
+  JSON_Literal,
+
+  /**
+   * After a value, expecting ',', the end of the container or
+   * (at the top level) the end of the body.
+   */
+  JSON_AfterValue
+};
+
+
 /**
  * Bits for the globally known fields that
  * should not be deleted when we exit the
@@ -111,6 +170,179 @@ enum NE_State
 };
 
 
+/**
+ * Default number of bytes written at once to spooled files.
+ */
+#define SPOOL_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * Spooled files are written in multiples of this many bytes.
+ */
+#define SPOOL_ALIGNMENT 4096
+
+
+/**
+ * State for writing file uploads to temporary files
+ * (see #MHD_post_processor_spool_files()).
+ */
+struct PostSpool
+{
+
+#ifdef MHD_HAVE_COND_
+  /**
+   * Next spool in the queue of @e writer.
+   */
+  struct PostSpool *job_next;
+#endif
+
+  /**
+   * Function to call for each complete file.
+   */
+  MHD_PostFileCallback cb;
+
+  /**
+   * Extra argument to @e cb.
+   */
+  void *cb_cls;
+
+  /**
+   * Directory for the files.
+   */
+  char *dir;
+
+  /**
+   * Name of the file being written, NULL if none.
+   */
+  char *path;
+
+  /**
+   * Buffers for collecting the data; the second one is only
+   * used with a background thread (which writes one buffer
+   * while the other one is filled).
+   */
+  char *chunk[2];
+
+  /**
+   * Size of each of the @e chunk buffers.
+   */
+  size_t chunk_size;
+
+  /**
+   * Number of bytes in the buffer being filled.
+   */
+  size_t fill;
+
+  /**
+   * Number of bytes of the file so far.
+   */
+  uint64_t size;
+
+  /**
+   * Index of the buffer being filled.
+   */
+  unsigned int cur;
+
+  /**
+   * Descriptor of the file being written.
+   */
+  int fd;
+
+  /**
+   * Set to #MHD_YES once a write failed.
+   */
+  int io_error;
+
+  /**
+   * Set to #MHD_YES if processing stopped because the background
+   * thread was still busy with the other buffer.
+   */
+  int blocked;
+
+#ifdef MHD_HAVE_COND_
+  /**
+   * Writer of the daemon that writes the buffers in the background;
+   * its lock protects the fields below (except @e use_thread).
+   */
+  struct MHD_PostWriter *writer;
+
+  /**
+   * Data the thread is to write (or writing).
+   */
+  const char *job_data;
+
+  /**
+   * Number of bytes at @e job_data.
+   */
+  size_t job_size;
+
+  /**
+   * File to write @e job_data to.
+   */
+  int job_fd;
+
+  /**
+   * #MHD_YES while the thread has a job (queued or being written).
+   */
+  int busy;
+
+  /**
+   * #MHD_YES if we use a background thread.
+   */
+  int use_thread;
+#endif
+
+};
+
+
+#ifdef MHD_HAVE_COND_
+/**
+ * Thread of a daemon writing the buffers of all of its spools with
+ * #MHD_POST_SPOOL_THREAD, one job after the other; the number of
+ * threads thus does not grow with the number of uploads.
+ */
+struct MHD_PostWriter
+{
+
+  /**
+   * Spool with the oldest job.
+   */
+  struct PostSpool *head;
+
+  /**
+   * Spool with the newest job.
+   */
+  struct PostSpool *tail;
+
+  /**
+   * The thread, if @e started.
+   */
+  MHD_thread_handle_ pid;
+
+  /**
+   * Protects the queue, the flags below and the job fields
+   * of the spools.
+   */
+  MHD_mutex_ lock;
+
+  /**
+   * Signalled whenever a job is queued or done, and on @e quit.
+   */
+  MHD_cond_ cond;
+
+  /**
+   * #MHD_YES once the thread was started.
+   */
+  int started;
+
+  /**
+   * #MHD_YES to make the thread terminate.
+   */
+  int quit;
+
+};
+#endif
+
+
 /**
  * Internal state of the post-processor.  Note that the fields
  * are sorted by type to enable optimal packing by the compiler.
@@ -170,12 +402,28 @@ struct MHD_PostProcessor
    */
   char *content_transfer_encoding;
 
+  /**
+   * Where to write file uploads, NULL to pass them to the iterator.
+   */
+  struct PostSpool *spool;
+
   /**
    * Unprocessed value bytes due to escape
    * sequences (URL-encoding only).
    */
   char xbuf[8];
 
+  /**
+   * Skip table for finding the delimiter ("\r\n--" and boundary)
+   * of the primary boundary, see #build_skip_table().
+   */
+  unsigned char boundary_skip[256];
+
+  /**
+   * Skip table for the delimiter of the nested boundary.
+   */
+  unsigned char nested_skip[256];
+
   /**
    * Size of our buffer for the key.
    */
@@ -241,38 +489,107 @@ struct MHD_PostProcessor
    */
   enum NE_State have;
 
+  /**
+   * Types of the enclosing JSON containers, bit @e json_depth - 1
+   * for the innermost one (set for arrays).
+   */
+  uint64_t json_types;
+
+  /**
+   * Number of JSON containers we are in.
+   */
+  unsigned int json_depth;
+
+  /**
+   * Number of bytes of decoded value data in our buffer (after the
+   * path) not yet passed to the iterator.
+   */
+  size_t json_fill;
+
+  /**
+   * Code point of the "\\u" escape being parsed (first character
+   * of the literal being parsed).
+   */
+  uint32_t json_code;
+
+  /**
+   * High surrogate waiting for its low surrogate, 0 if none.
+   */
+  uint32_t json_high;
+
+  /**
+   * Literal being parsed ("true", "false" or "null").
+   */
+  const char *json_literal;
+
+  /**
+   * State of the JSON tokenizer.
+   */
+  enum JSON_State json_state;
+
+  /**
+   * Escape sequence being parsed in a string: 0 for none, 1 after
+   * the backslash, 2-5 for the hex digits of "\\u".
+   */
+  unsigned int json_escape;
+
 };
 
 
 /**
- * Create a `struct MHD_PostProcessor`.
+ * Character @a i of the delimiter that ends a value, "\r\n--"
+ * followed by the boundary.
  *
- * A `struct MHD_PostProcessor` can be used to (incrementally) parse
- * the data portion of a POST request.  Note that some buggy browsers
- * fail to set the encoding type.  If you want to support those, you
- * may have to call #MHD_set_connection_value with the proper encoding
- * type before creating a post processor (if no supported encoding
- * type is set, this function will fail).
+ * @param boundary the boundary
+ * @param i offset into the delimiter
+ * @return the character
+ */
+#define DELIM_CHAR(boundary,i) \
+  ((unsigned char) (((i) < 4) ? "\r\n--"[(i)] : (boundary)[(i) - 4]))
+
+
+/**
+ * Build the table of the Boyer-Moore-Horspool search for the
+ * delimiter of @a boundary: how far the delimiter may be shifted
+ * if the data under its last character is the given character.
+ * Shifts are capped at 255, which keeps the search correct.
  *
- * @param connection the connection on which the POST is
- *        happening (used to determine the POST format)
- * @param buffer_size maximum number of bytes to use for
- *        internal buffering (used only for the parsing,
- *        specifically the parsing of the keys).  A
- *        tiny value (256-1024) should be sufficient.
- *        Do NOT use a value smaller than 256.  For good
- *        performance, use 32 or 64k (i.e. 65536).
- * @param iter iterator to be called with the parsed data,
- *        Must NOT be NULL.
+ * @param skip table to fill
+ * @param boundary the boundary
+ * @param blen strlen(boundary)
+ */
+static void
+build_skip_table (unsigned char *skip,
+                  const char *boundary,
+                  size_t blen)
+{
+  size_t m = blen + 4;
+  size_t i;
+
+  memset (skip, (m > 255) ? 255 : (int) m, 256);
+  for (i = 0; i < m - 1; i++)
+    skip[DELIM_CHAR (boundary, i)] =
+      (m - 1 - i > 255) ? 255 : (unsigned char) (m - 1 - i);
+}
+
+
+/**
+ * Create a `struct MHD_PostProcessor` for the encoding of the
+ * request on @a connection.
+ *
+ * @param connection the connection on which the POST is happening
+ * @param buffer_size maximum number of bytes to use for buffering
+ * @param allow_json #MHD_YES to also accept #MHD_HTTP_POST_ENCODING_JSON
+ * @param iter iterator to be called with the parsed data
  * @param iter_cls first argument to @a iter
  * @return NULL on error (out of memory, unsupported encoding),
  *         otherwise a PP handle
- * @ingroup request
  */
-struct MHD_PostProcessor *
-MHD_create_post_processor (struct MHD_Connection *connection,
-                           size_t buffer_size,
-                           MHD_PostDataIterator iter, void *iter_cls)
+static struct MHD_PostProcessor *
+create_post_processor (struct MHD_Connection *connection,
+                       size_t buffer_size,
+                       int allow_json,
+                       MHD_PostDataIterator iter, void *iter_cls)
 {
   struct MHD_PostProcessor *ret;
   const char *encoding;
@@ -287,7 +604,13 @@ MHD_create_post_processor (struct MHD_Connection *connection,
   if (encoding == NULL)
     return NULL;
   boundary = NULL;
-  if (!MHD_str_equal_caseless_n_ (MHD_HTTP_POST_ENCODING_FORM_URLENCODED, encoding,
+  if ( (MHD_YES == allow_json) &&
+       (MHD_str_equal_caseless_n_ (MHD_HTTP_POST_ENCODING_JSON, encoding,
+                                   strlen (MHD_HTTP_POST_ENCODING_JSON))) )
+    {
+      blen = 0;
+    }
+  else if (!MHD_str_equal_caseless_n_ (MHD_HTTP_POST_ENCODING_FORM_URLENCODED, encoding,
                         strlen (MHD_HTTP_POST_ENCODING_FORM_URLENCODED)))
     {
       if (!MHD_str_equal_caseless_n_ (MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA, encoding,
@@ -301,9 +624,9 @@ MHD_create_post_processor (struct MHD_Connection *connection,
 	return NULL; /* failed to determine boundary */
       boundary += strlen ("boundary=");
       blen = strlen (boundary);
-      if ((blen == 0) || (blen * 2 + 2 > buffer_size))
+      if ((blen == 0) || (blen + 4 > buffer_size))
         return NULL;            /* (will be) out of memory or invalid boundary */
-      if ( (boundary[0] == '"') && (boundary[blen - 1] == '"') )
+      if ( (blen > 2) && (boundary[0] == '"') && (boundary[blen - 1] == '"') )
 	{
 	  /* remove enclosing quotes */
 	  ++boundary;
@@ -327,10 +650,78 @@ MHD_create_post_processor (struct MHD_Connection *connection,
   ret->blen = blen;
   ret->boundary = boundary;
   ret->skip_rn = RN_Inactive;
+  if (NULL != boundary)
+    build_skip_table (ret->boundary_skip, boundary, blen);
   return ret;
 }
 
 
+/**
+ * Create a `struct MHD_PostProcessor`.
+ *
+ * A `struct MHD_PostProcessor` can be used to (incrementally) parse
+ * the data portion of a POST request.  Note that some buggy browsers
+ * fail to set the encoding type.  If you want to support those, you
+ * may have to call #MHD_set_connection_value with the proper encoding
+ * type before creating a post processor (if no supported encoding
+ * type is set, this function will fail).
+ *
+ * @param connection the connection on which the POST is
+ *        happening (used to determine the POST format)
+ * @param buffer_size maximum number of bytes to use for
+ *        internal buffering (used only for the parsing,
+ *        specifically the parsing of the keys).  A
+ *        tiny value (256-1024) should be sufficient.
+ *        Do NOT use a value smaller than 256.  For good
+ *        performance, use 32 or 64k (i.e. 65536).
+ * @param iter iterator to be called with the parsed data,
+ *        Must NOT be NULL.
+ * @param iter_cls first argument to @a iter
+ * @return NULL on error (out of memory, unsupported encoding),
+ *         otherwise a PP handle
+ * @ingroup request
+ */
+struct MHD_PostProcessor *
+MHD_create_post_processor (struct MHD_Connection *connection,
+                           size_t buffer_size,
+                           MHD_PostDataIterator iter, void *iter_cls)
+{
+  return create_post_processor (connection,
+                                buffer_size,
+                                MHD_NO,
+                                iter,
+                                iter_cls);
+}
+
+
+/**
+ * Create a `struct MHD_PostProcessor` that also accepts
+ * #MHD_HTTP_POST_ENCODING_JSON bodies.
+ *
+ * @param connection the connection on which the POST is
+ *        happening (used to determine the POST format)
+ * @param buffer_size maximum number of bytes to use for
+ *        internal buffering, see #MHD_create_post_processor()
+ * @param iter iterator to be called with the parsed data,
+ *        Must NOT be NULL.
+ * @param iter_cls first argument to @a iter
+ * @return NULL on error (out of memory, unsupported encoding),
+ *         otherwise a PP handle
+ * @ingroup request
+ */
+struct MHD_PostProcessor *
+MHD_create_post_processor_json (struct MHD_Connection *connection,
+                                size_t buffer_size,
+                                MHD_PostDataIterator iter, void *iter_cls)
+{
+  return create_post_processor (connection,
+                                buffer_size,
+                                MHD_YES,
+                                iter,
+                                iter_cls);
+}
+
+
 /**
  * Process url-encoded POST data.
  *
@@ -349,8 +740,12 @@ post_process_urlencoded (struct MHD_PostProcessor *pp,
   size_t poff;
   size_t xoff;
   size_t delta;
+  size_t dsize;
   int end_of_value_found;
+  int plain;
+  char c;
   char *buf;
+  char *dbuf;
   char xbuf[XBUF_SIZE + 1];
 
   buf = (char *) &pp[1];
@@ -388,72 +783,107 @@ post_process_urlencoded (struct MHD_PostProcessor *pp,
           pp->value_offset = 0;
           break;
         case PP_ProcessValue:
-          /* obtain rest of value from previous iteration */
-          memcpy (xbuf, pp->xbuf, pp->xbuf_pos);
-          xoff = pp->xbuf_pos;
-          pp->xbuf_pos = 0;
-
-          /* find last position in input buffer that is part of the value */
-          amper = 0;
-          while ((amper + poff < post_data_len) &&
-                 (amper < XBUF_SIZE) &&
-                 (post_data[amper + poff] != '&') &&
-                 (post_data[amper + poff] != '\n') &&
-                 (post_data[amper + poff] != '\r'))
-            amper++;
-          end_of_value_found = ((amper + poff < post_data_len) &&
-                                ((post_data[amper + poff] == '&') ||
-                                 (post_data[amper + poff] == '\n') ||
-                                 (post_data[amper + poff] == '\r')));
-          /* compute delta, the maximum number of bytes that we will be able to
-             process right now (either amper-limited of xbuf-size limited) */
-          delta = amper;
-          if (delta > XBUF_SIZE - xoff)
-            delta = XBUF_SIZE - xoff;
-
-          /* move input into processing buffer */
-          memcpy (&xbuf[xoff], &post_data[poff], delta);
-          xoff += delta;
-          poff += delta;
-
-          /* find if escape sequence is at the end of the processing buffer;
-             if so, exclude those from processing (reduce delta to point at
-             end of processed region) */
-          delta = xoff;
-          if ((delta > 0) && (xbuf[delta - 1] == '%'))
-            delta--;
-          else if ((delta > 1) && (xbuf[delta - 2] == '%'))
-            delta -= 2;
-
-          /* if we have an incomplete escape sequence, save it to
-             pp->xbuf for later */
-          if (delta < xoff)
+          /* find the end of the value (or of the input), and whether
+             there is anything to unescape on the way */
+          amper = poff;
+          plain = MHD_YES;
+          while (amper < post_data_len)
             {
-              memcpy (pp->xbuf, &xbuf[delta], xoff - delta);
-              pp->xbuf_pos = xoff - delta;
-              xoff = delta;
+              c = post_data[amper];
+              if ( ('&' == c) || ('\n' == c) || ('\r' == c) )
+                break;
+              if ( ('%' == c) || ('+' == c) )
+                plain = MHD_NO;
+              amper++;
             }
-
-          /* If we have nothing to do (delta == 0) and
-             not just because the value is empty (are
-             waiting for more data), go for next iteration */
-          if ((xoff == 0) && (poff == post_data_len))
-            continue;
-
-          /* unescape */
-          xbuf[xoff] = '\0';    /* 0-terminate in preparation */
-	  MHD_unescape_plus (xbuf);
-          xoff = MHD_http_unescape (xbuf);
-          /* finally: call application! */
-	  pp->must_ikvi = MHD_NO;
-          if (MHD_NO == pp->ikvi (pp->cls, MHD_POSTDATA_KIND, (const char *) &pp[1],    /* key */
-                                  NULL, NULL, NULL, xbuf, pp->value_offset,
-                                  xoff))
+          end_of_value_found = (amper < post_data_len);
+          if ( (0 == pp->xbuf_pos) &&
+               (MHD_YES == plain) )
             {
-              pp->state = PP_Error;
-              return MHD_NO;
+              /* nothing to unescape: hand the value to the
+                 application as it is */
+              xoff = amper - poff;
+              pp->must_ikvi = MHD_NO;
+              if (MHD_NO == pp->ikvi (pp->cls, MHD_POSTDATA_KIND, (const char *) &pp[1],    /* key */
+                                      NULL, NULL, NULL, &post_data[poff],
+                                      pp->value_offset, xoff))
+                {
+                  pp->state = PP_Error;
+                  return MHD_NO;
+                }
+              pp->value_offset += xoff;
+              poff = amper;
+            }
+          else
+            {
+              /* unescape into the part of our buffer after the key,
+                 or on the stack if the key leaves too little room */
+              dsize = pp->buffer_size - strlen (buf) - 1;
+              if (dsize > XBUF_SIZE)
+                dbuf = &buf[pp->buffer_size - dsize];
+              else
+                {
+                  dbuf = xbuf;
+                  dsize = XBUF_SIZE;
+                }
+              /* obtain rest of value from previous iteration */
+              memcpy (dbuf, pp->xbuf, pp->xbuf_pos);
+              xoff = pp->xbuf_pos;
+              pp->xbuf_pos = 0;
+
+              /* compute delta, the maximum number of bytes that we will be able to
+                 process right now (either amper-limited of buffer-size limited) */
+              delta = amper - poff;
+              if (delta > dsize - xoff)
+                {
+                  delta = dsize - xoff;
+                  end_of_value_found = 0;
+                }
+
+              /* move input into processing buffer */
+              memcpy (&dbuf[xoff], &post_data[poff], delta);
+              xoff += delta;
+              poff += delta;
+
+              /* find if escape sequence is at the end of the processing buffer;
+                 if so, exclude those from processing (reduce delta to point at
+                 end of processed region) */
+              delta = xoff;
+              if ((delta > 0) && (dbuf[delta - 1] == '%'))
+                delta--;
+              else if ((delta > 1) && (dbuf[delta - 2] == '%'))
+                delta -= 2;
+
+              /* if we have an incomplete escape sequence, save it to
+                 pp->xbuf for later */
+              if (delta < xoff)
+                {
+                  memcpy (pp->xbuf, &dbuf[delta], xoff - delta);
+                  pp->xbuf_pos = xoff - delta;
+                  xoff = delta;
+                }
+
+              /* If we have nothing to do (delta == 0) and
+                 not just because the value is empty (are
+                 waiting for more data), go for next iteration */
+              if ((xoff == 0) && (poff == post_data_len))
+                continue;
+
+              /* unescape */
+              dbuf[xoff] = '\0';    /* 0-terminate in preparation */
+              MHD_unescape_plus (dbuf);
+              xoff = MHD_http_unescape (dbuf);
+              /* finally: call application! */
+              pp->must_ikvi = MHD_NO;
+              if (MHD_NO == pp->ikvi (pp->cls, MHD_POSTDATA_KIND, (const char *) &pp[1],    /* key */
+                                      NULL, NULL, NULL, dbuf, pp->value_offset,
+                                      xoff))
+                {
+                  pp->state = PP_Error;
+                  return MHD_NO;
+                }
+              pp->value_offset += xoff;
             }
-          pp->value_offset += xoff;
 
           /* are we done with the value? */
           if (end_of_value_found)
@@ -683,217 +1113,910 @@ process_multipart_headers (struct MHD_PostProcessor *pp,
 
 
 /**
- * We have the value until we hit the given boundary;
- * process accordingly.
+ * Find out how much of @a data is certainly part of a value that
+ * ends with the delimiter "\r\n--" followed by @a boundary.
  *
- * @param pp post processor context
- * @param ioffptr incremented based on the number of bytes processed
+ * Complete delimiters are found with the Boyer-Moore-Horspool
+ * algorithm, which usually advances by the length of the delimiter
+ * per comparison; only the end of @a data, where the delimiter
+ * does not fit anymore, is checked for its beginning.
+ *
+ * @param data value data
+ * @param size number of bytes in @a data
  * @param boundary the boundary to look for
  * @param blen strlen(boundary)
- * @param next_state what state to go into after the
- *        boundary was found
- * @param next_dash_state state to go into if the next
- *        boundary ends with "--"
- * @return #MHD_YES if we can continue processing,
- *         #MHD_NO on error or if we do not have
- *                enough data yet
+ * @param skip skip table for @a boundary
+ * @param[out] found set to #MHD_YES if the delimiter starts at the
+ *        returned offset, to #MHD_NO if the data ends with what
+ *        might be the beginning of the delimiter (or no delimiter
+ *        was found at all)
+ * @return number of bytes of @a data that belong to the value
  */
-static int
-process_value_to_boundary (struct MHD_PostProcessor *pp,
-                           size_t *ioffptr,
-                           const char *boundary,
-                           size_t blen,
-                           enum PP_State next_state,
-                           enum PP_State next_dash_state)
+static size_t
+find_value_end (const char *data,
+                size_t size,
+                const char *boundary,
+                size_t blen,
+                const unsigned char *skip,
+                int *found)
 {
-  char *buf = (char *) &pp[1];
-  size_t newline;
+  const unsigned char *udata = (const unsigned char *) data;
+  const unsigned char last = DELIM_CHAR (boundary, blen + 3);
   const char *r;
-
-  /* all data in buf until the boundary
-     (\r\n--+boundary) is part of the value */
-  newline = 0;
-  while (1)
+  size_t m = blen + 4;
+  size_t pos;
+  size_t avail;
+  unsigned char c;
+
+  *found = MHD_NO;
+  pos = 0;
+  while (pos + m <= size)
     {
-      while (newline + 4 < pp->buffer_pos)
-        {
-          r = memchr (&buf[newline], '\r', pp->buffer_pos - newline - 4);
-          if (NULL == r)
-          {
-            newline = pp->buffer_pos - 4;
-            break;
-          }
-          newline = r - buf;
-          if (0 == memcmp ("\r\n--", &buf[newline], 4))
-            break;
-          newline++;
-        }
-      if (newline + pp->blen + 4 <= pp->buffer_pos)
+      c = udata[pos + m - 1];
+      if ( (last == c) &&
+           (0 == memcmp (&data[pos], "\r\n--", 4)) &&
+           (0 == memcmp (&data[pos + 4], boundary, blen - 1)) )
         {
-          /* can check boundary */
-          if (0 != memcmp (&buf[newline + 4], boundary, pp->blen))
-            {
-              /* no boundary, "\r\n--" is part of content, skip */
-              newline += 4;
-              continue;
-            }
-          else
-            {
-              /* boundary found, process until newline then
-                 skip boundary and go back to init */
-              pp->skip_rn = RN_Dash;
-              pp->state = next_state;
-              pp->dash_state = next_dash_state;
-              (*ioffptr) += pp->blen + 4;       /* skip boundary as well */
-              buf[newline] = '\0';
-              break;
-            }
+          *found = MHD_YES;
+          return pos;
         }
-      else
+      pos += skip[c];
+    }
+  /* no complete delimiter; the data may end with its beginning */
+  if (size >= m)
+    pos = size - m + 1;
+  else
+    pos = 0;
+  while (pos < size)
+    {
+      r = memchr (&data[pos], '\r', size - pos);
+      if (NULL == r)
+        return size;
+      pos = r - data;
+      avail = size - pos;
+      if ( (0 == memcmp (&data[pos],
+                         "\r\n--",
+                         (avail < 4) ? avail : 4)) &&
+           ( (avail <= 4) ||
+             (0 == memcmp (&data[pos + 4],
+                           boundary,
+                           avail - 4)) ) )
+        return pos;
+      pos++;
+    }
+  return size;
+}
+
+
+/**
+ * Write all of a buffer to a file.
+ *
+ * @param fd file to write to
+ * @param data data to write
+ * @param size number of bytes in @a data
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+spool_write (int fd,
+             const char *data,
+             size_t size)
+{
+  ssize_t ret;
+
+  while (0 != size)
+    {
+      ret = write (fd, data, size);
+      if (0 > ret)
         {
-          /* cannot check for boundary, process content that
-             we have and check again later; except, if we have
-             no content, abort (out of memory) */
-          if ((0 == newline) && (pp->buffer_pos == pp->buffer_size))
-            {
-              pp->state = PP_Error;
-              return MHD_NO;
-            }
-          break;
+          if (EINTR == errno)
+            continue;
+          return MHD_NO;
         }
+      data += ret;
+      size -= ret;
     }
-  /* newline is either at beginning of boundary or
-     at least at the last character that we are sure
-     is not part of the boundary */
-  if ( ( (MHD_YES == pp->must_ikvi) ||
-	 (0 != newline) ) &&
-       (MHD_NO == pp->ikvi (pp->cls,
-			    MHD_POSTDATA_KIND,
-			    pp->content_name,
-			    pp->content_filename,
-			    pp->content_type,
-			    pp->content_transfer_encoding,
-			    buf, pp->value_offset, newline)) )
+  return MHD_YES;
+}
+
+
+/**
+ * Result of the spool functions if the background thread is still
+ * busy with the other buffer; processing has to stop and can be
+ * resumed once the thread is done.
+ */
+#define SPOOL_BUSY (-1)
+
+
+#ifdef MHD_HAVE_COND_
+/**
+ * Main function of the thread writing spooled files.
+ *
+ * @param cls the `struct MHD_PostWriter`
+ * @return 0
+ */
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+writer_thread (void *cls)
+{
+  struct MHD_PostWriter *writer = cls;
+  struct PostSpool *spool;
+  int ok;
+
+  if (MHD_YES != MHD_mutex_lock_ (&writer->lock))
+    MHD_PANIC ("Failed to lock mutex\n");
+  while (1)
     {
-      pp->state = PP_Error;
-      return MHD_NO;
+      while ( (NULL == writer->head) &&
+              (MHD_NO == writer->quit) )
+        if (MHD_YES != MHD_cond_wait_ (&writer->cond, &writer->lock))
+          MHD_PANIC ("Failed to wait for condition\n");
+      if (NULL == (spool = writer->head))
+        break;
+      writer->head = spool->job_next;
+      if (NULL == writer->head)
+        writer->tail = NULL;
+      spool->job_next = NULL;
+      if (MHD_YES != MHD_mutex_unlock_ (&writer->lock))
+        MHD_PANIC ("Failed to unlock mutex\n");
+      ok = spool_write (spool->job_fd,
+                        spool->job_data,
+                        spool->job_size);
+      if (MHD_YES != MHD_mutex_lock_ (&writer->lock))
+        MHD_PANIC ("Failed to lock mutex\n");
+      if (MHD_NO == ok)
+        spool->io_error = MHD_YES;
+      spool->busy = MHD_NO;
+      if (MHD_YES != MHD_cond_broadcast_ (&writer->cond))
+        MHD_PANIC ("Failed to signal condition\n");
     }
-  pp->must_ikvi = MHD_NO;
-  pp->value_offset += newline;
-  (*ioffptr) += newline;
-  return MHD_YES;
+  if (MHD_YES != MHD_mutex_unlock_ (&writer->lock))
+    MHD_PANIC ("Failed to unlock mutex\n");
+  return (MHD_THRD_RTRN_TYPE_) 0;
 }
 
 
 /**
+ * Create the writer for the post processors of a daemon that spool
+ * files with #MHD_POST_SPOOL_THREAD.  Its thread is only started
+ * when it is first used.
  *
- * @param pp post processor context
+ * @return NULL on error
  */
-static void
-free_unmarked (struct MHD_PostProcessor *pp)
+struct MHD_PostWriter *
+MHD_post_writer_create_ (void)
 {
-  if ((NULL != pp->content_name) && (0 == (pp->have & NE_content_name)))
+  struct MHD_PostWriter *writer;
+
+  if (NULL == (writer = malloc (sizeof (struct MHD_PostWriter))))
+    return NULL;
+  memset (writer, 0, sizeof (struct MHD_PostWriter));
+  writer->started = MHD_NO;
+  writer->quit = MHD_NO;
+  if (MHD_YES != MHD_mutex_create_ (&writer->lock))
     {
-      free (pp->content_name);
-      pp->content_name = NULL;
+      free (writer);
+      return NULL;
     }
-  if ((NULL != pp->content_type) && (0 == (pp->have & NE_content_type)))
+  if (MHD_YES != MHD_cond_create_ (&writer->cond))
     {
-      free (pp->content_type);
-      pp->content_type = NULL;
+      (void) MHD_mutex_destroy_ (&writer->lock);
+      free (writer);
+      return NULL;
     }
-  if ((NULL != pp->content_filename) &&
-      (0 == (pp->have & NE_content_filename)))
+  return writer;
+}
+
+
+/**
+ * Start the thread of a writer unless it is already running.
+ *
+ * @param writer the writer
+ * @param daemon daemon the writer belongs to
+ * @return #MHD_YES if the thread is running
+ */
+static int
+writer_start (struct MHD_PostWriter *writer,
+              struct MHD_Daemon *daemon)
+{
+  int ret;
+
+  ret = MHD_YES;
+  if (MHD_YES != MHD_mutex_lock_ (&writer->lock))
+    MHD_PANIC ("Failed to lock mutex\n");
+  if (MHD_NO == writer->started)
     {
-      free (pp->content_filename);
-      pp->content_filename = NULL;
+      if (0 == MHD_create_thread_ (&writer->pid,
+                                   daemon,
+                                   &writer_thread,
+                                   writer))
+        writer->started = MHD_YES;
+      else
+        ret = MHD_NO;
     }
-  if ((NULL != pp->content_transfer_encoding) &&
-      (0 == (pp->have & NE_content_transfer_encoding)))
+  if (MHD_YES != MHD_mutex_unlock_ (&writer->lock))
+    MHD_PANIC ("Failed to unlock mutex\n");
+  return ret;
+}
+
+
+/**
+ * Stop the thread of a writer and release it.  There must be no
+ * post processors left that use it.
+ *
+ * @param writer writer to destroy, can be NULL
+ */
+void
+MHD_post_writer_destroy_ (struct MHD_PostWriter *writer)
+{
+  if (NULL == writer)
+    return;
+  if (MHD_YES == writer->started)
     {
-      free (pp->content_transfer_encoding);
-      pp->content_transfer_encoding = NULL;
+      if (MHD_YES != MHD_mutex_lock_ (&writer->lock))
+        MHD_PANIC ("Failed to lock mutex\n");
+      writer->quit = MHD_YES;
+      if (MHD_YES != MHD_cond_broadcast_ (&writer->cond))
+        MHD_PANIC ("Failed to signal condition\n");
+      if (MHD_YES != MHD_mutex_unlock_ (&writer->lock))
+        MHD_PANIC ("Failed to unlock mutex\n");
+      if (0 != MHD_join_thread_ (writer->pid))
+        MHD_PANIC ("Failed to join a thread\n");
     }
+  (void) MHD_cond_destroy_ (&writer->cond);
+  (void) MHD_mutex_destroy_ (&writer->lock);
+  free (writer);
 }
 
 
 /**
- * Decode multipart POST data.
+ * Check if the thread is busy with a job of a spool.
  *
- * @param pp post processor context
- * @param post_data data to decode
- * @param post_data_len number of bytes in @a post_data
- * @return #MHD_NO on error,
+ * @param spool spool with a background thread
+ * @return #MHD_YES if the job of @a spool is not done yet
  */
 static int
-post_process_multipart (struct MHD_PostProcessor *pp,
-                        const char *post_data,
-			size_t post_data_len)
+spool_busy (struct PostSpool *spool)
 {
-  char *buf;
-  size_t max;
-  size_t ioff;
-  size_t poff;
-  int state_changed;
+  int busy;
+
+  if (MHD_YES != MHD_mutex_lock_ (&spool->writer->lock))
+    MHD_PANIC ("Failed to lock mutex\n");
+  busy = spool->busy;
+  if (MHD_YES != MHD_mutex_unlock_ (&spool->writer->lock))
+    MHD_PANIC ("Failed to unlock mutex\n");
+  return busy;
+}
 
-  buf = (char *) &pp[1];
-  ioff = 0;
-  poff = 0;
-  state_changed = 1;
-  while ((poff < post_data_len) ||
-         ((pp->buffer_pos > 0) && (state_changed != 0)))
+
+/**
+ * Wait until the thread finished the job of a spool.
+ *
+ * @param spool spool with a background thread
+ */
+static void
+spool_wait (struct PostSpool *spool)
+{
+  if (MHD_YES != MHD_mutex_lock_ (&spool->writer->lock))
+    MHD_PANIC ("Failed to lock mutex\n");
+  while (MHD_YES == spool->busy)
+    if (MHD_YES != MHD_cond_wait_ (&spool->writer->cond,
+                                   &spool->writer->lock))
+      MHD_PANIC ("Failed to wait for condition\n");
+  if (MHD_YES != MHD_mutex_unlock_ (&spool->writer->lock))
+    MHD_PANIC ("Failed to unlock mutex\n");
+}
+#endif
+
+
+/**
+ * Write the data collected in the current buffer.  With a
+ * background thread, the data is queued for the thread and we
+ * continue with the other buffer; if the thread did not write
+ * that one yet, nothing is done.
+ *
+ * @param spool spool with an open file
+ * @return #MHD_YES on success, #MHD_NO on error,
+ *         #SPOOL_BUSY if the thread is busy
+ */
+static int
+spool_submit (struct PostSpool *spool)
+{
+  if (0 == spool->fill)
+    return MHD_YES;
+#ifdef MHD_HAVE_COND_
+  if (MHD_YES == spool->use_thread)
     {
-      /* first, move as much input data
-         as possible to our internal buffer */
-      max = pp->buffer_size - pp->buffer_pos;
-      if (max > post_data_len - poff)
-        max = post_data_len - poff;
-      memcpy (&buf[pp->buffer_pos], &post_data[poff], max);
-      poff += max;
-      pp->buffer_pos += max;
-      if ((max == 0) && (state_changed == 0) && (poff < post_data_len))
+      struct MHD_PostWriter *writer = spool->writer;
+
+      if (MHD_YES != MHD_mutex_lock_ (&writer->lock))
+        MHD_PANIC ("Failed to lock mutex\n");
+      if (MHD_YES == spool->busy)
         {
-          pp->state = PP_Error;
-          return MHD_NO;        /* out of memory */
+          if (MHD_YES != MHD_mutex_unlock_ (&writer->lock))
+            MHD_PANIC ("Failed to unlock mutex\n");
+          return SPOOL_BUSY;
         }
-      state_changed = 0;
+      spool->job_data = spool->chunk[spool->cur];
+      spool->job_size = spool->fill;
+      spool->job_fd = spool->fd;
+      spool->busy = MHD_YES;
+      spool->job_next = NULL;
+      if (NULL == writer->tail)
+        writer->head = spool;
+      else
+        writer->tail->job_next = spool;
+      writer->tail = spool;
+      if (MHD_YES != MHD_cond_broadcast_ (&writer->cond))
+        MHD_PANIC ("Failed to signal condition\n");
+      if (MHD_YES != MHD_mutex_unlock_ (&writer->lock))
+        MHD_PANIC ("Failed to unlock mutex\n");
+      spool->cur = 1 - spool->cur;
+      spool->fill = 0;
+      return MHD_YES;
+    }
+#endif
+  if (MHD_NO == spool_write (spool->fd,
+                             spool->chunk[spool->cur],
+                             spool->fill))
+    spool->io_error = MHD_YES;
+  spool->fill = 0;
+  return (MHD_YES == spool->io_error) ? MHD_NO : MHD_YES;
+}
 
-      /* first state machine for '\r'-'\n' and '--' handling */
-      switch (pp->skip_rn)
+
+/**
+ * Create the temporary file for the current file upload.
+ *
+ * @param pp post processor context
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+spool_open (struct MHD_PostProcessor *pp)
+{
+  struct PostSpool *spool = pp->spool;
+  size_t len;
+
+  len = strlen (spool->dir);
+  spool->path = malloc (len + sizeof ("/mhd-post-XXXXXX"));
+  if (NULL == spool->path)
+    return MHD_NO;
+  memcpy (spool->path, spool->dir, len);
+  memcpy (&spool->path[len], "/mhd-post-XXXXXX", sizeof ("/mhd-post-XXXXXX"));
+#ifdef HAVE_MKSTEMP
+  spool->fd = mkstemp (spool->path);
+#else
+  spool->fd = -1;
+#endif
+  if (-1 == spool->fd)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (pp->connection->daemon,
+                "Failed to create temporary file in `%s': %s\n",
+                spool->dir,
+                MHD_strerror_ (errno));
+#endif
+      free (spool->path);
+      spool->path = NULL;
+      return MHD_NO;
+    }
+  spool->size = 0;
+  spool->fill = 0;
+  return MHD_YES;
+}
+
+
+/**
+ * Add data of the current file upload to its temporary file.
+ * Full chunks of the data are written without copying them if
+ * we do not use a background thread.  A full buffer is only
+ * submitted once more data arrives.
+ *
+ * @param spool spool with an open file
+ * @param data data to add
+ * @param size number of bytes in @a data
+ * @param[out] done set to the number of bytes of @a data added
+ * @return #MHD_YES on success, #MHD_NO on error,
+ *         #SPOOL_BUSY if only part of the data could be added
+ */
+static int
+spool_append (struct PostSpool *spool,
+              const char *data,
+              size_t size,
+              size_t *done)
+{
+  size_t n;
+  int ret;
+
+  *done = 0;
+  while (0 != size)
+    {
+      if (spool->fill == spool->chunk_size)
         {
-        case RN_Inactive:
-          break;
-        case RN_OptN:
-          if (buf[0] == '\n')
-            {
-              ioff++;
-              pp->skip_rn = RN_Inactive;
-              goto AGAIN;
-            }
-          /* fall-through! */
-        case RN_Dash:
-          if (buf[0] == '-')
-            {
-              ioff++;
-              pp->skip_rn = RN_Dash2;
-              goto AGAIN;
-            }
-          pp->skip_rn = RN_Full;
-          /* fall-through! */
-        case RN_Full:
-          if (buf[0] == '\r')
+          ret = spool_submit (spool);
+          if (MHD_YES != ret)
+            return ret;
+        }
+      if ( (0 == spool->fill) &&
+           (size >= spool->chunk_size)
+#ifdef MHD_HAVE_COND_
+           && (MHD_NO == spool->use_thread)
+#endif
+           )
+        {
+          n = size - size % spool->chunk_size;
+          if (MHD_NO == spool_write (spool->fd, data, n))
             {
-              if ((pp->buffer_pos > 1) && (buf[1] == '\n'))
-                {
-                  pp->skip_rn = RN_Inactive;
-                  ioff += 2;
-                }
-              else
-                {
-                  pp->skip_rn = RN_OptN;
-                  ioff++;
-                }
-              goto AGAIN;
+              spool->io_error = MHD_YES;
+              return MHD_NO;
+            }
+        }
+      else
+        {
+          n = spool->chunk_size - spool->fill;
+          if (n > size)
+            n = size;
+          memcpy (&spool->chunk[spool->cur][spool->fill], data, n);
+          spool->fill += n;
+        }
+      spool->size += n;
+      *done += n;
+      data += n;
+      size -= n;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Release the temporary file of the current file upload, waiting
+ * for the background thread to write what it was given.
+ *
+ * @param spool spool with an open file
+ * @param keep #MHD_NO to remove the file
+ * @return #MHD_YES if all data was written, #MHD_NO on error
+ */
+static int
+spool_close (struct PostSpool *spool,
+             int keep)
+{
+  int ret;
+
+  ret = MHD_YES;
+#ifdef MHD_HAVE_COND_
+  if (MHD_YES == spool->use_thread)
+    spool_wait (spool);
+#endif
+  if ( (MHD_YES == keep) &&
+       (MHD_YES != spool_submit (spool)) )
+    ret = MHD_NO;
+#ifdef MHD_HAVE_COND_
+  if (MHD_YES == spool->use_thread)
+    spool_wait (spool);
+#endif
+  if (MHD_YES == spool->io_error)
+    ret = MHD_NO;
+  if (0 != close (spool->fd))
+    ret = MHD_NO;
+  spool->fd = -1;
+  if ( (MHD_NO == keep) ||
+       (MHD_NO == ret) )
+    (void) unlink (spool->path);
+  return ret;
+}
+
+
+/**
+ * Finish the temporary file of the current file upload and pass it
+ * to the application.
+ *
+ * @param pp post processor context with an open file
+ * @return #MHD_YES on success, #MHD_NO on error,
+ *         #SPOOL_BUSY if the thread did not write all of it yet
+ */
+static int
+spool_finish (struct MHD_PostProcessor *pp)
+{
+  struct PostSpool *spool = pp->spool;
+  int ret;
+
+  /* only close the file once the thread wrote all of it */
+  ret = spool_submit (spool);
+  if (MHD_YES != ret)
+    return ret;
+#ifdef MHD_HAVE_COND_
+  if ( (MHD_YES == spool->use_thread) &&
+       (MHD_YES == spool_busy (spool)) )
+    return SPOOL_BUSY;
+#endif
+  ret = spool_close (spool, MHD_YES);
+  if ( (MHD_YES == ret) &&
+       (MHD_NO == spool->cb (spool->cb_cls,
+                             pp->content_name,
+                             pp->content_filename,
+                             pp->content_type,
+                             pp->content_transfer_encoding,
+                             spool->path,
+                             spool->size)) )
+    ret = MHD_NO;
+  free (spool->path);
+  spool->path = NULL;
+  return ret;
+}
+
+
+/**
+ * Pass value data of a multipart entry on, either to the iterator
+ * or (for file uploads, if enabled) to a temporary file.
+ *
+ * @param pp post processor context
+ * @param data value data
+ * @param size number of bytes in @a data
+ * @param[out] done set to the number of bytes of @a data passed on
+ * @return #MHD_YES on success, #MHD_NO on error,
+ *         #SPOOL_BUSY if only part of the data was passed on
+ */
+static int
+deliver_value (struct MHD_PostProcessor *pp,
+               const char *data,
+               size_t size,
+               size_t *done)
+{
+  int ret;
+
+  *done = 0;
+  if ( (NULL == pp->spool) ||
+       (NULL == pp->content_filename) )
+    {
+      ret = pp->ikvi (pp->cls,
+                      MHD_POSTDATA_KIND,
+                      pp->content_name,
+                      pp->content_filename,
+                      pp->content_type,
+                      pp->content_transfer_encoding,
+                      data, pp->value_offset, size);
+      if (MHD_YES == ret)
+        *done = size;
+      return ret;
+    }
+  if ( (NULL == pp->spool->path) &&
+       (MHD_NO == spool_open (pp)) )
+    return MHD_NO;
+  return spool_append (pp->spool, data, size, done);
+}
+
+
+/**
+ * We have the value until we hit the given boundary;
+ * process accordingly.
+ *
+ * @param pp post processor context
+ * @param ioffptr incremented based on the number of bytes processed
+ * @param boundary the boundary to look for
+ * @param blen strlen(boundary)
+ * @param skip skip table for @a boundary
+ * @param next_state what state to go into after the
+ *        boundary was found
+ * @param next_dash_state state to go into if the next
+ *        boundary ends with "--"
+ * @return #MHD_YES if we can continue processing,
+ *         #MHD_NO on error, if we do not have
+ *                enough data yet or if the spool is busy
+ *                (then the spool is marked @e blocked)
+ */
+static int
+process_value_to_boundary (struct MHD_PostProcessor *pp,
+                           size_t *ioffptr,
+                           const char *boundary,
+                           size_t blen,
+                           const unsigned char *skip,
+                           enum PP_State next_state,
+                           enum PP_State next_dash_state)
+{
+  char *buf = (char *) &pp[1];
+  size_t newline;
+  size_t done;
+  int found;
+  int ret;
+  char saved;
+
+  /* all data in buf until the boundary
+     (\r\n--+boundary) is part of the value */
+  newline = find_value_end (buf,
+                            pp->buffer_pos,
+                            boundary,
+                            blen,
+                            skip,
+                            &found);
+  if ( (MHD_NO == found) &&
+       (0 == newline) &&
+       (pp->buffer_pos == pp->buffer_size) )
+    {
+      /* cannot check for boundary and no content
+         to process: abort (out of memory) */
+      pp->state = PP_Error;
+      return MHD_NO;
+    }
+  /* newline is either at beginning of boundary or
+     at least at the last character that we are sure
+     is not part of the boundary */
+  if ( (MHD_YES == pp->must_ikvi) ||
+       (0 != newline) )
+    {
+      /* terminate the value for the iterator, but keep the
+         boundary intact in case we have to come back */
+      saved = buf[newline];
+      if (MHD_YES == found)
+        buf[newline] = '\0';
+      ret = deliver_value (pp, buf, newline, &done);
+      buf[newline] = saved;
+      if (MHD_NO == ret)
+        {
+          pp->state = PP_Error;
+          return MHD_NO;
+        }
+      if ( (0 != done) ||
+           (MHD_YES == ret) )
+        pp->must_ikvi = MHD_NO;
+      pp->value_offset += done;
+      (*ioffptr) += done;
+      if (SPOOL_BUSY == ret)
+        {
+          pp->spool->blocked = MHD_YES;
+          return MHD_NO;
+        }
+    }
+  if (MHD_NO == found)
+    return MHD_YES;
+  if ( (NULL != pp->spool) &&
+       (NULL != pp->spool->path) )
+    {
+      ret = spool_finish (pp);
+      if (SPOOL_BUSY == ret)
+        {
+          pp->spool->blocked = MHD_YES;
+          return MHD_NO;
+        }
+      if (MHD_NO == ret)
+        {
+          pp->state = PP_Error;
+          return MHD_NO;
+        }
+    }
+  /* boundary found, skip it and go back to init */
+  pp->skip_rn = RN_Dash;
+  pp->state = next_state;
+  pp->dash_state = next_dash_state;
+  (*ioffptr) += blen + 4;
+  return MHD_YES;
+}
+
+
+/**
+ * Pass value data directly from the input of the application to
+ * the iterator, without copying it into our buffer.  Only data
+ * that certainly is not part of the boundary is passed on; the rest
+ * (the boundary or what might be its beginning) is left for the
+ * buffered processing.
+ *
+ * @param pp post processor context, with an empty buffer
+ * @param post_data input data of the application
+ * @param post_data_len number of bytes in @a post_data
+ * @param boundary the boundary to look for
+ * @param blen strlen(boundary)
+ * @param skip skip table for @a boundary
+ * @return number of bytes of @a post_data processed, 0 if none
+ *         (then @e state may be #PP_Error); the spool is marked
+ *         @e blocked if it did not take all of the data
+ */
+static size_t
+process_value_direct (struct MHD_PostProcessor *pp,
+                      const char *post_data,
+                      size_t post_data_len,
+                      const char *boundary,
+                      size_t blen,
+                      const unsigned char *skip)
+{
+  size_t end;
+  size_t done;
+  int found;
+  int ret;
+
+  end = find_value_end (post_data,
+                        post_data_len,
+                        boundary,
+                        blen,
+                        skip,
+                        &found);
+  if (0 == end)
+    return 0;
+  ret = deliver_value (pp, post_data, end, &done);
+  if (MHD_NO == ret)
+    {
+      pp->state = PP_Error;
+      return 0;
+    }
+  if (SPOOL_BUSY == ret)
+    pp->spool->blocked = MHD_YES;
+  if (0 != done)
+    pp->must_ikvi = MHD_NO;
+  pp->value_offset += done;
+  return done;
+}
+
+
+/**
+ *
+ * @param pp post processor context
+ */
+static void
+free_unmarked (struct MHD_PostProcessor *pp)
+{
+  if ((NULL != pp->content_name) && (0 == (pp->have & NE_content_name)))
+    {
+      free (pp->content_name);
+      pp->content_name = NULL;
+    }
+  if ((NULL != pp->content_type) && (0 == (pp->have & NE_content_type)))
+    {
+      free (pp->content_type);
+      pp->content_type = NULL;
+    }
+  if ((NULL != pp->content_filename) &&
+      (0 == (pp->have & NE_content_filename)))
+    {
+      free (pp->content_filename);
+      pp->content_filename = NULL;
+    }
+  if ((NULL != pp->content_transfer_encoding) &&
+      (0 == (pp->have & NE_content_transfer_encoding)))
+    {
+      free (pp->content_transfer_encoding);
+      pp->content_transfer_encoding = NULL;
+    }
+}
+
+
+/**
+ * Check if processing stopped because the background thread
+ * writing file uploads was busy.
+ *
+ * @param pp post processor context
+ */
+#define SPOOL_BLOCKED(pp) \
+  ( (NULL != (pp)->spool) && (MHD_YES == (pp)->spool->blocked) )
+
+
+/**
+ * Decode multipart POST data.
+ *
+ * @param pp post processor context
+ * @param post_data data to decode
+ * @param post_data_len number of bytes in @a post_data
+ * @param[out] left set to the number of bytes at the end of
+ *        @a post_data that were not processed because the spool
+ *        was busy (never 0 then unless @a post_data_len is 0)
+ * @return #MHD_NO on error,
+ */
+static int
+post_process_multipart (struct MHD_PostProcessor *pp,
+                        const char *post_data,
+			size_t post_data_len,
+                        size_t *left)
+{
+  char *buf;
+  const char *boundary;
+  const unsigned char *skip;
+  size_t blen;
+  size_t max;
+  size_t ioff;
+  size_t poff;
+  int state_changed;
+
+  buf = (char *) &pp[1];
+  ioff = 0;
+  poff = 0;
+  *left = 0;
+  if (NULL != pp->spool)
+    pp->spool->blocked = MHD_NO;
+  state_changed = 1;
+  while ((poff < post_data_len) ||
+         ((pp->buffer_pos > 0) && (state_changed != 0)))
+    {
+      if ( (RN_Inactive == pp->skip_rn) &&
+           ( (PP_ProcessValueToBoundary == pp->state) ||
+             (PP_Nested_ProcessValueToBoundary == pp->state) ) )
+        {
+          if (PP_ProcessValueToBoundary == pp->state)
+            {
+              boundary = pp->boundary;
+              blen = pp->blen;
+              skip = pp->boundary_skip;
+            }
+          else
+            {
+              boundary = pp->nested_boundary;
+              blen = pp->nlen;
+              skip = pp->nested_skip;
+            }
+          if ( (0 == pp->buffer_pos) &&
+               (poff < post_data_len) )
+            {
+              /* the bulk of the value goes straight from the input
+                 to the iterator */
+              max = process_value_direct (pp,
+                                          &post_data[poff],
+                                          post_data_len - poff,
+                                          boundary,
+                                          blen,
+                                          skip);
+              if (PP_Error == pp->state)
+                return MHD_NO;
+              poff += max;
+              if (SPOOL_BLOCKED (pp))
+                goto END;
+              if (0 != max)
+                {
+                  state_changed = 1;
+                  continue;
+                }
+            }
+          /* only buffer what is needed to tell whether the end
+             of the buffer is the beginning of the boundary */
+          max = blen + 4;
+        }
+      else
+        max = pp->buffer_size;
+      /* first, move as much input data
+         as possible to our internal buffer */
+      if (max > pp->buffer_size - pp->buffer_pos)
+        max = pp->buffer_size - pp->buffer_pos;
+      if (max > post_data_len - poff)
+        max = post_data_len - poff;
+      memcpy (&buf[pp->buffer_pos], &post_data[poff], max);
+      poff += max;
+      pp->buffer_pos += max;
+      if ((max == 0) && (state_changed == 0) && (poff < post_data_len))
+        {
+          pp->state = PP_Error;
+          return MHD_NO;        /* out of memory */
+        }
+      state_changed = 0;
+
+      /* first state machine for '\r'-'\n' and '--' handling */
+      switch (pp->skip_rn)
+        {
+        case RN_Inactive:
+          break;
+        case RN_OptN:
+          if (buf[0] == '\n')
+            {
+              ioff++;
+              pp->skip_rn = RN_Inactive;
+              goto AGAIN;
+            }
+          /* fall-through! */
+        case RN_Dash:
+          if (buf[0] == '-')
+            {
+              ioff++;
+              pp->skip_rn = RN_Dash2;
+              goto AGAIN;
+            }
+          pp->skip_rn = RN_Full;
+          /* fall-through! */
+        case RN_Full:
+          if (buf[0] == '\r')
+            {
+              if ((pp->buffer_pos > 1) && (buf[1] == '\n'))
+                {
+                  pp->skip_rn = RN_Inactive;
+                  ioff += 2;
+                }
+              else
+                {
+                  pp->skip_rn = RN_OptN;
+                  ioff++;
+                }
+              goto AGAIN;
             }
           if (buf[0] == '\n')
             {
@@ -992,7 +2115,16 @@ post_process_multipart (struct MHD_PostProcessor *pp,
               free (pp->content_type);
               pp->content_type = NULL;
               pp->nlen = strlen (pp->nested_boundary);
-              pp->state = PP_Nested_Init;
+              if ( (0 == pp->nlen) ||
+                   (pp->nlen + 4 > pp->buffer_size) )
+                {
+                  pp->state = PP_Error;
+                  return MHD_NO;
+                }
+              build_skip_table (pp->nested_skip,
+                                pp->nested_boundary,
+                                pp->nlen);
+              pp->state = PP_Nested_Init;
               state_changed = 1;
               break;
             }
@@ -1005,11 +2137,14 @@ post_process_multipart (struct MHD_PostProcessor *pp,
                                                    &ioff,
                                                    pp->boundary,
                                                    pp->blen,
+                                                   pp->boundary_skip,
                                                    PP_PerformCleanup,
                                                    PP_Done))
             {
               if (pp->state == PP_Error)
                 return MHD_NO;
+              if (SPOOL_BLOCKED (pp))
+                goto END;
               break;
             }
           break;
@@ -1076,11 +2211,14 @@ post_process_multipart (struct MHD_PostProcessor *pp,
                                                    &ioff,
                                                    pp->nested_boundary,
                                                    pp->nlen,
+                                                   pp->nested_skip,
                                                    PP_Nested_PerformCleanup,
                                                    PP_NextBoundary))
             {
               if (pp->state == PP_Error)
                 return MHD_NO;
+              if (SPOOL_BLOCKED (pp))
+                goto END;
               break;
             }
           break;
@@ -1107,6 +2245,20 @@ END:
       memmove (buf, &buf[ioff], pp->buffer_pos - ioff);
       pp->buffer_pos -= ioff;
     }
+  if (SPOOL_BLOCKED (pp))
+    {
+      /* give the last byte we buffered back, so that the caller
+         knows it has to come back even if we took all of the
+         input; the rest of the buffer is kept */
+      if ( (0 != poff) &&
+           (poff == post_data_len) )
+        {
+          pp->buffer_pos--;
+          poff--;
+        }
+      *left = post_data_len - poff;
+      return MHD_YES;
+    }
   if (poff < post_data_len)
     {
       pp->state = PP_Error;
@@ -1117,22 +2269,672 @@ END:
 
 
 /**
- * Parse and process POST data.  Call this function when POST data is
- * available (usually during an #MHD_AccessHandlerCallback) with the
- * "upload_data" and "upload_data_size".  Whenever possible, this will
- * then cause calls to the #MHD_PostDataIterator.
+ * Type of JSON strings, as passed to the iterator.
+ */
+#define JSON_TYPE_STRING "string"
+
+/**
+ * Type of JSON numbers, as passed to the iterator.
+ */
+#define JSON_TYPE_NUMBER "number"
+
+/**
+ * Type of JSON "true" and "false", as passed to the iterator.
+ */
+#define JSON_TYPE_BOOLEAN "boolean"
+
+/**
+ * Type of JSON "null", as passed to the iterator.
+ */
+#define JSON_TYPE_NULL "null"
+
+/**
+ * Maximum nesting of JSON containers (one bit of
+ * `json_types` per level).
+ */
+#define JSON_MAX_DEPTH 64
+
+
+/**
+ * Pass the decoded value data in our buffer to the iterator.
+ *
+ * @param pp post processor context
+ * @param type type of the value
+ * @return #MHD_YES on success, #MHD_NO if the iterator aborted
+ */
+static int
+json_flush (struct MHD_PostProcessor *pp,
+            const char *type)
+{
+  char *buf = (char *) &pp[1];
+
+  if ( (0 == pp->json_fill) &&
+       (MHD_NO == pp->must_ikvi) )
+    return MHD_YES;
+  pp->must_ikvi = MHD_NO;
+  if (MHD_NO == pp->ikvi (pp->cls,
+                          MHD_POSTDATA_KIND,
+                          buf,                                  /* path */
+                          NULL,
+                          type,
+                          NULL,
+                          &buf[pp->buffer_pos + 1],
+                          pp->value_offset,
+                          pp->json_fill))
+    {
+      pp->state = PP_Error;
+      return MHD_NO;
+    }
+  pp->value_offset += pp->json_fill;
+  pp->json_fill = 0;
+  return MHD_YES;
+}
+
+
+/**
+ * Append decoded value data to our buffer, passing it on whenever
+ * the buffer is full.
+ *
+ * @param pp post processor context
+ * @param type type of the value
+ * @param data data to append
+ * @param size number of bytes in @a data
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+json_append_value (struct MHD_PostProcessor *pp,
+                   const char *type,
+                   const char *data,
+                   size_t size)
+{
+  char *buf = (char *) &pp[1];
+  size_t room;
+  size_t n;
+
+  while (0 != size)
+    {
+      room = pp->buffer_size - pp->buffer_pos - 1 - pp->json_fill;
+      if (0 == room)
+        {
+          if (MHD_NO == json_flush (pp, type))
+            return MHD_NO;
+          continue;
+        }
+      n = (size < room) ? size : room;
+      memcpy (&buf[pp->buffer_pos + 1 + pp->json_fill], data, n);
+      pp->json_fill += n;
+      data += n;
+      size -= n;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Append (decoded) characters of a key to the path, escaping them
+ * as for a JSON Pointer (RFC 6901).
+ *
+ * @param pp post processor context
+ * @param data characters to append
+ * @param size number of bytes in @a data
+ * @return #MHD_YES on success, #MHD_NO if the path does not fit
+ */
+static int
+json_append_key (struct MHD_PostProcessor *pp,
+                 const char *data,
+                 size_t size)
+{
+  char *buf = (char *) &pp[1];
+  size_t i;
+  size_t need;
+
+  need = size;
+  for (i = 0; i < size; i++)
+    if ( ('~' == data[i]) || ('/' == data[i]) )
+      need++;
+  if (pp->buffer_pos + need + 1 > pp->buffer_size)
+    {
+      pp->state = PP_Error;     /* out of memory */
+      return MHD_NO;
+    }
+  for (i = 0; i < size; i++)
+    {
+      if ('~' == data[i])
+        {
+          buf[pp->buffer_pos++] = '~';
+          buf[pp->buffer_pos++] = '0';
+        }
+      else if ('/' == data[i])
+        {
+          buf[pp->buffer_pos++] = '~';
+          buf[pp->buffer_pos++] = '1';
+        }
+      else
+        buf[pp->buffer_pos++] = data[i];
+    }
+  buf[pp->buffer_pos] = '\0';
+  return MHD_YES;
+}
+
+
+/**
+ * Append a segment to the path.
+ *
+ * @param pp post processor context
+ * @param segment segment to append, including the leading '/'
+ * @return #MHD_YES on success, #MHD_NO if the path does not fit
+ */
+static int
+json_push_segment (struct MHD_PostProcessor *pp,
+                   const char *segment)
+{
+  char *buf = (char *) &pp[1];
+  size_t len = strlen (segment);
+
+  if (pp->buffer_pos + len + 1 > pp->buffer_size)
+    {
+      pp->state = PP_Error;     /* out of memory */
+      return MHD_NO;
+    }
+  memcpy (&buf[pp->buffer_pos], segment, len + 1);
+  pp->buffer_pos += len;
+  return MHD_YES;
+}
+
+
+/**
+ * Remove the last segment from the path.
+ *
+ * @param pp post processor context
+ */
+static void
+json_pop_segment (struct MHD_PostProcessor *pp)
+{
+  char *buf = (char *) &pp[1];
+
+  while ( (0 != pp->buffer_pos) &&
+          ('/' != buf[--pp->buffer_pos]) )
+    ;
+  buf[pp->buffer_pos] = '\0';
+}
+
+
+/**
+ * Check if the innermost JSON container is an array.
+ *
+ * @param pp post processor context, with @e json_depth > 0
+ * @return non-zero for an array
+ */
+#define JSON_IN_ARRAY(pp) \
+  (0 != ((pp)->json_types & (((uint64_t) 1) << ((pp)->json_depth - 1))))
+
+
+/**
+ * Type of the literal being parsed.
+ *
+ * @param pp post processor context, in #JSON_Literal
+ */
+#define JSON_LITERAL_TYPE(pp) \
+  (('n' == (pp)->json_code) ? JSON_TYPE_NULL : JSON_TYPE_BOOLEAN)
+
+
+/**
+ * Process the end of a value: move on to what may follow it.
+ *
+ * @param pp post processor context
+ */
+static void
+json_end_value (struct MHD_PostProcessor *pp)
+{
+  pp->json_state = JSON_AfterValue;
+  if (0 == pp->json_depth)
+    pp->state = PP_Done;
+}
+
+
+/**
+ * Append a code point to the decoded string (value or key) as UTF-8.
+ *
+ * @param pp post processor context
+ * @param code the code point
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+json_append_code (struct MHD_PostProcessor *pp,
+                  uint32_t code)
+{
+  char utf8[4];
+  size_t len;
+
+  if (code < 0x80)
+    {
+      utf8[0] = (char) code;
+      len = 1;
+    }
+  else if (code < 0x800)
+    {
+      utf8[0] = (char) (0xC0 | (code >> 6));
+      utf8[1] = (char) (0x80 | (code & 0x3F));
+      len = 2;
+    }
+  else if (code < 0x10000)
+    {
+      utf8[0] = (char) (0xE0 | (code >> 12));
+      utf8[1] = (char) (0x80 | ((code >> 6) & 0x3F));
+      utf8[2] = (char) (0x80 | (code & 0x3F));
+      len = 3;
+    }
+  else
+    {
+      utf8[0] = (char) (0xF0 | (code >> 18));
+      utf8[1] = (char) (0x80 | ((code >> 12) & 0x3F));
+      utf8[2] = (char) (0x80 | ((code >> 6) & 0x3F));
+      utf8[3] = (char) (0x80 | (code & 0x3F));
+      len = 4;
+    }
+  if (JSON_KeyString == pp->json_state)
+    return json_append_key (pp, utf8, len);
+  return json_append_value (pp, JSON_TYPE_STRING, utf8, len);
+}
+
+
+/**
+ * Process one character of an escape sequence in a string.
+ *
+ * @param pp post processor context
+ * @param c the character
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+json_process_escape (struct MHD_PostProcessor *pp,
+                     char c)
+{
+  static const char plain_in[] = "\"\\/bfnrt";
+  static const char plain_out[] = "\"\\/\b\f\n\r\t";
+  const char *pos;
+  uint32_t code;
+
+  if (1 == pp->json_escape)
+    {
+      if ('u' == c)
+        {
+          pp->json_escape = 2;
+          pp->json_code = 0;
+          return MHD_YES;
+        }
+      if ( (0 != pp->json_high) ||
+           ('\0' == c) ||
+           (NULL == (pos = strchr (plain_in, c))) )
+        return MHD_NO;
+      pp->json_escape = 0;
+      return json_append_code (pp,
+                               (unsigned char) plain_out[pos - plain_in]);
+    }
+  if ( (c >= '0') && (c <= '9') )
+    code = c - '0';
+  else if ( (c >= 'a') && (c <= 'f') )
+    code = c - 'a' + 10;
+  else if ( (c >= 'A') && (c <= 'F') )
+    code = c - 'A' + 10;
+  else
+    return MHD_NO;
+  pp->json_code = (pp->json_code << 4) | code;
+  if (5 != pp->json_escape++)
+    return MHD_YES;
+  pp->json_escape = 0;
+  code = pp->json_code;
+  if ( (code >= 0xD800) && (code < 0xDC00) )
+    {
+      /* high surrogate, the low one must follow right away */
+      if (0 != pp->json_high)
+        return MHD_NO;
+      pp->json_high = code;
+      return MHD_YES;
+    }
+  if ( (code >= 0xDC00) && (code < 0xE000) )
+    {
+      if (0 == pp->json_high)
+        return MHD_NO;
+      code = 0x10000 + ((pp->json_high - 0xD800) << 10) + (code - 0xDC00);
+      pp->json_high = 0;
+    }
+  else if (0 != pp->json_high)
+    return MHD_NO;
+  return json_append_code (pp, code);
+}
+
+
+/**
+ * Start a container ('{' or '[') at the current path.
+ *
+ * @param pp post processor context
+ * @param array #MHD_YES for an array
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+json_open (struct MHD_PostProcessor *pp,
+           int array)
+{
+  if (JSON_MAX_DEPTH == pp->json_depth)
+    return MHD_NO;
+  pp->json_depth++;
+  if (MHD_YES == array)
+    {
+      pp->json_types |= ((uint64_t) 1) << (pp->json_depth - 1);
+      pp->json_state = JSON_ArrayStart;
+      return json_push_segment (pp, "/0");
+    }
+  pp->json_types &= ~(((uint64_t) 1) << (pp->json_depth - 1));
+  pp->json_state = JSON_ObjectStart;
+  return MHD_YES;
+}
+
+
+/**
+ * End the innermost container.
+ *
+ * @param pp post processor context
+ * @param c the closing character
+ * @param has_member #MHD_NO if the container is empty
+ *        (an empty object added nothing to the path)
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+json_close (struct MHD_PostProcessor *pp,
+            char c,
+            int has_member)
+{
+  if ( (0 == pp->json_depth) ||
+       ( (']' == c) != JSON_IN_ARRAY (pp) ) )
+    return MHD_NO;
+  if ( (MHD_YES == has_member) ||
+       (JSON_IN_ARRAY (pp)) )
+    json_pop_segment (pp);
+  pp->json_depth--;
+  json_end_value (pp);
+  return MHD_YES;
+}
+
+
+/**
+ * Move on to the next member of the innermost container.
+ *
+ * @param pp post processor context
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+json_next_member (struct MHD_PostProcessor *pp)
+{
+  char *buf = (char *) &pp[1];
+  char index[24];
+  size_t pos;
+
+  if (0 == pp->json_depth)
+    return MHD_NO;
+  if (! JSON_IN_ARRAY (pp))
+    {
+      json_pop_segment (pp);
+      pp->json_state = JSON_Key;
+      return MHD_YES;
+    }
+  pos = pp->buffer_pos;
+  while ('/' != buf[pos - 1])
+    pos--;
+  snprintf (index,
+            sizeof (index),
+            "/%llu",
+            1 + strtoull (&buf[pos], NULL, 10));
+  json_pop_segment (pp);
+  pp->json_state = JSON_Value;
+  return json_push_segment (pp, index);
+}
+
+
+/**
+ * Process JSON POST data.  The iterator is called for each string,
+ * number, boolean and null with the JSON Pointer (RFC 6901) of the
+ * value as the key and the type of the value as the content type;
+ * strings are passed on decoded, everything else as it appears in
+ * the body.  Long strings are passed in several pieces.
+ *
+ * @param pp post processor context
+ * @param post_data upload data
+ * @param post_data_len number of bytes in @a post_data
+ * @return #MHD_YES on success, #MHD_NO if there was an error processing the data
+ */
+static int
+post_process_json (struct MHD_PostProcessor *pp,
+                   const char *post_data,
+                   size_t post_data_len)
+{
+  size_t poff;
+  size_t run;
+  char c;
+
+  poff = 0;
+  while (poff < post_data_len)
+    {
+      if (PP_Error == pp->state)
+        return MHD_NO;
+      c = post_data[poff];
+      switch (pp->json_state)
+        {
+        case JSON_String:
+        case JSON_KeyString:
+          if (0 != pp->json_escape)
+            {
+              if (MHD_NO == json_process_escape (pp, c))
+                goto ERROR;
+              poff++;
+              continue;
+            }
+          /* the bulk of a string needs no decoding */
+          run = 0;
+          while ( (poff + run < post_data_len) &&
+                  ('"' != post_data[poff + run]) &&
+                  ('\\' != post_data[poff + run]) &&
+                  ((unsigned char) post_data[poff + run] >= 0x20) )
+            run++;
+          if ( (0 != run) &&
+               (0 != pp->json_high) )
+            goto ERROR;         /* lone surrogate */
+          if (JSON_KeyString == pp->json_state)
+            {
+              if (MHD_NO == json_append_key (pp, &post_data[poff], run))
+                return MHD_NO;
+            }
+          else if (0 != run)
+            {
+              /* pass it on without copying */
+              if (MHD_NO == json_flush (pp, JSON_TYPE_STRING))
+                return MHD_NO;
+              pp->must_ikvi = MHD_NO;
+              if (MHD_NO == pp->ikvi (pp->cls,
+                                      MHD_POSTDATA_KIND,
+                                      (const char *) &pp[1],    /* path */
+                                      NULL,
+                                      JSON_TYPE_STRING,
+                                      NULL,
+                                      &post_data[poff],
+                                      pp->value_offset,
+                                      run))
+                goto ERROR;
+              pp->value_offset += run;
+            }
+          poff += run;
+          if (poff == post_data_len)
+            break;
+          c = post_data[poff++];
+          if ('\\' == c)
+            {
+              pp->json_escape = 1;
+              continue;
+            }
+          if ( ('"' != c) ||
+               (0 != pp->json_high) )
+            goto ERROR;         /* control character */
+          if (JSON_KeyString == pp->json_state)
+            {
+              pp->json_state = JSON_Colon;
+              continue;
+            }
+          if (MHD_NO == json_flush (pp, JSON_TYPE_STRING))
+            return MHD_NO;
+          json_end_value (pp);
+          continue;
+        case JSON_Number:
+          if ( ( (c >= '0') && (c <= '9') ) ||
+               ('.' == c) || ('e' == c) || ('E' == c) ||
+               ('+' == c) || ('-' == c) )
+            {
+              if (MHD_NO == json_append_value (pp, JSON_TYPE_NUMBER, &c, 1))
+                return MHD_NO;
+              poff++;
+              continue;
+            }
+          if (MHD_NO == json_flush (pp, JSON_TYPE_NUMBER))
+            return MHD_NO;
+          json_end_value (pp);
+          continue;             /* process 'c' again */
+        case JSON_Literal:
+          if ('\0' != *pp->json_literal)
+            {
+              if (c != *pp->json_literal)
+                goto ERROR;
+              if (MHD_NO == json_append_value (pp, JSON_LITERAL_TYPE (pp), &c, 1))
+                return MHD_NO;
+              pp->json_literal++;
+              poff++;
+              continue;
+            }
+          if ( ( (c >= 'a') && (c <= 'z') ) ||
+               ( (c >= '0') && (c <= '9') ) )
+            goto ERROR;
+          if (MHD_NO == json_flush (pp, JSON_LITERAL_TYPE (pp)))
+            return MHD_NO;
+          json_end_value (pp);
+          continue;             /* process 'c' again */
+        default:
+          break;
+        }
+      if (poff == post_data_len)
+        break;
+      poff++;
+      if ( (' ' == c) || ('\t' == c) || ('\n' == c) || ('\r' == c) )
+        continue;
+      if (PP_Done == pp->state)
+        goto ERROR;             /* more than one value */
+      switch (pp->json_state)
+        {
+        case JSON_ObjectStart:
+          if ('}' == c)
+            {
+              if (MHD_NO == json_close (pp, c, MHD_NO))
+                goto ERROR;
+              continue;
+            }
+          /* fall through */
+        case JSON_Key:
+          if ('"' != c)
+            goto ERROR;
+          if (MHD_NO == json_push_segment (pp, "/"))
+            return MHD_NO;
+          pp->json_state = JSON_KeyString;
+          continue;
+        case JSON_Colon:
+          if (':' != c)
+            goto ERROR;
+          pp->json_state = JSON_Value;
+          continue;
+        case JSON_AfterValue:
+          if (',' == c)
+            {
+              if (MHD_NO == json_next_member (pp))
+                goto ERROR;
+              continue;
+            }
+          if ( ('}' == c) || (']' == c) )
+            {
+              if (MHD_NO == json_close (pp, c, MHD_YES))
+                goto ERROR;
+              continue;
+            }
+          goto ERROR;
+        case JSON_ArrayStart:
+          if (']' == c)
+            {
+              if (MHD_NO == json_close (pp, c, MHD_NO))
+                goto ERROR;
+              continue;
+            }
+          /* fall through */
+        case JSON_Value:
+          pp->value_offset = 0;
+          pp->json_fill = 0;
+          pp->must_ikvi = MHD_YES;
+          switch (c)
+            {
+            case '{':
+            case '[':
+              if (MHD_NO == json_open (pp, ('[' == c) ? MHD_YES : MHD_NO))
+                goto ERROR;
+              continue;
+            case '"':
+              pp->json_state = JSON_String;
+              continue;
+            case 't':
+              pp->json_literal = "rue";
+              break;
+            case 'f':
+              pp->json_literal = "alse";
+              break;
+            case 'n':
+              pp->json_literal = "ull";
+              break;
+            default:
+              if ( ('-' != c) &&
+                   ( (c < '0') || (c > '9') ) )
+                goto ERROR;
+              pp->json_state = JSON_Number;
+              if (MHD_NO == json_append_value (pp, JSON_TYPE_NUMBER, &c, 1))
+                return MHD_NO;
+              continue;
+            }
+          /* remember which literal it is for its type */
+          pp->json_code = (unsigned char) c;
+          pp->json_state = JSON_Literal;
+          if (MHD_NO == json_append_value (pp, JSON_LITERAL_TYPE (pp), &c, 1))
+            return MHD_NO;
+          continue;
+        default:
+          mhd_panic (mhd_panic_cls, __FILE__, __LINE__, NULL);          /* should never happen! */
+        }
+    }
+  return (PP_Error == pp->state) ? MHD_NO : MHD_YES;
+ERROR:
+  pp->state = PP_Error;
+  return MHD_NO;
+}
+
+
+/**
+ * Parse and process POST data, without waiting for the background
+ * thread writing file uploads.
  *
  * @param pp the post processor
  * @param post_data @a post_data_len bytes of POST data
  * @param post_data_len length of @a post_data
+ * @param[out] left set to the number of bytes at the end of
+ *        @a post_data that were not processed
  * @return #MHD_YES on success, #MHD_NO on error
- *         (out-of-memory, iterator aborted, parse error)
- * @ingroup request
  */
-int
-MHD_post_process (struct MHD_PostProcessor *pp,
-                  const char *post_data, size_t post_data_len)
+static int
+post_process (struct MHD_PostProcessor *pp,
+              const char *post_data,
+              size_t post_data_len,
+              size_t *left)
 {
+  *left = 0;
   if (0 == post_data_len)
     return MHD_YES;
   if (NULL == pp)
@@ -1140,14 +2942,190 @@ MHD_post_process (struct MHD_PostProcessor *pp,
   if (MHD_str_equal_caseless_n_ (MHD_HTTP_POST_ENCODING_FORM_URLENCODED, pp->encoding,
                          strlen(MHD_HTTP_POST_ENCODING_FORM_URLENCODED)))
     return post_process_urlencoded (pp, post_data, post_data_len);
+  if (MHD_str_equal_caseless_n_ (MHD_HTTP_POST_ENCODING_JSON, pp->encoding,
+                                 strlen (MHD_HTTP_POST_ENCODING_JSON)))
+    return post_process_json (pp, post_data, post_data_len);
   if (MHD_str_equal_caseless_n_ (MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA, pp->encoding,
                    strlen (MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA)))
-    return post_process_multipart (pp, post_data, post_data_len);
+    return post_process_multipart (pp, post_data, post_data_len, left);
   /* this should never be reached */
   return MHD_NO;
 }
 
 
+/**
+ * Parse and process POST data.  Call this function when POST data is
+ * available (usually during an #MHD_AccessHandlerCallback) with the
+ * "upload_data" and "upload_data_size".  Whenever possible, this will
+ * then cause calls to the #MHD_PostDataIterator.
+ *
+ * @param pp the post processor
+ * @param post_data @a post_data_len bytes of POST data
+ * @param post_data_len length of @a post_data
+ * @return #MHD_YES on success, #MHD_NO on error
+ *         (out-of-memory, iterator aborted, parse error)
+ * @ingroup request
+ */
+int
+MHD_post_process (struct MHD_PostProcessor *pp,
+                  const char *post_data, size_t post_data_len)
+{
+  size_t left;
+
+  while (1)
+    {
+      if (MHD_YES != post_process (pp, post_data, post_data_len, &left))
+        return MHD_NO;
+      if (0 == left)
+        return MHD_YES;
+#ifdef MHD_HAVE_COND_
+      spool_wait (pp->spool);
+#endif
+      post_data += post_data_len - left;
+      post_data_len = left;
+    }
+}
+
+
+/**
+ * Parse and process POST data like #MHD_post_process(), but
+ * without waiting for the background thread of
+ * #MHD_post_processor_spool_files().
+ *
+ * @param pp the post processor
+ * @param post_data POST data
+ * @param[in,out] post_data_len number of bytes at @a post_data,
+ *        set to the number of bytes at its end that were not
+ *        processed because the thread was busy
+ * @return #MHD_YES on success, #MHD_NO on error
+ *         (out-of-memory, iterator aborted, parse error)
+ * @ingroup request
+ */
+int
+MHD_post_process_partial (struct MHD_PostProcessor *pp,
+                          const char *post_data,
+                          size_t *post_data_len)
+{
+  return post_process (pp, post_data, *post_data_len, post_data_len);
+}
+
+
+/**
+ * Have a (multipart) post processor write the data of file uploads
+ * (parts with a filename) to temporary files instead of passing it
+ * to the #MHD_PostDataIterator.
+ *
+ * @param pp the post processor
+ * @param dir directory for the temporary files, NULL for the
+ *        one given by the TMPDIR environment variable or "/tmp"
+ * @param chunk_size number of bytes to write at once (rounded
+ *        up to a multiple of 4 KiB), 0 for the default (1 MiB)
+ * @param flags how to write the files
+ * @param cb function to call for each complete file
+ * @param cb_cls first argument to @a cb
+ * @return #MHD_YES on success,
+ *         #MHD_NO on error (out of memory, not supported by the
+ *         platform, post processor already in use)
+ */
+int
+MHD_post_processor_spool_files (struct MHD_PostProcessor *pp,
+                                const char *dir,
+                                size_t chunk_size,
+                                enum MHD_PostSpoolFlags flags,
+                                MHD_PostFileCallback cb,
+                                void *cb_cls)
+{
+  struct PostSpool *spool;
+#ifdef MHD_HAVE_COND_
+  struct MHD_Daemon *daemon;
+#endif
+
+#ifndef HAVE_MKSTEMP
+  return MHD_NO;
+#endif
+  if ( (NULL == pp) ||
+       (NULL == cb) ||
+       (NULL != pp->spool) ||
+       (NULL == pp->boundary) ||
+       (PP_Init != pp->state) ||
+       (0 != pp->buffer_pos) )
+    return MHD_NO;
+  if (NULL == dir)
+    dir = getenv ("TMPDIR");
+  if ( (NULL == dir) ||
+       ('\0' == dir[0]) )
+    dir = "/tmp";
+  if (0 == chunk_size)
+    chunk_size = SPOOL_CHUNK_SIZE;
+  if (chunk_size > SIZE_MAX - SPOOL_ALIGNMENT)
+    return MHD_NO;
+  chunk_size = (chunk_size + SPOOL_ALIGNMENT - 1)
+    - (chunk_size + SPOOL_ALIGNMENT - 1) % SPOOL_ALIGNMENT;
+  if (NULL == (spool = malloc (sizeof (struct PostSpool))))
+    return MHD_NO;
+  memset (spool, 0, sizeof (struct PostSpool));
+  spool->cb = cb;
+  spool->cb_cls = cb_cls;
+  spool->chunk_size = chunk_size;
+  spool->fd = -1;
+  spool->io_error = MHD_NO;
+  if ( (NULL == (spool->dir = strdup (dir))) ||
+       (NULL == (spool->chunk[0] = malloc (chunk_size))) )
+    goto ERROR;
+#ifdef MHD_HAVE_COND_
+  spool->busy = MHD_NO;
+  spool->use_thread = MHD_NO;
+  if (0 != (flags & MHD_POST_SPOOL_THREAD))
+    {
+      daemon = pp->connection->daemon;
+      if (NULL != daemon->master)
+        daemon = daemon->master;
+      spool->writer = daemon->post_writer;
+      if ( (NULL == spool->writer) ||
+           (NULL == (spool->chunk[1] = malloc (chunk_size))) ||
+           (MHD_YES != writer_start (spool->writer,
+                                     daemon)) )
+        goto ERROR;
+      spool->use_thread = MHD_YES;
+    }
+#endif
+  pp->spool = spool;
+  return MHD_YES;
+ERROR:
+  free (spool->chunk[1]);
+  free (spool->chunk[0]);
+  free (spool->dir);
+  free (spool);
+  return MHD_NO;
+}
+
+
+/**
+ * Release the resources for writing file uploads to temporary
+ * files, removing an incomplete file.
+ *
+ * @param spool spool to release
+ */
+static void
+spool_destroy (struct PostSpool *spool)
+{
+  if (NULL != spool->path)
+    {
+      (void) spool_close (spool, MHD_NO);
+      free (spool->path);
+    }
+#ifdef MHD_HAVE_COND_
+  /* the thread must be done with our buffers */
+  if (MHD_YES == spool->use_thread)
+    spool_wait (spool);
+#endif
+  free (spool->chunk[1]);
+  free (spool->chunk[0]);
+  free (spool->dir);
+  free (spool);
+}
+
+
 /**
  * Release PostProcessor resources.
  *
@@ -1161,6 +3139,9 @@ MHD_post_process (struct MHD_PostProcessor *pp,
 int
 MHD_destroy_post_processor (struct MHD_PostProcessor *pp)
 {
+#ifdef MHD_HAVE_COND_
+  size_t left;
+#endif
   int ret;
 
   if (NULL == pp)
@@ -1172,6 +3153,23 @@ MHD_destroy_post_processor (struct MHD_PostProcessor *pp)
        ensure it is also processed */
     post_process_urlencoded (pp, "\n", 1);
   }
+  if ( (PP_Init == pp->state) &&
+       (0 == pp->json_depth) &&
+       ( (JSON_Number == pp->json_state) ||
+         (JSON_Literal == pp->json_state) ) )
+  {
+    /* a number (or literal) at the top level ends with the body */
+    post_process_json (pp, "\n", 1);
+  }
+#ifdef MHD_HAVE_COND_
+  while ( (SPOOL_BLOCKED (pp)) &&
+          (PP_Error != pp->state) )
+    {
+      /* the end of the body is still in our buffer */
+      spool_wait (pp->spool);
+      (void) post_process_multipart (pp, "", 0, &left);
+    }
+#endif
   /* These internal strings need cleaning up since
      the post-processing may have been interrupted
      at any stage */
@@ -1181,6 +3179,12 @@ MHD_destroy_post_processor (struct MHD_PostProcessor *pp)
     ret = MHD_NO;
   else
     ret = MHD_YES;
+  if (NULL != pp->spool)
+    {
+      if (NULL != pp->spool->path)
+        ret = MHD_NO;
+      spool_destroy (pp->spool);
+    }
   pp->have = NE_none;
   free_unmarked (pp);
   if (pp->nested_boundary != NULL)
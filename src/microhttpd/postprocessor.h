@@ -0,0 +1,55 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file postprocessor.h
+ * @brief  thread writing the files of post processors
+ * @author Christian Grothoff
+ */
+
+#ifndef POSTPROCESSOR_H
+#define POSTPROCESSOR_H
+
+#include "internal.h"
+
+#ifdef MHD_HAVE_COND_
+
+/**
+ * Create the writer for the post processors of a daemon that spool
+ * files with #MHD_POST_SPOOL_THREAD.  Its thread is only started
+ * when it is first used.
+ *
+ * @return NULL on error
+ */
+struct MHD_PostWriter *
+MHD_post_writer_create_ (void);
+
+
+/**
+ * Stop the thread of a writer and release it.  There must be no
+ * post processors left that use it.
+ *
+ * @param writer writer to destroy, can be NULL
+ */
+void
+MHD_post_writer_destroy_ (struct MHD_PostWriter *writer);
+
+#endif
+
+#endif
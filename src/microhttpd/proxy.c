@@ -0,0 +1,2783 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file proxy.c
+ * @brief forwarding of requests to upstream servers in the event loop
+ * @author Christian Grothoff
+ *
+ * Once the application queued a proxy response, the connection
+ * keeps its memory pool (and thus the headers of the request) and
+ * the handlers of the connection are replaced by the ones in this
+ * file.  The idle handler moves data in both directions without
+ * blocking until neither socket can make progress; the event loop
+ * watches the upstream socket next to the socket of the client.
+ *
+ * The request head is rebuilt for the upstream server, the body is
+ * passed on as received (chunked bodies keep their framing, which is
+ * only parsed to find the end of the request).  The response head
+ * of the upstream server is rewritten in the write buffer of the
+ * connection; bodies of known length (or delimited by the upstream
+ * closing the connection) are moved between plain sockets with
+ * splice() through a pipe, everything else through the buffers of
+ * the connection.
+ *
+ * After a complete exchange, the upstream connection goes into a
+ * pool of the daemon to be reused for later requests to the same
+ * address, and the client connection returns to HTTP processing as
+ * after any other response.
+ */
+
+#include "internal.h"
+#include "connection.h"
+#include "memorypool.h"
+#include "mhd_mono_clock.h"
+#include "mhd_str.h"
+#include "proxy.h"
+#if HTTPS_SUPPORT
+#include "tls.h"
+#endif
+
+#if HAVE_NETINET_TCP_H
+/* for TCP_NODELAY */
+#include <netinet/tcp.h>
+#endif
+
+#ifndef LINUX
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+
+/**
+ * Maximum number of bytes moved with one call to splice().
+ */
+#define SPLICE_CHUNK (64 * 1024)
+
+/**
+ * Space kept free in the write buffer while receiving the response
+ * head, so that the rewritten head (which may add a
+ * "Connection: close" header) always fits in its place.
+ */
+#define HEAD_RESERVE 32
+
+/**
+ * Maximum number of rounds of moving data per call of the idle
+ * handler, so that a fast exchange does not starve the others.
+ */
+#define MAX_ROUNDS 16
+
+/**
+ * Interim response sent to clients that expect it before sending
+ * the body.
+ */
+#define PROXY_100_CONTINUE "HTTP/1.1 100 Continue\r\n\r\n"
+
+
+/**
+ * How the end of a body is found.
+ */
+enum MHD_ProxyBody
+{
+  /**
+   * There is no body.
+   */
+  MHD_PROXY_BODY_NONE = 0,
+
+  /**
+   * The body has a known length.
+   */
+  MHD_PROXY_BODY_LENGTH = 1,
+
+  /**
+   * The body uses chunked encoding.
+   */
+  MHD_PROXY_BODY_CHUNKED = 2,
+
+  /**
+   * The body ends when the upstream server closes the connection.
+   */
+  MHD_PROXY_BODY_CLOSE = 3
+};
+
+
+/**
+ * States of the parser for chunked bodies.
+ */
+enum MHD_ProxyChunkState
+{
+  CHUNK_SIZE = 0,
+  CHUNK_EXTENSION,
+  CHUNK_SIZE_LF,
+  CHUNK_DATA,
+  CHUNK_DATA_CR,
+  CHUNK_DATA_LF,
+  CHUNK_TRAILER_START,
+  CHUNK_TRAILER,
+  CHUNK_END_LF,
+  CHUNK_DONE,
+  CHUNK_ERROR
+};
+
+
+/**
+ * Parser finding the end of a chunked body.
+ */
+struct MHD_ProxyChunks
+{
+  /**
+   * Current state.
+   */
+  enum MHD_ProxyChunkState state;
+
+  /**
+   * Remaining bytes of the current chunk (or its size while the
+   * size is parsed).
+   */
+  uint64_t left;
+
+  /**
+   * Number of digits of the chunk size parsed so far.
+   */
+  unsigned int digits;
+};
+
+
+/**
+ * Connection to an upstream server, either in use by a proxied
+ * request or idle in the pool of a daemon.
+ */
+struct MHD_ProxyUpstream
+{
+
+  /**
+   * Idle connections are kept in a DLL of the daemon.
+   */
+  struct MHD_ProxyUpstream *next;
+
+  /**
+   * Idle connections are kept in a DLL of the daemon.
+   */
+  struct MHD_ProxyUpstream *prev;
+
+  /**
+   * Address of the upstream server.
+   */
+  struct sockaddr_storage addr;
+
+  /**
+   * Number of bytes in @e addr.
+   */
+  socklen_t addr_len;
+
+  /**
+   * Socket connected to the upstream server.
+   */
+  MHD_socket fd;
+
+  /**
+   * Pipe used to splice() bodies, created on first use;
+   * -1 if there is none.
+   */
+  int pipe[2];
+
+};
+
+
+/**
+ * State of a request that is forwarded to an upstream server.
+ */
+struct MHD_Proxy
+{
+
+  /**
+   * The connection of the client.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * The connection to the upstream server, NULL once released.
+   */
+  struct MHD_ProxyUpstream *up;
+
+  /**
+   * Handlers of the connection to restore once the exchange is done.
+   */
+  int (*read_handler) (struct MHD_Connection *connection);
+
+  /**
+   * Handlers of the connection to restore once the exchange is done.
+   */
+  int (*write_handler) (struct MHD_Connection *connection);
+
+  /**
+   * Handlers of the connection to restore once the exchange is done.
+   */
+  int (*idle_handler) (struct MHD_Connection *connection);
+
+  /**
+   * Request head for the upstream server (kept until the response
+   * head arrived, to retry on a fresh connection).
+   */
+  char *head;
+
+  /**
+   * Number of bytes in @e head.
+   */
+  size_t head_size;
+
+  /**
+   * Number of bytes of @e head sent.
+   */
+  size_t head_off;
+
+  /**
+   * Number of bytes of #PROXY_100_CONTINUE still to be sent to the
+   * client.
+   */
+  size_t continue_left;
+
+  /**
+   * Number of bytes at the start of the read buffer that belong to
+   * the request body and are to be forwarded.
+   */
+  size_t req_fwd;
+
+  /**
+   * Bytes in the pipe of the upstream connection.
+   */
+  size_t pipe_fill;
+
+  /**
+   * For request bodies of known length, the number of bytes not
+   * yet received from the client.
+   */
+  uint64_t req_left;
+
+  /**
+   * Number of bytes of the request body forwarded so far.
+   */
+  uint64_t req_forwarded;
+
+  /**
+   * For response bodies of known length, the number of bytes not
+   * yet received from the upstream server.
+   */
+  uint64_t resp_left;
+
+  /**
+   * Parser of a chunked request body.
+   */
+  struct MHD_ProxyChunks req_chunks;
+
+  /**
+   * Parser of a chunked response body.
+   */
+  struct MHD_ProxyChunks resp_chunks;
+
+  /**
+   * Framing of the request body.
+   */
+  enum MHD_ProxyBody req_body;
+
+  /**
+   * Framing of the response body.
+   */
+  enum MHD_ProxyBody resp_body;
+
+  /**
+   * Status code to answer with if the upstream server fails.
+   */
+  unsigned int error_code;
+
+  /**
+   * #MHD_YES if the pipe holds request data, #MHD_NO if it holds
+   * response data (only meaningful if @e pipe_fill is not zero).
+   */
+  int pipe_request;
+
+  /**
+   * #MHD_YES while the connection to the upstream server is being
+   * established.
+   */
+  int connecting;
+
+  /**
+   * #MHD_YES if the upstream connection was taken from the pool.
+   */
+  int reused;
+
+  /**
+   * #MHD_YES once the head of the response was received (or an
+   * error response was generated).
+   */
+  int head_received;
+
+  /**
+   * #MHD_YES once the whole request body was received from the client.
+   */
+  int req_received;
+
+  /**
+   * #MHD_YES once the whole response body was received from the
+   * upstream server.
+   */
+  int resp_received;
+
+  /**
+   * #MHD_YES if the framing of a chunked response is removed
+   * (for HTTP/1.0 clients).
+   */
+  int dechunk;
+
+  /**
+   * #MHD_YES if the request uses the HEAD method.
+   */
+  int is_head;
+
+  /**
+   * #MHD_YES if the client uses HTTP/1.0.
+   */
+  int client_http10;
+
+  /**
+   * #MHD_YES if the connection to the client is closed after the
+   * response.
+   */
+  int client_close;
+
+  /**
+   * #MHD_YES if the upstream connection can be reused after the
+   * response.
+   */
+  int up_reusable;
+
+  /**
+   * #MHD_YES if no more data can be splice()d (no pipe).
+   */
+  int no_splice;
+
+  /**
+   * #MHD_YES if the exchange failed and the client is to be
+   * disconnected.
+   */
+  int failed;
+
+  /**
+   * #MHD_NO if the upstream socket is known to have no data.
+   */
+  int up_rd;
+
+  /**
+   * #MHD_NO if the upstream socket is known to accept no data.
+   */
+  int up_wr;
+
+  /**
+   * #MHD_NO if the client socket is known to have no data.
+   */
+  int client_rd;
+
+  /**
+   * #MHD_NO if the client socket is known to accept no data.
+   */
+  int client_wr;
+
+  /**
+   * #MHD_YES if the upstream socket is in the epoll set of the daemon.
+   */
+  int up_in_epoll;
+
+};
+
+
+/**
+ * Parse the framing of a chunked body in @a buf, stopping at the
+ * end of the body.
+ *
+ * @param cs parser state
+ * @param buf data to parse
+ * @param size number of bytes in @a buf
+ * @param strip #MHD_YES to remove the framing, moving the payload
+ *        of the chunks to the start of @a buf
+ * @param[out] out set to the number of bytes to pass on (the
+ *        payload if @a strip is set)
+ * @return number of bytes of @a buf that belong to the body
+ */
+static size_t
+chunks_scan (struct MHD_ProxyChunks *cs,
+             char *buf,
+             size_t size,
+             int strip,
+             size_t *out)
+{
+  size_t pos;
+  size_t o;
+  size_t n;
+  char c;
+
+  pos = 0;
+  o = 0;
+  while ( (pos < size) &&
+          (CHUNK_DONE != cs->state) &&
+          (CHUNK_ERROR != cs->state) )
+    {
+      if (CHUNK_DATA == cs->state)
+        {
+          n = size - pos;
+          if ((uint64_t) n > cs->left)
+            n = (size_t) cs->left;
+          if (MHD_YES == strip)
+            memmove (&buf[o], &buf[pos], n);
+          o += n;
+          pos += n;
+          cs->left -= n;
+          if (0 == cs->left)
+            cs->state = CHUNK_DATA_CR;
+          continue;
+        }
+      c = buf[pos++];
+      switch (cs->state)
+        {
+        case CHUNK_SIZE:
+          if ( ( (c >= '0') && (c <= '9') ) ||
+               ( (c >= 'a') && (c <= 'f') ) ||
+               ( (c >= 'A') && (c <= 'F') ) )
+            {
+              if (cs->left > (UINT64_MAX >> 4))
+                {
+                  cs->state = CHUNK_ERROR;
+                  break;
+                }
+              cs->left = (cs->left << 4) |
+                (uint64_t) ( (c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10);
+              cs->digits++;
+              break;
+            }
+          if (0 == cs->digits)
+            cs->state = CHUNK_ERROR;
+          else if ( (';' == c) || (' ' == c) || ('\t' == c) )
+            cs->state = CHUNK_EXTENSION;
+          else if ('\r' == c)
+            cs->state = CHUNK_SIZE_LF;
+          else if ('\n' == c)
+            cs->state = (0 == cs->left) ? CHUNK_TRAILER_START : CHUNK_DATA;
+          else
+            cs->state = CHUNK_ERROR;
+          break;
+        case CHUNK_EXTENSION:
+          if ('\n' == c)
+            cs->state = (0 == cs->left) ? CHUNK_TRAILER_START : CHUNK_DATA;
+          break;
+        case CHUNK_SIZE_LF:
+          if ('\n' == c)
+            cs->state = (0 == cs->left) ? CHUNK_TRAILER_START : CHUNK_DATA;
+          else
+            cs->state = CHUNK_ERROR;
+          break;
+        case CHUNK_DATA_CR:
+          if ('\r' == c)
+            {
+              cs->state = CHUNK_DATA_LF;
+              break;
+            }
+          /* fall through */
+        case CHUNK_DATA_LF:
+          if ('\n' == c)
+            {
+              cs->state = CHUNK_SIZE;
+              cs->digits = 0;
+            }
+          else
+            cs->state = CHUNK_ERROR;
+          break;
+        case CHUNK_TRAILER_START:
+          if ('\r' == c)
+            cs->state = CHUNK_END_LF;
+          else if ('\n' == c)
+            cs->state = CHUNK_DONE;
+          else
+            cs->state = CHUNK_TRAILER;
+          break;
+        case CHUNK_TRAILER:
+          if ('\n' == c)
+            cs->state = CHUNK_TRAILER_START;
+          break;
+        case CHUNK_END_LF:
+          cs->state = ('\n' == c) ? CHUNK_DONE : CHUNK_ERROR;
+          break;
+        default:
+          cs->state = CHUNK_ERROR;
+          break;
+        }
+    }
+  *out = (MHD_YES == strip) ? o : pos;
+  return pos;
+}
+
+
+/**
+ * Close a connection to an upstream server and free it.
+ *
+ * @param up connection to close
+ */
+static void
+upstream_close (struct MHD_ProxyUpstream *up)
+{
+  if (0 != MHD_socket_close_ (up->fd))
+    MHD_PANIC ("close failed\n");
+  if (-1 != up->pipe[0])
+    {
+      (void) close (up->pipe[0]);
+      (void) close (up->pipe[1]);
+    }
+  free (up);
+}
+
+
+/**
+ * Open a new connection to an upstream server; the connection is
+ * established in the background.
+ *
+ * @param daemon daemon (for logging)
+ * @param addr address of the upstream server
+ * @param addr_len number of bytes in @a addr
+ * @param[out] connecting set to #MHD_YES if the connection is not
+ *             established yet
+ * @return NULL on error
+ */
+static struct MHD_ProxyUpstream *
+upstream_connect (struct MHD_Daemon *daemon,
+                  const struct sockaddr *addr,
+                  socklen_t addr_len,
+                  int *connecting)
+{
+  struct MHD_ProxyUpstream *up;
+  MHD_socket fd;
+  int err;
+#if defined(TCP_NODELAY)
+  const _MHD_SOCKOPT_BOOL_TYPE on_val = 1;
+#endif
+
+  fd = socket (addr->sa_family, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == fd)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to create socket for upstream server: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return NULL;
+    }
+  (void) MHD_socket_noninheritable_ (daemon, fd);
+  if ( (MHD_YES != MHD_socket_nonblocking_ (daemon, fd)) ||
+       (NULL == (up = malloc (sizeof (struct MHD_ProxyUpstream)))) )
+    {
+      (void) MHD_socket_close_ (fd);
+      return NULL;
+    }
+  memset (up, 0, sizeof (struct MHD_ProxyUpstream));
+  memcpy (&up->addr, addr, addr_len);
+  up->addr_len = addr_len;
+  up->fd = fd;
+  up->pipe[0] = -1;
+  up->pipe[1] = -1;
+#if defined(TCP_NODELAY)
+  /* heads and short bodies are forwarded as soon as they arrive */
+  if (AF_INET == addr->sa_family
+#if HAVE_INET6
+      || AF_INET6 == addr->sa_family
+#endif
+      )
+    (void) setsockopt (fd,
+                       IPPROTO_TCP,
+                       TCP_NODELAY,
+                       (const void *) &on_val,
+                       sizeof (on_val));
+#endif
+  *connecting = MHD_NO;
+  if (0 == connect (fd, addr, addr_len))
+    return up;
+  err = MHD_socket_errno_;
+  if ( (EINPROGRESS == err) || (EAGAIN == err) || (EWOULDBLOCK == err) ||
+       (EINTR == err) )
+    {
+      *connecting = MHD_YES;
+      return up;
+    }
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Failed to connect to upstream server: %s\n",
+            MHD_socket_last_strerr_ ());
+#endif
+  upstream_close (up);
+  return NULL;
+}
+
+
+/**
+ * Take an idle connection to @a addr from the pool of @a daemon,
+ * dropping connections the upstream server closed in the meantime.
+ *
+ * @param daemon daemon with the pool
+ * @param addr address of the upstream server
+ * @param addr_len number of bytes in @a addr
+ * @return NULL if there is no usable connection
+ */
+static struct MHD_ProxyUpstream *
+pool_take (struct MHD_Daemon *daemon,
+           const struct sockaddr *addr,
+           socklen_t addr_len)
+{
+  struct MHD_ProxyUpstream *pos;
+  struct MHD_ProxyUpstream *next;
+  char c;
+  ssize_t ret;
+
+  next = daemon->proxy_pool_head;
+  while (NULL != (pos = next))
+    {
+      next = pos->next;
+      if ( (pos->addr_len != addr_len) ||
+           (0 != memcmp (&pos->addr, addr, addr_len)) )
+        continue;
+      DLL_remove (daemon->proxy_pool_head,
+                  daemon->proxy_pool_tail,
+                  pos);
+      daemon->proxy_pool_count--;
+      /* an idle connection must not have anything to read; EOF or
+         data means that the server closed it (or misbehaves) */
+      ret = recv (pos->fd, &c, 1, MSG_PEEK);
+      if ( (0 > ret) &&
+           ( (EAGAIN == MHD_socket_errno_) ||
+             (EWOULDBLOCK == MHD_socket_errno_) ) )
+        return pos;
+      upstream_close (pos);
+    }
+  return NULL;
+}
+
+
+/**
+ * Put an idle connection into the pool of @a daemon, closing the
+ * least recently used one if the pool is full.
+ *
+ * @param daemon daemon with the pool
+ * @param up connection to keep
+ */
+static void
+pool_put (struct MHD_Daemon *daemon,
+          struct MHD_ProxyUpstream *up)
+{
+  struct MHD_ProxyUpstream *old;
+
+  if (0 == daemon->proxy_pool_size)
+    {
+      upstream_close (up);
+      return;
+    }
+  if (daemon->proxy_pool_count >= daemon->proxy_pool_size)
+    {
+      old = daemon->proxy_pool_tail;
+      DLL_remove (daemon->proxy_pool_head,
+                  daemon->proxy_pool_tail,
+                  old);
+      daemon->proxy_pool_count--;
+      upstream_close (old);
+    }
+  DLL_insert (daemon->proxy_pool_head,
+              daemon->proxy_pool_tail,
+              up);
+  daemon->proxy_pool_count++;
+}
+
+
+/**
+ * Start watching the upstream socket of a proxied request in the
+ * event loop.
+ *
+ * @param p proxied request with an upstream connection
+ * @return #MHD_YES on success
+ */
+static int
+upstream_watch (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+#if EPOLL_SUPPORT
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct epoll_event event;
+
+  if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
+    {
+      event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+      event.data.ptr = (void *) (((uintptr_t) connection) | MHD_PROXY_EPOLL_TAG);
+      if (0 != epoll_ctl (daemon->epoll_fd,
+                          EPOLL_CTL_ADD,
+                          p->up->fd,
+                          &event))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Call to epoll_ctl failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+          return MHD_NO;
+        }
+      p->up_in_epoll = MHD_YES;
+    }
+#endif
+  connection->proxy_sock = p->up->fd;
+  p->up_rd = MHD_YES;
+  p->up_wr = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Stop using the upstream connection of a proxied request, keeping
+ * it for later requests if possible.
+ *
+ * @param p proxied request
+ * @param keep #MHD_YES to put the connection into the pool
+ */
+static void
+upstream_release (struct MHD_Proxy *p,
+                  int keep)
+{
+  struct MHD_Connection *connection = p->connection;
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_ProxyUpstream *up = p->up;
+
+  if (NULL == up)
+    return;
+  p->up = NULL;
+  connection->proxy_sock = MHD_INVALID_SOCKET;
+  connection->proxy_read_wanted = MHD_NO;
+  connection->proxy_write_wanted = MHD_NO;
+#if EPOLL_SUPPORT
+  if (MHD_YES == p->up_in_epoll)
+    {
+      if (0 != epoll_ctl (daemon->epoll_fd,
+                          EPOLL_CTL_DEL,
+                          up->fd,
+                          NULL))
+        MHD_PANIC ("Failed to remove FD from epoll set\n");
+      p->up_in_epoll = MHD_NO;
+    }
+#endif
+  if ( (MHD_YES == keep) &&
+       (0 == p->pipe_fill) )
+    pool_put (daemon, up);
+  else
+    upstream_close (up);
+  p->pipe_fill = 0;
+}
+
+
+/**
+ * Open a connection to the upstream server of the response of a
+ * proxied request, preferring an idle one from the pool.
+ *
+ * @param p proxied request without upstream connection
+ * @param use_pool #MHD_NO to always open a new connection
+ * @return #MHD_YES on success
+ */
+static int
+upstream_acquire (struct MHD_Proxy *p,
+                  int use_pool)
+{
+  struct MHD_Connection *connection = p->connection;
+  struct MHD_Response *response = connection->response;
+
+  p->reused = MHD_NO;
+  p->connecting = MHD_NO;
+  p->up = NULL;
+  if (MHD_YES == use_pool)
+    p->up = pool_take (connection->daemon,
+                       response->proxy_addr,
+                       response->proxy_addr_len);
+  if (NULL != p->up)
+    p->reused = MHD_YES;
+  else
+    p->up = upstream_connect (connection->daemon,
+                              response->proxy_addr,
+                              response->proxy_addr_len,
+                              &p->connecting);
+  if (NULL == p->up)
+    return MHD_NO;
+  if (MHD_YES != upstream_watch (p))
+    {
+      upstream_close (p->up);
+      p->up = NULL;
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Growable buffer for building the request head.
+ */
+struct MHD_ProxyBuffer
+{
+  /**
+   * Data (allocated with malloc()), NULL after an allocation failed.
+   */
+  char *data;
+
+  /**
+   * Number of bytes used in @e data.
+   */
+  size_t len;
+
+  /**
+   * Number of bytes allocated for @e data.
+   */
+  size_t size;
+};
+
+
+/**
+ * Append data to a buffer.
+ *
+ * @param buf buffer to append to
+ * @param data data to append
+ * @param len number of bytes in @a data
+ */
+static void
+buf_append (struct MHD_ProxyBuffer *buf,
+            const char *data,
+            size_t len)
+{
+  char *nd;
+  size_t ns;
+
+  if (NULL == buf->data)
+    return;
+  if (buf->size - buf->len < len)
+    {
+      ns = buf->size * 2 + len;
+      nd = realloc (buf->data, ns);
+      if (NULL == nd)
+        {
+          free (buf->data);
+          buf->data = NULL;
+          return;
+        }
+      buf->data = nd;
+      buf->size = ns;
+    }
+  memcpy (&buf->data[buf->len], data, len);
+  buf->len += len;
+}
+
+
+/**
+ * Append a string to a buffer.
+ *
+ * @param buf buffer to append to
+ * @param str 0-terminated string to append
+ */
+static void
+buf_append_str (struct MHD_ProxyBuffer *buf,
+                const char *str)
+{
+  buf_append (buf, str, strlen (str));
+}
+
+
+/**
+ * Append a string to a buffer, escaping the characters that may
+ * not appear in the path or the query of a URL.
+ *
+ * @param buf buffer to append to
+ * @param str 0-terminated (unescaped) string to append
+ * @param query #MHD_YES for names and values of arguments, which
+ *        must not contain the separators of the query either
+ */
+static void
+buf_append_escaped (struct MHD_ProxyBuffer *buf,
+                    const char *str,
+                    int query)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  const unsigned char *pos;
+  char esc[3];
+  size_t run;
+
+  pos = (const unsigned char *) str;
+  while ('\0' != *pos)
+    {
+      /* copy runs of characters that need no escaping at once */
+      run = 0;
+      while ( ( ( (pos[run] >= 'a') && (pos[run] <= 'z') ) ||
+                ( (pos[run] >= 'A') && (pos[run] <= 'Z') ) ||
+                ( (pos[run] >= '0') && (pos[run] <= '9') ) ||
+                (NULL != strchr ("-._~!$'()*,;:@/", pos[run])) ||
+                ( (MHD_NO == query) &&
+                  (NULL != strchr ("&=+", pos[run])) ) ) &&
+              ('\0' != pos[run]) )
+        run++;
+      buf_append (buf, (const char *) pos, run);
+      pos += run;
+      if ('\0' == *pos)
+        break;
+      esc[0] = '%';
+      esc[1] = hex[*pos >> 4];
+      esc[2] = hex[*pos & 15];
+      buf_append (buf, esc, 3);
+      pos++;
+    }
+}
+
+
+/**
+ * Append the numeric form of an address to a buffer.
+ *
+ * @param buf buffer to append to
+ * @param addr address to format
+ * @param with_port #MHD_YES to append the port (as for a "Host" header)
+ * @return #MHD_NO if the address family is not supported
+ */
+static int
+buf_append_addr (struct MHD_ProxyBuffer *buf,
+                 const struct sockaddr *addr,
+                 int with_port)
+{
+  char text[INET6_ADDRSTRLEN + 16];
+  size_t len;
+
+  switch (addr->sa_family)
+    {
+    case AF_INET:
+      if (NULL == inet_ntop (AF_INET,
+                             &((const struct sockaddr_in *) addr)->sin_addr,
+                             text,
+                             INET6_ADDRSTRLEN))
+        return MHD_NO;
+      len = strlen (text);
+      if (MHD_YES == with_port)
+        snprintf (&text[len],
+                  sizeof (text) - len,
+                  ":%u",
+                  (unsigned int) ntohs (((const struct sockaddr_in *) addr)->sin_port));
+      break;
+#if HAVE_INET6
+    case AF_INET6:
+      text[0] = '[';
+      if (NULL == inet_ntop (AF_INET6,
+                             &((const struct sockaddr_in6 *) addr)->sin6_addr,
+                             &text[1],
+                             INET6_ADDRSTRLEN))
+        return MHD_NO;
+      len = strlen (text);
+      if (MHD_YES == with_port)
+        snprintf (&text[len],
+                  sizeof (text) - len,
+                  "]:%u",
+                  (unsigned int) ntohs (((const struct sockaddr_in6 *) addr)->sin6_port));
+      else
+        snprintf (&text[len],
+                  sizeof (text) - len,
+                  "]");
+      /* "X-Forwarded-For" uses the address without brackets */
+      if (MHD_NO == with_port)
+        {
+          buf_append (buf, &text[1], len - 1);
+          return MHD_YES;
+        }
+      break;
+#endif
+    default:
+      return MHD_NO;
+    }
+  buf_append_str (buf, text);
+  return MHD_YES;
+}
+
+
+/**
+ * Check if a request header is specific to the connection between
+ * client and proxy and thus not forwarded.
+ *
+ * @param name name of the header
+ * @return #MHD_YES if the header is not forwarded
+ */
+static int
+is_hop_by_hop (const char *name)
+{
+  return ( (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_CONNECTION)) ||
+           (MHD_str_equal_caseless_ (name, "Keep-Alive")) ||
+           (MHD_str_equal_caseless_ (name, "Proxy-Connection")) ||
+           (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_PROXY_AUTHORIZATION)) ||
+           (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_TE)) ||
+           (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_TRAILER)) ||
+           (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_TRANSFER_ENCODING)) ||
+           (MHD_str_equal_caseless_ (name, MHD_HTTP_HEADER_UPGRADE)) )
+    ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Build the head of the request for the upstream server.
+ *
+ * @param p proxied request
+ * @return #MHD_YES on success, #MHD_NO if out of memory
+ */
+static int
+build_request_head (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+  struct MHD_Response *response = connection->response;
+  struct MHD_HTTP_Header *pos;
+  struct MHD_ProxyBuffer buf;
+  const char *xff;
+  const char *conn_tokens;
+  const char *te;
+  char sep;
+  int have_host;
+
+  buf.size = 512;
+  buf.len = 0;
+  buf.data = malloc (buf.size);
+  buf_append_str (&buf, connection->method);
+  buf_append (&buf, " ", 1);
+  if (NULL != response->proxy_url)
+    {
+      buf_append_str (&buf, response->proxy_url);
+    }
+  else
+    {
+      /* MHD unescaped URL and arguments, escape them again */
+      buf_append_escaped (&buf, connection->url, MHD_NO);
+      sep = '?';
+      for (pos = connection->headers_received; NULL != pos; pos = pos->next)
+        {
+          if (MHD_GET_ARGUMENT_KIND != pos->kind)
+            continue;
+          buf_append (&buf, &sep, 1);
+          buf_append_escaped (&buf, pos->header, MHD_YES);
+          if (NULL != pos->value)
+            {
+              buf_append (&buf, "=", 1);
+              buf_append_escaped (&buf, pos->value, MHD_YES);
+            }
+          sep = '&';
+        }
+    }
+  buf_append_str (&buf, " " MHD_HTTP_VERSION_1_1 "\r\n");
+  have_host = MHD_NO;
+  xff = NULL;
+  conn_tokens = MHD_lookup_connection_value (connection,
+                                             MHD_HEADER_KIND,
+                                             MHD_HTTP_HEADER_CONNECTION);
+  te = MHD_lookup_connection_value (connection,
+                                    MHD_HEADER_KIND,
+                                    MHD_HTTP_HEADER_TRANSFER_ENCODING);
+  for (pos = connection->headers_received; NULL != pos; pos = pos->next)
+    {
+      if (MHD_HEADER_KIND != pos->kind)
+        continue;
+      if ( (MHD_YES == is_hop_by_hop (pos->header)) ||
+           (MHD_str_equal_caseless_ (pos->header, MHD_HTTP_HEADER_EXPECT)) )
+        continue;
+      if (MHD_str_equal_caseless_ (pos->header,
+                                   MHD_HTTP_HEADER_CONTENT_LENGTH))
+        {
+          /* with "Transfer-Encoding" the length is meaningless
+             (RFC 7230, 3.3.3); forwarding both would let the
+             upstream server frame the body differently than we do */
+          if (NULL != te)
+            continue;
+        }
+      else if (MHD_str_has_token_caseless_ (conn_tokens,
+                                            pos->header))
+        {
+          /* named as hop-by-hop by the client (RFC 7230, 6.1);
+             the framing headers are ours to decide and kept */
+          continue;
+        }
+      if (MHD_str_equal_caseless_ (pos->header, "X-Forwarded-For"))
+        {
+          xff = pos->value;
+          continue;
+        }
+      if (MHD_str_equal_caseless_ (pos->header, MHD_HTTP_HEADER_HOST))
+        have_host = MHD_YES;
+      buf_append_str (&buf, pos->header);
+      buf_append (&buf, ": ", 2);
+      buf_append_str (&buf, pos->value);
+      buf_append (&buf, "\r\n", 2);
+    }
+  if (MHD_NO == have_host)
+    {
+      buf_append_str (&buf, MHD_HTTP_HEADER_HOST ": ");
+      if (MHD_YES != buf_append_addr (&buf, response->proxy_addr, MHD_YES))
+        buf_append_str (&buf, "localhost");
+      buf_append (&buf, "\r\n", 2);
+    }
+  if (MHD_PROXY_BODY_CHUNKED == p->req_body)
+    buf_append_str (&buf, MHD_HTTP_HEADER_TRANSFER_ENCODING ": chunked\r\n");
+  if (NULL != connection->addr)
+    {
+      buf_append_str (&buf, "X-Forwarded-For: ");
+      if (NULL != xff)
+        {
+          buf_append_str (&buf, xff);
+          buf_append (&buf, ", ", 2);
+        }
+      if (MHD_YES != buf_append_addr (&buf, connection->addr, MHD_NO))
+        buf_append_str (&buf, "unknown");
+      buf_append (&buf, "\r\n", 2);
+    }
+  if (0 == connection->daemon->proxy_pool_size)
+    buf_append_str (&buf, MHD_HTTP_HEADER_CONNECTION ": close\r\n");
+  buf_append (&buf, "\r\n", 2);
+  if (NULL == buf.data)
+    return MHD_NO;
+  p->head = buf.data;
+  p->head_size = buf.len;
+  p->head_off = 0;
+  return MHD_YES;
+}
+
+
+/**
+ * Account for request data that arrived in the read buffer beyond
+ * the part already known to belong to the body.
+ *
+ * @param p proxied request
+ */
+static void
+request_scan (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+  size_t avail;
+  size_t n;
+
+  if (MHD_YES == p->req_received)
+    return;
+  avail = connection->read_buffer_offset - p->req_fwd;
+  switch (p->req_body)
+    {
+    case MHD_PROXY_BODY_LENGTH:
+      n = avail;
+      if ((uint64_t) n > p->req_left)
+        n = (size_t) p->req_left;
+      p->req_fwd += n;
+      p->req_left -= n;
+      if (0 == p->req_left)
+        p->req_received = MHD_YES;
+      break;
+    case MHD_PROXY_BODY_CHUNKED:
+      p->req_fwd += chunks_scan (&p->req_chunks,
+                                 &connection->read_buffer[p->req_fwd],
+                                 avail,
+                                 MHD_NO,
+                                 &n);
+      if (CHUNK_DONE == p->req_chunks.state)
+        p->req_received = MHD_YES;
+      if (CHUNK_ERROR == p->req_chunks.state)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Received malformed chunked request body\n");
+#endif
+          p->failed = MHD_YES;
+        }
+      break;
+    default:
+      p->req_received = MHD_YES;
+      break;
+    }
+}
+
+
+/**
+ * Account for response data that arrived in the write buffer at
+ * @a off, stripping the chunk framing if needed.
+ *
+ * @param p proxied request
+ * @param off offset of the new data in the write buffer
+ */
+static void
+response_scan (struct MHD_Proxy *p,
+               size_t off)
+{
+  struct MHD_Connection *connection = p->connection;
+  size_t avail;
+  size_t used;
+  size_t out;
+
+  avail = connection->write_buffer_append_offset - off;
+  switch (p->resp_body)
+    {
+    case MHD_PROXY_BODY_LENGTH:
+      used = avail;
+      if ((uint64_t) used > p->resp_left)
+        used = (size_t) p->resp_left;
+      p->resp_left -= used;
+      out = used;
+      if (0 == p->resp_left)
+        p->resp_received = MHD_YES;
+      break;
+    case MHD_PROXY_BODY_CHUNKED:
+      used = chunks_scan (&p->resp_chunks,
+                          &connection->write_buffer[off],
+                          avail,
+                          p->dechunk,
+                          &out);
+      if (CHUNK_DONE == p->resp_chunks.state)
+        p->resp_received = MHD_YES;
+      if (CHUNK_ERROR == p->resp_chunks.state)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Received malformed chunked response from upstream server\n");
+#endif
+          p->failed = MHD_YES;
+        }
+      break;
+    case MHD_PROXY_BODY_CLOSE:
+      used = avail;
+      out = avail;
+      break;
+    default:
+      used = 0;
+      out = 0;
+      p->resp_received = MHD_YES;
+      break;
+    }
+  if (used < avail)
+    {
+      /* data beyond the end of the response, do not reuse a
+         connection that is out of sync */
+      p->up_reusable = MHD_NO;
+    }
+  connection->write_buffer_append_offset = off + out;
+}
+
+
+/**
+ * Answer the client with the status in the @e error_code of @a p
+ * because the upstream server could not be reached or failed
+ * before answering, or the request cannot be forwarded.
+ *
+ * @param p proxied request
+ */
+static void
+respond_error (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+  int ret;
+
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (connection->daemon,
+            "Answering proxied request with status %u\n",
+            p->error_code);
+#endif
+  upstream_release (p, MHD_NO);
+  ret = snprintf (connection->write_buffer,
+                  connection->write_buffer_size,
+                  "%s %u %s\r\n"
+                  MHD_HTTP_HEADER_CONTENT_LENGTH ": 0\r\n"
+                  MHD_HTTP_HEADER_CONNECTION ": close\r\n\r\n",
+                  (MHD_YES == p->client_http10)
+                  ? MHD_HTTP_VERSION_1_0 : MHD_HTTP_VERSION_1_1,
+                  p->error_code,
+                  MHD_get_reason_phrase_for (p->error_code));
+  if ( (0 > ret) ||
+       ((size_t) ret >= connection->write_buffer_size) )
+    {
+      p->failed = MHD_YES;
+      return;
+    }
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = ret;
+  p->head_received = MHD_YES;
+  p->resp_received = MHD_YES;
+  p->resp_body = MHD_PROXY_BODY_NONE;
+  p->client_close = MHD_YES;
+  p->req_received = MHD_YES; /* stop reading the body */
+  p->req_fwd = 0;
+  connection->read_buffer_offset = 0;
+}
+
+
+/**
+ * Handle the failure of the upstream connection: retry once on a
+ * fresh connection if a pooled connection failed before anything
+ * was lost, answer with an error if the client did not get anything
+ * yet, and give up otherwise.
+ *
+ * @param p proxied request
+ */
+static void
+upstream_failed (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+
+  if (MHD_YES == p->head_received)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Upstream server failed while sending the response\n");
+#endif
+      upstream_release (p, MHD_NO);
+      p->failed = MHD_YES;
+      return;
+    }
+  if ( (MHD_YES == p->reused) &&
+       (0 == p->req_forwarded) &&
+       (0 == p->pipe_fill) &&
+       (0 == connection->write_buffer_append_offset) )
+    {
+      /* the server closed an idle connection we just reused */
+      upstream_release (p, MHD_NO);
+      p->head_off = 0;
+      if (MHD_YES == upstream_acquire (p, MHD_NO))
+        return;
+    }
+  respond_error (p);
+}
+
+
+/**
+ * Send data to the upstream server.
+ *
+ * @param p proxied request
+ * @param data data to send
+ * @param len number of bytes in @a data
+ * @return number of bytes sent, 0 if none (check @e up_wr and @e up)
+ */
+static size_t
+upstream_send (struct MHD_Proxy *p,
+               const char *data,
+               size_t len)
+{
+  ssize_t ret;
+  int err;
+
+  ret = send (p->up->fd,
+              data,
+              (_MHD_socket_funcs_size) len,
+              MSG_NOSIGNAL);
+  if (0 < ret)
+    {
+      if ((size_t) ret < len)
+        p->up_wr = MHD_NO;
+      return (size_t) ret;
+    }
+  err = MHD_socket_errno_;
+  if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+    {
+      p->up_wr = MHD_NO;
+      return 0;
+    }
+  upstream_failed (p);
+  return 0;
+}
+
+
+/**
+ * Receive data from the upstream server.
+ *
+ * @param p proxied request
+ * @param data where to store the data
+ * @param len number of bytes available at @a data
+ * @param[out] eof set to #MHD_YES if the server closed the connection
+ * @return number of bytes received, 0 if none
+ */
+static size_t
+upstream_recv (struct MHD_Proxy *p,
+               char *data,
+               size_t len,
+               int *eof)
+{
+  ssize_t ret;
+  int err;
+
+  *eof = MHD_NO;
+  ret = recv (p->up->fd,
+              data,
+              (_MHD_socket_funcs_size) len,
+              MSG_NOSIGNAL);
+  if (0 < ret)
+    {
+      if ((size_t) ret < len)
+        p->up_rd = MHD_NO;
+      return (size_t) ret;
+    }
+  if (0 == ret)
+    {
+      *eof = MHD_YES;
+      return 0;
+    }
+  err = MHD_socket_errno_;
+  if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+    {
+      p->up_rd = MHD_NO;
+      return 0;
+    }
+  *eof = MHD_YES;
+  return 0;
+}
+
+
+/**
+ * Handle the end of the upstream connection while reading.
+ *
+ * @param p proxied request
+ */
+static void
+upstream_eof (struct MHD_Proxy *p)
+{
+  if ( (MHD_YES == p->head_received) &&
+       (MHD_PROXY_BODY_CLOSE == p->resp_body) )
+    {
+      p->resp_received = MHD_YES;
+      p->up_reusable = MHD_NO;
+      upstream_release (p, MHD_NO);
+      return;
+    }
+  upstream_failed (p);
+}
+
+
+/**
+ * Check if the client uses a plain socket (and not TLS or a custom
+ * transport), so that splice() can be used.
+ *
+ * @param connection connection of the client
+ * @return #MHD_YES if the connection uses a plain socket
+ */
+static int
+client_uses_plain_socket (struct MHD_Connection *connection)
+{
+#if HTTPS_SUPPORT
+  if (NULL != connection->tls_session)
+    return MHD_NO;
+#endif
+  if (NULL != connection->transport.recv)
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Note that the client socket cannot be read from any more for now.
+ *
+ * @param p proxied request
+ */
+static void
+client_not_readable (struct MHD_Proxy *p)
+{
+  p->client_rd = MHD_NO;
+#if EPOLL_SUPPORT
+  p->connection->epoll_state &= ~MHD_EPOLL_STATE_READ_READY;
+#endif
+}
+
+
+/**
+ * Note that the client socket cannot be written to any more for now.
+ *
+ * @param p proxied request
+ */
+static void
+client_not_writable (struct MHD_Proxy *p)
+{
+  p->client_wr = MHD_NO;
+#if EPOLL_SUPPORT
+  p->connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+#endif
+}
+
+
+/**
+ * Send data to the client.
+ *
+ * @param p proxied request
+ * @param data data to send
+ * @param len number of bytes in @a data
+ * @return number of bytes sent, 0 if none
+ */
+static size_t
+client_send (struct MHD_Proxy *p,
+             const char *data,
+             size_t len)
+{
+  struct MHD_Connection *connection = p->connection;
+  ssize_t ret;
+  int err;
+
+  ret = connection->send_cls (connection, data, len);
+  if (0 < ret)
+    {
+      if ((size_t) ret < len)
+        client_not_writable (p);
+      return (size_t) ret;
+    }
+  err = MHD_socket_errno_;
+  if ( (0 == ret) ||
+       (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+    {
+      client_not_writable (p);
+      return 0;
+    }
+  /* client is gone */
+  p->failed = MHD_YES;
+  return 0;
+}
+
+
+/**
+ * Receive data from the client into the read buffer.
+ *
+ * @param p proxied request
+ * @return number of bytes received, 0 if none
+ */
+static size_t
+client_recv (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+  ssize_t ret;
+  size_t len;
+  int err;
+
+  len = connection->read_buffer_size - connection->read_buffer_offset;
+  ret = connection->recv_cls (connection,
+                              &connection->read_buffer
+                              [connection->read_buffer_offset],
+                              len);
+  if (0 < ret)
+    {
+      connection->read_buffer_offset += ret;
+      if ((size_t) ret < len)
+        client_not_readable (p);
+      return (size_t) ret;
+    }
+  err = MHD_socket_errno_;
+  if ( (0 > ret) &&
+       ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) ) )
+    {
+      client_not_readable (p);
+      return 0;
+    }
+  /* client closed the connection (or failed); fine once the whole
+     request was received, the response is still delivered */
+  connection->read_closed = MHD_YES;
+  p->client_close = MHD_YES;
+  if ( (0 != ret) ||
+       (MHD_NO == p->req_received) )
+    p->failed = MHD_YES;
+  return 0;
+}
+
+
+#if LINUX
+/**
+ * Make sure the upstream connection has a pipe for splice().
+ *
+ * @param p proxied request
+ * @return #MHD_YES if there is a pipe
+ */
+static int
+pipe_ready (struct MHD_Proxy *p)
+{
+  if (-1 != p->up->pipe[0])
+    return MHD_YES;
+  if (MHD_YES == p->no_splice)
+    return MHD_NO;
+  if (0 != pipe2 (p->up->pipe, O_NONBLOCK | O_CLOEXEC))
+    {
+      p->up->pipe[0] = -1;
+      p->up->pipe[1] = -1;
+      p->no_splice = MHD_YES;
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+#endif
+
+
+/**
+ * Move data from the client to the upstream server.
+ *
+ * @param p proxied request
+ * @return #MHD_YES if any progress was made
+ */
+static int
+pump_request (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+  size_t n;
+  int so_err;
+  socklen_t so_len;
+#if LINUX
+  ssize_t ret;
+  int err;
+#endif
+
+  if (NULL == p->up)
+    return MHD_NO;
+  if (MHD_YES == p->connecting)
+    {
+      /* connect() completed once the socket is writable */
+      if (MHD_NO == p->up_wr)
+        return MHD_NO;
+      so_err = 0;
+      so_len = sizeof (so_err);
+      if (0 != getsockopt (p->up->fd,
+                           SOL_SOCKET,
+                           SO_ERROR,
+                           (void *) &so_err,
+                           &so_len))
+        so_err = MHD_socket_errno_;
+      if ( (EINPROGRESS == so_err) ||
+           (EALREADY == so_err) )
+        {
+          p->up_wr = MHD_NO;
+          return MHD_NO;
+        }
+      if (0 != so_err)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Failed to connect to upstream server: %s\n",
+                    strerror (so_err));
+#endif
+          upstream_failed (p);
+          return MHD_YES;
+        }
+      p->connecting = MHD_NO;
+    }
+  if (p->head_off < p->head_size)
+    {
+      if (MHD_NO == p->up_wr)
+        return MHD_NO;
+      n = upstream_send (p,
+                         &p->head[p->head_off],
+                         p->head_size - p->head_off);
+      p->head_off += n;
+      return (0 != n) ? MHD_YES : MHD_NO;
+    }
+  if (0 != p->req_fwd)
+    {
+      /* body data in the read buffer */
+      if (MHD_NO == p->up_wr)
+        return MHD_NO;
+      n = upstream_send (p,
+                         connection->read_buffer,
+                         p->req_fwd);
+      if (0 == n)
+        return MHD_NO;
+      memmove (connection->read_buffer,
+               &connection->read_buffer[n],
+               connection->read_buffer_offset - n);
+      connection->read_buffer_offset -= n;
+      p->req_fwd -= n;
+      p->req_forwarded += n;
+      return MHD_YES;
+    }
+#if LINUX
+  if ( (0 != p->pipe_fill) &&
+       (MHD_YES == p->pipe_request) )
+    {
+      if (MHD_NO == p->up_wr)
+        return MHD_NO;
+      ret = splice (p->up->pipe[0],
+                    NULL,
+                    p->up->fd,
+                    NULL,
+                    p->pipe_fill,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (0 < ret)
+        {
+          p->pipe_fill -= ret;
+          p->req_forwarded += ret;
+          return MHD_YES;
+        }
+      err = errno;
+      if ( (EINTR == err) || (EAGAIN == err) )
+        p->up_wr = MHD_NO;
+      else
+        upstream_failed (p);
+      return MHD_NO;
+    }
+  if ( (MHD_PROXY_BODY_LENGTH == p->req_body) &&
+       (MHD_NO == p->req_received) &&
+       (0 == connection->read_buffer_offset) &&
+       (0 == p->pipe_fill) &&
+       (MHD_YES == client_uses_plain_socket (connection)) &&
+       (MHD_YES == pipe_ready (p)) )
+    {
+      /* body of known length from a plain socket: move it to the
+         upstream server without copying */
+      if (MHD_NO == p->client_rd)
+        return MHD_NO;
+      n = SPLICE_CHUNK;
+      if ((uint64_t) n > p->req_left)
+        n = (size_t) p->req_left;
+      ret = splice (connection->socket_fd,
+                    NULL,
+                    p->up->pipe[1],
+                    NULL,
+                    n,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (0 < ret)
+        {
+          p->pipe_fill = ret;
+          p->pipe_request = MHD_YES;
+          p->req_left -= ret;
+          if (0 == p->req_left)
+            p->req_received = MHD_YES;
+          MHD_update_last_activity_ (connection);
+          return MHD_YES;
+        }
+      err = errno;
+      if ( (0 > ret) &&
+           ( (EINTR == err) || (EAGAIN == err) ) )
+        client_not_readable (p);
+      else
+        {
+          connection->read_closed = MHD_YES;
+          p->failed = MHD_YES;
+        }
+      return MHD_NO;
+    }
+#endif
+  if ( (MHD_NO == connection->read_closed) &&
+       (connection->read_buffer_offset < connection->read_buffer_size) &&
+       (MHD_YES == p->client_rd) )
+    {
+      /* body (or the next request of the client) */
+      if (0 == client_recv (p))
+        return MHD_NO;
+      request_scan (p);
+      MHD_update_last_activity_ (connection);
+      return MHD_YES;
+    }
+  return MHD_NO;
+}
+
+
+/**
+ * Collect the values of all header lines named @a name in a
+ * response head that was not parsed yet, separated by commas.
+ *
+ * @param line first header line of the head
+ * @param end end of the head
+ * @param name name of the header
+ * @param[out] values buffer to append the values to
+ */
+static void
+collect_header_values (const char *line,
+                       const char *end,
+                       const char *name,
+                       struct MHD_ProxyBuffer *values)
+{
+  const size_t name_len = strlen (name);
+  const char *eol;
+  const char *vend;
+
+  for (; line < end; line = eol + 1)
+    {
+      eol = memchr (line, '\n', end - line);
+      if (NULL == eol)
+        eol = end;
+      if ( ((size_t) (eol - line) <= name_len) ||
+           (':' != line[name_len]) ||
+           (! MHD_str_equal_caseless_n_ (line, name, name_len)) )
+        continue;
+      vend = eol;
+      if ( (vend > line) && ('\r' == vend[-1]) )
+        vend--;
+      buf_append (values, ",", 1);
+      buf_append (values,
+                  &line[name_len + 1],
+                  vend - &line[name_len + 1]);
+    }
+}
+
+
+/**
+ * Parse the head of the response of the upstream server at the
+ * start of the write buffer and replace it with the head for the
+ * client.
+ *
+ * @param p proxied request
+ * @param head_len number of bytes of the head (including the empty line)
+ * @return #MHD_YES if a final response head was processed, #MHD_NO if
+ *         it was an interim response (or the head is malformed, then
+ *         @e failed or @e head_received is set)
+ */
+static int
+process_response_head (struct MHD_Proxy *p,
+                       size_t head_len)
+{
+  struct MHD_Connection *connection = p->connection;
+  char *buf = connection->write_buffer;
+  struct MHD_ProxyBuffer out;
+  char *line;
+  char *eol;
+  char *colon;
+  char *value;
+  char *end;
+  const char *length_value;
+  struct MHD_ProxyBuffer conn_tokens;
+  unsigned int status;
+  int up_http11;
+  int up_close;
+  int up_keepalive;
+  int have_te;
+  int chunked;
+  int have_length;
+  uint64_t length;
+  size_t body;
+
+  /* status line */
+  if ( (head_len < 13) ||
+       (0 != strncmp (buf, "HTTP/1.", 7)) ||
+       ( ('0' != buf[7]) && ('1' != buf[7]) ) ||
+       (' ' != buf[8]) ||
+       (buf[9] < '1') || (buf[9] > '5') ||
+       (buf[10] < '0') || (buf[10] > '9') ||
+       (buf[11] < '0') || (buf[11] > '9') )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Received malformed response from upstream server\n");
+#endif
+      p->up_reusable = MHD_NO;
+      respond_error (p);
+      return MHD_NO;
+    }
+  up_http11 = ('1' == buf[7]) ? MHD_YES : MHD_NO;
+  status = (buf[9] - '0') * 100 + (buf[10] - '0') * 10 + (buf[11] - '0');
+  if (status < 200)
+    {
+      if (MHD_HTTP_SWITCHING_PROTOCOLS == status)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Upstream server tried to switch protocols\n");
+#endif
+          p->up_reusable = MHD_NO;
+          respond_error (p);
+          return MHD_NO;
+        }
+      /* interim response, we already sent "100 Continue" ourselves */
+      memmove (buf,
+               &buf[head_len],
+               connection->write_buffer_append_offset - head_len);
+      connection->write_buffer_append_offset -= head_len;
+      return MHD_NO;
+    }
+
+  out.size = head_len + HEAD_RESERVE;
+  out.len = 0;
+  out.data = malloc (out.size);
+  eol = memchr (buf, '\n', head_len);
+  end = eol;
+  if ( (end > buf) && ('\r' == end[-1]) )
+    end--;
+  buf_append_str (&out, (MHD_YES == p->client_http10)
+                  ? MHD_HTTP_VERSION_1_0 : MHD_HTTP_VERSION_1_1);
+  buf_append (&out, &buf[8], end - &buf[8]);
+  buf_append (&out, "\r\n", 2);
+
+  /* headers named in "Connection" are hop-by-hop (RFC 7230, 6.1);
+     the header may follow them, so collect its tokens first */
+  conn_tokens.size = 64;
+  conn_tokens.len = 0;
+  conn_tokens.data = malloc (conn_tokens.size);
+  collect_header_values (eol + 1,
+                         &buf[head_len],
+                         MHD_HTTP_HEADER_CONNECTION,
+                         &conn_tokens);
+  buf_append (&conn_tokens, "", 1);
+  if (NULL == conn_tokens.data)
+    {
+      free (out.data);
+      p->failed = MHD_YES;
+      return MHD_NO;
+    }
+
+  up_close = MHD_NO;
+  up_keepalive = MHD_NO;
+  have_te = MHD_NO;
+  chunked = MHD_NO;
+  have_length = MHD_NO;
+  length_value = NULL;
+  length = 0;
+  line = eol + 1;
+  while (line < &buf[head_len])
+    {
+      eol = memchr (line, '\n', &buf[head_len] - line);
+      end = eol;
+      if ( (end > line) && ('\r' == end[-1]) )
+        end--;
+      if (end == line)
+        break; /* empty line, end of head */
+      *end = '\0';
+      colon = strchr (line, ':');
+      if ( (NULL == colon) ||
+           (colon == line) ||
+           (' ' == line[0]) || ('\t' == line[0]) )
+        {
+          /* no obsolete line folding or other oddities */
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Received malformed response header from upstream server\n");
+#endif
+          free (out.data);
+          free (conn_tokens.data);
+          p->up_reusable = MHD_NO;
+          respond_error (p);
+          return MHD_NO;
+        }
+      *colon = '\0';
+      value = colon + 1;
+      while ( (' ' == *value) || ('\t' == *value) )
+        value++;
+      if (MHD_str_equal_caseless_ (line, MHD_HTTP_HEADER_CONNECTION))
+        {
+          if (MHD_str_has_token_caseless_ (value, "close"))
+            up_close = MHD_YES;
+          if (MHD_str_has_token_caseless_ (value, "keep-alive"))
+            up_keepalive = MHD_YES;
+        }
+      else if (MHD_str_equal_caseless_ (line, MHD_HTTP_HEADER_TRANSFER_ENCODING))
+        {
+          have_te = MHD_YES;
+          if (MHD_str_has_token_caseless_ (value, "chunked"))
+            chunked = MHD_YES;
+          else
+            up_close = MHD_YES; /* body ends with the connection */
+          if (MHD_NO == p->client_http10)
+            {
+              buf_append_str (&out, MHD_HTTP_HEADER_TRANSFER_ENCODING ": ");
+              buf_append_str (&out, value);
+              buf_append (&out, "\r\n", 2);
+            }
+        }
+      else if (MHD_str_equal_caseless_ (line, MHD_HTTP_HEADER_CONTENT_LENGTH))
+        {
+          if ( (0 == MHD_str_to_uint64_ (value, &length)) ||
+               ( (MHD_YES == have_length) &&
+                 (length != p->resp_left) ) )
+            {
+              free (out.data);
+              free (conn_tokens.data);
+              p->up_reusable = MHD_NO;
+              respond_error (p);
+              return MHD_NO;
+            }
+          /* only forwarded once the framing is known */
+          length_value = value;
+          have_length = MHD_YES;
+          p->resp_left = length;
+        }
+      else if ( (MHD_NO == is_hop_by_hop (line)) &&
+                (! MHD_str_has_token_caseless_ (conn_tokens.data,
+                                                line)) )
+        {
+          buf_append_str (&out, line);
+          buf_append (&out, ": ", 2);
+          buf_append_str (&out, value);
+          buf_append (&out, "\r\n", 2);
+        }
+      line = eol + 1;
+    }
+  free (conn_tokens.data);
+
+  /* find the end of the body; with "Transfer-Encoding" the length
+     is meaningless (RFC 7230, 3.3.3) */
+  p->up_reusable = ( ( (MHD_YES == up_http11) &&
+                       (MHD_NO == up_close) ) ||
+                     ( (MHD_NO == up_http11) &&
+                       (MHD_YES == up_keepalive) &&
+                       (MHD_NO == up_close) ) ) ? MHD_YES : MHD_NO;
+  if ( (MHD_YES == p->is_head) ||
+       (MHD_HTTP_NO_CONTENT == status) ||
+       (MHD_HTTP_NOT_MODIFIED == status) )
+    p->resp_body = MHD_PROXY_BODY_NONE;
+  else if (MHD_YES == chunked)
+    p->resp_body = MHD_PROXY_BODY_CHUNKED;
+  else if (MHD_YES == have_te)
+    p->resp_body = MHD_PROXY_BODY_CLOSE;
+  else if (MHD_YES == have_length)
+    p->resp_body = (0 == p->resp_left)
+      ? MHD_PROXY_BODY_NONE : MHD_PROXY_BODY_LENGTH;
+  else
+    p->resp_body = MHD_PROXY_BODY_CLOSE;
+  if (MHD_PROXY_BODY_CLOSE == p->resp_body)
+    {
+      p->up_reusable = MHD_NO;
+      p->client_close = MHD_YES;
+    }
+  if ( (MHD_PROXY_BODY_CHUNKED == p->resp_body) &&
+       (MHD_YES == p->client_http10) )
+    {
+      /* HTTP/1.0 clients do not know chunks, the body ends
+         with the connection instead */
+      p->dechunk = MHD_YES;
+      p->client_close = MHD_YES;
+    }
+  if ( (MHD_YES == have_length) &&
+       (MHD_NO == have_te) )
+    {
+      /* never together with "Transfer-Encoding" from upstream, and
+         then there is also no length for a dechunked body */
+      buf_append_str (&out, MHD_HTTP_HEADER_CONTENT_LENGTH ": ");
+      buf_append_str (&out, length_value);
+      buf_append (&out, "\r\n", 2);
+    }
+  if (MHD_YES == p->client_close)
+    buf_append_str (&out, MHD_HTTP_HEADER_CONNECTION ": close\r\n");
+  buf_append (&out, "\r\n", 2);
+  if (NULL == out.data)
+    {
+      p->failed = MHD_YES;
+      return MHD_NO;
+    }
+
+  /* the rewritten head replaces the original one, the body that was
+     received with it follows; #HEAD_RESERVE guarantees that it fits */
+  body = connection->write_buffer_append_offset - head_len;
+  if (out.len + body > connection->write_buffer_size)
+    {
+      free (out.data);
+      p->failed = MHD_YES;
+      return MHD_NO;
+    }
+  memmove (&buf[out.len],
+           &buf[head_len],
+           body);
+  memcpy (buf, out.data, out.len);
+  free (out.data);
+  connection->write_buffer_append_offset = out.len + body;
+  p->head_received = MHD_YES;
+  /* the request can no longer be retried */
+  free (p->head);
+  p->head = NULL;
+  p->head_size = 0;
+  p->head_off = 0;
+  response_scan (p, out.len);
+  return MHD_YES;
+}
+
+
+/**
+ * Find the end of the response head at the start of the write buffer.
+ *
+ * @param connection connection with the data from the upstream server
+ * @return length of the head including the empty line, 0 if incomplete
+ */
+static size_t
+find_head_end (struct MHD_Connection *connection)
+{
+  const char *buf = connection->write_buffer;
+  size_t len = connection->write_buffer_append_offset;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      if ('\n' != buf[i])
+        continue;
+      if ( (i + 1 < len) &&
+           ('\n' == buf[i + 1]) )
+        return i + 2;
+      if ( (i + 2 < len) &&
+           ('\r' == buf[i + 1]) &&
+           ('\n' == buf[i + 2]) )
+        return i + 3;
+    }
+  return 0;
+}
+
+
+/**
+ * Move data from the upstream server to the client.
+ *
+ * @param p proxied request
+ * @return #MHD_YES if any progress was made
+ */
+static int
+pump_response (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+  size_t n;
+  size_t off;
+  size_t limit;
+  size_t head_len;
+  int eof;
+#if LINUX
+  ssize_t ret;
+  int err;
+#endif
+
+  if (0 != p->continue_left)
+    {
+      if (MHD_NO == p->client_wr)
+        return MHD_NO;
+      n = client_send (p,
+                       &PROXY_100_CONTINUE[strlen (PROXY_100_CONTINUE) -
+                                           p->continue_left],
+                       p->continue_left);
+      p->continue_left -= n;
+      return (0 != n) ? MHD_YES : MHD_NO;
+    }
+  if ( (MHD_YES == p->head_received) &&
+       (connection->write_buffer_send_offset !=
+        connection->write_buffer_append_offset) )
+    {
+      if (MHD_NO == p->client_wr)
+        return MHD_NO;
+      n = client_send (p,
+                       &connection->write_buffer
+                       [connection->write_buffer_send_offset],
+                       connection->write_buffer_append_offset -
+                       connection->write_buffer_send_offset);
+      if (0 == n)
+        return MHD_NO;
+      connection->write_buffer_send_offset += n;
+      if (connection->write_buffer_send_offset ==
+          connection->write_buffer_append_offset)
+        {
+          connection->write_buffer_send_offset = 0;
+          connection->write_buffer_append_offset = 0;
+        }
+      MHD_update_last_activity_ (connection);
+      return MHD_YES;
+    }
+#if LINUX
+  if ( (0 != p->pipe_fill) &&
+       (MHD_NO == p->pipe_request) )
+    {
+      if (MHD_NO == p->client_wr)
+        return MHD_NO;
+      ret = splice (p->up->pipe[0],
+                    NULL,
+                    connection->socket_fd,
+                    NULL,
+                    p->pipe_fill,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (0 < ret)
+        {
+          p->pipe_fill -= ret;
+          MHD_update_last_activity_ (connection);
+          return MHD_YES;
+        }
+      err = errno;
+      if ( (EINTR == err) || (EAGAIN == err) )
+        client_not_writable (p);
+      else
+        p->failed = MHD_YES;
+      return MHD_NO;
+    }
+#endif
+  if ( (NULL == p->up) ||
+       (MHD_YES == p->connecting) ||
+       (MHD_YES == p->resp_received) ||
+       (MHD_NO == p->up_rd) )
+    return MHD_NO;
+#if LINUX
+  if ( (MHD_YES == p->head_received) &&
+       ( (MHD_PROXY_BODY_LENGTH == p->resp_body) ||
+         (MHD_PROXY_BODY_CLOSE == p->resp_body) ) &&
+       (0 == connection->write_buffer_append_offset) &&
+       (0 == p->pipe_fill) &&
+       (MHD_YES == client_uses_plain_socket (connection)) &&
+       (MHD_YES == pipe_ready (p)) )
+    {
+      /* body of known length (or up to the end of the connection)
+         to a plain socket: move it to the client without copying */
+      n = SPLICE_CHUNK;
+      if ( (MHD_PROXY_BODY_LENGTH == p->resp_body) &&
+           ((uint64_t) n > p->resp_left) )
+        n = (size_t) p->resp_left;
+      ret = splice (p->up->fd,
+                    NULL,
+                    p->up->pipe[1],
+                    NULL,
+                    n,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (0 < ret)
+        {
+          p->pipe_fill = ret;
+          p->pipe_request = MHD_NO;
+          if (MHD_PROXY_BODY_LENGTH == p->resp_body)
+            {
+              p->resp_left -= ret;
+              if (0 == p->resp_left)
+                p->resp_received = MHD_YES;
+            }
+          return MHD_YES;
+        }
+      err = errno;
+      if ( (0 > ret) &&
+           ( (EINTR == err) || (EAGAIN == err) ) )
+        {
+          p->up_rd = MHD_NO;
+          return MHD_NO;
+        }
+      upstream_eof (p);
+      return MHD_YES;
+    }
+#endif
+  /* copy through the write buffer */
+  if (MHD_NO == p->head_received)
+    limit = connection->write_buffer_size - HEAD_RESERVE;
+  else
+    limit = connection->write_buffer_size;
+  off = connection->write_buffer_append_offset;
+  if (off >= limit)
+    {
+      if (MHD_NO == p->head_received)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Response head from upstream server too large\n");
+#endif
+          p->up_reusable = MHD_NO;
+          respond_error (p);
+          return MHD_YES;
+        }
+      return MHD_NO; /* wait for the client */
+    }
+  n = limit - off;
+  if ( (MHD_YES == p->head_received) &&
+       (MHD_PROXY_BODY_LENGTH == p->resp_body) &&
+       ((uint64_t) n > p->resp_left) )
+    n = (size_t) p->resp_left;
+  n = upstream_recv (p,
+                     &connection->write_buffer[off],
+                     n,
+                     &eof);
+  if (MHD_YES == eof)
+    {
+      upstream_eof (p);
+      return MHD_YES;
+    }
+  if (0 == n)
+    return MHD_NO;
+  connection->write_buffer_append_offset += n;
+  MHD_update_last_activity_ (connection);
+  if (MHD_YES == p->head_received)
+    {
+      response_scan (p, off);
+      return MHD_YES;
+    }
+  while ( (MHD_NO == p->head_received) &&
+          (MHD_NO == p->failed) &&
+          (0 != (head_len = find_head_end (connection))) )
+    (void) process_response_head (p, head_len);
+  return MHD_YES;
+}
+
+
+/**
+ * Check if the exchange is complete: the response was relayed in
+ * full and nothing is buffered for the client any more.
+ *
+ * @param p proxied request
+ * @return #MHD_YES if the exchange is complete
+ */
+static int
+response_done (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+
+  return ( (MHD_YES == p->head_received) &&
+           (MHD_YES == p->resp_received) &&
+           (0 == p->continue_left) &&
+           (connection->write_buffer_send_offset ==
+            connection->write_buffer_append_offset) &&
+           ( (0 == p->pipe_fill) ||
+             (MHD_YES == p->pipe_request) ) ) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Free the state of a proxied request and give the connection
+ * back to the HTTP handlers.
+ *
+ * @param p proxied request, freed
+ */
+static void
+proxy_free (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+
+  upstream_release (p, MHD_NO);
+  connection->read_handler = p->read_handler;
+  connection->write_handler = p->write_handler;
+  connection->idle_handler = p->idle_handler;
+  connection->proxy = NULL;
+  free (p->head);
+  free (p);
+}
+
+
+/**
+ * Finish a successful exchange: keep the upstream connection if
+ * possible and continue with HTTP processing of the connection as
+ * after any other response.
+ *
+ * @param p proxied request, freed
+ * @return result of the idle handler of the connection
+ */
+static int
+proxy_finish (struct MHD_Proxy *p)
+{
+  struct MHD_Connection *connection = p->connection;
+  int req_done;
+
+  req_done = ( (MHD_YES == p->req_received) &&
+               (0 == p->req_fwd) &&
+               (0 == p->pipe_fill) &&
+               (p->head_off == p->head_size) ) ? MHD_YES : MHD_NO;
+  if (MHD_YES != req_done)
+    {
+      /* the server answered before reading the whole request */
+      p->client_close = MHD_YES;
+      p->up_reusable = MHD_NO;
+    }
+  upstream_release (p,
+                    ( (MHD_YES == p->up_reusable) &&
+                      (MHD_NO == p->connecting) ) ? MHD_YES : MHD_NO);
+  if (MHD_YES == p->client_close)
+    connection->read_closed = MHD_YES;
+  proxy_free (p);
+  connection->state = MHD_CONNECTION_FOOTERS_SENT;
+  connection->in_idle = MHD_NO;
+  return connection->idle_handler (connection);
+}
+
+
+/**
+ * Nothing to do on read readiness, the idle handler moves all data.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES
+ */
+static int
+proxy_handle_read (struct MHD_Connection *connection)
+{
+  (void) connection;
+  return MHD_YES;
+}
+
+
+/**
+ * Nothing to do on write readiness, the idle handler moves all data.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES
+ */
+static int
+proxy_handle_write (struct MHD_Connection *connection)
+{
+  (void) connection;
+  return MHD_YES;
+}
+
+
+/**
+ * Move data between client and upstream server until neither can
+ * make progress, and finish the exchange once it is complete.
+ *
+ * @param connection connection to handle
+ * @return #MHD_YES if we should continue to process the
+ *         connection (not dead yet), #MHD_NO if it died
+ */
+static int
+proxy_handle_idle (struct MHD_Connection *connection)
+{
+  struct MHD_Proxy *p = connection->proxy;
+  struct MHD_Daemon *daemon = connection->daemon;
+  unsigned int rounds;
+  unsigned int timeout;
+  int progress;
+
+  if (MHD_CONNECTION_UPGRADE != connection->state)
+    {
+      /* closed by the daemon (shutdown) */
+      return MHD_connection_handle_idle (connection);
+    }
+  connection->in_idle = MHD_YES;
+#if EPOLL_SUPPORT
+  if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
+    {
+      p->client_rd = (0 != (connection->epoll_state & MHD_EPOLL_STATE_READ_READY))
+        ? MHD_YES : MHD_NO;
+      p->client_wr = (0 != (connection->epoll_state & MHD_EPOLL_STATE_WRITE_READY))
+        ? MHD_YES : MHD_NO;
+    }
+  else
+#endif
+    {
+      /* no readiness information, just try */
+      p->client_rd = MHD_YES;
+      p->client_wr = MHD_YES;
+      p->up_rd = MHD_YES;
+      p->up_wr = MHD_YES;
+    }
+#if HTTPS_SUPPORT
+  if ( (MHD_YES == connection->tls_read_ready) ||
+       ( (NULL != connection->tls_session) &&
+         (0 != MHD_tls_pending_ (connection)) ) )
+    p->client_rd = MHD_YES;
+#endif
+
+  rounds = 0;
+  do
+    {
+      progress = pump_request (p);
+      if (MHD_YES == pump_response (p))
+        progress = MHD_YES;
+    }
+  while ( (MHD_YES == progress) &&
+          (MHD_NO == p->failed) &&
+          (MHD_NO == response_done (p)) &&
+          (++rounds < MAX_ROUNDS) );
+
+  if (MHD_YES == p->failed)
+    {
+      proxy_free (p);
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_WITH_ERROR);
+      return MHD_connection_handle_idle (connection);
+    }
+  if (MHD_YES == response_done (p))
+    return proxy_finish (p);
+
+  timeout = connection->connection_timeout;
+  if ( (0 != timeout) &&
+       (timeout <= (MHD_monotonic_sec_counter () - connection->last_activity)) )
+    {
+      proxy_free (p);
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+      return MHD_connection_handle_idle (connection);
+    }
+
+  /* tell the event loop what we are waiting for */
+  if ( (0 != p->continue_left) ||
+       (connection->write_buffer_send_offset !=
+        connection->write_buffer_append_offset) ||
+       ( (0 != p->pipe_fill) &&
+         (MHD_NO == p->pipe_request) ) )
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+  else if ( (MHD_NO == connection->read_closed) &&
+            (connection->read_buffer_offset < connection->read_buffer_size) )
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+  else
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+  if (NULL != p->up)
+    {
+      connection->proxy_write_wanted =
+        ( (MHD_YES == p->connecting) ||
+          (p->head_off < p->head_size) ||
+          (0 != p->req_fwd) ||
+          ( (0 != p->pipe_fill) &&
+            (MHD_YES == p->pipe_request) ) ) ? MHD_YES : MHD_NO;
+      connection->proxy_read_wanted =
+        ( (MHD_NO == p->connecting) &&
+          (MHD_NO == p->resp_received) ) ? MHD_YES : MHD_NO;
+    }
+#if EPOLL_SUPPORT
+  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+       (MAX_ROUNDS == rounds) &&
+       (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+    {
+      /* more to do, but give the other connections a chance first */
+      EDLL_insert (daemon->eready_head,
+                   daemon->eready_tail,
+                   connection);
+      connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+    }
+  return MHD_connection_epoll_update_ (connection);
+#else
+  (void) daemon;
+  connection->in_idle = MHD_NO;
+  return MHD_YES;
+#endif
+}
+
+
+/**
+ * Start forwarding the request of a connection for which the
+ * application queued a response created with
+ * #MHD_create_response_for_proxy().  From now on the connection is
+ * handled by the functions in this file until the response of the
+ * upstream server was relayed.
+ *
+ * @param connection connection in state #MHD_CONNECTION_HEADERS_PROCESSED
+ *        or #MHD_CONNECTION_FOOTERS_RECEIVED
+ * @return #MHD_YES on success, #MHD_NO on failure (the connection
+ *         should be closed)
+ */
+int
+MHD_proxy_start_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_Proxy *p;
+  const char *value;
+  size_t size;
+  int bad_coding;
+
+  p = malloc (sizeof (struct MHD_Proxy));
+  if (NULL == p)
+    return MHD_NO;
+  memset (p, 0, sizeof (struct MHD_Proxy));
+  p->connection = connection;
+  p->error_code = connection->responseCode;
+  p->is_head = MHD_str_equal_caseless_ (connection->method,
+                                        MHD_HTTP_METHOD_HEAD) ? MHD_YES : MHD_NO;
+  p->client_http10 = ( (NULL == connection->version) ||
+                       (! MHD_str_equal_caseless_ (connection->version,
+                                                   MHD_HTTP_VERSION_1_1)) )
+    ? MHD_YES : MHD_NO;
+  value = MHD_lookup_connection_value (connection,
+                                       MHD_HEADER_KIND,
+                                       MHD_HTTP_HEADER_CONNECTION);
+  p->client_close = ( (MHD_YES == p->client_http10) ||
+                      (MHD_str_has_token_caseless_ (value, "close")) )
+    ? MHD_YES : MHD_NO;
+  /* only "chunked" lets us find the end of a body of unknown size */
+  bad_coding = ( (MHD_NO == connection->have_chunked_upload) &&
+                 (NULL != MHD_lookup_connection_value (connection,
+                                                       MHD_HEADER_KIND,
+                                                       MHD_HTTP_HEADER_TRANSFER_ENCODING)) )
+    ? MHD_YES : MHD_NO;
+  if ( (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state) ||
+       (MHD_YES == bad_coding) )
+    p->req_body = MHD_PROXY_BODY_NONE;
+  else if (MHD_YES == connection->have_chunked_upload)
+    p->req_body = MHD_PROXY_BODY_CHUNKED;
+  else if (0 != connection->remaining_upload_size)
+    p->req_body = MHD_PROXY_BODY_LENGTH;
+  else
+    p->req_body = MHD_PROXY_BODY_NONE;
+  p->req_left = connection->remaining_upload_size;
+  if (MHD_PROXY_BODY_NONE == p->req_body)
+    p->req_received = MHD_YES;
+  value = MHD_lookup_connection_value (connection,
+                                       MHD_HEADER_KIND,
+                                       MHD_HTTP_HEADER_EXPECT);
+  if ( (MHD_PROXY_BODY_NONE != p->req_body) &&
+       (MHD_NO == p->client_http10) &&
+       (NULL != value) &&
+       (MHD_str_equal_caseless_ (value, "100-continue")) &&
+       (0 == connection->read_buffer_offset) )
+    p->continue_left = strlen (PROXY_100_CONTINUE);
+  if (MHD_YES != build_request_head (p))
+    {
+      free (p);
+      return MHD_NO;
+    }
+
+  /* the request stays in the pool, the rest of it becomes the
+     buffer for the response */
+  size = daemon->pool_size;
+  do
+    {
+      size /= 2;
+      if (size < MHD_BUF_INC_SIZE)
+        {
+          free (p->head);
+          free (p);
+          return MHD_NO;
+        }
+      connection->write_buffer = MHD_pool_allocate (connection->pool,
+                                                    size,
+                                                    MHD_NO);
+    }
+  while (NULL == connection->write_buffer);
+  connection->write_buffer_size = size;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = 0;
+
+  p->read_handler = connection->read_handler;
+  p->write_handler = connection->write_handler;
+  p->idle_handler = connection->idle_handler;
+  p->up_reusable = MHD_YES;
+  connection->proxy = p;
+  connection->proxy_sock = MHD_INVALID_SOCKET;
+  connection->proxy_read_wanted = MHD_NO;
+  connection->proxy_write_wanted = MHD_NO;
+  connection->state = MHD_CONNECTION_UPGRADE;
+  connection->read_handler = &proxy_handle_read;
+  connection->write_handler = &proxy_handle_write;
+  connection->idle_handler = &proxy_handle_idle;
+  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+  if (MHD_YES == bad_coding)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Request body uses an unsupported transfer coding, not forwarding it\n");
+#endif
+      p->error_code = MHD_HTTP_NOT_IMPLEMENTED;
+      respond_error (p);
+      return MHD_YES;
+    }
+  request_scan (p);
+  if (MHD_YES != upstream_acquire (p, MHD_YES))
+    respond_error (p);
+  return MHD_YES;
+}
+
+
+#if EPOLL_SUPPORT
+/**
+ * Handle an epoll event for the upstream socket of a proxied
+ * request, making sure that the event loop looks at the connection.
+ *
+ * @param ptr data pointer of the event, with #MHD_PROXY_EPOLL_TAG set
+ * @param events events reported for the upstream socket
+ */
+void
+MHD_proxy_epoll_event_ (void *ptr,
+                        uint32_t events)
+{
+  struct MHD_Connection *connection;
+  struct MHD_Daemon *daemon;
+  struct MHD_Proxy *p;
+
+  connection = (struct MHD_Connection *) (((uintptr_t) ptr) & ~MHD_PROXY_EPOLL_TAG);
+  p = connection->proxy;
+  if (NULL == p)
+    return;
+  daemon = connection->daemon;
+  if (0 != (events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+    p->up_rd = MHD_YES;
+  if (0 != (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+    p->up_wr = MHD_YES;
+  if (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL))
+    {
+      EDLL_insert (daemon->eready_head,
+                   daemon->eready_tail,
+                   connection);
+      connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+    }
+}
+#endif
+
+
+/**
+ * Release the forwarding state of a connection that is being
+ * destroyed, closing its upstream connection.
+ *
+ * @param connection the connection to clean up
+ */
+void
+MHD_proxy_cleanup_ (struct MHD_Connection *connection)
+{
+  if (NULL == connection->proxy)
+    return;
+  proxy_free (connection->proxy);
+}
+
+
+/**
+ * Close the idle upstream connections kept by @a daemon.
+ *
+ * @param daemon daemon that is being stopped
+ */
+void
+MHD_proxy_pool_cleanup_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_ProxyUpstream *up;
+
+  while (NULL != (up = daemon->proxy_pool_head))
+    {
+      DLL_remove (daemon->proxy_pool_head,
+                  daemon->proxy_pool_tail,
+                  up);
+      upstream_close (up);
+    }
+  daemon->proxy_pool_count = 0;
+}
+
+
+/**
+ * Create a response that forwards the request to an upstream HTTP
+ * server and relays the answer of the server to the client.
+ *
+ * @param addr address of the upstream server (plain HTTP)
+ * @param addrlen number of bytes in @a addr
+ * @param url request target to send to the upstream server
+ *        (must be properly escaped), NULL to forward the URL and
+ *        the arguments of each request
+ * @return NULL on error (unsupported address family, out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_for_proxy (const struct sockaddr *addr,
+                               socklen_t addrlen,
+                               const char *url)
+{
+  struct MHD_Response *response;
+
+  if ( (NULL == addr) ||
+       (addrlen > sizeof (struct sockaddr_storage)) )
+    return NULL;
+  switch (addr->sa_family)
+    {
+    case AF_INET:
+      if (addrlen < sizeof (struct sockaddr_in))
+        return NULL;
+      break;
+#if HAVE_INET6
+    case AF_INET6:
+      if (addrlen < sizeof (struct sockaddr_in6))
+        return NULL;
+      break;
+#endif
+    default:
+      return NULL;
+    }
+  if (NULL == (response = malloc (sizeof (struct MHD_Response))))
+    return NULL;
+  memset (response, 0, sizeof (struct MHD_Response));
+  response->fd = -1;
+  response->proxy_addr = malloc (addrlen);
+  response->proxy_url = (NULL != url) ? strdup (url) : NULL;
+  if ( (NULL == response->proxy_addr) ||
+       ( (NULL != url) &&
+         (NULL == response->proxy_url) ) ||
+       (MHD_YES != MHD_mutex_create_ (&response->mutex)) )
+    {
+      free (response->proxy_addr);
+      free (response->proxy_url);
+      free (response);
+      return NULL;
+    }
+  memcpy (response->proxy_addr, addr, addrlen);
+  response->proxy_addr_len = addrlen;
+  response->reference_count = 1;
+  response->total_size = MHD_SIZE_UNKNOWN;
+  return response;
+}
+
+/* end of proxy.c */
@@ -0,0 +1,88 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file proxy.h
+ * @brief  forwarding of requests to upstream servers in the event loop
+ * @author Christian Grothoff
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "internal.h"
+
+
+/**
+ * Bit set in the epoll data pointer of upstream sockets to tell
+ * them apart from the sockets of connections (which are registered
+ * with the pointer to the connection, which is always aligned).
+ */
+#define MHD_PROXY_EPOLL_TAG ((uintptr_t) 1)
+
+
+/**
+ * Start forwarding the request of a connection for which the
+ * application queued a response created with
+ * #MHD_create_response_for_proxy().  From now on the connection is
+ * handled by the functions in proxy.c until the response of the
+ * upstream server was relayed.
+ *
+ * @param connection connection in state #MHD_CONNECTION_HEADERS_PROCESSED
+ *        or #MHD_CONNECTION_FOOTERS_RECEIVED
+ * @return #MHD_YES on success, #MHD_NO on failure (the connection
+ *         should be closed)
+ */
+int
+MHD_proxy_start_ (struct MHD_Connection *connection);
+
+
+#if EPOLL_SUPPORT
+/**
+ * Handle an epoll event for the upstream socket of a proxied
+ * request, making sure that the event loop looks at the connection.
+ *
+ * @param ptr data pointer of the event, with #MHD_PROXY_EPOLL_TAG set
+ * @param events events reported for the upstream socket
+ */
+void
+MHD_proxy_epoll_event_ (void *ptr,
+                        uint32_t events);
+#endif
+
+
+/**
+ * Release the forwarding state of a connection that is being
+ * destroyed, closing its upstream connection.
+ *
+ * @param connection the connection to clean up
+ */
+void
+MHD_proxy_cleanup_ (struct MHD_Connection *connection);
+
+
+/**
+ * Close the idle upstream connections kept by @a daemon.
+ *
+ * @param daemon daemon that is being stopped
+ */
+void
+MHD_proxy_pool_cleanup_ (struct MHD_Daemon *daemon);
+
+#endif
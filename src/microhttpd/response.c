@@ -29,6 +29,8 @@
 #include "internal.h"
 #include "response.h"
 #include "mhd_limits.h"
+#include "mhd_str.h"
+#include "compression.h"
 
 #if defined(_WIN32) && defined(MHD_W32_MUTEX_)
 #ifndef WIN32_LEAN_AND_MEAN
@@ -271,6 +273,36 @@ MHD_create_response_from_callback (uint64_t size,
 }
 
 
+#ifdef HAVE_ZLIB
+/**
+ * Check if one of the "Vary" headers of a response already lists
+ * "Accept-Encoding" (or "*").
+ *
+ * @param response response to check
+ * @return #MHD_YES if it does
+ */
+static int
+vary_has_accept_encoding (const struct MHD_Response *response)
+{
+  const struct MHD_HTTP_Header *pos;
+
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    {
+      if ( (MHD_HEADER_KIND != pos->kind) ||
+           (! MHD_str_equal_caseless_ (pos->header,
+                                       MHD_HTTP_HEADER_VARY)) )
+        continue;
+      if ( (MHD_str_has_token_caseless_ (pos->value,
+                                         MHD_HTTP_HEADER_ACCEPT_ENCODING)) ||
+           (MHD_str_has_token_caseless_ (pos->value,
+                                         "*")) )
+        return MHD_YES;
+    }
+  return MHD_NO;
+}
+#endif
+
+
 /**
  * Set special flags and options for a response.
  *
@@ -290,6 +322,17 @@ MHD_set_response_options (struct MHD_Response *response,
 
   ret = MHD_YES;
   response->flags = flags;
+#ifdef HAVE_ZLIB
+  /* caches must not serve the compressed variant to clients that
+     do not support it (and vice versa); a second "Vary" header
+     extends the list of the application's */
+  if ( (0 != (flags & MHD_RF_COMPRESS)) &&
+       (MHD_YES != vary_has_accept_encoding (response)) &&
+       (MHD_YES != MHD_add_response_header (response,
+                                            MHD_HTTP_HEADER_VARY,
+                                            MHD_HTTP_HEADER_ACCEPT_ENCODING)) )
+    ret = MHD_NO;
+#endif
   va_start (ap, flags);
   while (MHD_RO_END != (ro = va_arg (ap, enum MHD_ResponseOptions)))
   {
@@ -563,6 +606,41 @@ MHD_create_response_from_buffer (size_t size,
 }
 
 
+/**
+ * Create a response object that can be used for 101 UPGRADE
+ * responses, for example to implement WebSockets.  After sending the
+ * response, control over the data stream is given to the callback.
+ *
+ * @param upgrade_handler function to call with the 'upgraded' socket
+ * @param upgrade_handler_cls closure for @a upgrade_handler
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_for_upgrade (MHD_UpgradeHandler upgrade_handler,
+				 void *upgrade_handler_cls)
+{
+  struct MHD_Response *response;
+
+  if (NULL == upgrade_handler)
+    return NULL;
+  if (NULL == (response = malloc (sizeof (struct MHD_Response))))
+    return NULL;
+  memset (response, 0, sizeof (struct MHD_Response));
+  response->fd = -1;
+  if (MHD_YES != MHD_mutex_create_ (&response->mutex))
+    {
+      free (response);
+      return NULL;
+    }
+  response->upgrade_handler = upgrade_handler;
+  response->upgrade_handler_cls = upgrade_handler_cls;
+  response->reference_count = 1;
+  response->total_size = 0;
+  return response;
+}
+
+
 /**
  * Destroy a response object and associated resources.  Note that
  * libmicrohttpd may keep some of the resources around if the response
@@ -587,6 +665,9 @@ MHD_destroy_response (struct MHD_Response *response)
     }
   (void) MHD_mutex_unlock_ (&response->mutex);
   (void) MHD_mutex_destroy_ (&response->mutex);
+#ifdef HAVE_ZLIB
+  MHD_compress_response_cleanup_ (response);
+#endif
   if (response->crfc != NULL)
     response->crfc (response->crc_cls);
   while (NULL != response->first_header)
@@ -597,6 +678,8 @@ MHD_destroy_response (struct MHD_Response *response)
       free (pos->value);
       free (pos);
     }
+  free (response->proxy_addr);
+  free (response->proxy_url);
   free (response);
 }
 
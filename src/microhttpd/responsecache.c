@@ -0,0 +1,885 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file responsecache.c
+ * @brief cache of responses produced by the access handler, with
+ *        coalescing of concurrent requests for the same resource
+ * @author Christian Grothoff
+ *
+ * Entries are keyed by method, host, URL, GET arguments and the
+ * values of the request headers given with
+ * #MHD_OPTION_RESPONSE_CACHE_VARY.
+ * An entry is in one of three states:
+ * - pending: a connection (the "leader") is running the access
+ *   handler for the key; other connections with the same key wait
+ *   for it (suspended) in the list of waiters;
+ * - cached: a response is available and is served until the entry
+ *   expires;
+ * - pass: the response produced for the key was not cacheable;
+ *   until the entry expires, requests go straight to the handler
+ *   (and are not serialized behind each other).
+ */
+
+#include "internal.h"
+#include "response.h"
+#include "responsecache.h"
+#include "mhd_mono_clock.h"
+#include "mhd_str.h"
+
+
+/**
+ * Entry in the response cache.  Each entry is both in a hash chain
+ * (for lookups by key) and in the LRU list (for eviction).
+ */
+struct MHD_ResponseCacheEntry
+{
+
+  /**
+   * Next entry in the same hash bucket.
+   */
+  struct MHD_ResponseCacheEntry *next_hash;
+
+  /**
+   * Next entry in the LRU list (towards less recently used).
+   */
+  struct MHD_ResponseCacheEntry *next;
+
+  /**
+   * Previous entry in the LRU list (towards more recently used).
+   */
+  struct MHD_ResponseCacheEntry *prev;
+
+  /**
+   * Key of the entry (not 0-terminated, may contain 0-bytes).
+   */
+  char *key;
+
+  /**
+   * Cached response, the cache holds one reference.  NULL if the
+   * entry is pending or a "pass" entry.
+   */
+  struct MHD_Response *response;
+
+  /**
+   * Connection producing the response for this entry, NULL if the
+   * entry is not pending.
+   */
+  struct MHD_Connection *leader;
+
+  /**
+   * Suspended connections waiting for @e leader, linked
+   * using their `cache_waiter_next` field.
+   */
+  struct MHD_Connection *waiters;
+
+  /**
+   * Number of bytes in @e key.
+   */
+  size_t key_len;
+
+  /**
+   * Monotonic time (in seconds) at which the entry expires
+   * (not used while the entry is pending).
+   */
+  time_t expires;
+
+  /**
+   * HTTP status code to use with @e response.
+   */
+  unsigned int status_code;
+
+  /**
+   * Hash of @e key.
+   */
+  unsigned int hash;
+
+};
+
+
+/**
+ * Cache of responses produced by the access handler.
+ */
+struct MHD_ResponseCache
+{
+
+  /**
+   * Hash table of entries, with @e num_buckets chains.
+   */
+  struct MHD_ResponseCacheEntry **buckets;
+
+  /**
+   * Most recently used entry.
+   */
+  struct MHD_ResponseCacheEntry *lru_head;
+
+  /**
+   * Least recently used entry.
+   */
+  struct MHD_ResponseCacheEntry *lru_tail;
+
+  /**
+   * Names of the request headers that are part of the key,
+   * NULL-terminated.  The strings are allocated with the array.
+   */
+  char **vary;
+
+  /**
+   * Mutex protecting all of the above, @e num_entries and the
+   * `cache_entry`, `cache_wait` and `cache_waiter_next` fields
+   * of all connections.
+   */
+  MHD_mutex_ lock;
+
+  /**
+   * Number of chains in @e buckets.
+   */
+  unsigned int num_buckets;
+
+  /**
+   * Number of entries currently in the cache.
+   */
+  unsigned int num_entries;
+
+  /**
+   * Maximum number of entries in the cache.
+   */
+  unsigned int max_entries;
+
+  /**
+   * Number of seconds a response is served from the cache.
+   */
+  unsigned int ttl;
+
+};
+
+
+/**
+ * Compute the hash of a key (FNV-1a).
+ *
+ * @param key the key
+ * @param key_len number of bytes in @a key
+ * @return hash value
+ */
+static unsigned int
+hash_key (const char *key,
+          size_t key_len)
+{
+  uint32_t h = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < key_len; i++)
+    {
+      h ^= (unsigned char) key[i];
+      h *= 16777619U;
+    }
+  return (unsigned int) h;
+}
+
+
+/**
+ * Append @a str to the key under construction.  If @a key is
+ * NULL, only the length is computed.
+ *
+ * @param key buffer for the key, or NULL
+ * @param off offset at which to append
+ * @param str 0-terminated string to append, NULL for empty
+ * @return new offset
+ */
+static size_t
+append_key (char *key,
+            size_t off,
+            const char *str)
+{
+  size_t len;
+
+  if (NULL == str)
+    return off;
+  len = strlen (str);
+  if (NULL != key)
+    memcpy (&key[off], str, len);
+  return off + len;
+}
+
+
+/**
+ * Write the key of the request of @a connection to @a key.  The
+ * components of the key are separated by 0-bytes, which cannot
+ * occur within them.
+ *
+ * @param cache the cache
+ * @param connection connection with the request
+ * @param key where to write the key, NULL to only compute the length
+ * @return length of the key
+ */
+static size_t
+write_key (struct MHD_ResponseCache *cache,
+           struct MHD_Connection *connection,
+           char *key)
+{
+  const struct MHD_HTTP_Header *pos;
+  unsigned int i;
+  size_t off;
+
+  off = append_key (key, 0, connection->method);
+  off++;
+  /* the same URL may name different resources on virtual hosts */
+  off = append_key (key, off, MHD_lookup_connection_value (connection,
+                                                           MHD_HEADER_KIND,
+                                                           MHD_HTTP_HEADER_HOST));
+  off++;
+  off = append_key (key, off, connection->url);
+  for (pos = connection->headers_received; NULL != pos; pos = pos->next)
+    {
+      if (MHD_GET_ARGUMENT_KIND != pos->kind)
+        continue;
+      off++;
+      off = append_key (key, off, pos->header);
+      off++;
+      off = append_key (key, off, pos->value);
+    }
+  for (i = 0; NULL != cache->vary[i]; i++)
+    {
+      off++;
+      off = append_key (key, off, MHD_lookup_connection_value (connection,
+                                                               MHD_HEADER_KIND,
+                                                               cache->vary[i]));
+    }
+  return off;
+}
+
+
+/**
+ * Check if a request header is part of the cache key.
+ *
+ * @param cache the cache
+ * @param name name of the header (not 0-terminated)
+ * @param len number of bytes in @a name
+ * @return #MHD_YES if the value of the header is part of the key
+ */
+static int
+is_key_header (const struct MHD_ResponseCache *cache,
+               const char *name,
+               size_t len)
+{
+  unsigned int i;
+
+  if ( (strlen (MHD_HTTP_HEADER_HOST) == len) &&
+       (MHD_str_equal_caseless_n_ (name,
+                                   MHD_HTTP_HEADER_HOST,
+                                   len)) )
+    return MHD_YES;
+  for (i = 0; NULL != cache->vary[i]; i++)
+    if ( (strlen (cache->vary[i]) == len) &&
+         (MHD_str_equal_caseless_n_ (name,
+                                     cache->vary[i],
+                                     len)) )
+      return MHD_YES;
+  return MHD_NO;
+}
+
+
+/**
+ * Check if the request of @a connection may be served from the cache.
+ *
+ * @param cache the cache
+ * @param connection connection with the request
+ * @return #MHD_YES if the request may be served from the cache
+ */
+static int
+request_cacheable (const struct MHD_ResponseCache *cache,
+                   struct MHD_Connection *connection)
+{
+  if ( (NULL == connection->method) ||
+       (NULL == connection->url) )
+    return MHD_NO;
+  if ( (! MHD_str_equal_caseless_ (connection->method,
+                                    MHD_HTTP_METHOD_GET)) &&
+       (! MHD_str_equal_caseless_ (connection->method,
+                                    MHD_HTTP_METHOD_HEAD)) )
+    return MHD_NO;
+  if (0 != connection->remaining_upload_size)
+    return MHD_NO;
+  /* responses to authenticated requests are specific to the client */
+  if (NULL != MHD_lookup_connection_value (connection,
+                                           MHD_HEADER_KIND,
+                                           MHD_HTTP_HEADER_AUTHORIZATION))
+    return MHD_NO;
+  /* same for cookies, unless they are part of the key */
+  if ( (NULL != MHD_lookup_connection_value (connection,
+                                             MHD_HEADER_KIND,
+                                             MHD_HTTP_HEADER_COOKIE)) &&
+       (MHD_YES != is_key_header (cache,
+                                  MHD_HTTP_HEADER_COOKIE,
+                                  strlen (MHD_HTTP_HEADER_COOKIE))) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Check if all request headers named in the "Vary" header of a
+ * response are part of the cache key, so that the response is
+ * only served for requests it was made for.
+ *
+ * @param cache the cache
+ * @param vary value of the "Vary" header
+ * @return #MHD_YES if the key covers @a vary
+ */
+static int
+key_covers_vary (const struct MHD_ResponseCache *cache,
+                 const char *vary)
+{
+  const char *end;
+
+  while (1)
+    {
+      while ( (' ' == *vary) ||
+              ('\t' == *vary) ||
+              (',' == *vary) )
+        vary++;
+      if ('\0' == *vary)
+        return MHD_YES;
+      end = vary;
+      while ( ('\0' != *end) &&
+              (',' != *end) &&
+              (' ' != *end) &&
+              ('\t' != *end) )
+        end++;
+      /* "*" varies on more than the request headers */
+      if ( ( (1 == end - vary) &&
+             ('*' == *vary) ) ||
+           (MHD_YES != is_key_header (cache,
+                                      vary,
+                                      end - vary)) )
+        return MHD_NO;
+      vary = end;
+    }
+}
+
+
+/**
+ * Check if a comma-separated header value contains the
+ * given directive (with or without an argument).
+ *
+ * @param value header value
+ * @param directive directive to look for
+ * @return #MHD_YES if @a directive is in @a value
+ */
+static int
+has_directive (const char *value,
+               const char *directive)
+{
+  size_t len = strlen (directive);
+
+  while ('\0' != *value)
+    {
+      while ( (' ' == *value) ||
+              ('\t' == *value) ||
+              (',' == *value) )
+        value++;
+      if ( (MHD_str_equal_caseless_n_ (value,
+                                       directive,
+                                       len)) &&
+           ( ('\0' == value[len]) ||
+             (',' == value[len]) ||
+             ('=' == value[len]) ||
+             (' ' == value[len]) ) )
+        return MHD_YES;
+      while ( ('\0' != *value) &&
+              (',' != *value) )
+        value++;
+    }
+  return MHD_NO;
+}
+
+
+/**
+ * Check if a response may be stored in the cache and given to
+ * other connections.  Only responses with a body that does not
+ * depend on a callback (buffer and file descriptor responses), with
+ * a status code that is cacheable by default and that do not vary
+ * on request headers outside of the key are stored.
+ *
+ * @param cache the cache
+ * @param status_code HTTP status code of the response
+ * @param response the response
+ * @return #MHD_YES if @a response may be cached
+ */
+static int
+response_cacheable (const struct MHD_ResponseCache *cache,
+                    unsigned int status_code,
+                    struct MHD_Response *response)
+{
+  const struct MHD_HTTP_Header *pos;
+
+  switch (status_code)
+    {
+    case MHD_HTTP_OK:
+    case MHD_HTTP_NON_AUTHORITATIVE_INFORMATION:
+    case MHD_HTTP_NO_CONTENT:
+    case MHD_HTTP_MULTIPLE_CHOICES:
+    case MHD_HTTP_MOVED_PERMANENTLY:
+    case MHD_HTTP_NOT_FOUND:
+    case MHD_HTTP_METHOD_NOT_ALLOWED:
+    case MHD_HTTP_GONE:
+    case MHD_HTTP_REQUEST_URI_TOO_LONG:
+    case MHD_HTTP_NOT_IMPLEMENTED:
+      break;
+    default:
+      return MHD_NO;
+    }
+  if ( (MHD_SIZE_UNKNOWN == response->total_size) ||
+       ( (NULL != response->crc) &&
+         (-1 == response->fd) ) )
+    return MHD_NO;
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    {
+      if (MHD_HEADER_KIND != pos->kind)
+        continue;
+      if (MHD_str_equal_caseless_ (pos->header,
+                                   MHD_HTTP_HEADER_SET_COOKIE))
+        return MHD_NO;
+      if ( (MHD_str_equal_caseless_ (pos->header,
+                                     MHD_HTTP_HEADER_CACHE_CONTROL)) &&
+           ( (MHD_YES == has_directive (pos->value, "no-store")) ||
+             (MHD_YES == has_directive (pos->value, "no-cache")) ||
+             (MHD_YES == has_directive (pos->value, "private")) ) )
+        return MHD_NO;
+      if ( (MHD_str_equal_caseless_ (pos->header,
+                                     MHD_HTTP_HEADER_VARY)) &&
+           (MHD_YES != key_covers_vary (cache,
+                                        pos->value)) )
+        return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Resume all connections waiting on an entry.  Must be called
+ * with the cache's lock held.
+ *
+ * @param entry entry to process
+ */
+static void
+wake_waiters (struct MHD_ResponseCacheEntry *entry)
+{
+  struct MHD_Connection *pos;
+
+  while (NULL != (pos = entry->waiters))
+    {
+      entry->waiters = pos->cache_waiter_next;
+      pos->cache_waiter_next = NULL;
+      pos->cache_wait = NULL;
+      MHD_resume_connection (pos);
+    }
+}
+
+
+/**
+ * Remove an entry from the cache and release the cache's
+ * reference to its response.  The entry must not be pending.
+ * Must be called with the cache's lock held.
+ *
+ * @param cache cache to remove @a entry from
+ * @param entry entry to remove
+ */
+static void
+remove_entry (struct MHD_ResponseCache *cache,
+              struct MHD_ResponseCacheEntry *entry)
+{
+  struct MHD_ResponseCacheEntry **pos;
+
+  pos = &cache->buckets[entry->hash % cache->num_buckets];
+  while (*pos != entry)
+    pos = &(*pos)->next_hash;
+  *pos = entry->next_hash;
+  DLL_remove (cache->lru_head,
+              cache->lru_tail,
+              entry);
+  cache->num_entries--;
+  if (NULL != entry->response)
+    MHD_destroy_response (entry->response);
+  free (entry->key);
+  free (entry);
+}
+
+
+/**
+ * Make room for a new entry by evicting the least recently used
+ * entry that is not pending.  Must be called with the cache's lock
+ * held.
+ *
+ * @param cache the cache
+ * @return #MHD_YES if there is room for a new entry
+ */
+static int
+make_room (struct MHD_ResponseCache *cache)
+{
+  struct MHD_ResponseCacheEntry *pos;
+
+  if (cache->num_entries < cache->max_entries)
+    return MHD_YES;
+  for (pos = cache->lru_tail; NULL != pos; pos = pos->prev)
+    {
+      if (NULL != pos->leader)
+        continue;
+      remove_entry (cache, pos);
+      return MHD_YES;
+    }
+  return MHD_NO;
+}
+
+
+/**
+ * Create a response cache.
+ *
+ * @param max_entries maximum number of entries to keep
+ * @param ttl number of seconds cached responses are served
+ * @param vary comma-separated list of request headers that are
+ *        part of the cache key, or NULL
+ * @return NULL on error
+ */
+struct MHD_ResponseCache *
+MHD_response_cache_create_ (unsigned int max_entries,
+                            unsigned int ttl,
+                            const char *vary)
+{
+  struct MHD_ResponseCache *cache;
+  unsigned int num_vary;
+  const char *pos;
+  const char *end;
+  char *str;
+  size_t len;
+
+  if (0 == max_entries)
+    return NULL;
+  if (NULL == vary)
+    vary = "";
+  num_vary = 2;
+  for (pos = vary; '\0' != *pos; pos++)
+    if (',' == *pos)
+      num_vary++;
+  cache = malloc (sizeof (struct MHD_ResponseCache));
+  if (NULL == cache)
+    return NULL;
+  memset (cache,
+          0,
+          sizeof (struct MHD_ResponseCache));
+  cache->max_entries = max_entries;
+  cache->ttl = ttl;
+  cache->num_buckets = max_entries;
+  cache->buckets = calloc (cache->num_buckets,
+                           sizeof (struct MHD_ResponseCacheEntry *));
+  cache->vary = malloc (num_vary * sizeof (char *) + strlen (vary) + num_vary);
+  if ( (NULL == cache->buckets) ||
+       (NULL == cache->vary) )
+    {
+      free (cache->buckets);
+      free (cache->vary);
+      free (cache);
+      return NULL;
+    }
+  str = (char *) &cache->vary[num_vary];
+  num_vary = 0;
+  for (pos = vary; '\0' != *pos; pos = end)
+    {
+      while ( (' ' == *pos) ||
+              ('\t' == *pos) ||
+              (',' == *pos) )
+        pos++;
+      end = pos;
+      while ( ('\0' != *end) &&
+              (',' != *end) &&
+              (' ' != *end) &&
+              ('\t' != *end) )
+        end++;
+      len = end - pos;
+      if (0 == len)
+        continue;
+      memcpy (str, pos, len);
+      str[len] = '\0';
+      cache->vary[num_vary++] = str;
+      str += len + 1;
+    }
+  cache->vary[num_vary] = NULL;
+  if (MHD_YES != MHD_mutex_create_ (&cache->lock))
+    {
+      free (cache->buckets);
+      free (cache->vary);
+      free (cache);
+      return NULL;
+    }
+  return cache;
+}
+
+
+/**
+ * Destroy a response cache, releasing all cached responses.
+ * There must be no connections left waiting on the cache.
+ *
+ * @param cache cache to destroy
+ */
+void
+MHD_response_cache_destroy_ (struct MHD_ResponseCache *cache)
+{
+  while (NULL != cache->lru_head)
+    {
+      cache->lru_head->leader = NULL;
+      remove_entry (cache,
+                    cache->lru_head);
+    }
+  (void) MHD_mutex_destroy_ (&cache->lock);
+  free (cache->buckets);
+  free (cache->vary);
+  free (cache);
+}
+
+
+/**
+ * Resume all connections waiting on pending entries of the cache;
+ * used when the daemon shuts down.
+ *
+ * @param cache the cache
+ */
+void
+MHD_response_cache_resume_all_ (struct MHD_ResponseCache *cache)
+{
+  struct MHD_ResponseCacheEntry *pos;
+
+  if (MHD_YES != MHD_mutex_lock_ (&cache->lock))
+    MHD_PANIC ("Failed to acquire response cache mutex\n");
+  for (pos = cache->lru_head; NULL != pos; pos = pos->next)
+    wake_waiters (pos);
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+    MHD_PANIC ("Failed to release response cache mutex\n");
+}
+
+
+/**
+ * Try to answer the request of @a connection from the cache of its
+ * daemon.  On a hit, the cached response is queued.  If another
+ * connection is already producing the response for the same key and
+ * the daemon supports suspending connections, @a connection is
+ * suspended until that response is available.  Otherwise, the caller
+ * must invoke the access handler; if @a connection became the one
+ * producing the response for its key, the response it queues is
+ * passed to #MHD_response_cache_store_().
+ *
+ * @param connection connection with a complete request header
+ * @return #MHD_YES if the request was handled (queued or suspended),
+ *         #MHD_NO if the access handler must be called
+ */
+int
+MHD_response_cache_lookup_ (struct MHD_Connection *connection)
+{
+  struct MHD_ResponseCache *cache = connection->daemon->response_cache;
+  struct MHD_ResponseCacheEntry *entry;
+  struct MHD_Response *response;
+  unsigned int status_code;
+  unsigned int hash;
+  size_t key_len;
+  char *key;
+  time_t now;
+  int ret;
+
+  /* the handler was already called for this request, either because
+     this connection produces the entry or because it was not
+     cacheable */
+  if ( (NULL != connection->cache_entry) ||
+       (MHD_NO != connection->client_aware) )
+    return MHD_NO;
+  if (MHD_YES != request_cacheable (cache,
+                                    connection))
+    return MHD_NO;
+  key_len = write_key (cache, connection, NULL);
+  key = calloc (1, key_len);
+  if (NULL == key)
+    return MHD_NO;
+  (void) write_key (cache, connection, key);
+  hash = hash_key (key, key_len);
+  now = MHD_monotonic_sec_counter ();
+
+  if (MHD_YES != MHD_mutex_lock_ (&cache->lock))
+    MHD_PANIC ("Failed to acquire response cache mutex\n");
+  if (NULL != connection->cache_wait)
+    {
+      /* still waiting (called again before the suspension took effect) */
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+        MHD_PANIC ("Failed to release response cache mutex\n");
+      free (key);
+      return MHD_YES;
+    }
+  for (entry = cache->buckets[hash % cache->num_buckets];
+       NULL != entry;
+       entry = entry->next_hash)
+    if ( (entry->hash == hash) &&
+         (entry->key_len == key_len) &&
+         (0 == memcmp (entry->key, key, key_len)) )
+      break;
+  if ( (NULL != entry) &&
+       (NULL == entry->leader) &&
+       (entry->expires <= now) )
+    {
+      remove_entry (cache, entry);
+      entry = NULL;
+    }
+  if (NULL == entry)
+    {
+      /* miss: this connection produces the response */
+      if ( (MHD_YES != make_room (cache)) ||
+           (NULL == (entry = malloc (sizeof (struct MHD_ResponseCacheEntry)))) )
+        {
+          if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+            MHD_PANIC ("Failed to release response cache mutex\n");
+          free (key);
+          return MHD_NO;
+        }
+      memset (entry,
+              0,
+              sizeof (struct MHD_ResponseCacheEntry));
+      entry->key = key;
+      entry->key_len = key_len;
+      entry->hash = hash;
+      entry->leader = connection;
+      entry->next_hash = cache->buckets[hash % cache->num_buckets];
+      cache->buckets[hash % cache->num_buckets] = entry;
+      DLL_insert (cache->lru_head,
+                  cache->lru_tail,
+                  entry);
+      cache->num_entries++;
+      connection->cache_entry = entry;
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+        MHD_PANIC ("Failed to release response cache mutex\n");
+      return MHD_NO;
+    }
+  free (key);
+  if (NULL != entry->response)
+    {
+      /* hit */
+      DLL_remove (cache->lru_head,
+                  cache->lru_tail,
+                  entry);
+      DLL_insert (cache->lru_head,
+                  cache->lru_tail,
+                  entry);
+      response = entry->response;
+      status_code = entry->status_code;
+      MHD_increment_response_rc (response);
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+        MHD_PANIC ("Failed to release response cache mutex\n");
+      ret = MHD_queue_response (connection,
+                                status_code,
+                                response);
+      MHD_destroy_response (response);
+      return ret;
+    }
+  if ( (NULL != entry->leader) &&
+       (MHD_USE_SUSPEND_RESUME ==
+        (connection->daemon->options & MHD_USE_SUSPEND_RESUME)) )
+    {
+      /* pending: wait for the leader */
+      connection->cache_wait = entry;
+      connection->cache_waiter_next = entry->waiters;
+      entry->waiters = connection;
+      MHD_suspend_connection (connection);
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+        MHD_PANIC ("Failed to release response cache mutex\n");
+      return MHD_YES;
+    }
+  /* pass, or pending but we cannot wait */
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+    MHD_PANIC ("Failed to release response cache mutex\n");
+  return MHD_NO;
+}
+
+
+/**
+ * Offer the response queued by the connection producing a cache
+ * entry to the cache and wake up connections waiting for it.
+ *
+ * @param connection connection with `cache_entry` set
+ * @param status_code HTTP status code of the response
+ * @param response response queued by the application
+ */
+void
+MHD_response_cache_store_ (struct MHD_Connection *connection,
+                           unsigned int status_code,
+                           struct MHD_Response *response)
+{
+  struct MHD_ResponseCache *cache = connection->daemon->response_cache;
+  struct MHD_ResponseCacheEntry *entry;
+
+  if (MHD_YES != MHD_mutex_lock_ (&cache->lock))
+    MHD_PANIC ("Failed to acquire response cache mutex\n");
+  entry = connection->cache_entry;
+  connection->cache_entry = NULL;
+  entry->leader = NULL;
+  entry->expires = MHD_monotonic_sec_counter () + cache->ttl;
+  if (MHD_YES == response_cacheable (cache,
+                                     status_code,
+                                     response))
+    {
+      MHD_increment_response_rc (response);
+      entry->response = response;
+      entry->status_code = status_code;
+    }
+  wake_waiters (entry);
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+    MHD_PANIC ("Failed to release response cache mutex\n");
+}
+
+
+/**
+ * A connection producing or waiting for a cache entry is closed;
+ * if it was producing the entry, drop the entry and wake up the
+ * connections waiting for it, otherwise just stop waiting.
+ *
+ * @param connection connection with `cache_entry` or `cache_wait` set
+ */
+void
+MHD_response_cache_abandon_ (struct MHD_Connection *connection)
+{
+  struct MHD_ResponseCache *cache = connection->daemon->response_cache;
+  struct MHD_ResponseCacheEntry *entry;
+  struct MHD_Connection **pos;
+
+  if (MHD_YES != MHD_mutex_lock_ (&cache->lock))
+    MHD_PANIC ("Failed to acquire response cache mutex\n");
+  if (NULL != (entry = connection->cache_wait))
+    {
+      for (pos = &entry->waiters; *pos != connection; pos = &(*pos)->cache_waiter_next)
+        ;
+      *pos = connection->cache_waiter_next;
+      connection->cache_waiter_next = NULL;
+      connection->cache_wait = NULL;
+    }
+  if (NULL != (entry = connection->cache_entry))
+    {
+      connection->cache_entry = NULL;
+      entry->leader = NULL;
+      wake_waiters (entry);
+      remove_entry (cache, entry);
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->lock))
+    MHD_PANIC ("Failed to release response cache mutex\n");
+}
+
+/* end of responsecache.c */
@@ -0,0 +1,109 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file responsecache.h
+ * @brief  cache of responses produced by the access handler
+ * @author Christian Grothoff
+ */
+
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include "internal.h"
+
+
+/**
+ * Create a response cache.
+ *
+ * @param max_entries maximum number of entries to keep
+ * @param ttl number of seconds cached responses are served
+ * @param vary comma-separated list of request headers that are
+ *        part of the cache key, or NULL
+ * @return NULL on error
+ */
+struct MHD_ResponseCache *
+MHD_response_cache_create_ (unsigned int max_entries,
+                            unsigned int ttl,
+                            const char *vary);
+
+
+/**
+ * Destroy a response cache, releasing all cached responses.
+ * There must be no connections left waiting on the cache.
+ *
+ * @param cache cache to destroy
+ */
+void
+MHD_response_cache_destroy_ (struct MHD_ResponseCache *cache);
+
+
+/**
+ * Resume all connections waiting on pending entries of the cache;
+ * used when the daemon shuts down.
+ *
+ * @param cache the cache
+ */
+void
+MHD_response_cache_resume_all_ (struct MHD_ResponseCache *cache);
+
+
+/**
+ * Try to answer the request of @a connection from the cache of its
+ * daemon.  On a hit, the cached response is queued.  If another
+ * connection is already producing the response for the same key and
+ * the daemon supports suspending connections, @a connection is
+ * suspended until that response is available.  Otherwise, the caller
+ * must invoke the access handler; if @a connection became the one
+ * producing the response for its key, the response it queues is
+ * passed to #MHD_response_cache_store_().
+ *
+ * @param connection connection with a complete request header
+ * @return #MHD_YES if the request was handled (queued or suspended),
+ *         #MHD_NO if the access handler must be called
+ */
+int
+MHD_response_cache_lookup_ (struct MHD_Connection *connection);
+
+
+/**
+ * Offer the response queued by the connection producing a cache
+ * entry to the cache and wake up connections waiting for it.
+ *
+ * @param connection connection with `cache_entry` set
+ * @param status_code HTTP status code of the response
+ * @param response response queued by the application
+ */
+void
+MHD_response_cache_store_ (struct MHD_Connection *connection,
+                           unsigned int status_code,
+                           struct MHD_Response *response);
+
+
+/**
+ * A connection producing or waiting for a cache entry is closed;
+ * if it was producing the entry, drop the entry and wake up the
+ * connections waiting for it, otherwise just stop waiting.
+ *
+ * @param connection connection with `cache_entry` or `cache_wait` set
+ */
+void
+MHD_response_cache_abandon_ (struct MHD_Connection *connection);
+
+#endif
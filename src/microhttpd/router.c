@@ -0,0 +1,729 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file router.c
+ * @brief dispatch of requests to handlers by method and path pattern
+ * @author Christian Grothoff
+ *
+ * Patterns are stored in a radix trie.  Each node has a (possibly
+ * empty) static label, static children (with distinct first bytes,
+ * sorted by that byte once the router is compiled), at most one
+ * parameter child (":name", matching one non-empty path segment) and
+ * at most one wildcard child ("*name", matching the rest of the
+ * path).  When matching, static children take precedence over the
+ * parameter child, which takes precedence over the wildcard child;
+ * if a more specific branch does not lead to a route for the
+ * request's method, the next one is tried.
+ */
+
+#include "internal.h"
+#include "router.h"
+#include "memorypool.h"
+
+/**
+ * Maximum number of parameters (including the wildcard)
+ * in a pattern.
+ */
+#define MAX_ROUTE_PARAMS 16
+
+
+/**
+ * Handler registered for a pattern.
+ */
+struct Route
+{
+
+  /**
+   * Next route for the same pattern.
+   */
+  struct Route *next;
+
+  /**
+   * Method the route is for, NULL for any method.
+   */
+  char *method;
+
+  /**
+   * Handler to call.
+   */
+  MHD_AccessHandlerCallback handler;
+
+  /**
+   * Closure for @e handler.
+   */
+  void *handler_cls;
+
+};
+
+
+/**
+ * Node in the radix trie of a router.
+ */
+struct RouteNode
+{
+
+  /**
+   * Static label of the node (consumed when entering the node from
+   * its parent's static children), not 0-terminated.
+   */
+  char *label;
+
+  /**
+   * Static children of the node.
+   */
+  struct RouteNode **children;
+
+  /**
+   * Child for a parameter, or NULL.
+   */
+  struct RouteNode *param_child;
+
+  /**
+   * Child for a wildcard, or NULL.
+   */
+  struct RouteNode *wildcard_child;
+
+  /**
+   * Name of the parameter or wildcard leading to this node, or NULL.
+   */
+  char *name;
+
+  /**
+   * Routes for patterns ending at this node.
+   */
+  struct Route *routes;
+
+  /**
+   * Number of bytes in @e label.
+   */
+  size_t label_len;
+
+  /**
+   * Number of entries in @e children.
+   */
+  unsigned int num_children;
+
+};
+
+
+/**
+ * Handle for a router.
+ */
+struct MHD_Router
+{
+
+  /**
+   * Root of the trie (with an empty label).
+   */
+  struct RouteNode root;
+
+  /**
+   * #MHD_YES once the router has been compiled.
+   */
+  int compiled;
+
+};
+
+
+/**
+ * Parameter value found while matching.
+ */
+struct RouteParam
+{
+
+  /**
+   * Name of the parameter.
+   */
+  const char *name;
+
+  /**
+   * Start of the value in the URL.
+   */
+  const char *value;
+
+  /**
+   * Length of the value.
+   */
+  size_t value_len;
+
+};
+
+
+/**
+ * Create a new trie node.
+ *
+ * @param label static label of the node
+ * @param label_len number of bytes in @a label
+ * @return NULL on error
+ */
+static struct RouteNode *
+create_node (const char *label,
+             size_t label_len)
+{
+  struct RouteNode *node;
+
+  node = malloc (sizeof (struct RouteNode));
+  if (NULL == node)
+    return NULL;
+  memset (node,
+          0,
+          sizeof (struct RouteNode));
+  if (0 != label_len)
+    {
+      node->label = malloc (label_len);
+      if (NULL == node->label)
+        {
+          free (node);
+          return NULL;
+        }
+      memcpy (node->label, label, label_len);
+      node->label_len = label_len;
+    }
+  return node;
+}
+
+
+/**
+ * Free a trie node and all nodes below it.
+ *
+ * @param node node to free
+ */
+static void
+free_node (struct RouteNode *node)
+{
+  struct Route *route;
+  unsigned int i;
+
+  for (i = 0; i < node->num_children; i++)
+    {
+      free_node (node->children[i]);
+      free (node->children[i]);
+    }
+  free (node->children);
+  if (NULL != node->param_child)
+    {
+      free_node (node->param_child);
+      free (node->param_child);
+    }
+  if (NULL != node->wildcard_child)
+    {
+      free_node (node->wildcard_child);
+      free (node->wildcard_child);
+    }
+  while (NULL != (route = node->routes))
+    {
+      node->routes = route->next;
+      free (route->method);
+      free (route);
+    }
+  free (node->name);
+  free (node->label);
+}
+
+
+/**
+ * Find the node for a static path below @a node, splitting labels
+ * and creating nodes as necessary.
+ *
+ * @param node node to start at
+ * @param path static path to insert
+ * @param path_len number of bytes in @a path
+ * @return NULL on error (out of memory)
+ */
+static struct RouteNode *
+insert_static (struct RouteNode *node,
+               const char *path,
+               size_t path_len)
+{
+  struct RouteNode **children;
+  struct RouteNode *child;
+  struct RouteNode *mid;
+  char *label;
+  unsigned int i;
+  size_t common;
+
+  while (0 != path_len)
+    {
+      child = NULL;
+      for (i = 0; i < node->num_children; i++)
+        if (node->children[i]->label[0] == path[0])
+          {
+            child = node->children[i];
+            break;
+          }
+      if (NULL == child)
+        {
+          children = realloc (node->children,
+                              (node->num_children + 1) * sizeof (struct RouteNode *));
+          if (NULL == children)
+            return NULL;
+          node->children = children;
+          child = create_node (path, path_len);
+          if (NULL == child)
+            return NULL;
+          node->children[node->num_children++] = child;
+          return child;
+        }
+      for (common = 0;
+           (common < path_len) &&
+           (common < child->label_len) &&
+           (path[common] == child->label[common]);
+           common++) ;
+      if (common < child->label_len)
+        {
+          /* split the label of 'child' after 'common' bytes */
+          mid = create_node (child->label, common);
+          if (NULL == mid)
+            return NULL;
+          mid->children = malloc (sizeof (struct RouteNode *));
+          label = malloc (child->label_len - common);
+          if ( (NULL == mid->children) ||
+               (NULL == label) )
+            {
+              free (label);
+              free_node (mid);
+              free (mid);
+              return NULL;
+            }
+          memcpy (label,
+                  &child->label[common],
+                  child->label_len - common);
+          free (child->label);
+          child->label = label;
+          child->label_len -= common;
+          mid->children[0] = child;
+          mid->num_children = 1;
+          node->children[i] = mid;
+          child = mid;
+        }
+      node = child;
+      path += common;
+      path_len -= common;
+    }
+  return node;
+}
+
+
+/**
+ * Find or create the parameter or wildcard child of a node.
+ *
+ * @param slot pointer to the `param_child` or `wildcard_child`
+ *        field of the node
+ * @param name name of the parameter
+ * @param name_len number of bytes in @a name
+ * @return NULL on error (out of memory, or a parameter with a
+ *         different name at the same position)
+ */
+static struct RouteNode *
+insert_param (struct RouteNode **slot,
+              const char *name,
+              size_t name_len)
+{
+  struct RouteNode *child;
+
+  if (NULL != (child = *slot))
+    {
+      if ( (strlen (child->name) != name_len) ||
+           (0 != memcmp (child->name, name, name_len)) )
+        return NULL;
+      return child;
+    }
+  child = create_node (NULL, 0);
+  if (NULL == child)
+    return NULL;
+  child->name = malloc (name_len + 1);
+  if (NULL == child->name)
+    {
+      free (child);
+      return NULL;
+    }
+  memcpy (child->name, name, name_len);
+  child->name[name_len] = '\0';
+  *slot = child;
+  return child;
+}
+
+
+/**
+ * Create a router.  Routes are added with #MHD_router_add and the
+ * router is given to #MHD_start_daemon with #MHD_OPTION_ROUTER.
+ *
+ * @return NULL on error (out of memory)
+ * @ingroup specialized
+ */
+struct MHD_Router *
+MHD_router_create (void)
+{
+  struct MHD_Router *router;
+
+  router = malloc (sizeof (struct MHD_Router));
+  if (NULL == router)
+    return NULL;
+  memset (router,
+          0,
+          sizeof (struct MHD_Router));
+  return router;
+}
+
+
+/**
+ * Register a handler for requests with the given method and a URL
+ * matching the given pattern.
+ *
+ * @param router router to add the route to
+ * @param method method of the requests (i.e. #MHD_HTTP_METHOD_GET),
+ *        NULL for requests with any method
+ * @param pattern pattern for the URL
+ * @param handler handler to call
+ * @param handler_cls closure for @a handler
+ * @return #MHD_YES on success, #MHD_NO if the pattern is invalid,
+ *         conflicts with a pattern added before, the router is in
+ *         use by a daemon already or we are out of memory
+ * @ingroup specialized
+ */
+int
+MHD_router_add (struct MHD_Router *router,
+                const char *method,
+                const char *pattern,
+                MHD_AccessHandlerCallback handler,
+                void *handler_cls)
+{
+  struct RouteNode *node;
+  struct Route *route;
+  const char *start;
+  const char *end;
+  unsigned int params;
+
+  if ( (MHD_YES == router->compiled) ||
+       (NULL == handler) ||
+       ('/' != pattern[0]) )
+    return MHD_NO;
+  node = &router->root;
+  params = 0;
+  start = pattern;
+  while ('\0' != *start)
+    {
+      if ( ( (':' == *start) ||
+             ('*' == *start) ) &&
+           ('/' == start[-1]) )
+        {
+          end = start + 1;
+          while ( ('\0' != *end) &&
+                  ('/' != *end) )
+            end++;
+          if ( (end == start + 1) ||
+               (++params > MAX_ROUTE_PARAMS) ||
+               ( ('*' == *start) &&
+                 ('\0' != *end) ) )
+            return MHD_NO;
+          node = insert_param ((':' == *start)
+                               ? &node->param_child
+                               : &node->wildcard_child,
+                               start + 1,
+                               end - start - 1);
+        }
+      else
+        {
+          end = start + 1;
+          while ( ('\0' != *end) &&
+                  ( ( (':' != *end) &&
+                      ('*' != *end) ) ||
+                    ('/' != end[-1]) ) )
+            end++;
+          node = insert_static (node,
+                                start,
+                                end - start);
+        }
+      if (NULL == node)
+        return MHD_NO;
+      start = end;
+    }
+  for (route = node->routes; NULL != route; route = route->next)
+    if ( (route->method == method) ||
+         ( (NULL != route->method) &&
+           (NULL != method) &&
+           (0 == strcmp (route->method, method)) ) )
+      return MHD_NO;
+  route = malloc (sizeof (struct Route));
+  if (NULL == route)
+    return MHD_NO;
+  route->method = NULL;
+  if ( (NULL != method) &&
+       (NULL == (route->method = strdup (method))) )
+    {
+      free (route);
+      return MHD_NO;
+    }
+  route->handler = handler;
+  route->handler_cls = handler_cls;
+  route->next = node->routes;
+  node->routes = route;
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy a router.  Must only be called after all daemons using
+ * the router have been stopped.
+ *
+ * @param router router to destroy
+ * @ingroup specialized
+ */
+void
+MHD_router_destroy (struct MHD_Router *router)
+{
+  free_node (&router->root);
+  free (router);
+}
+
+
+/**
+ * Compare two nodes by the first byte of their labels, for qsort().
+ *
+ * @param a first node
+ * @param b second node
+ * @return comparison result
+ */
+static int
+compare_nodes (const void *a,
+               const void *b)
+{
+  const struct RouteNode *na = *(const struct RouteNode * const *) a;
+  const struct RouteNode *nb = *(const struct RouteNode * const *) b;
+
+  return (int) (unsigned char) na->label[0]
+    - (int) (unsigned char) nb->label[0];
+}
+
+
+/**
+ * Sort the static children of @a node and of all nodes below it.
+ *
+ * @param node node to process
+ */
+static void
+compile_node (struct RouteNode *node)
+{
+  unsigned int i;
+
+  if (node->num_children > 1)
+    qsort (node->children,
+           node->num_children,
+           sizeof (struct RouteNode *),
+           &compare_nodes);
+  for (i = 0; i < node->num_children; i++)
+    compile_node (node->children[i]);
+  if (NULL != node->param_child)
+    compile_node (node->param_child);
+  if (NULL != node->wildcard_child)
+    compile_node (node->wildcard_child);
+}
+
+
+/**
+ * Prepare the router for matching; called when a daemon using
+ * the router is started.  No routes can be added afterwards.
+ *
+ * @param router router to compile
+ */
+void
+MHD_router_compile_ (struct MHD_Router *router)
+{
+  if (MHD_YES == router->compiled)
+    return;
+  compile_node (&router->root);
+  router->compiled = MHD_YES;
+}
+
+
+/**
+ * Find the route for @a method at @a node.  "HEAD" requests
+ * use the route for "GET" if there is no route for "HEAD".
+ *
+ * @param node node to search
+ * @param method method of the request
+ * @return NULL if there is no route for @a method
+ */
+static const struct Route *
+find_route (const struct RouteNode *node,
+            const char *method)
+{
+  const struct Route *route;
+  const struct Route *get;
+  const struct Route *any;
+
+  get = NULL;
+  any = NULL;
+  for (route = node->routes; NULL != route; route = route->next)
+    {
+      if (NULL == route->method)
+        any = route;
+      else if (0 == strcmp (route->method, method))
+        return route;
+      else if (0 == strcmp (route->method, MHD_HTTP_METHOD_GET))
+        get = route;
+    }
+  if ( (NULL != get) &&
+       (0 == strcmp (method, MHD_HTTP_METHOD_HEAD)) )
+    return get;
+  return any;
+}
+
+
+/**
+ * Match the remainder of a path against the trie below @a node.
+ *
+ * @param node node whose label has been matched
+ * @param path remainder of the path
+ * @param method method of the request
+ * @param params array for the values of the parameters
+ * @param num_params number of entries in @a params so far,
+ *        updated to the number of parameters of the matching route
+ * @return NULL if no route matches
+ */
+static const struct Route *
+match_node (const struct RouteNode *node,
+            const char *path,
+            const char *method,
+            struct RouteParam *params,
+            unsigned int *num_params)
+{
+  const struct RouteNode *child;
+  const struct Route *route;
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int mid;
+  size_t len;
+
+  if ( ('\0' == *path) &&
+       (NULL != (route = find_route (node, method))) )
+    return route;
+  if ('\0' != *path)
+    {
+      /* static children, sorted by the first byte of their labels */
+      lo = 0;
+      hi = node->num_children;
+      while (lo < hi)
+        {
+          mid = (lo + hi) / 2;
+          child = node->children[mid];
+          if ((unsigned char) child->label[0] < (unsigned char) *path)
+            lo = mid + 1;
+          else if ((unsigned char) child->label[0] > (unsigned char) *path)
+            hi = mid;
+          else
+            {
+              if ( (0 == strncmp (child->label, path, child->label_len)) &&
+                   (NULL != (route = match_node (child,
+                                                 path + child->label_len,
+                                                 method,
+                                                 params,
+                                                 num_params))) )
+                return route;
+              break;
+            }
+        }
+      if (NULL != node->param_child)
+        {
+          for (len = 0; ('\0' != path[len]) && ('/' != path[len]); len++) ;
+          if (0 != len)
+            {
+              params[*num_params].name = node->param_child->name;
+              params[*num_params].value = path;
+              params[*num_params].value_len = len;
+              (*num_params)++;
+              if (NULL != (route = match_node (node->param_child,
+                                               path + len,
+                                               method,
+                                               params,
+                                               num_params)))
+                return route;
+              (*num_params)--;
+            }
+        }
+    }
+  if ( (NULL != node->wildcard_child) &&
+       (NULL != (route = find_route (node->wildcard_child, method))) )
+    {
+      params[*num_params].name = node->wildcard_child->name;
+      params[*num_params].value = path;
+      params[*num_params].value_len = strlen (path);
+      (*num_params)++;
+      return route;
+    }
+  return NULL;
+}
+
+
+/**
+ * Find the handler for the request of @a connection in the router
+ * of its daemon and set the connection's `handler` and `handler_cls`
+ * accordingly.  The values of the parameters in the matched pattern
+ * are added to the connection as #MHD_ROUTE_ARGUMENT_KIND values.
+ *
+ * @param connection connection with a complete request header
+ * @return #MHD_YES if a route matched, #MHD_NO if not (in which
+ *         case the handler is not changed), -1 if a route matched
+ *         but its parameters could not be stored (out of memory in
+ *         the connection's pool; the handler is not changed either)
+ */
+int
+MHD_router_dispatch_ (struct MHD_Connection *connection)
+{
+  struct RouteParam params[MAX_ROUTE_PARAMS];
+  const struct Route *route;
+  unsigned int num_params;
+  unsigned int i;
+  char *value;
+
+  if ( (NULL == connection->url) ||
+       (NULL == connection->method) )
+    return MHD_NO;
+  num_params = 0;
+  route = match_node (&connection->daemon->router->root,
+                      connection->url,
+                      connection->method,
+                      params,
+                      &num_params);
+  if (NULL == route)
+    return MHD_NO;
+  for (i = 0; i < num_params; i++)
+    {
+      value = MHD_pool_allocate (connection->pool,
+                                 params[i].value_len + 1,
+                                 MHD_YES);
+      if (NULL == value)
+        return -1;
+      memcpy (value,
+              params[i].value,
+              params[i].value_len);
+      value[params[i].value_len] = '\0';
+      if (MHD_YES != MHD_set_connection_value (connection,
+                                               MHD_ROUTE_ARGUMENT_KIND,
+                                               params[i].name,
+                                               value))
+        return -1;
+    }
+  connection->handler = route->handler;
+  connection->handler_cls = route->handler_cls;
+  return MHD_YES;
+}
+
+/* end of router.c */
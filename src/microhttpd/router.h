@@ -0,0 +1,57 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file router.h
+ * @brief  dispatch of requests to handlers by method and path pattern
+ * @author Christian Grothoff
+ */
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "internal.h"
+
+
+/**
+ * Prepare the router for matching; called when a daemon using
+ * the router is started.  No routes can be added afterwards.
+ *
+ * @param router router to compile
+ */
+void
+MHD_router_compile_ (struct MHD_Router *router);
+
+
+/**
+ * Find the handler for the request of @a connection in the router
+ * of its daemon and set the connection's `handler` and `handler_cls`
+ * accordingly.  The values of the parameters in the matched pattern
+ * are added to the connection as #MHD_ROUTE_ARGUMENT_KIND values.
+ *
+ * @param connection connection with a complete request header
+ * @return #MHD_YES if a route matched, #MHD_NO if not (in which
+ *         case the handler is not changed), -1 if a route matched
+ *         but its parameters could not be stored (out of memory in
+ *         the connection's pool; the handler is not changed either)
+ */
+int
+MHD_router_dispatch_ (struct MHD_Connection *connection);
+
+#endif
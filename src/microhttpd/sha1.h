@@ -0,0 +1,47 @@
+/*
+ * This code implements the SHA-1 message-digest algorithm
+ * (FIPS 180-4).  It is based on the public domain implementation
+ * by Steve Reid.
+ * This code is in the public domain; do with it what you wish.
+ *
+ * To compute the message digest of a chunk of bytes, declare an
+ * SHA1Context structure, pass it to SHA1Init, call SHA1Update as
+ * needed on buffers full of bytes, and then call SHA1Final, which
+ * will fill a supplied 20-byte array with the digest.
+ */
+
+#ifndef MHD_SHA1_H
+#define MHD_SHA1_H
+
+#include "platform.h"
+
+#define	SHA1_BLOCK_SIZE              64
+#define	SHA1_DIGEST_SIZE             20
+
+struct SHA1Context
+{
+  uint32_t state[5];			/* state */
+  uint64_t count;			/* number of bits, mod 2^64 */
+  uint8_t buffer[SHA1_BLOCK_SIZE];	/* input buffer */
+};
+
+/*
+ * Start SHA-1 accumulation.  Set bit count to 0 and buffer to the
+ * initialization constants.
+ */
+void SHA1Init(struct SHA1Context *ctx);
+
+/*
+ * Update context to reflect the concatenation of another buffer full
+ * of bytes.
+ */
+void SHA1Update(struct SHA1Context *ctx, const unsigned char *input, size_t len);
+
+/*
+ * Final wrapup--pad to 64-byte boundary with the bit pattern
+ * 1 0* (64-bit count of bits processed, MSB-first), fill in digest
+ * and zero out ctx.
+ */
+void SHA1Final(unsigned char digest[SHA1_DIGEST_SIZE], struct SHA1Context *ctx);
+
+#endif /* !MHD_SHA1_H */
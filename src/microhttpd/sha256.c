@@ -0,0 +1,401 @@
+/*
+ * This code implements the SHA-256 and SHA-512/256 message-digest
+ * algorithms (FIPS 180-4).
+ * This code is in the public domain; do with it what you wish.
+ *
+ * To compute the message digest of a chunk of bytes, declare an
+ * SHA256Context (or SHA512_256Context) structure, pass it to
+ * SHA256Init, call SHA256Update as needed on buffers full of bytes,
+ * and then call SHA256Final, which will fill a supplied 32-byte
+ * array with the digest.
+ */
+
+#include "sha256.h"
+
+#define GET_32BIT_BE(cp)						\
+	(((uint32_t)(cp)[0] << 24) | ((uint32_t)(cp)[1] << 16) |	\
+	 ((uint32_t)(cp)[2] << 8) | (uint32_t)(cp)[3])
+
+#define GET_64BIT_BE(cp)						\
+	(((uint64_t)GET_32BIT_BE(cp) << 32) | GET_32BIT_BE((cp) + 4))
+
+#define PUT_32BIT_BE(cp, value) do {					\
+	(cp)[0] = (uint8_t)((value) >> 24);				\
+	(cp)[1] = (uint8_t)((value) >> 16);				\
+	(cp)[2] = (uint8_t)((value) >> 8);				\
+	(cp)[3] = (uint8_t)((value)); } while (0)
+
+#define PUT_64BIT_BE(cp, value) do {					\
+	PUT_32BIT_BE((cp), (uint32_t)((value) >> 32));			\
+	PUT_32BIT_BE((cp) + 4, (uint32_t)(value)); } while (0)
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#define CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+
+static const uint32_t K256[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t K512[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+  0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+  0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+  0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+  0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+  0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+  0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+  0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+  0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+  0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+  0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+  0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+  0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+  0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+  0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+  0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+  0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+  0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+  0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+  0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+  0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+
+/*
+ * The core of the SHA-256 algorithm, this alters an existing SHA-256
+ * hash to reflect the addition of 16 longwords of new data.
+ */
+static void
+SHA256Transform(uint32_t state[8], const uint8_t block[SHA256_BLOCK_SIZE])
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h, s0, s1, t1, t2;
+  unsigned int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = GET_32BIT_BE(&block[i * 4]);
+  for (i = 16; i < 64; i++)
+    {
+      s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  f = state[5];
+  g = state[6];
+  h = state[7];
+  for (i = 0; i < 64; i++)
+    {
+      s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+      t1 = h + s1 + CH(e, f, g) + K256[i] + w[i];
+      s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+      t2 = s0 + MAJ(a, b, c);
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+
+/*
+ * The core of the SHA-512 algorithm, this alters an existing SHA-512
+ * hash to reflect the addition of 16 64-bit words of new data.
+ */
+static void
+SHA512Transform(uint64_t state[8], const uint8_t block[SHA512_256_BLOCK_SIZE])
+{
+  uint64_t w[80];
+  uint64_t a, b, c, d, e, f, g, h, s0, s1, t1, t2;
+  unsigned int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = GET_64BIT_BE(&block[i * 8]);
+  for (i = 16; i < 80; i++)
+    {
+      s0 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+      s1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  f = state[5];
+  g = state[6];
+  h = state[7];
+  for (i = 0; i < 80; i++)
+    {
+      s1 = ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41);
+      t1 = h + s1 + CH(e, f, g) + K512[i] + w[i];
+      s0 = ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39);
+      t2 = s0 + MAJ(a, b, c);
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+
+/*
+ * Start SHA-256 accumulation.  Set bit count to 0 and buffer to the
+ * initialization constants.
+ */
+void
+SHA256Init(struct SHA256Context *ctx)
+{
+  if (!ctx)
+    return;
+
+  ctx->count = 0;
+  ctx->state[0] = 0x6a09e667;
+  ctx->state[1] = 0xbb67ae85;
+  ctx->state[2] = 0x3c6ef372;
+  ctx->state[3] = 0xa54ff53a;
+  ctx->state[4] = 0x510e527f;
+  ctx->state[5] = 0x9b05688c;
+  ctx->state[6] = 0x1f83d9ab;
+  ctx->state[7] = 0x5be0cd19;
+}
+
+
+/*
+ * Update context to reflect the concatenation of another buffer full
+ * of bytes.
+ */
+void
+SHA256Update(struct SHA256Context *ctx, const unsigned char *input, size_t len)
+{
+  size_t have, need;
+
+  if (!ctx || !input)
+    return;
+
+  /* Check how many bytes we already have and how many more we need. */
+  have = (size_t)((ctx->count >> 3) & (SHA256_BLOCK_SIZE - 1));
+  need = SHA256_BLOCK_SIZE - have;
+
+  /* Update bitcount */
+  ctx->count += (uint64_t)len << 3;
+
+  if (len >= need)
+    {
+      if (have != 0)
+	{
+	  memcpy(ctx->buffer + have, input, need);
+	  SHA256Transform(ctx->state, ctx->buffer);
+	  input += need;
+	  len -= need;
+	  have = 0;
+	}
+
+      /* Process data in SHA256_BLOCK_SIZE chunks. */
+      while (len >= SHA256_BLOCK_SIZE)
+	{
+	  SHA256Transform(ctx->state, (const uint8_t *)input);
+	  input += SHA256_BLOCK_SIZE;
+	  len -= SHA256_BLOCK_SIZE;
+	}
+    }
+
+  /* Handle any remaining bytes of data. */
+  if (len != 0)
+    memcpy(ctx->buffer + have, input, len);
+}
+
+
+/*
+ * Final wrapup--pad to 64-byte boundary with the bit pattern
+ * 1 0* (64-bit count of bits processed, MSB-first), fill in digest
+ * and zero out ctx.
+ */
+void
+SHA256Final(unsigned char digest[SHA256_DIGEST_SIZE], struct SHA256Context *ctx)
+{
+  uint8_t count[8];
+  uint64_t bits;
+  unsigned int i;
+
+  if (!ctx || !digest)
+    return;
+
+  bits = ctx->count;
+  for (i = 0; i < 8; i++)
+    count[i] = (uint8_t)(bits >> (56 - 8 * i));
+  SHA256Update(ctx, (const unsigned char *)"\200", 1);
+  while (56 != ((ctx->count >> 3) & (SHA256_BLOCK_SIZE - 1)))
+    SHA256Update(ctx, (const unsigned char *)"\0", 1);
+  SHA256Update(ctx, count, 8);
+
+  for (i = 0; i < 8; i++)
+    PUT_32BIT_BE(digest + 4 * i, ctx->state[i]);
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+
+/*
+ * Start SHA-512/256 accumulation.  Set bit count to 0 and buffer to
+ * the initialization constants.
+ */
+void
+SHA512_256Init(struct SHA512_256Context *ctx)
+{
+  if (!ctx)
+    return;
+
+  ctx->count = 0;
+  ctx->state[0] = 0x22312194fc2bf72cULL;
+  ctx->state[1] = 0x9f555fa3c84c64c2ULL;
+  ctx->state[2] = 0x2393b86b6f53b151ULL;
+  ctx->state[3] = 0x963877195940eabdULL;
+  ctx->state[4] = 0x96283ee2a88effe3ULL;
+  ctx->state[5] = 0xbe5e1e2553863992ULL;
+  ctx->state[6] = 0x2b0199fc2c85b8aaULL;
+  ctx->state[7] = 0x0eb72ddc81c52ca2ULL;
+}
+
+
+/*
+ * Update context to reflect the concatenation of another buffer full
+ * of bytes.
+ */
+void
+SHA512_256Update(struct SHA512_256Context *ctx, const unsigned char *input, size_t len)
+{
+  size_t have, need;
+
+  if (!ctx || !input)
+    return;
+
+  /* Check how many bytes we already have and how many more we need. */
+  have = (size_t)((ctx->count >> 3) & (SHA512_256_BLOCK_SIZE - 1));
+  need = SHA512_256_BLOCK_SIZE - have;
+
+  /* Update bitcount */
+  ctx->count += (uint64_t)len << 3;
+
+  if (len >= need)
+    {
+      if (have != 0)
+	{
+	  memcpy(ctx->buffer + have, input, need);
+	  SHA512Transform(ctx->state, ctx->buffer);
+	  input += need;
+	  len -= need;
+	  have = 0;
+	}
+
+      /* Process data in SHA512_256_BLOCK_SIZE chunks. */
+      while (len >= SHA512_256_BLOCK_SIZE)
+	{
+	  SHA512Transform(ctx->state, (const uint8_t *)input);
+	  input += SHA512_256_BLOCK_SIZE;
+	  len -= SHA512_256_BLOCK_SIZE;
+	}
+    }
+
+  /* Handle any remaining bytes of data. */
+  if (len != 0)
+    memcpy(ctx->buffer + have, input, len);
+}
+
+
+/*
+ * Final wrapup--pad to 128-byte boundary with the bit pattern
+ * 1 0* (128-bit count of bits processed, MSB-first), fill in the
+ * digest (the first 256 bits of the SHA-512 state) and zero out ctx.
+ */
+void
+SHA512_256Final(unsigned char digest[SHA512_256_DIGEST_SIZE], struct SHA512_256Context *ctx)
+{
+  uint8_t count[16];
+  uint64_t bits;
+  unsigned int i;
+
+  if (!ctx || !digest)
+    return;
+
+  /* we only count up to 2^64 bits, the upper half is zero */
+  bits = ctx->count;
+  memset(count, 0, 8);
+  for (i = 0; i < 8; i++)
+    count[8 + i] = (uint8_t)(bits >> (56 - 8 * i));
+  SHA512_256Update(ctx, (const unsigned char *)"\200", 1);
+  while (112 != ((ctx->count >> 3) & (SHA512_256_BLOCK_SIZE - 1)))
+    SHA512_256Update(ctx, (const unsigned char *)"\0", 1);
+  SHA512_256Update(ctx, count, 16);
+
+  for (i = 0; i < SHA512_256_DIGEST_SIZE / 8; i++)
+    PUT_64BIT_BE(digest + 8 * i, ctx->state[i]);
+  memset(ctx, 0, sizeof(*ctx));
+}
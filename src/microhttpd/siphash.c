@@ -0,0 +1,120 @@
+/*
+ * This code implements the SipHash-2-4 keyed hash function by
+ * Jean-Philippe Aumasson and Daniel J. Bernstein.
+ * This code is in the public domain; do with it what you wish.
+ */
+
+/**
+ * @file siphash.c
+ * @brief  SipHash-2-4 keyed hash function
+ */
+
+#include "siphash.h"
+
+/**
+ * Rotate the 64-bit value @a x left by @a b bits.
+ */
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+/**
+ * One SipRound on the state in v0 to v3.
+ */
+#define SIPROUND                                \
+  do {                                          \
+    v0 += v1; v1 = ROTL (v1, 13); v1 ^= v0;     \
+    v0 = ROTL (v0, 32);                         \
+    v2 += v3; v3 = ROTL (v3, 16); v3 ^= v2;     \
+    v0 += v3; v3 = ROTL (v3, 21); v3 ^= v0;     \
+    v2 += v1; v1 = ROTL (v1, 17); v1 ^= v2;     \
+    v2 = ROTL (v2, 32);                         \
+  } while (0)
+
+
+/**
+ * Load a little-endian 64-bit value, independent of the host
+ * byte order.
+ *
+ * @param p the 8 bytes of the value
+ * @return the value
+ */
+static uint64_t
+load64 (const uint8_t *p)
+{
+  return ((uint64_t) p[0]) | ((uint64_t) p[1] << 8) |
+    ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24) |
+    ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40) |
+    ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
+
+
+/**
+ * Compute the SipHash-2-4 of a buffer with the given key.
+ *
+ * @param key secret key
+ * @param data data to hash
+ * @param len number of bytes in @a data
+ * @return hash of @a data
+ */
+uint64_t
+MHD_siphash_ (const uint8_t key[SIPHASH_KEY_SIZE],
+              const void *data,
+              size_t len)
+{
+  const uint8_t *in = data;
+  const uint8_t *end = in + len - (len % 8);
+  uint64_t k0 = load64 (key);
+  uint64_t k1 = load64 (key + 8);
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+  uint64_t v3 = 0x7465646279746573ULL ^ k1;
+  uint64_t b = ((uint64_t) len) << 56;
+  uint64_t m;
+
+  for (; in != end; in += 8)
+    {
+      m = load64 (in);
+      v3 ^= m;
+      SIPROUND;
+      SIPROUND;
+      v0 ^= m;
+    }
+  switch (len % 8)
+    {
+    case 7:
+      b |= ((uint64_t) in[6]) << 48;
+      /* fall-through! */
+    case 6:
+      b |= ((uint64_t) in[5]) << 40;
+      /* fall-through! */
+    case 5:
+      b |= ((uint64_t) in[4]) << 32;
+      /* fall-through! */
+    case 4:
+      b |= ((uint64_t) in[3]) << 24;
+      /* fall-through! */
+    case 3:
+      b |= ((uint64_t) in[2]) << 16;
+      /* fall-through! */
+    case 2:
+      b |= ((uint64_t) in[1]) << 8;
+      /* fall-through! */
+    case 1:
+      b |= ((uint64_t) in[0]);
+      /* fall-through! */
+    case 0:
+      break;
+    }
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* end of siphash.c */
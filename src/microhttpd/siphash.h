@@ -0,0 +1,40 @@
+/*
+ * This code implements the SipHash-2-4 keyed hash function by
+ * Jean-Philippe Aumasson and Daniel J. Bernstein.
+ * This code is in the public domain; do with it what you wish.
+ *
+ * SipHash is a fast pseudorandom function for short inputs; with a
+ * secret key, an attacker cannot choose inputs that collide in a
+ * hash table.
+ */
+
+/**
+ * @file siphash.h
+ * @brief  SipHash-2-4 keyed hash function
+ */
+
+#ifndef MHD_SIPHASH_H
+#define MHD_SIPHASH_H
+
+#include "platform.h"
+
+/**
+ * Number of bytes in a SipHash key.
+ */
+#define SIPHASH_KEY_SIZE 16
+
+
+/**
+ * Compute the SipHash-2-4 of a buffer with the given key.
+ *
+ * @param key secret key
+ * @param data data to hash
+ * @param len number of bytes in @a data
+ * @return hash of @a data
+ */
+uint64_t
+MHD_siphash_ (const uint8_t key[SIPHASH_KEY_SIZE],
+              const void *data,
+              size_t len);
+
+#endif /* !MHD_SIPHASH_H */
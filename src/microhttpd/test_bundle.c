@@ -0,0 +1,182 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_bundle.c
+ * @brief  Testcase for static asset bundles
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define HDRS "Content-Type: text/plain\r\n"
+
+
+static void
+put_u32 (unsigned char *p, uint32_t v)
+{
+  p[0] = (unsigned char) v;
+  p[1] = (unsigned char) (v >> 8);
+  p[2] = (unsigned char) (v >> 16);
+  p[3] = (unsigned char) (v >> 24);
+}
+
+
+static void
+put_entry (unsigned char *p,
+           uint32_t path_off, uint32_t path_len,
+           uint32_t hdr_off, uint32_t hdr_len,
+           uint32_t data_off, uint32_t data_len,
+           uint32_t gz_off, uint32_t gz_len)
+{
+  memset (p, 0, 48);
+  put_u32 (&p[0], path_off);
+  put_u32 (&p[4], path_len);
+  put_u32 (&p[8], hdr_off);
+  put_u32 (&p[12], hdr_len);
+  put_u32 (&p[16], data_off);
+  put_u32 (&p[24], data_len);
+  put_u32 (&p[32], gz_off);
+  put_u32 (&p[40], gz_len);
+}
+
+
+/**
+ * Write a bundle with the assets "/a" (with compressed variant)
+ * and "/b/c".
+ */
+static int
+write_bundle (const char *name)
+{
+  unsigned char buf[256];
+  size_t off;
+  FILE *f;
+
+  memset (buf, 0, sizeof (buf));
+  memcpy (buf, "MHDBNDL", 8);
+  put_u32 (&buf[8], 1);
+  put_u32 (&buf[12], 2);
+  off = 16 + 2 * 48;
+  memcpy (&buf[off], "/a/b/c" HDRS "helloGZxyz", 6 + strlen (HDRS) + 10);
+  put_entry (&buf[16],
+             off, 2,
+             off + 6, strlen (HDRS),
+             off + 6 + strlen (HDRS), 5,
+             off + 6 + strlen (HDRS) + 5, 2);
+  put_entry (&buf[16 + 48],
+             off + 2, 4,
+             off + 6, strlen (HDRS),
+             off + 6 + strlen (HDRS) + 7, 3,
+             0, 0);
+  f = fopen (name, "wb");
+  if (NULL == f)
+    return 1;
+  fwrite (buf, 1, off + 6 + strlen (HDRS) + 10, f);
+  fclose (f);
+  return 0;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  char name[] = "/tmp/test_bundleXXXXXX";
+  struct MHD_Bundle *bundle;
+  struct MHD_Response *r1;
+  struct MHD_Response *r2;
+  const char *ct;
+  int fd;
+  int errorCount = 0;
+
+  fd = mkstemp (name);
+  if (-1 == fd)
+    return 77;                  /* skip */
+  close (fd);
+  if (0 != write_bundle (name))
+    {
+      unlink (name);
+      return 1;
+    }
+  bundle = MHD_bundle_open (name);
+  if (NULL == bundle)
+    {
+      unlink (name);
+      return 2;
+    }
+  r1 = MHD_bundle_lookup (bundle, "/a", NULL);
+  r2 = MHD_bundle_lookup (bundle, "/a", "deflate, gzip;q=0.5");
+  if ( (NULL == r1) || (NULL == r2) || (r1 == r2) )
+    errorCount |= 4;
+  if ( (NULL != r1) &&
+       ( (NULL == (ct = MHD_get_response_header (r1, MHD_HTTP_HEADER_CONTENT_TYPE))) ||
+         (0 != strcmp (ct, "text/plain")) ||
+         (NULL != MHD_get_response_header (r1, MHD_HTTP_HEADER_CONTENT_ENCODING)) ) )
+    errorCount |= 8;
+  if ( (NULL != r2) &&
+       (NULL == MHD_get_response_header (r2, MHD_HTTP_HEADER_CONTENT_ENCODING)) )
+    errorCount |= 16;
+  if (NULL != r1)
+    MHD_destroy_response (r1);
+  if (NULL != r2)
+    MHD_destroy_response (r2);
+  r1 = MHD_bundle_lookup (bundle, "/a", "gzip;q=0");
+  r2 = MHD_bundle_lookup (bundle, "/a", NULL);
+  if ( (NULL == r1) || (r1 != r2) )
+    errorCount |= 32;
+  if (NULL != r1)
+    MHD_destroy_response (r1);
+  if (NULL != r2)
+    MHD_destroy_response (r2);
+  /* an explicit refusal takes precedence over the wildcard */
+  r1 = MHD_bundle_lookup (bundle, "/a", "*, gzip;q=0");
+  r2 = MHD_bundle_lookup (bundle, "/a", "gzip;q=0, *");
+  if ( (NULL == r1) ||
+       (NULL == r2) ||
+       (NULL != MHD_get_response_header (r1, MHD_HTTP_HEADER_CONTENT_ENCODING)) ||
+       (NULL != MHD_get_response_header (r2, MHD_HTTP_HEADER_CONTENT_ENCODING)) )
+    errorCount |= 32;
+  if (NULL != r1)
+    MHD_destroy_response (r1);
+  if (NULL != r2)
+    MHD_destroy_response (r2);
+  r1 = MHD_bundle_lookup (bundle, "/b/c", "gzip");
+  if ( (NULL == r1) ||
+       (NULL != MHD_get_response_header (r1, MHD_HTTP_HEADER_CONTENT_ENCODING)) )
+    errorCount |= 64;
+  if (NULL != r1)
+    MHD_destroy_response (r1);
+  if ( (NULL != MHD_bundle_lookup (bundle, "/b", NULL)) ||
+       (NULL != MHD_bundle_lookup (bundle, "/b/c/", NULL)) ||
+       (NULL != MHD_bundle_lookup (bundle, "/", NULL)) )
+    errorCount |= 128;
+  MHD_bundle_close (bundle);
+  unlink (name);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
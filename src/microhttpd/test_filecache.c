@@ -0,0 +1,146 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_filecache.c
+ * @brief  Testcase for the static file cache
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+static int
+write_file (const char *name,
+            const char *data)
+{
+  FILE *f;
+
+  f = fopen (name, "wb");
+  if (NULL == f)
+    return 1;
+  fputs (data, f);
+  fclose (f);
+  return 0;
+}
+
+
+static int
+testLookup (const char *dir)
+{
+  struct MHD_FileCache *cache;
+  struct MHD_Response *r1;
+  struct MHD_Response *r2;
+  int ret = 0;
+
+  cache = MHD_file_cache_create (dir, 1, 3600);
+  if (NULL == cache)
+    return 1;
+  r1 = MHD_file_cache_lookup (cache, "/a.txt");
+  r2 = MHD_file_cache_lookup (cache, "/a.txt");
+  if ( (NULL == r1) || (r1 != r2) )
+    ret |= 2;
+  if ( (NULL != r1) &&
+       ( (NULL == MHD_get_response_header (r1, MHD_HTTP_HEADER_ETAG)) ||
+         (NULL == MHD_get_response_header (r1, MHD_HTTP_HEADER_LAST_MODIFIED)) ) )
+    ret |= 4;
+  if (NULL != MHD_file_cache_lookup (cache, "/missing"))
+    ret |= 8;
+  if (NULL != MHD_file_cache_lookup (cache, "/../a.txt"))
+    ret |= 8;
+  /* evicts "/a.txt", response must remain usable */
+  r2 = MHD_file_cache_lookup (cache, "/b.txt");
+  if ( (NULL == r2) || (r1 == r2) )
+    ret |= 16;
+  MHD_file_cache_destroy (cache);
+  if (NULL != r1)
+    {
+      if (NULL == MHD_get_response_header (r1, MHD_HTTP_HEADER_ETAG))
+        ret |= 32;
+      MHD_destroy_response (r1);
+      MHD_destroy_response (r1);
+    }
+  if (NULL != r2)
+    MHD_destroy_response (r2);
+  return ret;
+}
+
+
+static int
+testInvalidate (const char *dir,
+                const char *name)
+{
+  struct MHD_FileCache *cache;
+  struct MHD_Response *r1;
+  struct MHD_Response *r2;
+  int ret = 0;
+
+  cache = MHD_file_cache_create (dir, 4, 0);
+  if (NULL == cache)
+    return 64;
+  r1 = MHD_file_cache_lookup (cache, "/a.txt");
+  if (0 != write_file (name, "changed size"))
+    ret |= 128;
+  r2 = MHD_file_cache_lookup (cache, "/a.txt");
+  if ( (NULL == r1) || (NULL == r2) || (r1 == r2) )
+    ret |= 256;
+  MHD_file_cache_destroy (cache);
+  if (NULL != r1)
+    MHD_destroy_response (r1);
+  if (NULL != r2)
+    MHD_destroy_response (r2);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  char dir[] = "/tmp/test_filecacheXXXXXX";
+  char a[64];
+  char b[64];
+  int errorCount = 0;
+
+  if (NULL == mkdtemp (dir))
+    return 77;                  /* skip */
+  snprintf (a, sizeof (a), "%s/a.txt", dir);
+  snprintf (b, sizeof (b), "%s/b.txt", dir);
+  if ( (0 != write_file (a, "a")) ||
+       (0 != write_file (b, "b")) )
+    errorCount = 1;
+  if (0 == errorCount)
+    errorCount += testLookup (dir);
+  if (0 == errorCount)
+    errorCount += testInvalidate (dir, a);
+  (void) unlink (a);
+  (void) unlink (b);
+  (void) rmdir (dir);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
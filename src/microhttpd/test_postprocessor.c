@@ -66,6 +66,21 @@ const char *want[] = {
   "key2", NULL, NULL, NULL, "",
   "key3", NULL, NULL, NULL, "",
 #define URL_EMPTY_VALUE_END (URL_EMPTY_VALUE_START + 15)
+  NULL, NULL, NULL, NULL, NULL,
+#define JSON_DATA "{\"name\": \"Joe \\\"B\\\" \\u00e9\\ud83d\\ude00!\",\n \"n\": [1, -2.5e3,true,null, {}, []],\"a/b~\":false, \"o\":{\"x\":[\"\"]}} "
+#define JSON_START (URL_EMPTY_VALUE_END + 5)
+  "/name", NULL, "string", NULL, "Joe \"B\" \xc3\xa9\xf0\x9f\x98\x80!",
+  "/n/0", NULL, "number", NULL, "1",
+  "/n/1", NULL, "number", NULL, "-2.5e3",
+  "/n/2", NULL, "boolean", NULL, "true",
+  "/n/3", NULL, "null", NULL, "null",
+  "/a~1b~0", NULL, "boolean", NULL, "false",
+  "/o/x/0", NULL, "string", NULL, "",
+#define JSON_END (JSON_START + 35)
+  NULL, NULL, NULL, NULL, NULL,
+#define JSON_NUMBER_START (JSON_END + 5)
+  "", NULL, "number", NULL, "42",
+#define JSON_NUMBER_END (JSON_NUMBER_START + 5)
   NULL, NULL, NULL, NULL, NULL
 };
 
@@ -332,6 +347,78 @@ test_empty_value ()
 
 
 
+static int
+test_json ()
+{
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  unsigned int want_off;
+  size_t size;
+  size_t splitpoint;
+  int ret;
+
+  /* JSON is only parsed on request */
+  memset (&connection, 0, sizeof (struct MHD_Connection));
+  memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+  connection.headers_received = &header;
+  header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+  header.value = MHD_HTTP_POST_ENCODING_JSON;
+  header.kind = MHD_HEADER_KIND;
+  if (NULL != MHD_create_post_processor (&connection,
+                                         1024, &value_checker, &want_off))
+    return 16;
+  size = strlen (JSON_DATA);
+  for (splitpoint = 1; splitpoint < size; splitpoint++)
+  {
+    want_off = JSON_START;
+    memset (&connection, 0, sizeof (struct MHD_Connection));
+    memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+    connection.headers_received = &header;
+    header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+    header.value = MHD_HTTP_POST_ENCODING_JSON "; charset=utf-8";
+    header.kind = MHD_HEADER_KIND;
+    pp = MHD_create_post_processor_json (&connection,
+                                         1024, &value_checker, &want_off);
+    MHD_post_process (pp, JSON_DATA, splitpoint);
+    MHD_post_process (pp, &JSON_DATA[splitpoint], size - splitpoint);
+    ret = MHD_destroy_post_processor (pp);
+    if ( (want_off != JSON_END) ||
+         (MHD_YES != ret) )
+      return 16;
+  }
+  /* a number at the top level only ends with the body */
+  want_off = JSON_NUMBER_START;
+  pp = MHD_create_post_processor_json (&connection,
+                                       1024, &value_checker, &want_off);
+  MHD_post_process (pp, " 42", 3);
+  if (want_off != JSON_NUMBER_START)
+    return 16;
+  ret = MHD_destroy_post_processor (pp);
+  if ( (want_off != JSON_NUMBER_END) ||
+       (MHD_YES != ret) )
+    return 16;
+  /* invalid bodies */
+  want_off = JSON_NUMBER_END;
+  pp = MHD_create_post_processor_json (&connection,
+                                       1024, &value_checker, &want_off);
+  if ( (MHD_NO != MHD_post_process (pp, "[,]", 3)) ||
+       (MHD_NO != MHD_destroy_post_processor (pp)) )
+    return 16;
+  pp = MHD_create_post_processor_json (&connection,
+                                       1024, &value_checker, &want_off);
+  if ( (MHD_NO != MHD_post_process (pp, "{]", 2)) ||
+       (MHD_NO != MHD_destroy_post_processor (pp)) )
+    return 16;
+  pp = MHD_create_post_processor_json (&connection,
+                                       1024, &value_checker, &want_off);
+  MHD_post_process (pp, "[[", 2);
+  if (MHD_NO != MHD_destroy_post_processor (pp))
+    return 16;
+  return 0;
+}
+
+
 int
 main (int argc, char *const *argv)
 {
@@ -343,6 +430,7 @@ main (int argc, char *const *argv)
   errorCount += test_multipart ();
   errorCount += test_nested_multipart ();
   errorCount += test_empty_value ();
+  errorCount += test_json ();
   if (errorCount != 0)
     fprintf (stderr, "Error (code: %u)\n", errorCount);
   return errorCount != 0;       /* 0 == pass */
@@ -93,12 +93,507 @@ test_simple_large ()
   return 0;
 }
 
+/**
+ * Size of the values posted by #test_urlencoded_large().
+ */
+#define VALUE_SIZE 60000
+
+struct ValueCheck
+{
+  /**
+   * Reassembled values of "a" and "b".
+   */
+  char value[2][VALUE_SIZE];
+
+  /**
+   * Number of bytes received per value.
+   */
+  size_t received[2];
+
+  /**
+   * Number of calls for the value of "a".
+   */
+  unsigned int calls;
+};
+
+
+static int
+urlencoded_checker (void *cls,
+                    enum MHD_ValueKind kind,
+                    const char *key,
+                    const char *filename,
+                    const char *content_type,
+                    const char *transfer_encoding,
+                    const char *data, uint64_t off, size_t size)
+{
+  struct ValueCheck *vc = cls;
+  unsigned int idx;
+
+  if (0 == strcmp (key, "a"))
+    {
+      idx = 0;
+      vc->calls++;
+    }
+  else if (0 == strcmp (key, "b c"))
+    idx = 1;
+  else
+    return MHD_NO;
+  if ( (off != vc->received[idx]) ||
+       (off + size > VALUE_SIZE) )
+    return MHD_NO;
+  memcpy (&vc->value[idx][off], data, size);
+  vc->received[idx] += size;
+  return MHD_YES;
+}
+
+
+/**
+ * Post a long plain value and a long value with escapes, in random
+ * pieces.
+ */
+static int
+test_urlencoded_large ()
+{
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  static struct ValueCheck vc;
+  static char expected[VALUE_SIZE];
+  static char data[4 * VALUE_SIZE];
+  size_t size;
+  size_t i;
+  size_t delta;
+  unsigned int round;
+
+  size = 0;
+  memcpy (data, "a=", 2);
+  size += 2;
+  for (i = 0; i < VALUE_SIZE; i++)
+    data[size++] = 'a' + (char) (i % 26);
+  memcpy (&data[size], "&b+c=", 5);
+  size += 5;
+  for (i = 0; i < VALUE_SIZE; i++)
+    {
+      expected[i] = (char) (' ' + i % 90);
+      if (' ' == expected[i])
+        data[size++] = '+';
+      else if ( ('%' == expected[i]) ||
+                ('&' == expected[i]) ||
+                ('+' == expected[i]) ||
+                (0 == i % 7) )
+        size += sprintf (&data[size], "%%%02X", (unsigned int) expected[i]);
+      else
+        data[size++] = expected[i];
+    }
+  memset (&connection, 0, sizeof (struct MHD_Connection));
+  memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+  connection.headers_received = &header;
+  header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+  header.value = MHD_HTTP_POST_ENCODING_FORM_URLENCODED;
+  header.kind = MHD_HEADER_KIND;
+  for (round = 0; round < 20; round++)
+    {
+      memset (&vc, 0, sizeof (vc));
+      pp = MHD_create_post_processor (&connection, 1024, &urlencoded_checker, &vc);
+      i = 0;
+      while (i < size)
+        {
+          /* the first round passes everything at once */
+          delta = (0 == round) ? size : 1 + MHD_random_ () % 5000;
+          if (delta > size - i)
+            delta = size - i;
+          if (MHD_YES != MHD_post_process (pp, &data[i], delta))
+            {
+              MHD_destroy_post_processor (pp);
+              return 32;
+            }
+          i += delta;
+        }
+      MHD_destroy_post_processor (pp);
+      if ( (VALUE_SIZE != vc.received[0]) ||
+           (VALUE_SIZE != vc.received[1]) ||
+           (0 != memcmp (vc.value[1], expected, VALUE_SIZE)) )
+        return 64;
+      for (i = 0; i < VALUE_SIZE; i++)
+        if (vc.value[0][i] != 'a' + (char) (i % 26))
+          return 64;
+      /* a value without escapes is passed on in one piece */
+      if ( (0 == round) &&
+           (1 != vc.calls) )
+        return 128;
+    }
+  return 0;
+}
+
+
+/**
+ * Size of the file uploaded by #test_multipart_large().
+ */
+#define FILE_SIZE 102400
+
+struct FileCheck
+{
+  /**
+   * Reassembled file.
+   */
+  char file[FILE_SIZE];
+
+  /**
+   * Number of bytes of the file received.
+   */
+  size_t received;
+
+  /**
+   * Size of the largest piece of the file passed to the iterator.
+   */
+  size_t max_piece;
+
+  /**
+   * Value of the "name" field.
+   */
+  char name[16];
+};
+
+
+static int
+file_checker (void *cls,
+              enum MHD_ValueKind kind,
+              const char *key,
+              const char *filename,
+              const char *content_type,
+              const char *transfer_encoding,
+              const char *data, uint64_t off, size_t size)
+{
+  struct FileCheck *fc = cls;
+
+  if (0 == strcmp (key, "name"))
+    {
+      if (off + size >= sizeof (fc->name))
+        return MHD_NO;
+      memcpy (&fc->name[off], data, size);
+      return MHD_YES;
+    }
+  if ( (0 != strcmp (key, "file")) ||
+       (NULL == filename) ||
+       (0 != strcmp (filename, "f.bin")) ||
+       (off + size > FILE_SIZE) )
+    return MHD_NO;
+  memcpy (&fc->file[off], data, size);
+  fc->received += size;
+  if (size > fc->max_piece)
+    fc->max_piece = size;
+  return MHD_YES;
+}
+
+
+/**
+ * Upload a file that contains things that look like the beginning
+ * of the boundary, in random pieces.
+ *
+ * @param boundary boundary to use
+ */
+static int
+test_multipart_large (const char *boundary)
+{
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  static struct FileCheck fc;
+  static char file[FILE_SIZE];
+  static char data[FILE_SIZE + 2048];
+  char ctype[512];
+  char delim[512];
+  size_t blen;
+  size_t size;
+  size_t i;
+  size_t delta;
+  unsigned int round;
+
+  blen = strlen (boundary);
+  snprintf (delim, sizeof (delim), "\r\n--%s", boundary);
+  for (i = 0; i < FILE_SIZE; i++)
+    file[i] = 'a' + (char) (i % 23);
+  /* almost delimiters, one of them at the end of the file */
+  memcpy (&file[1000], delim, 4);
+  memcpy (&file[5000], delim, blen + 3);
+  memcpy (&file[FILE_SIZE - 8], delim, 8);
+  size = snprintf (data,
+                   sizeof (data),
+                   "--%s\r\n"
+                   "Content-Disposition: form-data; name=\"name\"\r\n\r\n"
+                   "value\r\n"
+                   "--%s\r\n"
+                   "Content-Disposition: form-data; name=\"file\"; filename=\"f.bin\"\r\n"
+                   "Content-Type: application/octet-stream\r\n\r\n",
+                   boundary,
+                   boundary);
+  memcpy (&data[size], file, FILE_SIZE);
+  size += FILE_SIZE;
+  size += snprintf (&data[size],
+                    sizeof (data) - size,
+                    "%s--\r\n",
+                    delim);
+  snprintf (ctype,
+            sizeof (ctype),
+            "%s, boundary=%s",
+            MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA,
+            boundary);
+  memset (&connection, 0, sizeof (struct MHD_Connection));
+  memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+  connection.headers_received = &header;
+  header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+  header.value = ctype;
+  header.kind = MHD_HEADER_KIND;
+  for (round = 0; round < 20; round++)
+    {
+      memset (&fc, 0, sizeof (fc));
+      pp = MHD_create_post_processor (&connection, 1024, &file_checker, &fc);
+      if (NULL == pp)
+        return 1;
+      i = 0;
+      while (i < size)
+        {
+          /* the first round passes everything at once */
+          delta = (0 == round) ? size : 1 + MHD_random_ () % 20000;
+          if (delta > size - i)
+            delta = size - i;
+          if (MHD_YES != MHD_post_process (pp, &data[i], delta))
+            {
+              MHD_destroy_post_processor (pp);
+              return 2;
+            }
+          i += delta;
+        }
+      if (MHD_YES != MHD_destroy_post_processor (pp))
+        return 4;
+      if ( (FILE_SIZE != fc.received) ||
+           (0 != memcmp (fc.file, file, FILE_SIZE)) ||
+           (0 != strcmp (fc.name, "value")) )
+        return 8;
+      /* the file was not squeezed through the buffer of 1024 bytes */
+      if ( (0 == round) &&
+           (fc.max_piece <= 1024) )
+        return 16;
+    }
+  return 0;
+}
+
+
+struct SpoolCheck
+{
+  /**
+   * Expected content of the file.
+   */
+  const char *file;
+
+  /**
+   * Number of files passed to #spool_checker().
+   */
+  unsigned int files;
+
+  /**
+   * Set to 1 if a file was not as expected.
+   */
+  int bad;
+};
+
+
+static int
+spool_checker (void *cls,
+               const char *key,
+               const char *filename,
+               const char *content_type,
+               const char *transfer_encoding,
+               const char *path,
+               uint64_t size)
+{
+  struct SpoolCheck *sc = cls;
+  static char buf[FILE_SIZE + 1];
+  FILE *f;
+
+  sc->files++;
+  if ( (0 != strcmp (key, "file")) ||
+       (0 != strcmp (filename, "f.bin")) ||
+       (0 != strcmp (content_type, "application/octet-stream")) ||
+       (FILE_SIZE != size) ||
+       (NULL == (f = fopen (path, "rb"))) )
+    {
+      sc->bad = 1;
+      return MHD_NO;
+    }
+  if ( (FILE_SIZE != fread (buf, 1, sizeof (buf), f)) ||
+       (0 != memcmp (buf, sc->file, FILE_SIZE)) )
+    sc->bad = 1;
+  fclose (f);
+  unlink (path);
+  return MHD_YES;
+}
+
+
+/**
+ * Access handler of the daemon of #test_multipart_spool(), which
+ * never gets a request.
+ */
+static int
+ahc_none (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  return MHD_NO;
+}
+
+
+/**
+ * Upload a file in random pieces and have the post processor write
+ * it to a temporary file (every other round without waiting for the
+ * thread); then stop an upload in the middle of the file, which must
+ * remove the file.
+ *
+ * @param flags how to write the file
+ */
+static int
+test_multipart_spool (enum MHD_PostSpoolFlags flags)
+{
+  struct MHD_Daemon *daemon;
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  static struct FileCheck fc;
+  static char file[FILE_SIZE];
+  static char data[FILE_SIZE + 2048];
+  struct SpoolCheck sc;
+  char dir[] = "/tmp/mhd-spool-XXXXXX";
+  size_t size;
+  size_t i;
+  size_t delta;
+  size_t left;
+  unsigned int round;
+
+  if (NULL == mkdtemp (dir))
+    return 1;
+  for (i = 0; i < FILE_SIZE; i++)
+    file[i] = (char) (i * 7 % 251);
+  size = snprintf (data,
+                   sizeof (data),
+                   "--AaB03x\r\n"
+                   "Content-Disposition: form-data; name=\"name\"\r\n\r\n"
+                   "value\r\n"
+                   "--AaB03x\r\n"
+                   "Content-Disposition: form-data; name=\"file\"; filename=\"f.bin\"\r\n"
+                   "Content-Type: application/octet-stream\r\n\r\n");
+  memcpy (&data[size], file, FILE_SIZE);
+  size += FILE_SIZE;
+  size += snprintf (&data[size],
+                    sizeof (data) - size,
+                    "\r\n--AaB03x--\r\n");
+  /* the writer thread belongs to the daemon */
+  daemon = MHD_start_daemon (MHD_USE_NO_LISTEN_SOCKET,
+                             0, NULL, NULL, &ahc_none, NULL,
+                             MHD_OPTION_END);
+  if (NULL == daemon)
+    return 1;
+  memset (&connection, 0, sizeof (struct MHD_Connection));
+  memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+  connection.daemon = daemon;
+  connection.headers_received = &header;
+  header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+  header.value = MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA ", boundary=AaB03x";
+  header.kind = MHD_HEADER_KIND;
+  for (round = 0; round < 10; round++)
+    {
+      memset (&fc, 0, sizeof (fc));
+      memset (&sc, 0, sizeof (sc));
+      sc.file = file;
+      pp = MHD_create_post_processor (&connection, 1024, &file_checker, &fc);
+      if (NULL == pp)
+        return 1;
+      if (MHD_YES != MHD_post_processor_spool_files (pp,
+                                                     dir,
+                                                     10000,
+                                                     flags,
+                                                     &spool_checker,
+                                                     &sc))
+        {
+          MHD_destroy_post_processor (pp);
+          return 1;
+        }
+      i = 0;
+      while (i < size)
+        {
+          delta = (0 == round) ? size : 1 + MHD_random_ () % 20000;
+          if (delta > size - i)
+            delta = size - i;
+          left = 0;
+          if (0 != (round & 1))
+            {
+              /* what is left is passed again with the next piece */
+              left = delta;
+              if (MHD_YES != MHD_post_process_partial (pp, &data[i], &left))
+                {
+                  MHD_destroy_post_processor (pp);
+                  return 2;
+                }
+            }
+          else if (MHD_YES != MHD_post_process (pp, &data[i], delta))
+            {
+              MHD_destroy_post_processor (pp);
+              return 2;
+            }
+          i += delta - left;
+        }
+      if (MHD_YES != MHD_destroy_post_processor (pp))
+        return 4;
+      /* the file did not go to the iterator, but the other field did */
+      if ( (1 != sc.files) ||
+           (0 != sc.bad) ||
+           (0 != fc.received) ||
+           (0 != strcmp (fc.name, "value")) )
+        return 8;
+    }
+  memset (&sc, 0, sizeof (sc));
+  pp = MHD_create_post_processor (&connection, 1024, &file_checker, &fc);
+  if ( (NULL == pp) ||
+       (MHD_YES != MHD_post_processor_spool_files (pp,
+                                                   dir,
+                                                   0,
+                                                   flags,
+                                                   &spool_checker,
+                                                   &sc)) )
+    return 1;
+  MHD_post_process (pp, data, size / 2);
+  if ( (MHD_NO != MHD_destroy_post_processor (pp)) ||
+       (0 != sc.files) )
+    return 16;
+  MHD_stop_daemon (daemon);
+  /* fails unless the incomplete file was removed */
+  if (0 != rmdir (dir))
+    return 16;
+  return 0;
+}
+
+
 int
 main (int argc, char *const *argv)
 {
   unsigned int errorCount = 0;
+  char boundary[301];
+  unsigned int i;
 
   errorCount += test_simple_large ();
+  errorCount += test_urlencoded_large ();
+  errorCount += test_multipart_large ("----XyZ123");
+  /* longer than the largest shift of the boundary search */
+  for (i = 0; i < sizeof (boundary) - 1; i++)
+    boundary[i] = 'A' + (char) (i % 26);
+  boundary[sizeof (boundary) - 1] = '\0';
+  errorCount += test_multipart_large (boundary);
+  errorCount += test_multipart_spool (MHD_POST_SPOOL_NONE);
+  errorCount += test_multipart_spool (MHD_POST_SPOOL_THREAD);
   if (errorCount != 0)
     fprintf (stderr, "Error (code: %u)\n", errorCount);
   return errorCount != 0;       /* 0 == pass */
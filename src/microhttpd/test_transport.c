@@ -0,0 +1,372 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file microhttpd/test_transport.c
+ * @brief  Testcase for connections added with
+ *         #MHD_add_connection_with_transport(), using a
+ *         transport that passes the data in memory
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include "microhttpd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#define BODY "Hello via transport"
+
+#define FILE_BODY "Contents of the file, sent from the file"
+
+
+/**
+ * A transport passing the data of a single connection in memory.
+ * The socket pair only signals readiness to the event loop.
+ */
+struct Loopback
+{
+  /**
+   * Data from the client.
+   */
+  char in[1024];
+
+  /**
+   * Data for the client.
+   */
+  char out[4096];
+
+  /**
+   * Number of bytes in @e in.
+   */
+  size_t in_len;
+
+  /**
+   * Number of bytes of @e in received by MHD.
+   */
+  size_t in_off;
+
+  /**
+   * Number of bytes in @e out.
+   */
+  size_t out_len;
+
+  /**
+   * Readiness descriptor given to MHD, and the other end of it.
+   */
+  MHD_socket ready[2];
+
+  /**
+   * How often the sendfile function was called.
+   */
+  unsigned int sendfile_calls;
+
+  /**
+   * Was the connection shut down?
+   */
+  int shut;
+
+  /**
+   * Was the connection closed?
+   */
+  int closed;
+};
+
+
+static ssize_t
+loop_recv (void *cls,
+           void *buf,
+           size_t size)
+{
+  struct Loopback *lb = cls;
+  char drain[16];
+
+  /* the data was announced with a byte on the socket pair */
+  while (0 < recv (lb->ready[0], drain, sizeof (drain), MSG_DONTWAIT))
+    ;
+  if (lb->in_off == lb->in_len)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+  if (size > lb->in_len - lb->in_off)
+    size = lb->in_len - lb->in_off;
+  memcpy (buf, &lb->in[lb->in_off], size);
+  lb->in_off += size;
+  return size;
+}
+
+
+static ssize_t
+loop_send (void *cls,
+           const void *buf,
+           size_t size)
+{
+  struct Loopback *lb = cls;
+
+  if (size > sizeof (lb->out) - lb->out_len)
+    size = sizeof (lb->out) - lb->out_len;
+  if (0 == size)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+  memcpy (&lb->out[lb->out_len], buf, size);
+  lb->out_len += size;
+  return size;
+}
+
+
+static ssize_t
+loop_sendfile (void *cls,
+               int fd,
+               uint64_t offset,
+               size_t size)
+{
+  struct Loopback *lb = cls;
+  ssize_t ret;
+
+  lb->sendfile_calls++;
+  if (size > sizeof (lb->out) - lb->out_len)
+    size = sizeof (lb->out) - lb->out_len;
+  if ((off_t) offset != lseek (fd, (off_t) offset, SEEK_SET))
+    return -1;
+  ret = read (fd, &lb->out[lb->out_len], size);
+  if (0 < ret)
+    lb->out_len += ret;
+  return ret;
+}
+
+
+static void
+loop_shutdown (void *cls,
+               enum MHD_TransportShutdown how)
+{
+  struct Loopback *lb = cls;
+
+  lb->shut = MHD_YES;
+}
+
+
+static void
+loop_close (void *cls)
+{
+  struct Loopback *lb = cls;
+
+  lb->closed = MHD_YES;
+  (void) close (lb->ready[0]);
+}
+
+
+/**
+ * File with #FILE_BODY.
+ */
+static int file_fd;
+
+
+static int
+ahc (void *cls,
+     struct MHD_Connection *connection,
+     const char *url,
+     const char *method,
+     const char *version,
+     const char *upload_data,
+     size_t *upload_data_size,
+     void **ptr)
+{
+  static int aptr;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&aptr != *ptr)
+    {
+      *ptr = &aptr;
+      return MHD_YES;
+    }
+  *ptr = NULL;
+  if (0 == strcmp (url, "/file"))
+    response = MHD_create_response_from_fd (strlen (FILE_BODY),
+                                            dup (file_fd));
+  else
+    response = MHD_create_response_from_buffer (strlen (BODY),
+                                                BODY,
+                                                MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Request @a url over a loopback transport from a daemon with
+ * an external event loop.
+ *
+ * @param flags event loop to use
+ * @param url URL to request
+ * @param body expected body
+ * @param with_sendfile #MHD_YES to give the transport a sendfile function
+ * @return 0 on success
+ */
+static int
+test_transport (unsigned int flags,
+                const char *url,
+                const char *body,
+                int with_sendfile)
+{
+  struct MHD_Daemon *d;
+  struct Loopback lb;
+  struct MHD_Transport transport;
+  struct sockaddr_in sa;
+  const char *hdr_end;
+  unsigned int i;
+  int ret;
+
+  memset (&lb, 0, sizeof (lb));
+  if (0 != socketpair (AF_UNIX, SOCK_STREAM, 0, lb.ready))
+    return 1;
+  lb.in_len = snprintf (lb.in, sizeof (lb.in),
+                        "GET %s HTTP/1.1\r\nHost: localhost\r\n"
+                        "Connection: close\r\n\r\n",
+                        url);
+  if (1 != send (lb.ready[1], "r", 1, 0))
+    return 1;
+  memset (&transport, 0, sizeof (transport));
+  transport.recv = &loop_recv;
+  transport.send = &loop_send;
+  if (MHD_YES == with_sendfile)
+    transport.sendfile = &loop_sendfile;
+  transport.shutdown = &loop_shutdown;
+  transport.close = &loop_close;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        0,
+                        NULL, NULL, &ahc, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 1;
+  if (MHD_YES != MHD_add_connection_with_transport (d,
+                                                    lb.ready[0],
+                                                    (struct sockaddr *) &sa,
+                                                    sizeof (sa),
+                                                    &transport,
+                                                    &lb))
+    {
+      fprintf (stderr, "Failed to add connection\n");
+      goto cleanup;
+    }
+  for (i = 0; (i < 1000) && (MHD_NO == lb.closed); i++)
+    MHD_run (d);
+  if (MHD_NO == lb.closed)
+    {
+      fprintf (stderr, "Connection for `%s' was not closed\n", url);
+      goto cleanup;
+    }
+  lb.out[lb.out_len < sizeof (lb.out) ? lb.out_len : sizeof (lb.out) - 1] = '\0';
+  hdr_end = strstr (lb.out, "\r\n\r\n");
+  if ( (NULL == hdr_end) ||
+       (0 != strncmp ("HTTP/1.1 200", lb.out, strlen ("HTTP/1.1 200"))) ||
+       (0 != strcmp (hdr_end + 4, body)) )
+    {
+      fprintf (stderr, "Unexpected response for `%s': `%s'\n", url, lb.out);
+      goto cleanup;
+    }
+  if (MHD_YES != lb.shut)
+    {
+      fprintf (stderr, "Transport was not shut down\n");
+      goto cleanup;
+    }
+  if ( (MHD_YES == with_sendfile) &&
+       (0 == strcmp (url, "/file")) &&
+       (0 == lb.sendfile_calls) )
+    {
+      fprintf (stderr, "Sendfile function of the transport was not used\n");
+      goto cleanup;
+    }
+  if ( (MHD_NO == with_sendfile) &&
+       (0 != lb.sendfile_calls) )
+    goto cleanup;
+  ret = 0;
+ cleanup:
+  MHD_stop_daemon (d);
+  if (MHD_NO == lb.closed)
+    (void) close (lb.ready[0]);
+  (void) close (lb.ready[1]);
+  return ret;
+}
+
+
+/**
+ * Run all requests with the given event loop.
+ *
+ * @param flags event loop to use
+ * @return number of failures
+ */
+static unsigned int
+test_event_loop (unsigned int flags)
+{
+  unsigned int errors = 0;
+
+  errors += test_transport (flags, "/", BODY, MHD_NO);
+  errors += test_transport (flags, "/file", FILE_BODY, MHD_YES);
+  errors += test_transport (flags, "/file", FILE_BODY, MHD_NO);
+  return errors;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  char name[] = "/tmp/test_transport_XXXXXX";
+  unsigned int errorCount = 0;
+
+  file_fd = mkstemp (name);
+  if (-1 == file_fd)
+    return 99;
+  (void) unlink (name);
+  if (strlen (FILE_BODY) != (size_t) write (file_fd,
+                                            FILE_BODY,
+                                            strlen (FILE_BODY)))
+    return 99;
+  errorCount += test_event_loop (0);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += test_event_loop (MHD_USE_POLL);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_event_loop (MHD_USE_EPOLL_LINUX_ONLY);
+  (void) close (file_fd);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,332 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file microhttpd/test_upgrade.c
+ * @brief  Testcase for handing connections over to another protocol
+ *         with #MHD_create_response_for_upgrade()
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include "microhttpd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+/**
+ * Data sent by the client together with the request, i.e. before
+ * it saw the response.
+ */
+#define EARLY "Hello"
+
+/**
+ * Data sent by the client after it saw the upgrade response.
+ */
+#define LATE "World"
+
+/**
+ * State of the (single) upgraded connection.
+ */
+struct Upgraded
+{
+  pthread_t thread;
+  MHD_socket sock;
+  char buf[64];
+  size_t off;
+  MHD_UpgradeActionCallback action;
+  void *action_cls;
+};
+
+static struct Upgraded upgraded;
+
+static volatile int done;
+
+static volatile int echoed;
+
+
+/**
+ * Wait until @a sock is ready for reading or writing.
+ */
+static int
+wait_for (MHD_socket sock,
+          int for_write)
+{
+  fd_set fds;
+  struct timeval tv;
+
+  FD_ZERO (&fds);
+  FD_SET (sock, &fds);
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  if (for_write)
+    return select (sock + 1, NULL, &fds, NULL, &tv);
+  return select (sock + 1, &fds, NULL, NULL, &tv);
+}
+
+
+/**
+ * Echo the client's data back over the upgraded socket and then
+ * tell MHD that we are done with the connection.
+ */
+static void *
+run_echo (void *cls)
+{
+  struct Upgraded *up = cls;
+  size_t want = strlen (EARLY LATE);
+  size_t sent;
+  ssize_t r;
+
+  while (up->off < want)
+    {
+      if (0 >= wait_for (up->sock, 0))
+        break;
+      r = recv (up->sock, &up->buf[up->off], want - up->off, 0);
+      if (0 >= r)
+        break;
+      up->off += r;
+    }
+  sent = 0;
+  while (sent < up->off)
+    {
+      if (0 >= wait_for (up->sock, 1))
+        break;
+      r = send (up->sock, &up->buf[sent], up->off - sent, 0);
+      if (0 >= r)
+        break;
+      sent += r;
+    }
+  if (sent == want)
+    echoed = 1;
+  up->action (up->action_cls, MHD_UPGRADE_ACTION_CLOSE);
+  return NULL;
+}
+
+
+static void
+upgrade_cb (void *cls,
+            struct MHD_Connection *connection,
+            void *con_cls,
+            const char *extra_in,
+            size_t extra_in_size,
+            MHD_socket sock,
+            MHD_UpgradeActionCallback upgrade_action,
+            void *upgrade_action_cls)
+{
+  struct Upgraded *up = cls;
+
+  up->sock = sock;
+  up->off = 0;
+  if (extra_in_size > sizeof (up->buf))
+    extra_in_size = sizeof (up->buf);
+  memcpy (up->buf, extra_in, extra_in_size);
+  up->off = extra_in_size;
+  up->action = upgrade_action;
+  up->action_cls = upgrade_action_cls;
+  if (0 != pthread_create (&up->thread, NULL, &run_echo, up))
+    abort ();
+}
+
+
+static void
+completed_cb (void *cls,
+              struct MHD_Connection *connection,
+              void **con_cls,
+              enum MHD_RequestTerminationCode toe)
+{
+  if (MHD_REQUEST_TERMINATED_COMPLETED_OK == toe)
+    done = 1;
+  else
+    done = 2;
+}
+
+
+static int
+ahc_upgrade (void *cls,
+             struct MHD_Connection *connection,
+             const char *url,
+             const char *method,
+             const char *version,
+             const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  response = MHD_create_response_for_upgrade (&upgrade_cb, &upgraded);
+  if (NULL == response)
+    return MHD_NO;
+  MHD_add_response_header (response,
+                           MHD_HTTP_HEADER_UPGRADE,
+                           "foo");
+  MHD_add_response_header (response,
+                           MHD_HTTP_HEADER_CONNECTION,
+                           "Upgrade");
+  /* only 101 may hand over the connection */
+  if (MHD_NO != MHD_queue_response (connection, MHD_HTTP_OK, response))
+    {
+      MHD_destroy_response (response);
+      return MHD_NO;
+    }
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_SWITCHING_PROTOCOLS,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Connect to the daemon, request the upgrade and check that our
+ * data is echoed back over the upgraded connection.
+ */
+static int
+run_client ()
+{
+  static const char request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "Connection: Upgrade\r\n"
+    "Upgrade: foo\r\n"
+    "\r\n"
+    EARLY;
+  struct sockaddr_in sa;
+  char buf[1024];
+  size_t off;
+  const char *body;
+  ssize_t r;
+  MHD_socket sock;
+  int ret = 0;
+  int late_sent = 0;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    return 4;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (1080);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) ||
+       (sizeof (request) - 1 != send (sock, request, sizeof (request) - 1, 0)) )
+    {
+      close (sock);
+      return 8;
+    }
+  off = 0;
+  body = NULL;
+  while (off < sizeof (buf) - 1)
+    {
+      if (0 >= wait_for (sock, 0))
+        break;
+      r = recv (sock, &buf[off], sizeof (buf) - 1 - off, 0);
+      if (0 >= r)
+        break;
+      off += r;
+      buf[off] = '\0';
+      if (NULL == body)
+        {
+          body = strstr (buf, "\r\n\r\n");
+          if (NULL == body)
+            continue;
+          body += 4;
+        }
+      if (! late_sent)
+        {
+          if (strlen (LATE) != send (sock, LATE, strlen (LATE), 0))
+            break;
+          late_sent = 1;
+        }
+      if (strlen (body) >= strlen (EARLY LATE))
+        break;
+    }
+  buf[off] = '\0';
+  if (0 != strncmp (buf, "HTTP/1.1 101", strlen ("HTTP/1.1 101")))
+    {
+      fprintf (stderr, "Unexpected response `%s'\n", buf);
+      ret |= 16;
+    }
+  if ( (NULL == body) ||
+       (0 != strcmp (body, EARLY LATE)) )
+    {
+      fprintf (stderr, "Unexpected echo `%s'\n", (NULL == body) ? "" : body);
+      ret |= 32;
+    }
+  /* MHD must close the connection once the application is done */
+  if ( (0 >= wait_for (sock, 0)) ||
+       (0 != recv (sock, buf, sizeof (buf), 0)) )
+    ret |= 64;
+  close (sock);
+  return ret;
+}
+
+
+static int
+testUpgrade (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  unsigned int i;
+  int ret;
+
+  done = 0;
+  echoed = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        1080, NULL, NULL,
+                        &ahc_upgrade, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &completed_cb, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = run_client ();
+  for (i = 0; (0 == done) && (i < 500); i++)
+    usleep (10000);
+  if (1 != done)
+    ret |= 128;
+  if (! echoed)
+    ret |= 256;
+  if (0 != pthread_join (upgraded.thread, NULL))
+    ret |= 512;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_UPGRADE))
+    return 77;
+  errorCount += testUpgrade (MHD_USE_SELECT_INTERNALLY | MHD_ALLOW_UPGRADE);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += testUpgrade (MHD_USE_POLL_INTERNALLY | MHD_ALLOW_UPGRADE);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
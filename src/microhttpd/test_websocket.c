@@ -0,0 +1,463 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file microhttpd/test_websocket.c
+ * @brief  Testcase for WebSockets created with
+ *         #MHD_create_response_for_websocket()
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include "microhttpd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+/**
+ * Key from the example in RFC 6455, section 1.3.
+ */
+#define KEY "dGhlIHNhbXBsZSBub25jZQ=="
+
+/**
+ * Accept value for #KEY.
+ */
+#define ACCEPT "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+
+/**
+ * Number of clients for the broadcast test.
+ */
+#define CLIENTS 2
+
+static struct MHD_WebSocket *sockets[CLIENTS];
+
+static volatile unsigned int opened;
+
+static volatile unsigned int closed;
+
+static volatile unsigned int close_status;
+
+
+static void
+open_cb (void *cls,
+         struct MHD_WebSocket *ws,
+         void *con_cls)
+{
+  if (opened < CLIENTS)
+    sockets[opened] = ws;
+  opened++;
+}
+
+
+/**
+ * Echo each message, or broadcast it to all clients if it
+ * starts with "all:".
+ */
+static void
+message_cb (void *cls,
+            struct MHD_WebSocket *ws,
+            enum MHD_WebSocketOpcode opcode,
+            const char *data,
+            size_t size)
+{
+  if ( (size >= 4) &&
+       (0 == memcmp (data, "all:", 4)) )
+    {
+      if (CLIENTS != MHD_websocket_broadcast (sockets,
+                                              CLIENTS,
+                                              opcode,
+                                              data,
+                                              size))
+        abort ();
+      return;
+    }
+  if (MHD_YES != MHD_websocket_send (ws, opcode, data, size))
+    abort ();
+}
+
+
+static void
+close_cb (void *cls,
+          struct MHD_WebSocket *ws,
+          unsigned short status)
+{
+  close_status = status;
+  closed++;
+}
+
+
+static int
+ahc_websocket (void *cls,
+               struct MHD_Connection *connection,
+               const char *url,
+               const char *method,
+               const char *version,
+               const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  response = MHD_create_response_for_websocket (connection,
+                                                NULL,
+                                                &open_cb,
+                                                &message_cb,
+                                                &close_cb,
+                                                NULL);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_SWITCHING_PROTOCOLS,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Wait until @a sock is readable.
+ */
+static int
+wait_readable (MHD_socket sock)
+{
+  fd_set fds;
+  struct timeval tv;
+
+  FD_ZERO (&fds);
+  FD_SET (sock, &fds);
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  return select (sock + 1, &fds, NULL, NULL, &tv);
+}
+
+
+/**
+ * Receive exactly @a size bytes.
+ */
+static int
+recv_all (MHD_socket sock,
+          char *buf,
+          size_t size)
+{
+  size_t off = 0;
+  ssize_t r;
+
+  while (off < size)
+    {
+      if (0 >= wait_readable (sock))
+        return -1;
+      r = recv (sock, &buf[off], size - off, 0);
+      if (0 >= r)
+        return -1;
+      off += r;
+    }
+  return 0;
+}
+
+
+/**
+ * Send a masked frame from the client.
+ */
+static int
+send_frame (MHD_socket sock,
+            int fin,
+            unsigned int opcode,
+            const char *data,
+            size_t size)
+{
+  static const char mask[4] = { 0x37, (char) 0xfa, 0x21, 0x3d };
+  static char buf[16 * 1024 + 8];
+  size_t hsize;
+  size_t i;
+
+  if (size > sizeof (buf) - 8)
+    return -1;
+  buf[0] = (char) ((fin ? 0x80 : 0) | opcode);
+  if (size < 126)
+    {
+      buf[1] = (char) (0x80 | size);
+      hsize = 2;
+    }
+  else
+    {
+      buf[1] = (char) (0x80 | 126);
+      buf[2] = (char) (size >> 8);
+      buf[3] = (char) size;
+      hsize = 4;
+    }
+  memcpy (&buf[hsize], mask, 4);
+  hsize += 4;
+  for (i = 0; i < size; i++)
+    buf[hsize + i] = data[i] ^ mask[i & 3];
+  if ((ssize_t) (hsize + size) != send (sock, buf, hsize + size, 0))
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Receive a frame from the server and compare it with what we expect.
+ */
+static int
+expect_frame (MHD_socket sock,
+              unsigned int opcode,
+              const char *data,
+              size_t size)
+{
+  char hdr[4];
+  char buf[300];
+  size_t len;
+
+  if (0 != recv_all (sock, hdr, 2))
+    return -1;
+  if ( ((unsigned char) hdr[0] != (0x80 | opcode)) ||
+       (0 != (hdr[1] & 0x80)) )  /* frames from the server are not masked */
+    return -1;
+  len = hdr[1] & 0x7f;
+  if (126 == len)
+    {
+      if (0 != recv_all (sock, &hdr[2], 2))
+        return -1;
+      len = ((unsigned char) hdr[2] << 8) | (unsigned char) hdr[3];
+    }
+  if ( (len != size) ||
+       (len > sizeof (buf)) ||
+       (0 != recv_all (sock, buf, len)) ||
+       (0 != memcmp (buf, data, len)) )
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Connect and perform the handshake.
+ *
+ * @return the socket, #MHD_INVALID_SOCKET on error
+ */
+static MHD_socket
+handshake ()
+{
+  static const char request[] =
+    "GET /chat HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: keep-alive, Upgrade\r\n"
+    "Sec-WebSocket-Key: " KEY "\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+  struct sockaddr_in sa;
+  char buf[1024];
+  size_t off;
+  ssize_t r;
+  MHD_socket sock;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    return MHD_INVALID_SOCKET;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (1080);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) ||
+       (sizeof (request) - 1 != send (sock, request, sizeof (request) - 1, 0)) )
+    {
+      close (sock);
+      return MHD_INVALID_SOCKET;
+    }
+  /* read the response byte by byte to not consume any frame */
+  off = 0;
+  while (off < sizeof (buf) - 1)
+    {
+      if (0 >= wait_readable (sock))
+        break;
+      r = recv (sock, &buf[off], 1, 0);
+      if (1 != r)
+        break;
+      off++;
+      buf[off] = '\0';
+      if (NULL != strstr (buf, "\r\n\r\n"))
+        break;
+    }
+  buf[off] = '\0';
+  if ( (0 != strncmp (buf, "HTTP/1.1 101", strlen ("HTTP/1.1 101"))) ||
+       (NULL == strstr (buf, "Sec-WebSocket-Accept: " ACCEPT "\r\n")) )
+    {
+      fprintf (stderr, "Unexpected handshake response `%s'\n", buf);
+      close (sock);
+      return MHD_INVALID_SOCKET;
+    }
+  return sock;
+}
+
+
+static int
+testWebSocket (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock[CLIENTS];
+  char big[200];
+  char close_payload[2];
+  char *fragment;
+  unsigned int i;
+  int ret = 0;
+
+  opened = 0;
+  closed = 0;
+  close_status = 0;
+  d = MHD_start_daemon (flags | MHD_ALLOW_UPGRADE | MHD_USE_DEBUG,
+                        1080, NULL, NULL,
+                        &ahc_websocket, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  for (i = 0; i < CLIENTS; i++)
+    {
+      sock[i] = handshake ();
+      if (MHD_INVALID_SOCKET == sock[i])
+        {
+          MHD_stop_daemon (d);
+          return 2;
+        }
+    }
+  /* echo of a simple message and of one with a 16-bit length */
+  memset (big, 'x', sizeof (big));
+  if ( (0 != send_frame (sock[0], 1, 1, "Hello", 5)) ||
+       (0 != expect_frame (sock[0], 1, "Hello", 5)) ||
+       (0 != send_frame (sock[0], 1, 2, big, sizeof (big))) ||
+       (0 != expect_frame (sock[0], 2, big, sizeof (big))) )
+    ret |= 4;
+  /* fragmented message with a ping in the middle */
+  if ( (0 != send_frame (sock[0], 0, 1, "Hel", 3)) ||
+       (0 != send_frame (sock[0], 1, 9, "p", 1)) ||
+       (0 != send_frame (sock[0], 0, 0, "lo ", 3)) ||
+       (0 != send_frame (sock[0], 1, 0, "World", 5)) ||
+       (0 != expect_frame (sock[0], 10, "p", 1)) ||
+       (0 != expect_frame (sock[0], 1, "Hello World", 11)) )
+    ret |= 8;
+  /* broadcast */
+  if (0 != send_frame (sock[1], 1, 1, "all:hi", 6))
+    ret |= 16;
+  for (i = 0; i < CLIENTS; i++)
+    if (0 != expect_frame (sock[i], 1, "all:hi", 6))
+      ret |= 32;
+  /* closing handshake initiated by the client */
+  close_payload[0] = (char) (1000 >> 8);
+  close_payload[1] = (char) (1000 & 0xff);
+  if ( (0 != send_frame (sock[0], 1, 8, close_payload, 2)) ||
+       (0 != expect_frame (sock[0], 8, close_payload, 2)) )
+    ret |= 64;
+  /* MHD closes the connection after the handshake */
+  if ( (0 >= wait_readable (sock[0])) ||
+       (0 != recv (sock[0], big, sizeof (big), 0)) )
+    ret |= 128;
+  for (i = 0; (1 != closed) && (i < 500); i++)
+    usleep (10000);
+  if ( (1 != closed) ||
+       (1000 != close_status) )
+    ret |= 256;
+  /* a protocol violation (unmasked frame) fails the WebSocket */
+  big[0] = (char) 0x81;
+  big[1] = 0;
+  if ( (2 != send (sock[1], big, 2, 0)) ||
+       (0 != expect_frame (sock[1], 8, "\x03\xea", 2)) )
+    ret |= 512;
+  for (i = 0; (2 != closed) && (i < 500); i++)
+    usleep (10000);
+  if ( (2 != closed) ||
+       (MHD_WEBSOCKET_CLOSE_PROTOCOL_ERROR != close_status) )
+    ret |= 1024;
+  for (i = 0; i < CLIENTS; i++)
+    close (sock[i]);
+  /* invalid UTF-8 (an overlong encoding) split across fragments */
+  sock[0] = handshake ();
+  if ( (MHD_INVALID_SOCKET == sock[0]) ||
+       (0 != send_frame (sock[0], 0, 1, "Hi \xc0", 4)) ||
+       (0 != send_frame (sock[0], 1, 0, "\xaf", 1)) ||
+       (0 != expect_frame (sock[0], 8, "\x03\xef", 2)) )
+    ret |= 4096;
+  if (MHD_INVALID_SOCKET != sock[0])
+    close (sock[0]);
+  for (i = 0; (3 != closed) && (i < 500); i++)
+    usleep (10000);
+  if ( (3 != closed) ||
+       (MHD_WEBSOCKET_CLOSE_INVALID_DATA != close_status) )
+    ret |= 8192;
+  /* a close status that must not be sent */
+  close_payload[0] = (char) (MHD_WEBSOCKET_CLOSE_NO_STATUS >> 8);
+  close_payload[1] = (char) (MHD_WEBSOCKET_CLOSE_NO_STATUS & 0xff);
+  sock[0] = handshake ();
+  if ( (MHD_INVALID_SOCKET == sock[0]) ||
+       (0 != send_frame (sock[0], 1, 8, close_payload, 2)) ||
+       (0 != expect_frame (sock[0], 8, "\x03\xea", 2)) )
+    ret |= 16384;
+  if (MHD_INVALID_SOCKET != sock[0])
+    close (sock[0]);
+  /* a fragment that fills the read buffer up to the header of a
+     continuation with a 64-bit length that has the top bit set */
+  fragment = malloc (16372);
+  if (NULL == fragment)
+    abort ();
+  memset (fragment, 'x', 16372);
+  big[0] = 0x00;
+  big[1] = (char) (0x80 | 127);
+  memset (&big[2], 0xff, 7);
+  big[9] = (char) 0xfe;
+  big[10] = 0x37;
+  big[11] = (char) 0xfa;
+  sock[0] = handshake ();
+  if ( (MHD_INVALID_SOCKET == sock[0]) ||
+       (0 != send_frame (sock[0], 0, 1, fragment, 16372)) ||
+       (12 != send (sock[0], big, 12, 0)) ||
+       (0 != expect_frame (sock[0], 8, "\x03\xea", 2)) )
+    ret |= 32768;
+  if (MHD_INVALID_SOCKET != sock[0])
+    close (sock[0]);
+  free (fragment);
+  MHD_stop_daemon (d);
+  if (CLIENTS + 3 != opened)
+    ret |= 2048;
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_WEBSOCKET))
+    return 77;
+  errorCount += testWebSocket (MHD_USE_SELECT_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += testWebSocket (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += testWebSocket (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
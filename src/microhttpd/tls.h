@@ -0,0 +1,303 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file tls.h
+ * @brief  TLS backend used for HTTPS connections
+ * @author Christian Grothoff
+ *
+ * The rest of MHD only uses the functions declared here to work with
+ * TLS sessions.  They are implemented once for each TLS library MHD
+ * can be built with (see `--with-tls` of configure): with GnuTLS in
+ * tls_gnutls.c and with OpenSSL (or BoringSSL) in tls_openssl.c.
+ */
+
+#ifndef TLS_H
+#define TLS_H
+
+#include "internal.h"
+
+
+/**
+ * Value of `GNUTLS_CRD_CERTIFICATE`, the only credentials type
+ * supported for #MHD_OPTION_HTTPS_CRED_TYPE (with any backend).
+ */
+#define MHD_TLS_CRD_CERTIFICATE 1
+
+/**
+ * Largest number of bytes of plaintext in a TLS record.
+ */
+#define MHD_TLS_MAX_RECORD_SIZE 16384
+
+
+/**
+ * Results of the TLS functions that can block.
+ */
+enum MHD_TlsResult
+{
+
+  /**
+   * The operation completed.
+   */
+  MHD_TLS_DONE = 0,
+
+  /**
+   * The socket is not ready, try again later.
+   */
+  MHD_TLS_AGAIN = -1,
+
+  /**
+   * The operation failed, the session cannot be used any longer.
+   */
+  MHD_TLS_FAILED = -2
+
+};
+
+
+/**
+ * Initialize the TLS library.  Called once when MHD is loaded.
+ */
+void
+MHD_tls_global_init_ (void);
+
+
+/**
+ * Release the global resources of the TLS library.
+ */
+void
+MHD_tls_global_deinit_ (void);
+
+
+/**
+ * Set up the credentials and settings of an HTTPS daemon from its
+ * options.  The result is shared by all worker threads.
+ *
+ * @param daemon handle to daemon to initialize
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
+ */
+int
+MHD_tls_daemon_init_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Release what #MHD_tls_daemon_init_() set up.  Safe to call if
+ * the initialization failed or never happened.
+ *
+ * @param daemon handle to daemon to clean up
+ */
+void
+MHD_tls_daemon_deinit_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Create the TLS session of a new connection.
+ *
+ * @param connection the new connection
+ * @param pull function receiving encrypted data from the client
+ * @param push function sending encrypted data to the client
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_tls_connection_init_ (struct MHD_Connection *connection,
+                          ReceiveCallback pull,
+                          TransmitCallback push);
+
+
+/**
+ * Destroy the TLS session of a connection.
+ *
+ * @param connection connection to clean up, may have no session
+ */
+void
+MHD_tls_connection_deinit_ (struct MHD_Connection *connection);
+
+
+/**
+ * Continue the TLS handshake of a connection.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_DONE if the handshake completed,
+ *         #MHD_TLS_AGAIN if it is still running
+ */
+enum MHD_TlsResult
+MHD_tls_handshake_ (struct MHD_Connection *connection);
+
+
+/**
+ * Is the TLS session waiting to write (rather than to read) to
+ * make progress with the handshake?
+ *
+ * @param connection the connection
+ * @return #MHD_YES if the socket must become writable
+ */
+int
+MHD_tls_wants_write_ (struct MHD_Connection *connection);
+
+
+/**
+ * Receive and decrypt data.
+ *
+ * @param connection the connection
+ * @param buf where to store the data
+ * @param size number of bytes available in @a buf
+ * @return number of bytes received, 0 if the client closed the
+ *         session, or a (negative) #MHD_TlsResult
+ */
+ssize_t
+MHD_tls_recv_ (struct MHD_Connection *connection,
+               void *buf,
+               size_t size);
+
+
+/**
+ * Encrypt and send data, in at least one record.  While the session
+ * is corked, the data is only collected.
+ *
+ * @param connection the connection
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, or a (negative) #MHD_TlsResult
+ */
+ssize_t
+MHD_tls_send_ (struct MHD_Connection *connection,
+               const void *buf,
+               size_t size);
+
+
+/**
+ * Get the number of bytes that were decrypted already and are
+ * waiting to be received.
+ *
+ * @param connection the connection
+ * @return number of bytes waiting within TLS
+ */
+size_t
+MHD_tls_pending_ (struct MHD_Connection *connection);
+
+
+/**
+ * Get the largest number of bytes that fit into one record.
+ *
+ * @param connection the connection
+ * @return maximum size of the plaintext of a record
+ */
+size_t
+MHD_tls_max_record_size_ (struct MHD_Connection *connection);
+
+
+/**
+ * Cork the TLS session: data sent from now on is collected, until
+ * #MHD_tls_uncork_() sends it.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_cork_ (struct MHD_Connection *connection);
+
+
+/**
+ * Get the number of bytes collected while the session is corked.
+ *
+ * @param connection the connection
+ * @return number of bytes waiting for #MHD_tls_uncork_()
+ */
+size_t
+MHD_tls_corked_ (struct MHD_Connection *connection);
+
+
+/**
+ * Send the data collected while the session was corked.  Errors
+ * are logged.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_DONE once all of it was sent (the session is no
+ *         longer corked then), #MHD_TLS_AGAIN if the socket is not
+ *         ready for all of it, #MHD_TLS_FAILED on error
+ */
+enum MHD_TlsResult
+MHD_tls_uncork_ (struct MHD_Connection *connection);
+
+
+/**
+ * Tell the client that we are done with the TLS session (without
+ * waiting for its answer).
+ *
+ * @param connection the connection
+ * @param how whether we only stop sending or the session is closed
+ */
+void
+MHD_tls_bye_ (struct MHD_Connection *connection,
+              enum MHD_TransportShutdown how);
+
+
+/**
+ * Offer application protocols via ALPN during the handshake of a new
+ * session, in order of our preference.
+ *
+ * @param connection connection with the new session
+ * @param protocols the protocols, each prefixed by its length in
+ *        one byte (as on the wire); must stay valid for the
+ *        lifetime of the session
+ * @param size number of bytes in @a protocols
+ */
+void
+MHD_tls_set_alpn_ (struct MHD_Connection *connection,
+                   const char *protocols,
+                   size_t size);
+
+
+/**
+ * Get the application protocol selected via ALPN during the handshake.
+ *
+ * @param connection connection that completed the handshake
+ * @param[out] protocol set to the protocol (not 0-terminated)
+ * @param[out] size set to the number of bytes in @a protocol
+ * @return #MHD_YES if a protocol was selected
+ */
+int
+MHD_tls_get_alpn_ (struct MHD_Connection *connection,
+                   const char **protocol,
+                   size_t *size);
+
+
+/**
+ * Obtain information about the TLS session of a connection.
+ *
+ * @param connection the connection
+ * @param info_type one of the TLS related types
+ * @return NULL if the information is not available
+ */
+const union MHD_ConnectionInfo *
+MHD_tls_get_info_ (struct MHD_Connection *connection,
+                   enum MHD_ConnectionInfoType info_type);
+
+
+/**
+ * Fill a buffer with random bytes from the cryptographically secure
+ * generator of the TLS library, e.g. for secret keys.
+ *
+ * @param buf buffer to fill
+ * @param size number of bytes at @a buf
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_tls_random_ (void *buf,
+                 size_t size);
+
+#endif
@@ -0,0 +1,742 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2007-2016 Daniel Pittman and Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file tls_gnutls.c
+ * @brief  TLS backend using GnuTLS
+ * @author Daniel Pittman
+ * @author Christian Grothoff
+ */
+
+#include "internal.h"
+#include "tls.h"
+#include "tlscache.h"
+#include <gcrypt.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+
+
+#if GCRYPT_VERSION_NUMBER < 0x010600
+#if defined(MHD_USE_POSIX_THREADS)
+GCRY_THREAD_OPTION_PTHREAD_IMPL;
+#elif defined(MHD_W32_MUTEX_)
+
+static int
+gcry_w32_mutex_init (void **ppmtx)
+{
+  *ppmtx = malloc (sizeof (MHD_mutex_));
+
+  if (NULL == *ppmtx)
+    return ENOMEM;
+  if (MHD_YES != MHD_mutex_create_ ((MHD_mutex_*)*ppmtx))
+    {
+      free (*ppmtx);
+      *ppmtx = NULL;
+      return EPERM;
+    }
+
+  return 0;
+}
+
+
+static int
+gcry_w32_mutex_destroy (void **ppmtx)
+{
+  int res = (MHD_YES == MHD_mutex_destroy_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
+  free (*ppmtx);
+  return res;
+}
+
+
+static int
+gcry_w32_mutex_lock (void **ppmtx)
+{
+  return (MHD_YES == MHD_mutex_lock_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
+}
+
+
+static int
+gcry_w32_mutex_unlock (void **ppmtx)
+{
+  return (MHD_YES == MHD_mutex_unlock_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
+}
+
+
+static struct gcry_thread_cbs gcry_threads_w32 = {
+  (GCRY_THREAD_OPTION_USER | (GCRY_THREAD_OPTION_VERSION << 8)),
+  NULL, gcry_w32_mutex_init, gcry_w32_mutex_destroy,
+  gcry_w32_mutex_lock, gcry_w32_mutex_unlock,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+
+#endif /* defined(MHD_W32_MUTEX_) */
+#endif /* GCRYPT_VERSION_NUMBER < 0x010600 */
+
+
+/**
+ * Initialize the TLS library.  Called once when MHD is loaded.
+ */
+void
+MHD_tls_global_init_ (void)
+{
+#if GCRYPT_VERSION_NUMBER < 0x010600
+#if defined(MHD_USE_POSIX_THREADS)
+  if (0 != gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread))
+    MHD_PANIC ("Failed to initialise multithreading in libgcrypt\n");
+#elif defined(MHD_W32_MUTEX_)
+  if (0 != gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_w32))
+    MHD_PANIC ("Failed to initialise multithreading in libgcrypt\n");
+#endif /* defined(MHD_W32_MUTEX_) */
+  gcry_check_version (NULL);
+#else
+  if (NULL == gcry_check_version ("1.6.0"))
+    MHD_PANIC ("libgcrypt is too old. MHD was compiled for libgcrypt 1.6.0 or newer\n");
+#endif
+  gnutls_global_init ();
+}
+
+
+/**
+ * Release the global resources of the TLS library.
+ */
+void
+MHD_tls_global_deinit_ (void)
+{
+  gnutls_global_deinit ();
+}
+
+
+/**
+ * Fill a buffer with random bytes from the cryptographically secure
+ * generator of the TLS library, e.g. for secret keys.
+ *
+ * @param buf buffer to fill
+ * @param size number of bytes at @a buf
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_tls_random_ (void *buf,
+                 size_t size)
+{
+  return (0 == gnutls_rnd (GNUTLS_RND_RANDOM, buf, size)) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Read and setup our certificate and key.
+ *
+ * @param daemon handle to daemon to initialize
+ * @return 0 on success
+ */
+static int
+init_daemon_certificate (struct MHD_Daemon *daemon)
+{
+  gnutls_datum_t key;
+  gnutls_datum_t cert;
+  int ret;
+
+#if GNUTLS_VERSION_MAJOR >= 3
+  if (NULL != daemon->cert_callback)
+    {
+      gnutls_certificate_set_retrieve_function2 (daemon->x509_cred,
+                                                 daemon->cert_callback);
+    }
+#endif
+  if (NULL != daemon->https_mem_trust)
+    {
+      cert.data = (unsigned char *) daemon->https_mem_trust;
+      cert.size = strlen (daemon->https_mem_trust);
+      if (gnutls_certificate_set_x509_trust_mem (daemon->x509_cred, &cert,
+						 GNUTLS_X509_FMT_PEM) < 0)
+	{
+#ifdef HAVE_MESSAGES
+	  MHD_DLOG(daemon,
+		   "Bad trust certificate format\n");
+#endif
+	  return -1;
+	}
+    }
+
+  if (MHD_YES == daemon->have_dhparams)
+    {
+      gnutls_certificate_set_dh_params (daemon->x509_cred,
+                                        daemon->dh_params);
+    }
+  /* certificate & key loaded from memory */
+  if ( (NULL != daemon->https_mem_cert) &&
+       (NULL != daemon->https_mem_key) )
+    {
+      key.data = (unsigned char *) daemon->https_mem_key;
+      key.size = strlen (daemon->https_mem_key);
+      cert.data = (unsigned char *) daemon->https_mem_cert;
+      cert.size = strlen (daemon->https_mem_cert);
+
+      if (NULL != daemon->https_key_password) {
+#if GNUTLS_VERSION_NUMBER >= 0x030111
+        ret = gnutls_certificate_set_x509_key_mem2 (daemon->x509_cred,
+                                                    &cert, &key,
+                                                    GNUTLS_X509_FMT_PEM,
+                                                    daemon->https_key_password,
+                                                    0);
+#else
+#ifdef HAVE_MESSAGES
+	MHD_DLOG (daemon,
+                  "Failed to setup x509 certificate/key: pre 3.X.X version " \
+		  "of GnuTLS does not support setting key password");
+#endif
+	return -1;
+#endif
+      }
+      else
+        ret = gnutls_certificate_set_x509_key_mem (daemon->x509_cred,
+                                                   &cert, &key,
+                                                   GNUTLS_X509_FMT_PEM);
+#ifdef HAVE_MESSAGES
+      if (0 != ret)
+        MHD_DLOG (daemon,
+                  "GnuTLS failed to setup x509 certificate/key: %s\n",
+                  gnutls_strerror (ret));
+#endif
+      return ret;
+    }
+#if GNUTLS_VERSION_MAJOR >= 3
+  if (NULL != daemon->cert_callback)
+    return 0;
+#endif
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "You need to specify a certificate and key location\n");
+#endif
+  return -1;
+}
+
+
+/**
+ * Import the Diffie-Hellman parameters given with
+ * #MHD_OPTION_HTTPS_MEM_DHPARAMS.
+ *
+ * @param daemon handle to daemon to initialize
+ * @return 0 on success
+ */
+static int
+init_dh_params (struct MHD_Daemon *daemon)
+{
+  gnutls_datum_t dhpar;
+
+  if (gnutls_dh_params_init (&daemon->dh_params) < 0)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG(daemon,
+               "Error initializing DH parameters\n");
+#endif
+      return -1;
+    }
+  dhpar.data = (unsigned char *) daemon->https_mem_dhparams;
+  dhpar.size = strlen (daemon->https_mem_dhparams);
+  if (gnutls_dh_params_import_pkcs3 (daemon->dh_params, &dhpar,
+                                     GNUTLS_X509_FMT_PEM) < 0)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG(daemon,
+               "Bad Diffie-Hellman parameters format\n");
+#endif
+      gnutls_dh_params_deinit (daemon->dh_params);
+      return -1;
+    }
+  daemon->have_dhparams = MHD_YES;
+  return 0;
+}
+
+
+/**
+ * Set up session resumption for the HTTPS daemon: the session cache
+ * (#MHD_OPTION_HTTPS_SESSION_CACHE_SIZE) and the key for session
+ * tickets (#MHD_OPTION_HTTPS_SESSION_TICKETS).  Both are shared by
+ * all worker threads.
+ *
+ * @param daemon handle to daemon to initialize
+ * @return 0 on success
+ */
+static int
+init_resumption (struct MHD_Daemon *daemon)
+{
+  int ret;
+
+  if ( (0 != daemon->tls_session_cache_size) &&
+       (NULL == (daemon->tls_session_cache
+                 = MHD_tls_session_cache_create_ (daemon->tls_session_cache_size,
+                                                  daemon->tls_session_timeout))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to create TLS session cache\n");
+#endif
+      return GNUTLS_E_MEMORY_ERROR;
+    }
+  if (MHD_YES == daemon->tls_tickets)
+    {
+      /* GnuTLS derives the keys that encrypt the tickets from this
+         master key and rotates them every session timeout */
+      ret = gnutls_session_ticket_key_generate (&daemon->tls_ticket_key);
+      if (GNUTLS_E_SUCCESS != ret)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to generate session ticket key: %s\n",
+                    gnutls_strerror (ret));
+#endif
+          return ret;
+        }
+    }
+  return 0;
+}
+
+
+/**
+ * Set up the credentials and settings of an HTTPS daemon from its
+ * options.  The result is shared by all worker threads.
+ *
+ * @param daemon handle to daemon to initialize
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
+ */
+int
+MHD_tls_daemon_init_ (struct MHD_Daemon *daemon)
+{
+  const char *priorities;
+  int ret;
+
+  priorities = (NULL != daemon->https_priorities)
+    ? daemon->https_priorities
+    : "NORMAL";
+  ret = gnutls_priority_init (&daemon->priority_cache,
+                              priorities,
+                              NULL);
+  if (GNUTLS_E_SUCCESS != ret)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Setting priorities to `%s' failed: %s\n",
+                priorities,
+                gnutls_strerror (ret));
+#endif
+      daemon->priority_cache = NULL;
+      return MHD_NO;
+    }
+  if ( (NULL != daemon->https_mem_dhparams) &&
+       (0 != init_dh_params (daemon)) )
+    return MHD_NO;
+  if (0 != gnutls_certificate_allocate_credentials (&daemon->x509_cred))
+    {
+      daemon->x509_cred = NULL;
+      return MHD_NO;
+    }
+  if ( (0 != init_daemon_certificate (daemon)) ||
+       (0 != init_resumption (daemon)) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Release what #MHD_tls_daemon_init_() set up.  Safe to call if
+ * the initialization failed or never happened.
+ *
+ * @param daemon handle to daemon to clean up
+ */
+void
+MHD_tls_daemon_deinit_ (struct MHD_Daemon *daemon)
+{
+  if (NULL != daemon->priority_cache)
+    {
+      gnutls_priority_deinit (daemon->priority_cache);
+      daemon->priority_cache = NULL;
+    }
+  if (MHD_YES == daemon->have_dhparams)
+    {
+      gnutls_dh_params_deinit (daemon->dh_params);
+      daemon->have_dhparams = MHD_NO;
+    }
+  if (NULL != daemon->x509_cred)
+    {
+      gnutls_certificate_free_credentials (daemon->x509_cred);
+      daemon->x509_cred = NULL;
+    }
+  MHD_tls_session_cache_destroy_ (daemon->tls_session_cache);
+  daemon->tls_session_cache = NULL;
+  if (NULL != daemon->tls_ticket_key.data)
+    {
+      memset (daemon->tls_ticket_key.data,
+              0,
+              daemon->tls_ticket_key.size);
+      gnutls_free (daemon->tls_ticket_key.data);
+      daemon->tls_ticket_key.data = NULL;
+    }
+}
+
+
+/**
+ * Create the TLS session of a new connection.
+ *
+ * @param connection the new connection
+ * @param pull function receiving encrypted data from the client
+ * @param push function sending encrypted data to the client
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_tls_connection_init_ (struct MHD_Connection *connection,
+                          ReceiveCallback pull,
+                          TransmitCallback push)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (GNUTLS_E_SUCCESS != gnutls_init (&connection->tls_session,
+                                       GNUTLS_SERVER))
+    {
+      connection->tls_session = NULL;
+      return MHD_NO;
+    }
+  gnutls_priority_set (connection->tls_session,
+                       daemon->priority_cache);
+  /* set needed credentials for certificate authentication. */
+  gnutls_credentials_set (connection->tls_session,
+                          GNUTLS_CRD_CERTIFICATE,
+                          daemon->x509_cred);
+  gnutls_transport_set_ptr (connection->tls_session,
+                            (gnutls_transport_ptr_t) connection);
+  gnutls_transport_set_pull_function (connection->tls_session,
+                                      (gnutls_pull_func) pull);
+  gnutls_transport_set_push_function (connection->tls_session,
+                                      (gnutls_push_func) push);
+  if (daemon->https_mem_trust)
+    gnutls_certificate_server_set_request (connection->tls_session,
+                                           GNUTLS_CERT_REQUEST);
+  gnutls_db_set_cache_expiration (connection->tls_session,
+                                  daemon->tls_session_timeout);
+  if (NULL != daemon->tls_session_cache)
+    MHD_tls_session_cache_attach_ (daemon->tls_session_cache,
+                                   connection->tls_session);
+  if (NULL != daemon->tls_ticket_key.data)
+    gnutls_session_ticket_enable_server (connection->tls_session,
+                                         &daemon->tls_ticket_key);
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy the TLS session of a connection.
+ *
+ * @param connection connection to clean up, may have no session
+ */
+void
+MHD_tls_connection_deinit_ (struct MHD_Connection *connection)
+{
+  if (NULL == connection->tls_session)
+    return;
+  gnutls_deinit (connection->tls_session);
+  connection->tls_session = NULL;
+}
+
+
+/**
+ * Continue the TLS handshake of a connection.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_DONE if the handshake completed,
+ *         #MHD_TLS_AGAIN if it is still running
+ */
+enum MHD_TlsResult
+MHD_tls_handshake_ (struct MHD_Connection *connection)
+{
+  int ret;
+
+  ret = gnutls_handshake (connection->tls_session);
+  if (GNUTLS_E_SUCCESS == ret)
+    return MHD_TLS_DONE;
+  if ( (GNUTLS_E_AGAIN == ret) ||
+       (GNUTLS_E_INTERRUPTED == ret) )
+    return MHD_TLS_AGAIN;
+  return MHD_TLS_FAILED;
+}
+
+
+/**
+ * Is the TLS session waiting to write (rather than to read) to
+ * make progress with the handshake?
+ *
+ * @param connection the connection
+ * @return #MHD_YES if the socket must become writable
+ */
+int
+MHD_tls_wants_write_ (struct MHD_Connection *connection)
+{
+  return (1 == gnutls_record_get_direction (connection->tls_session))
+    ? MHD_YES
+    : MHD_NO;
+}
+
+
+/**
+ * Receive and decrypt data.
+ *
+ * @param connection the connection
+ * @param buf where to store the data
+ * @param size number of bytes available in @a buf
+ * @return number of bytes received, 0 if the client closed the
+ *         session, or a (negative) #MHD_TlsResult
+ */
+ssize_t
+MHD_tls_recv_ (struct MHD_Connection *connection,
+               void *buf,
+               size_t size)
+{
+  ssize_t res;
+
+  res = gnutls_record_recv (connection->tls_session, buf, size);
+  if ( (GNUTLS_E_AGAIN == res) ||
+       (GNUTLS_E_INTERRUPTED == res) )
+    return MHD_TLS_AGAIN;
+  if (res < 0)
+    return MHD_TLS_FAILED; /* likely 'GNUTLS_E_INVALID_SESSION' */
+  return res;
+}
+
+
+/**
+ * Encrypt and send data, in at least one record.  While the session
+ * is corked, the data is only collected.
+ *
+ * @param connection the connection
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, or a (negative) #MHD_TlsResult
+ */
+ssize_t
+MHD_tls_send_ (struct MHD_Connection *connection,
+               const void *buf,
+               size_t size)
+{
+  ssize_t res;
+
+  res = gnutls_record_send (connection->tls_session, buf, size);
+  if ( (GNUTLS_E_AGAIN == res) ||
+       (GNUTLS_E_INTERRUPTED == res) )
+    return MHD_TLS_AGAIN;
+  if (res < 0)
+    return MHD_TLS_FAILED;
+  return res;
+}
+
+
+/**
+ * Get the number of bytes that were decrypted already and are
+ * waiting to be received.
+ *
+ * @param connection the connection
+ * @return number of bytes waiting within TLS
+ */
+size_t
+MHD_tls_pending_ (struct MHD_Connection *connection)
+{
+  return gnutls_record_check_pending (connection->tls_session);
+}
+
+
+/**
+ * Get the largest number of bytes that fit into one record.
+ *
+ * @param connection the connection
+ * @return maximum size of the plaintext of a record
+ */
+size_t
+MHD_tls_max_record_size_ (struct MHD_Connection *connection)
+{
+  return gnutls_record_get_max_size (connection->tls_session);
+}
+
+
+/**
+ * Cork the TLS session: data sent from now on is collected, until
+ * #MHD_tls_uncork_() sends it.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_cork_ (struct MHD_Connection *connection)
+{
+  gnutls_record_cork (connection->tls_session);
+}
+
+
+/**
+ * Get the number of bytes collected while the session is corked.
+ *
+ * @param connection the connection
+ * @return number of bytes waiting for #MHD_tls_uncork_()
+ */
+size_t
+MHD_tls_corked_ (struct MHD_Connection *connection)
+{
+  return gnutls_record_check_corked (connection->tls_session);
+}
+
+
+/**
+ * Send the data collected while the session was corked.  Errors
+ * are logged.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_DONE once all of it was sent (the session is no
+ *         longer corked then), #MHD_TLS_AGAIN if the socket is not
+ *         ready for all of it, #MHD_TLS_FAILED on error
+ */
+enum MHD_TlsResult
+MHD_tls_uncork_ (struct MHD_Connection *connection)
+{
+  int ret;
+
+  ret = gnutls_record_uncork (connection->tls_session, 0);
+  if ( (GNUTLS_E_AGAIN == ret) ||
+       (GNUTLS_E_INTERRUPTED == ret) )
+    return MHD_TLS_AGAIN;
+  if (ret < 0)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Failed to send data: %s\n",
+                gnutls_strerror (ret));
+#endif
+      return MHD_TLS_FAILED;
+    }
+  return MHD_TLS_DONE;
+}
+
+
+/**
+ * Tell the client that we are done with the TLS session (without
+ * waiting for its answer).
+ *
+ * @param connection the connection
+ * @param how whether we only stop sending or the session is closed
+ */
+void
+MHD_tls_bye_ (struct MHD_Connection *connection,
+              enum MHD_TransportShutdown how)
+{
+  gnutls_bye (connection->tls_session,
+              (MHD_TRANSPORT_SHUTDOWN_WRITE == how)
+              ? GNUTLS_SHUT_WR
+              : GNUTLS_SHUT_RDWR);
+}
+
+
+/**
+ * Offer application protocols via ALPN during the handshake of a new
+ * session, in order of our preference.
+ *
+ * @param connection connection with the new session
+ * @param protocols the protocols, each prefixed by its length in
+ *        one byte (as on the wire); must stay valid for the
+ *        lifetime of the session
+ * @param size number of bytes in @a protocols
+ */
+void
+MHD_tls_set_alpn_ (struct MHD_Connection *connection,
+                   const char *protocols,
+                   size_t size)
+{
+#if GNUTLS_VERSION_NUMBER >= 0x030200
+  gnutls_datum_t list[4];
+  unsigned int num;
+  size_t off;
+
+  num = 0;
+  off = 0;
+  while ( (off < size) &&
+          (num < sizeof (list) / sizeof (list[0])) )
+    {
+      list[num].size = (unsigned char) protocols[off];
+      list[num].data = (unsigned char *) &protocols[off + 1];
+      off += 1 + list[num].size;
+      num++;
+    }
+  (void) gnutls_alpn_set_protocols (connection->tls_session,
+                                    list,
+                                    num,
+                                    GNUTLS_ALPN_SERVER_PRECEDENCE);
+#endif
+}
+
+
+/**
+ * Get the application protocol selected via ALPN during the handshake.
+ *
+ * @param connection connection that completed the handshake
+ * @param[out] protocol set to the protocol (not 0-terminated)
+ * @param[out] size set to the number of bytes in @a protocol
+ * @return #MHD_YES if a protocol was selected
+ */
+int
+MHD_tls_get_alpn_ (struct MHD_Connection *connection,
+                   const char **protocol,
+                   size_t *size)
+{
+#if GNUTLS_VERSION_NUMBER >= 0x030200
+  gnutls_datum_t selected;
+
+  if (GNUTLS_E_SUCCESS !=
+      gnutls_alpn_get_selected_protocol (connection->tls_session,
+                                         &selected))
+    return MHD_NO;
+  *protocol = (const char *) selected.data;
+  *size = selected.size;
+  return MHD_YES;
+#else
+  return MHD_NO;
+#endif
+}
+
+
+/**
+ * Obtain information about the TLS session of a connection.
+ *
+ * @param connection the connection
+ * @param info_type one of the TLS related types
+ * @return NULL if the information is not available
+ */
+const union MHD_ConnectionInfo *
+MHD_tls_get_info_ (struct MHD_Connection *connection,
+                   enum MHD_ConnectionInfoType info_type)
+{
+  if (NULL == connection->tls_session)
+    return NULL;
+  switch (info_type)
+    {
+    case MHD_CONNECTION_INFO_CIPHER_ALGO:
+      connection->cipher = gnutls_cipher_get (connection->tls_session);
+      return (const union MHD_ConnectionInfo *) &connection->cipher;
+    case MHD_CONNECTION_INFO_PROTOCOL:
+      connection->protocol = gnutls_protocol_get_version (connection->tls_session);
+      return (const union MHD_ConnectionInfo *) &connection->protocol;
+    case MHD_CONNECTION_INFO_GNUTLS_SESSION:
+      return (const union MHD_ConnectionInfo *) &connection->tls_session;
+    default:
+      return NULL;
+    }
+}
+
+/* end of tls_gnutls.c */
@@ -0,0 +1,1026 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file tls_openssl.c
+ * @brief  TLS backend using OpenSSL (or BoringSSL)
+ * @author Christian Grothoff
+ *
+ * All TLS sessions of a daemon are created from one `SSL_CTX`, which
+ * also holds the session cache and the keys for session tickets, and
+ * which is shared by the worker threads.  The encrypted data is passed
+ * through a BIO that calls the same functions as GnuTLS would, so that
+ * custom transports and the readiness tracking of epoll keep working.
+ *
+ * OpenSSL has no corking, so the plaintext is collected in a buffer
+ * of one record instead, which is then given to `SSL_write()` at once.
+ */
+
+#include "internal.h"
+#include "tls.h"
+#include "mhd_limits.h"
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+
+/**
+ * BIO type passing the encrypted data to the functions given to
+ * #MHD_tls_connection_init_().
+ */
+static BIO_METHOD *connection_bio;
+
+
+/**
+ * Receive encrypted data for a TLS session.
+ *
+ * @param bio the BIO of the session
+ * @param buf where to store the data
+ * @param size number of bytes available in @a buf
+ * @return number of bytes received, -1 on error
+ */
+static int
+bio_read (BIO *bio,
+          char *buf,
+          int size)
+{
+  struct MHD_Connection *connection = BIO_get_data (bio);
+  ssize_t ret;
+  int err;
+
+  BIO_clear_retry_flags (bio);
+  if (0 >= size)
+    return 0;
+  ret = connection->tls_pull (connection,
+                              buf,
+                              (size_t) size);
+  if (ret < 0)
+    {
+      err = MHD_socket_errno_;
+      if ( (EINTR == err) ||
+           (EAGAIN == err) ||
+           (EWOULDBLOCK == err) )
+        BIO_set_retry_read (bio);
+      return -1;
+    }
+  return (int) ret;
+}
+
+
+/**
+ * Send encrypted data of a TLS session.
+ *
+ * @param bio the BIO of the session
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, -1 on error
+ */
+static int
+bio_write (BIO *bio,
+           const char *buf,
+           int size)
+{
+  struct MHD_Connection *connection = BIO_get_data (bio);
+  ssize_t ret;
+  int err;
+
+  BIO_clear_retry_flags (bio);
+  if (0 >= size)
+    return 0;
+  ret = connection->tls_push (connection,
+                              buf,
+                              (size_t) size);
+  if (ret < 0)
+    {
+      err = MHD_socket_errno_;
+      if ( (EINTR == err) ||
+           (EAGAIN == err) ||
+           (EWOULDBLOCK == err) )
+        BIO_set_retry_write (bio);
+      return -1;
+    }
+  if (0 == ret)
+    {
+      /* nothing was sent (sendfile() would have blocked) */
+      BIO_set_retry_write (bio);
+      return -1;
+    }
+  return (int) ret;
+}
+
+
+/**
+ * Control function of the BIO.  The data is never buffered, so
+ * only flushing is supported (and does nothing).
+ *
+ * @param bio the BIO of the session
+ * @param cmd what to do
+ * @param num argument of @a cmd
+ * @param ptr argument of @a cmd
+ * @return 1 for #BIO_CTRL_FLUSH, 0 otherwise
+ */
+static long
+bio_ctrl (BIO *bio,
+          int cmd,
+          long num,
+          void *ptr)
+{
+  return (BIO_CTRL_FLUSH == cmd) ? 1 : 0;
+}
+
+
+/**
+ * Initialize a new BIO.
+ *
+ * @param bio the new BIO
+ * @return 1 on success
+ */
+static int
+bio_create (BIO *bio)
+{
+  BIO_set_init (bio, 1);
+  return 1;
+}
+
+
+/**
+ * Initialize the TLS library.  Called once when MHD is loaded.
+ */
+void
+MHD_tls_global_init_ (void)
+{
+  if (1 != OPENSSL_init_ssl (0, NULL))
+    MHD_PANIC ("Failed to initialize OpenSSL\n");
+  connection_bio = BIO_meth_new (BIO_get_new_index () | BIO_TYPE_SOURCE_SINK,
+                                 "microhttpd connection");
+  if ( (NULL == connection_bio) ||
+       (1 != BIO_meth_set_read (connection_bio, &bio_read)) ||
+       (1 != BIO_meth_set_write (connection_bio, &bio_write)) ||
+       (1 != BIO_meth_set_ctrl (connection_bio, &bio_ctrl)) ||
+       (1 != BIO_meth_set_create (connection_bio, &bio_create)) )
+    MHD_PANIC ("Failed to initialize OpenSSL\n");
+}
+
+
+/**
+ * Release the global resources of the TLS library.
+ */
+void
+MHD_tls_global_deinit_ (void)
+{
+  BIO_meth_free (connection_bio);
+  connection_bio = NULL;
+}
+
+
+/**
+ * Fill a buffer with random bytes from the cryptographically secure
+ * generator of the TLS library, e.g. for secret keys.
+ *
+ * @param buf buffer to fill
+ * @param size number of bytes at @a buf
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_tls_random_ (void *buf,
+                 size_t size)
+{
+  if (size > INT_MAX)
+    return MHD_NO;
+  return (1 == RAND_bytes (buf, (int) size)) ? MHD_YES : MHD_NO;
+}
+
+
+#ifdef HAVE_MESSAGES
+/**
+ * Log the errors OpenSSL reported for a failed operation.
+ *
+ * @param daemon daemon to log for
+ * @param what description of what failed
+ */
+static void
+log_tls_errors (struct MHD_Daemon *daemon,
+                const char *what)
+{
+  char buf[256];
+  unsigned long err;
+
+  err = ERR_get_error ();
+  if (0 == err)
+    {
+      MHD_DLOG (daemon,
+                "%s\n",
+                what);
+      return;
+    }
+  do
+    {
+      ERR_error_string_n (err, buf, sizeof (buf));
+      MHD_DLOG (daemon,
+                "%s: %s\n",
+                what,
+                buf);
+    }
+  while (0 != (err = ERR_get_error ()));
+}
+#else
+#define log_tls_errors(daemon,what) ERR_clear_error ()
+#endif
+
+
+/**
+ * Create a memory BIO reading a 0-terminated string.
+ *
+ * @param data the string
+ * @return NULL on error
+ */
+static BIO *
+string_bio (const char *data)
+{
+  return BIO_new_mem_buf ((void *) data,
+                          (int) strlen (data));
+}
+
+
+/**
+ * Accept the certificate of a client whatever the result of its
+ * verification (applications check it themselves).
+ *
+ * @param preverify_ok result of the verification
+ * @param ctx verification context
+ * @return 1 to continue the handshake
+ */
+static int
+accept_any_certificate (int preverify_ok,
+                        X509_STORE_CTX *ctx)
+{
+  return 1;
+}
+
+
+/**
+ * Add the certificates in @a pem as trusted certificate authorities
+ * and request certificates of clients signed by them.  As with GnuTLS,
+ * a missing or invalid client certificate does not fail the handshake.
+ *
+ * @param daemon daemon to initialize
+ * @param ctx context of @a daemon
+ * @param pem the certificates
+ * @return #MHD_YES on success
+ */
+static int
+init_trust (struct MHD_Daemon *daemon,
+            SSL_CTX *ctx,
+            const char *pem)
+{
+  X509_STORE *store;
+  X509 *cert;
+  BIO *bio;
+  unsigned int num;
+
+  if (NULL == (bio = string_bio (pem)))
+    return MHD_NO;
+  store = SSL_CTX_get_cert_store (ctx);
+  num = 0;
+  while (NULL != (cert = PEM_read_bio_X509 (bio, NULL, NULL, NULL)))
+    {
+      if ( (1 != X509_STORE_add_cert (store, cert)) ||
+           (1 != SSL_CTX_add_client_CA (ctx, cert)) )
+        {
+          X509_free (cert);
+          BIO_free (bio);
+          log_tls_errors (daemon,
+                          "Bad trust certificate format");
+          return MHD_NO;
+        }
+      X509_free (cert);
+      num++;
+    }
+  BIO_free (bio);
+  /* reading ends with an error at the end of the data */
+  ERR_clear_error ();
+  if (0 == num)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Bad trust certificate format\n");
+#endif
+      return MHD_NO;
+    }
+  SSL_CTX_set_verify (ctx,
+                      SSL_VERIFY_PEER,
+                      &accept_any_certificate);
+  return MHD_YES;
+}
+
+
+/**
+ * Supply the password of the private key to OpenSSL.
+ *
+ * @param buf where to store the password
+ * @param size number of bytes available in @a buf
+ * @param rwflag 0 as the key is read
+ * @param cls the password, NULL for none
+ * @return length of the password, 0 if there is none
+ */
+static int
+key_password (char *buf,
+              int size,
+              int rwflag,
+              void *cls)
+{
+  const char *password = cls;
+  size_t len;
+
+  /* never ask on the terminal */
+  if (NULL == password)
+    return 0;
+  len = strlen (password);
+  if (len > (size_t) size)
+    return 0;
+  memcpy (buf, password, len);
+  return (int) len;
+}
+
+
+/**
+ * Read and setup our certificate (possibly followed by the chain
+ * of intermediate certificates) and key.
+ *
+ * @param daemon handle to daemon to initialize
+ * @param ctx context of @a daemon
+ * @return #MHD_YES on success
+ */
+static int
+init_certificate (struct MHD_Daemon *daemon,
+                  SSL_CTX *ctx)
+{
+  EVP_PKEY *key;
+  X509 *cert;
+  BIO *bio;
+  int ok;
+
+  if (NULL == (bio = string_bio (daemon->https_mem_cert)))
+    return MHD_NO;
+  cert = PEM_read_bio_X509_AUX (bio, NULL, NULL, NULL);
+  ok = ( (NULL != cert) &&
+         (1 == SSL_CTX_use_certificate (ctx, cert)) );
+  X509_free (cert);
+  while ( ok &&
+          (NULL != (cert = PEM_read_bio_X509 (bio, NULL, NULL, NULL))) )
+    {
+      /* on success, the context takes over the certificate */
+      if (1 != SSL_CTX_add_extra_chain_cert (ctx, cert))
+        {
+          X509_free (cert);
+          ok = 0;
+        }
+    }
+  BIO_free (bio);
+  if (! ok)
+    {
+      log_tls_errors (daemon,
+                      "OpenSSL failed to setup x509 certificate");
+      return MHD_NO;
+    }
+  /* reading the chain ends with an error at the end of the data */
+  ERR_clear_error ();
+
+  if (NULL == (bio = string_bio (daemon->https_mem_key)))
+    return MHD_NO;
+  key = PEM_read_bio_PrivateKey (bio,
+                                 NULL,
+                                 &key_password,
+                                 (void *) daemon->https_key_password);
+  BIO_free (bio);
+  ok = ( (NULL != key) &&
+         (1 == SSL_CTX_use_PrivateKey (ctx, key)) &&
+         (1 == SSL_CTX_check_private_key (ctx)) );
+  EVP_PKEY_free (key);
+  if (! ok)
+    {
+      log_tls_errors (daemon,
+                      "OpenSSL failed to setup x509 key");
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Import the Diffie-Hellman parameters given with
+ * #MHD_OPTION_HTTPS_MEM_DHPARAMS.
+ *
+ * @param daemon handle to daemon to initialize
+ * @param ctx context of @a daemon
+ * @return #MHD_YES on success
+ */
+static int
+init_dh_params (struct MHD_Daemon *daemon,
+                SSL_CTX *ctx)
+{
+  BIO *bio;
+  int ok;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && ! defined(OPENSSL_IS_BORINGSSL)
+  EVP_PKEY *dh;
+
+  if (NULL == (bio = string_bio (daemon->https_mem_dhparams)))
+    return MHD_NO;
+  dh = PEM_read_bio_Parameters (bio, NULL);
+  BIO_free (bio);
+  /* on success, the context takes over the parameters */
+  ok = ( (NULL != dh) &&
+         (1 == SSL_CTX_set0_tmp_dh_pkey (ctx, dh)) );
+  if ( (! ok) &&
+       (NULL != dh) )
+    EVP_PKEY_free (dh);
+#else
+  DH *dh;
+
+  if (NULL == (bio = string_bio (daemon->https_mem_dhparams)))
+    return MHD_NO;
+  dh = PEM_read_bio_DHparams (bio, NULL, NULL, NULL);
+  BIO_free (bio);
+  ok = ( (NULL != dh) &&
+         (1 == SSL_CTX_set_tmp_dh (ctx, dh)) );
+  DH_free (dh);
+#endif
+  if (! ok)
+    {
+      log_tls_errors (daemon,
+                      "Bad Diffie-Hellman parameters format");
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Set up session resumption: the session cache (keyed by session ID)
+ * and session tickets, whose keys OpenSSL generates for the context.
+ *
+ * @param daemon handle to daemon to initialize
+ * @param ctx context of @a daemon
+ */
+static void
+init_resumption (struct MHD_Daemon *daemon,
+                 SSL_CTX *ctx)
+{
+  (void) SSL_CTX_set_session_id_context (ctx,
+                                         (const unsigned char *) "MHD",
+                                         3);
+  (void) SSL_CTX_set_timeout (ctx,
+                              daemon->tls_session_timeout);
+  if (0 != daemon->tls_session_cache_size)
+    {
+      (void) SSL_CTX_set_session_cache_mode (ctx,
+                                             SSL_SESS_CACHE_SERVER);
+      (void) SSL_CTX_sess_set_cache_size (ctx,
+                                          daemon->tls_session_cache_size);
+    }
+  else
+    (void) SSL_CTX_set_session_cache_mode (ctx,
+                                           SSL_SESS_CACHE_OFF);
+  if (MHD_YES != daemon->tls_tickets)
+    {
+      (void) SSL_CTX_set_options (ctx,
+                                  SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+      /* TLS 1.3 tickets would refer to the (disabled) cache */
+      if (0 == daemon->tls_session_cache_size)
+        (void) SSL_CTX_set_num_tickets (ctx,
+                                        0);
+#endif
+    }
+}
+
+
+/**
+ * Select the application protocol of a new session among the ones
+ * offered by the client, preferring the order of the protocols given
+ * to #MHD_tls_set_alpn_().
+ *
+ * @param ssl the new session
+ * @param[out] out set to the selected protocol
+ * @param[out] outlen set to the length of @a out
+ * @param in protocols offered by the client (wire format)
+ * @param inlen number of bytes in @a in
+ * @param cls unused
+ * @return #SSL_TLSEXT_ERR_OK if a protocol was selected
+ */
+static int
+select_alpn (SSL *ssl,
+             const unsigned char **out,
+             unsigned char *outlen,
+             const unsigned char *in,
+             unsigned int inlen,
+             void *cls)
+{
+  struct MHD_Connection *connection = SSL_get_app_data (ssl);
+  unsigned char *selected;
+
+  if ( (NULL == connection->tls_alpn) ||
+       (OPENSSL_NPN_NEGOTIATED !=
+        SSL_select_next_proto (&selected,
+                               outlen,
+                               (const unsigned char *) connection->tls_alpn,
+                               (unsigned int) connection->tls_alpn_size,
+                               in,
+                               inlen)) )
+    return SSL_TLSEXT_ERR_NOACK;
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+
+/**
+ * Set up the credentials and settings of an HTTPS daemon from its
+ * options.  The result is shared by all worker threads.
+ *
+ * @param daemon handle to daemon to initialize
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
+ */
+int
+MHD_tls_daemon_init_ (struct MHD_Daemon *daemon)
+{
+  SSL_CTX *ctx;
+
+  if (NULL == (ctx = SSL_CTX_new (TLS_server_method ())))
+    {
+      log_tls_errors (daemon,
+                      "Failed to create TLS context");
+      return MHD_NO;
+    }
+  daemon->tls_context = ctx;
+  (void) SSL_CTX_set_mode (ctx,
+                           SSL_MODE_ENABLE_PARTIAL_WRITE |
+                           SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  if ( (NULL != daemon->https_priorities) &&
+       (1 != SSL_CTX_set_cipher_list (ctx,
+                                      daemon->https_priorities)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Setting priorities to `%s' failed\n",
+                daemon->https_priorities);
+#endif
+      ERR_clear_error ();
+      return MHD_NO;
+    }
+  if (NULL != daemon->https_mem_dhparams)
+    {
+      if (MHD_YES != init_dh_params (daemon, ctx))
+        return MHD_NO;
+    }
+#ifdef SSL_CTX_set_dh_auto
+  else
+    (void) SSL_CTX_set_dh_auto (ctx, 1);
+#endif
+  if ( (NULL != daemon->https_mem_trust) &&
+       (MHD_YES != init_trust (daemon, ctx, daemon->https_mem_trust)) )
+    return MHD_NO;
+  if ( (NULL == daemon->https_mem_cert) ||
+       (NULL == daemon->https_mem_key) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "You need to specify a certificate and key location\n");
+#endif
+      return MHD_NO;
+    }
+  if (MHD_YES != init_certificate (daemon, ctx))
+    return MHD_NO;
+  init_resumption (daemon, ctx);
+  SSL_CTX_set_alpn_select_cb (ctx,
+                              &select_alpn,
+                              NULL);
+  return MHD_YES;
+}
+
+
+/**
+ * Release what #MHD_tls_daemon_init_() set up.  Safe to call if
+ * the initialization failed or never happened.
+ *
+ * @param daemon handle to daemon to clean up
+ */
+void
+MHD_tls_daemon_deinit_ (struct MHD_Daemon *daemon)
+{
+  if (NULL == daemon->tls_context)
+    return;
+  SSL_CTX_free (daemon->tls_context);
+  daemon->tls_context = NULL;
+}
+
+
+/**
+ * Create the TLS session of a new connection.
+ *
+ * @param connection the new connection
+ * @param pull function receiving encrypted data from the client
+ * @param push function sending encrypted data to the client
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_tls_connection_init_ (struct MHD_Connection *connection,
+                          ReceiveCallback pull,
+                          TransmitCallback push)
+{
+  SSL *ssl;
+  BIO *bio;
+
+  if (NULL == (ssl = SSL_new (connection->daemon->tls_context)))
+    {
+      ERR_clear_error ();
+      return MHD_NO;
+    }
+  if (NULL == (bio = BIO_new (connection_bio)))
+    {
+      ERR_clear_error ();
+      SSL_free (ssl);
+      return MHD_NO;
+    }
+  BIO_set_data (bio, connection);
+  SSL_set_bio (ssl, bio, bio);
+  SSL_set_app_data (ssl, connection);
+  SSL_set_accept_state (ssl);
+  connection->tls_pull = pull;
+  connection->tls_push = push;
+  connection->tls_session = ssl;
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy the TLS session of a connection.
+ *
+ * @param connection connection to clean up, may have no session
+ */
+void
+MHD_tls_connection_deinit_ (struct MHD_Connection *connection)
+{
+  if (NULL == connection->tls_session)
+    return;
+  SSL_free (connection->tls_session);
+  connection->tls_session = NULL;
+  free (connection->tls_cork_buffer);
+  connection->tls_cork_buffer = NULL;
+  connection->tls_cork_size = 0;
+}
+
+
+/**
+ * Convert the result of a failed operation on the TLS session of
+ * @a connection.
+ *
+ * @param connection the connection
+ * @param ret return value of the operation
+ * @return #MHD_TLS_AGAIN if the socket was not ready,
+ *         #MHD_TLS_FAILED otherwise
+ */
+static enum MHD_TlsResult
+get_result (struct MHD_Connection *connection,
+            int ret)
+{
+  switch (SSL_get_error (connection->tls_session, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      return MHD_TLS_AGAIN;
+    default:
+      ERR_clear_error ();
+      return MHD_TLS_FAILED;
+    }
+}
+
+
+/**
+ * Continue the TLS handshake of a connection.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_DONE if the handshake completed,
+ *         #MHD_TLS_AGAIN if it is still running
+ */
+enum MHD_TlsResult
+MHD_tls_handshake_ (struct MHD_Connection *connection)
+{
+  int ret;
+
+  ERR_clear_error ();
+  ret = SSL_do_handshake (connection->tls_session);
+  if (1 == ret)
+    return MHD_TLS_DONE;
+  return get_result (connection, ret);
+}
+
+
+/**
+ * Is the TLS session waiting to write (rather than to read) to
+ * make progress with the handshake?
+ *
+ * @param connection the connection
+ * @return #MHD_YES if the socket must become writable
+ */
+int
+MHD_tls_wants_write_ (struct MHD_Connection *connection)
+{
+  return SSL_want_write (connection->tls_session) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Receive and decrypt data.
+ *
+ * @param connection the connection
+ * @param buf where to store the data
+ * @param size number of bytes available in @a buf
+ * @return number of bytes received, 0 if the client closed the
+ *         session, or a (negative) #MHD_TlsResult
+ */
+ssize_t
+MHD_tls_recv_ (struct MHD_Connection *connection,
+               void *buf,
+               size_t size)
+{
+  int ret;
+
+  if (size > INT_MAX)
+    size = INT_MAX;
+  ERR_clear_error ();
+  ret = SSL_read (connection->tls_session, buf, (int) size);
+  if (ret > 0)
+    return ret;
+  if (SSL_ERROR_ZERO_RETURN == SSL_get_error (connection->tls_session, ret))
+    return 0;
+  return get_result (connection, ret);
+}
+
+
+/**
+ * Encrypt and send (at most) one record.
+ *
+ * @param connection the connection
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, or a (negative) #MHD_TlsResult
+ */
+static ssize_t
+tls_write (struct MHD_Connection *connection,
+           const void *buf,
+           size_t size)
+{
+  int ret;
+
+  /* OpenSSL requires a write that could not be completed to be
+     repeated with at least the same data; as we always retry from
+     the same position, the data is still there even if fewer bytes
+     are offered this time (the size of the records changed) */
+  if (size < connection->tls_write_pending)
+    size = connection->tls_write_pending;
+  if (size > MHD_TLS_MAX_RECORD_SIZE)
+    size = MHD_TLS_MAX_RECORD_SIZE;
+  ERR_clear_error ();
+  ret = SSL_write (connection->tls_session, buf, (int) size);
+  if (ret > 0)
+    {
+      connection->tls_write_pending = 0;
+      return ret;
+    }
+  if (MHD_TLS_AGAIN != get_result (connection, ret))
+    return MHD_TLS_FAILED;
+  connection->tls_write_pending = size;
+  return MHD_TLS_AGAIN;
+}
+
+
+/**
+ * Encrypt and send data, in at least one record.  While the session
+ * is corked, the data is only collected.
+ *
+ * @param connection the connection
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, or a (negative) #MHD_TlsResult
+ */
+ssize_t
+MHD_tls_send_ (struct MHD_Connection *connection,
+               const void *buf,
+               size_t size)
+{
+  if ( (MHD_YES == connection->tls_corked) &&
+       (NULL != connection->tls_cork_buffer) )
+    {
+      if (size > MHD_TLS_MAX_RECORD_SIZE - connection->tls_cork_size)
+        size = MHD_TLS_MAX_RECORD_SIZE - connection->tls_cork_size;
+      if (0 == size)
+        return MHD_TLS_AGAIN;
+      memcpy (&connection->tls_cork_buffer[connection->tls_cork_size],
+              buf,
+              size);
+      connection->tls_cork_size += size;
+      return size;
+    }
+  return tls_write (connection, buf, size);
+}
+
+
+/**
+ * Get the number of bytes that were decrypted already and are
+ * waiting to be received.
+ *
+ * @param connection the connection
+ * @return number of bytes waiting within TLS
+ */
+size_t
+MHD_tls_pending_ (struct MHD_Connection *connection)
+{
+  return (size_t) SSL_pending (connection->tls_session);
+}
+
+
+/**
+ * Get the largest number of bytes that fit into one record.
+ *
+ * @param connection the connection
+ * @return maximum size of the plaintext of a record
+ */
+size_t
+MHD_tls_max_record_size_ (struct MHD_Connection *connection)
+{
+  return MHD_TLS_MAX_RECORD_SIZE;
+}
+
+
+/**
+ * Cork the TLS session: data sent from now on is collected, until
+ * #MHD_tls_uncork_() sends it.  The buffer for it is kept for the
+ * lifetime of the session.  Without memory for it, the data is sent
+ * right away instead.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_cork_ (struct MHD_Connection *connection)
+{
+  if (NULL == connection->tls_cork_buffer)
+    connection->tls_cork_buffer = malloc (MHD_TLS_MAX_RECORD_SIZE);
+}
+
+
+/**
+ * Get the number of bytes collected while the session is corked.
+ *
+ * @param connection the connection
+ * @return number of bytes waiting for #MHD_tls_uncork_()
+ */
+size_t
+MHD_tls_corked_ (struct MHD_Connection *connection)
+{
+  return connection->tls_cork_size;
+}
+
+
+/**
+ * Send the data collected while the session was corked.  Errors
+ * are logged.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_DONE once all of it was sent (the session is no
+ *         longer corked then), #MHD_TLS_AGAIN if the socket is not
+ *         ready for all of it, #MHD_TLS_FAILED on error
+ */
+enum MHD_TlsResult
+MHD_tls_uncork_ (struct MHD_Connection *connection)
+{
+  ssize_t ret;
+
+  while (0 != connection->tls_cork_size)
+    {
+      ret = tls_write (connection,
+                       connection->tls_cork_buffer,
+                       connection->tls_cork_size);
+      if (MHD_TLS_AGAIN == ret)
+        return MHD_TLS_AGAIN;
+      if (ret < 0)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Failed to send data\n");
+#endif
+          connection->tls_cork_size = 0;
+          return MHD_TLS_FAILED;
+        }
+      memmove (connection->tls_cork_buffer,
+               &connection->tls_cork_buffer[ret],
+               connection->tls_cork_size - ret);
+      connection->tls_cork_size -= ret;
+    }
+  return MHD_TLS_DONE;
+}
+
+
+/**
+ * Tell the client that we are done with the TLS session (without
+ * waiting for its answer).
+ *
+ * @param connection the connection
+ * @param how whether we only stop sending or the session is closed
+ */
+void
+MHD_tls_bye_ (struct MHD_Connection *connection,
+              enum MHD_TransportShutdown how)
+{
+  /* either way, we only send our close_notify; OpenSSL does not keep
+     sessions in its cache that were not shut down like this */
+  if (0 != (SSL_get_shutdown (connection->tls_session) & SSL_SENT_SHUTDOWN))
+    return;
+  ERR_clear_error ();
+  (void) SSL_shutdown (connection->tls_session);
+  ERR_clear_error ();
+}
+
+
+/**
+ * Offer application protocols via ALPN during the handshake of a new
+ * session, in order of our preference.
+ *
+ * @param connection connection with the new session
+ * @param protocols the protocols, each prefixed by its length in
+ *        one byte (as on the wire); must stay valid for the
+ *        lifetime of the session
+ * @param size number of bytes in @a protocols
+ */
+void
+MHD_tls_set_alpn_ (struct MHD_Connection *connection,
+                   const char *protocols,
+                   size_t size)
+{
+  connection->tls_alpn = protocols;
+  connection->tls_alpn_size = size;
+}
+
+
+/**
+ * Get the application protocol selected via ALPN during the handshake.
+ *
+ * @param connection connection that completed the handshake
+ * @param[out] protocol set to the protocol (not 0-terminated)
+ * @param[out] size set to the number of bytes in @a protocol
+ * @return #MHD_YES if a protocol was selected
+ */
+int
+MHD_tls_get_alpn_ (struct MHD_Connection *connection,
+                   const char **protocol,
+                   size_t *size)
+{
+  const unsigned char *data;
+  unsigned int len;
+
+  SSL_get0_alpn_selected (connection->tls_session,
+                          &data,
+                          &len);
+  if (0 == len)
+    return MHD_NO;
+  *protocol = (const char *) data;
+  *size = len;
+  return MHD_YES;
+}
+
+
+/**
+ * Obtain information about the TLS session of a connection.  The
+ * cipher, protocol and session are only available as values of
+ * GnuTLS, and thus not with this backend.
+ *
+ * @param connection the connection
+ * @param info_type one of the TLS related types
+ * @return NULL, the information is not available
+ */
+const union MHD_ConnectionInfo *
+MHD_tls_get_info_ (struct MHD_Connection *connection,
+                   enum MHD_ConnectionInfoType info_type)
+{
+  (void) connection;
+  (void) info_type;
+  return NULL;
+}
+
+/* end of tls_openssl.c */
@@ -0,0 +1,368 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file tlscache.c
+ * @brief server-side cache of TLS sessions for resumption
+ * @author Christian Grothoff
+ *
+ * GnuTLS stores the parameters of each new session under its session
+ * ID with the callbacks installed here and looks them up when a
+ * client asks to resume a session.  The cache is shared by all
+ * worker threads; it is a sharded table (see mhd_shardtable.h) keyed
+ * by the session ID, so that handshakes on different workers rarely
+ * contend.
+ */
+
+#include "internal.h"
+#include "tlscache.h"
+#include "mhd_shardtable.h"
+#include "mhd_mono_clock.h"
+
+
+/**
+ * Maximum number of slots of the cache looked at for a session;
+ * a new session replaces the least recently used one of these slots.
+ */
+#define TLS_CACHE_PROBE_LIMIT 8
+
+/**
+ * Maximum length of a session ID (32 bytes in TLS).
+ */
+#define TLS_CACHE_MAX_ID_SIZE 64
+
+
+/**
+ * Stored TLS session.
+ */
+struct TlsSessionEntry
+{
+
+  /**
+   * Session parameters serialized by GnuTLS, NULL for unused
+   * entries.
+   */
+  void *data;
+
+  /**
+   * Number of bytes at @e data.
+   */
+  size_t data_size;
+
+  /**
+   * Hash of @e id.
+   */
+  uint64_t hash;
+
+  /**
+   * Monotonic time (in seconds) when the entry expires.
+   */
+  uint64_t expires;
+
+  /**
+   * Value of the clock of the shard when the entry was last used.
+   */
+  uint32_t last_used;
+
+  /**
+   * Number of bytes in @e id.
+   */
+  unsigned int id_size;
+
+  /**
+   * The session ID.
+   */
+  unsigned char id[TLS_CACHE_MAX_ID_SIZE];
+
+};
+
+
+/**
+ * Cache of TLS sessions, shared by all worker threads.
+ */
+struct MHD_TlsSessionCache
+{
+
+  /**
+   * Entries of type `struct TlsSessionEntry`, hashed by session ID.
+   */
+  struct MHD_ShardTable table;
+
+  /**
+   * Number of seconds sessions are kept.
+   */
+  unsigned int ttl;
+
+};
+
+
+/**
+ * Create a cache of TLS sessions.
+ *
+ * @param size maximum number of sessions to keep
+ * @param ttl number of seconds sessions can be resumed
+ * @return NULL on error
+ */
+struct MHD_TlsSessionCache *
+MHD_tls_session_cache_create_ (unsigned int size,
+                               unsigned int ttl)
+{
+  struct MHD_TlsSessionCache *cache;
+
+  if (NULL == (cache = malloc (sizeof (struct MHD_TlsSessionCache))))
+    return NULL;
+  if (MHD_YES != MHD_shard_table_init_ (&cache->table,
+                                        size,
+                                        sizeof (struct TlsSessionEntry),
+                                        TLS_CACHE_PROBE_LIMIT,
+                                        NULL,
+                                        0))
+    {
+      free (cache);
+      return NULL;
+    }
+  cache->ttl = ttl;
+  return cache;
+}
+
+
+/**
+ * Release the session stored in an entry of the cache.
+ *
+ * @param entry the `struct TlsSessionEntry`
+ */
+static void
+release_session (void *entry)
+{
+  struct TlsSessionEntry *slot = entry;
+
+  free (slot->data);
+}
+
+
+/**
+ * Destroy a cache of TLS sessions.
+ *
+ * @param cache cache to destroy, may be NULL
+ */
+void
+MHD_tls_session_cache_destroy_ (struct MHD_TlsSessionCache *cache)
+{
+  if (NULL == cache)
+    return;
+  MHD_shard_table_deinit_ (&cache->table,
+                           &release_session);
+  free (cache);
+}
+
+
+/**
+ * Find the entry for a session ID and lock its shard.
+ *
+ * @param cache the cache
+ * @param id the session ID
+ * @param hash hash of @a id
+ * @param[out] probe set to the slots for @a id, in a shard that is
+ *             locked on return
+ * @param[out] victim set to the entry to replace if the session
+ *             is not found (an unused, expired or the least
+ *             recently used entry); may be NULL
+ * @return the entry for @a id, NULL if not found
+ */
+static struct TlsSessionEntry *
+find_session (struct MHD_TlsSessionCache *cache,
+              const gnutls_datum_t *id,
+              uint64_t hash,
+              struct MHD_ShardProbe *probe,
+              struct TlsSessionEntry **victim)
+{
+  struct TlsSessionEntry *slot;
+  struct TlsSessionEntry *old;
+  uint64_t now;
+  unsigned int i;
+
+  now = (uint64_t) MHD_monotonic_sec_counter ();
+  MHD_shard_table_lock_ (&cache->table, hash, probe);
+  old = MHD_shard_probe_slot_ (probe, 0);
+  for (i = 0; i < probe->limit; i++)
+    {
+      slot = MHD_shard_probe_slot_ (probe, i);
+      if ( (NULL != slot->data) &&
+           (hash == slot->hash) &&
+           (id->size == slot->id_size) &&
+           (0 == memcmp (slot->id, id->data, id->size)) )
+        {
+          if (now < slot->expires)
+            return slot;
+          /* expired, make room */
+          free (slot->data);
+          slot->data = NULL;
+        }
+      /* prefer unused or expired entries, then the least recently
+         used one */
+      if ( (NULL != old->data) &&
+           (now < old->expires) &&
+           ( (NULL == slot->data) ||
+             (now >= slot->expires) ||
+             ((int32_t) (slot->last_used - old->last_used) < 0) ) )
+        old = slot;
+    }
+  if (NULL != victim)
+    *victim = old;
+  return NULL;
+}
+
+
+/**
+ * Store the parameters of a new session (GnuTLS db callback).
+ *
+ * @param cls the `struct MHD_TlsSessionCache`
+ * @param key the session ID
+ * @param data serialized session parameters
+ * @return 0 on success, -1 on error
+ */
+static int
+store_session (void *cls,
+               gnutls_datum_t key,
+               gnutls_datum_t data)
+{
+  struct MHD_TlsSessionCache *cache = cls;
+  struct MHD_ShardProbe probe;
+  struct TlsSessionEntry *slot;
+  struct TlsSessionEntry *victim;
+  uint64_t hash;
+  void *copy;
+
+  if ( (0 == key.size) ||
+       (TLS_CACHE_MAX_ID_SIZE < key.size) ||
+       (NULL == (copy = malloc (data.size))) )
+    return -1;
+  memcpy (copy, data.data, data.size);
+  hash = MHD_shard_table_hash_ (&cache->table, key.data, key.size);
+  slot = find_session (cache, &key, hash, &probe, &victim);
+  if (NULL == slot)
+    {
+      slot = victim;
+      slot->hash = hash;
+      slot->id_size = key.size;
+      memcpy (slot->id, key.data, key.size);
+    }
+  free (slot->data);
+  slot->data = copy;
+  slot->data_size = data.size;
+  slot->expires = (uint64_t) MHD_monotonic_sec_counter () + cache->ttl;
+  slot->last_used = probe.shard->clock;
+  MHD_shard_probe_unlock_ (&probe);
+  return 0;
+}
+
+
+/**
+ * Look up the parameters of a session to resume (GnuTLS db
+ * callback).
+ *
+ * @param cls the `struct MHD_TlsSessionCache`
+ * @param key the session ID
+ * @return the parameters (allocated with gnutls_malloc()), or
+ *         an empty datum if the session is not known
+ */
+static gnutls_datum_t
+retrieve_session (void *cls,
+                  gnutls_datum_t key)
+{
+  struct MHD_TlsSessionCache *cache = cls;
+  struct MHD_ShardProbe probe;
+  struct TlsSessionEntry *slot;
+  gnutls_datum_t res = { NULL, 0 };
+
+  if ( (0 == key.size) ||
+       (TLS_CACHE_MAX_ID_SIZE < key.size) )
+    return res;
+  slot = find_session (cache,
+                      &key,
+                      MHD_shard_table_hash_ (&cache->table,
+                                             key.data,
+                                             key.size),
+                      &probe,
+                      NULL);
+  if ( (NULL != slot) &&
+       (NULL != (res.data = gnutls_malloc (slot->data_size))) )
+    {
+      memcpy (res.data, slot->data, slot->data_size);
+      res.size = slot->data_size;
+      slot->last_used = probe.shard->clock;
+    }
+  MHD_shard_probe_unlock_ (&probe);
+  return res;
+}
+
+
+/**
+ * Forget a session (GnuTLS db callback).
+ *
+ * @param cls the `struct MHD_TlsSessionCache`
+ * @param key the session ID
+ * @return 0 on success, -1 if the session was not known
+ */
+static int
+remove_session (void *cls,
+                gnutls_datum_t key)
+{
+  struct MHD_TlsSessionCache *cache = cls;
+  struct MHD_ShardProbe probe;
+  struct TlsSessionEntry *slot;
+
+  if ( (0 == key.size) ||
+       (TLS_CACHE_MAX_ID_SIZE < key.size) )
+    return -1;
+  slot = find_session (cache,
+                      &key,
+                      MHD_shard_table_hash_ (&cache->table,
+                                             key.data,
+                                             key.size),
+                      &probe,
+                      NULL);
+  if (NULL != slot)
+    {
+      free (slot->data);
+      slot->data = NULL;
+    }
+  MHD_shard_probe_unlock_ (&probe);
+  return (NULL != slot) ? 0 : -1;
+}
+
+
+/**
+ * Let a new TLS session store its parameters in the cache and resume
+ * sessions found there.
+ *
+ * @param cache the cache
+ * @param session the session of a new connection
+ */
+void
+MHD_tls_session_cache_attach_ (struct MHD_TlsSessionCache *cache,
+                               gnutls_session_t session)
+{
+  gnutls_db_set_ptr (session, cache);
+  gnutls_db_set_store_function (session, &store_session);
+  gnutls_db_set_retrieve_function (session, &retrieve_session);
+  gnutls_db_set_remove_function (session, &remove_session);
+}
+
+/* end of tlscache.c */
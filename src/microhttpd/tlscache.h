@@ -0,0 +1,64 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file tlscache.h
+ * @brief  server-side cache of TLS sessions for resumption
+ * @author Christian Grothoff
+ */
+
+#ifndef TLSCACHE_H
+#define TLSCACHE_H
+
+#include "internal.h"
+
+
+/**
+ * Create a cache of TLS sessions.
+ *
+ * @param size maximum number of sessions to keep
+ * @param ttl number of seconds sessions can be resumed
+ * @return NULL on error
+ */
+struct MHD_TlsSessionCache *
+MHD_tls_session_cache_create_ (unsigned int size,
+                               unsigned int ttl);
+
+
+/**
+ * Destroy a cache of TLS sessions.
+ *
+ * @param cache cache to destroy, may be NULL
+ */
+void
+MHD_tls_session_cache_destroy_ (struct MHD_TlsSessionCache *cache);
+
+
+/**
+ * Let a new TLS session store its parameters in the cache and resume
+ * sessions found there.
+ *
+ * @param cache the cache
+ * @param session the session of a new connection
+ */
+void
+MHD_tls_session_cache_attach_ (struct MHD_TlsSessionCache *cache,
+                               gnutls_session_t session);
+
+#endif
@@ -0,0 +1,628 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file tlshandshake.c
+ * @brief threads running the TLS handshakes of new connections
+ * @author Christian Grothoff
+ *
+ * With #MHD_OPTION_HTTPS_HANDSHAKE_THREADS, new HTTPS connections
+ * are suspended right after they were accepted and handed to one of
+ * the threads here, which drives their handshakes with `poll()`.
+ * This keeps the expensive public key operations off the threads
+ * that process the requests of established connections.  Once the
+ * handshake is done, the connection is resumed with
+ * #MHD_resume_connection() and continues on the thread of its daemon
+ * like any other connection.
+ */
+
+#include "internal.h"
+#include "tlshandshake.h"
+#include "connection.h"
+#include "connection_https.h"
+#include "mhd_mono_clock.h"
+#include "tls.h"
+#if defined(HAVE_POLL_H) && defined(HAVE_POLL)
+#include <poll.h>
+#endif
+
+#if defined(MHD_USE_POSIX_THREADS) && defined(HAVE_POLL) && defined(MHD_POSIX_SOCKETS)
+/**
+ * Can we run handshake threads on this platform?
+ */
+#define HANDSHAKE_THREADS_SUPPORTED 1
+#endif
+
+
+#ifdef HANDSHAKE_THREADS_SUPPORTED
+/**
+ * A thread running handshakes.  Connections are linked through
+ * their `nextX` and `prevX` fields, which are not used while the
+ * connection is suspended.
+ */
+struct HandshakeThread
+{
+
+  /**
+   * Connections submitted to this thread that it did not pick up
+   * yet.  Protected by @e lock.
+   */
+  struct MHD_Connection *incoming_head;
+
+  /**
+   * Tail of the list of submitted connections.
+   */
+  struct MHD_Connection *incoming_tail;
+
+  /**
+   * Connections whose handshakes this thread is running.  Only
+   * accessed by the thread.
+   */
+  struct MHD_Connection *active_head;
+
+  /**
+   * Tail of the list of active connections.
+   */
+  struct MHD_Connection *active_tail;
+
+  /**
+   * Array for `poll()`, the first entry is for @e wpipe.
+   */
+  struct pollfd *pfd;
+
+  /**
+   * Number of entries allocated in @e pfd.
+   */
+  unsigned int pfd_size;
+
+  /**
+   * Number of connections in the active list.
+   */
+  unsigned int num_active;
+
+  /**
+   * Protects the list of submitted connections and @e quit.
+   */
+  MHD_mutex_ lock;
+
+  /**
+   * Pipe used to wake up the thread when a connection was submitted
+   * or when it should terminate.
+   */
+  MHD_pipe wpipe[2];
+
+  /**
+   * Handle of the thread.
+   */
+  MHD_thread_handle_ pid;
+
+  /**
+   * Set to #MHD_YES to make the thread terminate.
+   */
+  int quit;
+
+};
+#endif
+
+
+/**
+ * Threads running TLS handshakes for a daemon (and its workers).
+ */
+struct MHD_TlsHandshakePool
+{
+#ifdef HANDSHAKE_THREADS_SUPPORTED
+  /**
+   * Array of @e num_threads threads.
+   */
+  struct HandshakeThread *threads;
+#endif
+
+  /**
+   * Number of threads in the pool.
+   */
+  unsigned int num_threads;
+
+  /**
+   * #MHD_YES once the threads were stopped.
+   */
+  int stopped;
+};
+
+
+#ifdef HANDSHAKE_THREADS_SUPPORTED
+/**
+ * Hand a connection back to its daemon.  The connection must not be
+ * touched afterwards, as its daemon may close it at once.
+ *
+ * @param connection connection to resume
+ */
+static void
+hand_back (struct MHD_Connection *connection)
+{
+  connection->last_activity = MHD_monotonic_sec_counter ();
+  MHD_resume_connection (connection);
+}
+
+
+/**
+ * Hand back a connection whose handshake failed (or was aborted),
+ * so that its daemon closes it.
+ *
+ * @param connection the connection
+ * @param termination_code reason for closing the connection
+ */
+static void
+hand_back_closed (struct MHD_Connection *connection,
+                  enum MHD_RequestTerminationCode termination_code)
+{
+  MHD_connection_close_ (connection,
+                         termination_code);
+  hand_back (connection);
+}
+
+
+/**
+ * Remove a connection from the active list of a thread.
+ *
+ * @param thread the thread
+ * @param connection connection to remove
+ */
+static void
+remove_active (struct HandshakeThread *thread,
+               struct MHD_Connection *connection)
+{
+  XDLL_remove (thread->active_head,
+               thread->active_tail,
+               connection);
+  thread->num_active--;
+}
+
+
+/**
+ * Continue the handshake of a connection whose socket became ready.
+ *
+ * @param thread thread running the handshake
+ * @param connection the connection
+ */
+static void
+run_handshake (struct HandshakeThread *thread,
+               struct MHD_Connection *connection)
+{
+  enum MHD_TlsResult ret;
+
+  ret = MHD_tls_handshake_ (connection);
+  connection->last_activity = MHD_monotonic_sec_counter ();
+  if (MHD_TLS_AGAIN == ret)
+    return; /* handshake not done */
+  remove_active (thread,
+                 connection);
+  if (MHD_TLS_DONE == ret)
+    {
+      MHD_tls_handshake_completed_ (connection);
+      hand_back (connection);
+      return;
+    }
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (connection->daemon,
+            "Error: received handshake message out of context\n");
+#endif
+  hand_back_closed (connection,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+}
+
+
+/**
+ * Make sure @a thread can poll for all of its connections.  If
+ * there is not enough memory, the connections that do not fit
+ * are given up.
+ *
+ * @param thread the thread
+ */
+static void
+grow_pfd (struct HandshakeThread *thread)
+{
+  struct pollfd *pfd;
+  unsigned int size;
+
+  if (thread->num_active < thread->pfd_size)
+    return;
+  size = thread->pfd_size * 2;
+  while (size <= thread->num_active)
+    size *= 2;
+  pfd = realloc (thread->pfd,
+                 size * sizeof (struct pollfd));
+  if (NULL != pfd)
+    {
+      thread->pfd = pfd;
+      thread->pfd_size = size;
+      return;
+    }
+  while (thread->num_active >= thread->pfd_size)
+    {
+      struct MHD_Connection *pos = thread->active_head;
+
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (pos->daemon,
+                "Failed to allocate memory for handshake\n");
+#endif
+      remove_active (thread,
+                     pos);
+      hand_back_closed (pos,
+                        MHD_REQUEST_TERMINATED_WITH_ERROR);
+    }
+}
+
+
+/**
+ * Main function of a handshake thread.
+ *
+ * @param cls the `struct HandshakeThread`
+ * @return always 0
+ */
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+handshake_thread (void *cls)
+{
+  struct HandshakeThread *thread = cls;
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  unsigned int i;
+  int timeout;
+  int quit;
+  time_t now;
+
+  while (1)
+    {
+      if (MHD_YES != MHD_mutex_lock_ (&thread->lock))
+        MHD_PANIC ("Failed to acquire handshake mutex\n");
+      while (NULL != (pos = thread->incoming_head))
+        {
+          XDLL_remove (thread->incoming_head,
+                       thread->incoming_tail,
+                       pos);
+          XDLL_insert (thread->active_head,
+                       thread->active_tail,
+                       pos);
+          thread->num_active++;
+        }
+      quit = thread->quit;
+      if (MHD_YES != MHD_mutex_unlock_ (&thread->lock))
+        MHD_PANIC ("Failed to release handshake mutex\n");
+      if (MHD_YES == quit)
+        break;
+
+      grow_pfd (thread);
+      thread->pfd[0].fd = thread->wpipe[0];
+      thread->pfd[0].events = POLLIN;
+      thread->pfd[0].revents = 0;
+      timeout = -1;
+      i = 1;
+      for (pos = thread->active_head; NULL != pos; pos = pos->nextX)
+        {
+          thread->pfd[i].fd = pos->socket_fd;
+          thread->pfd[i].events
+            = (MHD_YES == MHD_tls_wants_write_ (pos))
+            ? POLLOUT
+            : POLLIN;
+          thread->pfd[i].revents = 0;
+          /* timeouts are in seconds, checking once per second is enough */
+          if (0 != pos->connection_timeout)
+            timeout = 1000;
+          i++;
+        }
+      if (0 > MHD_sys_poll_ (thread->pfd, i, timeout))
+        {
+          if (EINTR == MHD_socket_errno_)
+            continue;
+#ifdef HAVE_MESSAGES
+          if (NULL != thread->active_head)
+            MHD_DLOG (thread->active_head->daemon,
+                      "poll failed: %s\n",
+                      MHD_socket_last_strerr_ ());
+#endif
+          /* the error would come back on the next round; give up on
+             the handshakes instead of spinning */
+          while (NULL != (pos = thread->active_head))
+            {
+              remove_active (thread,
+                             pos);
+              hand_back_closed (pos,
+                                MHD_REQUEST_TERMINATED_WITH_ERROR);
+            }
+          continue;
+        }
+      if (0 != (thread->pfd[0].revents & POLLIN))
+        MHD_pipe_drain_ (thread->wpipe[0]);
+
+      now = MHD_monotonic_sec_counter ();
+      i = 1;
+      next = thread->active_head;
+      while (NULL != (pos = next))
+        {
+          next = pos->nextX;
+          if (0 != thread->pfd[i++].revents)
+            {
+              run_handshake (thread,
+                             pos);
+              continue;
+            }
+          if ( (0 != pos->connection_timeout) &&
+               (pos->connection_timeout <= now - pos->last_activity) )
+            {
+              remove_active (thread,
+                             pos);
+              hand_back_closed (pos,
+                                MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+            }
+        }
+    }
+
+  /* give everything back so that the daemons can close it */
+  while (NULL != (pos = thread->active_head))
+    {
+      remove_active (thread,
+                     pos);
+      hand_back_closed (pos,
+                        MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN);
+    }
+  return (MHD_THRD_RTRN_TYPE_) 0;
+}
+
+
+/**
+ * Stop and release the threads [0, @a num) of @a pool.
+ *
+ * @param pool the pool
+ * @param num number of threads that were started
+ */
+static void
+stop_threads (struct MHD_TlsHandshakePool *pool,
+              unsigned int num)
+{
+  struct HandshakeThread *thread;
+  unsigned int i;
+
+  for (i = 0; i < num; i++)
+    {
+      thread = &pool->threads[i];
+      if (MHD_YES != MHD_mutex_lock_ (&thread->lock))
+        MHD_PANIC ("Failed to acquire handshake mutex\n");
+      thread->quit = MHD_YES;
+      if (MHD_YES != MHD_mutex_unlock_ (&thread->lock))
+        MHD_PANIC ("Failed to release handshake mutex\n");
+      (void) MHD_pipe_write_ (thread->wpipe[1], "e", 1);
+    }
+  for (i = 0; i < num; i++)
+    {
+      thread = &pool->threads[i];
+      if (0 != MHD_join_thread_ (thread->pid))
+        MHD_PANIC ("Failed to join a thread\n");
+    }
+}
+
+
+/**
+ * Release the resources of a thread that is not running.
+ *
+ * @param thread thread to clean up
+ */
+static void
+thread_cleanup (struct HandshakeThread *thread)
+{
+  (void) MHD_mutex_destroy_ (&thread->lock);
+  if (0 != MHD_pipe_close_ (thread->wpipe[0]))
+    MHD_PANIC ("close failed\n");
+  if (0 != MHD_pipe_close_ (thread->wpipe[1]))
+    MHD_PANIC ("close failed\n");
+  free (thread->pfd);
+}
+
+
+/**
+ * Prepare and start a handshake thread.
+ *
+ * @param daemon daemon the thread is for (used for logging)
+ * @param thread thread to start
+ * @return #MHD_YES on success
+ */
+static int
+thread_start (struct MHD_Daemon *daemon,
+              struct HandshakeThread *thread)
+{
+  int ret;
+
+  thread->quit = MHD_NO;
+  thread->pfd_size = 16;
+  if (NULL == (thread->pfd = malloc (thread->pfd_size * sizeof (struct pollfd))))
+    return MHD_NO;
+  if (0 != MHD_pipe_ (thread->wpipe))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to create control pipe: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      free (thread->pfd);
+      return MHD_NO;
+    }
+  (void) fcntl (thread->wpipe[0], F_SETFL,
+                fcntl (thread->wpipe[0], F_GETFL) | O_NONBLOCK);
+  (void) fcntl (thread->wpipe[1], F_SETFL,
+                fcntl (thread->wpipe[1], F_GETFL) | O_NONBLOCK);
+  if (MHD_YES != MHD_mutex_create_ (&thread->lock))
+    {
+      (void) MHD_pipe_close_ (thread->wpipe[0]);
+      (void) MHD_pipe_close_ (thread->wpipe[1]);
+      free (thread->pfd);
+      return MHD_NO;
+    }
+  if (0 != (ret = MHD_create_thread_ (&thread->pid,
+                                      daemon,
+                                      &handshake_thread,
+                                      thread)))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to create a thread: %s\n",
+                MHD_strerror_ (ret));
+#endif
+      thread_cleanup (thread);
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+#endif
+
+
+/**
+ * Start the threads of a handshake pool.
+ *
+ * @param daemon daemon the pool is for (used for logging)
+ * @param num_threads number of threads to start
+ * @return NULL on error
+ */
+struct MHD_TlsHandshakePool *
+MHD_tls_handshake_pool_create_ (struct MHD_Daemon *daemon,
+                                unsigned int num_threads)
+{
+#ifdef HANDSHAKE_THREADS_SUPPORTED
+  struct MHD_TlsHandshakePool *pool;
+  unsigned int i;
+
+  if (NULL == (pool = malloc (sizeof (struct MHD_TlsHandshakePool))))
+    return NULL;
+  pool->num_threads = num_threads;
+  pool->stopped = MHD_NO;
+  if (NULL == (pool->threads = calloc (num_threads,
+                                       sizeof (struct HandshakeThread))))
+    {
+      free (pool);
+      return NULL;
+    }
+  for (i = 0; i < num_threads; i++)
+    {
+      if (MHD_YES == thread_start (daemon,
+                                   &pool->threads[i]))
+        continue;
+      stop_threads (pool, i);
+      while (i > 0)
+        thread_cleanup (&pool->threads[--i]);
+      free (pool->threads);
+      free (pool);
+      return NULL;
+    }
+  return pool;
+#else
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Handshake threads are not supported on this platform\n");
+#endif
+  return NULL;
+#endif
+}
+
+
+/**
+ * Stop the threads of a handshake pool.  Connections that did not
+ * finish their handshake yet, and all connections submitted from now
+ * on, are handed back closed.
+ *
+ * @param pool pool to stop, may be NULL
+ */
+void
+MHD_tls_handshake_pool_stop_ (struct MHD_TlsHandshakePool *pool)
+{
+  if ( (NULL == pool) ||
+       (MHD_YES == pool->stopped) )
+    return;
+#ifdef HANDSHAKE_THREADS_SUPPORTED
+  stop_threads (pool,
+                pool->num_threads);
+#endif
+  pool->stopped = MHD_YES;
+}
+
+
+/**
+ * Stop the threads of a handshake pool (if that did not happen yet)
+ * and release it.
+ *
+ * @param pool pool to destroy, may be NULL
+ */
+void
+MHD_tls_handshake_pool_destroy_ (struct MHD_TlsHandshakePool *pool)
+{
+#ifdef HANDSHAKE_THREADS_SUPPORTED
+  unsigned int i;
+#endif
+
+  if (NULL == pool)
+    return;
+  MHD_tls_handshake_pool_stop_ (pool);
+#ifdef HANDSHAKE_THREADS_SUPPORTED
+  for (i = 0; i < pool->num_threads; i++)
+    thread_cleanup (&pool->threads[i]);
+  free (pool->threads);
+#endif
+  free (pool);
+}
+
+
+/**
+ * Have a thread of the pool run the TLS handshake of a new
+ * connection.  The connection must be in the list of suspended
+ * connections of its daemon; it is resumed once the handshake
+ * completed (in state #MHD_CONNECTION_INIT) or failed (in state
+ * #MHD_CONNECTION_CLOSED).
+ *
+ * @param pool the pool
+ * @param connection connection in state #MHD_TLS_CONNECTION_INIT
+ */
+void
+MHD_tls_handshake_submit_ (struct MHD_TlsHandshakePool *pool,
+                           struct MHD_Connection *connection)
+{
+#ifdef HANDSHAKE_THREADS_SUPPORTED
+  struct HandshakeThread *thread;
+  int quit;
+
+  /* like the worker pool, use the socket for load balancing */
+  thread = &pool->threads[connection->socket_fd % pool->num_threads];
+  if (MHD_YES != MHD_mutex_lock_ (&thread->lock))
+    MHD_PANIC ("Failed to acquire handshake mutex\n");
+  quit = thread->quit;
+  if (MHD_YES != quit)
+    XDLL_insert (thread->incoming_head,
+                 thread->incoming_tail,
+                 connection);
+  if (MHD_YES != MHD_mutex_unlock_ (&thread->lock))
+    MHD_PANIC ("Failed to release handshake mutex\n");
+  if (MHD_YES != quit)
+    {
+      (void) MHD_pipe_write_ (thread->wpipe[1], "n", 1);
+      return;
+    }
+  /* the daemon is shutting down */
+  hand_back_closed (connection,
+                    MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN);
+#else
+  MHD_connection_close_ (connection,
+                         MHD_REQUEST_TERMINATED_WITH_ERROR);
+  MHD_resume_connection (connection);
+#endif
+}
@@ -0,0 +1,79 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file tlshandshake.h
+ * @brief  threads running the TLS handshakes of new connections
+ * @author Christian Grothoff
+ */
+
+#ifndef TLSHANDSHAKE_H
+#define TLSHANDSHAKE_H
+
+#include "internal.h"
+
+
+/**
+ * Start the threads of a handshake pool.
+ *
+ * @param daemon daemon the pool is for (used for logging)
+ * @param num_threads number of threads to start
+ * @return NULL on error
+ */
+struct MHD_TlsHandshakePool *
+MHD_tls_handshake_pool_create_ (struct MHD_Daemon *daemon,
+                                unsigned int num_threads);
+
+
+/**
+ * Stop the threads of a handshake pool.  Connections that did not
+ * finish their handshake yet, and all connections submitted from now
+ * on, are handed back closed.
+ *
+ * @param pool pool to stop, may be NULL
+ */
+void
+MHD_tls_handshake_pool_stop_ (struct MHD_TlsHandshakePool *pool);
+
+
+/**
+ * Stop the threads of a handshake pool (if that did not happen yet)
+ * and release it.
+ *
+ * @param pool pool to destroy, may be NULL
+ */
+void
+MHD_tls_handshake_pool_destroy_ (struct MHD_TlsHandshakePool *pool);
+
+
+/**
+ * Have a thread of the pool run the TLS handshake of a new
+ * connection.  The connection must be in the list of suspended
+ * connections of its daemon; it is resumed once the handshake
+ * completed (in state #MHD_CONNECTION_INIT) or failed (in state
+ * #MHD_CONNECTION_CLOSED).
+ *
+ * @param pool the pool
+ * @param connection connection in state #MHD_TLS_CONNECTION_INIT
+ */
+void
+MHD_tls_handshake_submit_ (struct MHD_TlsHandshakePool *pool,
+                           struct MHD_Connection *connection);
+
+#endif
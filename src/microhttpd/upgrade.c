@@ -0,0 +1,527 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file upgrade.c
+ * @brief handing connections over to other protocols after
+ *        an upgrade response
+ * @author Christian Grothoff
+ *
+ * For HTTP, the application gets the socket of the connection
+ * itself, and the connection is suspended until the application
+ * closes it.  For HTTPS, the application gets one end of a socket
+ * pair; the connection stays in the event loop, which decrypts data
+ * from the client into the read buffer and passes it to the other
+ * end of the pair, and encrypts data read from the pair out of the
+ * write buffer.
+ */
+
+#include "internal.h"
+#include "connection.h"
+#include "memorypool.h"
+#include "upgrade.h"
+#include "websocket.h"
+#if HTTPS_SUPPORT
+#include "tls.h"
+#endif
+
+
+/**
+ * Enable or disable CORKing on a TCP socket.
+ *
+ * @param sock socket to manipulate
+ * @param on #MHD_YES to cork, #MHD_NO to uncork (and flush)
+ * @return #MHD_YES on success, #MHD_NO if not supported
+ */
+static int
+socket_cork (MHD_socket sock,
+             int on)
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+  const _MHD_SOCKOPT_BOOL_TYPE val = (MHD_YES == on) ? 1 : 0;
+#if !defined(TCP_CORK)
+  const int dummy = 0;
+#endif /* !TCP_CORK */
+
+#if defined(TCP_CORK)
+  return (0 == setsockopt (sock, IPPROTO_TCP, TCP_CORK, (const void*)&val,
+                           sizeof (val))) ? MHD_YES : MHD_NO;
+#else  /* TCP_NOPUSH */
+  if (0 != setsockopt (sock, IPPROTO_TCP, TCP_NOPUSH, (const void*)&val,
+                       sizeof (val)))
+    return MHD_NO;
+  /* Disabling TCP_NOPUSH does not flush on all platforms */
+  if (MHD_NO == on)
+    (void) send (sock, (const void*)&dummy, 0, 0);
+  return MHD_YES;
+#endif /* TCP_NOPUSH */
+#else  /* !TCP_CORK && !TCP_NOPUSH */
+  return MHD_NO;
+#endif /* !TCP_CORK && !TCP_NOPUSH */
+}
+
+
+/**
+ * Perform an action on the socket of an upgraded connection.
+ * Implements #MHD_UpgradeActionCallback.
+ *
+ * @param cls the `struct MHD_UpgradeResponseHandle`
+ * @param action which action should be performed
+ * @param ... arguments to the action (depends on the action)
+ * @return #MHD_NO on error, #MHD_YES on success
+ */
+static int
+upgrade_action (void *cls,
+                enum MHD_UpgradeAction action,
+                ...)
+{
+  struct MHD_UpgradeResponseHandle *urh = cls;
+  struct MHD_Connection *connection = urh->connection;
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  switch (action)
+    {
+    case MHD_UPGRADE_ACTION_CLOSE:
+      if (MHD_YES == urh->was_closed)
+        return MHD_NO;
+      if (MHD_INVALID_SOCKET == urh->mhd_sock)
+        {
+          /* the connection was suspended, let the event loop
+             finish it; 'urh' may be gone once we resumed */
+          urh->was_closed = MHD_YES;
+          MHD_resume_connection (connection);
+          return MHD_YES;
+        }
+      /* the event loop still passes the remaining data to the client
+         and then closes the connection; the pipe makes it notice */
+      if (0 != MHD_socket_close_ (urh->app_sock))
+        MHD_PANIC ("close failed\n");
+      urh->app_sock = MHD_INVALID_SOCKET;
+      urh->was_closed = MHD_YES;
+      if ( (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
+           (1 != MHD_pipe_write_ (daemon->wpipe[1], "u", 1)) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "failed to signal close of upgraded connection via pipe");
+#endif
+        }
+      return MHD_YES;
+    case MHD_UPGRADE_ACTION_CORK:
+      return socket_cork (connection->socket_fd, MHD_YES);
+    case MHD_UPGRADE_ACTION_UNCORK:
+      return socket_cork (connection->socket_fd, MHD_NO);
+    default:
+      return MHD_NO;
+    }
+}
+
+
+/**
+ * Use the whole memory pool of an upgraded connection for buffering,
+ * as the request is gone now: half of the pool becomes the read
+ * buffer (keeping the data that was read beyond the request) and
+ * half the write buffer.
+ *
+ * @param connection the upgraded connection
+ */
+static void
+reset_buffers (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  size_t half;
+
+  /* the halves are kept aligned so that both fit into the pool */
+  half = (daemon->pool_size / 2) & ~((size_t) 63);
+  if (connection->read_buffer_offset > half)
+    connection->read_buffer_offset = half;
+  connection->read_buffer = MHD_pool_reset (connection->pool,
+                                            connection->read_buffer,
+                                            connection->read_buffer_offset,
+                                            half);
+  connection->read_buffer_size = (NULL == connection->read_buffer) ? 0 : half;
+  connection->write_buffer = MHD_pool_allocate (connection->pool,
+                                                half,
+                                                MHD_YES);
+  connection->write_buffer_size = (NULL == connection->write_buffer) ? 0 : half;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = 0;
+  connection->headers_received = NULL;
+  connection->headers_received_tail = NULL;
+  connection->method = NULL;
+  connection->url = NULL;
+  connection->version = NULL;
+}
+
+
+#if HTTPS_SUPPORT
+/**
+ * Read data from the client into the read buffer of an upgraded
+ * HTTPS connection.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES
+ */
+static int
+upgrade_tls_handle_read (struct MHD_Connection *connection)
+{
+  struct MHD_UpgradeResponseHandle *urh = connection->urh;
+  ssize_t ret;
+  int err;
+
+  if ( (MHD_CONNECTION_UPGRADE != connection->state) ||
+       (MHD_YES == urh->client_eof) ||
+       (connection->read_buffer_offset == connection->read_buffer_size) )
+    return MHD_YES;
+  ret = connection->recv_cls (connection,
+                              &connection->read_buffer
+                              [connection->read_buffer_offset],
+                              connection->read_buffer_size -
+                              connection->read_buffer_offset);
+  if (0 < ret)
+    {
+      connection->read_buffer_offset += ret;
+      return MHD_YES;
+    }
+  err = MHD_socket_errno_;
+  if ( (0 > ret) &&
+       ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) ) )
+    return MHD_YES;
+  /* client closed the TLS session or it failed */
+  urh->client_eof = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Send data from the write buffer of an upgraded HTTPS connection
+ * to the client.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES
+ */
+static int
+upgrade_tls_handle_write (struct MHD_Connection *connection)
+{
+  struct MHD_UpgradeResponseHandle *urh = connection->urh;
+  ssize_t ret;
+  int err;
+
+  if ( (MHD_CONNECTION_UPGRADE != connection->state) ||
+       (connection->write_buffer_send_offset ==
+        connection->write_buffer_append_offset) )
+    return MHD_YES;
+  ret = connection->send_cls (connection,
+                              &connection->write_buffer
+                              [connection->write_buffer_send_offset],
+                              connection->write_buffer_append_offset -
+                              connection->write_buffer_send_offset);
+  if (0 < ret)
+    {
+      connection->write_buffer_send_offset += ret;
+      if (connection->write_buffer_send_offset ==
+          connection->write_buffer_append_offset)
+        {
+          connection->write_buffer_send_offset = 0;
+          connection->write_buffer_append_offset = 0;
+        }
+      return MHD_YES;
+    }
+  err = MHD_socket_errno_;
+  if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+    return MHD_YES;
+  /* client is gone, nothing more can be delivered */
+  urh->client_eof = MHD_YES;
+  urh->tls_failed = MHD_YES;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = 0;
+  return MHD_YES;
+}
+
+
+/**
+ * Pass data between the buffers of an upgraded HTTPS connection
+ * and the application's socket, and close the connection once both
+ * sides are done.
+ *
+ * @param connection connection to handle
+ * @return #MHD_YES if we should continue to process the
+ *         connection (not dead yet), #MHD_NO if it died
+ */
+static int
+upgrade_tls_handle_idle (struct MHD_Connection *connection)
+{
+  struct MHD_UpgradeResponseHandle *urh = connection->urh;
+  ssize_t ret;
+  int err;
+
+  if (MHD_CONNECTION_UPGRADE != connection->state)
+    {
+      /* closed by the daemon (shutdown) */
+      MHD_tls_bye_ (connection, MHD_TRANSPORT_SHUTDOWN_BOTH);
+      return MHD_connection_handle_idle (connection);
+    }
+  connection->in_idle = MHD_YES;
+  if (0 != MHD_tls_pending_ (connection))
+    upgrade_tls_handle_read (connection);
+
+  /* pass data from the client on to the application */
+  if (0 != connection->read_buffer_offset)
+    {
+      ret = send (urh->mhd_sock,
+                  connection->read_buffer,
+                  connection->read_buffer_offset,
+                  MSG_NOSIGNAL);
+      if (0 < ret)
+        {
+          memmove (connection->read_buffer,
+                   &connection->read_buffer[ret],
+                   connection->read_buffer_offset - ret);
+          connection->read_buffer_offset -= ret;
+        }
+      else
+        {
+          err = MHD_socket_errno_;
+          if ( (EINTR != err) && (EAGAIN != err) && (EWOULDBLOCK != err) )
+            connection->read_buffer_offset = 0; /* application stopped reading */
+        }
+    }
+  if ( (MHD_YES == urh->client_eof) &&
+       (0 == connection->read_buffer_offset) &&
+       (MHD_NO == urh->app_shut) )
+    {
+      /* signal EOF to the application */
+      (void) shutdown (urh->mhd_sock, SHUT_WR);
+      urh->app_shut = MHD_YES;
+    }
+  /* do not wait for the client to send more once it stopped */
+  if (MHD_YES == urh->client_eof)
+    connection->read_buffer_size = connection->read_buffer_offset;
+
+  /* read what the application wants to send to the client */
+  if ( (MHD_NO == urh->app_eof) &&
+       (connection->write_buffer_append_offset <
+        connection->write_buffer_size) )
+    {
+      ret = recv (urh->mhd_sock,
+                  &connection->write_buffer
+                  [connection->write_buffer_append_offset],
+                  connection->write_buffer_size -
+                  connection->write_buffer_append_offset,
+                  0);
+      if (0 < ret)
+        {
+          if (MHD_NO == urh->tls_failed)
+            connection->write_buffer_append_offset += ret;
+        }
+      else
+        {
+          err = MHD_socket_errno_;
+          if ( (0 == ret) ||
+               ( (EINTR != err) && (EAGAIN != err) && (EWOULDBLOCK != err) ) )
+            urh->app_eof = MHD_YES;
+        }
+    }
+  /* try to send right away instead of waiting for the next round */
+  upgrade_tls_handle_write (connection);
+
+  if ( (MHD_YES == urh->was_closed) &&
+       ( (MHD_YES == urh->tls_failed) ||
+         ( (MHD_YES == urh->app_eof) &&
+           (connection->write_buffer_send_offset ==
+            connection->write_buffer_append_offset) ) ) )
+    {
+      if (MHD_NO == urh->tls_failed)
+        MHD_tls_bye_ (connection, MHD_TRANSPORT_SHUTDOWN_WRITE);
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_COMPLETED_OK);
+      return MHD_connection_handle_idle (connection);
+    }
+
+  urh->app_read_wanted = ( (MHD_NO == urh->app_eof) &&
+                           (connection->write_buffer_append_offset <
+                            connection->write_buffer_size) );
+  urh->app_write_wanted = (0 != connection->read_buffer_offset);
+  if (connection->write_buffer_send_offset !=
+      connection->write_buffer_append_offset)
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+  else if (connection->read_buffer_offset < connection->read_buffer_size)
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+  else
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+  connection->in_idle = MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Set up the socket pair and the buffers for passing data between
+ * the TLS session of an upgraded connection and the application.
+ *
+ * @param connection the connection to upgrade
+ * @param urh upgrade state to initialize
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+static int
+upgrade_tls_init (struct MHD_Connection *connection,
+                  struct MHD_UpgradeResponseHandle *urh)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  MHD_socket sv[2];
+
+  if (0 != MHD_socket_pair_ (sv))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to create socket pair for upgraded connection: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_NO;
+    }
+  if (MHD_YES != MHD_socket_nonblocking_ (daemon, sv[1]))
+    {
+      if ( (0 != MHD_socket_close_ (sv[0])) ||
+           (0 != MHD_socket_close_ (sv[1])) )
+        MHD_PANIC ("close failed\n");
+      return MHD_NO;
+    }
+  urh->app_sock = sv[0];
+  urh->mhd_sock = sv[1];
+  urh->app_read_wanted = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Switch an upgraded HTTPS connection to passing data between the
+ * TLS session and the application, once the application has seen
+ * the request.
+ *
+ * @param connection the upgraded connection
+ */
+static void
+upgrade_tls_start (struct MHD_Connection *connection)
+{
+  reset_buffers (connection);
+  connection->read_handler = &upgrade_tls_handle_read;
+  connection->write_handler = &upgrade_tls_handle_write;
+  connection->idle_handler = &upgrade_tls_handle_idle;
+}
+#endif
+
+
+/**
+ * Hand the connection over to the upgrade handler of its response.
+ * Called once the header of the upgrade response was sent and the
+ * connection was moved to #MHD_CONNECTION_UPGRADE.
+ *
+ * @param connection the connection to upgrade
+ * @return #MHD_YES on success, #MHD_NO on failure (the handler
+ *         was not called and the connection should be closed)
+ */
+int
+MHD_upgrade_connection_ (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+  struct MHD_UpgradeResponseHandle *urh;
+  MHD_socket sock;
+
+  if (NULL != response->ws_message_cb)
+    {
+      /* WebSockets stay in the event loop */
+      reset_buffers (connection);
+      return MHD_websocket_start_ (connection);
+    }
+  if ( (NULL != connection->transport.recv) &&
+       (0 == (connection->daemon->options & MHD_USE_SSL)) )
+    {
+      /* there is no socket to hand to the application */
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Cannot upgrade connection of a custom transport\n");
+#endif
+      return MHD_NO;
+    }
+  urh = malloc (sizeof (struct MHD_UpgradeResponseHandle));
+  if (NULL == urh)
+    return MHD_NO;
+  memset (urh, 0, sizeof (struct MHD_UpgradeResponseHandle));
+  urh->connection = connection;
+  urh->mhd_sock = MHD_INVALID_SOCKET;
+  urh->app_sock = MHD_INVALID_SOCKET;
+  sock = connection->socket_fd;
+#if HTTPS_SUPPORT
+  if (0 != (connection->daemon->options & MHD_USE_SSL))
+    {
+      if (MHD_YES != upgrade_tls_init (connection, urh))
+        {
+          free (urh);
+          return MHD_NO;
+        }
+      sock = urh->app_sock;
+    }
+#endif
+  connection->urh = urh;
+  /* the application decides how long the connection lives */
+  MHD_set_connection_option (connection,
+                             MHD_CONNECTION_OPTION_TIMEOUT,
+                             0);
+  if (MHD_INVALID_SOCKET == urh->mhd_sock)
+    MHD_suspend_connection (connection);
+  response->upgrade_handler (response->upgrade_handler_cls,
+                             connection,
+                             connection->client_context,
+                             connection->read_buffer,
+                             connection->read_buffer_offset,
+                             sock,
+                             &upgrade_action,
+                             urh);
+  connection->read_buffer_offset = 0;
+#if HTTPS_SUPPORT
+  if (MHD_INVALID_SOCKET != urh->mhd_sock)
+    upgrade_tls_start (connection);
+#endif
+  return MHD_YES;
+}
+
+
+/**
+ * Release the upgrade state of a connection that is being
+ * destroyed.
+ *
+ * @param connection the connection to clean up
+ */
+void
+MHD_upgrade_cleanup_ (struct MHD_Connection *connection)
+{
+  struct MHD_UpgradeResponseHandle *urh = connection->urh;
+
+  if (NULL == urh)
+    return;
+  if ( (MHD_INVALID_SOCKET != urh->mhd_sock) &&
+       (0 != MHD_socket_close_ (urh->mhd_sock)) )
+    MHD_PANIC ("close failed\n");
+  if ( (MHD_INVALID_SOCKET != urh->app_sock) &&
+       (0 != MHD_socket_close_ (urh->app_sock)) )
+    MHD_PANIC ("close failed\n");
+  free (urh);
+  connection->urh = NULL;
+}
+
+/* end of upgrade.c */
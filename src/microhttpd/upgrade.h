@@ -0,0 +1,60 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file upgrade.h
+ * @brief  handing connections over to other protocols after
+ *         an upgrade response
+ * @author Christian Grothoff
+ */
+
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include "internal.h"
+
+
+/**
+ * Hand the connection over to the upgrade handler of its response.
+ * Called once the header of the upgrade response was sent and the
+ * connection was moved to #MHD_CONNECTION_UPGRADE.
+ *
+ * For HTTP, the connection is suspended until the application
+ * closes the socket.  For HTTPS, the connection remains in the
+ * event loop and passes data between the TLS session and the
+ * socket pair given to the application.
+ *
+ * @param connection the connection to upgrade
+ * @return #MHD_YES on success, #MHD_NO on failure (the handler
+ *         was not called and the connection should be closed)
+ */
+int
+MHD_upgrade_connection_ (struct MHD_Connection *connection);
+
+
+/**
+ * Release the upgrade state of a connection that is being
+ * destroyed.
+ *
+ * @param connection the connection to clean up
+ */
+void
+MHD_upgrade_cleanup_ (struct MHD_Connection *connection);
+
+#endif
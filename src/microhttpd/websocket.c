@@ -0,0 +1,1540 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file websocket.c
+ * @brief WebSockets (RFC 6455) handled in the event loop of the daemon
+ * @author Christian Grothoff
+ *
+ * After the handshake response was sent, the connection keeps its
+ * socket and its memory pool: half of the pool becomes the read
+ * buffer and half the write buffer, and the handlers of the
+ * connection are replaced by the ones in this file.
+ *
+ * Frames from the client are unmasked in place, a machine word at a
+ * time, and unfragmented messages are passed to the application
+ * straight out of the read buffer.  The payloads of fragmented
+ * messages are moved together at the start of the read buffer until
+ * the message is complete.
+ *
+ * Frames to the client are built once into reference counted buffers
+ * that may be queued on any number of WebSockets.  The event loop
+ * copies as many queued frames as fit into the write buffer of the
+ * connection, so that many small frames are passed to the OS with a
+ * single system call.  Frames queued from other threads put the
+ * WebSocket into a list of the daemon and signal the event loop via
+ * its pipe.
+ */
+
+#include "internal.h"
+#include "connection.h"
+#include "memorypool.h"
+#include "mhd_mono_clock.h"
+#include "mhd_str.h"
+#include "sha1.h"
+#include "websocket.h"
+#if HTTPS_SUPPORT
+#include "tls.h"
+#endif
+
+
+/**
+ * GUID appended to the key of the client to compute the value of
+ * the "Sec-WebSocket-Accept" header.
+ */
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/**
+ * Maximum size of the payload of a control frame.
+ */
+#define MAX_CONTROL_SIZE 125
+
+/**
+ * Initial number of entries in the queue of a WebSocket.
+ */
+#define INITIAL_QUEUE_SIZE 16
+
+
+/**
+ * Frame to be sent to clients, shared by all WebSockets it is
+ * queued on.
+ */
+struct MHD_WebSocketFrame
+{
+
+  /**
+   * Header and payload of the frame, allocated at the end of
+   * this struct.
+   */
+  char *data;
+
+  /**
+   * Number of bytes in @e data.
+   */
+  size_t size;
+
+  /**
+   * Mutex protecting @e rc.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * Reference counter (held by the application until it destroys
+   * the frame and by each WebSocket that has it queued).
+   */
+  unsigned int rc;
+
+};
+
+
+/**
+ * WebSocket handled in the event loop of a daemon.
+ */
+struct MHD_WebSocket
+{
+
+  /**
+   * WebSockets with frames queued from outside of the event loop
+   * are kept in a DLL of the daemon.
+   */
+  struct MHD_WebSocket *next;
+
+  /**
+   * WebSockets with frames queued from outside of the event loop
+   * are kept in a DLL of the daemon.
+   */
+  struct MHD_WebSocket *prev;
+
+  /**
+   * Connection of the WebSocket.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * Function to call for each message.
+   */
+  MHD_WebSocketMessageCallback message_cb;
+
+  /**
+   * Function to call once the WebSocket is closed.
+   */
+  MHD_WebSocketCloseCallback close_cb;
+
+  /**
+   * Closure for the callbacks.
+   */
+  void *cls;
+
+  /**
+   * Mutex protecting the queue and @e close_sent.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * Ring buffer of frames to be sent.
+   */
+  struct MHD_WebSocketFrame **queue;
+
+  /**
+   * Index of the first frame in @e queue.
+   */
+  unsigned int queue_head;
+
+  /**
+   * Number of frames in @e queue.
+   */
+  unsigned int queue_len;
+
+  /**
+   * Number of entries allocated for @e queue.
+   */
+  unsigned int queue_size;
+
+  /**
+   * Number of bytes of the first frame in @e queue that were
+   * already copied to the write buffer.
+   */
+  size_t queue_offset;
+
+  /**
+   * Number of bytes in @e queue that were not yet copied to the
+   * write buffer.
+   */
+  size_t pending;
+
+  /**
+   * Number of bytes of the fragmented message being received that
+   * are at the start of the read buffer.
+   */
+  size_t msg_size;
+
+  /**
+   * Type of the fragmented message being received,
+   * #MHD_WEBSOCKET_OPCODE_CONTINUATION if there is none.
+   */
+  enum MHD_WebSocketOpcode msg_opcode;
+
+  /**
+   * When did we send the last keepalive ping that was not yet
+   * answered (0 for none)?
+   */
+  time_t ping_sent;
+
+  /**
+   * Close status to report to the application.
+   */
+  unsigned short status;
+
+  /**
+   * #MHD_YES once a close frame was queued, no more frames may be
+   * queued after it.
+   */
+  int close_sent;
+
+  /**
+   * #MHD_YES once the client sent a close frame (or misbehaved, or
+   * the connection failed); no more frames are read.
+   */
+  int close_received;
+
+  /**
+   * #MHD_YES if the connection should be closed without waiting for
+   * the closing handshake to complete (once the queue was sent).
+   */
+  int abort;
+
+  /**
+   * #MHD_YES if the WebSocket is in the list of the daemon (protected
+   * by the daemon's `cleanup_connection_mutex`).
+   */
+  int in_wakeup;
+
+  /**
+   * #MHD_YES once the application was told that the WebSocket is
+   * closed.
+   */
+  int notified;
+
+};
+
+
+/**
+ * Encode @a size bytes of @a data in base64 (with padding).
+ *
+ * @param data data to encode
+ * @param size number of bytes in @a data
+ * @param out where to write the result, must have room for
+ *        4 * ((size + 2) / 3) + 1 characters
+ */
+static void
+base64_encode (const unsigned char *data,
+               size_t size,
+               char *out)
+{
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint32_t v;
+  size_t i;
+
+  for (i = 0; i + 2 < size; i += 3)
+    {
+      v = ((uint32_t) data[i] << 16) | ((uint32_t) data[i + 1] << 8) | data[i + 2];
+      *out++ = alphabet[(v >> 18) & 63];
+      *out++ = alphabet[(v >> 12) & 63];
+      *out++ = alphabet[(v >> 6) & 63];
+      *out++ = alphabet[v & 63];
+    }
+  if (i < size)
+    {
+      v = (uint32_t) data[i] << 16;
+      if (i + 1 < size)
+        v |= (uint32_t) data[i + 1] << 8;
+      *out++ = alphabet[(v >> 18) & 63];
+      *out++ = alphabet[(v >> 12) & 63];
+      *out++ = (i + 1 < size) ? alphabet[(v >> 6) & 63] : '=';
+      *out++ = '=';
+    }
+  *out = '\0';
+}
+
+
+/**
+ * Unmask the payload of a frame from the client in place.  The
+ * payload is processed a machine word at a time; only the bytes
+ * before the first aligned word and after the last full word are
+ * handled one by one.
+ *
+ * @param data payload to unmask
+ * @param size number of bytes in @a data
+ * @param mask masking key of the frame
+ */
+static void
+unmask (char *data,
+        size_t size,
+        const char mask[4])
+{
+  uint8_t pattern[sizeof (uint64_t)];
+  uint64_t word;
+  uint64_t mask_word;
+  size_t i;
+  size_t j;
+
+  i = 0;
+  while ( (i < size) &&
+          (0 != ((uintptr_t) &data[i] % sizeof (uint64_t))) )
+    {
+      data[i] ^= mask[i & 3];
+      i++;
+    }
+  if (i + sizeof (uint64_t) <= size)
+    {
+      /* the key repeats every 4 bytes, so the same word (rotated to
+         the current position) applies to all words */
+      for (j = 0; j < sizeof (uint64_t); j++)
+        pattern[j] = (uint8_t) mask[(i + j) & 3];
+      memcpy (&mask_word, pattern, sizeof (uint64_t));
+      for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+        {
+          memcpy (&word, &data[i], sizeof (uint64_t));
+          word ^= mask_word;
+          memcpy (&data[i], &word, sizeof (uint64_t));
+        }
+    }
+  for (; i < size; i++)
+    data[i] ^= mask[i & 3];
+}
+
+
+/**
+ * Build a frame from the server (which is never masked).
+ *
+ * @param opcode type of the frame
+ * @param data payload of the frame
+ * @param size number of bytes in @a data
+ * @return NULL on error
+ */
+static struct MHD_WebSocketFrame *
+build_frame (enum MHD_WebSocketOpcode opcode,
+             const char *data,
+             size_t size)
+{
+  struct MHD_WebSocketFrame *frame;
+  size_t hsize;
+  char *pos;
+  unsigned int i;
+
+  if (size <= MAX_CONTROL_SIZE)
+    hsize = 2;
+  else if (size <= 0xFFFF)
+    hsize = 4;
+  else
+    hsize = 10;
+  if (size > SIZE_MAX - sizeof (struct MHD_WebSocketFrame) - hsize)
+    return NULL;
+  frame = malloc (sizeof (struct MHD_WebSocketFrame) + hsize + size);
+  if (NULL == frame)
+    return NULL;
+  if (MHD_YES != MHD_mutex_create_ (&frame->mutex))
+    {
+      free (frame);
+      return NULL;
+    }
+  frame->data = (char *) &frame[1];
+  frame->size = hsize + size;
+  frame->rc = 1;
+  pos = frame->data;
+  *pos++ = (char) (0x80 | opcode);
+  if (2 == hsize)
+    {
+      *pos++ = (char) size;
+    }
+  else if (4 == hsize)
+    {
+      *pos++ = 126;
+      *pos++ = (char) (size >> 8);
+      *pos++ = (char) size;
+    }
+  else
+    {
+      *pos++ = 127;
+      for (i = 0; i < 8; i++)
+        *pos++ = (char) ((uint64_t) size >> (56 - 8 * i));
+    }
+  if (0 != size)
+    memcpy (pos, data, size);
+  return frame;
+}
+
+
+/**
+ * Drop a reference to a frame, freeing it if it was the last one.
+ *
+ * @param frame frame to release
+ */
+static void
+frame_release (struct MHD_WebSocketFrame *frame)
+{
+  unsigned int rc;
+
+  (void) MHD_mutex_lock_ (&frame->mutex);
+  rc = --frame->rc;
+  (void) MHD_mutex_unlock_ (&frame->mutex);
+  if (0 != rc)
+    return;
+  (void) MHD_mutex_destroy_ (&frame->mutex);
+  free (frame);
+}
+
+
+/**
+ * Make sure the event loop of the daemon looks at the connection of
+ * @a ws, as frames were queued for it.
+ *
+ * @param ws WebSocket with new frames
+ */
+static void
+wakeup (struct MHD_WebSocket *ws)
+{
+  struct MHD_Daemon *daemon = ws->connection->daemon;
+  int signal;
+
+  signal = MHD_NO;
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_NO == ws->in_wakeup)
+    {
+      /* signal only once per round of the event loop */
+      signal = (NULL == daemon->ws_wakeup_head);
+      DLL_insert (daemon->ws_wakeup_head,
+                  daemon->ws_wakeup_tail,
+                  ws);
+      ws->in_wakeup = MHD_YES;
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  if ( (signal) &&
+       (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
+       (1 != MHD_pipe_write_ (daemon->wpipe[1], "w", 1)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "failed to signal WebSocket data via pipe");
+#endif
+    }
+}
+
+
+/**
+ * Append a frame to the queue of a WebSocket.  The caller must hold
+ * the mutex of @a ws.
+ *
+ * @param ws WebSocket to queue the frame for
+ * @param frame frame to queue, a reference is taken
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+static int
+queue_frame (struct MHD_WebSocket *ws,
+             struct MHD_WebSocketFrame *frame)
+{
+  struct MHD_WebSocketFrame **queue;
+  unsigned int size;
+  unsigned int i;
+
+  if (ws->queue_len == ws->queue_size)
+    {
+      size = (0 == ws->queue_size) ? INITIAL_QUEUE_SIZE : 2 * ws->queue_size;
+      if (size <= ws->queue_size)
+        return MHD_NO;
+      queue = malloc (size * sizeof (struct MHD_WebSocketFrame *));
+      if (NULL == queue)
+        return MHD_NO;
+      for (i = 0; i < ws->queue_len; i++)
+        queue[i] = ws->queue[(ws->queue_head + i) % ws->queue_size];
+      free (ws->queue);
+      ws->queue = queue;
+      ws->queue_size = size;
+      ws->queue_head = 0;
+    }
+  ws->queue[(ws->queue_head + ws->queue_len) % ws->queue_size] = frame;
+  ws->queue_len++;
+  ws->pending += frame->size;
+  (void) MHD_mutex_lock_ (&frame->mutex);
+  frame->rc++;
+  (void) MHD_mutex_unlock_ (&frame->mutex);
+  return MHD_YES;
+}
+
+
+/**
+ * Build and queue a control frame.  The caller must hold the mutex
+ * of @a ws.  Control frames are not subject to the limit on pending
+ * data.
+ *
+ * @param ws WebSocket to queue the frame for
+ * @param opcode type of the frame
+ * @param data payload of the frame
+ * @param size number of bytes in @a data, at most #MAX_CONTROL_SIZE
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+static int
+queue_control (struct MHD_WebSocket *ws,
+               enum MHD_WebSocketOpcode opcode,
+               const char *data,
+               size_t size)
+{
+  struct MHD_WebSocketFrame *frame;
+  int ret;
+
+  frame = build_frame (opcode, data, size);
+  if (NULL == frame)
+    return MHD_NO;
+  ret = queue_frame (ws, frame);
+  frame_release (frame);
+  return ret;
+}
+
+
+/**
+ * Queue a close frame, unless one was queued already.  The caller
+ * must hold the mutex of @a ws.
+ *
+ * @param ws WebSocket to close
+ * @param status status to send, #MHD_WEBSOCKET_CLOSE_NO_STATUS to
+ *        send a close frame without status
+ * @return #MHD_YES on success, #MHD_NO if a close frame was queued
+ *         already
+ */
+static int
+queue_close (struct MHD_WebSocket *ws,
+             unsigned short status)
+{
+  char payload[2];
+
+  if (MHD_YES == ws->close_sent)
+    return MHD_NO;
+  ws->close_sent = MHD_YES;
+  payload[0] = (char) (status >> 8);
+  payload[1] = (char) status;
+  if (MHD_YES != queue_control (ws,
+                                MHD_WEBSOCKET_OPCODE_CLOSE,
+                                payload,
+                                (MHD_WEBSOCKET_CLOSE_NO_STATUS == status) ? 0 : 2))
+    ws->abort = MHD_YES; /* out of memory, just close */
+  return MHD_YES;
+}
+
+
+/**
+ * The client violated the protocol (or sent a message that is too
+ * large): queue a close frame with @a status and close the
+ * connection once it was sent.
+ *
+ * @param ws WebSocket to fail
+ * @param status status to send
+ */
+static void
+fail (struct MHD_WebSocket *ws,
+      unsigned short status)
+{
+  (void) MHD_mutex_lock_ (&ws->mutex);
+  if (MHD_NO == ws->close_sent)
+    ws->status = status;
+  queue_close (ws, status);
+  (void) MHD_mutex_unlock_ (&ws->mutex);
+  ws->close_received = MHD_YES;
+  ws->abort = MHD_YES;
+}
+
+
+/**
+ * Check whether @a data is valid UTF-8 (RFC 3629): no overlong
+ * encodings, no surrogates and no code points above U+10FFFF.
+ *
+ * @param data data to check
+ * @param size number of bytes in @a data
+ * @return #MHD_YES if @a data is valid UTF-8
+ */
+static int
+utf8_valid (const char *data,
+            size_t size)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  const uint8_t *end = p + size;
+  uint8_t lo;
+  uint8_t hi;
+  unsigned int n;
+
+  while (p < end)
+    {
+      if (*p < 0x80)
+        {
+          p++;
+          continue;
+        }
+      /* range allowed for the second byte, number of bytes following */
+      lo = 0x80;
+      hi = 0xBF;
+      if ( (*p >= 0xC2) && (*p <= 0xDF) )
+        n = 1;
+      else if (*p <= 0xEF)
+        {
+          if (*p < 0xE0)
+            return MHD_NO;
+          n = 2;
+          if (0xE0 == *p)
+            lo = 0xA0; /* overlong */
+          else if (0xED == *p)
+            hi = 0x9F; /* surrogates */
+        }
+      else if (*p <= 0xF4)
+        {
+          n = 3;
+          if (0xF0 == *p)
+            lo = 0x90; /* overlong */
+          else if (0xF4 == *p)
+            hi = 0x8F; /* above U+10FFFF */
+        }
+      else
+        return MHD_NO;
+      if ((size_t) (end - p) <= n)
+        return MHD_NO;
+      p++;
+      if ( (*p < lo) || (*p > hi) )
+        return MHD_NO;
+      p++;
+      while (--n > 0)
+        {
+          if ( (*p < 0x80) || (*p > 0xBF) )
+            return MHD_NO;
+          p++;
+        }
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Check whether the client may send @a status in a close frame
+ * (RFC 6455, sections 7.4.1 and 7.4.2).
+ *
+ * @param status status received
+ * @return #MHD_YES if @a status is valid
+ */
+static int
+close_status_valid (unsigned short status)
+{
+  if ( (status >= 3000) &&
+       (status <= 4999) )
+    return MHD_YES; /* registered or private use */
+  if ( (status < MHD_WEBSOCKET_CLOSE_NORMAL) ||
+       (status > 1014) )
+    return MHD_NO;
+  /* reserved and those that must not be sent */
+  return ( (1004 == status) ||
+           (MHD_WEBSOCKET_CLOSE_NO_STATUS == status) ||
+           (MHD_WEBSOCKET_CLOSE_ABNORMAL == status) ) ? MHD_NO : MHD_YES;
+}
+
+
+/**
+ * Pass a complete message to the application, unless it is a text
+ * message that is not valid UTF-8.
+ *
+ * @param ws WebSocket that received the message
+ * @param opcode type of the message
+ * @param payload unmasked payload of the message
+ * @param size number of bytes in @a payload
+ * @return #MHD_YES if the message was delivered, #MHD_NO if the
+ *         WebSocket failed
+ */
+static int
+deliver_message (struct MHD_WebSocket *ws,
+                 enum MHD_WebSocketOpcode opcode,
+                 const char *payload,
+                 size_t size)
+{
+  if ( (MHD_WEBSOCKET_OPCODE_TEXT == opcode) &&
+       (MHD_YES != utf8_valid (payload, size)) )
+    {
+      fail (ws, MHD_WEBSOCKET_CLOSE_INVALID_DATA);
+      return MHD_NO;
+    }
+  ws->message_cb (ws->cls, ws, opcode, payload, size);
+  return MHD_YES;
+}
+
+
+/**
+ * Tell the application that the WebSocket is closed (once).
+ *
+ * @param ws WebSocket that is closed
+ */
+static void
+notify_close (struct MHD_WebSocket *ws)
+{
+  if (MHD_YES == ws->notified)
+    return;
+  ws->notified = MHD_YES;
+  if (NULL != ws->close_cb)
+    ws->close_cb (ws->cls,
+                  ws,
+                  ws->status);
+}
+
+
+/**
+ * Process a control frame from the client.
+ *
+ * @param ws WebSocket that received the frame
+ * @param opcode type of the frame
+ * @param payload unmasked payload of the frame
+ * @param size number of bytes in @a payload
+ */
+static void
+handle_control (struct MHD_WebSocket *ws,
+                enum MHD_WebSocketOpcode opcode,
+                const char *payload,
+                size_t size)
+{
+  unsigned short status;
+
+  switch (opcode)
+    {
+    case MHD_WEBSOCKET_OPCODE_PING:
+      (void) MHD_mutex_lock_ (&ws->mutex);
+      if ( (MHD_NO == ws->close_sent) &&
+           (MHD_YES != queue_control (ws,
+                                      MHD_WEBSOCKET_OPCODE_PONG,
+                                      payload,
+                                      size)) )
+        ws->abort = MHD_YES;
+      (void) MHD_mutex_unlock_ (&ws->mutex);
+      break;
+    case MHD_WEBSOCKET_OPCODE_PONG:
+      ws->ping_sent = 0;
+      break;
+    case MHD_WEBSOCKET_OPCODE_CLOSE:
+      if (1 == size)
+        {
+          fail (ws, MHD_WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+          return;
+        }
+      if (0 == size)
+        status = MHD_WEBSOCKET_CLOSE_NO_STATUS;
+      else
+        {
+          status = (unsigned short) (((uint8_t) payload[0] << 8) | (uint8_t) payload[1]);
+          if (MHD_YES != close_status_valid (status))
+            {
+              fail (ws, MHD_WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+              return;
+            }
+          if (MHD_YES != utf8_valid (&payload[2], size - 2))
+            {
+              fail (ws, MHD_WEBSOCKET_CLOSE_INVALID_DATA);
+              return;
+            }
+        }
+      ws->close_received = MHD_YES;
+      (void) MHD_mutex_lock_ (&ws->mutex);
+      if (MHD_NO == ws->close_sent)
+        {
+          /* echo the status of the client */
+          ws->status = status;
+          queue_close (ws, status);
+        }
+      (void) MHD_mutex_unlock_ (&ws->mutex);
+      break;
+    default:
+      break;
+    }
+}
+
+
+/**
+ * Parse the frames in the read buffer of the connection, passing
+ * complete messages to the application.
+ *
+ * @param ws WebSocket to process
+ */
+static void
+parse_frames (struct MHD_WebSocket *ws)
+{
+  struct MHD_Connection *connection = ws->connection;
+  char *buf = connection->read_buffer;
+  size_t pos;
+  size_t avail;
+  size_t hsize;
+  uint64_t len;
+  char *payload;
+  uint8_t b0;
+  uint8_t b1;
+  enum MHD_WebSocketOpcode opcode;
+  unsigned int i;
+
+  pos = ws->msg_size;
+  while (MHD_NO == ws->close_received)
+    {
+      avail = connection->read_buffer_offset - pos;
+      if (avail < 2)
+        break;
+      b0 = (uint8_t) buf[pos];
+      b1 = (uint8_t) buf[pos + 1];
+      opcode = (enum MHD_WebSocketOpcode) (b0 & 0x0F);
+      if ( (0 != (b0 & 0x70)) ||  /* no extensions were negotiated */
+           (0 == (b1 & 0x80)) )   /* frames from clients must be masked */
+        {
+          fail (ws, MHD_WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+          break;
+        }
+      len = b1 & 0x7F;
+      hsize = 2;
+      if (126 == len)
+        {
+          if (avail < 4)
+            break;
+          len = ((uint64_t) (uint8_t) buf[pos + 2] << 8) | (uint8_t) buf[pos + 3];
+          hsize = 4;
+        }
+      else if (127 == len)
+        {
+          if (avail < 10)
+            break;
+          if (0 != (buf[pos + 2] & 0x80))
+            {
+              /* the most significant bit must be 0 (RFC 6455, 5.2) */
+              fail (ws, MHD_WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+              break;
+            }
+          len = 0;
+          for (i = 0; i < 8; i++)
+            len = (len << 8) | (uint8_t) buf[pos + 2 + i];
+          hsize = 10;
+        }
+      hsize += 4; /* masking key */
+      if (0 != (opcode & 0x08))
+        {
+          /* control frames are short and never fragmented */
+          if ( (len > MAX_CONTROL_SIZE) ||
+               (0 == (b0 & 0x80)) ||
+               ( (MHD_WEBSOCKET_OPCODE_CLOSE != opcode) &&
+                 (MHD_WEBSOCKET_OPCODE_PING != opcode) &&
+                 (MHD_WEBSOCKET_OPCODE_PONG != opcode) ) )
+            {
+              fail (ws, MHD_WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+              break;
+            }
+        }
+      else if ( (opcode > MHD_WEBSOCKET_OPCODE_BINARY) ||
+                ( (MHD_WEBSOCKET_OPCODE_CONTINUATION == opcode) &&
+                  (MHD_WEBSOCKET_OPCODE_CONTINUATION == ws->msg_opcode) ) ||
+                ( (MHD_WEBSOCKET_OPCODE_CONTINUATION != opcode) &&
+                  (MHD_WEBSOCKET_OPCODE_CONTINUATION != ws->msg_opcode) ) )
+        {
+          fail (ws, MHD_WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+          break;
+        }
+      /* once compacted, the frame starts right after the payload of
+         the fragmented message; it must fit into the read buffer */
+      if ( (ws->msg_size + hsize > connection->read_buffer_size) ||
+           (len > connection->read_buffer_size - ws->msg_size - hsize) )
+        {
+          fail (ws, MHD_WEBSOCKET_CLOSE_MESSAGE_TOO_BIG);
+          break;
+        }
+      if ( (avail < hsize) ||
+           (len > avail - hsize) )
+        break; /* wait for the rest of the frame */
+      payload = &buf[pos + hsize];
+      unmask (payload, (size_t) len, &buf[pos + hsize - 4]);
+      pos += hsize + (size_t) len;
+      if (0 != (opcode & 0x08))
+        {
+          handle_control (ws, opcode, payload, (size_t) len);
+          continue;
+        }
+      if ( (0 != (b0 & 0x80)) &&
+           (MHD_WEBSOCKET_OPCODE_CONTINUATION != opcode) )
+        {
+          /* unfragmented message, deliver in place */
+          if (MHD_YES != deliver_message (ws, opcode, payload, (size_t) len))
+            break;
+          continue;
+        }
+      /* fragment, move its payload next to the previous ones */
+      if (payload != &buf[ws->msg_size])
+        memmove (&buf[ws->msg_size], payload, (size_t) len);
+      ws->msg_size += (size_t) len;
+      if (MHD_WEBSOCKET_OPCODE_CONTINUATION != opcode)
+        ws->msg_opcode = opcode;
+      if (0 == (b0 & 0x80))
+        continue;
+      if (MHD_YES != deliver_message (ws, ws->msg_opcode, buf, ws->msg_size))
+        break;
+      ws->msg_size = 0;
+      ws->msg_opcode = MHD_WEBSOCKET_OPCODE_CONTINUATION;
+    }
+  /* keep what was not processed after the fragmented message */
+  if (pos != ws->msg_size)
+    {
+      memmove (&buf[ws->msg_size],
+               &buf[pos],
+               connection->read_buffer_offset - pos);
+      connection->read_buffer_offset -= pos - ws->msg_size;
+    }
+}
+
+
+/**
+ * Copy queued frames into the write buffer of the connection.
+ *
+ * @param ws WebSocket to process
+ */
+static void
+fill_write_buffer (struct MHD_WebSocket *ws)
+{
+  struct MHD_Connection *connection = ws->connection;
+  struct MHD_WebSocketFrame *frame;
+  size_t space;
+  size_t n;
+
+  if (connection->write_buffer_send_offset == connection->write_buffer_append_offset)
+    {
+      connection->write_buffer_send_offset = 0;
+      connection->write_buffer_append_offset = 0;
+    }
+  (void) MHD_mutex_lock_ (&ws->mutex);
+  while ( (0 != ws->queue_len) &&
+          (connection->write_buffer_append_offset < connection->write_buffer_size) )
+    {
+      frame = ws->queue[ws->queue_head];
+      space = connection->write_buffer_size - connection->write_buffer_append_offset;
+      n = frame->size - ws->queue_offset;
+      if (n > space)
+        n = space;
+      memcpy (&connection->write_buffer[connection->write_buffer_append_offset],
+              &frame->data[ws->queue_offset],
+              n);
+      connection->write_buffer_append_offset += n;
+      ws->queue_offset += n;
+      ws->pending -= n;
+      if (ws->queue_offset < frame->size)
+        break;
+      ws->queue_offset = 0;
+      ws->queue_head = (ws->queue_head + 1) % ws->queue_size;
+      ws->queue_len--;
+      frame_release (frame);
+    }
+  (void) MHD_mutex_unlock_ (&ws->mutex);
+}
+
+
+/**
+ * Read frames from the client into the read buffer.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES
+ */
+static int
+websocket_handle_read (struct MHD_Connection *connection)
+{
+  struct MHD_WebSocket *ws = connection->ws;
+  ssize_t ret;
+  int err;
+
+  if ( (MHD_CONNECTION_UPGRADE != connection->state) ||
+       (MHD_YES == ws->close_received) ||
+       (connection->read_buffer_offset == connection->read_buffer_size) )
+    return MHD_YES;
+  ret = connection->recv_cls (connection,
+                              &connection->read_buffer
+                              [connection->read_buffer_offset],
+                              connection->read_buffer_size -
+                              connection->read_buffer_offset);
+  if (0 < ret)
+    {
+      connection->read_buffer_offset += ret;
+      MHD_update_last_activity_ (connection);
+      ws->ping_sent = 0;
+      return MHD_YES;
+    }
+  err = MHD_socket_errno_;
+  if ( (0 > ret) &&
+       ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) ) )
+    return MHD_YES;
+  /* client is gone without closing handshake */
+  if (MHD_NO == ws->close_sent)
+    ws->status = MHD_WEBSOCKET_CLOSE_ABNORMAL;
+  ws->close_received = MHD_YES;
+  ws->abort = MHD_YES;
+  connection->read_closed = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Send the write buffer to the client.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES
+ */
+static int
+websocket_handle_write (struct MHD_Connection *connection)
+{
+  struct MHD_WebSocket *ws = connection->ws;
+  ssize_t ret;
+  int err;
+
+  if ( (MHD_CONNECTION_UPGRADE != connection->state) ||
+       (connection->write_buffer_send_offset ==
+        connection->write_buffer_append_offset) )
+    return MHD_YES;
+  ret = connection->send_cls (connection,
+                              &connection->write_buffer
+                              [connection->write_buffer_send_offset],
+                              connection->write_buffer_append_offset -
+                              connection->write_buffer_send_offset);
+  if (0 < ret)
+    {
+      connection->write_buffer_send_offset += ret;
+      return MHD_YES;
+    }
+  err = MHD_socket_errno_;
+  if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+    return MHD_YES;
+  /* client is gone, nothing more can be delivered */
+  if (MHD_NO == ws->close_sent)
+    ws->status = MHD_WEBSOCKET_CLOSE_ABNORMAL;
+  ws->close_received = MHD_YES;
+  ws->abort = MHD_YES;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = 0;
+  (void) MHD_mutex_lock_ (&ws->mutex);
+  ws->close_sent = MHD_YES; /* refuse further frames */
+  (void) MHD_mutex_unlock_ (&ws->mutex);
+  return MHD_YES;
+}
+
+
+/**
+ * Process the frames received and queued on a WebSocket, send
+ * keepalives, and close the connection once the WebSocket is done.
+ *
+ * @param connection connection to handle
+ * @return #MHD_YES if we should continue to process the
+ *         connection (not dead yet), #MHD_NO if it died
+ */
+static int
+websocket_handle_idle (struct MHD_Connection *connection)
+{
+  struct MHD_WebSocket *ws = connection->ws;
+  struct MHD_Daemon *daemon = connection->daemon;
+  unsigned int interval = daemon->websocket_ping_interval;
+  time_t now;
+  int flushed;
+
+  if (MHD_CONNECTION_UPGRADE != connection->state)
+    {
+      /* closed by the daemon (shutdown) */
+      if (MHD_NO == ws->notified)
+        ws->status = MHD_WEBSOCKET_CLOSE_GOING_AWAY;
+      notify_close (ws);
+      return MHD_connection_handle_idle (connection);
+    }
+  connection->in_idle = MHD_YES;
+#if HTTPS_SUPPORT
+  if ( (MHD_YES == connection->tls_read_ready) ||
+       ( (NULL != connection->tls_session) &&
+         (0 != MHD_tls_pending_ (connection)) ) )
+    websocket_handle_read (connection);
+#endif
+  parse_frames (ws);
+
+  /* keepalive */
+  if ( (0 != interval) &&
+       (MHD_NO == ws->abort) )
+    {
+      now = MHD_monotonic_sec_counter ();
+      if (now - connection->last_activity >= (time_t) interval)
+        {
+          if ( (0 != ws->ping_sent) ||
+               (MHD_YES == ws->close_sent) )
+            {
+              /* no answer to our ping or close frame */
+              if (MHD_NO == ws->close_sent)
+                ws->status = MHD_WEBSOCKET_CLOSE_ABNORMAL;
+              ws->abort = MHD_YES;
+            }
+          else
+            {
+              (void) MHD_mutex_lock_ (&ws->mutex);
+              if (MHD_YES != queue_control (ws,
+                                            MHD_WEBSOCKET_OPCODE_PING,
+                                            NULL,
+                                            0))
+                ws->abort = MHD_YES;
+              (void) MHD_mutex_unlock_ (&ws->mutex);
+              ws->ping_sent = now;
+              MHD_update_last_activity_ (connection);
+            }
+        }
+    }
+
+  /* send what we can right away instead of waiting for the next round */
+  fill_write_buffer (ws);
+  websocket_handle_write (connection);
+  if (connection->write_buffer_send_offset ==
+      connection->write_buffer_append_offset)
+    fill_write_buffer (ws);
+
+  (void) MHD_mutex_lock_ (&ws->mutex);
+  flushed = ( (0 == ws->queue_len) &&
+              (connection->write_buffer_send_offset ==
+               connection->write_buffer_append_offset) );
+  if ( (MHD_YES == ws->close_received) &&
+       (MHD_NO == ws->close_sent) )
+    queue_close (ws, ws->status); /* should not happen, but be safe */
+  (void) MHD_mutex_unlock_ (&ws->mutex);
+  if ( ( (MHD_YES == ws->abort) &&
+         ( (flushed) ||
+           (MHD_YES == connection->read_closed) ) ) ||
+       ( (MHD_YES == ws->close_sent) &&
+         (MHD_YES == ws->close_received) &&
+         (flushed) ) ||
+       ( (MHD_YES == ws->close_sent) &&
+         (0 == interval) &&
+         (flushed) ) )
+    {
+      /* closing handshake complete (or given up on) */
+      notify_close (ws);
+#if HTTPS_SUPPORT
+      if ( (NULL != connection->tls_session) &&
+           (MHD_NO == connection->read_closed) )
+        MHD_tls_bye_ (connection, MHD_TRANSPORT_SHUTDOWN_WRITE);
+#endif
+      MHD_connection_close_ (connection,
+                             (MHD_WEBSOCKET_CLOSE_ABNORMAL == ws->status)
+                             ? MHD_REQUEST_TERMINATED_WITH_ERROR
+                             : MHD_REQUEST_TERMINATED_COMPLETED_OK);
+      return MHD_connection_handle_idle (connection);
+    }
+
+  if (connection->write_buffer_send_offset !=
+      connection->write_buffer_append_offset)
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+  else
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+#if EPOLL_SUPPORT
+  MHD_connection_epoll_ready_ (connection);
+  return MHD_connection_epoll_update_ (connection);
+#else
+  connection->in_idle = MHD_NO;
+  return MHD_YES;
+#endif
+}
+
+
+/**
+ * Switch a connection that sent a WebSocket response to handling
+ * the WebSocket protocol.  Called instead of the upgrade handler
+ * once the header of the response was sent; the buffers of the
+ * connection must already be set up for the upgraded connection.
+ *
+ * @param connection the connection to upgrade
+ * @return #MHD_YES on success, #MHD_NO on failure (the connection
+ *         should be closed)
+ */
+int
+MHD_websocket_start_ (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_WebSocket *ws;
+
+  if ( (NULL == connection->read_buffer) ||
+       (NULL == connection->write_buffer) )
+    return MHD_NO;
+  ws = malloc (sizeof (struct MHD_WebSocket));
+  if (NULL == ws)
+    return MHD_NO;
+  memset (ws, 0, sizeof (struct MHD_WebSocket));
+  if (MHD_YES != MHD_mutex_create_ (&ws->mutex))
+    {
+      free (ws);
+      return MHD_NO;
+    }
+  ws->connection = connection;
+  ws->message_cb = response->ws_message_cb;
+  ws->close_cb = response->ws_close_cb;
+  ws->cls = response->ws_cls;
+  ws->msg_opcode = MHD_WEBSOCKET_OPCODE_CONTINUATION;
+  ws->status = MHD_WEBSOCKET_CLOSE_NORMAL;
+  connection->ws = ws;
+  /* keepalives take over the role of the timeout */
+  MHD_set_connection_option (connection,
+                             MHD_CONNECTION_OPTION_TIMEOUT,
+                             daemon->websocket_ping_interval);
+  MHD_update_last_activity_ (connection);
+  connection->read_handler = &websocket_handle_read;
+  connection->write_handler = &websocket_handle_write;
+  connection->idle_handler = &websocket_handle_idle;
+  connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+  if (NULL != response->ws_open_cb)
+    response->ws_open_cb (response->ws_cls,
+                          ws,
+                          connection->client_context);
+  return MHD_YES;
+}
+
+
+/**
+ * Process the WebSockets of @a daemon that had frames queued from
+ * outside of the event loop, making sure that the event loop looks
+ * at their connections.
+ *
+ * @param daemon daemon to process
+ */
+void
+MHD_websocket_wakeup_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_WebSocket *ws;
+
+  if (NULL == daemon->ws_wakeup_head)
+    return; /* racy, but we will be signalled again */
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  while (NULL != (ws = daemon->ws_wakeup_head))
+    {
+      DLL_remove (daemon->ws_wakeup_head,
+                  daemon->ws_wakeup_tail,
+                  ws);
+      ws->in_wakeup = MHD_NO;
+#if EPOLL_SUPPORT
+      /* the other event loops look at all connections anyway */
+      if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+           (0 == (ws->connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+        {
+          EDLL_insert (daemon->eready_head,
+                       daemon->eready_tail,
+                       ws->connection);
+          ws->connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+        }
+#endif
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Release the WebSocket of a connection that is being destroyed,
+ * notifying the application if that did not happen yet.
+ *
+ * @param connection the connection to clean up
+ */
+void
+MHD_websocket_cleanup_ (struct MHD_Connection *connection)
+{
+  struct MHD_WebSocket *ws = connection->ws;
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (NULL == ws)
+    return;
+  if (MHD_NO == ws->notified)
+    ws->status = MHD_WEBSOCKET_CLOSE_ABNORMAL;
+  notify_close (ws);
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_YES == ws->in_wakeup)
+    DLL_remove (daemon->ws_wakeup_head,
+                daemon->ws_wakeup_tail,
+                ws);
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  while (0 != ws->queue_len)
+    {
+      frame_release (ws->queue[ws->queue_head]);
+      ws->queue_head = (ws->queue_head + 1) % ws->queue_size;
+      ws->queue_len--;
+    }
+  free (ws->queue);
+  (void) MHD_mutex_destroy_ (&ws->mutex);
+  free (ws);
+  connection->ws = NULL;
+}
+
+
+/**
+ * Create a response that accepts the WebSocket handshake of a
+ * request.
+ *
+ * @param connection connection with the handshake request
+ * @param protocol subprotocol to confirm, NULL for none
+ * @param open_cb function to call when the WebSocket is open
+ * @param message_cb function to call for each message received
+ * @param close_cb function to call when the WebSocket is closed
+ * @param cls closure for the callbacks
+ * @return NULL if the request is not a valid WebSocket handshake
+ *         or on error (out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_for_websocket (struct MHD_Connection *connection,
+                                   const char *protocol,
+                                   MHD_WebSocketOpenCallback open_cb,
+                                   MHD_WebSocketMessageCallback message_cb,
+                                   MHD_WebSocketCloseCallback close_cb,
+                                   void *cls)
+{
+  struct MHD_Response *response;
+  struct SHA1Context ctx;
+  unsigned char digest[SHA1_DIGEST_SIZE];
+  char accept[4 * ((SHA1_DIGEST_SIZE + 2) / 3) + 1];
+  const char *key;
+  const char *version;
+
+  if (NULL == message_cb)
+    return NULL;
+  if ( (! MHD_str_has_token_caseless_ (MHD_lookup_connection_value (connection,
+                                                                    MHD_HEADER_KIND,
+                                                                    MHD_HTTP_HEADER_UPGRADE),
+                                       "websocket")) ||
+       (! MHD_str_has_token_caseless_ (MHD_lookup_connection_value (connection,
+                                                                    MHD_HEADER_KIND,
+                                                                    MHD_HTTP_HEADER_CONNECTION),
+                                       "upgrade")) )
+    return NULL;
+  version = MHD_lookup_connection_value (connection,
+                                         MHD_HEADER_KIND,
+                                         "Sec-WebSocket-Version");
+  key = MHD_lookup_connection_value (connection,
+                                     MHD_HEADER_KIND,
+                                     "Sec-WebSocket-Key");
+  /* the key is 16 random bytes in base64 */
+  if ( (NULL == version) ||
+       (0 != strcmp (version, "13")) ||
+       (NULL == key) ||
+       (24 != strlen (key)) )
+    return NULL;
+  SHA1Init (&ctx);
+  SHA1Update (&ctx, (const unsigned char *) key, strlen (key));
+  SHA1Update (&ctx,
+              (const unsigned char *) WEBSOCKET_GUID,
+              strlen (WEBSOCKET_GUID));
+  SHA1Final (digest, &ctx);
+  base64_encode (digest, sizeof (digest), accept);
+
+  response = MHD_create_response_from_buffer (0,
+                                              NULL,
+                                              MHD_RESPMEM_PERSISTENT);
+  if (NULL == response)
+    return NULL;
+  response->ws_open_cb = open_cb;
+  response->ws_message_cb = message_cb;
+  response->ws_close_cb = close_cb;
+  response->ws_cls = cls;
+  if ( (MHD_YES != MHD_add_response_header (response,
+                                            MHD_HTTP_HEADER_UPGRADE,
+                                            "websocket")) ||
+       (MHD_YES != MHD_add_response_header (response,
+                                            MHD_HTTP_HEADER_CONNECTION,
+                                            "Upgrade")) ||
+       (MHD_YES != MHD_add_response_header (response,
+                                            "Sec-WebSocket-Accept",
+                                            accept)) ||
+       ( (NULL != protocol) &&
+         (MHD_YES != MHD_add_response_header (response,
+                                              "Sec-WebSocket-Protocol",
+                                              protocol)) ) )
+    {
+      MHD_destroy_response (response);
+      return NULL;
+    }
+  return response;
+}
+
+
+/**
+ * Queue a frame on a WebSocket, respecting the limit on pending data.
+ *
+ * @param ws WebSocket to send on
+ * @param frame frame to send
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_websocket_send_frame (struct MHD_WebSocket *ws,
+                          struct MHD_WebSocketFrame *frame)
+{
+  size_t max_pending;
+  int ret;
+
+  if ( (NULL == ws) ||
+       (NULL == frame) )
+    return MHD_NO;
+  max_pending = ws->connection->daemon->websocket_max_pending;
+  (void) MHD_mutex_lock_ (&ws->mutex);
+  if ( (MHD_YES == ws->close_sent) ||
+       ( (0 != max_pending) &&
+         (ws->pending + frame->size > max_pending) ) )
+    ret = MHD_NO;
+  else
+    ret = queue_frame (ws, frame);
+  (void) MHD_mutex_unlock_ (&ws->mutex);
+  if (MHD_YES == ret)
+    wakeup (ws);
+  return ret;
+}
+
+
+/**
+ * Send a message on a WebSocket.
+ *
+ * @param ws WebSocket to send on
+ * @param opcode type of the message (text, binary, ping or pong)
+ * @param data payload of the message
+ * @param size number of bytes in @a data
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_websocket_send (struct MHD_WebSocket *ws,
+                    enum MHD_WebSocketOpcode opcode,
+                    const char *data,
+                    size_t size)
+{
+  struct MHD_WebSocketFrame *frame;
+  int ret;
+
+  frame = MHD_websocket_frame_create (opcode, data, size);
+  if (NULL == frame)
+    return MHD_NO;
+  ret = MHD_websocket_send_frame (ws, frame);
+  frame_release (frame);
+  return ret;
+}
+
+
+/**
+ * Start the closing handshake of a WebSocket.
+ *
+ * @param ws WebSocket to close
+ * @param status close status to send to the client
+ * @return #MHD_YES on success, #MHD_NO if the WebSocket was
+ *         already closing
+ */
+int
+MHD_websocket_close (struct MHD_WebSocket *ws,
+                     unsigned short status)
+{
+  int ret;
+
+  (void) MHD_mutex_lock_ (&ws->mutex);
+  if (MHD_NO == ws->close_sent)
+    ws->status = status;
+  ret = queue_close (ws, status);
+  (void) MHD_mutex_unlock_ (&ws->mutex);
+  if (MHD_YES == ret)
+    wakeup (ws);
+  return ret;
+}
+
+
+/**
+ * Build a server frame that can be sent on any number of
+ * WebSockets.
+ *
+ * @param opcode type of the message (text, binary, ping or pong)
+ * @param data payload of the message
+ * @param size number of bytes in @a data
+ * @return NULL on error (invalid opcode, out of memory)
+ */
+struct MHD_WebSocketFrame *
+MHD_websocket_frame_create (enum MHD_WebSocketOpcode opcode,
+                            const char *data,
+                            size_t size)
+{
+  switch (opcode)
+    {
+    case MHD_WEBSOCKET_OPCODE_TEXT:
+    case MHD_WEBSOCKET_OPCODE_BINARY:
+      break;
+    case MHD_WEBSOCKET_OPCODE_PING:
+    case MHD_WEBSOCKET_OPCODE_PONG:
+      if (size > MAX_CONTROL_SIZE)
+        return NULL;
+      break;
+    default:
+      /* close frames only via MHD_websocket_close() */
+      return NULL;
+    }
+  if ( (NULL == data) &&
+       (0 != size) )
+    return NULL;
+  return build_frame (opcode, data, size);
+}
+
+
+/**
+ * Release the application's reference to a frame.
+ *
+ * @param frame frame to release
+ */
+void
+MHD_websocket_frame_destroy (struct MHD_WebSocketFrame *frame)
+{
+  if (NULL != frame)
+    frame_release (frame);
+}
+
+
+/**
+ * Send the same message on many WebSockets, building the frame
+ * only once.
+ *
+ * @param ws array of WebSockets to send on
+ * @param num_ws number of entries in @a ws
+ * @param opcode type of the message (text, binary, ping or pong)
+ * @param data payload of the message
+ * @param size number of bytes in @a data
+ * @return number of WebSockets the message was queued for
+ */
+unsigned int
+MHD_websocket_broadcast (struct MHD_WebSocket *const *ws,
+                         unsigned int num_ws,
+                         enum MHD_WebSocketOpcode opcode,
+                         const char *data,
+                         size_t size)
+{
+  struct MHD_WebSocketFrame *frame;
+  unsigned int i;
+  unsigned int ret;
+
+  if (0 == num_ws)
+    return 0;
+  frame = MHD_websocket_frame_create (opcode, data, size);
+  if (NULL == frame)
+    return 0;
+  ret = 0;
+  for (i = 0; i < num_ws; i++)
+    if (MHD_YES == MHD_websocket_send_frame (ws[i], frame))
+      ret++;
+  frame_release (frame);
+  return ret;
+}
+
+/* end of websocket.c */
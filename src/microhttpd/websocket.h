@@ -0,0 +1,66 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     This library is free software; you can redistribute it and/or
+     modify it under the terms of the GNU Lesser General Public
+     License as published by the Free Software Foundation; either
+     version 2.1 of the License, or (at your option) any later version.
+
+     This library is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Lesser General Public License for more details.
+
+     You should have received a copy of the GNU Lesser General Public
+     License along with this library; if not, write to the Free Software
+     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file websocket.h
+ * @brief  WebSockets handled in the event loop of the daemon
+ * @author Christian Grothoff
+ */
+
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include "internal.h"
+
+
+/**
+ * Switch a connection that sent a WebSocket response to handling
+ * the WebSocket protocol.  Called instead of the upgrade handler
+ * once the header of the response was sent; the buffers of the
+ * connection must already be set up for the upgraded connection.
+ *
+ * @param connection the connection to upgrade
+ * @return #MHD_YES on success, #MHD_NO on failure (the connection
+ *         should be closed)
+ */
+int
+MHD_websocket_start_ (struct MHD_Connection *connection);
+
+
+/**
+ * Process the WebSockets of @a daemon that had frames queued from
+ * outside of the event loop, making sure that the event loop looks
+ * at their connections.
+ *
+ * @param daemon daemon to process
+ */
+void
+MHD_websocket_wakeup_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Release the WebSocket of a connection that is being destroyed,
+ * notifying the application if that did not happen yet.
+ *
+ * @param connection the connection to clean up
+ */
+void
+MHD_websocket_cleanup_ (struct MHD_Connection *connection);
+
+#endif
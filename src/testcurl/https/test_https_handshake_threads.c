@@ -0,0 +1,239 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_https_handshake_threads.c
+ * @brief  Testcase for running TLS handshakes on separate threads
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <gcrypt.h>
+#include <gnutls/gnutls.h>
+#include "tls_test_common.h"
+
+extern const char srv_key_pem[];
+extern const char srv_self_signed_cert_pem[];
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+
+
+/**
+ * Open a TCP connection to the daemon.
+ *
+ * @return the socket, #MHD_INVALID_SOCKET on error
+ */
+static MHD_socket
+open_socket ()
+{
+  struct sockaddr_in sa;
+  MHD_socket sd;
+
+  sd = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sd)
+    return MHD_INVALID_SOCKET;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (DEAMON_TEST_PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sd, (struct sockaddr *) &sa, sizeof (sa)))
+    {
+      fprintf (stderr, "Failed to connect: %s\n", strerror (errno));
+      (void) close (sd);
+      return MHD_INVALID_SOCKET;
+    }
+  return sd;
+}
+
+
+/**
+ * Connect to the daemon and fetch a page.
+ *
+ * @return 0 on success
+ */
+static int
+query ()
+{
+  gnutls_session_t session;
+  gnutls_certificate_credentials_t xcred;
+  MHD_socket sd;
+  char buf[1024];
+  const char *body;
+  ssize_t got;
+  size_t total;
+  int ret;
+
+  if (MHD_INVALID_SOCKET == (sd = open_socket ()))
+    return 1;
+  gnutls_certificate_allocate_credentials (&xcred);
+  gnutls_init (&session, GNUTLS_CLIENT);
+  gnutls_priority_set_direct (session, "NORMAL", NULL);
+  gnutls_credentials_set (session, GNUTLS_CRD_CERTIFICATE, xcred);
+  gnutls_transport_set_int (session, sd);
+  do
+    ret = gnutls_handshake (session);
+  while ( (ret < 0) && (0 == gnutls_error_is_fatal (ret)) );
+  if (ret < 0)
+    {
+      fprintf (stderr, "Handshake failed: %s\n", gnutls_strerror (ret));
+      ret = 1;
+      goto cleanup;
+    }
+  if (0 > gnutls_record_send (session, REQUEST, strlen (REQUEST)))
+    {
+      ret = 1;
+      goto cleanup;
+    }
+  total = 0;
+  while ( (total < sizeof (buf) - 1) &&
+          (0 < (got = gnutls_record_recv (session,
+                                          &buf[total],
+                                          sizeof (buf) - 1 - total))) )
+    total += got;
+  buf[total] = '\0';
+  body = strstr (buf, "\r\n\r\n");
+  if ( (NULL == body) ||
+       (0 != strcmp (body + 4, test_data)) ||
+       (0 != strncmp ("HTTP/1.1 200", buf, strlen ("HTTP/1.1 200"))) )
+    {
+      fprintf (stderr, "Unexpected response\n");
+      ret = 1;
+      goto cleanup;
+    }
+  ret = 0;
+ cleanup:
+  gnutls_deinit (session);
+  gnutls_certificate_free_credentials (xcred);
+  (void) close (sd);
+  return ret;
+}
+
+
+/**
+ * Fetch pages from a daemon started with the given options while
+ * another client never starts its handshake.
+ *
+ * @param flags event loop to use
+ * @param pool_size value for #MHD_OPTION_THREAD_POOL_SIZE
+ * @param wait_timeout #MHD_YES to check that the stalled client
+ *        is disconnected after the connection timeout, #MHD_NO to
+ *        stop the daemon during its handshake
+ * @return 0 on success
+ */
+static int
+test_handshake_threads (unsigned int flags,
+                        unsigned int pool_size,
+                        int wait_timeout)
+{
+  struct MHD_Daemon *d;
+  MHD_socket stalled;
+  struct timeval tv;
+  char c;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_SSL | MHD_USE_SUSPEND_RESUME |
+                        MHD_USE_DEBUG, DEAMON_TEST_PORT,
+                        NULL, NULL, &http_ahc, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 2,
+                        MHD_OPTION_HTTPS_HANDSHAKE_THREADS, (unsigned int) 2,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      fprintf (stderr, MHD_E_SERVER_INIT);
+      return 1;
+    }
+  ret = 0;
+  if (MHD_INVALID_SOCKET == (stalled = open_socket ()))
+    ret = 1;
+  for (i = 0; (0 == ret) && (i < 4); i++)
+    ret = query ();
+  if ( (0 == ret) &&
+       (MHD_YES == wait_timeout) )
+    {
+      /* the handshake thread must give up on the stalled client */
+      tv.tv_sec = 10;
+      tv.tv_usec = 0;
+      setsockopt (stalled, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+      if (0 != recv (stalled, &c, 1, 0))
+        {
+          fprintf (stderr, "Stalled handshake was not timed out\n");
+          ret = 1;
+        }
+    }
+  MHD_stop_daemon (d);
+  if (MHD_INVALID_SOCKET != stalled)
+    (void) close (stalled);
+  return ret;
+}
+
+
+/**
+ * Check that the handshake threads are refused without
+ * #MHD_USE_SUSPEND_RESUME.
+ *
+ * @return 0 on success
+ */
+static int
+test_requires_suspend ()
+{
+  struct MHD_Daemon *d;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SSL,
+                        DEAMON_TEST_PORT,
+                        NULL, NULL, &http_ahc, NULL,
+                        MHD_OPTION_HTTPS_HANDSHAKE_THREADS, (unsigned int) 2,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 0;
+  fprintf (stderr, "Daemon started without MHD_USE_SUSPEND_RESUME\n");
+  MHD_stop_daemon (d);
+  return 1;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+#ifdef GCRYCTL_INITIALIZATION_FINISHED
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+#endif
+  gnutls_global_init ();
+  errorCount += test_requires_suspend ();
+  errorCount += test_handshake_threads (MHD_USE_SELECT_INTERNALLY, 0, MHD_YES);
+  errorCount += test_handshake_threads (MHD_USE_SELECT_INTERNALLY, 2, MHD_NO);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += test_handshake_threads (MHD_USE_POLL_INTERNALLY, 0, MHD_NO);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_handshake_threads (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY,
+                                          0, MHD_YES);
+  print_test_result (errorCount, argv[0]);
+  gnutls_global_deinit ();
+  return errorCount != 0;
+}
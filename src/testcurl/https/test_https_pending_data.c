@@ -0,0 +1,215 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_https_pending_data.c
+ * @brief  Testcase for processing data that is waiting within TLS
+ *         after the socket was drained
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <gcrypt.h>
+#include <gnutls/gnutls.h>
+#include "tls_test_common.h"
+
+extern const char srv_key_pem[];
+extern const char srv_self_signed_cert_pem[];
+
+/**
+ * Size of the upload; the whole request fits into a single
+ * TLS record, but not into the read buffer of the connection.
+ */
+#define UPLOAD_SIZE 12000
+
+
+static int
+ahc (void *cls,
+     struct MHD_Connection *connection,
+     const char *url,
+     const char *method,
+     const char *version,
+     const char *upload_data,
+     size_t *upload_data_size,
+     void **ptr)
+{
+  static char body[32];
+  size_t *received = *ptr;
+  struct MHD_Response *response;
+  int ret;
+
+  if (NULL == received)
+    {
+      if (NULL == (received = malloc (sizeof (size_t))))
+        return MHD_NO;
+      *received = 0;
+      *ptr = received;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      *received += *upload_data_size;
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  snprintf (body, sizeof (body), "%u", (unsigned int) *received);
+  free (received);
+  *ptr = NULL;
+  response = MHD_create_response_from_buffer (strlen (body),
+                                              body,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Upload data in a single TLS record to a daemon using the given
+ * event loop and check that all of it was processed.
+ *
+ * @param flags event loop to use
+ * @return 0 on success
+ */
+static int
+test_pending (unsigned int flags)
+{
+  static char request[UPLOAD_SIZE + 256];
+  struct MHD_Daemon *d;
+  gnutls_session_t session;
+  gnutls_certificate_credentials_t xcred;
+  struct sockaddr_in sa;
+  struct timeval tv;
+  MHD_socket sd;
+  char buf[1024];
+  char expected[32];
+  const char *body;
+  size_t len;
+  size_t total;
+  ssize_t got;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_SSL | MHD_USE_DEBUG,
+                        DEAMON_TEST_PORT,
+                        NULL, NULL, &ahc, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) 4096,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      fprintf (stderr, MHD_E_SERVER_INIT);
+      return 1;
+    }
+  sd = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sd)
+    {
+      MHD_stop_daemon (d);
+      return 1;
+    }
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (DEAMON_TEST_PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sd, (struct sockaddr *) &sa, sizeof (sa)))
+    {
+      fprintf (stderr, "Failed to connect: %s\n", strerror (errno));
+      (void) close (sd);
+      MHD_stop_daemon (d);
+      return 1;
+    }
+  /* the daemon stalls if it does not process the pending data */
+  tv.tv_sec = 10;
+  tv.tv_usec = 0;
+  setsockopt (sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  gnutls_certificate_allocate_credentials (&xcred);
+  gnutls_init (&session, GNUTLS_CLIENT);
+  gnutls_priority_set_direct (session, "NORMAL", NULL);
+  gnutls_credentials_set (session, GNUTLS_CRD_CERTIFICATE, xcred);
+  gnutls_transport_set_int (session, sd);
+  do
+    ret = gnutls_handshake (session);
+  while ( (ret < 0) && (0 == gnutls_error_is_fatal (ret)) );
+  if (ret < 0)
+    {
+      fprintf (stderr, "Handshake failed: %s\n", gnutls_strerror (ret));
+      ret = 1;
+      goto cleanup;
+    }
+  len = snprintf (request, sizeof (request),
+                  "POST / HTTP/1.1\r\nHost: localhost\r\n"
+                  "Connection: close\r\nContent-Length: %u\r\n\r\n",
+                  (unsigned int) UPLOAD_SIZE);
+  memset (&request[len], 'x', UPLOAD_SIZE);
+  len += UPLOAD_SIZE;
+  if (len != (size_t) gnutls_record_send (session, request, len))
+    {
+      fprintf (stderr, "Failed to send request in a single record\n");
+      ret = 1;
+      goto cleanup;
+    }
+  total = 0;
+  while ( (total < sizeof (buf) - 1) &&
+          (0 < (got = gnutls_record_recv (session,
+                                          &buf[total],
+                                          sizeof (buf) - 1 - total))) )
+    total += got;
+  buf[total] = '\0';
+  snprintf (expected, sizeof (expected), "%u", (unsigned int) UPLOAD_SIZE);
+  body = strstr (buf, "\r\n\r\n");
+  if ( (NULL == body) ||
+       (0 != strcmp (body + 4, expected)) ||
+       (0 != strncmp ("HTTP/1.1 200", buf, strlen ("HTTP/1.1 200"))) )
+    {
+      fprintf (stderr, "Unexpected response: `%s'\n", buf);
+      ret = 1;
+      goto cleanup;
+    }
+  ret = 0;
+ cleanup:
+  gnutls_deinit (session);
+  gnutls_certificate_free_credentials (xcred);
+  (void) close (sd);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+#ifdef GCRYCTL_INITIALIZATION_FINISHED
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+#endif
+  gnutls_global_init ();
+  errorCount += test_pending (MHD_USE_SELECT_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += test_pending (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_pending (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  errorCount += test_pending (MHD_USE_THREAD_PER_CONNECTION);
+  print_test_result (errorCount, argv[0]);
+  gnutls_global_deinit ();
+  return errorCount != 0;
+}
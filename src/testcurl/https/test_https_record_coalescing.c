@@ -0,0 +1,344 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_https_record_coalescing.c
+ * @brief  Testcase for sending the header and the body of small
+ *         HTTPS responses in a single TLS record, and for sending
+ *         small records at the start of large ones
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <gcrypt.h>
+#include <gnutls/gnutls.h>
+#include "tls_test_common.h"
+
+extern const char srv_key_pem[];
+extern const char srv_self_signed_cert_pem[];
+
+#define SMALL_BODY "{\"status\":\"ok\"}"
+
+#define LARGE_SIZE (100 * 1024)
+
+#define READER_SIZE 5000
+
+/**
+ * Largest record (plaintext) expected at the start of a response.
+ */
+#define SMALL_RECORD_SIZE 1369
+
+/**
+ * Checks on the records of a response.
+ */
+enum RecordCheck
+{
+  /**
+   * Any records will do.
+   */
+  CHECK_NONE,
+
+  /**
+   * The whole response must be in a single record.
+   */
+  CHECK_SINGLE_RECORD,
+
+  /**
+   * The response must start with small records, followed by
+   * records of the maximum size.
+   */
+  CHECK_RECORD_SIZES
+};
+
+/**
+ * Body of the large response.
+ */
+static char large_body[LARGE_SIZE];
+
+
+static ssize_t
+reader (void *cls,
+        uint64_t pos,
+        char *buf,
+        size_t max)
+{
+  size_t i;
+
+  if (pos >= READER_SIZE)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > READER_SIZE - pos)
+    max = READER_SIZE - pos;
+  for (i = 0; i < max; i++)
+    buf[i] = 'a' + (pos + i) % 26;
+  return max;
+}
+
+
+static int
+ahc (void *cls,
+     struct MHD_Connection *connection,
+     const char *url,
+     const char *method,
+     const char *version,
+     const char *upload_data,
+     size_t *upload_data_size,
+     void **ptr)
+{
+  static int aptr;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&aptr != *ptr)
+    {
+      /* do never respond on first call */
+      *ptr = &aptr;
+      return MHD_YES;
+    }
+  *ptr = NULL;
+  if (0 == strcmp (url, "/small"))
+    response = MHD_create_response_from_buffer (strlen (SMALL_BODY),
+                                                 SMALL_BODY,
+                                                 MHD_RESPMEM_PERSISTENT);
+  else if (0 == strcmp (url, "/large"))
+    response = MHD_create_response_from_buffer (LARGE_SIZE,
+                                                large_body,
+                                                MHD_RESPMEM_PERSISTENT);
+  else if (0 == strcmp (url, "/reader"))
+    response = MHD_create_response_from_callback (READER_SIZE,
+                                                  1024,
+                                                  &reader,
+                                                  NULL,
+                                                  NULL);
+  else
+    response = MHD_create_response_from_buffer (0,
+                                                NULL,
+                                                MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Request @a url on the (kept alive) connection of @a session and
+ * check the body of the response.
+ *
+ * @param session TLS session with the daemon
+ * @param url URL to request
+ * @param body expected body
+ * @param body_size number of bytes in @a body
+ * @param check what to check about the records of the response
+ * @return 0 on success
+ */
+static int
+query (gnutls_session_t session,
+       const char *url,
+       const char *body,
+       size_t body_size,
+       enum RecordCheck check)
+{
+  static char buf[LARGE_SIZE + 1024];
+  char request[128];
+  const char *hdr_end;
+  ssize_t got;
+  size_t total;
+  size_t first;
+  size_t largest_early;
+  size_t largest;
+
+  snprintf (request, sizeof (request),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+            url);
+  if (0 > gnutls_record_send (session, request, strlen (request)))
+    return 1;
+  total = 0;
+  first = 0;
+  largest_early = 0;
+  largest = 0;
+  hdr_end = NULL;
+  while ( ( (NULL == hdr_end) ||
+            (total - (hdr_end - buf) < body_size) ) &&
+          (total < sizeof (buf) - 1) )
+    {
+      got = gnutls_record_recv (session,
+                                &buf[total],
+                                sizeof (buf) - 1 - total);
+      if (got <= 0)
+        {
+          fprintf (stderr, "Failed to receive `%s'\n", url);
+          return 1;
+        }
+      /* every call returns (at most) one record */
+      if (0 == first)
+        first = got;
+      if ( (total < 32 * 1024) &&
+           ((size_t) got > largest_early) )
+        largest_early = got;
+      if ((size_t) got > largest)
+        largest = got;
+      total += got;
+      buf[total] = '\0';
+      if ( (NULL == hdr_end) &&
+           (NULL != (hdr_end = strstr (buf, "\r\n\r\n"))) )
+        hdr_end += 4;
+    }
+  if ( (0 != strncmp ("HTTP/1.1 200", buf, strlen ("HTTP/1.1 200"))) ||
+       (total - (hdr_end - buf) != body_size) ||
+       (0 != memcmp (hdr_end, body, body_size)) )
+    {
+      fprintf (stderr, "Unexpected response for `%s'\n", url);
+      return 1;
+    }
+  if ( (CHECK_SINGLE_RECORD == check) &&
+       (first != total) )
+    {
+      fprintf (stderr,
+               "Response for `%s' was split into several records\n",
+               url);
+      return 1;
+    }
+  if ( (CHECK_RECORD_SIZES == check) &&
+       ( (largest_early > SMALL_RECORD_SIZE) ||
+         (largest <= SMALL_RECORD_SIZE) ) )
+    {
+      fprintf (stderr,
+               "Unexpected record sizes for `%s': %u at the start, %u at most\n",
+               url,
+               (unsigned int) largest_early,
+               (unsigned int) largest);
+      return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Fetch responses of various kinds from a daemon using the
+ * given event loop.
+ *
+ * @param flags event loop to use
+ * @return 0 on success
+ */
+static int
+test_coalescing (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  gnutls_session_t session;
+  gnutls_certificate_credentials_t xcred;
+  struct sockaddr_in sa;
+  MHD_socket sd;
+  char reader_body[READER_SIZE];
+  size_t i;
+  int ret;
+
+  for (i = 0; i < READER_SIZE; i++)
+    reader_body[i] = 'a' + i % 26;
+  d = MHD_start_daemon (flags | MHD_USE_SSL | MHD_USE_DEBUG,
+                        DEAMON_TEST_PORT,
+                        NULL, NULL, &ahc, NULL,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      fprintf (stderr, MHD_E_SERVER_INIT);
+      return 1;
+    }
+  sd = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sd)
+    {
+      MHD_stop_daemon (d);
+      return 1;
+    }
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (DEAMON_TEST_PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sd, (struct sockaddr *) &sa, sizeof (sa)))
+    {
+      fprintf (stderr, "Failed to connect: %s\n", strerror (errno));
+      (void) close (sd);
+      MHD_stop_daemon (d);
+      return 1;
+    }
+  gnutls_certificate_allocate_credentials (&xcred);
+  gnutls_init (&session, GNUTLS_CLIENT);
+  gnutls_priority_set_direct (session, "NORMAL", NULL);
+  gnutls_credentials_set (session, GNUTLS_CRD_CERTIFICATE, xcred);
+  gnutls_transport_set_int (session, sd);
+  do
+    ret = gnutls_handshake (session);
+  while ( (ret < 0) && (0 == gnutls_error_is_fatal (ret)) );
+  if (ret < 0)
+    {
+      fprintf (stderr, "Handshake failed: %s\n", gnutls_strerror (ret));
+      ret = 1;
+    }
+  else
+    {
+      /* all on one connection, so that keep-alive is covered */
+      ret = query (session, "/small", SMALL_BODY, strlen (SMALL_BODY),
+                   CHECK_SINGLE_RECORD);
+      if (0 == ret)
+        ret = query (session, "/empty", NULL, 0,
+                     CHECK_SINGLE_RECORD);
+      if (0 == ret)
+        ret = query (session, "/large", large_body, LARGE_SIZE,
+                     CHECK_RECORD_SIZES);
+      if (0 == ret)
+        ret = query (session, "/reader", reader_body, READER_SIZE,
+                     CHECK_NONE);
+      if (0 == ret)
+        ret = query (session, "/small", SMALL_BODY, strlen (SMALL_BODY),
+                     CHECK_SINGLE_RECORD);
+      gnutls_bye (session, GNUTLS_SHUT_WR);
+    }
+  gnutls_deinit (session);
+  gnutls_certificate_free_credentials (xcred);
+  (void) close (sd);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+  size_t i;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+#ifdef GCRYCTL_INITIALIZATION_FINISHED
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+#endif
+  gnutls_global_init ();
+  for (i = 0; i < LARGE_SIZE; i++)
+    large_body[i] = '0' + i % 10;
+  errorCount += test_coalescing (MHD_USE_SELECT_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += test_coalescing (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_coalescing (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  errorCount += test_coalescing (MHD_USE_THREAD_PER_CONNECTION);
+  print_test_result (errorCount, argv[0]);
+  gnutls_global_deinit ();
+  return errorCount != 0;
+}
@@ -0,0 +1,233 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_https_session_resumption.c
+ * @brief  Testcase for resuming TLS sessions from the session cache
+ *         and with session tickets
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <gcrypt.h>
+#include <gnutls/gnutls.h>
+#include "tls_test_common.h"
+
+extern const char srv_key_pem[];
+extern const char srv_self_signed_cert_pem[];
+
+/**
+ * TLS 1.2 without tickets, so that sessions are resumed by ID.
+ */
+#define PRIO_TLS12 "NORMAL:-VERS-ALL:+VERS-TLS1.2"
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+
+/**
+ * Connect to the daemon, resuming the session in @a data if given,
+ * and fetch a page.
+ *
+ * @param priorities GnuTLS priorities of the client
+ * @param flags flags for gnutls_init()
+ * @param data session to resume (if not empty), replaced with the
+ *        session established
+ * @param resumed set to #MHD_YES if the session was resumed
+ * @return 0 on success
+ */
+static int
+query (const char *priorities,
+       unsigned int flags,
+       gnutls_datum_t *data,
+       int *resumed)
+{
+  gnutls_session_t session;
+  gnutls_certificate_credentials_t xcred;
+  struct sockaddr_in sa;
+  MHD_socket sd;
+  char buf[1024];
+  const char *body;
+  ssize_t got;
+  size_t total;
+  int ret;
+
+  sd = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sd)
+    return 1;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (DEAMON_TEST_PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sd, (struct sockaddr *) &sa, sizeof (sa)))
+    {
+      fprintf (stderr, "Failed to connect: %s\n", strerror (errno));
+      (void) close (sd);
+      return 1;
+    }
+  gnutls_certificate_allocate_credentials (&xcred);
+  gnutls_init (&session, GNUTLS_CLIENT | flags);
+  gnutls_priority_set_direct (session, priorities, NULL);
+  gnutls_credentials_set (session, GNUTLS_CRD_CERTIFICATE, xcred);
+  if (NULL != data->data)
+    gnutls_session_set_data (session, data->data, data->size);
+  gnutls_transport_set_int (session, sd);
+  do
+    ret = gnutls_handshake (session);
+  while ( (ret < 0) && (0 == gnutls_error_is_fatal (ret)) );
+  if (ret < 0)
+    {
+      fprintf (stderr, "Handshake failed: %s\n", gnutls_strerror (ret));
+      ret = 1;
+      goto cleanup;
+    }
+  if (0 > gnutls_record_send (session, REQUEST, strlen (REQUEST)))
+    {
+      ret = 1;
+      goto cleanup;
+    }
+  /* read the response (this also gets the tickets of TLS 1.3, for
+     which GnuTLS returns GNUTLS_E_AGAIN); the connection is kept open
+     as a session that is not shut down properly must not be resumed */
+  total = 0;
+  body = NULL;
+  while ( ( (NULL == body) ||
+            (strlen (body) < strlen (test_data)) ) &&
+          (total < sizeof (buf) - 1) &&
+          ( (0 < (got = gnutls_record_recv (session,
+                                            &buf[total],
+                                            sizeof (buf) - 1 - total))) ||
+            (GNUTLS_E_AGAIN == got) ||
+            (GNUTLS_E_INTERRUPTED == got) ) )
+    {
+      if (0 > got)
+        continue;
+      total += got;
+      buf[total] = '\0';
+      if (NULL != (body = strstr (buf, "\r\n\r\n")))
+        body += 4;
+    }
+  if ( (NULL == body) ||
+       (0 != strcmp (body, test_data)) ||
+       (0 != strncmp ("HTTP/1.1 200", buf, strlen ("HTTP/1.1 200"))) )
+    {
+      fprintf (stderr, "Unexpected response\n");
+      ret = 1;
+      goto cleanup;
+    }
+  *resumed = gnutls_session_is_resumed (session) ? MHD_YES : MHD_NO;
+  gnutls_free (data->data);
+  data->data = NULL;
+  data->size = 0;
+  ret = (GNUTLS_E_SUCCESS == gnutls_session_get_data2 (session, data)) ? 0 : 1;
+  gnutls_bye (session, GNUTLS_SHUT_WR);
+ cleanup:
+  gnutls_deinit (session);
+  gnutls_certificate_free_credentials (xcred);
+  (void) close (sd);
+  return ret;
+}
+
+
+/**
+ * Connect twice to a daemon started with the given options and
+ * check whether the second connection resumed the session.
+ *
+ * @param priorities GnuTLS priorities of the client
+ * @param flags flags for gnutls_init()
+ * @param expect_resumed #MHD_YES if resumption must work,
+ *        #MHD_NO if it must not
+ * @param cache_size value for #MHD_OPTION_HTTPS_SESSION_CACHE_SIZE
+ * @param tickets value for #MHD_OPTION_HTTPS_SESSION_TICKETS
+ * @return 0 on success
+ */
+static int
+test_resumption (const char *priorities,
+                 unsigned int flags,
+                 int expect_resumed,
+                 unsigned int cache_size,
+                 unsigned int tickets)
+{
+  struct MHD_Daemon *d;
+  gnutls_datum_t data = { NULL, 0 };
+  int resumed;
+  int ret;
+
+  /* workers must share the cache and the ticket key */
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SSL |
+                        MHD_USE_DEBUG, DEAMON_TEST_PORT,
+                        NULL, NULL, &http_ahc, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, 2,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_HTTPS_SESSION_CACHE_SIZE, cache_size,
+                        MHD_OPTION_HTTPS_SESSION_TICKETS, tickets,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      fprintf (stderr, MHD_E_SERVER_INIT);
+      return 1;
+    }
+  ret = query (priorities, flags, &data, &resumed);
+  if ( (0 == ret) &&
+       (MHD_NO != resumed) )
+    ret = 1;
+  if (0 == ret)
+    ret = query (priorities, flags, &data, &resumed);
+  if ( (0 == ret) &&
+       (expect_resumed != resumed) )
+    {
+      fprintf (stderr,
+               "Session %s resumed with priorities `%s'\n",
+               (MHD_YES == resumed) ? "was" : "was not",
+               priorities);
+      ret = 1;
+    }
+  gnutls_free (data.data);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+#ifdef GCRYCTL_INITIALIZATION_FINISHED
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+#endif
+  gnutls_global_init ();
+  /* neither cache nor tickets */
+  errorCount += test_resumption (PRIO_TLS12, GNUTLS_NO_TICKETS,
+                                 MHD_NO, 0, MHD_NO);
+  /* resumption by session ID */
+  errorCount += test_resumption (PRIO_TLS12, GNUTLS_NO_TICKETS,
+                                 MHD_YES, 16, MHD_NO);
+  /* resumption with tickets, TLS 1.2 and TLS 1.3 */
+  errorCount += test_resumption (PRIO_TLS12, 0,
+                                 MHD_YES, 0, MHD_YES);
+  errorCount += test_resumption ("NORMAL", 0,
+                                 MHD_YES, 0, MHD_YES);
+  print_test_result (errorCount, argv[0]);
+  gnutls_global_deinit ();
+  return errorCount != 0;
+}
@@ -0,0 +1,235 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_basicauth.c
+ * @brief  Testcase for the cache of verified basic authentication credentials
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE "<html><head><title>libmicrohttpd demo</title></head><body>Access granted</body></html>"
+
+#define DENIED "<html><head><title>libmicrohttpd demo</title></head><body>Access denied</body></html>"
+
+#define REALM "test@example.com"
+
+/**
+ * Number of requests of the client with the right password.
+ */
+#define NUM_REQUESTS 5
+
+/**
+ * Number of times the handler checked a password.
+ */
+static unsigned int verifications;
+
+/**
+ * Number of requests accepted from the cache.
+ */
+static unsigned int cached;
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+};
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **unused)
+{
+  struct MHD_Response *response;
+  char *username;
+  char *password = NULL;
+  int ok;
+  int ret;
+
+  if (MHD_YES == MHD_basic_auth_check_cached (connection, REALM))
+    {
+      cached++;
+      ok = MHD_YES;
+    }
+  else
+    {
+      /* this is where an application would run its slow password hash */
+      verifications++;
+      username = MHD_basic_auth_get_username_password (connection,
+                                                       &password);
+      ok = ( (NULL != username) &&
+             (0 == strcmp (username, "testuser")) &&
+             (0 == strcmp (password, "testpass")) ) ? MHD_YES : MHD_NO;
+      free (username);
+      free (password);
+      if ( (MHD_YES == ok) &&
+           (MHD_YES != MHD_basic_auth_cache_verified (connection, REALM)) )
+        return MHD_NO;
+    }
+  if (MHD_YES != ok)
+    {
+      response = MHD_create_response_from_buffer (strlen (DENIED),
+                                                  DENIED,
+                                                  MHD_RESPMEM_PERSISTENT);
+      ret = MHD_queue_basic_auth_fail_response (connection,
+                                                REALM,
+                                                response);
+      MHD_destroy_response (response);
+      return ret;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Run one request with the given credentials.
+ *
+ * @param c handle to use
+ * @param userpwd credentials
+ * @return HTTP status code of the response, 0 on error
+ */
+static long
+query (CURL *c,
+       const char *userpwd)
+{
+  struct CBC cbc;
+  char buf[2048];
+  CURLcode errornum;
+  long code;
+
+  cbc.buf = buf;
+  cbc.size = sizeof (buf);
+  cbc.pos = 0;
+  curl_easy_setopt (c, CURLOPT_URL, "http://127.0.0.1:1337/");
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, &cbc);
+  curl_easy_setopt (c, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+  curl_easy_setopt (c, CURLOPT_USERPWD, userpwd);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  if (CURLE_OK != (errornum = curl_easy_perform (c)))
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed: `%s'\n",
+               curl_easy_strerror (errornum));
+      return 0;
+    }
+  if (CURLE_OK != curl_easy_getinfo (c, CURLINFO_RESPONSE_CODE, &code))
+    return 0;
+  if ( (MHD_HTTP_OK == code) &&
+       ( (cbc.pos != strlen (PAGE)) ||
+         (0 != strncmp (PAGE, cbc.buf, strlen (PAGE))) ) )
+    return 0;
+  return code;
+}
+
+
+/**
+ * A client that sends the same credentials for every request must
+ * only be verified once; wrong credentials must never be accepted
+ * from the cache.
+ */
+static int
+testBasicAuthCache ()
+{
+  CURL *c;
+  struct MHD_Daemon *d;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1337, NULL, NULL, &ahc_echo, NULL,
+                        MHD_OPTION_BASIC_AUTH_CACHE_TTL, 60,
+                        MHD_OPTION_BASIC_AUTH_CACHE_SIZE, 16,
+                        MHD_OPTION_END);
+  if (d == NULL)
+    return 1;
+  c = curl_easy_init ();
+  ret = 0;
+  for (i = 0; i < NUM_REQUESTS; i++)
+    if (MHD_HTTP_OK != query (c, "testuser:testpass"))
+      ret |= 2;
+  if ( (1 != verifications) ||
+       (NUM_REQUESTS - 1 != cached) )
+    {
+      fprintf (stderr,
+               "%u verifications, %u cached\n",
+               verifications,
+               cached);
+      ret |= 4;
+    }
+  for (i = 0; i < 2; i++)
+    if (MHD_HTTP_UNAUTHORIZED != query (c, "testuser:wrongpass"))
+      ret |= 8;
+  if (3 != verifications)
+    ret |= 16;
+  curl_easy_cleanup (c);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  errorCount += testBasicAuthCache ();
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -48,6 +48,21 @@
 
 #define MY_OPAQUE "11733b200778ce33060f31c9af70a870ba96ddd4"
 
+/**
+ * Number of clients in #testDigestAuthManyNonces().
+ */
+#define NUM_CLIENTS 50
+
+/**
+ * Number of requests of each client in #testDigestAuthManyNonces().
+ */
+#define NUM_ROUNDS 3
+
+/**
+ * Number of times the server asked for authentication.
+ */
+static unsigned int challenges;
+
 struct CBC
 {
   char *buf;
@@ -87,6 +102,7 @@ ahc_echo (void *cls,
   if ( (username == NULL) ||
        (0 != strcmp (username, "testuser")) )
     {
+      challenges++;
       response = MHD_create_response_from_buffer (strlen (DENIED),
                                                   DENIED,
                                                   MHD_RESPMEM_PERSISTENT);
@@ -105,6 +121,7 @@ ahc_echo (void *cls,
   if ( (ret == MHD_INVALID_NONCE) ||
        (ret == MHD_NO) )
     {
+      challenges++;
       response = MHD_create_response_from_buffer(strlen (DENIED),
 						 DENIED,
 						 MHD_RESPMEM_PERSISTENT);
@@ -128,6 +145,72 @@ ahc_echo (void *cls,
 }
 
 
+/**
+ * Like #ahc_echo(), but asks for SHA-256 (or MD5) and only knows the
+ * digest of the credentials.
+ */
+static int
+ahc_userdigest (void *cls,
+		struct MHD_Connection *connection,
+		const char *url,
+		const char *method,
+		const char *version,
+		const char *upload_data,
+		size_t *upload_data_size,
+		void **unused)
+{
+  struct MHD_Response *response;
+  char *username;
+  const char *realm = "test@example.com";
+  uint8_t digest[MHD_SHA256_DIGEST_SIZE];
+  int ret;
+
+  username = MHD_digest_auth_get_username (connection);
+  if ( (NULL != username) &&
+       (0 == strcmp (username, "testuser")) &&
+       (MHD_YES == MHD_digest_auth_calc_userdigest (MHD_DIGEST_ALG_SHA256,
+						    username,
+						    realm,
+						    "testpass",
+						    digest,
+						    sizeof (digest))) )
+    ret = MHD_digest_auth_check_digest2 (connection, realm,
+					 username,
+					 digest,
+					 sizeof (digest),
+					 300,
+					 MHD_DIGEST_ALG_SHA256);
+  else
+    ret = MHD_NO;
+  free (username);
+  if ( (ret == MHD_INVALID_NONCE) ||
+       (ret == MHD_NO) )
+    {
+      challenges++;
+      response = MHD_create_response_from_buffer(strlen (DENIED),
+						 DENIED,
+						 MHD_RESPMEM_PERSISTENT);
+      if (NULL == response)
+	return MHD_NO;
+      ret = MHD_queue_auth_fail_response2(connection, realm,
+					  MY_OPAQUE,
+					  response,
+					  (ret == MHD_INVALID_NONCE) ? MHD_YES : MHD_NO,
+					  MHD_DIGEST_ALG_AUTO);
+      MHD_destroy_response(response);
+      return ret;
+    }
+  response = MHD_create_response_from_buffer (strlen(PAGE),
+                                              PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
 static int
 testDigestAuth ()
 {
@@ -229,6 +312,156 @@ testDigestAuth ()
 }
 
 
+/**
+ * Have many clients (with nonces for different URLs) authenticate,
+ * then reuse their nonces.  Each client must be asked for
+ * authentication only once.
+ */
+static int
+testDigestAuthManyNonces ()
+{
+  CURL *c[NUM_CLIENTS];
+  CURLcode errornum;
+  struct MHD_Daemon *d;
+  struct CBC cbc;
+  char buf[2048];
+  char url[64];
+  unsigned int i;
+  unsigned int round;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1337, NULL, NULL, &ahc_echo, PAGE,
+                        MHD_OPTION_THREAD_POOL_SIZE, 4,
+			MHD_OPTION_DIGEST_AUTH_RANDOM, 8, "01234567",
+			MHD_OPTION_NONCE_NC_SIZE, 1024,
+			MHD_OPTION_END);
+  if (d == NULL)
+    return 16;
+  challenges = 0;
+  for (i = 0; i < NUM_CLIENTS; i++)
+    {
+      c[i] = curl_easy_init ();
+      snprintf (url, sizeof (url), "http://127.0.0.1:1337/client%u", i);
+      curl_easy_setopt (c[i], CURLOPT_URL, url);
+      curl_easy_setopt (c[i], CURLOPT_WRITEFUNCTION, &copyBuffer);
+      curl_easy_setopt (c[i], CURLOPT_WRITEDATA, &cbc);
+      curl_easy_setopt (c[i], CURLOPT_HTTPAUTH, CURLAUTH_DIGEST);
+      curl_easy_setopt (c[i], CURLOPT_USERPWD, "testuser:testpass");
+      curl_easy_setopt (c[i], CURLOPT_FAILONERROR, 1);
+      curl_easy_setopt (c[i], CURLOPT_TIMEOUT, 150L);
+      curl_easy_setopt (c[i], CURLOPT_CONNECTTIMEOUT, 150L);
+      curl_easy_setopt (c[i], CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+      curl_easy_setopt (c[i], CURLOPT_NOSIGNAL, 1);
+    }
+  ret = 0;
+  for (round = 0; (0 == ret) && (round < NUM_ROUNDS); round++)
+    for (i = 0; i < NUM_CLIENTS; i++)
+      {
+        cbc.buf = buf;
+        cbc.size = sizeof (buf);
+        cbc.pos = 0;
+        if (CURLE_OK != (errornum = curl_easy_perform (c[i])))
+          {
+            fprintf (stderr,
+                     "curl_easy_perform failed: `%s'\n",
+                     curl_easy_strerror (errornum));
+            ret = 32;
+            break;
+          }
+        if ( (cbc.pos != strlen (PAGE)) ||
+             (0 != strncmp (PAGE, cbc.buf, strlen (PAGE))) )
+          {
+            ret = 32;
+            break;
+          }
+      }
+  for (i = 0; i < NUM_CLIENTS; i++)
+    curl_easy_cleanup (c[i]);
+  MHD_stop_daemon (d);
+  if ( (0 == ret) &&
+       (NUM_CLIENTS != challenges) )
+    {
+      fprintf (stderr,
+               "%u challenges for %u clients\n",
+               challenges,
+               NUM_CLIENTS);
+      ret = 64;
+    }
+  return ret;
+}
+
+
+/**
+ * Authenticate with SHA-256 against a server that only has the
+ * digest of the credentials.  Both requests of the client must
+ * succeed after one challenge.
+ */
+static int
+testDigestAuthSHA256 ()
+{
+  CURL *c;
+  CURLcode errornum;
+  struct MHD_Daemon *d;
+  struct CBC cbc;
+  char buf[2048];
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1337, NULL, NULL, &ahc_userdigest, PAGE,
+			MHD_OPTION_DIGEST_AUTH_RANDOM, 8, "01234567",
+			MHD_OPTION_NONCE_NC_SIZE, 300,
+			MHD_OPTION_END);
+  if (d == NULL)
+    return 128;
+  challenges = 0;
+  c = curl_easy_init ();
+  curl_easy_setopt (c, CURLOPT_URL, "http://127.0.0.1:1337/sha?a=b");
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, &cbc);
+  curl_easy_setopt (c, CURLOPT_HTTPAUTH, CURLAUTH_DIGEST);
+  curl_easy_setopt (c, CURLOPT_USERPWD, "testuser:testpass");
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  ret = 0;
+  for (i = 0; i < 2; i++)
+    {
+      cbc.buf = buf;
+      cbc.size = sizeof (buf);
+      cbc.pos = 0;
+      if (CURLE_OK != (errornum = curl_easy_perform (c)))
+	{
+	  fprintf (stderr,
+		   "curl_easy_perform failed: `%s'\n",
+		   curl_easy_strerror (errornum));
+	  ret = 128;
+	  break;
+	}
+      if ( (cbc.pos != strlen (PAGE)) ||
+	   (0 != strncmp (PAGE, cbc.buf, strlen (PAGE))) )
+	{
+	  ret = 128;
+	  break;
+	}
+    }
+  curl_easy_cleanup (c);
+  MHD_stop_daemon (d);
+  if ( (0 == ret) &&
+       (1 != challenges) )
+    {
+      fprintf (stderr,
+	       "%u challenges for SHA-256 client\n",
+	       challenges);
+      ret = 256;
+    }
+  return ret;
+}
+
+
 int
 main (int argc, char *const *argv)
 {
@@ -243,6 +476,8 @@ main (int argc, char *const *argv)
 if (0 != curl_global_init (CURL_GLOBAL_WIN32))
     return 2;
   errorCount += testDigestAuth ();
+  errorCount += testDigestAuthManyNonces ();
+  errorCount += testDigestAuthSHA256 ();
   if (errorCount != 0)
     fprintf (stderr, "Error (code: %u)\n", errorCount);
   curl_global_cleanup ();
@@ -0,0 +1,348 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_get_cached.c
+ * @brief  Testcase for the response cache (#MHD_OPTION_RESPONSE_CACHE_TTL)
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Number of concurrent requests for the coalescing test.
+ */
+#define PARALLEL 4
+
+/**
+ * Number of calls to the access handler that produced a response.
+ */
+static volatile unsigned int handler_calls;
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+};
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  static int aptr;
+  struct MHD_Response *response;
+  char buf[64];
+  int ret;
+
+  if (0 != strcmp (MHD_HTTP_METHOD_GET, method))
+    return MHD_NO;              /* unexpected method */
+  if (&aptr != *ptr)
+    {
+      /* do never respond on first call */
+      *ptr = &aptr;
+      return MHD_YES;
+    }
+  *ptr = NULL;
+  if (0 == strcmp (url, "/slow"))
+    sleep (1);
+  snprintf (buf,
+            sizeof (buf),
+            "%u",
+            ++handler_calls);
+  response = MHD_create_response_from_buffer (strlen (buf),
+                                              buf,
+                                              MHD_RESPMEM_MUST_COPY);
+  if (0 == strcmp (url, "/nostore"))
+    MHD_add_response_header (response,
+                             MHD_HTTP_HEADER_CACHE_CONTROL,
+                             "no-store");
+  if (0 == strcmp (url, "/vary"))
+    MHD_add_response_header (response,
+                             MHD_HTTP_HEADER_VARY,
+                             "Accept-Language");
+  if (0 == strcmp (url, "/varystar"))
+    MHD_add_response_header (response,
+                             MHD_HTTP_HEADER_VARY,
+                             "*");
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+static CURL *
+setupCurl (const char *url, struct CBC *cbc)
+{
+  CURL *c;
+
+  c = curl_easy_init ();
+  curl_easy_setopt (c, CURLOPT_URL, url);
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, cbc);
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  curl_easy_setopt (c, CURLOPT_FORBID_REUSE, 1);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  return c;
+}
+
+/**
+ * Fetch @a url with the request header @a header (if not NULL)
+ * and return the number in the body, or 0 on error.
+ */
+static unsigned int
+doGetWithHeader (const char *url,
+                 const char *header)
+{
+  CURL *c;
+  char buf[64];
+  struct CBC cbc;
+  struct curl_slist *headers;
+  CURLcode errornum;
+
+  cbc.buf = buf;
+  cbc.size = sizeof (buf) - 1;
+  cbc.pos = 0;
+  c = setupCurl (url, &cbc);
+  headers = NULL;
+  if (NULL != header)
+    {
+      headers = curl_slist_append (NULL, header);
+      curl_easy_setopt (c, CURLOPT_HTTPHEADER, headers);
+    }
+  errornum = curl_easy_perform (c);
+  curl_easy_cleanup (c);
+  curl_slist_free_all (headers);
+  if (CURLE_OK != errornum)
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed: `%s'\n",
+               curl_easy_strerror (errornum));
+      return 0;
+    }
+  buf[cbc.pos] = '\0';
+  return (unsigned int) atoi (buf);
+}
+
+/**
+ * Fetch @a url and return the number in the body, or 0 on error.
+ */
+static unsigned int
+doGet (const char *url)
+{
+  return doGetWithHeader (url, NULL);
+}
+
+static int
+testCachedGet ()
+{
+  struct MHD_Daemon *d;
+  unsigned int first;
+  int ret = 0;
+
+  handler_calls = 0;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_echo, NULL,
+                        MHD_OPTION_RESPONSE_CACHE_TTL, (unsigned int) 60,
+                        MHD_OPTION_END);
+  if (d == NULL)
+    return 1;
+  first = doGet ("http://127.0.0.1:1080/a");
+  if ( (0 == first) ||
+       (first != doGet ("http://127.0.0.1:1080/a")) )
+    ret |= 2;
+  if (first == doGet ("http://127.0.0.1:1080/a?x=1"))
+    ret |= 4;
+  if (first == doGet ("http://127.0.0.1:1080/b"))
+    ret |= 8;
+  /* virtual hosts do not share entries */
+  if (first == doGetWithHeader ("http://127.0.0.1:1080/a",
+                                "Host: other.example"))
+    ret |= 8;
+  first = doGet ("http://127.0.0.1:1080/nostore");
+  if (first == doGet ("http://127.0.0.1:1080/nostore"))
+    ret |= 16;
+  /* cookies are not part of the key, the response may be private */
+  first = doGetWithHeader ("http://127.0.0.1:1080/c",
+                           "Cookie: id=1");
+  if (first == doGetWithHeader ("http://127.0.0.1:1080/c",
+                                "Cookie: id=1"))
+    ret |= 16;
+  /* responses that vary on headers outside of the key */
+  first = doGet ("http://127.0.0.1:1080/vary");
+  if (first == doGet ("http://127.0.0.1:1080/vary"))
+    ret |= 16;
+  first = doGet ("http://127.0.0.1:1080/varystar");
+  if (first == doGet ("http://127.0.0.1:1080/varystar"))
+    ret |= 16;
+  if (12 != handler_calls)
+    ret |= 32;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+static int
+testVaryGet ()
+{
+  struct MHD_Daemon *d;
+  unsigned int first;
+  int ret = 0;
+
+  handler_calls = 0;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_echo, NULL,
+                        MHD_OPTION_RESPONSE_CACHE_TTL, (unsigned int) 60,
+                        MHD_OPTION_RESPONSE_CACHE_VARY, "Accept-Language, Cookie",
+                        MHD_OPTION_END);
+  if (d == NULL)
+    return 2048;
+  first = doGetWithHeader ("http://127.0.0.1:1080/vary",
+                           "Accept-Language: de");
+  if ( (0 == first) ||
+       (first != doGetWithHeader ("http://127.0.0.1:1080/vary",
+                                  "Accept-Language: de")) )
+    ret |= 4096;
+  if (first == doGetWithHeader ("http://127.0.0.1:1080/vary",
+                                "Accept-Language: fr"))
+    ret |= 4096;
+  first = doGetWithHeader ("http://127.0.0.1:1080/c",
+                           "Cookie: id=1");
+  if ( (0 == first) ||
+       (first != doGetWithHeader ("http://127.0.0.1:1080/c",
+                                  "Cookie: id=1")) )
+    ret |= 8192;
+  if (first == doGetWithHeader ("http://127.0.0.1:1080/c",
+                                "Cookie: id=2"))
+    ret |= 8192;
+  if (4 != handler_calls)
+    ret |= 16384;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+static int
+testCoalescedGet ()
+{
+  struct MHD_Daemon *d;
+  CURLM *multi;
+  CURL *c[PARALLEL];
+  struct CBC cbc[PARALLEL];
+  char buf[PARALLEL][64];
+  CURLMsg *msg;
+  int running;
+  int left;
+  unsigned int i;
+  int ret = 0;
+
+  handler_calls = 0;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, (unsigned int) PARALLEL,
+                        MHD_OPTION_RESPONSE_CACHE_TTL, (unsigned int) 60,
+                        MHD_OPTION_END);
+  if (d == NULL)
+    return 64;
+  multi = curl_multi_init ();
+  if (NULL == multi)
+    {
+      MHD_stop_daemon (d);
+      return 128;
+    }
+  for (i = 0; i < PARALLEL; i++)
+    {
+      cbc[i].buf = buf[i];
+      cbc[i].size = sizeof (buf[i]) - 1;
+      cbc[i].pos = 0;
+      c[i] = setupCurl ("http://127.0.0.1:1080/slow", &cbc[i]);
+      curl_multi_add_handle (multi, c[i]);
+    }
+  do
+    {
+      if (CURLM_OK != curl_multi_perform (multi, &running))
+        break;
+      if (0 != running)
+        curl_multi_wait (multi, NULL, 0, 100, NULL);
+    }
+  while (0 != running);
+  while (NULL != (msg = curl_multi_info_read (multi, &left)))
+    {
+      if ( (CURLMSG_DONE == msg->msg) &&
+           (CURLE_OK != msg->data.result) )
+        ret |= 256;
+    }
+  for (i = 0; i < PARALLEL; i++)
+    {
+      buf[i][cbc[i].pos] = '\0';
+      if (1 != atoi (buf[i]))
+        ret |= 512;
+      curl_multi_remove_handle (multi, c[i]);
+      curl_easy_cleanup (c[i]);
+    }
+  curl_multi_cleanup (multi);
+  if (1 != handler_calls)
+    ret |= 1024;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  errorCount += testCachedGet ();
+  errorCount += testVaryGet ();
+  errorCount += testCoalescedGet ();
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}
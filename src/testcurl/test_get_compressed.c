@@ -0,0 +1,233 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_get_compressed.c
+ * @brief  Testcase for compression of responses with #MHD_RF_COMPRESS
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Size of the response body.
+ */
+#define BODY_SIZE (64 * 1024)
+
+static char body[BODY_SIZE];
+
+static struct MHD_Response *buffer_response;
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+  int compressed;
+  int vary;
+};
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+static size_t
+checkHeader (char *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+  char line[256];
+  size_t len;
+  size_t i;
+
+  if ( (size * nmemb >= strlen ("Content-Encoding: gzip")) &&
+       (0 == strncasecmp (ptr, "Content-Encoding: gzip",
+                          strlen ("Content-Encoding: gzip"))) )
+    cbc->compressed = 1;
+  if ( (size * nmemb >= strlen ("Vary:")) &&
+       (0 == strncasecmp (ptr, "Vary:", strlen ("Vary:"))) )
+    {
+      /* look for the token in this (short) header line */
+      len = size * nmemb;
+      if (len > sizeof (line) - 1)
+        len = sizeof (line) - 1;
+      for (i = 0; i < len; i++)
+        line[i] = tolower ((unsigned char) ptr[i]);
+      line[len] = '\0';
+      if (NULL != strstr (line, "accept-encoding"))
+        cbc->vary = 1;
+    }
+  return size * nmemb;
+}
+
+static ssize_t
+crc (void *cls, uint64_t pos, char *buf, size_t max)
+{
+  if (pos >= BODY_SIZE)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > 1000)
+    max = 1000;
+  if (max > BODY_SIZE - pos)
+    max = BODY_SIZE - pos;
+  memcpy (buf, &body[pos], max);
+  return max;
+}
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  static int aptr;
+  struct MHD_Response *response;
+  int ret;
+
+  if (0 != strcmp (MHD_HTTP_METHOD_GET, method))
+    return MHD_NO;              /* unexpected method */
+  if (&aptr != *ptr)
+    {
+      /* do never respond on first call */
+      *ptr = &aptr;
+      return MHD_YES;
+    }
+  *ptr = NULL;
+  if (0 == strcmp (url, "/buffer"))
+    return MHD_queue_response (connection, MHD_HTTP_OK, buffer_response);
+  response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                1024,
+                                                &crc, NULL, NULL);
+  /* a "Vary" of the application must not keep MHD from
+     adding "Accept-Encoding" to it */
+  MHD_add_response_header (response, MHD_HTTP_HEADER_VARY, "Cookie");
+  MHD_set_response_options (response, MHD_RF_COMPRESS, MHD_RO_END);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+static int
+doGet (const char *url, const char *encoding)
+{
+  CURL *c;
+  char buf[BODY_SIZE + 1];
+  struct CBC cbc;
+  CURLcode errornum;
+
+  cbc.buf = buf;
+  cbc.size = sizeof (buf);
+  cbc.pos = 0;
+  cbc.compressed = 0;
+  cbc.vary = 0;
+  c = curl_easy_init ();
+  curl_easy_setopt (c, CURLOPT_URL, url);
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, &cbc);
+  curl_easy_setopt (c, CURLOPT_HEADERFUNCTION, &checkHeader);
+  curl_easy_setopt (c, CURLOPT_HEADERDATA, &cbc);
+  if (NULL != encoding)
+    curl_easy_setopt (c, CURLOPT_ENCODING, encoding);
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  if (CURLE_OK != (errornum = curl_easy_perform (c)))
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed: `%s'\n",
+               curl_easy_strerror (errornum));
+      curl_easy_cleanup (c);
+      return 1;
+    }
+  curl_easy_cleanup (c);
+  if ( (BODY_SIZE != cbc.pos) ||
+       (0 != memcmp (buf, body, BODY_SIZE)) )
+    return 2;
+  if (cbc.compressed != (NULL != encoding))
+    return 4;
+  if (! cbc.vary)
+    return 8;
+  return 0;
+}
+
+static int
+testCompressedGet ()
+{
+  struct MHD_Daemon *d;
+  int ret = 0;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_echo, NULL, MHD_OPTION_END);
+  if (d == NULL)
+    return 1;
+  ret |= doGet ("http://127.0.0.1:1080/buffer", "gzip") * 2;
+  ret |= doGet ("http://127.0.0.1:1080/buffer", "gzip") * 2;
+  ret |= doGet ("http://127.0.0.1:1080/buffer", NULL) * 16;
+  ret |= doGet ("http://127.0.0.1:1080/stream", "gzip") * 128;
+  ret |= doGet ("http://127.0.0.1:1080/stream", NULL) * 1024;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+  unsigned int i;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_COMPRESSION))
+    return 77;                  /* skip */
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  for (i = 0; i < BODY_SIZE; i++)
+    body[i] = 'a' + (i * 7 / 13) % 26;
+  buffer_response = MHD_create_response_from_buffer (BODY_SIZE,
+                                                     body,
+                                                     MHD_RESPMEM_PERSISTENT);
+  MHD_set_response_options (buffer_response, MHD_RF_COMPRESS, MHD_RO_END);
+  errorCount += testCompressedGet ();
+  MHD_destroy_response (buffer_response);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,321 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_get_events.c
+ * @brief  Testcase for broadcasting server-sent events with
+ *         `struct MHD_EventChannel`
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include "platform_interface.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Number of subscribers for the fan-out test.
+ */
+#define SUBSCRIBERS 3
+
+/**
+ * What each subscriber should receive in the fan-out test.
+ */
+#define EXPECTED "event: e\nid: 1\ndata: a\n\ndata: b\ndata: c\ndata: d\ndata: \n\n"
+
+static struct MHD_EventChannel *channel;
+
+static volatile unsigned int subscribed;
+
+static volatile int evicted;
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+};
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  static int aptr;
+  struct MHD_Response *response;
+  const union MHD_ConnectionInfo *info;
+  int size;
+  int ret;
+
+  if (0 != strcmp (MHD_HTTP_METHOD_GET, method))
+    return MHD_NO;              /* unexpected method */
+  if (&aptr != *ptr)
+    {
+      /* do never respond on first call */
+      *ptr = &aptr;
+      return MHD_YES;
+    }
+  *ptr = NULL;
+  if (NULL != cls)
+    {
+      /* a fixed send buffer keeps the kernel from taking more data
+         once the client stopped reading */
+      info = MHD_get_connection_info (connection,
+                                      MHD_CONNECTION_INFO_CONNECTION_FD);
+      size = 4096;
+      if (NULL != info)
+        setsockopt (info->connect_fd, SOL_SOCKET, SO_SNDBUF,
+                    (const void *) &size, sizeof (size));
+    }
+  response = MHD_event_channel_subscribe (channel, connection);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  subscribed++;
+  return ret;
+}
+
+static void
+completed_cb (void *cls,
+              struct MHD_Connection *connection,
+              void **con_cls,
+              enum MHD_RequestTerminationCode toe)
+{
+  /* the stream can only end early if the subscriber was evicted */
+  if (MHD_REQUEST_TERMINATED_COMPLETED_OK != toe)
+    evicted = 1;
+}
+
+static CURL *
+setupCurl (struct CBC *cbc)
+{
+  CURL *c;
+
+  c = curl_easy_init ();
+  curl_easy_setopt (c, CURLOPT_URL, "http://127.0.0.1:1080/events");
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, cbc);
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  return c;
+}
+
+/**
+ * Run the multi handle for a while.
+ *
+ * @return number of transfers still running
+ */
+static int
+step (CURLM *multi)
+{
+  int running;
+
+  if (CURLM_OK != curl_multi_perform (multi, &running))
+    return -1;
+  if (0 != running)
+    curl_multi_wait (multi, NULL, 0, 10, NULL);
+  return running;
+}
+
+static int
+testFanOut ()
+{
+  struct MHD_Daemon *d;
+  CURLM *multi;
+  CURL *c[SUBSCRIBERS];
+  struct CBC cbc[SUBSCRIBERS];
+  char buf[SUBSCRIBERS][256];
+  CURLMsg *msg;
+  int left;
+  unsigned int i;
+  int ret = 0;
+
+  subscribed = 0;
+  channel = MHD_event_channel_create (0);
+  if (NULL == channel)
+    return 1;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_echo, NULL, MHD_OPTION_END);
+  if (d == NULL)
+    {
+      MHD_event_channel_destroy (channel);
+      return 2;
+    }
+  multi = curl_multi_init ();
+  for (i = 0; i < SUBSCRIBERS; i++)
+    {
+      cbc[i].buf = buf[i];
+      cbc[i].size = sizeof (buf[i]) - 1;
+      cbc[i].pos = 0;
+      c[i] = setupCurl (&cbc[i]);
+      curl_multi_add_handle (multi, c[i]);
+    }
+  for (i = 0; (SUBSCRIBERS != subscribed) && (i < 1000); i++)
+    step (multi);
+  if (SUBSCRIBERS != subscribed)
+    ret |= 4;
+  /* give the subscribers time to become idle */
+  for (i = 0; i < 10; i++)
+    step (multi);
+  if ( (MHD_YES != MHD_event_channel_publish (channel, "e", "1", "a")) ||
+       (MHD_YES != MHD_event_channel_publish (channel, NULL, NULL, "b\nc\r\nd\r")) )
+    ret |= 8;
+  /* line ends would inject fields */
+  if ( (MHD_NO != MHD_event_channel_publish (channel, "e\ndata: x", NULL, "a")) ||
+       (MHD_NO != MHD_event_channel_publish (channel, NULL, "1\r", "a")) )
+    ret |= 2048;
+  for (i = 0; i < 10; i++)
+    step (multi);
+  MHD_event_channel_destroy (channel);
+  for (i = 0; (0 < step (multi)) && (i < 10000); i++) ;
+  while (NULL != (msg = curl_multi_info_read (multi, &left)))
+    {
+      if ( (CURLMSG_DONE == msg->msg) &&
+           (CURLE_OK != msg->data.result) )
+        ret |= 16;
+    }
+  for (i = 0; i < SUBSCRIBERS; i++)
+    {
+      buf[i][cbc[i].pos] = '\0';
+      if (0 != strcmp (buf[i], EXPECTED))
+        {
+          fprintf (stderr, "Got `%s'\n", buf[i]);
+          ret |= 32;
+        }
+      curl_multi_remove_handle (multi, c[i]);
+      curl_easy_cleanup (c[i]);
+    }
+  curl_multi_cleanup (multi);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+static int
+testSlowConsumer ()
+{
+  static const char request[] =
+    "GET /events HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "\r\n";
+  static char data[16 * 1024];
+  struct MHD_Daemon *d;
+  struct sockaddr_in sin;
+  MHD_socket fd;
+  int size;
+  unsigned int i;
+  int ret = 0;
+
+  subscribed = 0;
+  evicted = 0;
+  memset (data, 'x', sizeof (data) - 1);
+  data[sizeof (data) - 1] = '\0';
+  channel = MHD_event_channel_create (64 * 1024);
+  if (NULL == channel)
+    return 64;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_echo, "slow",
+                        MHD_OPTION_NOTIFY_COMPLETED, &completed_cb, NULL,
+                        MHD_OPTION_END);
+  if (d == NULL)
+    {
+      MHD_event_channel_destroy (channel);
+      return 128;
+    }
+  /* a client that never reads anything, with a fixed receive buffer
+     so that the kernel stops taking data */
+  fd = socket (PF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == fd)
+    {
+      MHD_event_channel_destroy (channel);
+      MHD_stop_daemon (d);
+      return 512;
+    }
+  size = 4096;
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, (const void *) &size, sizeof (size));
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons (1080);
+  sin.sin_addr.s_addr = htonl (0x7f000001);
+  if ( (0 != connect (fd, (struct sockaddr *) &sin, sizeof (sin))) ||
+       (sizeof (request) - 1 != send (fd, request, sizeof (request) - 1, 0)) )
+    ret |= 1024;
+  for (i = 0; (1 != subscribed) && (i < 1000); i++)
+    usleep (1000);
+  /* publish (slowly enough for the daemon to keep up) until the
+     kernel buffers are full and the subscriber falls behind by more
+     than the limit; the connection must be closed although the
+     client never reads again */
+  for (i = 0; (! evicted) && (i < 4096); i++)
+    {
+      MHD_event_channel_publish (channel, NULL, NULL, data);
+      usleep (1000);
+    }
+  for (i = 0; (! evicted) && (i < 1000); i++)
+    usleep (1000);
+  if (! evicted)
+    ret |= 256;
+  MHD_socket_close_ (fd);
+  MHD_event_channel_destroy (channel);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  errorCount += testFanOut ();
+  errorCount += testSlowConsumer ();
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,278 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_get_router.c
+ * @brief  Testcase for dispatching requests with #MHD_OPTION_ROUTER
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Number of generated static routes.
+ */
+#define NUM_ROUTES 300
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+};
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+/**
+ * Respond with the name of the route (given as the closure) followed
+ * by the values of the "id", "sub" and "path" parameters, if any.
+ */
+static int
+ahc_route (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  static int aptr;
+  const char *tag = cls;
+  const char *id;
+  const char *sub;
+  const char *path;
+  struct MHD_Response *response;
+  char buf[256];
+  int ret;
+
+  if (&aptr != *ptr)
+    {
+      /* do never respond on first call */
+      *ptr = &aptr;
+      return MHD_YES;
+    }
+  *ptr = NULL;
+  id = MHD_lookup_connection_value (connection, MHD_ROUTE_ARGUMENT_KIND, "id");
+  sub = MHD_lookup_connection_value (connection, MHD_ROUTE_ARGUMENT_KIND, "sub");
+  path = MHD_lookup_connection_value (connection, MHD_ROUTE_ARGUMENT_KIND, "path");
+  snprintf (buf,
+            sizeof (buf),
+            "%s|%s|%s|%s",
+            tag,
+            (NULL == id) ? "" : id,
+            (NULL == sub) ? "" : sub,
+            (NULL == path) ? "" : path);
+  response = MHD_create_response_from_buffer (strlen (buf),
+                                              buf,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+static int
+doGet (const char *method,
+       const char *url,
+       const char *expected)
+{
+  CURL *c;
+  char buf[256];
+  struct CBC cbc;
+  CURLcode errornum;
+
+  cbc.buf = buf;
+  cbc.size = sizeof (buf) - 1;
+  cbc.pos = 0;
+  c = curl_easy_init ();
+  curl_easy_setopt (c, CURLOPT_URL, url);
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, &cbc);
+  if (NULL != method)
+    curl_easy_setopt (c, CURLOPT_CUSTOMREQUEST, method);
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  if (CURLE_OK != (errornum = curl_easy_perform (c)))
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed: `%s'\n",
+               curl_easy_strerror (errornum));
+      curl_easy_cleanup (c);
+      return 1;
+    }
+  curl_easy_cleanup (c);
+  buf[cbc.pos] = '\0';
+  if (0 != strcmp (buf, expected))
+    {
+      fprintf (stderr,
+               "Got `%s' for %s, expected `%s'\n",
+               buf,
+               url,
+               expected);
+      return 2;
+    }
+  return 0;
+}
+
+static int
+testRouter ()
+{
+  static char tags[NUM_ROUTES][32];
+  struct MHD_Router *router;
+  struct MHD_Daemon *d;
+  char pattern[64];
+  unsigned int i;
+  int ret = 0;
+
+  router = MHD_router_create ();
+  if (NULL == router)
+    return 1;
+  for (i = 0; i < NUM_ROUTES; i++)
+    {
+      snprintf (tags[i], sizeof (tags[i]), "r%u", i);
+      snprintf (pattern, sizeof (pattern), "/api/v1/resource%u", i);
+      if (MHD_YES != MHD_router_add (router, MHD_HTTP_METHOD_GET, pattern,
+                                     &ahc_route, tags[i]))
+        ret |= 2;
+    }
+  if ( (MHD_YES != MHD_router_add (router, MHD_HTTP_METHOD_GET,
+                                   "/users/:id", &ahc_route, "user")) ||
+       (MHD_YES != MHD_router_add (router, MHD_HTTP_METHOD_DELETE,
+                                   "/users/:id", &ahc_route, "deluser")) ||
+       (MHD_YES != MHD_router_add (router, MHD_HTTP_METHOD_GET,
+                                   "/users/me", &ahc_route, "me")) ||
+       (MHD_YES != MHD_router_add (router, MHD_HTTP_METHOD_GET,
+                                   "/users/:id/posts/:sub", &ahc_route, "post")) ||
+       (MHD_YES != MHD_router_add (router, NULL,
+                                   "/files/*path", &ahc_route, "file")) )
+    ret |= 4;
+  /* invalid or conflicting patterns */
+  if ( (MHD_NO != MHD_router_add (router, MHD_HTTP_METHOD_GET,
+                                  "/users/:id", &ahc_route, "dup")) ||
+       (MHD_NO != MHD_router_add (router, MHD_HTTP_METHOD_GET,
+                                  "/users/:name/x", &ahc_route, "name")) ||
+       (MHD_NO != MHD_router_add (router, MHD_HTTP_METHOD_GET,
+                                  "/a/*path/b", &ahc_route, "wild")) ||
+       (MHD_NO != MHD_router_add (router, MHD_HTTP_METHOD_GET,
+                                  "no-slash", &ahc_route, "rel")) )
+    ret |= 8;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_route, "default",
+                        MHD_OPTION_ROUTER, router,
+                        MHD_OPTION_END);
+  if (d == NULL)
+    {
+      MHD_router_destroy (router);
+      return 16;
+    }
+  if (MHD_NO != MHD_router_add (router, MHD_HTTP_METHOD_GET,
+                                "/late", &ahc_route, "late"))
+    ret |= 32;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/api/v1/resource0", "r0|||") * 64;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/api/v1/resource299", "r299|||") * 64;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/api/v1/resource3", "r3|||") * 64;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/api/v1/resource", "default|||") * 256;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/users/42", "user|42||") * 1024;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/users/me", "me|||") * 1024;
+  ret |= doGet ("DELETE", "http://127.0.0.1:1080/users/42", "deluser|42||") * 1024;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/users/7/posts/9?x=1", "post|7|9|") * 4096;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/users/7/posts", "default|||") * 4096;
+  ret |= doGet (NULL, "http://127.0.0.1:1080/files/a/b.txt", "file|||a/b.txt") * 16384;
+  ret |= doGet ("PUT", "http://127.0.0.1:1080/files/", "file|||") * 16384;
+  MHD_stop_daemon (d);
+  MHD_router_destroy (router);
+  return ret;
+}
+
+
+static int
+testPoolExhausted ()
+{
+  static char url[4096];
+  struct MHD_Router *router;
+  struct MHD_Daemon *d;
+  size_t off;
+  int ret = 0;
+
+  router = MHD_router_create ();
+  if (NULL == router)
+    return 1;
+  if (MHD_YES != MHD_router_add (router, NULL,
+                                 "/files/*path", &ahc_route, "file"))
+    ret |= 2;
+  /* the request header fits into the pool, but the copy of the
+     parameter does not */
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1081, NULL, NULL, &ahc_route, "default",
+                        MHD_OPTION_ROUTER, router,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) 4096,
+                        MHD_OPTION_END);
+  if (d == NULL)
+    {
+      MHD_router_destroy (router);
+      return 4;
+    }
+  off = snprintf (url, sizeof (url), "http://127.0.0.1:1081/files/");
+  memset (&url[off], 'a', 2200);
+  url[off + 2200] = '\0';
+  /* the request must fail rather than reach the default handler */
+  if (1 != doGet (NULL, url, ""))
+    ret |= 8;
+  MHD_stop_daemon (d);
+  MHD_router_destroy (router);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  errorCount += testRouter ();
+  errorCount += testPoolExhausted ();
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,474 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_http2.c
+ * @brief  Testcase for HTTP/2 with #MHD_USE_HTTP2
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Size of the response to "/big", larger than the initial flow
+ * control window of HTTP/2.
+ */
+#define BIG_SIZE (256 * 1024)
+
+/**
+ * Size of the request body sent to "/post".
+ */
+#define POST_SIZE (200 * 1024)
+
+/**
+ * Number of requests sent concurrently on one connection.
+ */
+#define NUM_STREAMS 8
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+};
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+static ssize_t
+big_reader (void *cls, uint64_t pos, char *buf, size_t max)
+{
+  size_t i;
+
+  for (i = 0; i < max; i++)
+    buf[i] = 'a' + (char) ((pos + i) % 26);
+  return max;
+}
+
+/**
+ * Respond to "/big" with #BIG_SIZE bytes from a content reader, to
+ * "/post" with the number of bytes uploaded and to anything else
+ * with the version, URL and "q" argument of the request.
+ */
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  size_t *uploaded = *ptr;
+  struct MHD_Response *response;
+  const char *q;
+  char buf[256];
+  int ret;
+
+  if (NULL == uploaded)
+    {
+      uploaded = malloc (sizeof (size_t));
+      if (NULL == uploaded)
+        return MHD_NO;
+      *uploaded = 0;
+      *ptr = uploaded;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      *uploaded += *upload_data_size;
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  if (0 == strcmp (url, "/big"))
+    {
+      response = MHD_create_response_from_callback (BIG_SIZE,
+                                                    4096,
+                                                    &big_reader,
+                                                    NULL,
+                                                    NULL);
+    }
+  else
+    {
+      if (0 == strcmp (url, "/post"))
+        snprintf (buf, sizeof (buf), "%u", (unsigned int) *uploaded);
+      else
+        {
+          q = MHD_lookup_connection_value (connection,
+                                           MHD_GET_ARGUMENT_KIND,
+                                           "q");
+          snprintf (buf,
+                    sizeof (buf),
+                    "%s|%s|%s",
+                    version,
+                    url,
+                    (NULL == q) ? "" : q);
+        }
+      response = MHD_create_response_from_buffer (strlen (buf),
+                                                  buf,
+                                                  MHD_RESPMEM_MUST_COPY);
+    }
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+static void
+request_completed (void *cls,
+                   struct MHD_Connection *connection,
+                   void **con_cls,
+                   enum MHD_RequestTerminationCode toe)
+{
+  unsigned int *completed = cls;
+
+  if (MHD_REQUEST_TERMINATED_COMPLETED_OK == toe)
+    (*completed)++;
+  free (*con_cls);
+  *con_cls = NULL;
+}
+
+static CURL *
+setupCurl (const char *url,
+           long http_version,
+           struct CBC *cbc)
+{
+  CURL *c;
+
+  c = curl_easy_init ();
+  curl_easy_setopt (c, CURLOPT_URL, url);
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, cbc);
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, http_version);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1L);
+  return c;
+}
+
+static int
+checkBig (const struct CBC *cbc)
+{
+  size_t i;
+
+  if (BIG_SIZE != cbc->pos)
+    return 1;
+  for (i = 0; i < BIG_SIZE; i++)
+    if (cbc->buf[i] != 'a' + (char) (i % 26))
+      return 1;
+  return 0;
+}
+
+/**
+ * Perform a single request.
+ *
+ * @param url URL to request
+ * @param http_version HTTP version for curl to use
+ * @param post_size number of bytes to POST, 0 for a GET
+ * @param expected expected response, NULL for the one of "/big"
+ * @return 0 on success
+ */
+static int
+doRequest (const char *url,
+           long http_version,
+           size_t post_size,
+           const char *expected)
+{
+  CURL *c;
+  struct CBC cbc;
+  CURLcode errornum;
+  char *post;
+  long version;
+  int ret;
+
+  cbc.size = BIG_SIZE + 1;
+  cbc.buf = malloc (cbc.size);
+  cbc.pos = 0;
+  post = NULL;
+  if (NULL == cbc.buf)
+    return 1;
+  c = setupCurl (url, http_version, &cbc);
+  if (0 != post_size)
+    {
+      post = malloc (post_size);
+      if (NULL == post)
+        abort ();
+      memset (post, 'x', post_size);
+      curl_easy_setopt (c, CURLOPT_POSTFIELDS, post);
+      curl_easy_setopt (c, CURLOPT_POSTFIELDSIZE, (long) post_size);
+    }
+  ret = 0;
+  if (CURLE_OK != (errornum = curl_easy_perform (c)))
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed: `%s'\n",
+               curl_easy_strerror (errornum));
+      ret = 1;
+    }
+  else if ( (CURLE_OK != curl_easy_getinfo (c, CURLINFO_HTTP_VERSION, &version)) ||
+            (CURL_HTTP_VERSION_2_0 != version) )
+    {
+      fprintf (stderr, "Request to %s did not use HTTP/2\n", url);
+      ret = 2;
+    }
+  else if (NULL == expected)
+    {
+      if (0 != checkBig (&cbc))
+        {
+          fprintf (stderr, "Wrong body for %s\n", url);
+          ret = 4;
+        }
+    }
+  else
+    {
+      cbc.buf[cbc.pos] = '\0';
+      if (0 != strcmp (cbc.buf, expected))
+        {
+          fprintf (stderr,
+                   "Got `%s' for %s, expected `%s'\n",
+                   cbc.buf,
+                   url,
+                   expected);
+          ret = 4;
+        }
+    }
+  curl_easy_cleanup (c);
+  free (post);
+  free (cbc.buf);
+  return ret;
+}
+
+/**
+ * Run the transfers of a multi handle to completion.
+ *
+ * @param multi the multi handle
+ * @return 0 on success
+ */
+static int
+runMulti (CURLM *multi)
+{
+  CURLMsg *msg;
+  int running;
+  int left;
+  int ret;
+
+  ret = 0;
+  do
+    {
+      if (CURLM_OK != curl_multi_perform (multi, &running))
+        return 1;
+      while (NULL != (msg = curl_multi_info_read (multi, &left)))
+        if ( (CURLMSG_DONE == msg->msg) &&
+             (CURLE_OK != msg->data.result) )
+          {
+            fprintf (stderr,
+                     "Multiplexed request failed: `%s'\n",
+                     curl_easy_strerror (msg->data.result));
+            ret = 1;
+          }
+      if (0 != running)
+        curl_multi_wait (multi, NULL, 0, 100, NULL);
+    }
+  while (0 != running);
+  return ret;
+}
+
+/**
+ * Perform #NUM_STREAMS requests at once, which curl multiplexes on
+ * a single connection.
+ *
+ * @return 0 on success
+ */
+static int
+doMultiplexed ()
+{
+  CURLM *multi;
+  CURL *c[NUM_STREAMS];
+  struct CBC cbc[NUM_STREAMS];
+  char url[64];
+  char expected[64];
+  long connects;
+  int ret;
+  unsigned int i;
+
+  multi = curl_multi_init ();
+  if (NULL == multi)
+    return 1;
+  curl_multi_setopt (multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  /* open the connection first (via "h2c", some versions of libcurl
+     fail to reuse connections opened with prior knowledge) */
+  cbc[0].size = BIG_SIZE + 1;
+  cbc[0].buf = malloc (cbc[0].size);
+  cbc[0].pos = 0;
+  if (NULL == cbc[0].buf)
+    abort ();
+  c[0] = setupCurl ("http://127.0.0.1:1080/s",
+                    CURL_HTTP_VERSION_2_0,
+                    &cbc[0]);
+  curl_multi_add_handle (multi, c[0]);
+  ret = runMulti (multi);
+  curl_multi_remove_handle (multi, c[0]);
+  curl_easy_cleanup (c[0]);
+  free (cbc[0].buf);
+  for (i = 0; i < NUM_STREAMS; i++)
+    {
+      cbc[i].size = BIG_SIZE + 1;
+      cbc[i].buf = malloc (cbc[i].size);
+      cbc[i].pos = 0;
+      if (NULL == cbc[i].buf)
+        abort ();
+      if (0 == i % 2)
+        snprintf (url, sizeof (url), "http://127.0.0.1:1080/big");
+      else
+        snprintf (url, sizeof (url), "http://127.0.0.1:1080/s?q=%u", i);
+      c[i] = setupCurl (url, CURL_HTTP_VERSION_2_0, &cbc[i]);
+      curl_easy_setopt (c[i], CURLOPT_PIPEWAIT, 1L);
+      curl_multi_add_handle (multi, c[i]);
+    }
+  ret |= runMulti (multi);
+  for (i = 0; i < NUM_STREAMS; i++)
+    {
+      if (0 == i % 2)
+        {
+          if (0 != checkBig (&cbc[i]))
+            {
+              fprintf (stderr, "Wrong body for stream %u\n", i);
+              ret |= 2;
+            }
+        }
+      else
+        {
+          snprintf (expected, sizeof (expected), "HTTP/2.0|/s|%u", i);
+          cbc[i].buf[cbc[i].pos] = '\0';
+          if (0 != strcmp (cbc[i].buf, expected))
+            {
+              fprintf (stderr,
+                       "Got `%s' for stream %u, expected `%s'\n",
+                       cbc[i].buf,
+                       i,
+                       expected);
+              ret |= 2;
+            }
+        }
+      if ( (CURLE_OK != curl_easy_getinfo (c[i], CURLINFO_NUM_CONNECTS, &connects)) ||
+           (0 != connects) )
+        {
+          fprintf (stderr, "Stream %u did not reuse the connection\n", i);
+          ret |= 4;
+        }
+      curl_multi_remove_handle (multi, c[i]);
+      curl_easy_cleanup (c[i]);
+      free (cbc[i].buf);
+    }
+  curl_multi_cleanup (multi);
+  return ret;
+}
+
+static int
+testHttp2 (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  unsigned int completed;
+  char expected[64];
+  int ret;
+
+  completed = 0;
+  d = MHD_start_daemon (flags | MHD_USE_HTTP2 | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_echo, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &request_completed, &completed,
+                        MHD_OPTION_END);
+  if (d == NULL)
+    return 1;
+  ret = 0;
+  ret |= doRequest ("http://127.0.0.1:1080/hello?q=%41b",
+                    CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE,
+                    0,
+                    "HTTP/2.0|/hello|Ab") * 2;
+  ret |= doRequest ("http://127.0.0.1:1080/big",
+                    CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE,
+                    0,
+                    NULL) * 8;
+  snprintf (expected, sizeof (expected), "%u", (unsigned int) POST_SIZE);
+  ret |= doRequest ("http://127.0.0.1:1080/post",
+                    CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE,
+                    POST_SIZE,
+                    expected) * 32;
+  /* upgrade from HTTP/1.1 via "h2c" */
+  ret |= doRequest ("http://127.0.0.1:1080/up?q=1",
+                    CURL_HTTP_VERSION_2_0,
+                    0,
+                    "HTTP/2.0|/up|1") * 128;
+  ret |= doMultiplexed () * 512;
+  MHD_stop_daemon (d);
+  if ( (0 == ret) &&
+       (5 + NUM_STREAMS != completed) )
+    {
+      fprintf (stderr,
+               "%u requests completed, expected %u\n",
+               completed,
+               5 + NUM_STREAMS);
+      ret |= 2048;
+    }
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+  curl_version_info_data *info;
+
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  info = curl_version_info (CURLVERSION_NOW);
+  if (0 == (info->features & CURL_VERSION_HTTP2))
+    {
+      fprintf (stderr, "libcurl lacks HTTP/2 support, skipping test\n");
+      curl_global_cleanup ();
+      return 77;
+    }
+  errorCount += testHttp2 (MHD_USE_SELECT_INTERNALLY);
+  errorCount += testHttp2 (MHD_USE_SELECT_INTERNALLY | MHD_USE_POLL);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += testHttp2 (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}
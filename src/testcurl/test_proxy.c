@@ -0,0 +1,533 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_proxy.c
+ * @brief  Testcase for #MHD_create_response_for_proxy()
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Size of the responses to "/big" and "/chunked".
+ */
+#define BIG_SIZE (256 * 1024)
+
+/**
+ * Size of the request body sent to "/post".
+ */
+#define POST_SIZE (200 * 1024)
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+};
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+static ssize_t
+big_reader (void *cls, uint64_t pos, char *buf, size_t max)
+{
+  size_t i;
+
+  if (pos >= BIG_SIZE)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > BIG_SIZE - pos)
+    max = BIG_SIZE - pos;
+  /* odd sizes make for many chunks of different lengths */
+  if (max > 1000)
+    max = 1000 + (size_t) (pos % 7);
+  for (i = 0; i < max; i++)
+    buf[i] = 'a' + (char) ((pos + i) % 26);
+  return max;
+}
+
+static ssize_t
+hello_reader (void *cls, uint64_t pos, char *buf, size_t max)
+{
+  if (pos >= 5)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  memcpy (buf, "hello", 5);
+  return 5;
+}
+
+/**
+ * Connections accepted by the upstream server.
+ */
+static unsigned int upstream_connections;
+
+static int
+count_connections (void *cls,
+                   const struct sockaddr *addr,
+                   socklen_t addrlen)
+{
+  upstream_connections++;
+  return MHD_YES;
+}
+
+/**
+ * Upstream server: respond to "/big" with #BIG_SIZE bytes of known
+ * length, to "/chunked" with the same data of unknown length, to
+ * "/post" with the number of bytes uploaded, to "/hop" with the
+ * "X-Hop" header of the request, to "/framing" with a chunked
+ * "hello" that also has a (wrong) "Content-Length" and hop-by-hop
+ * headers named in "Connection", and to anything else with the URL,
+ * the "q" argument and the "X-Forwarded-For" header of the request.
+ */
+static int
+ahc_upstream (void *cls,
+              struct MHD_Connection *connection,
+              const char *url,
+              const char *method,
+              const char *version,
+              const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  size_t *uploaded = *ptr;
+  struct MHD_Response *response;
+  const char *q;
+  const char *xff;
+  char buf[256];
+  int ret;
+
+  if (NULL == uploaded)
+    {
+      uploaded = malloc (sizeof (size_t));
+      if (NULL == uploaded)
+        return MHD_NO;
+      *uploaded = 0;
+      *ptr = uploaded;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      *uploaded += *upload_data_size;
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  if ( (0 == strcmp (url, "/big")) ||
+       (0 == strcmp (url, "/chunked")) )
+    {
+      response = MHD_create_response_from_callback (('b' == url[1])
+                                                    ? BIG_SIZE
+                                                    : MHD_SIZE_UNKNOWN,
+                                                    4096,
+                                                    &big_reader,
+                                                    NULL,
+                                                    NULL);
+    }
+  else if (0 == strcmp (url, "/framing"))
+    {
+      response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                    16,
+                                                    &hello_reader,
+                                                    NULL,
+                                                    NULL);
+      if (NULL == response)
+        return MHD_NO;
+      MHD_add_response_header (response,
+                               MHD_HTTP_HEADER_CONTENT_LENGTH,
+                               "100");
+      MHD_add_response_header (response,
+                               MHD_HTTP_HEADER_CONNECTION,
+                               "X-Up");
+      MHD_add_response_header (response, "X-Up", "1");
+      MHD_add_response_header (response, "X-Kept", "2");
+    }
+  else
+    {
+      if (0 == strcmp (url, "/post"))
+        snprintf (buf, sizeof (buf), "%u", (unsigned int) *uploaded);
+      else if (0 == strcmp (url, "/hop"))
+        {
+          q = MHD_lookup_connection_value (connection,
+                                           MHD_HEADER_KIND,
+                                           "X-Hop");
+          snprintf (buf, sizeof (buf), "%s", (NULL == q) ? "" : q);
+        }
+      else
+        {
+          q = MHD_lookup_connection_value (connection,
+                                           MHD_GET_ARGUMENT_KIND,
+                                           "q");
+          xff = MHD_lookup_connection_value (connection,
+                                             MHD_HEADER_KIND,
+                                             "X-Forwarded-For");
+          snprintf (buf,
+                    sizeof (buf),
+                    "%s|%s|%s",
+                    url,
+                    (NULL == q) ? "" : q,
+                    (NULL == xff) ? "" : xff);
+        }
+      response = MHD_create_response_from_buffer (strlen (buf),
+                                                  buf,
+                                                  MHD_RESPMEM_MUST_COPY);
+    }
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+/**
+ * Proxy: forward every request with the response in @a cls.
+ */
+static int
+ahc_proxy (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+  struct MHD_Response *response = cls;
+
+  return MHD_queue_response (connection,
+                             MHD_HTTP_BAD_GATEWAY,
+                             response);
+}
+
+static void
+request_completed (void *cls,
+                   struct MHD_Connection *connection,
+                   void **con_cls,
+                   enum MHD_RequestTerminationCode toe)
+{
+  free (*con_cls);
+  *con_cls = NULL;
+}
+
+static int
+checkBig (const struct CBC *cbc)
+{
+  size_t i;
+
+  if (BIG_SIZE != cbc->pos)
+    return 1;
+  for (i = 0; i < BIG_SIZE; i++)
+    if (cbc->buf[i] != 'a' + (char) (i % 26))
+      return 1;
+  return 0;
+}
+
+/**
+ * Perform a single request.
+ *
+ * @param c curl handle to use (keeps the connection open)
+ * @param url URL to request
+ * @param post_size number of bytes to POST, 0 for a GET
+ * @param expected expected response, NULL for the one of "/big"
+ * @param expected_code expected status code
+ * @return 0 on success
+ */
+static int
+doRequest (CURL *c,
+           const char *url,
+           size_t post_size,
+           const char *expected,
+           long expected_code)
+{
+  struct CBC cbc;
+  CURLcode errornum;
+  char *post;
+  long code;
+  int ret;
+
+  cbc.size = BIG_SIZE + 1;
+  cbc.buf = malloc (cbc.size);
+  cbc.pos = 0;
+  post = NULL;
+  if (NULL == cbc.buf)
+    return 1;
+  curl_easy_setopt (c, CURLOPT_URL, url);
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, &cbc);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1L);
+  if (0 != post_size)
+    {
+      post = malloc (post_size);
+      if (NULL == post)
+        abort ();
+      memset (post, 'x', post_size);
+      curl_easy_setopt (c, CURLOPT_POSTFIELDS, post);
+      curl_easy_setopt (c, CURLOPT_POSTFIELDSIZE, (long) post_size);
+    }
+  else
+    curl_easy_setopt (c, CURLOPT_HTTPGET, 1L);
+  ret = 0;
+  if (CURLE_OK != (errornum = curl_easy_perform (c)))
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed: `%s'\n",
+               curl_easy_strerror (errornum));
+      ret = 1;
+    }
+  else if ( (CURLE_OK != curl_easy_getinfo (c, CURLINFO_RESPONSE_CODE, &code)) ||
+            (expected_code != code) )
+    {
+      fprintf (stderr,
+               "Got status %ld for %s, expected %ld\n",
+               code,
+               url,
+               expected_code);
+      ret = 2;
+    }
+  else if (NULL == expected)
+    {
+      if (0 != checkBig (&cbc))
+        {
+          fprintf (stderr, "Wrong body for %s\n", url);
+          ret = 4;
+        }
+    }
+  else
+    {
+      cbc.buf[cbc.pos] = '\0';
+      if (0 != strcmp (cbc.buf, expected))
+        {
+          fprintf (stderr,
+                   "Got `%s' for %s, expected `%s'\n",
+                   cbc.buf,
+                   url,
+                   expected);
+          ret = 4;
+        }
+    }
+  free (post);
+  free (cbc.buf);
+  return ret;
+}
+
+static size_t
+copyHeader (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+  const char *line = ptr;
+
+  if ( (size * nmemb >= 15) &&
+       (0 == strncasecmp (line, "Content-Length:", 15)) )
+    cbc->pos |= 1;
+  if ( (size * nmemb >= 5) &&
+       (0 == strncasecmp (line, "X-Up:", 5)) )
+    cbc->pos |= 2;
+  if ( (size * nmemb >= 7) &&
+       (0 == strncasecmp (line, "X-Kept:", 7)) )
+    cbc->pos |= 4;
+  return size * nmemb;
+}
+
+/**
+ * Request "/framing" and check that the client gets the body and
+ * the end-to-end header without the upstream length or the headers
+ * named in the upstream "Connection" header.
+ *
+ * @param c curl handle to use
+ * @param http_version HTTP version for curl to use
+ * @return 0 on success
+ */
+static int
+doFramingRequest (CURL *c,
+                  long http_version)
+{
+  struct CBC hdr;
+  int ret;
+
+  hdr.buf = NULL;
+  hdr.pos = 0;
+  hdr.size = 0;
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, http_version);
+  curl_easy_setopt (c, CURLOPT_HEADERFUNCTION, &copyHeader);
+  curl_easy_setopt (c, CURLOPT_HEADERDATA, &hdr);
+  ret = doRequest (c,
+                   "http://127.0.0.1:1080/framing",
+                   0,
+                   "hello",
+                   MHD_HTTP_OK);
+  curl_easy_setopt (c, CURLOPT_HEADERFUNCTION, NULL);
+  curl_easy_setopt (c, CURLOPT_HEADERDATA, NULL);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_NONE);
+  if ( (0 == ret) &&
+       (4 != hdr.pos) )
+    {
+      fprintf (stderr,
+               "Wrong headers for /framing (%u)\n",
+               (unsigned int) hdr.pos);
+      ret = 4;
+    }
+  return ret;
+}
+
+static int
+testProxy (unsigned int flags)
+{
+  struct MHD_Daemon *upstream;
+  struct MHD_Daemon *d;
+  struct MHD_Response *response;
+  struct sockaddr_in addr;
+  struct curl_slist *headers;
+  CURL *c;
+  char expected[64];
+  int ret;
+
+  upstream_connections = 0;
+  upstream = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                               1081, &count_connections, NULL,
+                               &ahc_upstream, NULL,
+                               MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+                               MHD_OPTION_END);
+  if (NULL == upstream)
+    return 1;
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (1081);
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  response = MHD_create_response_for_proxy ((const struct sockaddr *) &addr,
+                                            sizeof (addr),
+                                            NULL);
+  if (NULL == response)
+    {
+      MHD_stop_daemon (upstream);
+      return 2;
+    }
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        1080, NULL, NULL, &ahc_proxy, response,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      MHD_destroy_response (response);
+      MHD_stop_daemon (upstream);
+      return 4;
+    }
+  c = curl_easy_init ();
+  ret = 0;
+  ret |= doRequest (c,
+                    "http://127.0.0.1:1080/hello%20world?q=%41b%26c",
+                    0,
+                    "/hello world|Ab&c|127.0.0.1",
+                    MHD_HTTP_OK) * 8;
+  ret |= doRequest (c,
+                    "http://127.0.0.1:1080/big",
+                    0,
+                    NULL,
+                    MHD_HTTP_OK) * 8;
+  ret |= doRequest (c,
+                    "http://127.0.0.1:1080/chunked",
+                    0,
+                    NULL,
+                    MHD_HTTP_OK) * 8;
+  snprintf (expected, sizeof (expected), "%u", (unsigned int) POST_SIZE);
+  ret |= doRequest (c,
+                    "http://127.0.0.1:1080/post",
+                    POST_SIZE,
+                    expected,
+                    MHD_HTTP_OK) * 8;
+  ret |= doRequest (c,
+                    "http://127.0.0.1:1080/again",
+                    0,
+                    "/again||127.0.0.1",
+                    MHD_HTTP_OK) * 8;
+  /* headers named in "Connection" are not forwarded */
+  headers = curl_slist_append (NULL, "Connection: X-Hop");
+  headers = curl_slist_append (headers, "X-Hop: 1");
+  curl_easy_setopt (c, CURLOPT_HTTPHEADER, headers);
+  ret |= doRequest (c,
+                    "http://127.0.0.1:1080/hop",
+                    0,
+                    "",
+                    MHD_HTTP_OK) * 256;
+  curl_slist_free_all (headers);
+  /* only "chunked" request bodies can be forwarded */
+  headers = curl_slist_append (NULL, "Transfer-Encoding: gzip");
+  curl_easy_setopt (c, CURLOPT_HTTPHEADER, headers);
+  ret |= doRequest (c,
+                    "http://127.0.0.1:1080/coded",
+                    0,
+                    "",
+                    MHD_HTTP_NOT_IMPLEMENTED) * 256;
+  curl_easy_setopt (c, CURLOPT_HTTPHEADER, NULL);
+  curl_slist_free_all (headers);
+  /* "Content-Length" and "Transfer-Encoding" from upstream */
+  ret |= doFramingRequest (c, CURL_HTTP_VERSION_1_1) * 256;
+  ret |= doFramingRequest (c, CURL_HTTP_VERSION_1_0) * 256;
+  curl_easy_cleanup (c);
+  if ( (0 == ret) &&
+       (1 != upstream_connections) )
+    {
+      fprintf (stderr,
+               "Upstream server got %u connections, expected 1\n",
+               upstream_connections);
+      ret |= 64;
+    }
+  /* the status of the queued response is used if the upstream
+     server is gone */
+  MHD_stop_daemon (upstream);
+  c = curl_easy_init ();
+  ret |= doRequest (c,
+                    "http://127.0.0.1:1080/gone",
+                    0,
+                    "",
+                    MHD_HTTP_BAD_GATEWAY) * 128;
+  curl_easy_cleanup (c);
+  MHD_stop_daemon (d);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  errorCount += testProxy (MHD_USE_SELECT_INTERNALLY);
+  errorCount += testProxy (MHD_USE_SELECT_INTERNALLY | MHD_USE_POLL);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += testProxy (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}